@@ -33,3 +33,95 @@ AC_DEFUN([FEATURE_RAPIDHASH_CHECK], [
 
     AM_CONDITIONAL([ENABLE_RAPIDHASH], [test "$enable_rapidhash" = "yes"])
 ])
+
+AC_DEFUN([FEATURE_ZLIB_CHECK], [
+    AS_IF([test "x$enable_compression" != "xno"], [
+        AC_CHECK_HEADER([zlib.h], [have_zlib_h=yes], [have_zlib_h=no])
+        AC_CHECK_LIB([z], [deflateInit2_], [have_libz=yes], [have_libz=no])
+
+        AS_IF([test "x$have_zlib_h" = "xyes" && test "x$have_libz" = "xyes"], [
+            enable_compression=yes
+            ZLIB_LIBS="-lz"
+            AC_DEFINE_UNQUOTED([FHTTPD_ENABLE_COMPRESSION], [1], [Enables on-the-fly response compression])
+        ], [
+            AS_IF([test "x$enable_compression" = "xyes"], [
+                AC_MSG_ERROR([zlib is required for compression support. Please install it or disable compression with --disable-compression.])
+            ])
+
+            enable_compression=no
+        ])
+    ])
+
+    AM_CONDITIONAL([ENABLE_COMPRESSION], [test "x$enable_compression" = "xyes"])
+    AC_SUBST([ZLIB_LIBS])
+])
+
+AC_DEFUN([FEATURE_OPENSSL_CHECK], [
+    AS_IF([test "x$enable_tls" != "xno"], [
+        PKG_CHECK_MODULES([OPENSSL], [libssl >= 3.0.0 libcrypto >= 3.0.0], [have_openssl=yes], [have_openssl=no])
+
+        AS_IF([test "x$have_openssl" = "xyes"], [
+            enable_tls=yes
+            AC_DEFINE_UNQUOTED([FHTTPD_ENABLE_TLS], [1], [Enables TLS listeners])
+            AC_SEARCH_LIBS([pthread_mutexattr_setrobust], [pthread], [], [
+                AC_MSG_ERROR([robust process-shared mutexes are required for the TLS session cache])
+            ])
+
+            save_CFLAGS="$CFLAGS"
+            CFLAGS="$CFLAGS $OPENSSL_CFLAGS"
+            AC_CHECK_DECLS([SSL_OP_ENABLE_KTLS, SSL_sendfile], [], [], [[#include <openssl/ssl.h>]])
+            CFLAGS="$save_CFLAGS"
+        ], [
+            AS_IF([test "x$enable_tls" = "xyes"], [
+                AC_MSG_ERROR([OpenSSL is required for TLS support. Please install it or disable TLS with --disable-tls.])
+            ])
+
+            enable_tls=no
+        ])
+    ])
+
+    AM_CONDITIONAL([ENABLE_TLS], [test "x$enable_tls" = "xyes"])
+    AC_SUBST([OPENSSL_CFLAGS])
+    AC_SUBST([OPENSSL_LIBS])
+])
+
+AC_DEFUN([FEATURE_HTTP3_CHECK], [
+    AS_IF([test "x$enable_http3" = "xyes"], [
+        AS_IF([test "x$enable_tls" != "xyes"], [
+            AC_MSG_ERROR([HTTP/3 requires TLS support. Please do not combine --enable-http3 with --disable-tls.])
+        ])
+
+        PKG_CHECK_MODULES([HTTP3], [libngtcp2 >= 1.0.0 libngtcp2_crypto_quictls >= 1.0.0 libnghttp3 >= 1.0.0], [], [
+            AC_MSG_ERROR([ngtcp2, its quictls crypto helper and nghttp3 are required for HTTP/3 support.])
+        ])
+
+        dnl Stock OpenSSL lacks the QUIC TLS API that ngtcp2 needs
+        save_CFLAGS="$CFLAGS"
+        CFLAGS="$CFLAGS $OPENSSL_CFLAGS"
+        AC_CHECK_DECL([SSL_set_quic_method], [], [
+            AC_MSG_ERROR([HTTP/3 requires an OpenSSL with the QUIC TLS API, such as quictls.])
+        ], [[#include <openssl/ssl.h>]])
+        CFLAGS="$save_CFLAGS"
+
+        AC_DEFINE_UNQUOTED([FHTTPD_ENABLE_HTTP3], [1], [Enables HTTP/3 listeners])
+    ])
+
+    AM_CONDITIONAL([ENABLE_HTTP3], [test "x$enable_http3" = "xyes"])
+    AC_SUBST([HTTP3_CFLAGS])
+    AC_SUBST([HTTP3_LIBS])
+])
+
+AC_DEFUN([FEATURE_USDT_CHECK], [
+    AS_IF([test "x$enable_usdt" != "xno"], [
+        AC_CHECK_HEADER([sys/sdt.h], [
+            enable_usdt=yes
+            AC_DEFINE_UNQUOTED([FHTTPD_ENABLE_USDT], [1], [Enables USDT static tracepoints])
+        ], [
+            AS_IF([test "x$enable_usdt" = "xyes"], [
+                AC_MSG_ERROR([<sys/sdt.h> is required for USDT probes. Please install the SystemTap SDT headers or disable them with --disable-usdt.])
+            ])
+
+            enable_usdt=no
+        ])
+    ])
+])
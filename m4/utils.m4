@@ -35,6 +35,10 @@ AC_DEFUN([PRINT_SUMMARY], [
   Main configuration file:   $FHTTPD_MAIN_CONFIG_FILE
   Module path:               $FHTTPD_MODULE_PATH
   Optional systemd support:  $enable_systemd
+  Compression support:       $enable_compression
+  TLS support:               $enable_tls
+  HTTP/3 support:            $enable_http3
+  USDT probes:               $enable_usdt
   Optional modules:          $enabled_modules
   Optimizations:             $enable_optimizations
 	])
@@ -0,0 +1,526 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FH_LOG_MODULE_NAME "accesslog"
+
+#include "accesslog.h"
+#include "compat.h"
+#include "conf.h"
+#include "conn.h"
+#include "hash/itable.h"
+#include "http/protocol.h"
+#include "log/log.h"
+#include "stats.h"
+
+/* Longest entry; longer URIs are cut */
+#define FH_ACCESS_ENTRY_MAX 8192
+
+struct fh_access_file
+{
+	char *path;
+	fd_t fd;
+	enum fh_access_format format;
+	/* The event loop appends to `active'; the writer swaps it with
+	   `spare' and writes that out, both under `lock' */
+	char *active;
+	size_t active_len;
+	char *spare;
+	/* When the oldest entry in `active' was added, in milliseconds */
+	uint64_t oldest;
+	struct fh_access_file *next;
+};
+
+static struct fh_access_file *files = NULL;
+static struct fh_access_file *default_file = NULL;
+/* (struct fh_config_host *) => (struct fh_access_file *) */
+static struct itable *host_files = NULL;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static pthread_t writer;
+static bool writer_started = false;
+static bool stopping = false;
+static volatile sig_atomic_t reopen_requested = 0;
+/* Entries that did not fit, not yet reported */
+static uint64_t dropped = 0;
+
+static uint64_t
+fh_access_clock_ms (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+}
+
+static bool
+fh_access_write_all (fd_t fd, const char *data, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t n = write (fd, data, len);
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			return false;
+		}
+
+		data += n;
+		len -= (size_t) n;
+	}
+
+	return true;
+}
+
+static fd_t
+fh_access_open (const char *path, enum fh_access_format format)
+{
+	fd_t fd = open (path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0640);
+	struct stat st;
+
+	if (fd < 0)
+		return -1;
+
+	if (format == FH_ACCESS_FORMAT_BINARY && fstat (fd, &st) == 0
+		&& st.st_size == 0
+		&& !fh_access_write_all (fd, FH_ACCESS_MAGIC, FH_ACCESS_MAGIC_LEN))
+	{
+		close (fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Runs on the writer thread, so that the event loop never waits for the
+   disk.  */
+static void
+fh_access_reopen (void)
+{
+	for (struct fh_access_file *file = files; file; file = file->next)
+	{
+		fd_t fd = fh_access_open (file->path, file->format);
+
+		/* Keeps writing to the old file otherwise */
+		if (fd < 0)
+			continue;
+
+		dup2 (fd, file->fd);
+		close (fd);
+	}
+}
+
+static void *
+fh_access_writer (void *arg __attribute_maybe_unused__)
+{
+	pthread_mutex_lock (&lock);
+
+	for (;;)
+	{
+		const uint64_t now = fh_access_clock_ms ();
+		uint64_t wait = FH_ACCESS_FLUSH_INTERVAL;
+		bool wrote = false;
+
+		if (reopen_requested)
+		{
+			reopen_requested = 0;
+			pthread_mutex_unlock (&lock);
+			fh_access_reopen ();
+			pthread_mutex_lock (&lock);
+		}
+
+		for (struct fh_access_file *file = files; file; file = file->next)
+		{
+			if (!file->active_len)
+				continue;
+
+			if (file->active_len < FH_ACCESS_BUF_SIZE / 2
+				&& now - file->oldest < FH_ACCESS_FLUSH_INTERVAL && !stopping)
+			{
+				/* Wakes up when the oldest entry is due */
+				if (file->oldest + FH_ACCESS_FLUSH_INTERVAL - now < wait)
+					wait = file->oldest + FH_ACCESS_FLUSH_INTERVAL - now;
+
+				continue;
+			}
+
+			char *buf = file->active;
+			const size_t len = file->active_len;
+
+			file->active = file->spare;
+			file->active_len = 0;
+			file->spare = buf;
+
+			pthread_mutex_unlock (&lock);
+			fh_access_write_all (file->fd, buf, len);
+			pthread_mutex_lock (&lock);
+			wrote = true;
+		}
+
+		if (wrote)
+			continue;
+
+		if (stopping)
+			break;
+
+		struct timespec ts;
+
+		clock_gettime (CLOCK_REALTIME, &ts);
+		ts.tv_nsec += (long) (wait % 1000) * 1000000L;
+		ts.tv_sec += (time_t) (wait / 1000) + ts.tv_nsec / 1000000000L;
+		ts.tv_nsec %= 1000000000L;
+		pthread_cond_timedwait (&cond, &lock, &ts);
+	}
+
+	pthread_mutex_unlock (&lock);
+	return NULL;
+}
+
+static struct fh_access_file *
+fh_access_file_get (const struct fh_config_logging *logging)
+{
+	if (!logging || !logging->access_file)
+		return NULL;
+
+	for (struct fh_access_file *file = files; file; file = file->next)
+	{
+		if (!strcmp (file->path, logging->access_file))
+			return file;
+	}
+
+	struct fh_access_file *file = calloc (1, sizeof (*file));
+
+	if (!file)
+		return NULL;
+
+	file->format = logging->access_format;
+	file->path = strdup (logging->access_file);
+	file->active = malloc (FH_ACCESS_BUF_SIZE);
+	file->spare = malloc (FH_ACCESS_BUF_SIZE);
+	file->fd = file->path ? fh_access_open (file->path, file->format) : -1;
+
+	if (file->fd < 0 || !file->active || !file->spare)
+	{
+		fh_pr_err ("Failed to open access log %s: %s", logging->access_file,
+				   strerror (errno));
+
+		if (file->fd >= 0)
+			close (file->fd);
+
+		free (file->active);
+		free (file->spare);
+		free (file->path);
+		free (file);
+		return NULL;
+	}
+
+	file->next = files;
+	files = file;
+	return file;
+}
+
+bool
+fh_access_log_init (const struct fh_config *config)
+{
+	if (config->logging && config->logging->access_file
+		&& !(default_file = fh_access_file_get (config->logging)))
+		return false;
+
+	for (struct strtable_entry *entry = config->hosts->head; entry;
+		 entry = entry->next)
+	{
+		const struct fh_config_host *host = entry->data;
+		struct fh_access_file *file;
+
+		if (!host->logging || !host->logging->access_file)
+			continue;
+
+		if (!(file = fh_access_file_get (host->logging)))
+			return false;
+
+		if (!host_files && !(host_files = itable_create (0)))
+			return false;
+
+		if (!itable_set (host_files, (uint64_t) (uintptr_t) host, file))
+			return false;
+	}
+
+	if (!files)
+		return true;
+
+	int err = pthread_create (&writer, NULL, &fh_access_writer, NULL);
+
+	if (err)
+	{
+		errno = err;
+		return false;
+	}
+
+	writer_started = true;
+	return true;
+}
+
+void
+fh_access_log_destroy (void)
+{
+	if (writer_started)
+	{
+		pthread_mutex_lock (&lock);
+		stopping = true;
+		pthread_cond_signal (&cond);
+		pthread_mutex_unlock (&lock);
+		pthread_join (writer, NULL);
+		writer_started = false;
+	}
+
+	while (files)
+	{
+		struct fh_access_file *next = files->next;
+
+		close (files->fd);
+		free (files->active);
+		free (files->spare);
+		free (files->path);
+		free (files);
+		files = next;
+	}
+
+	itable_destroy (host_files);
+	host_files = NULL;
+	default_file = NULL;
+}
+
+void
+fh_access_log_request_reopen (void)
+{
+	reopen_requested = 1;
+}
+
+void
+fh_access_log_check_reopen (void)
+{
+	if (!reopen_requested || !writer_started)
+		return;
+
+	/* Under the lock, so that the wakeup is not lost between the writer
+	   checking the flag and waiting */
+	pthread_mutex_lock (&lock);
+	pthread_cond_signal (&cond);
+	pthread_mutex_unlock (&lock);
+}
+
+/* Copies S as the contents of a JSON string */
+static size_t
+fh_access_json_escape (char *out, size_t room, const char *s, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	size_t n = 0;
+
+	for (size_t i = 0; i < len; i++)
+	{
+		const unsigned char c = (unsigned char) s[i];
+
+		if (c >= 0x20 && c != '"' && c != '\\' && c != 0x7f)
+		{
+			if (n + 1 > room)
+				break;
+
+			out[n++] = (char) c;
+		}
+		else if (c == '"' || c == '\\')
+		{
+			if (n + 2 > room)
+				break;
+
+			out[n++] = '\\';
+			out[n++] = (char) c;
+		}
+		else
+		{
+			if (n + 6 > room)
+				break;
+
+			memcpy (out + n, "\\u00", 4);
+			out[n + 4] = hex[c >> 4];
+			out[n + 5] = hex[c & 0xf];
+			n += 6;
+		}
+	}
+
+	return n;
+}
+
+static size_t
+fh_access_format_json (char *out, const struct fh_access_record *record,
+					   const char *host, const char *uri)
+{
+	/* Entries of the same second share the formatted date */
+	static time_t last_sec = -1;
+	static char date[32];
+	const time_t sec = (time_t) (record->time / 1000000);
+	char client[INET_ADDRSTRLEN] = "-";
+	struct in_addr addr = { .s_addr = record->client };
+
+	if (sec != last_sec)
+	{
+		struct tm tm;
+
+		gmtime_r (&sec, &tm);
+		strftime (date, sizeof (date), "%Y-%m-%dT%H:%M:%S", &tm);
+		last_sec = sec;
+	}
+
+	inet_ntop (AF_INET, &addr, client, sizeof (client));
+
+	/* Leaves room for the fields after the URI */
+	const size_t tail_room = 192;
+	int len = snprintf (out, FH_ACCESS_ENTRY_MAX,
+						"{\"time\":\"%s.%06luZ\",\"client\":\"%s\","
+						"\"host\":\"",
+						date, (unsigned long) (record->time % 1000000), client);
+	size_t n = (size_t) len;
+
+	n += fh_access_json_escape (out + n, 256, host, record->host_len);
+	n += (size_t) snprintf (out + n, FH_ACCESS_ENTRY_MAX - n,
+							"\",\"method\":\"%s\",\"uri\":\"",
+							record->method != FH_ACCESS_NO_METHOD
+								? fh_method_to_string (record->method)
+								: "-");
+	n += fh_access_json_escape (out + n, FH_ACCESS_ENTRY_MAX - n - tail_room,
+								uri, record->uri_len);
+	n += (size_t) snprintf (
+		out + n, FH_ACCESS_ENTRY_MAX - n,
+		"\",\"protocol\":\"%s\",\"status\":%u,\"bytes\":%lu,"
+		"\"duration_us\":%lu}\n",
+		fh_protocol_to_string (record->protocol), record->status,
+		(unsigned long) record->bytes, (unsigned long) record->duration);
+
+	return n;
+}
+
+static size_t
+fh_access_format_binary (char *out, struct fh_access_record *record,
+						 const char *host, const char *uri)
+{
+	const size_t room = FH_ACCESS_ENTRY_MAX - sizeof (*record);
+
+	if (record->host_len > room / 2)
+		record->host_len = (uint16_t) (room / 2);
+
+	if (record->uri_len > room - record->host_len)
+		record->uri_len = (uint32_t) (room - record->host_len);
+
+	memcpy (out, record, sizeof (*record));
+	memcpy (out + sizeof (*record), host, record->host_len);
+	memcpy (out + sizeof (*record) + record->host_len, uri, record->uri_len);
+	return sizeof (*record) + record->host_len + record->uri_len;
+}
+
+void
+fh_access_log (const struct fh_conn *conn, const struct fh_request *request,
+			   unsigned int status, uint64_t bytes,
+			   const struct fh_stats_timing *timing)
+{
+	if (!files)
+		return;
+
+	struct fh_access_file *file = NULL;
+
+	if (host_files && conn->config)
+		file = itable_get (host_files, (uint64_t) (uintptr_t) conn->config);
+
+	if (!file && !(file = default_file))
+		return;
+
+	struct timespec ts;
+	const uint64_t started = timing->at[FH_STATS_MARK_FIRST_BYTE]
+								 ? timing->at[FH_STATS_MARK_FIRST_BYTE]
+								 : timing->at[FH_STATS_MARK_ACCEPT];
+	const uint64_t now = fh_stats_clock ();
+	const char *host = request && request->host ? request->host
+												: conn->extra->host;
+	size_t host_len = request && request->host ? request->full_host_len
+											   : conn->extra->full_host_len;
+
+	if (!host)
+		host = "-", host_len = 1;
+
+	clock_gettime (CLOCK_REALTIME, &ts);
+
+	struct fh_access_record record = {
+		.time = (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000,
+		.duration = started && now > started ? now - started : 0,
+		.bytes = bytes,
+		.client = conn->client_addr ? conn->client_addr->sin_addr.s_addr : 0,
+		.client_port = conn->client_addr ? conn->client_addr->sin_port : 0,
+		.status = (uint16_t) status,
+		.host_len = (uint16_t) (host_len < UINT16_MAX ? host_len : UINT16_MAX),
+		.method = request ? request->method : FH_ACCESS_NO_METHOD,
+		.protocol = request ? request->protocol : conn->protocol,
+		.uri_len = request && request->uri ? (uint32_t) request->uri_len : 1,
+	};
+	const char *uri = request && request->uri ? request->uri : "-";
+	char entry[FH_ACCESS_ENTRY_MAX];
+	const size_t len
+		= file->format == FH_ACCESS_FORMAT_BINARY
+			  ? fh_access_format_binary (entry, &record, host, uri)
+			  : fh_access_format_json (entry, &record, host, uri);
+	uint64_t reported = 0;
+
+	pthread_mutex_lock (&lock);
+
+	if (file->active_len + len > FH_ACCESS_BUF_SIZE)
+	{
+		dropped++;
+		pthread_cond_signal (&cond);
+		pthread_mutex_unlock (&lock);
+		return;
+	}
+
+	if (!file->active_len)
+		file->oldest = fh_access_clock_ms ();
+
+	memcpy (file->active + file->active_len, entry, len);
+	file->active_len += len;
+
+	if (file->active_len >= FH_ACCESS_BUF_SIZE / 2)
+		pthread_cond_signal (&cond);
+
+	reported = dropped;
+	dropped = 0;
+	pthread_mutex_unlock (&lock);
+
+	if (unlikely (reported))
+		fh_pr_warn ("%lu access log entries were dropped",
+					(unsigned long) reported);
+}
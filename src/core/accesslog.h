@@ -0,0 +1,78 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FH_CORE_ACCESSLOG_H
+#define FH_CORE_ACCESSLOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Binary access logs start with this, followed by records, each a struct
+   fh_access_record in host byte order, the host and the URI.  */
+#define FH_ACCESS_MAGIC "FHACC\x01\r\n"
+#define FH_ACCESS_MAGIC_LEN 8
+/* Entries collected per file before they are written.  The buffer is
+   handed to the writer once half full, or after FH_ACCESS_FLUSH_INTERVAL
+   milliseconds.  */
+#define FH_ACCESS_BUF_SIZE 65536
+#define FH_ACCESS_FLUSH_INTERVAL 1000
+/* Method of records without a parsed request */
+#define FH_ACCESS_NO_METHOD 0xff
+
+struct fh_config;
+struct fh_conn;
+struct fh_request;
+struct fh_stats_timing;
+
+struct fh_access_record
+{
+	/* Microseconds since the epoch */
+	uint64_t time;
+	/* From the first byte of the request to the end of the response */
+	uint64_t duration;
+	/* Of the response body */
+	uint64_t bytes;
+	/* IPv4 address and port of the client, in network byte order */
+	uint32_t client;
+	uint16_t client_port;
+	uint16_t status;
+	uint16_t host_len;
+	/* enum fh_method and enum fh_protocol */
+	uint8_t method;
+	uint8_t protocol;
+	uint32_t uri_len;
+};
+
+/* Opens the access logs of the configuration and starts their writer
+   thread; called by each worker.  */
+bool fh_access_log_init (const struct fh_config *config);
+/* Writes out what is left, and closes the files.  */
+void fh_access_log_destroy (void);
+/* Logs a finished response.  REQUEST is NULL when the request could not
+   be parsed.  */
+void fh_access_log (const struct fh_conn *conn,
+					const struct fh_request *request, unsigned int status,
+					uint64_t bytes, const struct fh_stats_timing *timing);
+/* Called from signal handlers; the writer reopens the files, so that
+   rotated logs are released, once fh_access_log_check_reopen() wakes it
+   up from outside the handler.  */
+void fh_access_log_request_reopen (void);
+void fh_access_log_check_reopen (void);
+
+#endif /* FH_CORE_ACCESSLOG_H */
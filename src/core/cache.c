@@ -0,0 +1,1044 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#define FH_LOG_MODULE_NAME "cache"
+
+#include "cache.h"
+#include "compat.h"
+#include "conf.h"
+#include "conn.h"
+#include "http/http1_upstream.h"
+#include "http/protocol.h"
+#include "log/log.h"
+#include "mm/shmcache.h"
+#include "stream.h"
+
+enum fh_cache_entry_type
+{
+	FH_CACHE_ENTRY_RESPONSE = 1,
+	/* Points to the variants of a response, keyed by the values of the
+	   request headers that it varies on */
+	FH_CACHE_ENTRY_VARY,
+	FH_CACHE_ENTRY_PASS
+};
+
+struct fh_cache_control
+{
+	bool no_store : 1;
+	bool no_cache : 1;
+	bool private : 1;
+	int64_t max_age;
+	int64_t s_maxage;
+	int64_t stale_while_revalidate;
+};
+
+static struct fh_shm_cache *cache_index = NULL;
+static char *cache_path = NULL;
+static size_t cache_max_entry_size = 0;
+/* Keeps clients from picking keys whose IDs collide */
+static uint64_t cache_seed[2];
+
+static void
+fh_cache_hash (const char *key, size_t len, uint8_t *id)
+{
+	for (size_t i = 0; i < 2; i++)
+	{
+		uint64_t hash = 0xcbf29ce484222325ULL ^ cache_seed[i];
+
+		for (size_t j = 0; j < len; j++)
+		{
+			hash ^= (uint8_t) key[j];
+			hash *= 0x100000001b3ULL;
+		}
+
+		memcpy (id + i * sizeof (hash), &hash, sizeof (hash));
+	}
+}
+
+static void
+fh_cache_file_path (char *buf, const uint8_t *id, const char *suffix)
+{
+	char *p = buf + sprintf (buf, "%s/", cache_path);
+
+	for (size_t i = 0; i < FH_CACHE_ID_LEN; i++)
+		p += sprintf (p, "%02x", id[i]);
+
+	strcpy (p, suffix);
+}
+
+static void
+fh_cache_evicted (const void *key, size_t key_len, const void *value,
+				  size_t value_len)
+{
+	uint8_t type;
+	char path[PATH_MAX];
+
+	/* Locks have longer keys, and the value is not aligned.  */
+	if (key_len != FH_CACHE_ID_LEN
+		|| value_len < offsetof (struct fh_cache_meta, vary))
+		return;
+
+	memcpy (&type, (const uint8_t *) value + offsetof (struct fh_cache_meta, type),
+			sizeof type);
+
+	if (type != FH_CACHE_ENTRY_RESPONSE)
+		return;
+
+	fh_cache_file_path (path, key, "");
+	unlink (path);
+}
+
+/* Removes what a previous run left behind, which the new index knows
+   nothing about.  */
+static void
+fh_cache_clean_dir (const char *path)
+{
+	DIR *dir = opendir (path);
+	struct dirent *entry;
+
+	if (!dir)
+		return;
+
+	while ((entry = readdir (dir)))
+	{
+		const size_t len = strlen (entry->d_name);
+		size_t hex = 0;
+
+		while (hex < len && strchr ("0123456789abcdef", entry->d_name[hex]))
+			hex++;
+
+		if (hex == 2 * FH_CACHE_ID_LEN
+			&& (len == hex || (len > 4 && !strcmp (entry->d_name + len - 4, ".tmp"))))
+			unlinkat (dirfd (dir), entry->d_name, 0);
+	}
+
+	closedir (dir);
+}
+
+bool
+fh_cache_shared_init (const struct fh_config *config)
+{
+	const struct fh_config_cache *cache = config->cache;
+	bool used = false;
+
+	for (struct strtable_entry *entry = config->hosts->head; entry && !used;
+		 entry = entry->next)
+	{
+		const struct fh_config_host *host = entry->data;
+
+		for (const struct fh_config_proxy *proxy = host->proxies;
+			 proxy && !used; proxy = proxy->next)
+			used = proxy->cache;
+	}
+
+	if (!used || !cache->path)
+		return true;
+
+	if (strlen (cache->path) + 2 * FH_CACHE_ID_LEN + 32 >= PATH_MAX)
+	{
+		fh_pr_err ("Cache path is too long");
+		return false;
+	}
+
+	if (mkdir (cache->path, 0700) < 0 && errno != EEXIST)
+	{
+		fh_pr_err ("Failed to create the cache directory %s: %s", cache->path,
+				   strerror (errno));
+		return false;
+	}
+
+	fh_cache_clean_dir (cache->path);
+
+	if (getrandom (cache_seed, sizeof cache_seed, 0) != sizeof cache_seed)
+		return false;
+
+	cache_index
+		= fh_shm_cache_create (cache->index_size, sizeof (struct fh_cache_meta));
+
+	if (!cache_index || !(cache_path = strdup (cache->path)))
+	{
+		fh_pr_err ("Failed to create the cache index: %s", strerror (errno));
+		fh_cache_shared_destroy ();
+		return false;
+	}
+
+	fh_shm_cache_set_evict_cb (cache_index, &fh_cache_evicted);
+	cache_max_entry_size = cache->max_entry_size;
+	return true;
+}
+
+void
+fh_cache_shared_destroy (void)
+{
+	fh_shm_cache_destroy (cache_index);
+	cache_index = NULL;
+	free (cache_path);
+	cache_path = NULL;
+}
+
+static int64_t
+fh_cache_parse_seconds (const char *value, size_t len)
+{
+	int64_t seconds = 0;
+
+	if (!len)
+		return -1;
+
+	for (size_t i = 0; i < len; i++)
+	{
+		if (value[i] < '0' || value[i] > '9')
+			return -1;
+
+		/* Anything beyond a year or so is as good as forever.  */
+		if (seconds < INT32_MAX)
+			seconds = seconds * 10 + (value[i] - '0');
+	}
+
+	return seconds;
+}
+
+#define fh_cache_token_is(p, len, str)                                         \
+	((len) == sizeof (str) - 1 && !strncasecmp ((p), (str), sizeof (str) - 1))
+
+static void
+fh_cache_parse_control (const char *value, size_t len,
+						struct fh_cache_control *cc)
+{
+	const char *end = value + len;
+
+	while (value < end)
+	{
+		while (value < end && (*value == ' ' || *value == '\t' || *value == ','))
+			value++;
+
+		const char *name = value;
+
+		while (value < end && *value != ',' && *value != '=' && *value != ' ')
+			value++;
+
+		const size_t name_len = (size_t) (value - name);
+		const char *arg = NULL;
+		size_t arg_len = 0;
+
+		if (value < end && *value == '=')
+		{
+			arg = ++value;
+
+			while (value < end && *value != ',' && *value != ' ')
+				value++;
+
+			arg_len = (size_t) (value - arg);
+
+			if (arg_len >= 2 && arg[0] == '"' && arg[arg_len - 1] == '"')
+			{
+				arg++;
+				arg_len -= 2;
+			}
+		}
+
+		while (value < end && *value != ',')
+			value++;
+
+		if (fh_cache_token_is (name, name_len, "no-store"))
+			cc->no_store = true;
+		else if (fh_cache_token_is (name, name_len, "no-cache"))
+			cc->no_cache = true;
+		else if (fh_cache_token_is (name, name_len, "private"))
+			cc->private = true;
+		else if (fh_cache_token_is (name, name_len, "max-age"))
+			cc->max_age = fh_cache_parse_seconds (arg, arg_len);
+		else if (fh_cache_token_is (name, name_len, "s-maxage"))
+			cc->s_maxage = fh_cache_parse_seconds (arg, arg_len);
+		else if (fh_cache_token_is (name, name_len, "stale-while-revalidate"))
+			cc->stale_while_revalidate = fh_cache_parse_seconds (arg, arg_len);
+	}
+}
+
+static void
+fh_cache_control_init (struct fh_cache_control *cc)
+{
+	memset (cc, 0, sizeof (*cc));
+	cc->max_age = cc->s_maxage = cc->stale_while_revalidate = -1;
+}
+
+struct fh_cache_req *
+fh_cache_req_create (pool_t *pool, const struct fh_request *request)
+{
+	struct fh_cache_control cc;
+
+	if (!cache_index || !request->uri || !request->host
+		|| (request->method != FH_METHOD_GET
+			&& request->method != FH_METHOD_HEAD))
+		return NULL;
+
+	fh_cache_control_init (&cc);
+
+	for (const struct fh_header *h = request->headers.head; h; h = h->next)
+	{
+		if (fh_cache_token_is (h->name, h->name_len, "Authorization"))
+			return NULL;
+
+		if (fh_cache_token_is (h->name, h->name_len, "Cache-Control")
+			|| fh_cache_token_is (h->name, h->name_len, "Pragma"))
+			fh_cache_parse_control (h->value, h->value_len, &cc);
+	}
+
+	if (cc.no_store || cc.no_cache)
+		return NULL;
+
+	struct fh_cache_req *req = fh_pool_zalloc (pool, sizeof (*req));
+	const char *scheme
+		= request->conn && request->conn->ssl ? "https" : "http";
+	const size_t size = 4 + strlen (scheme) + 3 + request->full_host_len
+						+ request->uri_len + 1;
+
+	if (!req || !(req->key = fh_pool_alloc (pool, size)))
+		return NULL;
+
+	/* HEAD requests are answered from GET responses.  */
+	req->key_len = req->primary_len
+		= (size_t) snprintf (req->key, size, "GET %s://%.*s%.*s", scheme,
+							 (int) request->full_host_len, request->host,
+							 (int) request->uri_len, request->uri);
+	req->pool = pool;
+	req->request = request;
+	req->fd = -1;
+	req->max_entry_size = cache_max_entry_size;
+	fh_cache_hash (req->key, req->key_len, req->id);
+	memcpy (req->primary_id, req->id, FH_CACHE_ID_LEN);
+	return req;
+}
+
+/* Extends the key with the values of the request headers named in
+   `names'.  */
+static bool
+fh_cache_req_vary (struct fh_cache_req *req, const char *names,
+				   size_t names_len)
+{
+	const struct fh_headers *headers = &req->request->headers;
+	size_t size = req->primary_len + 1;
+
+	for (size_t i = 0; i < names_len;)
+	{
+		const char *comma = memchr (names + i, ',', names_len - i);
+		const size_t len
+			= (comma ? (size_t) (comma - names) : names_len) - i;
+		const struct fh_header *h = fh_header_get (headers, names + i, len);
+
+		size += 1 + len + 2 + (h ? h->value_len : 0);
+		i += len + 1;
+	}
+
+	char *key = fh_pool_alloc (req->pool, size);
+
+	if (!key)
+		return false;
+
+	char *p = key + req->primary_len;
+
+	memcpy (key, req->key, req->primary_len);
+
+	for (size_t i = 0; i < names_len;)
+	{
+		const char *comma = memchr (names + i, ',', names_len - i);
+		const size_t len
+			= (comma ? (size_t) (comma - names) : names_len) - i;
+		const struct fh_header *h = fh_header_get (headers, names + i, len);
+
+		*p++ = '\n';
+		memcpy (p, names + i, len);
+		p += len;
+		*p++ = ':';
+		*p++ = ' ';
+
+		if (h)
+		{
+			memcpy (p, h->value, h->value_len);
+			p += h->value_len;
+		}
+
+		i += len + 1;
+	}
+
+	*p = 0;
+	req->key = key;
+	req->key_len = (size_t) (p - key);
+	fh_cache_hash (req->key, req->key_len, req->id);
+	return true;
+}
+
+enum fh_cache_status
+fh_cache_lookup (struct fh_cache_req *req, time_t now)
+{
+	size_t len = sizeof (req->meta);
+
+	req->key_len = req->primary_len;
+	memcpy (req->id, req->primary_id, FH_CACHE_ID_LEN);
+
+	if (!fh_shm_cache_get (cache_index, req->id, FH_CACHE_ID_LEN, &req->meta,
+						   &len, now))
+		return FH_CACHE_MISS;
+
+	if (req->meta.type == FH_CACHE_ENTRY_VARY)
+	{
+		if (!fh_cache_req_vary (req, req->meta.vary, req->meta.vary_len))
+			return FH_CACHE_PASS;
+
+		len = sizeof (req->meta);
+
+		if (!fh_shm_cache_get (cache_index, req->id, FH_CACHE_ID_LEN,
+							   &req->meta, &len, now))
+			return FH_CACHE_MISS;
+	}
+
+	switch (req->meta.type)
+	{
+		case FH_CACHE_ENTRY_RESPONSE:
+			return now < req->meta.fresh_until ? FH_CACHE_HIT : FH_CACHE_STALE;
+
+		case FH_CACHE_ENTRY_PASS:
+			return FH_CACHE_PASS;
+
+		default:
+			return FH_CACHE_MISS;
+	}
+}
+
+static void
+fh_cache_lock_key (uint8_t *key, const uint8_t *id)
+{
+	memcpy (key, id, FH_CACHE_ID_LEN);
+	key[FH_CACHE_ID_LEN] = 'L';
+}
+
+bool
+fh_cache_lock (struct fh_cache_req *req, time_t now)
+{
+	uint8_t key[FH_CACHE_ID_LEN + 1];
+	const pid_t pid = getpid ();
+
+	if (req->locked)
+		return true;
+
+	if (req->request->method != FH_METHOD_GET)
+		return false;
+
+	fh_cache_lock_key (key, req->id);
+
+	if (!fh_shm_cache_add (cache_index, key, sizeof key, &pid, sizeof pid,
+						   now + FH_CACHE_LOCK_TIMEOUT, now))
+		return false;
+
+	memcpy (req->lock_id, req->id, FH_CACHE_ID_LEN);
+	req->locked = true;
+	return true;
+}
+
+static void
+fh_cache_unlock (struct fh_cache_req *req)
+{
+	uint8_t key[FH_CACHE_ID_LEN + 1];
+
+	if (!req->locked)
+		return;
+
+	fh_cache_lock_key (key, req->lock_id);
+	fh_shm_cache_remove (cache_index, key, sizeof key);
+	req->locked = false;
+}
+
+bool
+fh_cache_serve (struct fh_cache_req *req, struct fh_response *response,
+				const char *tag, time_t now)
+{
+	const struct fh_cache_meta *meta = &req->meta;
+	struct fh_headers *headers = fh_response_get_headers (response);
+	struct fh_http1_response_head head;
+	char path[PATH_MAX];
+
+	fh_cache_file_path (path, req->id, "");
+
+	fd_t fd = open (path, O_RDONLY | O_CLOEXEC);
+	char *buf = fh_pool_alloc (response->pool, meta->head_len);
+
+	if (fd < 0)
+	{
+		fh_shm_cache_remove (cache_index, req->id, FH_CACHE_ID_LEN);
+		return false;
+	}
+
+	/* The key in front of the head tells IDs that collide apart.  */
+	if (!headers || !buf
+		|| pread (fd, buf, meta->head_len, 0) != (ssize_t) meta->head_len
+		|| meta->head_len <= req->key_len || buf[req->key_len] != '\n'
+		|| memcmp (buf, req->key, req->key_len)
+		|| fh_http1_parse_cgi_head (response->pool, buf + req->key_len + 1,
+									meta->head_len - req->key_len - 1, &head)
+			   != 1)
+	{
+		close (fd);
+		return false;
+	}
+
+	for (const struct fh_header *h = head.headers.head; h; h = h->next)
+	{
+		if (fh_cache_token_is (h->name, h->name_len, "Content-Type"))
+		{
+			response->content_type = h->value;
+			response->content_type_len = h->value_len;
+		}
+		else if (!fh_cache_token_is (h->name, h->name_len, "Status")
+				 && !fh_cache_token_is (h->name, h->name_len, "Age")
+				 && !fh_header_add (response->pool, headers, h->name,
+									h->name_len, h->value, h->value_len))
+		{
+			close (fd);
+			return false;
+		}
+	}
+
+	if (!fh_header_addf (response->pool, headers, "Age", 3, "%ld",
+						 (long) (now - meta->stored))
+		|| !fh_header_add (response->pool, headers, "X-Cache", 7, tag,
+						   strlen (tag)))
+	{
+		close (fd);
+		return false;
+	}
+
+	response->status = head.status;
+	response->reason = head.reason_len ? head.reason : NULL;
+	response->reason_len = head.reason_len;
+	response->content_encoding = FH_CONTENT_ENCODING_IDENTITY;
+	response->encoding = FH_ENCODING_PLAIN;
+	response->content_length = meta->body_len;
+	response->use_default_error_response = false;
+	response->headers_pending = false;
+	response->pull = NULL;
+	response->body_start = NULL;
+
+	if (req->request->method == FH_METHOD_HEAD || !meta->body_len)
+	{
+		response->no_send_body = req->request->method == FH_METHOD_HEAD;
+		close (fd);
+		return true;
+	}
+
+	struct fh_link *link = fh_pool_alloc (
+		response->pool, sizeof (struct fh_link) + sizeof (struct fh_buf));
+
+	if (!link)
+	{
+		close (fd);
+		return false;
+	}
+
+	/* Sent with sendfile(), like static files */
+	link->buf = (struct fh_buf *) (link + 1);
+	link->buf->type = FH_BUF_FILE;
+	link->buf->freeable = false;
+	link->buf->attrs.file.file_fd = fd;
+	link->buf->attrs.file.file_off = meta->head_len;
+	link->buf->attrs.file.file_len = meta->body_len;
+	link->next = NULL;
+	link->is_eos = true;
+	link->is_start = false;
+	response->body_start = link;
+	return true;
+}
+
+static bool
+fh_cache_write_all (fd_t fd, const void *data, size_t len)
+{
+	while (len)
+	{
+		ssize_t wrote = write (fd, data, len);
+
+		if (wrote < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			return false;
+		}
+
+		data = (const uint8_t *) data + wrote;
+		len -= (size_t) wrote;
+	}
+
+	return true;
+}
+
+/* Remembers that responses for the key cannot be cached, so that
+   requests for it neither wait nor fetch one at a time.  */
+static void
+fh_cache_pass (struct fh_cache_req *req, time_t now)
+{
+	struct fh_cache_meta meta = {
+		.type = FH_CACHE_ENTRY_PASS,
+	};
+
+	fh_shm_cache_set (cache_index, req->id, FH_CACHE_ID_LEN, &meta,
+					  offsetof (struct fh_cache_meta, vary),
+					  now + FH_CACHE_PASS_TTL);
+	fh_cache_unlock (req);
+}
+
+static bool
+fh_cache_status_is_cacheable (uint16_t status)
+{
+	switch (status)
+	{
+		case 200:
+		case 203:
+		case 204:
+		case 300:
+		case 301:
+		case 308:
+		case 404:
+		case 410:
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+static time_t
+fh_cache_parse_date (const char *value, size_t len)
+{
+	char buf[64];
+	struct tm tm = { 0 };
+
+	if (len >= sizeof buf)
+		return 0;
+
+	memcpy (buf, value, len);
+	buf[len] = 0;
+
+	const char *end = strptime (buf, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	return end && !*end ? timegm (&tm) : 0;
+}
+
+/* Appends the lowercased names of a Vary header to `vary'.  Returns false
+   for `*' or when there are too many.  */
+static bool
+fh_cache_add_vary (char *vary, size_t *vary_len, const char *value,
+				   size_t len)
+{
+	const char *end = value + len;
+
+	while (value < end)
+	{
+		while (value < end && (*value == ' ' || *value == '\t' || *value == ','))
+			value++;
+
+		const char *name = value;
+
+		while (value < end && *value != ',' && *value != ' '
+			   && *value != '\t')
+			value++;
+
+		const size_t name_len = (size_t) (value - name);
+
+		if (!name_len)
+			continue;
+
+		if (name[0] == '*' || *vary_len + name_len + 1 > FH_CACHE_VARY_MAX)
+			return false;
+
+		if (*vary_len)
+			vary[(*vary_len)++] = ',';
+
+		for (size_t i = 0; i < name_len; i++)
+			vary[(*vary_len)++] = (char) (name[i] >= 'A' && name[i] <= 'Z'
+											  ? name[i] + 32
+											  : name[i]);
+	}
+
+	return true;
+}
+
+bool
+fh_cache_store_begin (struct fh_cache_req *req,
+					  const struct fh_config_proxy *config,
+					  const struct fh_response *response, time_t now)
+{
+	struct fh_cache_control cc;
+	bool cacheable = fh_cache_status_is_cacheable (response->status);
+	char vary[FH_CACHE_VARY_MAX];
+	size_t vary_len = 0;
+	time_t expires = 0;
+	bool has_expires = false;
+	size_t head_size = req->key_len + 1 + 16 + response->reason_len + 2
+					   + (response->content_type
+							  ? 14 + response->content_type_len + 2
+							  : 0)
+					   + 2;
+
+	if (!req->locked)
+		return false;
+
+	fh_cache_control_init (&cc);
+
+	for (const struct fh_header *h = response->headers ? response->headers->head
+													   : NULL;
+		 h; h = h->next)
+	{
+		head_size += h->name_len + 2 + h->value_len + 2;
+
+		if (fh_cache_token_is (h->name, h->name_len, "Cache-Control"))
+			fh_cache_parse_control (h->value, h->value_len, &cc);
+		else if (fh_cache_token_is (h->name, h->name_len, "Expires")
+				 && !has_expires)
+		{
+			/* Invalid dates mean the past.  */
+			expires = fh_cache_parse_date (h->value, h->value_len);
+			has_expires = true;
+		}
+		else if (fh_cache_token_is (h->name, h->name_len, "Set-Cookie"))
+			cacheable = false;
+		else if (fh_cache_token_is (h->name, h->name_len, "Vary")
+				 && !fh_cache_add_vary (vary, &vary_len, h->value,
+										h->value_len))
+			cacheable = false;
+	}
+
+	const int64_t ttl = cc.s_maxage >= 0  ? cc.s_maxage
+						: cc.max_age >= 0 ? cc.max_age
+						: has_expires	  ? (int64_t) (expires - now)
+										  : (int64_t) config->cache_valid;
+
+	if (!cacheable || cc.no_store || cc.no_cache || cc.private || ttl <= 0)
+	{
+		fh_cache_pass (req, now);
+		return false;
+	}
+
+	if (vary_len)
+	{
+		if (!fh_cache_req_vary (req, vary, vary_len))
+		{
+			fh_cache_unlock (req);
+			return false;
+		}
+
+		/* The names go to the entry of the primary key.  */
+		memcpy (req->meta.vary, vary, vary_len);
+		req->meta.vary_len = (uint16_t) vary_len;
+		req->vary = true;
+		head_size += req->key_len - req->primary_len;
+	}
+
+	char *head = fh_pool_alloc (req->pool, head_size);
+	char path[PATH_MAX];
+
+	if (!head || !(req->tmp_path = fh_pool_alloc (req->pool, PATH_MAX)))
+	{
+		fh_cache_unlock (req);
+		return false;
+	}
+
+	snprintf (path, sizeof path, ".%d.tmp", (int) getpid ());
+	fh_cache_file_path (req->tmp_path, req->id, path);
+
+	char *p = head;
+
+	memcpy (p, req->key, req->key_len);
+	p += req->key_len;
+	p += sprintf (p, "\nStatus: %u ", response->status);
+
+	if (response->reason)
+	{
+		memcpy (p, response->reason, response->reason_len);
+		p += response->reason_len;
+	}
+
+	p = stpcpy (p, "\r\n");
+
+	if (response->content_type)
+	{
+		p = stpcpy (p, "Content-Type: ");
+		memcpy (p, response->content_type, response->content_type_len);
+		p = stpcpy (p + response->content_type_len, "\r\n");
+	}
+
+	for (const struct fh_header *h = response->headers ? response->headers->head
+													   : NULL;
+		 h; h = h->next)
+	{
+		memcpy (p, h->name, h->name_len);
+		p = stpcpy (p + h->name_len, ": ");
+		memcpy (p, h->value, h->value_len);
+		p = stpcpy (p + h->value_len, "\r\n");
+	}
+
+	p = stpcpy (p, "\r\n");
+
+	req->fd = open (req->tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+					0600);
+
+	if (req->fd < 0 || !fh_cache_write_all (req->fd, head, (size_t) (p - head)))
+	{
+		fh_pr_err ("Failed to write %s: %s", req->tmp_path, strerror (errno));
+
+		if (req->fd >= 0)
+		{
+			close (req->fd);
+			unlink (req->tmp_path);
+			req->fd = -1;
+		}
+
+		fh_cache_unlock (req);
+		return false;
+	}
+
+	req->meta.type = FH_CACHE_ENTRY_RESPONSE;
+	req->meta.stored = now;
+	req->meta.fresh_until = now + ttl;
+	req->meta.stale_until
+		= req->meta.fresh_until
+		  + (cc.stale_while_revalidate > 0 ? cc.stale_while_revalidate : 0);
+	req->meta.head_len = (uint32_t) (p - head);
+	req->written = 0;
+	req->storing = true;
+	return true;
+}
+
+static void
+fh_cache_store_abort (struct fh_cache_req *req)
+{
+	close (req->fd);
+	unlink (req->tmp_path);
+	req->fd = -1;
+	req->storing = false;
+	fh_cache_unlock (req);
+}
+
+bool
+fh_cache_store_write (struct fh_cache_req *req, const struct fh_link *link)
+{
+	for (; link && req->storing; link = link->next)
+	{
+		const size_t len = fh_link_size (link);
+
+		if (link->buf->type != FH_BUF_DATA
+			|| (req->written += len) > req->max_entry_size
+			|| !fh_cache_write_all (req->fd, link->buf->attrs.mem.data, len))
+			fh_cache_store_abort (req);
+
+		if (link->is_eos)
+			break;
+	}
+
+	return req->storing;
+}
+
+void
+fh_cache_finish (struct fh_cache_req *req, bool complete)
+{
+	char path[PATH_MAX];
+
+	if (req->storing && !complete)
+		fh_cache_store_abort (req);
+
+	if (req->storing)
+	{
+		struct fh_cache_meta *meta = &req->meta;
+		const uint16_t vary_len = meta->vary_len;
+
+		close (req->fd);
+		req->fd = -1;
+		req->storing = false;
+		fh_cache_file_path (path, req->id, "");
+		meta->body_len = req->written;
+		meta->vary_len = 0;
+
+		if (rename (req->tmp_path, path) < 0)
+		{
+			fh_pr_err ("Failed to rename %s: %s", req->tmp_path,
+					   strerror (errno));
+			unlink (req->tmp_path);
+		}
+		else if (fh_shm_cache_set (cache_index, req->id, FH_CACHE_ID_LEN, meta,
+								   offsetof (struct fh_cache_meta, vary),
+								   meta->stale_until)
+				 && req->vary)
+		{
+			meta->type = FH_CACHE_ENTRY_VARY;
+			meta->vary_len = vary_len;
+			fh_shm_cache_set (cache_index, req->primary_id, FH_CACHE_ID_LEN,
+							  meta,
+							  offsetof (struct fh_cache_meta, vary) + vary_len,
+							  meta->stale_until);
+		}
+	}
+
+	fh_cache_unlock (req);
+}
+
+struct fh_cache *
+fh_cache_create (xpoll_t xpoll_fd)
+{
+	struct fh_cache *cache = calloc (1, sizeof (*cache));
+
+	if (!cache)
+		return NULL;
+
+	cache->xpoll_fd = xpoll_fd;
+	cache->timerfd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+	if (cache->timerfd < 0 || !xpoll_add (xpoll_fd, cache->timerfd, XPOLLIN, 0))
+	{
+		fh_cache_destroy (cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+void
+fh_cache_destroy (struct fh_cache *cache)
+{
+	if (!cache)
+		return;
+
+	if (cache->timerfd >= 0)
+	{
+		xpoll_del (cache->xpoll_fd, cache->timerfd, XPOLLIN);
+		close (cache->timerfd);
+	}
+
+	free (cache);
+}
+
+static bool
+fh_cache_arm (struct fh_cache *cache, bool armed)
+{
+	const long nsec = armed ? FH_CACHE_WAIT_INTERVAL * 1000000L : 0;
+	const struct itimerspec spec = {
+		.it_interval = { .tv_sec = 0, .tv_nsec = nsec },
+		.it_value = { .tv_sec = 0, .tv_nsec = nsec },
+	};
+
+	if (timerfd_settime (cache->timerfd, 0, &spec, NULL) < 0)
+	{
+		fh_pr_err ("timerfd_settime() failed: %s", strerror (errno));
+		return false;
+	}
+
+	cache->armed = armed;
+	return true;
+}
+
+static void
+fh_cache_waiter_push (struct fh_cache_waiter **list,
+					  struct fh_cache_waiter *waiter)
+{
+	waiter->list = list;
+	waiter->prev = NULL;
+	waiter->next = *list;
+
+	if (*list)
+		(*list)->prev = waiter;
+
+	*list = waiter;
+}
+
+bool
+fh_cache_wait (struct fh_cache *cache, struct fh_cache_waiter *waiter)
+{
+	if (!cache->armed && !fh_cache_arm (cache, true))
+		return false;
+
+	fh_cache_cancel_wait (cache, waiter);
+	fh_cache_waiter_push (&cache->waiting, waiter);
+	return true;
+}
+
+void
+fh_cache_cancel_wait (struct fh_cache *cache, struct fh_cache_waiter *waiter)
+{
+	(void) cache;
+
+	if (!waiter->list)
+		return;
+
+	if (waiter->prev)
+		waiter->prev->next = waiter->next;
+	else
+		*waiter->list = waiter->next;
+
+	if (waiter->next)
+		waiter->next->prev = waiter->prev;
+
+	waiter->list = NULL;
+	waiter->prev = waiter->next = NULL;
+}
+
+bool
+fh_cache_handle_event (struct fh_cache *cache, fd_t fd, uint32_t events)
+{
+	uint64_t expirations;
+
+	(void) events;
+
+	if (!cache || fd != cache->timerfd)
+		return false;
+
+	if (read (fd, &expirations, sizeof expirations) < 0 && !would_block ())
+		fh_pr_err ("Failed to read the cache timer: %s", strerror (errno));
+
+	/* Those that wait again go back on `waiting', for the next tick.  */
+	while (cache->waiting)
+	{
+		struct fh_cache_waiter *waiter = cache->waiting;
+
+		fh_cache_cancel_wait (cache, waiter);
+		fh_cache_waiter_push (&cache->due, waiter);
+	}
+
+	while (cache->due)
+	{
+		struct fh_cache_waiter *waiter = cache->due;
+
+		fh_cache_cancel_wait (cache, waiter);
+		waiter->on_tick (waiter->data);
+	}
+
+	if (!cache->waiting && cache->armed)
+		fh_cache_arm (cache, false);
+
+	return true;
+}
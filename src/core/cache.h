@@ -0,0 +1,164 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FH_CORE_CACHE_H
+#define FH_CORE_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "event/xpoll.h"
+#include "mm/pool.h"
+#include "types.h"
+
+#define FH_CACHE_ID_LEN 16
+/* Names of the request headers that a response varies on, as far as they
+   are remembered */
+#define FH_CACHE_VARY_MAX 256
+/* Seconds that a miss waits for another request that fetches the same
+   response, and that such a request may take */
+#define FH_CACHE_LOCK_TIMEOUT 5
+/* Seconds for which requests go straight to the upstream server after a
+   response that could not be cached */
+#define FH_CACHE_PASS_TTL 10
+/* How often waiting requests look for the response, in milliseconds */
+#define FH_CACHE_WAIT_INTERVAL 10
+
+struct fh_config;
+struct fh_config_proxy;
+struct fh_link;
+struct fh_request;
+struct fh_response;
+
+enum fh_cache_status
+{
+	FH_CACHE_MISS,
+	FH_CACHE_HIT,
+	/* Past its lifetime, but within stale-while-revalidate */
+	FH_CACHE_STALE,
+	/* Known not to be cacheable */
+	FH_CACHE_PASS
+};
+
+/* Index entries, in shared memory */
+struct fh_cache_meta
+{
+	time_t stored;
+	time_t fresh_until;
+	time_t stale_until;
+	uint64_t body_len;
+	/* Bytes in front of the body in the file */
+	uint32_t head_len;
+	uint8_t type;
+	uint16_t vary_len;
+	/* Comma-separated, for FH_CACHE_ENTRY_VARY entries only */
+	char vary[FH_CACHE_VARY_MAX];
+};
+
+/* A request as far as the cache is concerned */
+struct fh_cache_req
+{
+	pool_t *pool;
+	const struct fh_request *request;
+	/* The method, the scheme, the host and the URI, followed by the values
+	   of the headers that the response varies on */
+	char *key;
+	size_t key_len;
+	size_t primary_len;
+	uint8_t id[FH_CACHE_ID_LEN];
+	uint8_t primary_id[FH_CACHE_ID_LEN];
+	uint8_t lock_id[FH_CACHE_ID_LEN];
+	struct fh_cache_meta meta;
+
+	/* While the response is written to a temporary file */
+	fd_t fd;
+	char *tmp_path;
+	uint64_t written;
+	size_t max_entry_size;
+
+	bool locked : 1;
+	bool storing : 1;
+	bool vary : 1;
+};
+
+typedef void (*fh_cache_wait_cb_t) (void *data);
+
+struct fh_cache_waiter
+{
+	fh_cache_wait_cb_t on_tick;
+	void *data;
+	/* The list the waiter is on, if any */
+	struct fh_cache_waiter **list;
+	struct fh_cache_waiter *prev, *next;
+};
+
+/* Requests of this worker that wait for others to fetch a response */
+struct fh_cache
+{
+	xpoll_t xpoll_fd;
+	fd_t timerfd;
+	bool armed;
+	struct fh_cache_waiter *waiting;
+	/* Those whose turn it is on the current tick */
+	struct fh_cache_waiter *due;
+};
+
+/* Maps the index and cleans up the directory of the root `cache' block;
+   called before the workers are forked.  */
+bool fh_cache_shared_init (const struct fh_config *config);
+void fh_cache_shared_destroy (void);
+
+/* Returns NULL if the cache is disabled or the request bypasses it, e.g.
+   because it carries credentials.  */
+struct fh_cache_req *fh_cache_req_create (pool_t *pool,
+										  const struct fh_request *request);
+enum fh_cache_status fh_cache_lookup (struct fh_cache_req *req, time_t now);
+/* Makes the request the one that fetches the response for its key.  Fails
+   if another request does, or for requests that are not GET.  */
+bool fh_cache_lock (struct fh_cache_req *req, time_t now);
+/* Answers with the entry that fh_cache_lookup() found, with `tag' in the
+   X-Cache header.  Fails if the entry is gone from the disk.  */
+bool fh_cache_serve (struct fh_cache_req *req, struct fh_response *response,
+					 const char *tag, time_t now);
+
+/* Starts storing the response of a locked request once its status and
+   headers are final.  Fails if the response may not be cached, which
+   is remembered for a while.  */
+bool fh_cache_store_begin (struct fh_cache_req *req,
+						   const struct fh_config_proxy *config,
+						   const struct fh_response *response, time_t now);
+/* Appends a piece of the body.  Fails, and gives up storing, on errors or
+   once the body gets too large.  */
+bool fh_cache_store_write (struct fh_cache_req *req,
+						   const struct fh_link *link);
+/* Publishes the stored response if `complete', and releases the lock.  */
+void fh_cache_finish (struct fh_cache_req *req, bool complete);
+
+struct fh_cache *fh_cache_create (xpoll_t xpoll_fd);
+void fh_cache_destroy (struct fh_cache *cache);
+/* Calls `waiter->on_tick' once in a while, until it waits again.  */
+bool fh_cache_wait (struct fh_cache *cache, struct fh_cache_waiter *waiter);
+void fh_cache_cancel_wait (struct fh_cache *cache,
+						   struct fh_cache_waiter *waiter);
+/* Returns false if `fd' is not the timer of `cache'.  */
+bool fh_cache_handle_event (struct fh_cache *cache, fd_t fd, uint32_t events);
+
+#endif /* FH_CORE_CACHE_H */
@@ -0,0 +1,329 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FH_LOG_MODULE_NAME "capture"
+
+#include "capture.h"
+#include "conf.h"
+#include "log/log.h"
+
+/* Connection IDs only count per worker */
+#define FH_CAPTURE_WORKER_SHIFT 48
+
+enum fh_capture_state
+{
+	/* At the start of a line of a head, before any colon */
+	FH_CAPTURE_LINE,
+	/* In the rest of a line that is recorded as it is */
+	FH_CAPTURE_REST,
+	/* In the value of a header that is blanked out */
+	FH_CAPTURE_REDACT,
+	/* In the value of Content-Length */
+	FH_CAPTURE_LENGTH,
+	/* In a body */
+	FH_CAPTURE_SKIP,
+	/* Nothing more of the connection is recorded */
+	FH_CAPTURE_STOP
+};
+
+fd_t fh_capture_fd = -1;
+
+static uint8_t capture_buf[FH_CAPTURE_BUF_SIZE];
+/* The heads of one read, as they are recorded */
+static uint8_t capture_head[FH_CAPTURE_BUF_SIZE];
+static size_t capture_len = 0;
+static size_t capture_max_size = 0;
+static uint64_t capture_worker = 0;
+
+bool
+fh_capture_init (const struct fh_config *config)
+{
+	const struct fh_config_capture *capture = config->capture;
+
+	if (!capture || !capture->file)
+		return true;
+
+	fd_t fd = open (capture->file,
+					O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0640);
+
+	if (fd < 0)
+	{
+		fh_pr_err ("Failed to open capture file %s: %s", capture->file,
+				   strerror (errno));
+		return false;
+	}
+
+	if (write (fd, FH_CAPTURE_MAGIC, FH_CAPTURE_MAGIC_LEN)
+		!= FH_CAPTURE_MAGIC_LEN)
+	{
+		fh_pr_err ("Failed to write capture file %s: %s", capture->file,
+				   strerror (errno));
+		close (fd);
+		return false;
+	}
+
+	fh_capture_fd = fd;
+	capture_max_size = capture->max_size;
+	fh_pr_info ("Capturing requests to %s", capture->file);
+	return true;
+}
+
+void
+fh_capture_attach (size_t worker_index)
+{
+	capture_worker = (uint64_t) (worker_index + 1) << FH_CAPTURE_WORKER_SHIFT;
+}
+
+/* With O_APPEND, each write lands as a whole after what other workers
+   wrote, so records never interleave.  */
+static void
+fh_capture_flush (const void *data, size_t len)
+{
+	struct iovec iov[2] = {
+		{ .iov_base = capture_buf, .iov_len = capture_len },
+		{ .iov_base = (void *) data, .iov_len = len },
+	};
+	ssize_t ret;
+
+	do
+		ret = writev (fh_capture_fd, iov, 2);
+	while (ret < 0 && errno == EINTR);
+
+	if (ret < 0)
+		fh_pr_err ("Failed to write capture file: %s", strerror (errno));
+
+	capture_len = 0;
+}
+
+void
+fh_capture_write (uint64_t conn_id, enum fh_capture_type type,
+				  const void *data, size_t len)
+{
+	struct timespec ts;
+
+	if (fh_capture_fd < 0)
+		return;
+
+	clock_gettime (CLOCK_REALTIME, &ts);
+
+	const struct fh_capture_record record = {
+		.time = (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000,
+		.conn = conn_id | capture_worker,
+		.len = (uint32_t) len,
+		.type = type,
+	};
+
+	if (capture_len + sizeof (record) > FH_CAPTURE_BUF_SIZE)
+		fh_capture_flush (NULL, 0);
+
+	memcpy (capture_buf + capture_len, &record, sizeof (record));
+	capture_len += sizeof (record);
+
+	if (capture_len + len > FH_CAPTURE_BUF_SIZE)
+		fh_capture_flush (data, len);
+	else if (len)
+	{
+		memcpy (capture_buf + capture_len, data, len);
+		capture_len += len;
+	}
+
+	if (type == FH_CAPTURE_CLOSE && capture_len)
+		fh_capture_flush (NULL, 0);
+}
+
+#define fh_capture_name_is(state, str)                                        \
+	((state)->line_len == sizeof (str) - 1                                     \
+	 && !strncasecmp ((state)->line, (str), sizeof (str) - 1))
+
+/* Classifies the header whose name the current line starts with.  */
+static void
+fh_capture_header (struct fh_capture_conn *state)
+{
+	if (fh_capture_name_is (state, "Authorization")
+		|| fh_capture_name_is (state, "Proxy-Authorization")
+		|| fh_capture_name_is (state, "Cookie"))
+		state->state = FH_CAPTURE_REDACT;
+	else if (fh_capture_name_is (state, "Content-Length"))
+	{
+		state->content_length = 0;
+		state->state = FH_CAPTURE_LENGTH;
+	}
+	else
+	{
+		if (fh_capture_name_is (state, "Transfer-Encoding"))
+			state->chunked = true;
+
+		state->state = FH_CAPTURE_REST;
+	}
+}
+
+static void
+fh_capture_line_end (struct fh_capture_conn *state)
+{
+	if (state->state == FH_CAPTURE_LINE && !state->line_len)
+	{
+		/* Empty lines before a request line are ignored.  */
+		if (!state->headers)
+			return;
+
+		if (state->chunked || state->h2)
+			state->state = FH_CAPTURE_STOP;
+		else
+		{
+			state->body_left = state->content_length;
+			state->state
+				= state->body_left ? FH_CAPTURE_SKIP : FH_CAPTURE_LINE;
+		}
+
+		state->content_length = 0;
+		state->headers = false;
+		return;
+	}
+
+	if (!state->headers)
+	{
+		state->h2 = state->line_len >= 4 && !memcmp (state->line, "PRI ", 4);
+		state->headers = true;
+	}
+
+	state->line_len = 0;
+	state->state = FH_CAPTURE_LINE;
+}
+
+/* Copies the bytes of the head that `data' starts with to `out',
+   blanking out credentials, and returns how many there were.  */
+static size_t
+fh_capture_scan_head (struct fh_capture_conn *state, const uint8_t *data,
+					  size_t len, uint8_t *out)
+{
+	size_t i;
+
+	for (i = 0; i < len && state->state < FH_CAPTURE_SKIP; i++)
+	{
+		const uint8_t c = data[i];
+
+		out[i] = c;
+
+		if (c == '\n')
+		{
+			fh_capture_line_end (state);
+			continue;
+		}
+
+		if (c == '\r')
+			continue;
+
+		switch (state->state)
+		{
+			case FH_CAPTURE_LINE:
+				if (c == ':' && state->headers)
+					fh_capture_header (state);
+				else if (state->line_len < sizeof (state->line))
+					state->line[state->line_len++] = (char) c;
+				else
+					state->state = FH_CAPTURE_REST;
+
+				break;
+
+			case FH_CAPTURE_REDACT:
+				if (c != ' ' && c != '\t')
+					out[i] = 'x';
+
+				break;
+
+			case FH_CAPTURE_LENGTH:
+				/* Larger bodies are refused anyway.  */
+				if (c >= '0' && c <= '9' && state->content_length < UINT32_MAX)
+					state->content_length
+						= state->content_length * 10 + (c - '0');
+
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	return i;
+}
+
+void
+fh_capture_data (uint64_t conn_id, struct fh_capture_conn *state,
+				 const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	while (len && state->state != FH_CAPTURE_STOP)
+	{
+		if (state->state == FH_CAPTURE_SKIP)
+		{
+			uint64_t skip = state->body_left < len ? state->body_left : len;
+
+			fh_capture_write (conn_id, FH_CAPTURE_BODY, &skip, sizeof (skip));
+			state->body_left -= skip;
+			p += skip;
+			len -= (size_t) skip;
+
+			if (!state->body_left)
+				state->state = FH_CAPTURE_LINE;
+
+			continue;
+		}
+
+		size_t head_len = fh_capture_scan_head (
+			state, p, len < sizeof (capture_head) ? len : sizeof (capture_head),
+			capture_head);
+		size_t keep = head_len;
+
+		p += head_len;
+		len -= head_len;
+
+		if (capture_max_size && keep > capture_max_size - state->captured)
+		{
+			keep = capture_max_size - state->captured;
+			state->state = FH_CAPTURE_STOP;
+		}
+
+		if (keep)
+			fh_capture_write (conn_id, FH_CAPTURE_DATA, capture_head, keep);
+
+		state->captured += keep;
+	}
+}
+
+void
+fh_capture_destroy (void)
+{
+	if (fh_capture_fd < 0)
+		return;
+
+	if (capture_len)
+		fh_capture_flush (NULL, 0);
+
+	close (fh_capture_fd);
+	fh_capture_fd = -1;
+}
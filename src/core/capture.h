@@ -0,0 +1,105 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FH_CORE_CAPTURE_H
+#define FH_CORE_CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "types.h"
+
+/* A capture file starts with this, and is followed by records, each a
+   struct fh_capture_record in host byte order and its `len' bytes of
+   data.  The workers append to the same file, so records are in order
+   of time per connection only.  Only request heads are recorded, with
+   the values of headers that carry credentials blanked out; bodies are
+   recorded as their length, and HTTP/2 connections up to the end of
+   their preface.  */
+#define FH_CAPTURE_MAGIC "FHCAP\x01\r\n"
+#define FH_CAPTURE_MAGIC_LEN 8
+/* Records are written once this much has been collected, or when a
+   connection closes */
+#define FH_CAPTURE_BUF_SIZE 65536
+
+struct fh_config;
+
+enum fh_capture_type
+{
+	/* A connection was accepted */
+	FH_CAPTURE_OPEN = 1,
+	/* The bytes of request heads that one read from the client returned */
+	FH_CAPTURE_DATA,
+	FH_CAPTURE_CLOSE,
+	/* The bytes of a request body that one read returned, which are left
+	   out; the data is their count, a uint64_t */
+	FH_CAPTURE_BODY
+};
+
+struct fh_capture_record
+{
+	/* Microseconds since the epoch */
+	uint64_t time;
+	/* Unique across the workers */
+	uint64_t conn;
+	uint32_t len;
+	uint8_t type;
+	uint8_t reserved[3];
+};
+
+/* Where a connection is in what it sends, as far as recording it goes;
+   zeroed before its first request.  */
+struct fh_capture_conn
+{
+	/* Bytes of request heads recorded */
+	size_t captured;
+	uint64_t content_length;
+	/* Bytes of the current body that are still to come */
+	uint64_t body_left;
+	/* The start of the current line */
+	char line[24];
+	uint8_t line_len;
+	uint8_t state;
+	/* Past the request line */
+	bool headers : 1;
+	/* The body is not delimited by Content-Length */
+	bool chunked : 1;
+	/* The head is the preface of HTTP/2 */
+	bool h2 : 1;
+};
+
+/* Open capture file, or -1 when capturing is disabled */
+extern fd_t fh_capture_fd;
+
+/* Opens the file of the `capture' block, if any; called before the
+   workers are forked.  */
+bool fh_capture_init (const struct fh_config *config);
+/* Tags the connections of the current process with its worker index.  */
+void fh_capture_attach (size_t worker_index);
+void fh_capture_write (uint64_t conn_id, enum fh_capture_type type,
+					   const void *data, size_t len);
+/* Records what one read from a connection returned, up to the limit per
+   connection.  */
+void fh_capture_data (uint64_t conn_id, struct fh_capture_conn *state,
+					  const void *data, size_t len);
+/* Writes out what is left, and closes the file.  */
+void fh_capture_destroy (void);
+
+#endif /* FH_CORE_CAPTURE_H */
@@ -22,6 +22,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/socket.h>
 
 #include "hash/strtable.h"
 #include "log/log.h"
@@ -43,12 +44,97 @@ struct fh_bound_addr
 	uint16_t port;
 };
 
+enum fh_access_format
+{
+	FH_ACCESS_FORMAT_JSON,
+	FH_ACCESS_FORMAT_BINARY
+};
+
 struct fh_config_logging
 {
 	bool enabled;
 	enum fh_log_level min_level;
 	char *file;
 	char *error_file;
+	/* Per-module levels, read at startup and on SIGUSR1 */
+	char *levels_file;
+	/* Access log of the hosts, or of one host in a `host' block */
+	char *access_file;
+	enum fh_access_format access_format;
+};
+
+struct fh_config_tls
+{
+	char *certificate;
+	char *key;
+	char *ciphers;
+	bool ktls;
+	/* Also serve the host over QUIC, on the same port number over UDP */
+	bool http3;
+};
+
+/* Settings of the root `tls' block, shared by every TLS host */
+struct fh_config_tls_session
+{
+	size_t cache_size;
+	uint32_t timeout;
+	bool tickets;
+	uint32_t ticket_key_rotation;
+};
+
+struct fh_upstream_state;
+
+struct fh_config_upstream
+{
+	/* As written, e.g. "127.0.0.1:9000" or "unix:/run/app.sock" */
+	char *name;
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	/* Load and health shared by the workers, mapped by the master before
+	   they are forked */
+	struct fh_upstream_state *state;
+};
+
+enum fh_upstream_balance
+{
+	FH_UPSTREAM_BALANCE_ROUND_ROBIN,
+	FH_UPSTREAM_BALANCE_LEAST_CONN,
+	FH_UPSTREAM_BALANCE_EWMA,
+	FH_UPSTREAM_BALANCE_HASH
+};
+
+/* A `proxy' or `fastcgi' block: requests whose URI starts with `path' are
+   forwarded to one of the upstream servers.  */
+struct fh_config_proxy
+{
+	/* Whether the servers speak FastCGI rather than HTTP/1.1 */
+	bool fastcgi;
+	/* FastCGI: the script that handles every request, or NULL to map the
+	   URI path under the document root */
+	char *script;
+	/* FastCGI: the script name appended to paths ending with a slash */
+	char *index;
+	char *path;
+	size_t path_len;
+	struct fh_config_upstream *upstreams;
+	size_t upstream_count;
+	/* Idle connections each worker keeps open per upstream server */
+	size_t keepalive;
+	enum fh_upstream_balance balance;
+	/* Header whose value the `hash' policy keys on, or NULL for the URI */
+	char *hash_header;
+	size_t hash_header_len;
+	/* Consecutive failures after which a server is ejected, 0 to never
+	   eject */
+	size_t max_fails;
+	/* First ejection period in seconds, doubled on each ejection in a row */
+	uint32_t fail_timeout;
+	/* Whether responses are kept in the root `cache' */
+	bool cache;
+	/* Seconds that a response without an explicit lifetime stays fresh, 0
+	   to not cache such responses */
+	uint32_t cache_valid;
+	struct fh_config_proxy *next;
 };
 
 struct fh_config_host
@@ -57,11 +143,24 @@ struct fh_config_host
 	char *docroot;
 	bool is_default;
 	struct fh_config_logging *logging;
+	/* NULL unless the host has a `tls' block */
+	struct fh_config_tls *tls;
+	/* Sorted by descending path length, so the first match is the
+	   longest one */
+	struct fh_config_proxy *proxies;
+	/* Path that the server statistics are served under, or NULL */
+	char *status_path;
+	size_t status_path_len;
 };
 
+/* Request bodies are read in full before they are handled */
+#define FH_CONF_DEFAULT_MAX_REQUEST_BODY_SIZE (8 << 20)
+
 struct fh_config_security
 {
 	size_t max_response_body_size;
+	/* Larger request bodies are refused with 413 before they are read */
+	size_t max_request_body_size;
 	size_t max_connections;
 	uint32_t recv_timeout;
 	uint32_t send_timeout;
@@ -69,16 +168,58 @@ struct fh_config_security
 	uint32_t body_timeout;
 };
 
+struct fh_config_compression
+{
+	bool enabled;
+	int level;
+	size_t min_size;
+	/* NULL-terminated list of MIME types, NULL means the built-in list */
+	char **types;
+	size_t cache_size;
+	size_t cache_max_file_size;
+};
+
+/* The root `cache' block, for responses of `proxy' and `fastcgi' blocks */
+struct fh_config_cache
+{
+	/* Directory that bodies are stored in, NULL to disable the cache */
+	char *path;
+	/* Size of the index shared by the workers */
+	size_t index_size;
+	/* Larger bodies are not cached */
+	size_t max_entry_size;
+};
+
+/* The root `capture' block */
+struct fh_config_capture
+{
+	/* File that received data is recorded in, NULL to disable capturing */
+	char *file;
+	/* Bytes recorded per connection at most, 0 for no limit */
+	size_t max_size;
+};
+
 struct fh_config
 {
 	char *conf_root;
+	/* 0 for one worker per CPU that the master may run on */
 	size_t worker_count;
+	/* CPUs that the workers are pinned to in turn; NULL when they are not
+	   pinned, or when `worker_cpus_auto' is set */
+	int *worker_cpus;
+	size_t worker_cpu_count;
+	/* Pin the workers to the CPUs of the master's affinity mask in turn */
+	bool worker_cpus_auto : 1;
 	/* (const char *host) => (struct fh_config_host *host_config) */
 	struct strtable *hosts;
 	struct fh_config_host *default_host_config;
 	bool no_free_hosts : 1;
 	struct fh_config_logging *logging;
 	struct fh_config_security *security;
+	struct fh_config_compression *compression;
+	struct fh_config_tls_session *tls_session;
+	struct fh_config_cache *cache;
+	struct fh_config_capture *capture;
 };
 
 enum conf_token_type
@@ -19,6 +19,10 @@
 
 #define _GNU_SOURCE
 
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -26,15 +30,29 @@
 #include <unistd.h>
 #include <glob.h>
 #include <limits.h>
+#include <sched.h>
 
 #define CORE_CONF_IMPLEMENTATION
 
 #include "conf.h"
 #include "confproc.h"
+#include "upstream.h"
 
 static bool fh_conf_traverse_block (struct fh_traverse_ctx *ctx,
 									const struct conf_node *node, void *config);
 
+static void
+fh_conf_free_string_list (char **list)
+{
+	if (!list)
+		return;
+
+	for (char **p = list; *p; p++)
+		free (*p);
+
+	free (list);
+}
+
 static bool
 fh_conf_expect_value (struct fh_traverse_ctx *ctx, const struct conf_node *node,
 					  enum conf_literal_kind kind)
@@ -235,6 +253,67 @@ fh_conf_traverse_include_glob (struct fh_traverse_ctx *ctx,
 	return true;
 }
 
+/* Parses a list like "0,2,4-7" into the CPUs it names, in order */
+static bool
+fh_conf_parse_cpu_list (const char *str, int **cpus_out, size_t *count_out)
+{
+	int *cpus = NULL;
+	size_t count = 0, cap = 0;
+
+	for (const char *p = str;;)
+	{
+		char *end;
+		long first = strtol (p, &end, 10), last;
+
+		if (end == p || first < 0 || first >= CPU_SETSIZE)
+			goto invalid;
+
+		last = first;
+		p = end;
+
+		if (*p == '-')
+		{
+			last = strtol (++p, &end, 10);
+
+			if (end == p || last < first || last >= CPU_SETSIZE)
+				goto invalid;
+
+			p = end;
+		}
+
+		for (long cpu = first; cpu <= last; cpu++)
+		{
+			if (count >= cap)
+			{
+				size_t new_cap = cap ? cap * 2 : 16;
+				int *new_cpus = realloc (cpus, new_cap * sizeof (int));
+
+				if (!new_cpus)
+					goto invalid;
+
+				cpus = new_cpus;
+				cap = new_cap;
+			}
+
+			cpus[count++] = (int) cpu;
+		}
+
+		if (*p == 0)
+			break;
+
+		if (*p++ != ',')
+			goto invalid;
+	}
+
+	*cpus_out = cpus;
+	*count_out = count;
+	return true;
+
+invalid:
+	free (cpus);
+	return false;
+}
+
 static bool
 fh_conf_traverse_root_block_assignment (struct fh_traverse_ctx *ctx,
 										const struct conf_node *node,
@@ -257,25 +336,66 @@ fh_conf_traverse_root_block_assignment (struct fh_traverse_ctx *ctx,
 	}
 	else if (!strcmp (prop_name, "worker_count"))
 	{
-		if (!fh_conf_expect_value (ctx, node->details.assignment.right,
-								   CONF_LITERAL_INT))
+		const struct conf_node *right = node->details.assignment.right;
+
+		if (right->type == CONF_NODE_LITERAL
+			&& right->details.literal.kind == CONF_LITERAL_STRING
+			&& !strcmp (right->details.literal.value.str.value, "auto"))
+		{
+			config->worker_count = 0;
+			return true;
+		}
+
+		if (!fh_conf_expect_value (ctx, right, CONF_LITERAL_INT))
 			return false;
 
-		int64_t value
-			= node->details.assignment.right->details.literal.value.int_value;
+		int64_t value = right->details.literal.value.int_value;
 
 		if (value <= 0)
 		{
 			fh_conf_parser_error (
 				ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG,
-				node->details.assignment.right->line,
-				node->details.assignment.right->column,
-				"Expected a positive non-zero integer value");
+				right->line, right->column,
+				"Expected a positive non-zero integer value or \"auto\"");
 			return false;
 		}
 
 		config->worker_count = (size_t) value;
 	}
+	else if (!strcmp (prop_name, "worker_cpu_affinity"))
+	{
+		const struct conf_node *right = node->details.assignment.right;
+
+		if (!fh_conf_expect_value (ctx, right, CONF_LITERAL_STRING))
+			return false;
+
+		const char *value = right->details.literal.value.str.value;
+
+		free (config->worker_cpus);
+		config->worker_cpus = NULL;
+		config->worker_cpu_count = 0;
+		config->worker_cpus_auto = false;
+
+		if (!strcmp (value, "auto"))
+		{
+			config->worker_cpus_auto = true;
+			return true;
+		}
+
+		if (!strcmp (value, "none"))
+			return true;
+
+		if (!fh_conf_parse_cpu_list (value, &config->worker_cpus,
+									 &config->worker_cpu_count))
+		{
+			fh_conf_parser_error (
+				ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG, right->line,
+				right->column,
+				"Expected \"auto\", \"none\" or a list of CPUs like "
+				"\"0,2,4-7\"");
+			return false;
+		}
+	}
 	else
 	{
 		fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG,
@@ -337,6 +457,19 @@ fh_conf_traverse_require_root_or_host_parent (struct fh_traverse_ctx *ctx,
 						   "host"));
 }
 
+static bool
+fh_conf_traverse_require_host_parent (struct fh_traverse_ctx *ctx,
+									  const struct conf_node *node,
+									  const struct conf_node *parent)
+{
+	(void) ctx;
+	(void) node;
+
+	return parent && parent->type == CONF_NODE_BLOCK
+		   && !strcmp (parent->details.block.name->details.identifier.value,
+					   "host");
+}
+
 static bool
 fh_conf_traverse_require_no_parent (struct fh_traverse_ctx *ctx,
 									const struct conf_node *node,
@@ -430,6 +563,52 @@ fh_conf_traverse_logging_block_assignment (struct fh_traverse_ctx *ctx,
 
 		config->error_file = strdup (strval);
 	}
+	else if (!strcmp (prop_name, "levels_file"))
+	{
+		if (!fh_conf_expect_value (ctx, value, CONF_LITERAL_STRING))
+			return false;
+
+		const char *strval = value->details.literal.value.str.value;
+
+		if (config->levels_file)
+			free (config->levels_file);
+
+		config->levels_file = strdup (strval);
+	}
+	else if (!strcmp (prop_name, "access_file"))
+	{
+		if (!fh_conf_expect_value (ctx, value, CONF_LITERAL_STRING))
+			return false;
+
+		const char *strval = value->details.literal.value.str.value;
+
+		if (config->access_file)
+			free (config->access_file);
+
+		config->access_file = strdup (strval);
+	}
+	else if (!strcmp (prop_name, "access_format"))
+	{
+		if (!fh_conf_expect_value (ctx, value, CONF_LITERAL_STRING))
+			return false;
+
+		const char *strval = value->details.literal.value.str.value;
+		int format = !strcmp (strval, "json")	  ? FH_ACCESS_FORMAT_JSON
+					 : !strcmp (strval, "binary") ? FH_ACCESS_FORMAT_BINARY
+												  : -1;
+
+		if (format == -1)
+		{
+			fh_conf_parser_error (ctx->parser,
+								  CONF_PARSER_ERROR_INVALID_CONFIG,
+								  value->line, value->column,
+								  "Value of `access_format' must be one of: "
+								  "json, binary");
+			return false;
+		}
+
+		config->access_format = (enum fh_access_format) format;
+	}
 	else
 	{
 		fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG,
@@ -559,6 +738,23 @@ fh_conf_traverse_security_block_assignment (struct fh_traverse_ctx *ctx,
 
 		config->max_response_body_size = (size_t) intval;
 	}
+	else if (!strcmp (prop_name, "max_request_body_size"))
+	{
+		if (!fh_conf_expect_value (ctx, value, CONF_LITERAL_INT))
+			return false;
+
+		int64_t intval = value->details.literal.value.int_value;
+
+		if (intval <= 0)
+		{
+			fh_conf_parser_error (
+				ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG, value->line,
+				value->column, "Expected a positive non-zero integer value");
+			return false;
+		}
+
+		config->max_request_body_size = (size_t) intval;
+	}
 	else if (!strcmp (prop_name, "max_connections"))
 	{
 		if (!fh_conf_expect_value (ctx, value, CONF_LITERAL_INT))
@@ -690,58 +886,134 @@ fh_conf_traverse_security_block (struct fh_traverse_ctx *ctx,
 
 /* end security block */
 
+/* compression block */
+
 static bool
-fh_conf_traverse_host_block_assignment (struct fh_traverse_ctx *ctx,
-										const struct conf_node *node,
-										struct fh_config_host *host)
+fh_conf_expect_size (struct fh_traverse_ctx *ctx, const struct conf_node *value,
+					 size_t *out)
 {
-	const char *prop_name
-		= node->details.assignment.left->details.identifier.value;
+	if (!fh_conf_expect_value (ctx, value, CONF_LITERAL_INT))
+		return false;
 
-	if (!strcmp (prop_name, "is_default"))
+	int64_t intval = value->details.literal.value.int_value;
+
+	if (intval < 0)
 	{
-		if (!fh_conf_expect_value (ctx, node->details.assignment.right,
-								   CONF_LITERAL_BOOLEAN))
-			return false;
+		fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG,
+							  value->line, value->column,
+							  "Expected a positive integer value or zero");
+		return false;
+	}
 
-		bool is_default
-			= node->details.assignment.right->details.literal.value.bool_value;
+	*out = (size_t) intval;
+	return true;
+}
 
-		if (ctx->default_host_config && is_default)
+static bool
+fh_conf_traverse_compression_types (struct fh_traverse_ctx *ctx,
+									const struct conf_node *value,
+									struct fh_config_compression *config)
+{
+	if (value->type != CONF_NODE_ARRAY)
+	{
+		fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG,
+							  value->line, value->column,
+							  "Expected an array of strings");
+		return false;
+	}
+
+	size_t count = value->details.array.element_count;
+	char **types = calloc (count + 1, sizeof (char *));
+
+	if (!types)
+	{
+		fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_MEMORY,
+							  value->line, value->column,
+							  "Memory allocation error");
+		return false;
+	}
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const struct conf_node *element = value->details.array.elements[i];
+
+		if (!fh_conf_expect_value (ctx, element, CONF_LITERAL_STRING))
 		{
-			fh_conf_parser_error (
-				ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG, node->line,
-				node->column, "A default host is already set");
+			for (size_t j = 0; j < i; j++)
+				free (types[j]);
 
+			free (types);
 			return false;
 		}
 
-		host->is_default = is_default;
+		types[i] = strdup (element->details.literal.value.str.value);
+	}
 
-		if (is_default)
-			ctx->default_host_config = host;
-		else if (!is_default && ctx->default_host_config == host)
-			ctx->default_host_config = NULL;
+	fh_conf_free_string_list (config->types);
+	config->types = types;
+	return true;
+}
+
+static bool
+fh_conf_traverse_compression_block_assignment (
+	struct fh_traverse_ctx *ctx, const struct conf_node *node,
+	struct fh_config_compression *config)
+{
+	const char *prop_name
+		= node->details.assignment.left->details.identifier.value;
+	const struct conf_node *value = node->details.assignment.right;
+
+	if (!strcmp (prop_name, "enabled"))
+	{
+		if (!fh_conf_expect_value (ctx, value, CONF_LITERAL_BOOLEAN))
+			return false;
+
+		config->enabled = value->details.literal.value.bool_value;
 	}
-	else if (!strcmp (prop_name, "docroot"))
+	else if (!strcmp (prop_name, "level"))
 	{
-		if (!fh_conf_expect_value (ctx, node->details.assignment.right,
-								   CONF_LITERAL_STRING))
+		if (!fh_conf_expect_value (ctx, value, CONF_LITERAL_INT))
 			return false;
 
-		if (host->docroot)
-			free (host->docroot);
+		int64_t intval = value->details.literal.value.int_value;
 
-		host->docroot = strdup (
-			node->details.assignment.right->details.literal.value.str.value);
+		if (intval < 1 || intval > 9)
+		{
+			fh_conf_parser_error (
+				ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG, value->line,
+				value->column, "Value of `level' must be between 1 and 9");
+			return false;
+		}
+
+		config->level = (int) intval;
+	}
+	else if (!strcmp (prop_name, "min_size"))
+	{
+		if (!fh_conf_expect_size (ctx, value, &config->min_size))
+			return false;
+	}
+	else if (!strcmp (prop_name, "cache_size"))
+	{
+		if (!fh_conf_expect_size (ctx, value, &config->cache_size))
+			return false;
+	}
+	else if (!strcmp (prop_name, "cache_max_file_size"))
+	{
+		if (!fh_conf_expect_size (ctx, value, &config->cache_max_file_size))
+			return false;
+	}
+	else if (!strcmp (prop_name, "types"))
+	{
+		if (!fh_conf_traverse_compression_types (ctx, value, config))
+			return false;
 	}
 	else
 	{
 		fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG,
-								  node->details.assignment.left->line,
-								  node->details.assignment.left->column,
-								  "Invalid property '%s' in block 'host'",
-								  prop_name);
+							  node->details.assignment.left->line,
+							  node->details.assignment.left->column,
+							  "Invalid property '%s' in block 'compression'",
+							  prop_name);
 		return false;
 	}
 
@@ -749,49 +1021,860 @@ fh_conf_traverse_host_block_assignment (struct fh_traverse_ctx *ctx,
 }
 
 static bool
-fh_conf_traverse_host_block (struct fh_traverse_ctx *ctx,
-							 const struct conf_node *node, void *src_config)
+fh_conf_traverse_compression_block (struct fh_traverse_ctx *ctx,
+									const struct conf_node *node,
+									void *src_config)
 {
 	struct fh_config *config = src_config;
 
-	if (!config->hosts)
+	for (size_t i = 0; i < node->details.block.child_count; i++)
 	{
-		config->hosts = strtable_create (0);
+		struct conf_node *child = node->details.block.children[i];
 
-		if (!config->hosts)
+		switch (child->type)
 		{
-			fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_MEMORY,
-									  node->line, node->column,
-									  "Memory allocation error");
-			return false;
+			case CONF_NODE_ASSIGNMENT:
+				if (!fh_conf_traverse_compression_block_assignment (
+						ctx, child, config->compression))
+					return false;
+
+				break;
+
+			default:
+				fh_conf_parser_error (
+					ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG, child->line,
+					child->column,
+					"Syntax error: unexpected junk (expected only properties)");
+				return false;
 		}
 	}
 
-	if (node->details.block.argc == 0)
-	{
-		fh_conf_parser_error (
-			ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG, node->line,
-			node->column, "Expected at least one argument, but none given");
-		return false;
-	}
+	return true;
+}
 
-	for (size_t i = 0; i < node->details.block.argc; i++)
-	{
-		struct conf_node *arg = node->details.block.args[i];
+/* end compression block */
 
-		if (!fh_conf_expect_value (ctx, arg, CONF_LITERAL_STRING))
+/* tls block */
+
+static bool
+fh_conf_traverse_tls_block_assignment (struct fh_traverse_ctx *ctx,
+									   const struct conf_node *node,
+									   struct fh_config_tls *config)
+{
+	const char *prop_name
+		= node->details.assignment.left->details.identifier.value;
+	const struct conf_node *value = node->details.assignment.right;
+	char **strprop = NULL;
+
+	if (!strcmp (prop_name, "certificate"))
+		strprop = &config->certificate;
+	else if (!strcmp (prop_name, "key"))
+		strprop = &config->key;
+	else if (!strcmp (prop_name, "ciphers"))
+		strprop = &config->ciphers;
+	else if (!strcmp (prop_name, "ktls"))
+	{
+		if (!fh_conf_expect_value (ctx, value, CONF_LITERAL_BOOLEAN))
 			return false;
 
-		const char *host_value = arg->details.literal.value.str.value;
+		config->ktls = value->details.literal.value.bool_value;
+		return true;
+	}
+	else if (!strcmp (prop_name, "http3"))
+	{
+		if (!fh_conf_expect_value (ctx, value, CONF_LITERAL_BOOLEAN))
+			return false;
 
-		if (strtable_contains (config->hosts, host_value))
+#ifndef FHTTPD_ENABLE_HTTP3
+		if (value->details.literal.value.bool_value)
 		{
-			fh_conf_parser_error (
-				ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG, arg->line,
-				arg->column,
-				"Host '%s' is already defined, refusing to overwrite",
-				host_value);
-			return false;
+			fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG,
+								  node->details.assignment.left->line,
+								  node->details.assignment.left->column,
+								  "HTTP/3 support was not enabled at build time");
+			return false;
+		}
+#endif /* FHTTPD_ENABLE_HTTP3 */
+
+		config->http3 = value->details.literal.value.bool_value;
+		return true;
+	}
+	else
+	{
+		fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG,
+							  node->details.assignment.left->line,
+							  node->details.assignment.left->column,
+							  "Invalid property '%s' in block 'tls'",
+							  prop_name);
+		return false;
+	}
+
+	if (!fh_conf_expect_value (ctx, value, CONF_LITERAL_STRING))
+		return false;
+
+	free (*strprop);
+	*strprop = strdup (value->details.literal.value.str.value);
+
+	if (!*strprop)
+	{
+		fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_MEMORY,
+							  value->line, value->column,
+							  "Memory allocation error");
+		return false;
+	}
+
+	return true;
+}
+
+static bool
+fh_conf_expect_seconds (struct fh_traverse_ctx *ctx,
+						const struct conf_node *value, uint32_t *out)
+{
+	if (!fh_conf_expect_value (ctx, value, CONF_LITERAL_INT))
+		return false;
+
+	int64_t intval = value->details.literal.value.int_value;
+
+	if (intval <= 0 || intval > UINT32_MAX)
+	{
+		fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG,
+							  value->line, value->column,
+							  "Expected a positive number of seconds");
+		return false;
+	}
+
+	*out = (uint32_t) intval;
+	return true;
+}
+
+static bool
+fh_conf_traverse_tls_session_assignment (struct fh_traverse_ctx *ctx,
+										 const struct conf_node *node,
+										 struct fh_config_tls_session *config)
+{
+	const char *prop_name
+		= node->details.assignment.left->details.identifier.value;
+	const struct conf_node *value = node->details.assignment.right;
+
+	if (!strcmp (prop_name, "session_cache_size"))
+	{
+		if (!fh_conf_expect_size (ctx, value, &config->cache_size))
+			return false;
+	}
+	else if (!strcmp (prop_name, "session_timeout"))
+	{
+		if (!fh_conf_expect_seconds (ctx, value, &config->timeout))
+			return false;
+	}
+	else if (!strcmp (prop_name, "ticket_key_rotation"))
+	{
+		if (!fh_conf_expect_seconds (ctx, value, &config->ticket_key_rotation))
+			return false;
+	}
+	else if (!strcmp (prop_name, "session_tickets"))
+	{
+		if (!fh_conf_expect_value (ctx, value, CONF_LITERAL_BOOLEAN))
+			return false;
+
+		config->tickets = value->details.literal.value.bool_value;
+	}
+	else
+	{
+		fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG,
+							  node->details.assignment.left->line,
+							  node->details.assignment.left->column,
+							  "Invalid property '%s' in root block 'tls'",
+							  prop_name);
+		return false;
+	}
+
+	return true;
+}
+
+static bool
+fh_conf_traverse_tls_block (struct fh_traverse_ctx *ctx,
+							const struct conf_node *node, void *src_config)
+{
+	if (!node->parent)
+	{
+		struct fh_config *config = src_config;
+
+		for (size_t i = 0; i < node->details.block.child_count; i++)
+		{
+			struct conf_node *child = node->details.block.children[i];
+
+			if (child->type != CONF_NODE_ASSIGNMENT)
+			{
+				fh_conf_parser_error (
+					ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG, child->line,
+					child->column,
+					"Syntax error: unexpected junk (expected only properties)");
+				return false;
+			}
+
+			if (!fh_conf_traverse_tls_session_assignment (
+					ctx, child, config->tls_session))
+				return false;
+		}
+
+		return true;
+	}
+
+	struct fh_config_host *host = src_config;
+
+	if (!host->tls)
+	{
+		host->tls = calloc (1, sizeof (*host->tls));
+
+		if (!host->tls)
+		{
+			fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_MEMORY,
+								  node->line, node->column,
+								  "Memory allocation error");
+			return false;
+		}
+
+		host->tls->ktls = true;
+	}
+
+	for (size_t i = 0; i < node->details.block.child_count; i++)
+	{
+		struct conf_node *child = node->details.block.children[i];
+
+		switch (child->type)
+		{
+			case CONF_NODE_ASSIGNMENT:
+				if (!fh_conf_traverse_tls_block_assignment (ctx, child,
+															host->tls))
+					return false;
+
+				break;
+
+			default:
+				fh_conf_parser_error (
+					ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG, child->line,
+					child->column,
+					"Syntax error: unexpected junk (expected only properties)");
+				return false;
+		}
+	}
+
+	if (!host->tls->certificate || !host->tls->key)
+	{
+		fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG,
+							  node->line, node->column,
+							  "Block 'tls' requires both `certificate' and "
+							  "`key' to be set");
+		return false;
+	}
+
+	return true;
+}
+
+/* end tls block */
+
+/* proxy block */
+
+static void
+fh_conf_free_proxy (struct fh_config_proxy *proxy)
+{
+	for (size_t i = 0; i < proxy->upstream_count; i++)
+		free (proxy->upstreams[i].name);
+
+	free (proxy->upstreams);
+	free (proxy->hash_header);
+	free (proxy->script);
+	free (proxy->index);
+	free (proxy->path);
+	free (proxy);
+}
+
+static bool
+fh_conf_traverse_proxy_upstreams (struct fh_traverse_ctx *ctx,
+								  const struct conf_node *value,
+								  struct fh_config_proxy *proxy)
+{
+	const struct conf_node *const *elements = &value;
+	size_t count = 1;
+
+	if (value->type == CONF_NODE_ARRAY)
+	{
+		elements = (const struct conf_node *const *) value->details.array
+					   .elements;
+		count = value->details.array.element_count;
+	}
+
+	if (!count)
+	{
+		fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG,
+							  value->line, value->column,
+							  "Expected at least one upstream server");
+		return false;
+	}
+
+	struct fh_config_upstream *upstreams
+		= calloc (proxy->upstream_count + count, sizeof (*upstreams));
+
+	if (!upstreams)
+	{
+		fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_MEMORY,
+							  value->line, value->column,
+							  "Memory allocation error");
+		return false;
+	}
+
+	if (proxy->upstream_count)
+		memcpy (upstreams, proxy->upstreams,
+				proxy->upstream_count * sizeof (*upstreams));
+
+	free (proxy->upstreams);
+	proxy->upstreams = upstreams;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const struct conf_node *element = elements[i];
+
+		if (!fh_conf_expect_value (ctx, element, CONF_LITERAL_STRING))
+			return false;
+
+		struct fh_config_upstream *upstream
+			= &proxy->upstreams[proxy->upstream_count];
+		const char *name = element->details.literal.value.str.value;
+
+		if (!fh_upstream_resolve (name, &upstream->addr, &upstream->addr_len))
+		{
+			fh_conf_parser_error (
+				ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG, element->line,
+				element->column,
+				"Invalid upstream address '%s' (expected host:port or "
+				"unix:/path)",
+				name);
+			return false;
+		}
+
+		upstream->name = strdup (name);
+
+		if (!upstream->name)
+		{
+			fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_MEMORY,
+								  element->line, element->column,
+								  "Memory allocation error");
+			return false;
+		}
+
+		proxy->upstream_count++;
+	}
+
+	return true;
+}
+
+static bool
+fh_conf_traverse_proxy_block_assignment (struct fh_traverse_ctx *ctx,
+										 const struct conf_node *node,
+										 struct fh_config_proxy *proxy)
+{
+	const char *prop_name
+		= node->details.assignment.left->details.identifier.value;
+	const struct conf_node *value = node->details.assignment.right;
+
+	if (!strcmp (prop_name, "upstream"))
+		return fh_conf_traverse_proxy_upstreams (ctx, value, proxy);
+
+	if (!strcmp (prop_name, "keepalive"))
+		return fh_conf_expect_size (ctx, value, &proxy->keepalive);
+
+	if (!strcmp (prop_name, "max_fails"))
+		return fh_conf_expect_size (ctx, value, &proxy->max_fails);
+
+	if (!strcmp (prop_name, "fail_timeout"))
+		return fh_conf_expect_seconds (ctx, value, &proxy->fail_timeout);
+
+	if (!strcmp (prop_name, "cache"))
+	{
+		if (!fh_conf_expect_value (ctx, value, CONF_LITERAL_BOOLEAN))
+			return false;
+
+		proxy->cache = value->details.literal.value.bool_value;
+		return true;
+	}
+
+	if (!strcmp (prop_name, "cache_valid"))
+		return fh_conf_expect_seconds (ctx, value, &proxy->cache_valid);
+
+	if (!strcmp (prop_name, "balance"))
+	{
+		if (!fh_conf_expect_value (ctx, value, CONF_LITERAL_STRING))
+			return false;
+
+		const char *strval = value->details.literal.value.str.value;
+		int balance = !strcmp (strval, "round-robin")
+						  ? FH_UPSTREAM_BALANCE_ROUND_ROBIN
+					  : !strcmp (strval, "least-conn")
+						  ? FH_UPSTREAM_BALANCE_LEAST_CONN
+					  : !strcmp (strval, "ewma") ? FH_UPSTREAM_BALANCE_EWMA
+					  : !strcmp (strval, "hash") ? FH_UPSTREAM_BALANCE_HASH
+												 : -1;
+
+		if (balance == -1)
+		{
+			fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG,
+								  value->line, value->column,
+								  "Value of `balance' must be one of: "
+								  "round-robin, least-conn, ewma, hash");
+			return false;
+		}
+
+		proxy->balance = (enum fh_upstream_balance) balance;
+		return true;
+	}
+
+	if (proxy->fastcgi
+		&& (!strcmp (prop_name, "script") || !strcmp (prop_name, "index")))
+	{
+		char **strprop = prop_name[0] == 's' ? &proxy->script : &proxy->index;
+
+		if (!fh_conf_expect_value (ctx, value, CONF_LITERAL_STRING))
+			return false;
+
+		free (*strprop);
+
+		if (!(*strprop = strdup (value->details.literal.value.str.value)))
+		{
+			fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_MEMORY,
+								  value->line, value->column,
+								  "Memory allocation error");
+			return false;
+		}
+
+		return true;
+	}
+
+	if (!strcmp (prop_name, "hash_key"))
+	{
+		if (!fh_conf_expect_value (ctx, value, CONF_LITERAL_STRING))
+			return false;
+
+		const char *strval = value->details.literal.value.str.value;
+
+		free (proxy->hash_header);
+		proxy->hash_header = NULL;
+		proxy->hash_header_len = 0;
+
+		if (!strcmp (strval, "uri"))
+			return true;
+
+		if (strncmp (strval, "header:", 7) || !strval[7])
+		{
+			fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG,
+								  value->line, value->column,
+								  "Value of `hash_key' must be \"uri\" or "
+								  "\"header:<name>\"");
+			return false;
+		}
+
+		if (!(proxy->hash_header = strdup (strval + 7)))
+		{
+			fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_MEMORY,
+								  value->line, value->column,
+								  "Memory allocation error");
+			return false;
+		}
+
+		proxy->hash_header_len = strlen (proxy->hash_header);
+		return true;
+	}
+
+	fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG,
+						  node->details.assignment.left->line,
+						  node->details.assignment.left->column,
+						  "Invalid property '%s' in block '%s'", prop_name,
+						  proxy->fastcgi ? "fastcgi" : "proxy");
+	return false;
+}
+
+static bool
+fh_conf_traverse_proxy_block (struct fh_traverse_ctx *ctx,
+							  const struct conf_node *node, void *src_config)
+{
+	struct fh_config_host *host = src_config;
+	const char *block_name = node->details.block.name->details.identifier.value;
+
+	if (node->details.block.argc != 1)
+	{
+		fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG,
+							  node->line, node->column,
+							  "Block '%s' expects exactly one argument, "
+							  "the URI path prefix",
+							  block_name);
+		return false;
+	}
+
+	const struct conf_node *arg = node->details.block.args[0];
+
+	if (!fh_conf_expect_value (ctx, arg, CONF_LITERAL_STRING))
+		return false;
+
+	const char *path = arg->details.literal.value.str.value;
+
+	if (path[0] != '/')
+	{
+		fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG,
+							  arg->line, arg->column,
+							  "Path '%s' of block '%s' must start with '/'",
+							  path, block_name);
+		return false;
+	}
+
+	struct fh_config_proxy *proxy = calloc (1, sizeof (*proxy));
+
+	if (!proxy || !(proxy->path = strdup (path)))
+	{
+		free (proxy);
+		fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_MEMORY,
+							  node->line, node->column,
+							  "Memory allocation error");
+		return false;
+	}
+
+	proxy->path_len = strlen (path);
+	proxy->fastcgi = !strcmp (block_name, "fastcgi");
+	proxy->keepalive = FH_UPSTREAM_DEFAULT_KEEPALIVE;
+	proxy->max_fails = FH_UPSTREAM_DEFAULT_MAX_FAILS;
+	proxy->fail_timeout = FH_UPSTREAM_DEFAULT_FAIL_TIMEOUT;
+
+	for (size_t i = 0; i < node->details.block.child_count; i++)
+	{
+		struct conf_node *child = node->details.block.children[i];
+
+		if (child->type != CONF_NODE_ASSIGNMENT)
+		{
+			fh_conf_parser_error (
+				ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG, child->line,
+				child->column,
+				"Syntax error: unexpected junk (expected only properties)");
+			fh_conf_free_proxy (proxy);
+			return false;
+		}
+
+		if (!fh_conf_traverse_proxy_block_assignment (ctx, child, proxy))
+		{
+			fh_conf_free_proxy (proxy);
+			return false;
+		}
+	}
+
+	if (!proxy->upstream_count)
+	{
+		fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG,
+							  node->line, node->column,
+							  "Block '%s' requires `upstream' to be set",
+							  block_name);
+		fh_conf_free_proxy (proxy);
+		return false;
+	}
+
+	struct fh_config_proxy **pos = &host->proxies;
+
+	while (*pos && (*pos)->path_len >= proxy->path_len)
+	{
+		if (!strcmp ((*pos)->path, proxy->path))
+		{
+			fh_conf_parser_error (
+				ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG, arg->line,
+				arg->column, "Proxy path '%s' is already defined", path);
+			fh_conf_free_proxy (proxy);
+			return false;
+		}
+
+		pos = &(*pos)->next;
+	}
+
+	proxy->next = *pos;
+	*pos = proxy;
+	return true;
+}
+
+/* end proxy block */
+
+/* cache block */
+
+static bool
+fh_conf_traverse_cache_block_assignment (struct fh_traverse_ctx *ctx,
+										 const struct conf_node *node,
+										 struct fh_config_cache *config)
+{
+	const char *prop_name
+		= node->details.assignment.left->details.identifier.value;
+	const struct conf_node *value = node->details.assignment.right;
+
+	if (!strcmp (prop_name, "path"))
+	{
+		if (!fh_conf_expect_value (ctx, value, CONF_LITERAL_STRING))
+			return false;
+
+		free (config->path);
+
+		if (!(config->path = strdup (value->details.literal.value.str.value)))
+		{
+			fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_MEMORY,
+								  value->line, value->column,
+								  "Memory allocation error");
+			return false;
+		}
+	}
+	else if (!strcmp (prop_name, "index_size"))
+	{
+		if (!fh_conf_expect_size (ctx, value, &config->index_size))
+			return false;
+	}
+	else if (!strcmp (prop_name, "max_entry_size"))
+	{
+		if (!fh_conf_expect_size (ctx, value, &config->max_entry_size))
+			return false;
+	}
+	else
+	{
+		fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG,
+							  node->details.assignment.left->line,
+							  node->details.assignment.left->column,
+							  "Invalid property '%s' in block 'cache'",
+							  prop_name);
+		return false;
+	}
+
+	return true;
+}
+
+static bool
+fh_conf_traverse_cache_block (struct fh_traverse_ctx *ctx,
+							  const struct conf_node *node, void *src_config)
+{
+	struct fh_config *config = src_config;
+
+	for (size_t i = 0; i < node->details.block.child_count; i++)
+	{
+		struct conf_node *child = node->details.block.children[i];
+
+		if (child->type != CONF_NODE_ASSIGNMENT)
+		{
+			fh_conf_parser_error (
+				ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG, child->line,
+				child->column,
+				"Syntax error: unexpected junk (expected only properties)");
+			return false;
+		}
+
+		if (!fh_conf_traverse_cache_block_assignment (ctx, child,
+													  config->cache))
+			return false;
+	}
+
+	return true;
+}
+
+/* end cache block */
+
+/* capture block */
+
+static bool
+fh_conf_traverse_capture_block_assignment (struct fh_traverse_ctx *ctx,
+										   const struct conf_node *node,
+										   struct fh_config_capture *config)
+{
+	const char *prop_name
+		= node->details.assignment.left->details.identifier.value;
+	const struct conf_node *value = node->details.assignment.right;
+
+	if (!strcmp (prop_name, "file"))
+	{
+		if (!fh_conf_expect_value (ctx, value, CONF_LITERAL_STRING))
+			return false;
+
+		free (config->file);
+
+		if (!(config->file = strdup (value->details.literal.value.str.value)))
+		{
+			fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_MEMORY,
+								  value->line, value->column,
+								  "Memory allocation error");
+			return false;
+		}
+	}
+	else if (!strcmp (prop_name, "max_size"))
+	{
+		if (!fh_conf_expect_size (ctx, value, &config->max_size))
+			return false;
+	}
+	else
+	{
+		fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG,
+							  node->details.assignment.left->line,
+							  node->details.assignment.left->column,
+							  "Invalid property '%s' in block 'capture'",
+							  prop_name);
+		return false;
+	}
+
+	return true;
+}
+
+static bool
+fh_conf_traverse_capture_block (struct fh_traverse_ctx *ctx,
+								const struct conf_node *node, void *src_config)
+{
+	struct fh_config *config = src_config;
+
+	for (size_t i = 0; i < node->details.block.child_count; i++)
+	{
+		struct conf_node *child = node->details.block.children[i];
+
+		if (child->type != CONF_NODE_ASSIGNMENT)
+		{
+			fh_conf_parser_error (
+				ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG, child->line,
+				child->column,
+				"Syntax error: unexpected junk (expected only properties)");
+			return false;
+		}
+
+		if (!fh_conf_traverse_capture_block_assignment (ctx, child,
+														config->capture))
+			return false;
+	}
+
+	return true;
+}
+
+/* end capture block */
+
+static bool
+fh_conf_traverse_host_block_assignment (struct fh_traverse_ctx *ctx,
+										const struct conf_node *node,
+										struct fh_config_host *host)
+{
+	const char *prop_name
+		= node->details.assignment.left->details.identifier.value;
+
+	if (!strcmp (prop_name, "is_default"))
+	{
+		if (!fh_conf_expect_value (ctx, node->details.assignment.right,
+								   CONF_LITERAL_BOOLEAN))
+			return false;
+
+		bool is_default
+			= node->details.assignment.right->details.literal.value.bool_value;
+
+		if (ctx->default_host_config && is_default)
+		{
+			fh_conf_parser_error (
+				ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG, node->line,
+				node->column, "A default host is already set");
+
+			return false;
+		}
+
+		host->is_default = is_default;
+
+		if (is_default)
+			ctx->default_host_config = host;
+		else if (!is_default && ctx->default_host_config == host)
+			ctx->default_host_config = NULL;
+	}
+	else if (!strcmp (prop_name, "docroot"))
+	{
+		if (!fh_conf_expect_value (ctx, node->details.assignment.right,
+								   CONF_LITERAL_STRING))
+			return false;
+
+		if (host->docroot)
+			free (host->docroot);
+
+		host->docroot = strdup (
+			node->details.assignment.right->details.literal.value.str.value);
+	}
+	else if (!strcmp (prop_name, "status"))
+	{
+		if (!fh_conf_expect_value (ctx, node->details.assignment.right,
+								   CONF_LITERAL_STRING))
+			return false;
+
+		const char *path
+			= node->details.assignment.right->details.literal.value.str.value;
+
+		if (path[0] != '/')
+		{
+			fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG,
+								  node->details.assignment.right->line,
+								  node->details.assignment.right->column,
+								  "The status path must start with '/'");
+			return false;
+		}
+
+		free (host->status_path);
+		host->status_path = strdup (path);
+
+		if (!host->status_path)
+			return false;
+
+		host->status_path_len = strlen (path);
+	}
+	else
+	{
+		fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG,
+								  node->details.assignment.left->line,
+								  node->details.assignment.left->column,
+								  "Invalid property '%s' in block 'host'",
+								  prop_name);
+		return false;
+	}
+
+	return true;
+}
+
+static bool
+fh_conf_traverse_host_block (struct fh_traverse_ctx *ctx,
+							 const struct conf_node *node, void *src_config)
+{
+	struct fh_config *config = src_config;
+
+	if (!config->hosts)
+	{
+		config->hosts = strtable_create (0);
+
+		if (!config->hosts)
+		{
+			fh_conf_parser_error (ctx->parser, CONF_PARSER_ERROR_MEMORY,
+									  node->line, node->column,
+									  "Memory allocation error");
+			return false;
+		}
+	}
+
+	if (node->details.block.argc == 0)
+	{
+		fh_conf_parser_error (
+			ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG, node->line,
+			node->column, "Expected at least one argument, but none given");
+		return false;
+	}
+
+	for (size_t i = 0; i < node->details.block.argc; i++)
+	{
+		struct conf_node *arg = node->details.block.args[i];
+
+		if (!fh_conf_expect_value (ctx, arg, CONF_LITERAL_STRING))
+			return false;
+
+		const char *host_value = arg->details.literal.value.str.value;
+
+		if (strtable_contains (config->hosts, host_value))
+		{
+			fh_conf_parser_error (
+				ctx->parser, CONF_PARSER_ERROR_INVALID_CONFIG, arg->line,
+				arg->column,
+				"Host '%s' is already defined, refusing to overwrite",
+				host_value);
+			return false;
 		}
 
 		struct fh_config_host *host = calloc (1, sizeof (*host));
@@ -900,7 +1983,7 @@ fh_conf_traverse_ctx_init (struct fh_traverse_ctx *ctx,
 		return false;
 
 	struct fh_block_handler *handlers
-		= calloc (4, sizeof (struct fh_block_handler));
+		= calloc (9, sizeof (struct fh_block_handler));
 
 	if (!handlers)
 	{
@@ -916,6 +1999,17 @@ fh_conf_traverse_ctx_init (struct fh_traverse_ctx *ctx,
 		= &fh_conf_traverse_require_root_or_host_parent;
 	handlers[3].walk_fn = &fh_conf_traverse_security_block;
 	handlers[3].is_valid_parent_fn = &fh_conf_traverse_require_no_parent;
+	handlers[4].walk_fn = &fh_conf_traverse_compression_block;
+	handlers[4].is_valid_parent_fn = &fh_conf_traverse_require_no_parent;
+	handlers[5].walk_fn = &fh_conf_traverse_tls_block;
+	handlers[5].is_valid_parent_fn
+		= &fh_conf_traverse_require_root_or_host_parent;
+	handlers[6].walk_fn = &fh_conf_traverse_proxy_block;
+	handlers[6].is_valid_parent_fn = &fh_conf_traverse_require_host_parent;
+	handlers[7].walk_fn = &fh_conf_traverse_cache_block;
+	handlers[7].is_valid_parent_fn = &fh_conf_traverse_require_no_parent;
+	handlers[8].walk_fn = &fh_conf_traverse_capture_block;
+	handlers[8].is_valid_parent_fn = &fh_conf_traverse_require_no_parent;
 
 	if (!strtable_set (ctx->block_handler_table, "host", &handlers[1]))
 	{
@@ -938,6 +2032,42 @@ fh_conf_traverse_ctx_init (struct fh_traverse_ctx *ctx,
 		return false;
 	}
 
+	if (!strtable_set (ctx->block_handler_table, "compression", &handlers[4]))
+	{
+		free (handlers);
+		strtable_destroy (ctx->block_handler_table);
+		return false;
+	}
+
+	if (!strtable_set (ctx->block_handler_table, "tls", &handlers[5]))
+	{
+		free (handlers);
+		strtable_destroy (ctx->block_handler_table);
+		return false;
+	}
+
+	if (!strtable_set (ctx->block_handler_table, "proxy", &handlers[6])
+		|| !strtable_set (ctx->block_handler_table, "fastcgi", &handlers[6]))
+	{
+		free (handlers);
+		strtable_destroy (ctx->block_handler_table);
+		return false;
+	}
+
+	if (!strtable_set (ctx->block_handler_table, "cache", &handlers[7]))
+	{
+		free (handlers);
+		strtable_destroy (ctx->block_handler_table);
+		return false;
+	}
+
+	if (!strtable_set (ctx->block_handler_table, "capture", &handlers[8]))
+	{
+		free (handlers);
+		strtable_destroy (ctx->block_handler_table);
+		return false;
+	}
+
 	ctx->root_handler = &handlers[0];
 	return true;
 }
@@ -1004,6 +2134,64 @@ fh_conf_init (struct fh_config *config)
 		}
 	}
 
+	if (!config->security->max_request_body_size)
+		config->security->max_request_body_size
+			= FH_CONF_DEFAULT_MAX_REQUEST_BODY_SIZE;
+
+	if (!config->compression)
+	{
+		config->compression = calloc (1, sizeof (*config->compression));
+
+		if (!config->compression)
+		{
+			return false;
+		}
+
+		config->compression->level = 6;
+		config->compression->min_size = 256;
+		config->compression->cache_max_file_size = 1024 * 1024;
+	}
+
+	if (!config->tls_session)
+	{
+		config->tls_session = calloc (1, sizeof (*config->tls_session));
+
+		if (!config->tls_session)
+		{
+			return false;
+		}
+
+		config->tls_session->cache_size = 4 * 1024 * 1024;
+		config->tls_session->timeout = 300;
+		config->tls_session->tickets = true;
+		config->tls_session->ticket_key_rotation = 3600;
+	}
+
+	if (!config->cache)
+	{
+		config->cache = calloc (1, sizeof (*config->cache));
+
+		if (!config->cache)
+		{
+			return false;
+		}
+
+		config->cache->index_size = 8 * 1024 * 1024;
+		config->cache->max_entry_size = 16 * 1024 * 1024;
+	}
+
+	if (!config->capture)
+	{
+		config->capture = calloc (1, sizeof (*config->capture));
+
+		if (!config->capture)
+		{
+			return false;
+		}
+
+		config->capture->max_size = 64 * 1024;
+	}
+
 	return true;
 }
 
@@ -1056,6 +2244,8 @@ fh_conf_print_security (struct fh_config_security *security, int indent)
 	fh_pr_debug ("%*sBlock [security] <%p>:", indent, "", (void *) security);
 	fh_pr_debug ("%*smax_response_body_size = %zu", indent + 2, "",
 				 security->max_response_body_size);
+	fh_pr_debug ("%*smax_request_body_size = %zu", indent + 2, "",
+				 security->max_request_body_size);
 	fh_pr_debug ("%*smax_connections = %zu", indent + 2, "",
 				 security->max_connections);
 	fh_pr_debug ("%*sheader_timeout = %u", indent + 2, "",
@@ -1068,6 +2258,104 @@ fh_conf_print_security (struct fh_config_security *security, int indent)
 				 security->send_timeout);
 }
 
+static void
+fh_conf_print_compression (struct fh_config_compression *compression,
+						   int indent)
+{
+	fh_pr_debug ("%*sBlock [compression] <%p>:", indent, "",
+				 (void *) compression);
+	fh_pr_debug ("%*senabled = %s", indent + 2, "",
+				 compression->enabled ? "true" : "false");
+	fh_pr_debug ("%*slevel = %d", indent + 2, "", compression->level);
+	fh_pr_debug ("%*smin_size = %zu", indent + 2, "", compression->min_size);
+
+	for (char **type = compression->types; type && *type; type++)
+		fh_pr_debug ("%*stypes[] = %s", indent + 2, "", *type);
+
+	fh_pr_debug ("%*scache_size = %zu", indent + 2, "",
+				 compression->cache_size);
+	fh_pr_debug ("%*scache_max_file_size = %zu", indent + 2, "",
+				 compression->cache_max_file_size);
+}
+
+static void
+fh_conf_print_tls_session (struct fh_config_tls_session *tls_session,
+						   int indent)
+{
+	fh_pr_debug ("%*sBlock [tls] <%p>:", indent, "", (void *) tls_session);
+	fh_pr_debug ("%*ssession_cache_size = %zu", indent + 2, "",
+				 tls_session->cache_size);
+	fh_pr_debug ("%*ssession_timeout = %u", indent + 2, "",
+				 tls_session->timeout);
+	fh_pr_debug ("%*ssession_tickets = %s", indent + 2, "",
+				 tls_session->tickets ? "true" : "false");
+	fh_pr_debug ("%*sticket_key_rotation = %u", indent + 2, "",
+				 tls_session->ticket_key_rotation);
+}
+
+static void
+fh_conf_print_tls (struct fh_config_tls *tls, int indent)
+{
+	fh_pr_debug ("%*sBlock [tls] <%p>:", indent, "", (void *) tls);
+	fh_pr_debug ("%*scertificate = %s", indent + 2, "", tls->certificate);
+	fh_pr_debug ("%*skey = %s", indent + 2, "", tls->key);
+	fh_pr_debug ("%*sciphers = %s", indent + 2, "",
+				 tls->ciphers ? tls->ciphers : "[default]");
+	fh_pr_debug ("%*sktls = %s", indent + 2, "", tls->ktls ? "true" : "false");
+	fh_pr_debug ("%*shttp3 = %s", indent + 2, "", tls->http3 ? "true" : "false");
+}
+
+static void
+fh_conf_print_proxy (struct fh_config_proxy *proxy, int indent)
+{
+	fh_pr_debug ("%*sBlock [%s] <%p, path:\"%s\">:", indent, "",
+				 proxy->fastcgi ? "fastcgi" : "proxy", (void *) proxy,
+				 proxy->path);
+
+	for (size_t i = 0; i < proxy->upstream_count; i++)
+		fh_pr_debug ("%*supstream[] = %s", indent + 2, "",
+					 proxy->upstreams[i].name);
+
+	fh_pr_debug ("%*skeepalive = %zu", indent + 2, "", proxy->keepalive);
+	fh_pr_debug ("%*sbalance = %d", indent + 2, "", (int) proxy->balance);
+	fh_pr_debug ("%*shash_key = %s%s", indent + 2, "",
+				 proxy->hash_header ? "header:" : "uri",
+				 proxy->hash_header ? proxy->hash_header : "");
+	fh_pr_debug ("%*smax_fails = %zu", indent + 2, "", proxy->max_fails);
+	fh_pr_debug ("%*sfail_timeout = %u", indent + 2, "", proxy->fail_timeout);
+	fh_pr_debug ("%*scache = %s", indent + 2, "",
+				 proxy->cache ? "true" : "false");
+	fh_pr_debug ("%*scache_valid = %u", indent + 2, "", proxy->cache_valid);
+
+	if (proxy->fastcgi)
+	{
+		fh_pr_debug ("%*sscript = %s", indent + 2, "",
+					 proxy->script ? proxy->script : "[document root]");
+		fh_pr_debug ("%*sindex = %s", indent + 2, "",
+					 proxy->index ? proxy->index : "[none]");
+	}
+}
+
+static void
+fh_conf_print_cache (struct fh_config_cache *cache, int indent)
+{
+	fh_pr_debug ("%*sBlock [cache] <%p>:", indent, "", (void *) cache);
+	fh_pr_debug ("%*spath = %s", indent + 2, "",
+				 cache->path ? cache->path : "[disabled]");
+	fh_pr_debug ("%*sindex_size = %zu", indent + 2, "", cache->index_size);
+	fh_pr_debug ("%*smax_entry_size = %zu", indent + 2, "",
+				 cache->max_entry_size);
+}
+
+static void
+fh_conf_print_capture (struct fh_config_capture *capture, int indent)
+{
+	fh_pr_debug ("%*sBlock [capture] <%p>:", indent, "", (void *) capture);
+	fh_pr_debug ("%*sfile = %s", indent + 2, "",
+				 capture->file ? capture->file : "[disabled]");
+	fh_pr_debug ("%*smax_size = %zu", indent + 2, "", capture->max_size);
+}
+
 static void
 fh_conf_print_logging (struct fh_config_logging *logging, int indent)
 {
@@ -1080,6 +2368,16 @@ fh_conf_print_logging (struct fh_config_logging *logging, int indent)
 				 logging ? logging->file : "[default]");
 	fh_pr_debug ("%*serror_file = %s", indent + 2, "",
 				 logging ? logging->error_file : "[default]");
+	fh_pr_debug ("%*slevels_file = %s", indent + 2, "",
+				 logging && logging->levels_file ? logging->levels_file
+												 : "[none]");
+	fh_pr_debug ("%*saccess_file = %s", indent + 2, "",
+				 logging && logging->access_file ? logging->access_file
+												 : "[none]");
+	fh_pr_debug ("%*saccess_format = %s", indent + 2, "",
+				 logging && logging->access_format == FH_ACCESS_FORMAT_BINARY
+					 ? "binary"
+					 : "json");
 }
 
 void
@@ -1087,7 +2385,12 @@ fh_conf_print (struct fh_config *config, int indent)
 {
 	fh_pr_debug ("%*sConfiguration <%p>:", indent, "", (void *) config);
 	fh_pr_debug ("%*sroot = %s", indent, "", config->conf_root);
-	fh_pr_debug ("%*sworker_count = %zu", indent, "", config->worker_count);
+	fh_pr_debug ("%*sworker_count = %zu%s", indent, "", config->worker_count,
+				 config->worker_count ? "" : " [auto]");
+	fh_pr_debug ("%*sworker_cpu_affinity = %s", indent, "",
+				 config->worker_cpus_auto ? "auto"
+				 : config->worker_cpus	  ? "[list]"
+										  : "none");
 
 	for (struct strtable_entry *entry = config->hosts->head; entry;
 		 entry = entry->next)
@@ -1101,11 +2404,26 @@ fh_conf_print (struct fh_config *config, int indent)
 		fh_pr_debug ("%*sis_default = %s", indent + 2, "",
 					 host->is_default ? "true" : "false");
 		fh_pr_debug ("%*sdocroot = %s", indent + 2, "", host->docroot);
+
+		if (host->status_path)
+			fh_pr_debug ("%*sstatus = %s", indent + 2, "", host->status_path);
+
 		fh_conf_print_logging (host->logging, indent + 2);
+
+		if (host->tls)
+			fh_conf_print_tls (host->tls, indent + 2);
+
+		for (struct fh_config_proxy *proxy = host->proxies; proxy;
+			 proxy = proxy->next)
+			fh_conf_print_proxy (proxy, indent + 2);
 	}
 
 	fh_conf_print_logging (config->logging, indent);
 	fh_conf_print_security (config->security, indent);
+	fh_conf_print_compression (config->compression, indent);
+	fh_conf_print_tls_session (config->tls_session, indent);
+	fh_conf_print_cache (config->cache, indent);
+	fh_conf_print_capture (config->capture, indent);
 }
 
 void
@@ -1113,6 +2431,8 @@ fh_conf_free_logging_config (struct fh_config_logging *logging)
 {
 	free (logging->file);
 	free (logging->error_file);
+	free (logging->levels_file);
+	free (logging->access_file);
 	free (logging);
 }
 
@@ -1125,7 +2445,27 @@ fh_conf_free (struct fh_config *config)
     if (config->logging)
 	    fh_conf_free_logging_config (config->logging);
 
+	free (config->worker_cpus);
 	free (config->security);
+	free (config->tls_session);
+
+	if (config->cache)
+	{
+		free (config->cache->path);
+		free (config->cache);
+	}
+
+	if (config->capture)
+	{
+		free (config->capture->file);
+		free (config->capture);
+	}
+
+	if (config->compression)
+	{
+		fh_conf_free_string_list (config->compression->types);
+		free (config->compression);
+	}
 
 	if (!config->no_free_hosts && config->hosts)
 	{
@@ -1137,7 +2477,23 @@ fh_conf_free (struct fh_config *config)
             if (host->logging)
 			    fh_conf_free_logging_config (host->logging);
 
+			if (host->tls)
+			{
+				free (host->tls->certificate);
+				free (host->tls->key);
+				free (host->tls->ciphers);
+				free (host->tls);
+			}
+
+			for (struct fh_config_proxy *proxy = host->proxies, *next; proxy;
+				 proxy = next)
+			{
+				next = proxy->next;
+				fh_conf_free_proxy (proxy);
+			}
+
             free (host->docroot);
+			free (host->status_path);
 			free (host->addr.full_hostname);
 			free (host->addr.hostname);
             free (host);
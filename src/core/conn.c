@@ -17,22 +17,35 @@
  * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
+
+#include <errno.h>
 #include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
 #define FH_LOG_MODULE_NAME "conn"
 
+#include "accesslog.h"
+#include "capture.h"
 #include "conn.h"
+#include "stats.h"
+#include "http/h2.h"
 #include "http/http1_response.h"
 #include "http/protocol.h"
 #include "log/log.h"
 #include "compat.h"
 #include "macros.h"
+#include "probes.h"
+#include "tls.h"
 
 #ifdef HAVE_RESOURCES
 	#include "resources.h"
@@ -58,6 +71,7 @@ fh_conn_create (fd_t client_sockfd, const struct sockaddr_in *client_addr,
 
 	conn->id = next_conn_id++;
 	conn->client_addr = (struct sockaddr_in *) (conn + 1);
+	memcpy (conn->client_addr, client_addr, sizeof (*client_addr));
 	conn->stream = (struct fh_stream *) (conn->client_addr + 1);
 	conn->client_sockfd = client_sockfd;
 	conn->pool = pool;
@@ -67,9 +81,38 @@ fh_conn_create (fd_t client_sockfd, const struct sockaddr_in *client_addr,
 	conn->io_ctx.proto_det_buf.off = 0;
 	conn->requests = (struct fh_requests *) (conn->stream + 1);
 	conn->extra = (struct fh_conn_extra *) (conn->requests + 1);
+	conn->ssl = NULL;
+	conn->tls_buf = NULL;
+	conn->tls_established = false;
+	conn->tls_want_write = false;
+	conn->ktls_send = false;
+	conn->requests_in_flight = 0;
+	memset (&conn->capture, 0, sizeof (conn->capture));
+	conn->bytes_sent = 0;
+
+	/* Responses are written as a header followed by a body that is sent
+	   separately, and HTTP/2 interleaves small frames of several streams.
+	   Nagle's algorithm would hold the small writes back until the
+	   client's delayed ACK.  Not every client socket is TCP, so failure is
+	   not an error.  */
+	if (client_sockfd >= 0)
+	{
+		int one = 1;
+
+		setsockopt (client_sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+	}
 
+	memset (&conn->timing, 0, sizeof (conn->timing));
+	fh_stats_mark (&conn->timing, FH_STATS_MARK_ACCEPT);
 	memset (conn->requests, 0,
 			sizeof (*conn->requests) + sizeof (*conn->extra));
+	fh_stats_add (accepted, 1);
+	fh_stats_add (idle, 1);
+
+	/* HTTP/3 connections have no stream of bytes to replay */
+	if (fh_capture_fd >= 0 && client_sockfd >= 0)
+		fh_capture_write (conn->id, FH_CAPTURE_OPEN, NULL, 0);
+
 	return conn;
 }
 
@@ -77,6 +120,10 @@ void
 fh_conn_destroy (struct fh_conn *conn)
 {
 	fh_pr_debug ("Connection #%lu will now be deallocated", conn->id);
+	fh_stats_record (&conn->timing);
+
+	if (fh_capture_fd >= 0 && conn->client_sockfd >= 0)
+		fh_capture_write (conn->id, FH_CAPTURE_CLOSE, NULL, 0);
 
 	struct fh_request *r = conn->requests->head;
 
@@ -91,14 +138,30 @@ fh_conn_destroy (struct fh_conn *conn)
 		r = r_next;
 	}
 
-	if (conn->io_ctx.h1.res_ctx)
+	if (conn->protocol == FH_PROTOCOL_H2)
+	{
+		if (conn->io_ctx.h2)
+			fh_h2_ctx_destroy (conn->io_ctx.h2);
+	}
+	else if (conn->io_ctx.h1.res_ctx)
 	{
 		fh_http1_res_ctx_clean (conn->io_ctx.h1.res_ctx);
 		fh_pool_destroy (conn->io_ctx.h1.res_ctx->pool);
 	}
 
+	/* HTTP/2 streams are gone by now.  */
+	if (conn->requests_in_flight)
+		fh_stats_sub (active, 1);
+	else
+		fh_stats_sub (idle, 1);
+
 	pool_t *pool = conn->pool;
-	close (conn->client_sockfd);
+	fh_tls_close (conn);
+
+	/* HTTP/3 connections share the socket of their endpoint */
+	if (conn->client_sockfd >= 0)
+		close (conn->client_sockfd);
+
 	fh_pool_destroy (pool);
 }
 
@@ -140,6 +203,8 @@ fh_conn_pop_request (struct fh_requests *requests)
 bool
 fh_conn_send_err_response (struct fh_conn *conn, enum fh_status code)
 {
+	fh_stats_response (code);
+
 	size_t status_text_len = 0, description_len = 0;
 	const char *status_text = fh_get_status_text (code, &status_text_len);
 	const char *description
@@ -154,62 +219,203 @@ fh_conn_send_err_response (struct fh_conn *conn, enum fh_status code)
 	const size_t response_len = resource_error_html_len - (2 * 7) - 2 + (2 * 3)
 								+ (2 * status_text_len) + description_len
 								+ host_len + port_len;
-	int rc;
+	char *headers = NULL, *body = NULL;
+	int headers_len, body_len;
+	bool ret = false;
 
-	rc = dprintf (conn->client_sockfd,
-				  "HTTP/1.1 %d %s\r\nServer: freehttpd\r\nContent-Length: "
-				  "%zu\r\nContent-Type: text/html; charset=UTF-8\r\n\r\n",
-				  code, status_text, response_len);
+	headers_len = asprintf (
+		&headers,
+		"HTTP/1.1 %d %s\r\nServer: freehttpd\r\nContent-Length: "
+		"%zu\r\nContent-Type: text/html; charset=UTF-8\r\n\r\n",
+		code, status_text, response_len);
 
-	if (rc < 0)
+	if (headers_len < 0)
 		return false;
 
-	rc = dprintf (conn->client_sockfd, resource_error_html, code, status_text,
-				  code, status_text, description, (int) host_len,
-				  conn->extra->host, conn->extra->port);
+	body_len = asprintf (&body, resource_error_html, code, status_text, code,
+						 status_text, description, (int) host_len,
+						 conn->extra->host, conn->extra->port);
 
-	return rc >= 0;
+	if (body_len >= 0)
+	{
+		struct iovec iov[2] = {
+			{ .iov_base = headers, .iov_len = (size_t) headers_len },
+			{ .iov_base = body, .iov_len = (size_t) body_len },
+		};
+
+		/* Best effort, like the rest of the error path: whatever does not
+		   fit into the socket buffer right now is dropped.  */
+		while (iov[1].iov_len > 0)
+		{
+			int idx = iov[0].iov_len > 0 ? 0 : 1;
+			ssize_t wrote = fh_conn_writev (conn, iov + idx, 2 - idx);
+
+			if (wrote <= 0)
+				break;
+
+			for (size_t size = (size_t) wrote; size > 0 && idx < 2; idx++)
+			{
+				size_t n = size < iov[idx].iov_len ? size : iov[idx].iov_len;
+
+				iov[idx].iov_base = (char *) iov[idx].iov_base + n;
+				iov[idx].iov_len -= n;
+				size -= n;
+			}
+		}
+
+		ret = iov[1].iov_len == 0;
+		fh_access_log (conn, NULL, code, (size_t) body_len - iov[1].iov_len,
+					   &conn->timing);
+	}
+
+	free (headers);
+	free (body);
+	return ret;
 }
 
 int
 fh_conn_detect_protocol (struct fh_conn *conn)
 {
-	fd_t sockfd = conn->client_sockfd;
+	char *buf = conn->io_ctx.proto_det_buf.buf;
+	size_t off = conn->io_ctx.proto_det_buf.off;
 
-	if (conn->io_ctx.proto_det_buf.off == 0)
+	if (!buf)
 	{
-		conn->io_ctx.proto_det_buf.buf = fh_pool_alloc (conn->pool, H2_PREFACE_SIZE);
+		buf = fh_pool_alloc (conn->pool, FH_CONN_RECV_BUF_SIZE);
 
-		if (!conn->io_ctx.proto_det_buf.buf)
+		if (!buf)
 			return -1;
-	}
 
-	if (conn->io_ctx.proto_det_buf.off >= H2_PREFACE_SIZE - 1)
-		return 1;
+		conn->io_ctx.proto_det_buf.buf = buf;
+	}
 
-	ssize_t bytes_read = recv (
-		sockfd, conn->io_ctx.proto_det_buf.buf + conn->io_ctx.proto_det_buf.off,
-		H2_PREFACE_SIZE - conn->io_ctx.proto_det_buf.off, 0);
+	ssize_t bytes_read
+		= fh_conn_recv (conn, buf + off, FH_CONN_RECV_BUF_SIZE - off);
 
 	if (bytes_read <= 0)
 	{
-		if (would_block ())
+		if (bytes_read < 0 && would_block ())
 			return 0;
 
 		return -1;
 	}
 
-	conn->io_ctx.proto_det_buf.off += (size_t) bytes_read;
+	off += (size_t) bytes_read;
+	conn->io_ctx.proto_det_buf.off = off;
+
+	/* The first byte that differs from the HTTP/2 preface settles it, so
+	   e.g. "GET " commits to HTTP/1.x right away.  */
+	if (memcmp (buf, H2_PREFACE, off < H2_PREFACE_SIZE ? off : H2_PREFACE_SIZE))
+		conn->protocol = FH_PROTOCOL_HTTP_1_1;
+	else if (off < H2_PREFACE_SIZE)
+		return 0;
+	else
+		conn->protocol = FH_PROTOCOL_H2;
+
+	FH_PROBE3 (conn__protocol, conn->id, conn->client_sockfd, conn->protocol);
+	return 1;
+}
+
+void
+fh_conn_request_begin (struct fh_conn *conn)
+{
+	if (!conn->requests_in_flight++)
+	{
+		fh_stats_sub (idle, 1);
+		fh_stats_add (active, 1);
+	}
+}
+
+void
+fh_conn_request_end (struct fh_conn *conn)
+{
+	if (conn->requests_in_flight && !--conn->requests_in_flight)
+	{
+		fh_stats_sub (active, 1);
+		fh_stats_add (idle, 1);
+	}
+}
 
-	if (conn->io_ctx.proto_det_buf.off >= H2_PREFACE_SIZE - 1)
+/* Counts what went through a socket call, and passes its result on */
+static inline ssize_t
+fh_conn_count (struct fh_conn *conn, ssize_t bytes, bool in)
+{
+	if (bytes > 0 && in)
+	{
+		FH_PROBE3 (conn__recv, conn->id, conn->client_sockfd, bytes);
+		fh_stats_add (bytes_in, (uint64_t) bytes);
+	}
+	else if (bytes > 0)
+	{
+		FH_PROBE3 (conn__send, conn->id, conn->client_sockfd, bytes);
+		fh_stats_add (bytes_out, (uint64_t) bytes);
+		conn->bytes_sent += (uint64_t) bytes;
+	}
+
+	return bytes;
+}
+
+ssize_t
+fh_conn_recv (struct fh_conn *conn, void *buf, size_t len)
+{
+#ifdef FHTTPD_ENABLE_TLS
+	ssize_t bytes = conn->ssl ? fh_tls_recv (conn, buf, len)
+							  : recv (conn->client_sockfd, buf, len, 0);
+#else
+	ssize_t bytes = recv (conn->client_sockfd, buf, len, 0);
+#endif /* FHTTPD_ENABLE_TLS */
+
+	if (bytes > 0)
 	{
-		if (memcmp (conn->io_ctx.proto_det_buf.buf, H2_PREFACE, H2_PREFACE_SIZE) == 0)
-			conn->protocol = FH_PROTOCOL_H2;
-		else
-			conn->protocol = FH_PROTOCOL_HTTP_1_1;
+		fh_stats_mark (&conn->timing, FH_STATS_MARK_FIRST_BYTE);
 
-		return 1;
+		if (fh_capture_fd >= 0)
+			fh_capture_data (conn->id, &conn->capture, buf, (size_t) bytes);
 	}
 
-	return 0;
+	return fh_conn_count (conn, bytes, true);
+}
+
+ssize_t
+fh_conn_writev (struct fh_conn *conn, const struct iovec *iov, int iovcnt)
+{
+#ifdef FHTTPD_ENABLE_TLS
+	if (conn->ssl)
+		return fh_conn_count (conn, fh_tls_writev (conn, iov, iovcnt), false);
+#endif /* FHTTPD_ENABLE_TLS */
+
+	return fh_conn_count (conn, writev (conn->client_sockfd, iov, iovcnt),
+						  false);
+}
+
+ssize_t
+fh_conn_sendfile (struct fh_conn *conn, fd_t in_fd, size_t *offset,
+				  size_t count)
+{
+#ifdef FHTTPD_ENABLE_TLS
+	if (conn->ssl)
+		return fh_conn_count (
+			conn, fh_tls_sendfile (conn, in_fd, offset, count), false);
+#endif /* FHTTPD_ENABLE_TLS */
+
+	return fh_conn_count (
+		conn,
+		sendfile64 (conn->client_sockfd, in_fd, (off64_t *) offset, count),
+		false);
+}
+
+bool
+fh_conn_can_splice (const struct fh_conn *conn)
+{
+	return !conn->ssl || conn->ktls_send;
+}
+
+ssize_t
+fh_conn_splice (struct fh_conn *conn, fd_t pipe_fd, size_t count)
+{
+	/* With kTLS the kernel encrypts whatever reaches the socket.  */
+	return fh_conn_count (conn,
+						  splice (pipe_fd, NULL, conn->client_sockfd, NULL,
+								  count, SPLICE_F_NONBLOCK | SPLICE_F_MOVE),
+						  false);
 }
@@ -24,11 +24,18 @@
 #include <sys/types.h>
 #include <stddef.h>
 #include <netinet/in.h>
+#include <sys/uio.h>
 #include "types.h"
 #include "mm/pool.h"
+#include "capture.h"
+#include "stats.h"
 #include "stream.h"
 #include "http/protocol.h"
 
+/* Size of the first receive buffer of a connection, which protocol
+   detection reads into and then hands over to the protocol handler */
+#define FH_CONN_RECV_BUF_SIZE 4096
+
 struct fh_requests
 {
     struct fh_request *head;
@@ -36,6 +43,8 @@ struct fh_requests
     size_t count;
 };
 
+struct ssl_st;
+
 struct fh_conn_extra
 {
     const char *host;
@@ -56,6 +65,22 @@ struct fh_conn
     struct fh_requests *requests;
     struct fh_conn_extra *extra;
     const struct fh_config_host *config;
+	/* Requests or streams that have not been answered in full */
+	uint32_t requests_in_flight;
+	/* Of the connection, and of its request over HTTP/1.x, which is the
+	   only one */
+	struct fh_stats_timing timing;
+	/* How far the capture file has followed what was received */
+	struct fh_capture_conn capture;
+	/* Bytes written to the client */
+	uint64_t bytes_sent;
+
+	/* Only set on TLS listeners */
+	struct ssl_st *ssl;
+	uint8_t *tls_buf;
+	bool tls_established : 1;
+	bool tls_want_write : 1;
+	bool ktls_send : 1;
 
     union {
 		struct {
@@ -67,6 +92,8 @@ struct fh_conn
             struct fh_http1_req_ctx *req_ctx;
             struct fh_http1_res_ctx *res_ctx;
         } h1;
+
+		struct fh_h2_ctx *h2;
     } io_ctx;
 };
 
@@ -76,5 +103,15 @@ void fh_conn_push_request (struct fh_requests *requests, struct fh_request *requ
 struct fh_request *fh_conn_pop_request (struct fh_requests *requests);
 bool fh_conn_send_err_response (struct fh_conn *conn, enum fh_status code);
 int fh_conn_detect_protocol (struct fh_conn *conn);
+/* Track whether the connection is active or idle, for the statistics */
+void fh_conn_request_begin (struct fh_conn *conn);
+void fh_conn_request_end (struct fh_conn *conn);
+
+ssize_t fh_conn_recv (struct fh_conn *conn, void *buf, size_t len);
+ssize_t fh_conn_writev (struct fh_conn *conn, const struct iovec *iov, int iovcnt);
+ssize_t fh_conn_sendfile (struct fh_conn *conn, fd_t in_fd, size_t *offset, size_t count);
+/* Whether data can be moved straight from a pipe to the client socket */
+bool fh_conn_can_splice (const struct fh_conn *conn);
+ssize_t fh_conn_splice (struct fh_conn *conn, fd_t pipe_fd, size_t count);
 
 #endif /* FH_CORE_CONN_H */
@@ -17,54 +17,90 @@
  * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
+
 #include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/signalfd.h>
+#include <sys/time.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #define FH_LOG_MODULE_NAME "master"
 
+#include "cache.h"
+#include "capture.h"
 #include "conf.h"
 #include "confproc.h"
 #include "log/log.h"
 #include "master.h"
 #include "module.h"
+#include "quic.h"
+#include "stats.h"
+#include "tls.h"
+#include "upstream.h"
 #include "worker.h"
 
 #ifdef HAVE_CONFPATHS_H
 	#include "confpaths.h"
 #endif /* HAVE_CONFPATHS_H */
 
-#define FH_MASTER_SPAWN_WORKERS 8
-
-static struct fh_master *local_master = NULL;
-static bool should_exit = false;
+/* Respawn delays grow from the minimum up to the maximum while a worker
+   keeps exiting within FH_MASTER_STABLE_TIME of its start, in µs */
+#define FH_MASTER_RESPAWN_DELAY_MIN 100000
+#define FH_MASTER_RESPAWN_DELAY_MAX 30000000
+#define FH_MASTER_STABLE_TIME 10000000
 
 struct fh_master *
 fh_master_create (void)
 {
-	return calloc (1, sizeof (struct fh_master));
+	struct fh_master *master = calloc (1, sizeof (struct fh_master));
+
+	if (master)
+		master->signal_fd = -1;
+
+	return master;
 }
 
 void
 fh_master_destroy (struct fh_master *master)
 {
-	if (master->worker_pids)
+	if (master->workers)
 	{
 		for (size_t i = 0; i < master->worker_count; i++)
 		{
-			kill (master->worker_pids[i], SIGTERM);
-			fh_pr_info ("Sent SIGTERM to worker: %d", master->worker_pids[i]);
+			if (master->workers[i].pid <= 0)
+				continue;
+
+			kill (master->workers[i].pid, SIGTERM);
+			fh_pr_info ("Sent SIGTERM to worker: %d", master->workers[i].pid);
 		}
 
 		for (size_t i = 0; i < master->worker_count; i++)
-			waitpid (master->worker_pids[i], NULL, 0);
+		{
+			if (master->workers[i].pid > 0)
+				waitpid (master->workers[i].pid, NULL, 0);
+		}
 
-		free (master->worker_pids);
+		free (master->workers);
 	}
 
+	if (master->signal_fd >= 0)
+		close (master->signal_fd);
+
+	fh_tls_session_destroy ();
+	fh_quic_listeners_destroy ();
+	fh_upstream_shared_destroy ();
+	fh_cache_shared_destroy ();
+	fh_stats_shared_destroy ();
+	fh_capture_destroy ();
+
 	if (master->config)
 		fh_conf_free (master->config);
 
@@ -75,27 +111,35 @@ fh_master_destroy (struct fh_master *master)
 }
 
 static void
-fh_master_handle_term (int sig)
+fh_master_signal_set (sigset_t *set)
 {
-	fh_pr_info ("Received %s", sig == SIGTERM ? "SIGTERM" : "SIGINT");
-	should_exit = true;
+	sigemptyset (set);
+	sigaddset (set, SIGINT);
+	sigaddset (set, SIGTERM);
+	sigaddset (set, SIGCHLD);
+	sigaddset (set, SIGALRM);
+	sigaddset (set, SIGUSR1);
+	sigaddset (set, SIGUSR2);
 }
 
 bool
 fh_master_setup_signal (struct fh_master *master)
 {
-	local_master = master;
+	sigset_t set;
 
-	struct sigaction act;
+	fh_master_signal_set (&set);
 
-	act.sa_flags = SA_RESTART;
-	act.sa_handler = &fh_master_handle_term;
-	sigemptyset (&act.sa_mask);
+	/* Blocked, so that they are only read from the signalfd */
+	if (sigprocmask (SIG_BLOCK, &set, NULL) < 0)
+		return false;
+
+	master->signal_fd = signalfd (-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
 
-	if (sigaction (SIGINT, &act, NULL) < 0
-		|| sigaction (SIGTERM, &act, NULL) < 0)
+	if (master->signal_fd < 0)
 		return false;
 
+	struct sigaction act;
+
 	act.sa_flags = SA_RESTART;
 	act.sa_handler = SIG_IGN;
 	sigemptyset (&act.sa_mask);
@@ -104,31 +148,34 @@ fh_master_setup_signal (struct fh_master *master)
 }
 
 static bool
-fh_master_reset_signal (void)
+fh_master_reset_signal (struct fh_master *master)
 {
+	sigset_t set;
 	struct sigaction act;
 
+	close (master->signal_fd);
+	master->signal_fd = -1;
+
 	act.sa_flags = 0;
 	act.sa_handler = SIG_DFL;
 	sigemptyset (&act.sa_mask);
 
-	if (sigaction (SIGINT, &act, NULL) < 0
-		|| sigaction (SIGTERM, &act, NULL) < 0)
+	if (sigaction (SIGHUP, &act, NULL) < 0)
 		return false;
 
-	return sigaction (SIGINT, &act, NULL) == 0
-		   && sigaction (SIGTERM, &act, NULL) == 0
-		   && sigaction (SIGHUP, &act, NULL) == 0;
+	fh_master_signal_set (&set);
+	return sigprocmask (SIG_UNBLOCK, &set, NULL) == 0;
 }
 
 bool
-fh_master_read_config (struct fh_master *master)
+fh_master_read_config (struct fh_master *master, const char *config_file)
 {
 #ifndef FHTTPD_MAIN_CONFIG_FILE
 	#define FHTTPD_MAIN_CONFIG_FILE "/etc/freehttpd/fhttpd.conf"
 #endif
 
-	const char *config_file = FHTTPD_MAIN_CONFIG_FILE;
+	if (!config_file)
+		config_file = FHTTPD_MAIN_CONFIG_FILE;
 
 	struct fh_conf_parser *parser = fh_conf_parser_create (config_file);
 
@@ -160,6 +207,22 @@ fh_master_read_config (struct fh_master *master)
 	master->config = config;
 	fh_conf_parser_destroy (parser);
 
+	if (config->logging)
+	{
+		if (!fh_log_open (config->logging->file, config->logging->error_file))
+		{
+			fh_pr_err ("Failed to open log file: %s", strerror (errno));
+			return false;
+		}
+
+		if (config->logging->min_level)
+			fh_log_set_min_level (config->logging->min_level);
+
+		if (!fh_log_set_levels_file (config->logging->levels_file)
+			|| !fh_log_load_levels ())
+			return false;
+	}
+
 	fh_pr_info ("Read configuration file successfully");
 	fh_conf_print (config, 0);
 
@@ -177,57 +240,316 @@ fh_master_load_modules (struct fh_master *master)
 	return fh_module_manager_load (master->module_manager);
 }
 
+/* One worker per CPU in `mask' when the count is "auto", which the
+   workers inherit unless they are pinned */
+static size_t
+fh_master_worker_count (const struct fh_config *config, const cpu_set_t *mask)
+{
+	size_t count = config->worker_count;
+
+	if (count == 0)
+	{
+		count = mask ? (size_t) CPU_COUNT (mask) : 0;
+
+		if (count == 0)
+		{
+			long online = sysconf (_SC_NPROCESSORS_ONLN);
+			count = online > 0 ? (size_t) online : 1;
+		}
+	}
+
+	if (count > FH_QUIC_MAX_WORKERS)
+	{
+		fh_pr_warn ("Limiting the worker count from %zu to %d", count,
+					FH_QUIC_MAX_WORKERS);
+		count = FH_QUIC_MAX_WORKERS;
+	}
+
+	return count;
+}
+
+/* The CPU that worker `index' is pinned to, or -1 */
+static int
+fh_master_worker_cpu (const struct fh_config *config, const cpu_set_t *mask,
+					  size_t index)
+{
+	if (config->worker_cpus)
+		return config->worker_cpus[index % config->worker_cpu_count];
+
+	if (!config->worker_cpus_auto || !mask || CPU_COUNT (mask) == 0)
+		return -1;
+
+	size_t n = index % (size_t) CPU_COUNT (mask);
+
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	{
+		if (CPU_ISSET (cpu, mask) && n-- == 0)
+			return cpu;
+	}
+
+	return -1;
+}
+
+static void
+fh_master_schedule_respawn (struct fh_master_worker *worker, uint64_t now)
+{
+	uint64_t delay = FH_MASTER_RESPAWN_DELAY_MIN;
+
+	for (unsigned int i = 0;
+		 i < worker->failures && delay < FH_MASTER_RESPAWN_DELAY_MAX; i++)
+		delay *= 2;
+
+	if (delay > FH_MASTER_RESPAWN_DELAY_MAX)
+		delay = FH_MASTER_RESPAWN_DELAY_MAX;
+
+	worker->failures++;
+	worker->respawn_at = now + delay;
+}
+
+static bool
+fh_master_start_worker (struct fh_master *master, size_t index)
+{
+	struct fh_master_worker *worker = &master->workers[index];
+	pid_t pid = fork ();
+
+	if (pid < 0)
+		return false;
+
+	if (pid == 0)
+	{
+		fh_master_reset_signal (master);
+		struct fh_config *config = master->config;
+		struct fh_module_manager *module_manager = master->module_manager;
+		int cpu = worker->cpu;
+		free (master->workers);
+		free (master);
+		fh_worker_start (config, module_manager, index, cpu);
+	}
+
+	worker->pid = pid;
+	worker->started_at = fh_stats_clock ();
+
+	if (worker->cpu >= 0)
+		fh_pr_info ("Started worker process with PID %d on CPU %d", pid,
+					worker->cpu);
+	else
+		fh_pr_info ("Started worker process with PID %d", pid);
+
+	return true;
+}
+
 bool
 fh_master_spawn_workers (struct fh_master *master)
 {
-	master->worker_pids = calloc (FH_MASTER_SPAWN_WORKERS, sizeof (pid_t));
+	cpu_set_t cpu_mask;
+	const cpu_set_t *mask = &cpu_mask;
+
+	if (sched_getaffinity (0, sizeof cpu_mask, &cpu_mask) < 0)
+	{
+		fh_pr_warn ("Failed to get the CPU affinity mask: %s",
+					strerror (errno));
+		mask = NULL;
+	}
+
+	size_t worker_count = fh_master_worker_count (master->config, mask);
+
+	/* Shared state must be mapped before fork() to be inherited */
+	if (!fh_tls_session_init (master->config))
+		return false;
+
+	if (!fh_upstream_shared_init (master->config, worker_count))
+	{
+		fh_pr_err ("Failed to map the upstream server state: %s",
+				   strerror (errno));
+		return false;
+	}
 
-	if (!master->worker_pids)
+	if (!fh_cache_shared_init (master->config))
 		return false;
 
-	master->worker_count = FH_MASTER_SPAWN_WORKERS;
+	if (!fh_capture_init (master->config))
+		return false;
 
-	for (size_t i = 0; i < FH_MASTER_SPAWN_WORKERS; i++)
+	if (!fh_stats_shared_init (worker_count))
 	{
-		pid_t pid = fork ();
+		fh_pr_err ("Failed to map the worker statistics: %s", strerror (errno));
+		return false;
+	}
+
+	/* So are the UDP sockets, whose order steering depends on */
+	if (!fh_quic_listeners_init (master->config, worker_count))
+	{
+		fh_pr_err ("Failed to create the QUIC sockets: %s", strerror (errno));
+		return false;
+	}
+
+	master->workers = calloc (worker_count, sizeof (*master->workers));
 
-		if (pid < 0)
+	if (!master->workers)
+		return false;
+
+	master->worker_count = worker_count;
+
+	for (size_t i = 0; i < worker_count; i++)
+	{
+		master->workers[i].cpu = fh_master_worker_cpu (master->config, mask, i);
+
+		if (!fh_master_start_worker (master, i))
 			return false;
+	}
+
+	unsigned int rotation = fh_tls_session_rotation_interval ();
+
+	if (rotation > 0)
+	{
+		struct itimerval timer = {
+			.it_interval = { .tv_sec = rotation },
+			.it_value = { .tv_sec = rotation },
+		};
 
-		if (pid == 0)
+		if (setitimer (ITIMER_REAL, &timer, NULL) < 0)
+			return false;
+	}
+
+	fh_pr_info ("Master PID: %d", getpid ());
+	return true;
+}
+
+/* Respawns the workers whose delay has passed, and returns the time in
+   milliseconds until the next one is due, or -1 if none is waiting */
+static int
+fh_master_respawn (struct fh_master *master)
+{
+	uint64_t now = fh_stats_clock ();
+	uint64_t next = UINT64_MAX;
+
+	for (size_t i = 0; i < master->worker_count; i++)
+	{
+		struct fh_master_worker *worker = &master->workers[i];
+
+		if (worker->pid > 0)
+			continue;
+
+		if (worker->respawn_at <= now && !fh_master_start_worker (master, i))
 		{
-			local_master = NULL;
-			fh_master_reset_signal ();
-			struct fh_config *config = master->config;
-			struct fh_module_manager *module_manager = master->module_manager;
-			free (master->worker_pids);
-			free (master);
-			fh_worker_start (config, module_manager);
+			fh_pr_err ("Failed to respawn worker %zu: %s", i, strerror (errno));
+			fh_master_schedule_respawn (worker, now);
 		}
-		else
+
+		if (worker->pid <= 0 && worker->respawn_at < next)
+			next = worker->respawn_at;
+	}
+
+	if (next == UINT64_MAX)
+		return -1;
+
+	return next <= now ? 0 : (int) ((next - now + 999) / 1000);
+}
+
+static void
+fh_master_reap (struct fh_master *master)
+{
+	pid_t pid;
+	int status;
+
+	while ((pid = waitpid (-1, &status, WNOHANG)) > 0)
+	{
+		struct fh_master_worker *worker = NULL;
+
+		for (size_t i = 0; i < master->worker_count; i++)
 		{
-			master->worker_pids[i] = pid;
-			fh_pr_info ("Started worker process with PID %d", pid);
+			if (master->workers[i].pid == pid)
+			{
+				worker = &master->workers[i];
+				break;
+			}
 		}
-	}
 
-	fh_pr_info ("Master PID: %d", getpid ());
-	return true;
+		if (!worker)
+			continue;
+
+		uint64_t now = fh_stats_clock ();
+
+		worker->pid = 0;
+		fh_upstream_forget ((size_t) (worker - master->workers));
+
+		if (now - worker->started_at >= FH_MASTER_STABLE_TIME)
+			worker->failures = 0;
+
+		fh_master_schedule_respawn (worker, now);
+
+		if (WIFSIGNALED (status))
+			fh_pr_err ("Worker %d was killed by signal %d (%s), respawning "
+					   "in %" PRIu64 " ms",
+					   pid, WTERMSIG (status), strsignal (WTERMSIG (status)),
+					   (worker->respawn_at - now) / 1000);
+		else
+			fh_pr_err ("Worker %d exited with status %d, respawning in %" PRIu64
+					   " ms",
+					   pid, WEXITSTATUS (status),
+					   (worker->respawn_at - now) / 1000);
+	}
 }
 
 void
 fh_master_wait (struct fh_master *master)
 {
-	for (size_t i = 0; i < master->worker_count; i++)
+	int timeout = -1;
+
+	for (;;)
 	{
-		if (should_exit)
+		struct pollfd pfd = { .fd = master->signal_fd, .events = POLLIN };
+
+		if (poll (&pfd, 1, timeout) < 0 && errno != EINTR)
 		{
-			if (local_master)
-				fh_master_destroy (local_master);
+			fh_pr_emerg ("Failed to wait for signals: %s", strerror (errno));
+			return;
+		}
 
-			exit (EXIT_SUCCESS);
+		struct signalfd_siginfo info;
+
+		while (read (master->signal_fd, &info, sizeof info) == sizeof info)
+		{
+			switch (info.ssi_signo)
+			{
+				case SIGINT:
+				case SIGTERM:
+					fh_pr_info ("Received %s", info.ssi_signo == SIGTERM
+												   ? "SIGTERM"
+												   : "SIGINT");
+					fh_master_destroy (master);
+					exit (EXIT_SUCCESS);
+
+				case SIGCHLD:
+					fh_master_reap (master);
+					break;
+
+				case SIGALRM:
+					fh_tls_session_rotate_keys ();
+					break;
+
+				/* The workers load the levels, or reopen their logs, too */
+				case SIGUSR1:
+				case SIGUSR2:
+					if (info.ssi_signo == SIGUSR1)
+						fh_log_request_levels ();
+					else
+						fh_log_request_reopen ();
+
+					for (size_t i = 0; i < master->worker_count; i++)
+					{
+						if (master->workers[i].pid > 0)
+							kill (master->workers[i].pid, (int) info.ssi_signo);
+					}
+
+					break;
+
+				default:
+					break;
+			}
 		}
 
-		waitpid (master->worker_pids[i], NULL, 0);
+		fh_log_check_requests ();
+		timeout = fh_master_respawn (master);
 	}
 }
@@ -22,15 +22,33 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 #include "conf.h"
 #include "module.h"
+#include "types.h"
+
+struct fh_master_worker
+{
+    /* 0 while the worker waits to be respawned */
+    pid_t pid;
+    /* CPU that the worker is pinned to, or -1 */
+    int cpu;
+    /* In microseconds, as returned by fh_stats_clock() */
+    uint64_t started_at;
+    uint64_t respawn_at;
+    /* Exits in a row that came soon after the worker started; each one
+       doubles the delay before it is respawned */
+    unsigned int failures;
+};
 
 struct fh_master
 {
-    pid_t *worker_pids;
+    struct fh_master_worker *workers;
     size_t worker_count;
+    /* Delivers the signals that the master handles, which are blocked */
+    fd_t signal_fd;
     struct fh_config *config;
     struct fh_module_manager *module_manager;
 };
@@ -40,7 +58,8 @@ bool fh_master_setup_signal (struct fh_master *master);
 void fh_master_destroy (struct fh_master *master);
 bool fh_master_spawn_workers (struct fh_master *master);
 void fh_master_wait (struct fh_master *master);
-bool fh_master_read_config (struct fh_master *master);
+/* Reads CONFIG_FILE, or the default configuration file if it is NULL */
+bool fh_master_read_config (struct fh_master *master, const char *config_file);
 bool fh_master_load_modules (struct fh_master *master);
 
 #endif /* FH_CORE_MASTER_H */
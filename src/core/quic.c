@@ -0,0 +1,539 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <linux/filter.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "conf.h"
+#include "hash/strtable.h"
+#include "quic.h"
+
+#define FH_QUIC_MAX_PORTS 64
+
+/* Room for IP_PKTINFO and a UDP_GRO/UDP_SEGMENT size */
+#define FH_QUIC_CONTROL_SIZE                                                   \
+	(CMSG_SPACE (sizeof (struct in_pktinfo)) + CMSG_SPACE (sizeof (int)))
+
+static fd_t *listener_fds = NULL;
+static uint16_t listener_ports[FH_QUIC_MAX_PORTS];
+static size_t listener_port_count = 0;
+static size_t listener_worker_count = 0;
+
+bool
+fh_quic_parse_header (const uint8_t *data, size_t len,
+					  struct fh_quic_header *header)
+{
+	memset (header, 0, sizeof (*header));
+
+	if (len < 1)
+		return false;
+
+	if (!(data[0] & 0x80))
+	{
+		/* Short headers do not carry the length of the connection ID, but
+		   only the ones this server issued are of any use.  */
+		if (len < 1 + FH_QUIC_CID_LEN)
+			return false;
+
+		header->dcid = data + 1;
+		header->dcid_len = FH_QUIC_CID_LEN;
+		return true;
+	}
+
+	if (len < 7)
+		return false;
+
+	size_t off = 5;
+
+	header->is_long = true;
+	header->version = ((uint32_t) data[1] << 24) | ((uint32_t) data[2] << 16)
+					  | ((uint32_t) data[3] << 8) | data[4];
+	header->dcid_len = data[off++];
+
+	if (len < off + header->dcid_len + 1)
+		return false;
+
+	header->dcid = data + off;
+	off += header->dcid_len;
+	header->scid_len = data[off++];
+
+	if (len < off + header->scid_len)
+		return false;
+
+	header->scid = data + off;
+	return true;
+}
+
+size_t
+fh_quic_write_version_negotiation (uint8_t *out, size_t size,
+								   const struct fh_quic_header *header,
+								   const uint32_t *versions,
+								   size_t version_count)
+{
+	const size_t len = 7 + header->dcid_len + header->scid_len
+					   + 4 * version_count;
+	uint8_t unused;
+
+	if (len > size || !fh_quic_random (&unused, 1))
+		return 0;
+
+	size_t off = 0;
+
+	out[off++] = 0x80 | unused;
+	memset (out + off, 0, 4);
+	off += 4;
+
+	/* The connection IDs are echoed back swapped */
+	out[off++] = header->scid_len;
+	memcpy (out + off, header->scid, header->scid_len);
+	off += header->scid_len;
+	out[off++] = header->dcid_len;
+	memcpy (out + off, header->dcid, header->dcid_len);
+	off += header->dcid_len;
+
+	for (size_t i = 0; i < version_count; i++)
+	{
+		out[off++] = (uint8_t) (versions[i] >> 24);
+		out[off++] = (uint8_t) (versions[i] >> 16);
+		out[off++] = (uint8_t) (versions[i] >> 8);
+		out[off++] = (uint8_t) versions[i];
+	}
+
+	return off;
+}
+
+bool
+fh_quic_random (void *buf, size_t len)
+{
+	uint8_t *p = buf;
+
+	while (len > 0)
+	{
+		ssize_t n = getrandom (p, len, 0);
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			return false;
+		}
+
+		p += n;
+		len -= (size_t) n;
+	}
+
+	return true;
+}
+
+bool
+fh_quic_generate_cid (uint8_t *cid, size_t len, size_t worker)
+{
+	if (len < 1 || !fh_quic_random (cid + 1, len - 1))
+		return false;
+
+	cid[0] = (uint8_t) worker;
+	return true;
+}
+
+uint64_t
+fh_quic_cid_hash (const uint8_t *cid, size_t len)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (size_t i = 0; i < len; i++)
+	{
+		hash ^= cid[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+fd_t
+fh_quic_socket (uint16_t port)
+{
+	fd_t sockfd = socket (AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+	if (sockfd < 0)
+		return -1;
+
+	int opt = 1;
+
+	if (setsockopt (sockfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof opt) < 0
+		|| setsockopt (sockfd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof opt) < 0
+		|| setsockopt (sockfd, IPPROTO_IP, IP_PKTINFO, &opt, sizeof opt) < 0)
+	{
+		close (sockfd);
+		return -1;
+	}
+
+	/* Both are optimizations only: GRO lets the kernel coalesce datagrams
+	   of a flow, and QUIC forbids fragmentation anyway.  */
+	setsockopt (sockfd, IPPROTO_UDP, UDP_GRO, &opt, sizeof opt);
+	opt = IP_PMTUDISC_DO;
+	setsockopt (sockfd, IPPROTO_IP, IP_MTU_DISCOVER, &opt, sizeof opt);
+
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons (port),
+		.sin_addr.s_addr = INADDR_ANY,
+	};
+
+	if (bind (sockfd, (struct sockaddr *) &addr, sizeof addr) < 0)
+	{
+		close (sockfd);
+		return -1;
+	}
+
+	return sockfd;
+}
+
+/* Picks the socket of a SO_REUSEPORT group by the first byte of the
+   destination connection ID, which is the worker index for every ID the
+   server issued.  The program sees the UDP payload, that is the QUIC
+   packet.  Datagrams that are too short make it return 0, and the first
+   worker deals with them.  */
+bool
+fh_quic_attach_steering (fd_t sockfd, size_t worker_count)
+{
+	if (worker_count < 1 || worker_count > FH_QUIC_MAX_WORKERS)
+	{
+		errno = EINVAL;
+		return false;
+	}
+
+	struct sock_filter code[] = {
+		BPF_STMT (BPF_LD | BPF_B | BPF_ABS, 0),
+		BPF_JUMP (BPF_JMP | BPF_JSET | BPF_K, 0x80, 0, 2),
+		/* Long header: flags, version, DCID length, DCID */
+		BPF_STMT (BPF_LD | BPF_B | BPF_ABS, 6),
+		BPF_JUMP (BPF_JMP | BPF_JA, 1, 0, 0),
+		/* Short header: flags, DCID */
+		BPF_STMT (BPF_LD | BPF_B | BPF_ABS, 1),
+		BPF_STMT (BPF_ALU | BPF_MOD | BPF_K, (uint32_t) worker_count),
+		BPF_STMT (BPF_RET | BPF_A, 0),
+	};
+	struct sock_fprog prog = {
+		.len = sizeof (code) / sizeof (code[0]),
+		.filter = code,
+	};
+
+	return setsockopt (sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog,
+					   sizeof prog)
+		   == 0;
+}
+
+int
+fh_quic_recv_batch (fd_t sockfd, struct fh_quic_batch *batch, uint8_t *buf,
+					size_t slot_size)
+{
+	struct mmsghdr msgs[FH_QUIC_BATCH_SIZE];
+	struct iovec iov[FH_QUIC_BATCH_SIZE];
+	union
+	{
+		char buf[FH_QUIC_CONTROL_SIZE];
+		size_t align;
+	} control[FH_QUIC_BATCH_SIZE];
+
+	memset (msgs, 0, sizeof msgs);
+	batch->count = 0;
+
+	for (size_t i = 0; i < FH_QUIC_BATCH_SIZE; i++)
+	{
+		iov[i].iov_base = buf + i * slot_size;
+		iov[i].iov_len = slot_size;
+		msgs[i].msg_hdr.msg_name = &batch->datagrams[i].remote;
+		msgs[i].msg_hdr.msg_namelen = sizeof (batch->datagrams[i].remote);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_control = control[i].buf;
+		msgs[i].msg_hdr.msg_controllen = sizeof (control[i].buf);
+	}
+
+	int count;
+
+	while ((count = recvmmsg (sockfd, msgs, FH_QUIC_BATCH_SIZE, 0, NULL)) < 0)
+	{
+		if (errno == EINTR)
+			continue;
+
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return 0;
+
+		return -1;
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		struct fh_quic_datagram *datagram = &batch->datagrams[i];
+
+		datagram->data = iov[i].iov_base;
+		datagram->len = msgs[i].msg_len;
+		datagram->segment_size = 0;
+		datagram->local.s_addr = INADDR_ANY;
+
+		for (struct cmsghdr *cmsg = CMSG_FIRSTHDR (&msgs[i].msg_hdr); cmsg;
+			 cmsg = CMSG_NXTHDR (&msgs[i].msg_hdr, cmsg))
+		{
+			if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO)
+			{
+				struct in_pktinfo info;
+
+				memcpy (&info, CMSG_DATA (cmsg), sizeof info);
+				datagram->local = info.ipi_addr;
+			}
+			else if (cmsg->cmsg_level == IPPROTO_UDP
+					 && cmsg->cmsg_type == UDP_GRO)
+			{
+				int size;
+
+				memcpy (&size, CMSG_DATA (cmsg), sizeof size);
+
+				if (size > 0 && (size_t) size < datagram->len)
+					datagram->segment_size = (size_t) size;
+			}
+		}
+	}
+
+	batch->count = (size_t) count;
+	return count;
+}
+
+int
+fh_quic_send_batch (fd_t sockfd, const struct fh_quic_batch *batch)
+{
+	struct mmsghdr msgs[FH_QUIC_BATCH_SIZE];
+	struct iovec iov[FH_QUIC_BATCH_SIZE];
+	union
+	{
+		char buf[FH_QUIC_CONTROL_SIZE];
+		size_t align;
+	} control[FH_QUIC_BATCH_SIZE];
+
+	memset (msgs, 0, sizeof msgs);
+	memset (control, 0, sizeof control);
+
+	for (size_t i = 0; i < batch->count; i++)
+	{
+		const struct fh_quic_datagram *datagram = &batch->datagrams[i];
+		struct msghdr *hdr = &msgs[i].msg_hdr;
+		size_t controllen = 0;
+
+		iov[i].iov_base = datagram->data;
+		iov[i].iov_len = datagram->len;
+		hdr->msg_name = (void *) &datagram->remote;
+		hdr->msg_namelen = sizeof (datagram->remote);
+		hdr->msg_iov = &iov[i];
+		hdr->msg_iovlen = 1;
+		hdr->msg_control = control[i].buf;
+		hdr->msg_controllen = sizeof (control[i].buf);
+
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR (hdr);
+
+		/* Answer from the address the peer talked to */
+		if (datagram->local.s_addr != INADDR_ANY)
+		{
+			struct in_pktinfo info = { .ipi_spec_dst = datagram->local };
+
+			cmsg->cmsg_level = IPPROTO_IP;
+			cmsg->cmsg_type = IP_PKTINFO;
+			cmsg->cmsg_len = CMSG_LEN (sizeof info);
+			memcpy (CMSG_DATA (cmsg), &info, sizeof info);
+			controllen += CMSG_SPACE (sizeof info);
+			cmsg = CMSG_NXTHDR (hdr, cmsg);
+		}
+
+		if (datagram->segment_size && datagram->segment_size < datagram->len)
+		{
+			uint16_t size = (uint16_t) datagram->segment_size;
+
+			cmsg->cmsg_level = IPPROTO_UDP;
+			cmsg->cmsg_type = UDP_SEGMENT;
+			cmsg->cmsg_len = CMSG_LEN (sizeof size);
+			memcpy (CMSG_DATA (cmsg), &size, sizeof size);
+			controllen += CMSG_SPACE (sizeof size);
+		}
+
+		hdr->msg_controllen = controllen;
+
+		if (!controllen)
+			hdr->msg_control = NULL;
+	}
+
+	size_t sent = 0, failed = 0;
+
+	while (sent < batch->count)
+	{
+		int n = sendmmsg (sockfd, msgs + sent, (unsigned int) (batch->count - sent),
+						  0);
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+
+			/* Only the first datagram failed, e.g. because its peer is
+			   unreachable; the others may still go out.  */
+			failed++;
+			sent++;
+			continue;
+		}
+
+		sent += (size_t) n;
+	}
+
+	if (failed && failed == batch->count)
+		return -1;
+
+	return (int) (sent - failed);
+}
+
+bool
+fh_quic_listeners_init (const struct fh_config *config, size_t worker_count)
+{
+	if (worker_count > FH_QUIC_MAX_WORKERS)
+	{
+		errno = EINVAL;
+		return false;
+	}
+
+	for (const struct strtable_entry *entry = config->hosts->head; entry;
+		 entry = entry->next)
+	{
+		const struct fh_config_host *host = entry->data;
+		size_t k;
+
+		if (!host->tls || !host->tls->http3)
+			continue;
+
+		for (k = 0; k < listener_port_count; k++)
+		{
+			if (listener_ports[k] == host->addr.port)
+				break;
+		}
+
+		if (k < listener_port_count)
+			continue;
+
+		if (listener_port_count >= FH_QUIC_MAX_PORTS)
+		{
+			errno = ENOSPC;
+			return false;
+		}
+
+		listener_ports[listener_port_count++] = host->addr.port;
+	}
+
+	if (!listener_port_count)
+		return true;
+
+	listener_fds = malloc (listener_port_count * worker_count * sizeof (fd_t));
+
+	if (!listener_fds)
+		return false;
+
+	for (size_t i = 0; i < listener_port_count * worker_count; i++)
+		listener_fds[i] = -1;
+
+	listener_worker_count = worker_count;
+
+	for (size_t i = 0; i < listener_port_count; i++)
+	{
+		fd_t *fds = listener_fds + i * worker_count;
+
+		for (size_t w = 0; w < worker_count; w++)
+		{
+			if ((fds[w] = fh_quic_socket (listener_ports[i])) < 0)
+				return false;
+		}
+
+		if (!fh_quic_attach_steering (fds[0], worker_count))
+			return false;
+	}
+
+	return true;
+}
+
+size_t
+fh_quic_listeners_take (size_t worker, fd_t *fds, uint16_t *ports, size_t cap)
+{
+	size_t count = 0;
+
+	if (!listener_fds || worker >= listener_worker_count)
+		return 0;
+
+	for (size_t i = 0; i < listener_port_count; i++)
+	{
+		for (size_t w = 0; w < listener_worker_count; w++)
+		{
+			fd_t *fd = &listener_fds[i * listener_worker_count + w];
+
+			if (w == worker && count < cap)
+			{
+				fds[count] = *fd;
+				ports[count++] = listener_ports[i];
+			}
+			else
+			{
+				close (*fd);
+			}
+
+			*fd = -1;
+		}
+	}
+
+	return count;
+}
+
+size_t
+fh_quic_listeners_worker_count (void)
+{
+	return listener_worker_count;
+}
+
+void
+fh_quic_listeners_destroy (void)
+{
+	if (!listener_fds)
+		return;
+
+	for (size_t i = 0; i < listener_port_count * listener_worker_count; i++)
+	{
+		if (listener_fds[i] >= 0)
+			close (listener_fds[i]);
+	}
+
+	free (listener_fds);
+	listener_fds = NULL;
+	listener_port_count = 0;
+	listener_worker_count = 0;
+}
@@ -0,0 +1,110 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FH_CORE_QUIC_H
+#define FH_CORE_QUIC_H
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "types.h"
+
+#define FH_QUIC_MAX_CID_LEN 20
+/* Length of the connection IDs issued by the server.  Their first byte is
+   the index of the worker that owns the connection, which the kernel
+   steers datagrams by.  */
+#define FH_QUIC_CID_LEN 16
+#define FH_QUIC_MAX_WORKERS 256
+/* Datagrams moved per recvmmsg() or sendmmsg() call */
+#define FH_QUIC_BATCH_SIZE 16
+/* Largest datagram the kernel may hand over once GRO coalesced it */
+#define FH_QUIC_MAX_GRO_SIZE 65535
+/* Clients must pad the datagrams of their first flight to this size */
+#define FH_QUIC_MIN_INITIAL_SIZE 1200
+
+/* The version-independent part of a packet header (RFC 8999) */
+struct fh_quic_header
+{
+	uint32_t version;
+	bool is_long;
+	const uint8_t *dcid;
+	const uint8_t *scid;
+	uint8_t dcid_len;
+	uint8_t scid_len;
+};
+
+struct fh_quic_datagram
+{
+	uint8_t *data;
+	size_t len;
+	/* Size of each packet in a datagram that the kernel coalesced (GRO) or
+	   is to split up (GSO), the last one may be shorter; 0 if the datagram
+	   is a single packet.  */
+	size_t segment_size;
+	struct sockaddr_in remote;
+	/* The address the datagram was sent to, and is answered from */
+	struct in_addr local;
+};
+
+struct fh_quic_batch
+{
+	struct fh_quic_datagram datagrams[FH_QUIC_BATCH_SIZE];
+	size_t count;
+};
+
+struct fh_config;
+
+bool fh_quic_parse_header (const uint8_t *data, size_t len,
+						   struct fh_quic_header *header);
+size_t fh_quic_write_version_negotiation (uint8_t *out, size_t size,
+										  const struct fh_quic_header *header,
+										  const uint32_t *versions,
+										  size_t version_count);
+
+bool fh_quic_random (void *buf, size_t len);
+bool fh_quic_generate_cid (uint8_t *cid, size_t len, size_t worker);
+uint64_t fh_quic_cid_hash (const uint8_t *cid, size_t len);
+
+fd_t fh_quic_socket (uint16_t port);
+bool fh_quic_attach_steering (fd_t sockfd, size_t worker_count);
+
+/* Receives up to FH_QUIC_BATCH_SIZE datagrams into consecutive slots of
+   `slot_size' bytes of `buf'.  Returns the number of datagrams, 0 if none
+   were queued, or -1 on errors.  */
+int fh_quic_recv_batch (fd_t sockfd, struct fh_quic_batch *batch,
+						uint8_t *buf, size_t slot_size);
+/* Returns the number of datagrams handed to the kernel, or -1 on errors.
+   Datagrams that did not fit into the socket buffer are dropped, as QUIC
+   retransmits them anyway.  */
+int fh_quic_send_batch (fd_t sockfd, const struct fh_quic_batch *batch);
+
+/* UDP sockets of the HTTP/3 ports, one per worker and port.  They are
+   created before the workers are forked so that their order in the
+   SO_REUSEPORT group, which steering relies on, matches the worker
+   indices.  */
+bool fh_quic_listeners_init (const struct fh_config *config,
+							 size_t worker_count);
+size_t fh_quic_listeners_take (size_t worker, fd_t *fds, uint16_t *ports,
+							   size_t cap);
+size_t fh_quic_listeners_worker_count (void);
+void fh_quic_listeners_destroy (void);
+
+#endif /* FH_CORE_QUIC_H */
@@ -32,17 +32,25 @@
 
 #define FH_LOG_MODULE_NAME "server"
 
+#include "accesslog.h"
+#include "cache.h"
 #include "compat.h"
 #include "conf.h"
 #include "conn.h"
 #include "event/accept.h"
+#include "event/quic.h"
 #include "event/recv.h"
 #include "event/send.h"
 #include "hash/itable.h"
+#include "http/compress.h"
 #include "log/log.h"
 #include "router/router.h"
 #include "server.h"
+#include "stats.h"
 #include "module.h"
+#include "probes.h"
+#include "tls.h"
+#include "upstream.h"
 
 #define FH_SERVER_MAX_EVENTS 128
 
@@ -57,6 +65,7 @@ fh_server_create (struct fh_config *config, struct fh_module_manager *module_man
 	server->config = config;
 	server->module_manager = module_manager;
 	server->host_configs = config->hosts;
+	server->cpu = -1;
 	server->sockfd_table = itable_create (0);
 
 	if (!server->sockfd_table)
@@ -97,6 +106,22 @@ fh_server_create (struct fh_config *config, struct fh_module_manager *module_man
 		return NULL;
 	}
 
+	server->upstreams = fh_upstreams_create (server->xpoll_fd);
+	server->cache = fh_cache_create (server->xpoll_fd);
+
+	if (!server->upstreams || !server->cache)
+	{
+		fh_upstreams_destroy (server->upstreams);
+		fh_cache_destroy (server->cache);
+		fh_router_free (server->router);
+		free (server->router);
+		xpoll_destroy (server->xpoll_fd);
+		itable_destroy (server->connections);
+		itable_destroy (server->sockfd_table);
+		free (server);
+		return NULL;
+	}
+
 	return server;
 }
 
@@ -113,10 +138,16 @@ fh_server_destroy (struct fh_server *server)
 		fh_conn_destroy (entry->data);
 	}
 
+	event_quic_destroy (server);
+	fh_upstreams_destroy (server->upstreams);
+	fh_cache_destroy (server->cache);
+	fh_tls_destroy (server->tls);
 	itable_destroy (server->connections);
 	itable_destroy (server->sockfd_table);
+	free (server->deferred_fds);
 	xpoll_destroy (server->xpoll_fd);
 	fh_module_manager_free (server->module_manager);
+	fh_compress_cache_destroy ();
 	fh_conf_free (server->config);
 	fh_router_free (server->router);
 	free (server->router);
@@ -149,6 +180,9 @@ fh_server_listen (struct fh_server *server)
 	uint16_t ports[socket_cap];
 	size_t port_count = 0;
 
+	if (!fh_tls_init (server))
+		return false;
+
 	for (struct strtable_entry *entry = server->host_configs->head; entry;
 			 entry = entry->next)
 	{
@@ -185,6 +219,15 @@ fh_server_listen (struct fh_server *server)
 			return false;
 		}
 
+#ifdef SO_INCOMING_CPU
+		/* Prefer this socket of the reuseport group for connections whose
+		   packets arrive on the CPU the worker is pinned to */
+		if (server->cpu >= 0
+			&& setsockopt (sockfd, SOL_SOCKET, SO_INCOMING_CPU, &server->cpu,
+						   sizeof server->cpu) < 0)
+			fh_pr_warn ("Failed to set SO_INCOMING_CPU: %s", strerror (errno));
+#endif /* SO_INCOMING_CPU */
+
 		struct timeval tv;
 
 		tv.tv_sec = 10;
@@ -238,10 +281,38 @@ fh_server_listen (struct fh_server *server)
 			return false;
 		}
 
-		fh_pr_info ("Listening on 0.0.0.0:%u", ports[i]);
+		fh_pr_info ("Listening on 0.0.0.0:%u%s", ports[i],
+					fh_tls_is_listener (server->tls, ports[i]) ? " (TLS)" : "");
 	}
 
-	return fh_server_index_config (server);
+	if (!fh_server_index_config (server))
+		return false;
+
+	return event_quic_init (server);
+}
+
+/* Gives the connections deferred by the previous round their next turn.
+   Those that defer again wait for the round after.  A descriptor may have
+   been closed, or even reused, since; reading it once more is harmless.  */
+static void
+fh_server_run_deferred (struct fh_server *server)
+{
+	const size_t count = server->deferred_count;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		xevent_t event = { .events = XPOLLIN };
+
+		event.data.fd = server->deferred_fds[i];
+
+		if (itable_get (server->connections, event.data.fd)
+			&& !event_recv (server, &event))
+			fh_pr_err ("recv event handler failed: %s", strerror (errno));
+	}
+
+	server->deferred_count -= count;
+	memmove (server->deferred_fds, server->deferred_fds + count,
+			 server->deferred_count * sizeof (*server->deferred_fds));
 }
 
 void
@@ -254,8 +325,15 @@ fh_server_loop (struct fh_server *server)
 		if (server->should_exit)
 			return;
 
+		fh_log_check_requests ();
+		fh_access_log_check_reopen ();
+
+		/* Pools only grow and shrink while events are handled.  */
+		fh_stats_set (pool_bytes, fh_pool_bytes);
+
 		xevent_t events[FH_SERVER_MAX_EVENTS];
-		int nfds = xpoll_wait (server->xpoll_fd, events, FH_SERVER_MAX_EVENTS, -1);
+		int nfds = xpoll_wait (server->xpoll_fd, events, FH_SERVER_MAX_EVENTS,
+							   server->deferred_count ? 0 : -1);
 
 		if (nfds < 0)
 		{
@@ -279,6 +357,7 @@ fh_server_loop (struct fh_server *server)
 			uint32_t evflags = events[i].events;
 			fd_t fd = events[i].data.fd;
 			struct sockaddr_in *server_addr;
+			struct fh_h3 *h3;
 
 			if ((server_addr = itable_get (server->sockfd_table, fd)))
 			{
@@ -286,6 +365,20 @@ fh_server_loop (struct fh_server *server)
 				continue;
 			}
 
+			if (server->quic_fds && (h3 = itable_get (server->quic_fds, fd)))
+			{
+				if (!event_quic (server, &events[i], h3))
+					fh_pr_err ("QUIC event handler failed: %s", strerror (errno));
+
+				continue;
+			}
+
+			if (fh_upstream_handle_event (server->upstreams, fd, evflags))
+				continue;
+
+			if (fh_cache_handle_event (server->cache, fd, evflags))
+				continue;
+
 			if (evflags & XPOLLERR)
 			{
 				int err = xpoll_get_error (server->xpoll_fd, &events[i], fd);
@@ -324,12 +417,34 @@ fh_server_loop (struct fh_server *server)
 				continue;
 			}
 		}
+
+		fh_server_run_deferred (server);
 	}
 }
 
+bool
+fh_server_defer (struct fh_server *server, struct fh_conn *conn)
+{
+	if (server->deferred_count == server->deferred_cap)
+	{
+		size_t cap = server->deferred_cap ? server->deferred_cap * 2 : 16;
+		fd_t *fds = realloc (server->deferred_fds, cap * sizeof (*fds));
+
+		if (!fds)
+			return false;
+
+		server->deferred_fds = fds;
+		server->deferred_cap = cap;
+	}
+
+	server->deferred_fds[server->deferred_count++] = conn->client_sockfd;
+	return true;
+}
+
 void
 fh_server_close_conn (struct fh_server *server, struct fh_conn *conn)
 {
+	FH_PROBE3 (conn__close, conn->id, conn->client_sockfd, conn->protocol);
 	itable_remove (server->connections, conn->client_sockfd);
 	xpoll_del (server->xpoll_fd, conn->client_sockfd, XPOLLIN | XPOLLOUT);
 	fh_conn_destroy (conn);
@@ -33,7 +33,10 @@
 
 #define FH_SERVER_MAX_SOCKETS 128
 
+struct fh_cache;
 struct fh_module_manager;
+struct fh_tls;
+struct fh_upstreams;
 
 struct fh_server
 {
@@ -52,6 +55,30 @@ struct fh_server
 
     struct fh_router *router;
 	struct fh_module_manager *module_manager;
+
+	/* NULL when no host has a `tls' block */
+	struct fh_tls *tls;
+
+	/* Index of this worker among its siblings */
+	size_t worker_index;
+
+	/* CPU that this worker is pinned to, or -1 */
+	int cpu;
+
+	/* (fd_t) => (struct fh_h3 *), for both the socket and the timer of an
+	   HTTP/3 endpoint; NULL when there are none */
+	struct itable *quic_fds;
+
+	/* Connections to the servers of `proxy' blocks */
+	struct fh_upstreams *upstreams;
+
+	/* Requests that wait for the response cache */
+	struct fh_cache *cache;
+
+	/* Connections that stopped reading before EAGAIN so that others get a
+	   turn; they are read again once the current events are handled.  */
+	fd_t *deferred_fds;
+	size_t deferred_count, deferred_cap;
 };
 
 struct fh_server *fh_server_create (struct fh_config *config, struct fh_module_manager *module_manager);
@@ -59,5 +86,6 @@ void fh_server_destroy (struct fh_server *server);
 void fh_server_loop (struct fh_server *server);
 bool fh_server_listen (struct fh_server *server);
 void fh_server_close_conn (struct fh_server *server, struct fh_conn *conn);
+bool fh_server_defer (struct fh_server *server, struct fh_conn *conn);
 
 #endif /* FH_CORE_SERVER_H */
@@ -0,0 +1,154 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+/* Padded so that workers never write to the same cache line */
+struct fh_stats_slot
+{
+	struct fh_worker_stats stats;
+	/* In microseconds */
+	struct fh_histogram phases[FH_STATS_PHASE_COUNT];
+} __attribute__ ((aligned (FH_STATS_CACHELINE_SIZE)));
+
+static struct fh_worker_stats local_stats;
+static struct fh_histogram local_phases[FH_STATS_PHASE_COUNT];
+static struct fh_histogram *phases = local_phases;
+static struct fh_stats_slot *shared_stats = NULL;
+static size_t shared_stats_count = 0;
+
+struct fh_worker_stats *fh_stats = &local_stats;
+
+bool
+fh_stats_shared_init (size_t worker_count)
+{
+	struct fh_stats_slot *stats
+		= mmap (NULL, worker_count * sizeof (*stats), PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if (stats == MAP_FAILED)
+		return false;
+
+	shared_stats = stats;
+	shared_stats_count = worker_count;
+	return true;
+}
+
+void
+fh_stats_shared_destroy (void)
+{
+	if (!shared_stats)
+		return;
+
+	fh_stats = &local_stats;
+	phases = local_phases;
+	munmap (shared_stats, shared_stats_count * sizeof (*shared_stats));
+	shared_stats = NULL;
+	shared_stats_count = 0;
+}
+
+void
+fh_stats_attach (size_t worker_index)
+{
+	if (worker_index >= shared_stats_count)
+		return;
+
+	/* Whatever a previous worker in the same slot left is of no use.  */
+	memset (&shared_stats[worker_index], 0, sizeof (*shared_stats));
+	fh_stats = &shared_stats[worker_index].stats;
+	phases = shared_stats[worker_index].phases;
+	fh_stats->pid = getpid ();
+}
+
+void
+fh_stats_record (const struct fh_stats_timing *timing)
+{
+	const uint64_t *at = timing->at;
+
+	for (size_t i = 0; i + 1 < FH_STATS_MARK_COUNT; i++)
+	{
+		if (at[i] && at[i + 1])
+			fh_histogram_record (&phases[i], at[i + 1] - at[i]);
+	}
+
+	if (at[FH_STATS_MARK_FIRST_BYTE] && at[FH_STATS_MARK_BODY])
+		fh_histogram_record (&phases[FH_STATS_PHASE_TOTAL],
+							 at[FH_STATS_MARK_BODY]
+								 - at[FH_STATS_MARK_FIRST_BYTE]);
+}
+
+void
+fh_stats_collect_phases (struct fh_histogram *total)
+{
+	memset (total, 0, FH_STATS_PHASE_COUNT * sizeof (*total));
+
+	for (size_t i = 0; i < shared_stats_count; i++)
+	{
+		for (size_t j = 0; j < FH_STATS_PHASE_COUNT; j++)
+			fh_histogram_merge (&total[j], &shared_stats[i].phases[j]);
+	}
+}
+
+size_t
+fh_stats_worker_count (void)
+{
+	return shared_stats_count;
+}
+
+#define fh_stats_copy(dst, src, field)                                         \
+	((dst)->field = __atomic_load_n (&(src)->field, __ATOMIC_RELAXED))
+
+void
+fh_stats_collect (struct fh_worker_stats *stats, struct fh_worker_stats *total)
+{
+	memset (total, 0, sizeof (*total));
+
+	for (size_t i = 0; i < shared_stats_count; i++)
+	{
+		const struct fh_worker_stats *src = &shared_stats[i].stats;
+		struct fh_worker_stats *dst = &stats[i];
+
+		fh_stats_copy (dst, src, pid);
+		fh_stats_copy (dst, src, accepted);
+		fh_stats_copy (dst, src, active);
+		fh_stats_copy (dst, src, idle);
+		fh_stats_copy (dst, src, bytes_in);
+		fh_stats_copy (dst, src, bytes_out);
+		fh_stats_copy (dst, src, parse_errors);
+		fh_stats_copy (dst, src, pool_bytes);
+
+		for (size_t j = 0; j < FH_STATS_STATUS_CLASSES; j++)
+		{
+			fh_stats_copy (dst, src, responses[j]);
+			total->responses[j] += dst->responses[j];
+		}
+
+		total->accepted += dst->accepted;
+		total->active += dst->active;
+		total->idle += dst->idle;
+		total->bytes_in += dst->bytes_in;
+		total->bytes_out += dst->bytes_out;
+		total->parse_errors += dst->parse_errors;
+		total->pool_bytes += dst->pool_bytes;
+	}
+}
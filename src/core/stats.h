@@ -0,0 +1,146 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FH_CORE_STATS_H
+#define FH_CORE_STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "utils/histogram.h"
+
+#define FH_STATS_CACHELINE_SIZE 64
+/* Status classes counted separately: 1xx to 5xx, and anything else at 0 */
+#define FH_STATS_STATUS_CLASSES 6
+
+/* Points in the life of a request, in the order they are passed */
+enum fh_stats_mark
+{
+	FH_STATS_MARK_ACCEPT,
+	FH_STATS_MARK_FIRST_BYTE,
+	/* The request line and headers are parsed */
+	FH_STATS_MARK_HEAD,
+	FH_STATS_MARK_HANDLER,
+	/* The response headers are written */
+	FH_STATS_MARK_HEADERS,
+	FH_STATS_MARK_BODY,
+	FH_STATS_MARK_COUNT
+};
+
+/* The time between one mark and the next, and between the first byte and
+   the end of the body */
+enum fh_stats_phase
+{
+	FH_STATS_PHASE_ACCEPT,
+	FH_STATS_PHASE_PARSE,
+	FH_STATS_PHASE_HANDLER,
+	FH_STATS_PHASE_HEADERS,
+	FH_STATS_PHASE_BODY,
+	FH_STATS_PHASE_TOTAL,
+	FH_STATS_PHASE_COUNT
+};
+
+/* When the marks were passed, in microseconds, or 0 */
+struct fh_stats_timing
+{
+	uint64_t at[FH_STATS_MARK_COUNT];
+};
+
+/* Counters of one worker, in memory shared with the other workers.  Only
+   the worker itself writes to its block, so relaxed loads and stores do
+   without locked instructions, and readers may see a slightly old value.  */
+struct fh_worker_stats
+{
+	pid_t pid;
+	uint64_t accepted;
+	/* Open connections with a request in progress */
+	uint64_t active;
+	/* Open connections waiting for a request */
+	uint64_t idle;
+	uint64_t responses[FH_STATS_STATUS_CLASSES];
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	uint64_t parse_errors;
+	/* Memory held by the pools of the worker */
+	uint64_t pool_bytes;
+};
+
+/* The block of the current worker, or a private one in other processes */
+extern struct fh_worker_stats *fh_stats;
+
+#define fh_stats_set(field, value)                                             \
+	__atomic_store_n (&fh_stats->field, (value), __ATOMIC_RELAXED)
+
+#define fh_stats_add(field, n)                                                 \
+	fh_stats_set (field,                                                       \
+				  __atomic_load_n (&fh_stats->field, __ATOMIC_RELAXED) + (n))
+
+#define fh_stats_sub(field, n)                                                 \
+	fh_stats_set (field,                                                       \
+				  __atomic_load_n (&fh_stats->field, __ATOMIC_RELAXED) - (n))
+
+static inline void
+fh_stats_response (unsigned int status)
+{
+	const unsigned int class = status / 100;
+
+	fh_stats_add (responses[class < FH_STATS_STATUS_CLASSES ? class : 0], 1);
+}
+
+/* The vDSO answers this without a system call.  CLOCK_MONOTONIC_COARSE
+   would be cheaper still, but only ticks every few milliseconds, which
+   is longer than most phases take.  */
+static inline uint64_t
+fh_stats_clock (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+/* Marks are passed once; later calls keep the first time.  */
+static inline void
+fh_stats_mark (struct fh_stats_timing *timing, enum fh_stats_mark mark)
+{
+	if (!timing->at[mark])
+		timing->at[mark] = fh_stats_clock ();
+}
+
+/* Records the phases whose start and end were both marked.  */
+void fh_stats_record (const struct fh_stats_timing *timing);
+
+/* Maps a block per worker; called before the workers are forked.  */
+bool fh_stats_shared_init (size_t worker_count);
+void fh_stats_shared_destroy (void);
+/* Makes the block of the given worker the current one.  */
+void fh_stats_attach (size_t worker_index);
+
+/* Copies the block of each worker into `stats', which has room for
+   fh_stats_worker_count() of them, and adds them up in `total'.  */
+void fh_stats_collect (struct fh_worker_stats *stats,
+					   struct fh_worker_stats *total);
+/* Adds up the phase histograms of all workers.  */
+void fh_stats_collect_phases (struct fh_histogram *total);
+size_t fh_stats_worker_count (void);
+
+#endif /* FH_CORE_STATS_H */
@@ -18,6 +18,7 @@
  */
 
 #include <stdlib.h>
+#include <unistd.h>
 
 #define FH_LOG_MODULE_NAME "stream"
 
@@ -185,3 +186,58 @@ fh_stream_copy (void *dest, struct fh_link *start, size_t start_off, struct fh_l
 
 	return copied;
 }
+
+struct fh_link *
+fh_link_new_data (pool_t *pool, const uint8_t *data, size_t len, bool is_eos)
+{
+	struct fh_link *link = fh_pool_alloc (pool, sizeof (*link) + sizeof (*link->buf));
+
+	if (!link)
+		return NULL;
+
+	link->buf = (struct fh_buf *) (link + 1);
+	link->buf->type = FH_BUF_DATA;
+	link->buf->freeable = false;
+	link->buf->attrs.mem.rd_only = true;
+	link->buf->attrs.mem.data = (uint8_t *) data;
+	link->buf->attrs.mem.len = link->buf->attrs.mem.cap = len;
+	link->next = NULL;
+	link->is_eos = is_eos;
+	link->is_start = false;
+
+	return link;
+}
+
+size_t
+fh_link_size (const struct fh_link *link)
+{
+	switch (link->buf->type)
+	{
+		case FH_BUF_FILE:
+			return link->buf->attrs.file.file_len;
+
+		case FH_BUF_PIPE:
+			return link->buf->attrs.pipe.pipe_len;
+
+		default:
+			return link->buf->attrs.mem.len;
+	}
+}
+
+/* Closes the files referenced by a chain that is not going to be sent.  */
+void
+fh_link_release (struct fh_link *link)
+{
+	for (; link; link = link->next)
+	{
+		if (link->buf->type == FH_BUF_FILE && link->buf->attrs.file.file_fd >= 0)
+		{
+			close (link->buf->attrs.file.file_fd);
+			fh_pr_debug ("Closed fd %d", link->buf->attrs.file.file_fd);
+			link->buf->attrs.file.file_fd = -1;
+		}
+
+		if (link->is_eos)
+			break;
+	}
+}
@@ -38,7 +38,8 @@
 enum fh_buf_type
 {
 	FH_BUF_DATA,
-	FH_BUF_FILE
+	FH_BUF_FILE,
+	FH_BUF_PIPE
 };
 
 struct fh_buf
@@ -53,6 +54,12 @@ struct fh_buf
 			size_t file_len;
 		} file;
 
+		/* Bytes waiting in a pipe that is owned by someone else */
+		struct {
+			fd_t pipe_fd;
+			size_t pipe_len;
+		} pipe;
+
 		struct {
 			bool rd_only : 1;
 			uint8_t *data;
@@ -85,4 +92,8 @@ struct fh_buf *fh_stream_add_buf_memcpy (struct fh_stream *stream, const uint8_t
 size_t fh_stream_copy (void *dest, struct fh_link *start, size_t start_off, struct fh_link *end, size_t end_off, size_t max_size);
 void fh_stream_print (struct fh_stream *stream);
 
+struct fh_link *fh_link_new_data (pool_t *pool, const uint8_t *data, size_t len, bool is_eos);
+size_t fh_link_size (const struct fh_link *link);
+void fh_link_release (struct fh_link *link);
+
 #endif /* FH_CORE_STREAM_H */
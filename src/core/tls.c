@@ -0,0 +1,816 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#ifdef FHTTPD_ENABLE_HTTP3
+	#include <ngtcp2/ngtcp2_crypto_quictls.h>
+#endif /* FHTTPD_ENABLE_HTTP3 */
+
+#define FH_LOG_MODULE_NAME "tls"
+
+#include "conn.h"
+#include "hash/itable.h"
+#include "hash/strtable.h"
+#include "log/log.h"
+#include "server.h"
+#include "tls.h"
+
+struct fh_tls
+{
+	struct fh_server *server;
+	/* (const char *full_hostname) => (SSL_CTX *) */
+	struct strtable *contexts;
+	/* (uint16_t port) => (SSL_CTX *), the certificate used without SNI */
+	struct itable *listeners;
+#ifdef FHTTPD_ENABLE_HTTP3
+	/* Same as above, for the hosts also served over QUIC */
+	struct strtable *quic_contexts;
+	struct itable *quic_listeners;
+#endif /* FHTTPD_ENABLE_HTTP3 */
+};
+
+struct fh_tls_alpn_proto
+{
+	const char *name;
+	unsigned char len;
+	enum fh_protocol protocol;
+};
+
+/* Protocols offered through ALPN, in order of server preference.  */
+static const struct fh_tls_alpn_proto fh_tls_alpn_protos[] = {
+	{ "h2", 2, FH_PROTOCOL_H2 },
+	{ "http/1.1", 8, FH_PROTOCOL_HTTP_1_1 },
+	{ "http/1.0", 8, FH_PROTOCOL_HTTP_1_0 },
+};
+
+static void
+fh_tls_log_errors (const char *what)
+{
+	unsigned long err;
+	char buf[256];
+
+	if (!(err = ERR_get_error ()))
+	{
+		fh_pr_err ("%s: %s", what, strerror (errno));
+		return;
+	}
+
+	do
+	{
+		ERR_error_string_n (err, buf, sizeof buf);
+		fh_pr_err ("%s: %s", what, buf);
+	}
+	while ((err = ERR_get_error ()));
+}
+
+static int
+fh_tls_alpn_select (SSL *ssl, const unsigned char **out, unsigned char *outlen,
+					const unsigned char *in, unsigned int inlen, void *arg)
+{
+	(void) ssl;
+	(void) arg;
+
+	for (size_t i = 0;
+		 i < sizeof (fh_tls_alpn_protos) / sizeof (fh_tls_alpn_protos[0]); i++)
+	{
+		const struct fh_tls_alpn_proto *proto = &fh_tls_alpn_protos[i];
+
+		for (unsigned int off = 0; off < inlen; off += 1U + in[off])
+		{
+			if (in[off] == proto->len && off + 1U + in[off] <= inlen
+				&& !memcmp (in + off + 1, proto->name, proto->len))
+			{
+				*out = in + off + 1;
+				*outlen = in[off];
+				return SSL_TLSEXT_ERR_OK;
+			}
+		}
+	}
+
+	/* Let clients that only speak something else fail at the HTTP level
+	   rather than during the handshake.  */
+	return SSL_TLSEXT_ERR_NOACK;
+}
+
+/* Extracts the host_name entry of a raw server_name extension.  */
+static bool
+fh_tls_parse_server_name (const unsigned char *ext, size_t ext_len,
+						  char *out, size_t out_size)
+{
+	if (ext_len < 2 || (size_t) ((ext[0] << 8) | ext[1]) != ext_len - 2)
+		return false;
+
+	for (size_t off = 2; off + 3 <= ext_len;)
+	{
+		uint8_t type = ext[off];
+		size_t len = (size_t) ((ext[off + 1] << 8) | ext[off + 2]);
+
+		off += 3;
+
+		if (off + len > ext_len)
+			return false;
+
+		if (type == TLSEXT_NAMETYPE_host_name)
+		{
+			if (len == 0 || len >= out_size || memchr (ext + off, 0, len))
+				return false;
+
+			memcpy (out, ext + off, len);
+			out[len] = 0;
+			return true;
+		}
+
+		off += len;
+	}
+
+	return false;
+}
+
+/* Finds the TLS host that a client asked for through SNI.  */
+static struct fh_config_host *
+fh_tls_sni_host (struct fh_tls *tls, SSL *ssl, uint16_t port)
+{
+	const unsigned char *ext;
+	size_t ext_len;
+	char name[HOST_NAME_MAX + 1];
+	char key[HOST_NAME_MAX + 8];
+
+	if (!SSL_client_hello_get0_ext (ssl, TLSEXT_TYPE_server_name, &ext,
+									&ext_len)
+		|| !fh_tls_parse_server_name (ext, ext_len, name, sizeof name))
+		return NULL;
+
+	snprintf (key, sizeof key, "%s:%u", name, port);
+
+	struct fh_config_host *host
+		= strtable_get (tls->server->host_configs, key);
+
+	if (!host)
+		host = strtable_get (tls->server->host_configs, name);
+
+	if (!host || !host->tls)
+	{
+		fh_pr_debug ("No TLS host matches server name '%s'", name);
+		return NULL;
+	}
+
+	return host;
+}
+
+/* Picks the certificate from SNI.  This runs before OpenSSL looks up the
+   session being resumed, so switching contexts here also switches the
+   session ID context and sessions never cross virtual hosts.  */
+static int
+fh_tls_client_hello (SSL *ssl, int *alert, void *arg)
+{
+	struct fh_tls *tls = arg;
+	struct fh_conn *conn = SSL_get_app_data (ssl);
+
+	(void) alert;
+
+	if (!conn)
+		return SSL_CLIENT_HELLO_SUCCESS;
+
+	struct fh_config_host *host
+		= fh_tls_sni_host (tls, ssl, ntohs (conn->server_addr->sin_port));
+
+	if (!host)
+		return SSL_CLIENT_HELLO_SUCCESS;
+
+	SSL_CTX *ctx = strtable_get (tls->contexts, host->addr.full_hostname);
+
+	if (ctx && ctx != SSL_get_SSL_CTX (ssl))
+	{
+		SSL_set_SSL_CTX (ssl, ctx);
+
+#ifdef SSL_OP_ENABLE_KTLS
+		if (host->tls->ktls)
+			SSL_set_options (ssl, SSL_OP_ENABLE_KTLS);
+		else
+			SSL_clear_options (ssl, SSL_OP_ENABLE_KTLS);
+#endif /* SSL_OP_ENABLE_KTLS */
+	}
+
+	conn->config = host;
+	return SSL_CLIENT_HELLO_SUCCESS;
+}
+
+/* Only acknowledges SNI, which also records the name in new sessions.  */
+static int
+fh_tls_servername (SSL *ssl, int *alert, void *arg)
+{
+	(void) alert;
+	(void) arg;
+
+	return SSL_get_servername (ssl, TLSEXT_NAMETYPE_host_name)
+			   ? SSL_TLSEXT_ERR_OK
+			   : SSL_TLSEXT_ERR_NOACK;
+}
+
+static bool
+fh_tls_ctx_load_certificate (SSL_CTX *ctx, const struct fh_config_tls *config)
+{
+	if (SSL_CTX_use_certificate_chain_file (ctx, config->certificate) != 1)
+	{
+		fh_tls_log_errors (config->certificate);
+		return false;
+	}
+
+	if (SSL_CTX_use_PrivateKey_file (ctx, config->key, SSL_FILETYPE_PEM) != 1
+		|| SSL_CTX_check_private_key (ctx) != 1)
+	{
+		fh_tls_log_errors (config->key);
+		return false;
+	}
+
+	return true;
+}
+
+static SSL_CTX *
+fh_tls_ctx_create (struct fh_tls *tls, const struct fh_config_host *host)
+{
+	const struct fh_config_tls *config = host->tls;
+	SSL_CTX *ctx = SSL_CTX_new (TLS_server_method ());
+
+	if (!ctx)
+	{
+		fh_tls_log_errors ("SSL_CTX_new");
+		return NULL;
+	}
+
+	uint64_t options = SSL_OP_NO_COMPRESSION | SSL_OP_CIPHER_SERVER_PREFERENCE
+					   | SSL_OP_NO_RENEGOTIATION;
+
+#ifdef SSL_OP_ENABLE_KTLS
+	if (config->ktls)
+		options |= SSL_OP_ENABLE_KTLS;
+#endif /* SSL_OP_ENABLE_KTLS */
+
+	SSL_CTX_set_options (ctx, options);
+	SSL_CTX_set_mode (ctx, SSL_MODE_ENABLE_PARTIAL_WRITE
+							   | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER
+							   | SSL_MODE_RELEASE_BUFFERS);
+	SSL_CTX_set_min_proto_version (ctx, TLS1_2_VERSION);
+
+	if (!fh_tls_ctx_load_certificate (ctx, config))
+	{
+		SSL_CTX_free (ctx);
+		return NULL;
+	}
+
+	if (config->ciphers && SSL_CTX_set_cipher_list (ctx, config->ciphers) != 1)
+	{
+		fh_tls_log_errors (config->ciphers);
+		SSL_CTX_free (ctx);
+		return NULL;
+	}
+
+	fh_tls_session_setup_ctx (ctx, tls->server->config, host);
+
+	SSL_CTX_set_client_hello_cb (ctx, &fh_tls_client_hello, tls);
+	SSL_CTX_set_tlsext_servername_callback (ctx, &fh_tls_servername);
+	SSL_CTX_set_alpn_select_cb (ctx, &fh_tls_alpn_select, NULL);
+
+	return ctx;
+}
+
+#ifdef FHTTPD_ENABLE_HTTP3
+
+/* The port a QUIC handshake arrived on, as there is no socket to ask */
+static int fh_tls_quic_port_index = -1;
+
+static int
+fh_tls_quic_client_hello (SSL *ssl, int *alert, void *arg)
+{
+	struct fh_tls *tls = arg;
+	uint16_t port = (uint16_t) (uintptr_t) SSL_get_ex_data (
+		ssl, fh_tls_quic_port_index);
+	struct fh_config_host *host = fh_tls_sni_host (tls, ssl, port);
+
+	(void) alert;
+
+	if (!host)
+		return SSL_CLIENT_HELLO_SUCCESS;
+
+	SSL_CTX *ctx = strtable_get (tls->quic_contexts, host->addr.full_hostname);
+
+	if (ctx && ctx != SSL_get_SSL_CTX (ssl))
+		SSL_set_SSL_CTX (ssl, ctx);
+
+	return SSL_CLIENT_HELLO_SUCCESS;
+}
+
+static int
+fh_tls_quic_alpn_select (SSL *ssl, const unsigned char **out,
+						 unsigned char *outlen, const unsigned char *in,
+						 unsigned int inlen, void *arg)
+{
+	(void) ssl;
+	(void) arg;
+
+	for (unsigned int off = 0; off < inlen; off += 1U + in[off])
+	{
+		if (in[off] == 2 && off + 3U <= inlen && !memcmp (in + off + 1, "h3", 2))
+		{
+			*out = in + off + 1;
+			*outlen = in[off];
+			return SSL_TLSEXT_ERR_OK;
+		}
+	}
+
+	/* QUIC has no way of carrying on without an application protocol */
+	return SSL_TLSEXT_ERR_ALERT_FATAL;
+}
+
+static SSL_CTX *
+fh_tls_quic_ctx_create (struct fh_tls *tls, const struct fh_config_host *host)
+{
+	SSL_CTX *ctx = SSL_CTX_new (TLS_server_method ());
+
+	if (!ctx)
+	{
+		fh_tls_log_errors ("SSL_CTX_new");
+		return NULL;
+	}
+
+	/* QUIC only runs TLS 1.3, whose cipher suites are not configurable
+	   through the cipher list, and does its own record protection.  */
+	SSL_CTX_set_options (ctx, SSL_OP_NO_COMPRESSION
+								  | SSL_OP_CIPHER_SERVER_PREFERENCE);
+	SSL_CTX_set_min_proto_version (ctx, TLS1_3_VERSION);
+	SSL_CTX_set_max_proto_version (ctx, TLS1_3_VERSION);
+
+	if (!fh_tls_ctx_load_certificate (ctx, host->tls))
+	{
+		SSL_CTX_free (ctx);
+		return NULL;
+	}
+
+	if (ngtcp2_crypto_quictls_configure_server_context (ctx) != 0)
+	{
+		fh_tls_log_errors ("ngtcp2_crypto_quictls_configure_server_context");
+		SSL_CTX_free (ctx);
+		return NULL;
+	}
+
+	fh_tls_session_setup_ctx (ctx, tls->server->config, host);
+
+	SSL_CTX_set_client_hello_cb (ctx, &fh_tls_quic_client_hello, tls);
+	SSL_CTX_set_tlsext_servername_callback (ctx, &fh_tls_servername);
+	SSL_CTX_set_alpn_select_cb (ctx, &fh_tls_quic_alpn_select, NULL);
+
+	return ctx;
+}
+
+static bool
+fh_tls_quic_add_host (struct fh_tls *tls, const struct fh_config_host *host)
+{
+	if (!tls->quic_contexts)
+	{
+		tls->quic_contexts = strtable_create (0);
+		tls->quic_listeners = itable_create (0);
+
+		if (!tls->quic_contexts || !tls->quic_listeners)
+			return false;
+	}
+
+	if (fh_tls_quic_port_index < 0)
+	{
+		fh_tls_quic_port_index
+			= SSL_get_ex_new_index (0, NULL, NULL, NULL, NULL);
+
+		if (fh_tls_quic_port_index < 0)
+			return false;
+	}
+
+	SSL_CTX *ctx = fh_tls_quic_ctx_create (tls, host);
+
+	if (!ctx)
+		return false;
+
+	if (!strtable_set (tls->quic_contexts, host->addr.full_hostname, ctx))
+	{
+		SSL_CTX_free (ctx);
+		return false;
+	}
+
+	if (host->is_default
+		|| !itable_contains (tls->quic_listeners, host->addr.port))
+	{
+		if (!itable_set (tls->quic_listeners, host->addr.port, ctx))
+			return false;
+	}
+
+	return true;
+}
+
+SSL *
+fh_tls_quic_new (struct fh_tls *tls, uint16_t port)
+{
+	SSL_CTX *ctx = tls && tls->quic_listeners
+					   ? itable_get (tls->quic_listeners, port)
+					   : NULL;
+
+	if (!ctx)
+		return NULL;
+
+	SSL *ssl = SSL_new (ctx);
+
+	if (!ssl)
+	{
+		fh_tls_log_errors ("SSL_new");
+		return NULL;
+	}
+
+	SSL_set_ex_data (ssl, fh_tls_quic_port_index, (void *) (uintptr_t) port);
+	SSL_set_accept_state (ssl);
+	return ssl;
+}
+
+#endif /* FHTTPD_ENABLE_HTTP3 */
+
+bool
+fh_tls_init (struct fh_server *server)
+{
+	struct fh_tls *tls = NULL;
+
+	for (struct strtable_entry *entry = server->host_configs->head; entry;
+		 entry = entry->next)
+	{
+		struct fh_config_host *host = entry->data;
+
+		if (!host->tls)
+			continue;
+
+		if (!tls)
+		{
+			tls = calloc (1, sizeof (*tls));
+
+			if (!tls)
+				return false;
+
+			tls->server = server;
+			tls->contexts = strtable_create (0);
+			tls->listeners = itable_create (0);
+			server->tls = tls;
+
+			if (!tls->contexts || !tls->listeners)
+				return false;
+		}
+
+		if (strtable_contains (tls->contexts, host->addr.full_hostname))
+			continue;
+
+		SSL_CTX *ctx = fh_tls_ctx_create (tls, host);
+
+		if (!ctx)
+			return false;
+
+		if (!strtable_set (tls->contexts, host->addr.full_hostname, ctx))
+		{
+			SSL_CTX_free (ctx);
+			return false;
+		}
+
+		if (host->is_default || !itable_contains (tls->listeners, host->addr.port))
+		{
+			if (!itable_set (tls->listeners, host->addr.port, ctx))
+				return false;
+		}
+
+#ifdef FHTTPD_ENABLE_HTTP3
+		if (host->tls->http3 && !fh_tls_quic_add_host (tls, host))
+			return false;
+#endif /* FHTTPD_ENABLE_HTTP3 */
+
+		fh_pr_debug ("Loaded TLS certificate for %s: %s",
+					 host->addr.full_hostname, host->tls->certificate);
+	}
+
+	return true;
+}
+
+void
+fh_tls_destroy (struct fh_tls *tls)
+{
+	if (!tls)
+		return;
+
+	if (tls->contexts)
+	{
+		for (struct strtable_entry *entry = tls->contexts->head; entry;
+			 entry = entry->next)
+			SSL_CTX_free (entry->data);
+
+		strtable_destroy (tls->contexts);
+	}
+
+	if (tls->listeners)
+		itable_destroy (tls->listeners);
+
+#ifdef FHTTPD_ENABLE_HTTP3
+	if (tls->quic_contexts)
+	{
+		for (struct strtable_entry *entry = tls->quic_contexts->head; entry;
+			 entry = entry->next)
+			SSL_CTX_free (entry->data);
+
+		strtable_destroy (tls->quic_contexts);
+	}
+
+	if (tls->quic_listeners)
+		itable_destroy (tls->quic_listeners);
+#endif /* FHTTPD_ENABLE_HTTP3 */
+
+	free (tls);
+}
+
+bool
+fh_tls_is_listener (const struct fh_tls *tls, uint16_t port)
+{
+	return tls && itable_contains (tls->listeners, port);
+}
+
+bool
+fh_tls_accept (struct fh_tls *tls, struct fh_conn *conn)
+{
+	if (!tls)
+		return true;
+
+	SSL_CTX *ctx
+		= itable_get (tls->listeners, ntohs (conn->server_addr->sin_port));
+
+	if (!ctx)
+		return true;
+
+	conn->ssl = SSL_new (ctx);
+
+	if (!conn->ssl)
+	{
+		fh_tls_log_errors ("SSL_new");
+		return false;
+	}
+
+	if (SSL_set_fd (conn->ssl, conn->client_sockfd) != 1)
+	{
+		fh_tls_log_errors ("SSL_set_fd");
+		return false;
+	}
+
+	SSL_set_app_data (conn->ssl, conn);
+	SSL_set_accept_state (conn->ssl);
+	return true;
+}
+
+enum fh_tls_status
+fh_tls_handshake (struct fh_conn *conn)
+{
+	ERR_clear_error ();
+
+	int rc = SSL_do_handshake (conn->ssl);
+
+	if (rc == 1)
+	{
+		conn->tls_established = true;
+
+#ifdef BIO_get_ktls_send
+		conn->ktls_send = BIO_get_ktls_send (SSL_get_wbio (conn->ssl)) > 0;
+#endif /* BIO_get_ktls_send */
+
+		fh_pr_debug ("Connection #%lu: %s handshake done, cipher %s, "
+					 "protocol %s, kTLS %s",
+					 conn->id, SSL_get_version (conn->ssl),
+					 SSL_get_cipher_name (conn->ssl),
+					 fh_protocol_to_string (fh_tls_alpn_protocol (conn)),
+					 conn->ktls_send ? "on" : "off");
+		return FH_TLS_OK;
+	}
+
+	switch (SSL_get_error (conn->ssl, rc))
+	{
+		case SSL_ERROR_WANT_READ:
+			return FH_TLS_WANT_READ;
+
+		case SSL_ERROR_WANT_WRITE:
+			return FH_TLS_WANT_WRITE;
+
+		default:
+			fh_tls_log_errors ("TLS handshake failed");
+			return FH_TLS_ERROR;
+	}
+}
+
+enum fh_protocol
+fh_tls_alpn_protocol (const struct fh_conn *conn)
+{
+	const unsigned char *name = NULL;
+	unsigned int len = 0;
+
+	SSL_get0_alpn_selected (conn->ssl, &name, &len);
+
+	for (size_t i = 0;
+		 name && i < sizeof (fh_tls_alpn_protos) / sizeof (fh_tls_alpn_protos[0]);
+		 i++)
+	{
+		if (len == fh_tls_alpn_protos[i].len
+			&& !memcmp (name, fh_tls_alpn_protos[i].name, len))
+			return fh_tls_alpn_protos[i].protocol;
+	}
+
+	return FH_PROTOCOL_UNKNOWN;
+}
+
+void
+fh_tls_close (struct fh_conn *conn)
+{
+	if (!conn->ssl)
+		return;
+
+	/* Best effort close_notify; we never wait for the peer's reply.  */
+	if (conn->tls_established)
+	{
+		ERR_clear_error ();
+		SSL_shutdown (conn->ssl);
+	}
+
+	SSL_free (conn->ssl);
+	conn->ssl = NULL;
+}
+
+/* Translates a failed SSL_read()/SSL_write() into the errno convention the
+   plain socket paths use, so that callers need not know about TLS.  */
+static ssize_t
+fh_tls_io_error (struct fh_conn *conn, int rc)
+{
+	int saved_errno = errno;
+
+	switch (SSL_get_error (conn->ssl, rc))
+	{
+		case SSL_ERROR_ZERO_RETURN:
+			return 0;
+
+		case SSL_ERROR_WANT_READ:
+		case SSL_ERROR_WANT_WRITE:
+			errno = EAGAIN;
+			return -1;
+
+		case SSL_ERROR_SYSCALL:
+			errno = saved_errno ? saved_errno : ECONNRESET;
+			return -1;
+
+		default:
+			fh_tls_log_errors ("TLS I/O error");
+			errno = EIO;
+			return -1;
+	}
+}
+
+static uint8_t *
+fh_tls_scratch_buf (struct fh_conn *conn)
+{
+	if (!conn->tls_buf)
+		conn->tls_buf = fh_pool_alloc (conn->pool, FH_TLS_RECORD_SIZE);
+
+	return conn->tls_buf;
+}
+
+ssize_t
+fh_tls_recv (struct fh_conn *conn, void *buf, size_t len)
+{
+	ERR_clear_error ();
+
+	int rc = SSL_read (conn->ssl, buf, len > INT_MAX ? INT_MAX : (int) len);
+
+	return rc > 0 ? rc : fh_tls_io_error (conn, rc);
+}
+
+ssize_t
+fh_tls_writev (struct fh_conn *conn, const struct iovec *iov, int iovcnt)
+{
+	if (conn->ktls_send)
+		return writev (conn->client_sockfd, iov, iovcnt);
+
+	const void *data;
+	size_t len = 0;
+
+	if (iovcnt == 1)
+	{
+		data = iov[0].iov_base;
+		len = iov[0].iov_len > FH_TLS_RECORD_SIZE ? FH_TLS_RECORD_SIZE
+												  : iov[0].iov_len;
+	}
+	else
+	{
+		/* Coalesce small iovecs into one record instead of emitting a
+		   record per header line.  A retry after WANT_WRITE gets the same
+		   prefix back, which is all OpenSSL asks for.  */
+		uint8_t *scratch = fh_tls_scratch_buf (conn);
+
+		if (!scratch)
+		{
+			errno = ENOMEM;
+			return -1;
+		}
+
+		for (int i = 0; i < iovcnt && len < FH_TLS_RECORD_SIZE; i++)
+		{
+			size_t n = iov[i].iov_len;
+
+			if (n > FH_TLS_RECORD_SIZE - len)
+				n = FH_TLS_RECORD_SIZE - len;
+
+			memcpy (scratch + len, iov[i].iov_base, n);
+			len += n;
+		}
+
+		data = scratch;
+	}
+
+	if (len == 0)
+		return 0;
+
+	ERR_clear_error ();
+
+	int rc = SSL_write (conn->ssl, data, (int) len);
+
+	return rc > 0 ? rc : fh_tls_io_error (conn, rc);
+}
+
+ssize_t
+fh_tls_sendfile (struct fh_conn *conn, fd_t in_fd, size_t *offset,
+				 size_t count)
+{
+	if (conn->ktls_send)
+	{
+#if HAVE_DECL_SSL_SENDFILE
+		ERR_clear_error ();
+
+		ossl_ssize_t rc
+			= SSL_sendfile (conn->ssl, in_fd, (off_t) *offset, count, 0);
+
+		if (rc < 0)
+			return fh_tls_io_error (conn, (int) rc);
+
+		*offset += (size_t) rc;
+		return rc;
+#endif /* HAVE_DECL_SSL_SENDFILE */
+	}
+
+	uint8_t *scratch = fh_tls_scratch_buf (conn);
+
+	if (!scratch)
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+
+	ssize_t n = pread (in_fd, scratch,
+					   count > FH_TLS_RECORD_SIZE ? FH_TLS_RECORD_SIZE : count,
+					   (off_t) *offset);
+
+	if (n <= 0)
+		return n;
+
+	ERR_clear_error ();
+
+	int rc = SSL_write (conn->ssl, scratch, (int) n);
+
+	if (rc <= 0)
+		return fh_tls_io_error (conn, rc);
+
+	*offset += (size_t) rc;
+	return rc;
+}
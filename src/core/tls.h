@@ -0,0 +1,162 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FH_CORE_TLS_H
+#define FH_CORE_TLS_H
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "compat.h"
+#include "http/protocol.h"
+
+/* Largest plaintext TLS record; also the size of the per-connection
+   scratch buffer used when the kernel does not encrypt for us.  */
+#define FH_TLS_RECORD_SIZE 16384
+
+enum fh_tls_status
+{
+	FH_TLS_OK,
+	FH_TLS_WANT_READ,
+	FH_TLS_WANT_WRITE,
+	FH_TLS_ERROR
+};
+
+struct fh_server;
+struct fh_conn;
+struct fh_tls;
+struct fh_config;
+struct fh_config_host;
+struct ssl_ctx_st;
+struct ssl_st;
+
+#ifdef FHTTPD_ENABLE_TLS
+
+bool fh_tls_init (struct fh_server *server);
+void fh_tls_destroy (struct fh_tls *tls);
+bool fh_tls_is_listener (const struct fh_tls *tls, uint16_t port);
+bool fh_tls_accept (struct fh_tls *tls, struct fh_conn *conn);
+enum fh_tls_status fh_tls_handshake (struct fh_conn *conn);
+enum fh_protocol fh_tls_alpn_protocol (const struct fh_conn *conn);
+void fh_tls_close (struct fh_conn *conn);
+
+ssize_t fh_tls_recv (struct fh_conn *conn, void *buf, size_t len);
+ssize_t fh_tls_writev (struct fh_conn *conn, const struct iovec *iov,
+					   int iovcnt);
+ssize_t fh_tls_sendfile (struct fh_conn *conn, fd_t in_fd, size_t *offset,
+						 size_t count);
+
+/* Session resumption state shared by all workers, see tls_session.c */
+bool fh_tls_session_init (const struct fh_config *config);
+void fh_tls_session_destroy (void);
+unsigned int fh_tls_session_rotation_interval (void);
+void fh_tls_session_rotate_keys (void);
+void fh_tls_session_setup_ctx (struct ssl_ctx_st *ctx,
+							   const struct fh_config *config,
+							   const struct fh_config_host *host);
+
+#ifdef FHTTPD_ENABLE_HTTP3
+/* Starts a server-side handshake for a QUIC connection to `port', or
+   returns NULL if no host serves HTTP/3 there.  */
+struct ssl_st *fh_tls_quic_new (struct fh_tls *tls, uint16_t port);
+#endif /* FHTTPD_ENABLE_HTTP3 */
+
+#else /* not FHTTPD_ENABLE_TLS */
+
+__attribute_maybe_unused__ static inline bool
+fh_tls_init (struct fh_server *server)
+{
+	(void) server;
+	return true;
+}
+
+__attribute_maybe_unused__ static inline void
+fh_tls_destroy (struct fh_tls *tls)
+{
+	(void) tls;
+}
+
+__attribute_maybe_unused__ static inline bool
+fh_tls_is_listener (const struct fh_tls *tls, uint16_t port)
+{
+	(void) tls;
+	(void) port;
+	return false;
+}
+
+__attribute_maybe_unused__ static inline bool
+fh_tls_accept (struct fh_tls *tls, struct fh_conn *conn)
+{
+	(void) tls;
+	(void) conn;
+	return true;
+}
+
+__attribute_maybe_unused__ static inline enum fh_tls_status
+fh_tls_handshake (struct fh_conn *conn)
+{
+	(void) conn;
+	return FH_TLS_OK;
+}
+
+__attribute_maybe_unused__ static inline enum fh_protocol
+fh_tls_alpn_protocol (const struct fh_conn *conn)
+{
+	(void) conn;
+	return FH_PROTOCOL_UNKNOWN;
+}
+
+__attribute_maybe_unused__ static inline void
+fh_tls_close (struct fh_conn *conn)
+{
+	(void) conn;
+}
+
+__attribute_maybe_unused__ static inline bool
+fh_tls_session_init (const struct fh_config *config)
+{
+	(void) config;
+	return true;
+}
+
+__attribute_maybe_unused__ static inline void
+fh_tls_session_destroy (void)
+{
+}
+
+__attribute_maybe_unused__ static inline unsigned int
+fh_tls_session_rotation_interval (void)
+{
+	return 0;
+}
+
+__attribute_maybe_unused__ static inline void
+fh_tls_session_rotate_keys (void)
+{
+}
+
+#endif /* FHTTPD_ENABLE_TLS */
+
+#endif /* FH_CORE_TLS_H */
@@ -0,0 +1,344 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include <openssl/core_names.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/ssl.h>
+
+#define FH_LOG_MODULE_NAME "tls"
+
+#include "conf.h"
+#include "log/log.h"
+#include "mm/shmcache.h"
+#include "tls.h"
+
+/* Sessions whose DER encoding is larger than this are not cached; a
+   plain server-side session without client certificates is a few hundred
+   bytes.  */
+#define FH_TLS_SESSION_MAX_SIZE 1024
+
+/* The current ticket key plus the ones it replaced, which are still
+   accepted for decryption so that tickets live for a few rotations.  */
+#define FH_TLS_TICKET_KEYS 3
+
+struct fh_tls_ticket_key
+{
+	unsigned char name[16];
+	unsigned char aes_key[32];
+	unsigned char hmac_key[32];
+	time_t created;
+};
+
+/* Written by the master only, read by the workers under a sequence lock:
+   the sequence number is odd while an update is in progress.  */
+struct fh_tls_ticket_keys
+{
+	uint32_t seq;
+	uint32_t current;
+	struct fh_tls_ticket_key keys[FH_TLS_TICKET_KEYS];
+};
+
+static struct fh_shm_cache *session_cache = NULL;
+static struct fh_tls_ticket_keys *ticket_keys = NULL;
+static unsigned int ticket_key_rotation = 0;
+
+static bool
+fh_tls_ticket_key_generate (struct fh_tls_ticket_key *key)
+{
+	if (RAND_bytes (key->name, sizeof key->name) != 1
+		|| RAND_bytes (key->aes_key, sizeof key->aes_key) != 1
+		|| RAND_bytes (key->hmac_key, sizeof key->hmac_key) != 1)
+		return false;
+
+	key->created = time (NULL);
+	return true;
+}
+
+bool
+fh_tls_session_init (const struct fh_config *config)
+{
+	const struct fh_config_tls_session *tls_session = config->tls_session;
+	bool has_tls = false;
+
+	for (struct strtable_entry *entry = config->hosts->head; entry && !has_tls;
+		 entry = entry->next)
+		has_tls = ((struct fh_config_host *) entry->data)->tls != NULL;
+
+	if (!has_tls)
+		return true;
+
+	if (tls_session->cache_size > 0)
+	{
+		session_cache = fh_shm_cache_create (tls_session->cache_size,
+											 FH_TLS_SESSION_MAX_SIZE);
+
+		if (!session_cache)
+		{
+			fh_pr_err ("Failed to create the TLS session cache: %s",
+					   strerror (errno));
+			return false;
+		}
+	}
+
+	if (tls_session->tickets)
+	{
+		ticket_keys = mmap (NULL, sizeof (*ticket_keys), PROT_READ | PROT_WRITE,
+							MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+		if (ticket_keys == MAP_FAILED)
+		{
+			ticket_keys = NULL;
+			fh_pr_err ("Failed to map TLS ticket keys: %s", strerror (errno));
+			return false;
+		}
+
+		if (!fh_tls_ticket_key_generate (&ticket_keys->keys[0]))
+		{
+			fh_pr_err ("Failed to generate a TLS ticket key");
+			return false;
+		}
+
+		ticket_key_rotation = tls_session->ticket_key_rotation;
+	}
+
+	return true;
+}
+
+void
+fh_tls_session_destroy (void)
+{
+	fh_shm_cache_destroy (session_cache);
+	session_cache = NULL;
+
+	if (ticket_keys)
+	{
+		OPENSSL_cleanse (ticket_keys, sizeof (*ticket_keys));
+		munmap (ticket_keys, sizeof (*ticket_keys));
+		ticket_keys = NULL;
+	}
+}
+
+unsigned int
+fh_tls_session_rotation_interval (void)
+{
+	return ticket_keys ? ticket_key_rotation : 0;
+}
+
+void
+fh_tls_session_rotate_keys (void)
+{
+	struct fh_tls_ticket_key key;
+
+	if (!ticket_keys)
+		return;
+
+	if (!fh_tls_ticket_key_generate (&key))
+	{
+		fh_pr_err ("Failed to generate a TLS ticket key, keeping the old one");
+		return;
+	}
+
+	uint32_t next = (ticket_keys->current + 1) % FH_TLS_TICKET_KEYS;
+
+	__atomic_add_fetch (&ticket_keys->seq, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+
+	ticket_keys->keys[next] = key;
+	ticket_keys->current = next;
+
+	__atomic_add_fetch (&ticket_keys->seq, 1, __ATOMIC_RELEASE);
+
+	OPENSSL_cleanse (&key, sizeof key);
+	fh_pr_info ("Rotated TLS session ticket keys");
+}
+
+static void
+fh_tls_ticket_keys_read (struct fh_tls_ticket_keys *out)
+{
+	uint32_t seq;
+
+	do
+	{
+		while ((seq = __atomic_load_n (&ticket_keys->seq, __ATOMIC_ACQUIRE)) & 1)
+			;
+
+		memcpy (out->keys, ticket_keys->keys, sizeof (out->keys));
+		out->current = ticket_keys->current;
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+	}
+	while (__atomic_load_n (&ticket_keys->seq, __ATOMIC_RELAXED) != seq);
+}
+
+static int
+fh_tls_ticket_key_cb (SSL *ssl, unsigned char key_name[16], unsigned char *iv,
+					  EVP_CIPHER_CTX *cipher_ctx, EVP_MAC_CTX *mac_ctx, int enc)
+{
+	struct fh_tls_ticket_keys keys;
+	OSSL_PARAM params[] = {
+		OSSL_PARAM_construct_utf8_string (OSSL_MAC_PARAM_DIGEST,
+										  (char *) "SHA256", 0),
+		OSSL_PARAM_construct_end (),
+	};
+	int ret = 0;
+
+	(void) ssl;
+	fh_tls_ticket_keys_read (&keys);
+
+	if (enc)
+	{
+		const struct fh_tls_ticket_key *key = &keys.keys[keys.current];
+
+		if (RAND_bytes (iv, EVP_CIPHER_get_iv_length (EVP_aes_256_cbc ())) == 1
+			&& EVP_EncryptInit_ex (cipher_ctx, EVP_aes_256_cbc (), NULL,
+								   key->aes_key, iv)
+				   == 1
+			&& EVP_MAC_init (mac_ctx, key->hmac_key, sizeof key->hmac_key,
+							 params)
+				   == 1)
+		{
+			memcpy (key_name, key->name, sizeof key->name);
+			ret = 1;
+		}
+		else
+			ret = -1;
+	}
+	else
+	{
+		for (uint32_t i = 0; i < FH_TLS_TICKET_KEYS; i++)
+		{
+			const struct fh_tls_ticket_key *key = &keys.keys[i];
+
+			if (!key->created || memcmp (key_name, key->name, sizeof key->name))
+				continue;
+
+			if (EVP_MAC_init (mac_ctx, key->hmac_key, sizeof key->hmac_key,
+							  params)
+					!= 1
+				|| EVP_DecryptInit_ex (cipher_ctx, EVP_aes_256_cbc (), NULL,
+									   key->aes_key, iv)
+					   != 1)
+			{
+				ret = -1;
+				break;
+			}
+
+			/* Tickets under an older key are accepted, but renewed */
+			ret = i == keys.current ? 1 : 2;
+			break;
+		}
+	}
+
+	OPENSSL_cleanse (&keys, sizeof keys);
+	return ret;
+}
+
+static int
+fh_tls_session_new (SSL *ssl, SSL_SESSION *session)
+{
+	unsigned char buf[FH_TLS_SESSION_MAX_SIZE];
+	unsigned char *p = buf;
+	unsigned int id_len;
+	const unsigned char *id = SSL_SESSION_get_id (session, &id_len);
+	int len = i2d_SSL_SESSION (session, NULL);
+
+	(void) ssl;
+
+	if (len <= 0 || len > FH_TLS_SESSION_MAX_SIZE)
+		return 0;
+
+	i2d_SSL_SESSION (session, &p);
+	fh_shm_cache_set (session_cache, id, id_len, buf, (size_t) len,
+					  (time_t) (SSL_SESSION_get_time (session)
+								+ SSL_SESSION_get_timeout (session)));
+
+	/* We did not keep a reference to the session */
+	return 0;
+}
+
+static SSL_SESSION *
+fh_tls_session_get (SSL *ssl, const unsigned char *id, int id_len, int *copy)
+{
+	unsigned char buf[FH_TLS_SESSION_MAX_SIZE];
+	size_t len = sizeof buf;
+
+	(void) ssl;
+	*copy = 0;
+
+	if (!fh_shm_cache_get (session_cache, id, (size_t) id_len, buf, &len,
+						   time (NULL)))
+		return NULL;
+
+	const unsigned char *p = buf;
+	return d2i_SSL_SESSION (NULL, &p, (long) len);
+}
+
+static void
+fh_tls_session_remove (SSL_CTX *ctx, SSL_SESSION *session)
+{
+	unsigned int id_len;
+	const unsigned char *id = SSL_SESSION_get_id (session, &id_len);
+
+	(void) ctx;
+	fh_shm_cache_remove (session_cache, id, id_len);
+}
+
+void
+fh_tls_session_setup_ctx (SSL_CTX *ctx, const struct fh_config *config,
+						  const struct fh_config_host *host)
+{
+	unsigned char sid_ctx[EVP_MAX_MD_SIZE];
+	unsigned int sid_ctx_len = 0;
+
+	/* Sessions must not be resumed on a different virtual host */
+	EVP_Digest (host->addr.full_hostname, host->addr.full_hostname_len,
+				sid_ctx, &sid_ctx_len, EVP_sha256 (), NULL);
+	SSL_CTX_set_session_id_context (
+		ctx, sid_ctx,
+		sid_ctx_len < SSL_MAX_SID_CTX_LENGTH ? sid_ctx_len
+											 : SSL_MAX_SID_CTX_LENGTH);
+	SSL_CTX_set_timeout (ctx, config->tls_session->timeout);
+
+	if (session_cache)
+	{
+		SSL_CTX_set_session_cache_mode (ctx, SSL_SESS_CACHE_SERVER
+												 | SSL_SESS_CACHE_NO_INTERNAL);
+		SSL_CTX_sess_set_new_cb (ctx, &fh_tls_session_new);
+		SSL_CTX_sess_set_get_cb (ctx, &fh_tls_session_get);
+		SSL_CTX_sess_set_remove_cb (ctx, &fh_tls_session_remove);
+	}
+	else
+		SSL_CTX_set_session_cache_mode (ctx, SSL_SESS_CACHE_OFF);
+
+	if (!config->tls_session->tickets)
+		SSL_CTX_set_options (ctx, SSL_OP_NO_TICKET);
+	else if (ticket_keys)
+		SSL_CTX_set_tlsext_ticket_key_evp_cb (ctx, &fh_tls_ticket_key_cb);
+}
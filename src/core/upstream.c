@@ -0,0 +1,833 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FH_LOG_MODULE_NAME "upstream"
+
+#include "conf.h"
+#include "log/log.h"
+#include "upstream.h"
+
+/* Cost of a server without latency samples that is already busy, so that
+   a new server does not take every request until its first answer */
+#define FH_UPSTREAM_EWMA_PENALTY (UINT64_MAX >> 16)
+
+static struct fh_upstream_state *shared_states = NULL;
+static size_t shared_state_count = 0;
+/* A row of shared_state_count counters per worker */
+static uint32_t *shared_outstanding = NULL;
+static size_t shared_worker_count = 0;
+/* The row of this worker, once attached */
+static uint32_t *worker_outstanding = NULL;
+
+bool
+fh_upstream_resolve (const char *name, struct sockaddr_storage *addr,
+					 socklen_t *addr_len)
+{
+	memset (addr, 0, sizeof (*addr));
+
+	if (!strncmp (name, "unix:", 5))
+	{
+		struct sockaddr_un *un = (struct sockaddr_un *) addr;
+		const size_t len = strlen (name + 5);
+
+		if (!len || len >= sizeof (un->sun_path))
+			return false;
+
+		un->sun_family = AF_UNIX;
+		memcpy (un->sun_path, name + 5, len + 1);
+		*addr_len = (socklen_t) (offsetof (struct sockaddr_un, sun_path) + len
+								 + 1);
+		return true;
+	}
+
+	const char *colon = strrchr (name, ':');
+
+	if (!colon || colon == name || !colon[1])
+		return false;
+
+	const char *host_start = name;
+	size_t host_len = (size_t) (colon - name);
+	char host[256];
+
+	/* [::1]:8080 */
+	if (name[0] == '[' && host_len >= 2 && colon[-1] == ']')
+	{
+		host_start++;
+		host_len -= 2;
+	}
+
+	if (!host_len || host_len >= sizeof host)
+		return false;
+
+	memcpy (host, host_start, host_len);
+	host[host_len] = 0;
+
+	struct addrinfo hints = {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM,
+		.ai_flags = AI_NUMERICSERV,
+	};
+	struct addrinfo *result = NULL;
+
+	if (getaddrinfo (host, colon + 1, &hints, &result) || !result)
+		return false;
+
+	memcpy (addr, result->ai_addr, result->ai_addrlen);
+	*addr_len = result->ai_addrlen;
+	freeaddrinfo (result);
+	return true;
+}
+
+struct fh_upstreams *
+fh_upstreams_create (xpoll_t xpoll_fd)
+{
+	struct fh_upstreams *upstreams = calloc (1, sizeof (*upstreams));
+
+	if (!upstreams)
+		return NULL;
+
+	upstreams->xpoll_fd = xpoll_fd;
+	upstreams->conns = itable_create (0);
+	upstreams->groups = itable_create (0);
+
+	if (!upstreams->conns || !upstreams->groups)
+	{
+		fh_upstreams_destroy (upstreams);
+		return NULL;
+	}
+
+	return upstreams;
+}
+
+static void
+fh_upstream_conn_free (struct fh_upstream_conn *conn)
+{
+	close (conn->sockfd);
+
+	if (conn->pipe[0] >= 0)
+	{
+		close (conn->pipe[0]);
+		close (conn->pipe[1]);
+	}
+
+	free (conn);
+}
+
+void
+fh_upstreams_destroy (struct fh_upstreams *upstreams)
+{
+	if (!upstreams)
+		return;
+
+	if (upstreams->conns)
+	{
+		for_each_itable_entry (upstreams->conns, entry)
+		{
+			fh_upstream_conn_free (entry->data);
+		}
+
+		itable_destroy (upstreams->conns);
+	}
+
+	if (upstreams->groups)
+	{
+		for_each_itable_entry (upstreams->groups, entry)
+		{
+			struct fh_upstream_group *group = entry->data;
+
+			free (group->peers);
+			free (group);
+		}
+
+		itable_destroy (upstreams->groups);
+	}
+
+	free (upstreams);
+}
+
+struct fh_upstream_group *
+fh_upstream_group_get (struct fh_upstreams *upstreams,
+					   const struct fh_config_proxy *config)
+{
+	struct fh_upstream_group *group
+		= itable_get (upstreams->groups, (uint64_t) (uintptr_t) config);
+
+	if (group)
+		return group;
+
+	group = calloc (1, sizeof (*group));
+
+	if (!group)
+		return NULL;
+
+	group->config = config;
+	group->peer_count = config->upstream_count;
+	group->peers = calloc (group->peer_count, sizeof (*group->peers));
+
+	if (!group->peers
+		|| !itable_set (upstreams->groups, (uint64_t) (uintptr_t) config,
+						group))
+	{
+		free (group->peers);
+		free (group);
+		return NULL;
+	}
+
+	for (size_t i = 0; i < group->peer_count; i++)
+	{
+		struct fh_upstream_peer *peer = &group->peers[i];
+
+		peer->config = &config->upstreams[i];
+		peer->keepalive = config->keepalive;
+		peer->state = peer->config->state ? peer->config->state
+										  : &peer->local_state;
+	}
+
+	return group;
+}
+
+bool
+fh_upstream_shared_init (struct fh_config *config, size_t worker_count)
+{
+	size_t count = 0;
+
+	for (struct strtable_entry *entry = config->hosts->head; entry;
+		 entry = entry->next)
+	{
+		const struct fh_config_host *host = entry->data;
+
+		for (const struct fh_config_proxy *proxy = host->proxies; proxy;
+			 proxy = proxy->next)
+			count += proxy->upstream_count;
+	}
+
+	if (!count)
+		return true;
+
+	struct fh_upstream_state *states
+		= mmap (NULL, count * sizeof (*states), PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if (states == MAP_FAILED)
+		return false;
+
+	uint32_t *outstanding
+		= mmap (NULL, worker_count * count * sizeof (*outstanding),
+				PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if (outstanding == MAP_FAILED)
+	{
+		munmap (states, count * sizeof (*states));
+		return false;
+	}
+
+	shared_states = states;
+	shared_state_count = count;
+	shared_outstanding = outstanding;
+	shared_worker_count = worker_count;
+
+	for (struct strtable_entry *entry = config->hosts->head; entry;
+		 entry = entry->next)
+	{
+		const struct fh_config_host *host = entry->data;
+
+		for (struct fh_config_proxy *proxy = host->proxies; proxy;
+			 proxy = proxy->next)
+		{
+			for (size_t i = 0; i < proxy->upstream_count; i++)
+				proxy->upstreams[i].state = states++;
+		}
+	}
+
+	return true;
+}
+
+void
+fh_upstream_shared_destroy (void)
+{
+	if (!shared_states)
+		return;
+
+	munmap (shared_outstanding, shared_worker_count * shared_state_count
+									* sizeof (*shared_outstanding));
+	munmap (shared_states, shared_state_count * sizeof (*shared_states));
+	shared_states = NULL;
+	shared_state_count = 0;
+	shared_outstanding = NULL;
+	shared_worker_count = 0;
+	worker_outstanding = NULL;
+}
+
+void
+fh_upstream_forget (size_t worker_index)
+{
+	if (worker_index >= shared_worker_count)
+		return;
+
+	uint32_t *row = &shared_outstanding[worker_index * shared_state_count];
+
+	for (size_t i = 0; i < shared_state_count; i++)
+		__atomic_store_n (&row[i], 0, __ATOMIC_RELAXED);
+}
+
+void
+fh_upstream_attach (size_t worker_index)
+{
+	if (worker_index >= shared_worker_count)
+		return;
+
+	/* Requests that a previous worker in the same slot had in flight will
+	   never end.  */
+	fh_upstream_forget (worker_index);
+	worker_outstanding = &shared_outstanding[worker_index * shared_state_count];
+}
+
+static inline bool
+fh_upstream_is_shared (const struct fh_upstream_peer *peer)
+{
+	return worker_outstanding && peer->state != &peer->local_state;
+}
+
+uint64_t
+fh_upstream_outstanding (const struct fh_upstream_peer *peer)
+{
+	if (!fh_upstream_is_shared (peer))
+		return peer->outstanding;
+
+	const size_t index = (size_t) (peer->state - shared_states);
+	uint64_t outstanding = 0;
+
+	for (size_t i = 0; i < shared_worker_count; i++)
+		outstanding += __atomic_load_n (
+			&shared_outstanding[i * shared_state_count + index],
+			__ATOMIC_RELAXED);
+
+	return outstanding;
+}
+
+uint64_t
+fh_upstream_clock (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+static inline bool
+fh_upstream_available (const struct fh_upstream_peer *peer, uint64_t now_ms)
+{
+	return __atomic_load_n (&peer->state->ejected_until, __ATOMIC_RELAXED)
+		   <= now_ms;
+}
+
+static inline uint64_t
+fh_upstream_ewma_cost (const struct fh_upstream_peer *peer)
+{
+	const uint64_t latency
+		= __atomic_load_n (&peer->state->latency, __ATOMIC_RELAXED);
+	const uint64_t outstanding = fh_upstream_outstanding (peer);
+
+	if (!latency)
+		return outstanding ? FH_UPSTREAM_EWMA_PENALTY + outstanding : 0;
+
+	return latency * (outstanding + 1);
+}
+
+static uint64_t
+fh_upstream_hash_key (const char *key, size_t key_len)
+{
+	uint64_t hash = 0xcbf29ce484222325;
+
+	for (size_t i = 0; i < key_len; i++)
+	{
+		hash ^= (uint8_t) key[i];
+		hash *= 0x100000001b3;
+	}
+
+	return hash;
+}
+
+/* Jump consistent hash (Lamping and Veach): adding a server to the end of
+   the list only moves the keys that the new server takes.  */
+static size_t
+fh_upstream_jump_hash (uint64_t key, size_t buckets)
+{
+	int64_t b = -1, j = 0;
+
+	while (j < (int64_t) buckets)
+	{
+		b = j;
+		key = key * 2862933555777941757ULL + 1;
+		j = (int64_t) ((double) (b + 1)
+					   * ((double) (1LL << 31) / (double) ((key >> 33) + 1)));
+	}
+
+	return (size_t) b;
+}
+
+/* Returns the available peer of the lowest cost, looking from where
+   round-robin would to break ties, or NULL if none is available.  */
+static struct fh_upstream_peer *
+fh_upstream_pick_lowest (struct fh_upstream_group *group, uint64_t now_ms,
+						 bool ewma)
+{
+	struct fh_upstream_peer *best = NULL;
+	uint64_t best_cost = UINT64_MAX;
+	const size_t start = group->next_peer++;
+
+	for (size_t i = 0; i < group->peer_count; i++)
+	{
+		struct fh_upstream_peer *peer
+			= &group->peers[(start + i) % group->peer_count];
+
+		if (!fh_upstream_available (peer, now_ms))
+			continue;
+
+		const uint64_t cost
+			= ewma ? fh_upstream_ewma_cost (peer)
+				   : fh_upstream_outstanding (peer);
+
+		if (!best || cost < best_cost)
+		{
+			best = peer;
+			best_cost = cost;
+		}
+	}
+
+	return best;
+}
+
+static struct fh_upstream_peer *
+fh_upstream_pick_hash (struct fh_upstream_group *group, uint64_t now_ms,
+					   const char *key, size_t key_len)
+{
+	uint64_t hash = fh_upstream_hash_key (key, key_len);
+	const size_t first = fh_upstream_jump_hash (hash, group->peer_count);
+
+	/* Keys of an ejected server are spread over the others by rehashing,
+	   and the keys of the other servers stay where they are.  */
+	for (size_t i = 0, bucket = first; i < group->peer_count; i++)
+	{
+		if (fh_upstream_available (&group->peers[bucket], now_ms))
+			return &group->peers[bucket];
+
+		hash = fh_upstream_hash_key ((const char *) &hash, sizeof hash);
+		bucket = fh_upstream_jump_hash (hash, group->peer_count);
+	}
+
+	/* Unlucky rehashes end up with the next available server.  */
+	for (size_t i = 1; i < group->peer_count; i++)
+	{
+		struct fh_upstream_peer *peer
+			= &group->peers[(first + i) % group->peer_count];
+
+		if (fh_upstream_available (peer, now_ms))
+			return peer;
+	}
+
+	return NULL;
+}
+
+static struct fh_upstream_peer *
+fh_upstream_pick_round_robin (struct fh_upstream_group *group, uint64_t now_ms)
+{
+	for (size_t i = 0; i < group->peer_count; i++)
+	{
+		struct fh_upstream_peer *peer
+			= &group->peers[group->next_peer++ % group->peer_count];
+
+		if (fh_upstream_available (peer, now_ms))
+			return peer;
+	}
+
+	return NULL;
+}
+
+struct fh_upstream_peer *
+fh_upstream_pick (struct fh_upstream_group *group, const char *key,
+				  size_t key_len)
+{
+	if (!group->peer_count)
+		return NULL;
+
+	const uint64_t now_ms = fh_upstream_clock () / 1000;
+	struct fh_upstream_peer *peer;
+
+	switch (group->config->balance)
+	{
+		case FH_UPSTREAM_BALANCE_LEAST_CONN:
+			peer = fh_upstream_pick_lowest (group, now_ms, false);
+			break;
+
+		case FH_UPSTREAM_BALANCE_EWMA:
+			peer = fh_upstream_pick_lowest (group, now_ms, true);
+			break;
+
+		case FH_UPSTREAM_BALANCE_HASH:
+			peer = key ? fh_upstream_pick_hash (group, now_ms, key, key_len)
+					   : fh_upstream_pick_round_robin (group, now_ms);
+			break;
+
+		default:
+			peer = fh_upstream_pick_round_robin (group, now_ms);
+			break;
+	}
+
+	if (peer)
+		return peer;
+
+	/* Everything is ejected: a request that may fail beats certainly
+	   failing it.  */
+	if (group->config->balance == FH_UPSTREAM_BALANCE_HASH && key)
+		return &group->peers[fh_upstream_jump_hash (
+			fh_upstream_hash_key (key, key_len), group->peer_count)];
+
+	return &group->peers[group->next_peer++ % group->peer_count];
+}
+
+/* Only this worker writes its counter, but others read it.  */
+static inline uint32_t *
+fh_upstream_counter (struct fh_upstream_peer *peer)
+{
+	if (!fh_upstream_is_shared (peer))
+		return &peer->outstanding;
+
+	return &worker_outstanding[peer->state - shared_states];
+}
+
+void
+fh_upstream_begin (struct fh_upstream_peer *peer)
+{
+	__atomic_add_fetch (fh_upstream_counter (peer), 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch (&peer->state->requests, 1, __ATOMIC_RELAXED);
+}
+
+void
+fh_upstream_end (struct fh_upstream_peer *peer)
+{
+	__atomic_sub_fetch (fh_upstream_counter (peer), 1, __ATOMIC_RELAXED);
+}
+
+/* Peak-EWMA: a slower sample is taken right away, a faster one is blended
+   in with a weight growing with the time since the last sample.  */
+static void
+fh_upstream_update_latency (struct fh_upstream_state *state, uint64_t latency,
+							uint64_t now)
+{
+	const uint64_t old = __atomic_load_n (&state->latency, __ATOMIC_RELAXED);
+	const uint64_t stamp
+		= __atomic_load_n (&state->latency_stamp, __ATOMIC_RELAXED);
+	uint64_t value = latency ? latency : 1;
+
+	if (old && value < old)
+	{
+		const uint64_t elapsed = now > stamp ? now - stamp : 0;
+		const double w = (double) FH_UPSTREAM_EWMA_DECAY
+						 / (double) (FH_UPSTREAM_EWMA_DECAY + elapsed);
+
+		value = (uint64_t) ((double) old * w + (double) value * (1 - w));
+	}
+
+	__atomic_store_n (&state->latency, value ? value : 1, __ATOMIC_RELAXED);
+	__atomic_store_n (&state->latency_stamp, now, __ATOMIC_RELAXED);
+}
+
+void
+fh_upstream_report (struct fh_upstream_group *group,
+					struct fh_upstream_peer *peer, bool ok, uint64_t latency)
+{
+	struct fh_upstream_state *state = peer->state;
+	const uint64_t now = fh_upstream_clock ();
+
+	if (ok)
+	{
+		fh_upstream_update_latency (state, latency, now);
+
+		/* Written only when set, to keep the line shared between CPUs.  */
+		if (__atomic_load_n (&state->fails, __ATOMIC_RELAXED))
+			__atomic_store_n (&state->fails, 0, __ATOMIC_RELAXED);
+
+		if (__atomic_load_n (&state->ejections, __ATOMIC_RELAXED))
+		{
+			fh_pr_info ("Upstream %s is back", peer->config->name);
+			__atomic_store_n (&state->ejections, 0, __ATOMIC_RELAXED);
+		}
+
+		return;
+	}
+
+	__atomic_add_fetch (&state->failures, 1, __ATOMIC_RELAXED);
+
+	const uint32_t fails
+		= __atomic_add_fetch (&state->fails, 1, __ATOMIC_RELAXED);
+	const size_t max_fails = group->config->max_fails;
+
+	if (!max_fails || fails < max_fails)
+		return;
+
+	/* Of all the failures that come in while the server is still up, only
+	   the first one ejects it.  A failure after the ejection period, the
+	   first request let through, ejects it again for twice as long.  */
+	const uint64_t now_ms = now / 1000;
+	uint64_t until = __atomic_load_n (&state->ejected_until, __ATOMIC_RELAXED);
+
+	if (until > now_ms)
+		return;
+
+	const uint32_t ejections = __atomic_load_n (&state->ejections,
+												__ATOMIC_RELAXED);
+	const uint32_t shift = ejections < FH_UPSTREAM_MAX_BACKOFF_SHIFT
+							   ? ejections
+							   : FH_UPSTREAM_MAX_BACKOFF_SHIFT;
+	const uint64_t period = (uint64_t) group->config->fail_timeout * 1000
+							<< shift;
+
+	if (!__atomic_compare_exchange_n (&state->ejected_until, &until,
+									  now_ms + period, false,
+									  __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		return;
+
+	__atomic_add_fetch (&state->ejections, 1, __ATOMIC_RELAXED);
+	fh_pr_warn ("Upstream %s failed %u times in a row, ejected for %lu ms",
+				peer->config->name, fails, period);
+}
+
+static void
+fh_upstream_unlink_idle (struct fh_upstream_conn *conn)
+{
+	struct fh_upstream_peer *peer = conn->peer;
+
+	if (conn->prev)
+		conn->prev->next = conn->next;
+	else
+		peer->idle_head = conn->next;
+
+	if (conn->next)
+		conn->next->prev = conn->prev;
+
+	conn->prev = conn->next = NULL;
+	conn->idle = false;
+	peer->idle_count--;
+}
+
+static void
+fh_upstream_close (struct fh_upstreams *upstreams,
+				   struct fh_upstream_conn *conn)
+{
+	if (conn->idle)
+		fh_upstream_unlink_idle (conn);
+
+	itable_remove (upstreams->conns, (uint64_t) conn->sockfd);
+	xpoll_del (upstreams->xpoll_fd, conn->sockfd, XPOLLIN | XPOLLOUT);
+	fh_upstream_conn_free (conn);
+}
+
+static struct fh_upstream_conn *
+fh_upstream_connect (struct fh_upstreams *upstreams,
+					 struct fh_upstream_peer *peer)
+{
+	const struct fh_config_upstream *config = peer->config;
+	fd_t sockfd = socket (config->addr.ss_family,
+						  SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+	if (sockfd < 0)
+		return NULL;
+
+	if (config->addr.ss_family != AF_UNIX)
+	{
+		int one = 1;
+
+		setsockopt (sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+	}
+
+	bool connected = true;
+
+	if (connect (sockfd, (const struct sockaddr *) &config->addr,
+				 config->addr_len)
+		< 0)
+	{
+		if (errno != EINPROGRESS)
+		{
+			fh_pr_err ("Failed to connect to upstream %s: %s", config->name,
+					   strerror (errno));
+			close (sockfd);
+			return NULL;
+		}
+
+		connected = false;
+	}
+
+	struct fh_upstream_conn *conn = calloc (1, sizeof (*conn));
+
+	if (!conn)
+	{
+		close (sockfd);
+		return NULL;
+	}
+
+	conn->sockfd = sockfd;
+	conn->pipe[0] = conn->pipe[1] = -1;
+	conn->peer = peer;
+	conn->connected = connected;
+
+	if (!itable_set (upstreams->conns, (uint64_t) sockfd, conn))
+	{
+		fh_upstream_conn_free (conn);
+		return NULL;
+	}
+
+	/* Edge-triggered: the user reads and writes until EAGAIN, and is told
+	   again only once that changes.  */
+	if (!xpoll_add (upstreams->xpoll_fd, sockfd,
+					XPOLLIN | XPOLLOUT | XPOLLRDHUP | XPOLLET, 0))
+	{
+		itable_remove (upstreams->conns, (uint64_t) sockfd);
+		fh_upstream_conn_free (conn);
+		return NULL;
+	}
+
+	fh_pr_debug ("Connecting to upstream %s (fd %d)", config->name, sockfd);
+	return conn;
+}
+
+struct fh_upstream_conn *
+fh_upstream_acquire (struct fh_upstreams *upstreams,
+					 struct fh_upstream_peer *peer,
+					 fh_upstream_event_cb_t on_event, void *data)
+{
+	struct fh_upstream_conn *conn = peer->idle_head;
+
+	if (conn)
+		fh_upstream_unlink_idle (conn);
+	else if (!(conn = fh_upstream_connect (upstreams, peer)))
+		return NULL;
+
+	conn->on_event = on_event;
+	conn->data = data;
+	return conn;
+}
+
+void
+fh_upstream_release (struct fh_upstreams *upstreams,
+					 struct fh_upstream_conn *conn, bool reusable)
+{
+	struct fh_upstream_peer *peer = conn->peer;
+
+	conn->on_event = NULL;
+	conn->data = NULL;
+
+	if (!reusable || !conn->connected || peer->idle_count >= peer->keepalive)
+	{
+		fh_upstream_close (upstreams, conn);
+		return;
+	}
+
+	conn->requests++;
+	conn->idle = true;
+	conn->prev = NULL;
+	conn->next = peer->idle_head;
+
+	if (peer->idle_head)
+		peer->idle_head->prev = conn;
+
+	peer->idle_head = conn;
+	peer->idle_count++;
+}
+
+bool
+fh_upstream_pipe (struct fh_upstream_conn *conn)
+{
+	if (conn->pipe[0] >= 0)
+		return true;
+
+	if (pipe2 (conn->pipe, O_NONBLOCK | O_CLOEXEC) < 0)
+	{
+		conn->pipe[0] = conn->pipe[1] = -1;
+		return false;
+	}
+
+	/* Best effort: a larger pipe only saves trips through the loop.  */
+	fcntl (conn->pipe[1], F_SETPIPE_SZ, FH_UPSTREAM_PIPE_SIZE);
+	return true;
+}
+
+bool
+fh_upstream_handle_event (struct fh_upstreams *upstreams, fd_t fd,
+						  uint32_t events)
+{
+	struct fh_upstream_conn *conn = itable_get (upstreams->conns, (uint64_t) fd);
+
+	if (!conn)
+		return false;
+
+	if (conn->idle)
+	{
+		/* The server closed the connection, or sent something unasked.  */
+		if (events & (XPOLLIN | XPOLLRDHUP | XPOLLHUP | XPOLLERR))
+		{
+			fh_pr_debug ("Idle upstream connection %d to %s went away", fd,
+						 conn->peer->config->name);
+			fh_upstream_close (upstreams, conn);
+		}
+
+		return true;
+	}
+
+	if (!conn->connected && (events & (XPOLLOUT | XPOLLERR | XPOLLHUP)))
+	{
+		int err = 0;
+		socklen_t len = sizeof err;
+
+		if (getsockopt (fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+			err = errno;
+
+		if (err)
+		{
+			fh_pr_err ("Failed to connect to upstream %s: %s",
+					   conn->peer->config->name, strerror (err));
+			errno = err;
+			events |= XPOLLERR;
+		}
+		else
+		{
+			conn->connected = true;
+		}
+	}
+
+	if (conn->on_event)
+		conn->on_event (conn->data, events);
+
+	return true;
+}
@@ -0,0 +1,182 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FH_CORE_UPSTREAM_H
+#define FH_CORE_UPSTREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "event/xpoll.h"
+#include "hash/itable.h"
+#include "types.h"
+
+#define FH_UPSTREAM_DEFAULT_KEEPALIVE 16
+#define FH_UPSTREAM_DEFAULT_MAX_FAILS 3
+#define FH_UPSTREAM_DEFAULT_FAIL_TIMEOUT 10
+/* Ejection periods stop doubling after this many ejections in a row */
+#define FH_UPSTREAM_MAX_BACKOFF_SHIFT 6
+/* Time over which old latency samples lose most of their weight, in
+   microseconds */
+#define FH_UPSTREAM_EWMA_DECAY (10 * 1000 * 1000)
+/* Capacity requested for the pipes that response bodies are spliced
+   through */
+#define FH_UPSTREAM_PIPE_SIZE (256 * 1024)
+
+struct fh_config;
+struct fh_config_upstream;
+struct fh_config_proxy;
+struct fh_upstream_conn;
+
+/* What the workers know about an upstream server.  It lives in shared
+   memory, so the fields are only accessed atomically; the latency average
+   tolerates the odd lost update.  The requests in flight are counted by
+   each worker apart from it, see fh_upstream_outstanding().  */
+struct fh_upstream_state
+{
+	/* Failures since the last success */
+	uint32_t fails;
+	/* Ejections since the last success */
+	uint32_t ejections;
+	/* Monotonic time in milliseconds until which the server is skipped */
+	uint64_t ejected_until;
+	/* Peak-EWMA of the time to the response head, and when it was last
+	   updated, in microseconds */
+	uint64_t latency;
+	uint64_t latency_stamp;
+	uint64_t requests;
+	uint64_t failures;
+};
+
+/* Called with the poll events of a connection that is in use.  XPOLLERR
+   is also reported when a connect() in progress failed.  */
+typedef void (*fh_upstream_event_cb_t) (void *data, uint32_t events);
+
+/* An upstream server, as seen by this worker */
+struct fh_upstream_peer
+{
+	const struct fh_config_upstream *config;
+	/* The shared state, or `local_state' when none was mapped */
+	struct fh_upstream_state *state;
+	struct fh_upstream_state local_state;
+	/* Requests in flight when the state is not shared */
+	uint32_t outstanding;
+	/* Most recently used first */
+	struct fh_upstream_conn *idle_head;
+	size_t idle_count;
+	size_t keepalive;
+};
+
+/* The upstream servers of a `proxy' block */
+struct fh_upstream_group
+{
+	const struct fh_config_proxy *config;
+	struct fh_upstream_peer *peers;
+	size_t peer_count;
+	size_t next_peer;
+};
+
+struct fh_upstream_conn
+{
+	fd_t sockfd;
+	/* Created on first use and kept along with the connection */
+	fd_t pipe[2];
+	struct fh_upstream_peer *peer;
+	struct fh_upstream_conn *prev, *next;
+	fh_upstream_event_cb_t on_event;
+	void *data;
+	/* Requests that were completed over the connection */
+	size_t requests;
+	bool connected : 1;
+	bool idle : 1;
+};
+
+struct fh_upstreams
+{
+	xpoll_t xpoll_fd;
+	/* (fd_t) => (struct fh_upstream_conn *) */
+	struct itable *conns;
+	/* (const struct fh_config_proxy *) => (struct fh_upstream_group *) */
+	struct itable *groups;
+};
+
+/* Parses "host:port" or "unix:/path" into a socket address.  Host names
+   are resolved right away.  */
+bool fh_upstream_resolve (const char *name, struct sockaddr_storage *addr,
+						  socklen_t *addr_len);
+
+struct fh_upstreams *fh_upstreams_create (xpoll_t xpoll_fd);
+void fh_upstreams_destroy (struct fh_upstreams *upstreams);
+
+struct fh_upstream_group *
+fh_upstream_group_get (struct fh_upstreams *upstreams,
+					   const struct fh_config_proxy *config);
+/* Chooses a server according to the balancing policy of the group,
+   skipping ejected ones unless all of them are.  `key' is only used by
+   the `hash' policy, which falls back to round-robin without one.  */
+struct fh_upstream_peer *fh_upstream_pick (struct fh_upstream_group *group,
+										   const char *key, size_t key_len);
+
+/* Maps the state of every upstream server in `config', and a counter of
+   requests in flight per server for each worker; called before the
+   workers are forked.  */
+bool fh_upstream_shared_init (struct fh_config *config, size_t worker_count);
+void fh_upstream_shared_destroy (void);
+/* Makes the counters of the given worker the current ones.  They are
+   cleared first, which drops the requests of a worker that died in the
+   same slot.  */
+void fh_upstream_attach (size_t worker_index);
+/* Drops the requests in flight of a worker that exited.  */
+void fh_upstream_forget (size_t worker_index);
+/* Requests in flight to the server, over all workers */
+uint64_t fh_upstream_outstanding (const struct fh_upstream_peer *peer);
+
+/* Monotonic time in microseconds */
+uint64_t fh_upstream_clock (void);
+
+/* Bracket each request sent to `peer', for the least-conn and ewma
+   policies.  */
+void fh_upstream_begin (struct fh_upstream_peer *peer);
+void fh_upstream_end (struct fh_upstream_peer *peer);
+
+/* Records whether a server answered, and how fast.  Failures eject the
+   server once `max_fails' of them come in a row.  */
+void fh_upstream_report (struct fh_upstream_group *group,
+						 struct fh_upstream_peer *peer, bool ok,
+						 uint64_t latency);
+
+/* Returns an idle connection to `peer', or a new one whose connect() may
+   still be in progress, in which case an XPOLLOUT event follows.  */
+struct fh_upstream_conn *fh_upstream_acquire (struct fh_upstreams *upstreams,
+											  struct fh_upstream_peer *peer,
+											  fh_upstream_event_cb_t on_event,
+											  void *data);
+/* Keeps the connection for later requests if `reusable' and the pool of
+   its peer has room, and closes it otherwise.  */
+void fh_upstream_release (struct fh_upstreams *upstreams,
+						  struct fh_upstream_conn *conn, bool reusable);
+bool fh_upstream_pipe (struct fh_upstream_conn *conn);
+
+/* Returns false if `fd' is not an upstream connection.  */
+bool fh_upstream_handle_event (struct fh_upstreams *upstreams, fd_t fd,
+							   uint32_t events);
+
+#endif /* FH_CORE_UPSTREAM_H */
@@ -17,6 +17,9 @@
  * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
+
+#include <sched.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdbool.h>
@@ -31,6 +34,10 @@
 #include "worker.h"
 #include "server.h"
 #include "module.h"
+#include "stats.h"
+#include "accesslog.h"
+#include "capture.h"
+#include "upstream.h"
 
 static pid_t pid;
 static struct fh_server *server = NULL;
@@ -40,6 +47,10 @@ fh_worker_cleanup (void)
 {
     if (server)
         fh_server_destroy (server);
+
+    fh_access_log_destroy ();
+    fh_capture_destroy ();
+    fh_log_stop_async ();
 }
 
 static void
@@ -49,6 +60,18 @@ fh_worker_handle_signal (int sig __attribute_maybe_unused__)
         server->should_exit = true;
 }
 
+static void
+fh_worker_handle_log (int sig)
+{
+    if (sig == SIGUSR1)
+        fh_log_request_levels ();
+    else
+    {
+        fh_log_request_reopen ();
+        fh_access_log_request_reopen ();
+    }
+}
+
 static bool
 fh_worker_setup_signal (void)
 {
@@ -61,6 +84,12 @@ fh_worker_setup_signal (void)
 	if (sigaction (SIGINT, &act, NULL) < 0 || sigaction (SIGTERM, &act, NULL) < 0)
 		return false;
 
+	act.sa_handler = &fh_worker_handle_log;
+
+	if (sigaction (SIGUSR1, &act, NULL) < 0
+		|| sigaction (SIGUSR2, &act, NULL) < 0)
+		return false;
+
 	act.sa_flags = SA_RESTART;
 	act.sa_handler = SIG_IGN;
 	sigemptyset (&act.sa_mask);
@@ -69,7 +98,8 @@ fh_worker_setup_signal (void)
 }
 
 _noreturn void
-fh_worker_start (struct fh_config *config, struct fh_module_manager *module_manager)
+fh_worker_start (struct fh_config *config, struct fh_module_manager *module_manager,
+				 size_t worker_index, int cpu)
 {
     pid = getpid ();
 
@@ -77,12 +107,34 @@ fh_worker_start (struct fh_config *config, struct fh_module_manager *module_mana
         exit (EXIT_FAILURE);
 
     fh_log_set_worker_pid (pid);
+    fh_stats_attach (worker_index);
+    fh_capture_attach (worker_index);
+    fh_upstream_attach (worker_index);
 
     if (!fh_worker_setup_signal ())
         exit (EXIT_FAILURE);
 
     atexit (&fh_worker_cleanup);
 
+    if (cpu >= 0)
+    {
+        cpu_set_t mask;
+
+        CPU_ZERO (&mask);
+        CPU_SET (cpu, &mask);
+
+        /* Before the log writer is started, so that it is pinned too */
+        if (sched_setaffinity (0, sizeof mask, &mask) < 0)
+        {
+            fh_pr_warn ("Failed to pin the worker to CPU %d: %s", cpu,
+                        strerror (errno));
+            cpu = -1;
+        }
+    }
+
+    if (!fh_log_start_async ())
+        fh_pr_warn ("Failed to start the log writer: %s", strerror (errno));
+
     server = fh_server_create (config, module_manager);
 
     if (!server)
@@ -91,6 +143,15 @@ fh_worker_start (struct fh_config *config, struct fh_module_manager *module_mana
         exit (EXIT_FAILURE);
     }
 
+    server->worker_index = worker_index;
+    server->cpu = cpu;
+
+    if (!fh_access_log_init (server->config))
+    {
+        fh_pr_emerg ("Failed to open the access logs: %s", strerror (errno));
+        exit (EXIT_FAILURE);
+    }
+
     if (!fh_server_listen (server))
     {
         fh_pr_emerg ("Failed to initialize server: %s", strerror (errno));
@@ -20,12 +20,15 @@
 #ifndef FH_CORE_WORKER_H
 #define FH_CORE_WORKER_H
 
+#include <stddef.h>
+
 #include "compat.h"
 #include "conf.h"
 
 struct fh_module_manager;
 
 _noreturn void fh_worker_start (struct fh_config *config,
-								struct fh_module_manager *module_manager);
+								struct fh_module_manager *module_manager,
+								size_t worker_index, int cpu);
 
 #endif /* FH_CORE_WORKER_H */
@@ -34,7 +34,9 @@
 #include "compat.h"
 #include "core/conn.h"
 #include "core/server.h"
+#include "core/tls.h"
 #include "log/log.h"
+#include "probes.h"
 
 bool
 event_accept (struct fh_server *server, const xevent_t *ev_info, const struct sockaddr_in *server_addr)
@@ -96,6 +98,13 @@ event_accept (struct fh_server *server, const xevent_t *ev_info, const struct so
 			continue;
 		}
 
+		if (!fh_tls_accept (server->tls, conn))
+		{
+			fh_server_close_conn (server, conn);
+			fh_pr_err ("Failed to set up TLS for the connection");
+			continue;
+		}
+
 		if (!xpoll_add (server->xpoll_fd, client_sockfd, XPOLLIN | XPOLLET | XPOLLHUP, fdflags))
 		{
 			fh_server_close_conn (server, conn);
@@ -112,6 +121,8 @@ event_accept (struct fh_server *server, const xevent_t *ev_info, const struct so
 		conn->extra->full_host_len = addr->full_hostname_len;
 		conn->config = config;
 
+		FH_PROBE4 (conn__accept, conn->id, client_sockfd,
+				   ntohl (client_addr.sin_addr.s_addr), port);
 		fh_pr_info ("Connection established with %s:%u", ip, port);
 	}
 
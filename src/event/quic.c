@@ -0,0 +1,133 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define FH_LOG_MODULE_NAME "event/quic"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "core/quic.h"
+#include "core/server.h"
+#include "http/h3.h"
+#include "log/log.h"
+#include "quic.h"
+#include "recv.h"
+
+static bool
+event_quic_add (struct fh_server *server, fd_t sockfd, uint16_t port)
+{
+	struct fh_h3 *h3 = fh_h3_create (server, sockfd, port, server->worker_index,
+									 &event_recv_handle_request, server);
+
+	if (!h3)
+	{
+		close (sockfd);
+		return false;
+	}
+
+	fd_t timerfd = fh_h3_timerfd (h3);
+
+	if (!itable_set (server->quic_fds, (uint64_t) sockfd, h3))
+	{
+		fh_h3_destroy (h3);
+		return false;
+	}
+
+	if (!itable_set (server->quic_fds, (uint64_t) timerfd, h3)
+		|| !xpoll_add (server->xpoll_fd, sockfd, XPOLLIN, 0)
+		|| !xpoll_add (server->xpoll_fd, timerfd, XPOLLIN, 0))
+		return false;
+
+	fh_pr_info ("Listening on 0.0.0.0:%u (QUIC)", port);
+	return true;
+}
+
+bool
+event_quic_init (struct fh_server *server)
+{
+	fd_t fds[FH_SERVER_MAX_SOCKETS];
+	uint16_t ports[FH_SERVER_MAX_SOCKETS];
+	size_t count = fh_quic_listeners_take (server->worker_index, fds, ports,
+										   FH_SERVER_MAX_SOCKETS);
+
+	if (!count)
+		return true;
+
+	if (!server->tls)
+	{
+		for (size_t i = 0; i < count; i++)
+			close (fds[i]);
+
+		return false;
+	}
+
+	server->quic_fds = itable_create (0);
+
+	if (!server->quic_fds)
+	{
+		for (size_t i = 0; i < count; i++)
+			close (fds[i]);
+
+		return false;
+	}
+
+	for (size_t i = 0; i < count; i++)
+	{
+		if (!event_quic_add (server, fds[i], ports[i]))
+		{
+			for (size_t k = i + 1; k < count; k++)
+				close (fds[k]);
+
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void
+event_quic_destroy (struct fh_server *server)
+{
+	if (!server->quic_fds)
+		return;
+
+	/* Each endpoint is in the table twice, once under its timer */
+	for_each_itable_entry (server->quic_fds, entry)
+	{
+		struct fh_h3 *h3 = entry->data;
+
+		if ((fd_t) entry->key == fh_h3_sockfd (h3))
+			fh_h3_destroy (h3);
+	}
+
+	itable_destroy (server->quic_fds);
+	server->quic_fds = NULL;
+}
+
+bool
+event_quic (struct fh_server *server, const xevent_t *event, struct fh_h3 *h3)
+{
+	(void) server;
+
+	if (event->data.fd == fh_h3_timerfd (h3))
+		return fh_h3_expire (h3);
+
+	return fh_h3_recv (h3);
+}
@@ -0,0 +1,70 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FH_EVENT_QUIC_H
+#define FH_EVENT_QUIC_H
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <stdbool.h>
+
+#include "compat.h"
+#include "core/server.h"
+#include "xpoll.h"
+
+struct fh_h3;
+
+#ifdef FHTTPD_ENABLE_HTTP3
+
+/* Sets up the HTTP/3 endpoints of this worker on the UDP sockets that the
+   master created for it.  */
+bool event_quic_init (struct fh_server *server);
+void event_quic_destroy (struct fh_server *server);
+bool event_quic (struct fh_server *server, const xevent_t *event,
+				 struct fh_h3 *h3);
+
+#else /* not FHTTPD_ENABLE_HTTP3 */
+
+__attribute_maybe_unused__ static inline bool
+event_quic_init (struct fh_server *server)
+{
+	(void) server;
+	return true;
+}
+
+__attribute_maybe_unused__ static inline void
+event_quic_destroy (struct fh_server *server)
+{
+	(void) server;
+}
+
+__attribute_maybe_unused__ static inline bool
+event_quic (struct fh_server *server, const xevent_t *event, struct fh_h3 *h3)
+{
+	(void) server;
+	(void) event;
+	(void) h3;
+	return true;
+}
+
+#endif /* FHTTPD_ENABLE_HTTP3 */
+
+#endif /* FH_EVENT_QUIC_H */
@@ -25,22 +25,122 @@
 #include "compat.h"
 #include "core/conn.h"
 #include "core/server.h"
+#include "core/stats.h"
 #include "core/stream.h"
+#include "core/tls.h"
+#include "http/h2.h"
 #include "http/http1_request.h"
 #include "http/protocol.h"
 #include "log/log.h"
+#include "probes.h"
 #include "recv.h"
+#include "router/router.h"
+
+/* Drives the TLS handshake, waiting for writability only while OpenSSL
+   has a flight it could not flush.  Returns true once application data
+   can be read.  */
+static bool
+event_recv_tls_handshake (struct fh_server *server, struct fh_conn *conn)
+{
+	enum fh_tls_status status = fh_tls_handshake (conn);
+
+	if (status == FH_TLS_ERROR)
+	{
+		fh_server_close_conn (server, conn);
+		return false;
+	}
+
+	bool want_write = status == FH_TLS_WANT_WRITE;
+
+	if (want_write != conn->tls_want_write)
+	{
+		uint32_t flags = (want_write ? XPOLLOUT : XPOLLIN) | XPOLLET | XPOLLHUP;
+
+		if (!xpoll_mod (server->xpoll_fd, conn->client_sockfd, flags))
+		{
+			fh_pr_err ("Unable to switch poll mode during TLS handshake");
+			fh_server_close_conn (server, conn);
+			return false;
+		}
+
+		conn->tls_want_write = want_write;
+	}
+
+	return status == FH_TLS_OK;
+}
+
+bool
+event_recv_handle_request (void *data, struct fh_conn *conn,
+						   const struct fh_request *request,
+						   struct fh_response *response)
+{
+	struct fh_server *server = data;
+
+	if (request->host)
+	{
+		struct fh_config_host *config
+			= strtable_get (server->host_configs, request->host);
+
+		if (!config)
+		{
+			fh_pr_debug ("Non-existing host: |%.*s|",
+						 (int) request->full_host_len, request->host);
+			response->status = FH_STATUS_BAD_REQUEST;
+			response->use_default_error_response = true;
+			return true;
+		}
+
+		conn->config = config;
+	}
+
+	return fh_router_respond (server->router, conn, request, response);
+}
 
 static bool
 event_recv_h2 (struct fh_server *server, struct fh_conn *conn,
-			   char *proto_det_buf, size_t proto_det_off)
+			   const char *proto_det_buf, size_t proto_det_off)
 {
-	(void) proto_det_buf;
-	(void) proto_det_off;
+	struct fh_h2_ctx *ctx = conn->io_ctx.h2;
+
+	if (!ctx)
+	{
+		ctx = fh_h2_ctx_create (conn, &event_recv_handle_request, server);
 
-	fh_pr_err ("Not implemented: h2");
-	fh_server_close_conn (server, conn);
-	return false;
+		if (!ctx)
+		{
+			fh_pr_err ("Failed to allocate memory");
+			fh_server_close_conn (server, conn);
+			return false;
+		}
+
+		conn->io_ctx.h2 = ctx;
+
+		/* Streams are multiplexed from now on, so the connection waits for
+		   both directions at once.  */
+		if (!xpoll_mod (server->xpoll_fd, conn->client_sockfd,
+						XPOLLIN | XPOLLOUT | XPOLLET | XPOLLHUP))
+		{
+			fh_pr_err ("Unable to switch poll mode for HTTP/2");
+			fh_server_close_conn (server, conn);
+			return false;
+		}
+
+		/* Frames that came in along with the preface */
+		if (proto_det_off > H2_PREFACE_SIZE
+			&& !fh_h2_feed (ctx,
+							(const uint8_t *) proto_det_buf + H2_PREFACE_SIZE,
+							proto_det_off - H2_PREFACE_SIZE))
+		{
+			fh_server_close_conn (server, conn);
+			return true;
+		}
+	}
+
+	if (!fh_h2_recv (ctx) || !fh_h2_send (ctx) || fh_h2_done (ctx)
+		|| (ctx->recv_more && !fh_server_defer (server, conn)))
+		fh_server_close_conn (server, conn);
+
+	return true;
 }
 
 static bool
@@ -62,11 +162,16 @@ event_recv_http1 (struct fh_server *server, struct fh_conn *conn,
 
 		fh_stream_init (conn->stream, child_pool);
 
-		if (fh_stream_add_buf_data (conn->stream, (uint8_t *) proto_det_buf,
-									proto_det_off, proto_det_off)
-			&& conn->stream->head)
+		/* The buffer that protocol detection read into becomes the first
+		   one of the request, and the room left in it is read into next.  */
+		if (!fh_stream_add_buf_data (conn->stream, (uint8_t *) proto_det_buf,
+									 proto_det_off,
+									 proto_det_buf ? FH_CONN_RECV_BUF_SIZE : 0))
 		{
-			conn->stream->head->buf->attrs.mem.rd_only = true;
+			fh_pr_err ("Failed to allocate memory");
+			fh_pool_destroy (child_pool);
+			fh_server_close_conn (server, conn);
+			return false;
 		}
 	}
 
@@ -88,6 +193,7 @@ event_recv_http1 (struct fh_server *server, struct fh_conn *conn,
 		if (ctx->state == H1_REQ_STATE_ERROR)
 		{
 			fh_pr_err ("HTTP/1.x parsing failed");
+			fh_stats_add (parse_errors, 1);
 			fh_conn_send_err_response (
 				conn, ctx->suggested_code == 0 ? 500 : ctx->suggested_code);
 			fh_server_close_conn (server, conn);
@@ -107,6 +213,10 @@ event_recv_http1 (struct fh_server *server, struct fh_conn *conn,
 		struct fh_request *request = &ctx->request;
 		request->pool = conn->stream->pool;
 		fh_conn_push_request (conn->requests, request);
+		fh_conn_request_begin (conn);
+		fh_stats_mark (&conn->timing, FH_STATS_MARK_HEAD);
+		FH_PROBE5 (request__parsed, conn->id, conn->client_sockfd,
+				   request->method, request->uri, request->uri_len);
 
 		fh_pr_info ("Method: |%s|", fh_method_to_string (ctx->request.method));
 		fh_pr_info ("URI: |%.*s|", (int) ctx->request.uri_len,
@@ -144,6 +254,10 @@ event_recv (struct fh_server *server, const xevent_t *event)
 
 	fh_pr_info ("connection %lu: recv called", conn->id);
 
+	if (conn->ssl && !conn->tls_established
+		&& !event_recv_tls_handshake (server, conn))
+		return true;
+
 	char *proto_det_buf = NULL;
 	size_t proto_det_off = 0;
 
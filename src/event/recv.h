@@ -27,4 +27,10 @@
 
 bool event_recv (struct fh_server *server, const xevent_t *event);
 
+/* Resolves the virtual host of a request on a multiplexed connection and
+   routes it; `data' is the server.  */
+bool event_recv_handle_request (void *data, struct fh_conn *conn,
+								const struct fh_request *request,
+								struct fh_response *response);
+
 #endif /* FH_EVENT_RECV_H */
@@ -22,9 +22,11 @@
 #define FH_LOG_MODULE_NAME "event/send"
 
 #include "core/conn.h"
+#include "http/h2.h"
 #include "http/protocol.h"
 #include "router/router.h"
 #include "log/log.h"
+#include "recv.h"
 #include "send.h"
 
 bool
@@ -40,6 +42,20 @@ event_send (struct fh_server *server, const xevent_t *event)
 		return false;
 	}
 
+	/* The handshake blocked on a full socket buffer; it is driven from
+	   the read side.  */
+	if (conn->ssl && !conn->tls_established)
+		return event_recv (server, event);
+
+	if (conn->protocol == FH_PROTOCOL_H2)
+	{
+		if (conn->io_ctx.h2
+			&& (!fh_h2_send (conn->io_ctx.h2) || fh_h2_done (conn->io_ctx.h2)))
+			fh_server_close_conn (server, conn);
+
+		return true;
+	}
+
 	if (!fh_router_handle (server->router, conn, conn->requests->tail))
 	{
 		fh_pr_err ("Connection #%lu: failed to route", conn->id);
@@ -46,21 +46,23 @@
 #endif /* FHTTPD_ENABLE_SYSTEMD */
 
 static const char *invocation_name = NULL;
+static const char *config_file = NULL;
 
 static struct option const long_options[] = {
+	{ "config", required_argument, 0, 'f' },
 	{ "help", no_argument, 0, 'h' },
 	{ "version", no_argument, 0, 'V' },
 	{ 0, 0, 0, 0 },
 };
 
-static const char *short_options = "hV";
+static const char *short_options = "f:hV";
 
 static int
 start_master (void)
 {
 	struct fh_master *master = fh_master_create ();
 
-	if (!fh_master_read_config (master))
+	if (!fh_master_read_config (master, config_file))
 	{
 		fh_master_destroy (master);
 		return 1;
@@ -103,6 +105,7 @@ usage (void)
 	println ("  %s [options]", invocation_name);
 	println ("");
 	println ("Options:");
+	println ("  -f, --config=FILE  Load the configuration from FILE");
 	println ("  -h, --help         Print this help and exit");
 	println ("  -V, --version      Print version information");
 	println ();
@@ -133,6 +136,10 @@ main (int argc, char **argv)
 
 		switch (opt)
 		{
+			case 'f':
+				config_file = optarg;
+				break;
+
 			case 'h':
 				usage ();
 				exit (EXIT_SUCCESS);
@@ -0,0 +1,808 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define FH_LOG_MODULE_NAME "compress"
+
+#include "compat.h"
+#include "compress.h"
+#include "core/stream.h"
+#include "filter.h"
+#include "hash/strtable.h"
+#include "log/log.h"
+#include "mm/pool.h"
+
+#define GZIP_WINDOW_BITS (MAX_WBITS + 16)
+#define GZIP_MEM_LEVEL 8
+
+struct fh_compress
+{
+	pool_t *pool;
+	z_stream zs;
+	/* Input that hasn't been fed to deflate() yet */
+	struct fh_link *in, *in_tail;
+	struct fh_link *out;
+	uint8_t *out_data[FH_COMPRESS_BATCH_SIZE];
+	bool in_eos : 1;
+	bool finished : 1;
+};
+
+struct fh_compress_cache_entry
+{
+	char *key;
+	struct timespec mtime;
+	off64_t size;
+	uint8_t *data;
+	size_t len;
+	size_t refs;
+	bool detached;
+	struct fh_compress_cache_entry *prev, *next;
+};
+
+struct fh_compress_cache
+{
+	/* (const char *key) => (struct fh_compress_cache_entry *) */
+	struct strtable *table;
+	struct fh_compress_cache_entry *head, *tail;
+	size_t size;
+};
+
+static struct fh_compress_cache cache = { 0 };
+
+static const char *const default_types[] = {
+	"text/html",
+	"text/plain",
+	"text/css",
+	"text/csv",
+	"text/markdown",
+	"text/javascript",
+	"application/javascript",
+	"application/json",
+	"application/xml",
+	"application/wasm",
+	"image/svg+xml",
+	NULL,
+};
+
+static voidpf
+fh_compress_zalloc (voidpf opaque, uInt items, uInt size)
+{
+	return fh_pool_alloc ((pool_t *) opaque, (size_t) items * size);
+}
+
+static void
+fh_compress_zfree (voidpf opaque, voidpf address)
+{
+	(void) opaque;
+	(void) address;
+}
+
+static bool
+fh_compress_type_allowed (const struct fh_config_compression *config,
+						  const char *content_type, size_t content_type_len)
+{
+	if (!content_type)
+		return false;
+
+	const char *semicolon = memchr (content_type, ';', content_type_len);
+	size_t len = semicolon ? (size_t) (semicolon - content_type)
+						   : content_type_len;
+
+	while (len > 0 && content_type[len - 1] == ' ')
+		len--;
+
+	const char *const *types
+		= config->types ? (const char *const *) config->types : default_types;
+
+	for (; *types; types++)
+	{
+		if (strlen (*types) == len && !strncasecmp (*types, content_type, len))
+			return true;
+	}
+
+	return false;
+}
+
+/* Returns false for a "q=0" parameter (with any number of zero decimals),
+   true otherwise.  */
+static bool
+fh_compress_parse_params (const char **p_ptr, const char *end)
+{
+	const char *p = *p_ptr;
+	bool allowed = true;
+
+	while (p < end && *p != ',')
+	{
+		if (*p != ';')
+		{
+			p++;
+			continue;
+		}
+
+		p++;
+
+		while (p < end && (*p == ' ' || *p == '\t'))
+			p++;
+
+		if (end - p < 2 || (*p != 'q' && *p != 'Q') || p[1] != '=')
+			continue;
+
+		p += 2;
+		allowed = false;
+
+		while (p < end && *p != ',' && *p != ';')
+		{
+			if (*p >= '1' && *p <= '9')
+				allowed = true;
+
+			p++;
+		}
+	}
+
+	*p_ptr = p;
+	return allowed;
+}
+
+enum fh_content_encoding
+fh_compress_negotiate (const struct fh_config_compression *config,
+					   const struct fh_request *request)
+{
+	if (!config->enabled)
+		return FH_CONTENT_ENCODING_IDENTITY;
+
+	const struct fh_header *header
+		= fh_header_get (&request->headers, "Accept-Encoding", 15);
+
+	if (!header)
+		return FH_CONTENT_ENCODING_IDENTITY;
+
+	const char *p = header->value, *end = header->value + header->value_len;
+	int gzip_allowed = -1, wildcard_allowed = -1;
+
+	while (p < end)
+	{
+		while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+			p++;
+
+		const char *token = p;
+
+		while (p < end && *p != ',' && *p != ';' && *p != ' ' && *p != '\t')
+			p++;
+
+		const size_t token_len = (size_t) (p - token);
+		const bool allowed = fh_compress_parse_params (&p, end);
+
+		if ((token_len == 4 && !strncasecmp (token, "gzip", 4))
+			|| (token_len == 6 && !strncasecmp (token, "x-gzip", 6)))
+			gzip_allowed = allowed;
+		else if (token_len == 1 && *token == '*')
+			wildcard_allowed = allowed;
+	}
+
+	if (gzip_allowed == 1 || (gzip_allowed == -1 && wildcard_allowed == 1))
+		return FH_CONTENT_ENCODING_GZIP;
+
+	return FH_CONTENT_ENCODING_IDENTITY;
+}
+
+static bool
+fh_compress_add_headers (struct fh_response *response)
+{
+	if (!fh_response_get_headers (response))
+		return false;
+
+	size_t encoding_len = 0;
+	const char *encoding = fh_content_encoding_to_string (
+		response->content_encoding, &encoding_len);
+
+	return fh_header_add (response->pool, response->headers,
+						  "Content-Encoding", 16, encoding, encoding_len)
+		   && fh_header_add (response->pool, response->headers, "Vary", 4,
+							 "Accept-Encoding", 15);
+}
+
+static bool
+fh_compress_applicable (const struct fh_config_compression *config,
+						const struct fh_response *response)
+{
+	/* The handler has already encoded the body (e.g. from the cache).  */
+	if (response->headers
+		&& fh_header_get (response->headers, "Content-Encoding", 16))
+		return false;
+
+	if (response->status != FH_STATUS_OK || response->no_send_body
+		|| response->use_default_error_response
+		|| (response->protocol != FH_PROTOCOL_HTTP_1_1
+			&& response->protocol != FH_PROTOCOL_H2)
+		|| (response->encoding == FH_ENCODING_PLAIN
+			&& response->content_length < config->min_size)
+		|| !fh_compress_type_allowed (config, response->content_type,
+									  response->content_type_len))
+		return false;
+
+	/* File-backed bodies are compressed through the cache instead.  */
+	for (struct fh_link *link = response->body_start; link; link = link->next)
+	{
+		if (link->buf->type != FH_BUF_DATA)
+			return false;
+
+		if (link->is_eos)
+			break;
+	}
+
+	return true;
+}
+
+static void
+fh_compress_queue_input (struct fh_compress *compress, struct fh_link *in)
+{
+	struct fh_link *last = in;
+
+	while (!last->is_eos && last->next)
+		last = last->next;
+
+	if (compress->in_tail)
+		compress->in_tail->next = in;
+	else
+		compress->in = in;
+
+	compress->in_tail = last;
+	compress->in_eos = last->is_eos;
+}
+
+static inline void
+fh_compress_next_input (struct fh_compress *compress)
+{
+	struct fh_link *link = compress->in;
+
+	if (link->buf->type != FH_BUF_DATA)
+	{
+		/* Handlers that stream files should have used the cache; the file
+		   links are dropped rather than read here.  */
+		fh_pr_warn ("Skipping non-memory link in compressed body");
+
+		if (link->buf->type == FH_BUF_FILE && link->buf->attrs.file.file_fd >= 0)
+		{
+			close (link->buf->attrs.file.file_fd);
+			link->buf->attrs.file.file_fd = -1;
+		}
+	}
+	else
+	{
+		compress->zs.next_in = link->buf->attrs.mem.data;
+		compress->zs.avail_in = (uInt) link->buf->attrs.mem.len;
+	}
+
+	compress->in = link == compress->in_tail ? NULL : link->next;
+
+	if (!compress->in)
+		compress->in_tail = NULL;
+}
+
+static int
+fh_compress_filter (struct fh_filter *filter, struct fh_link *in,
+					struct fh_link **out_ptr)
+{
+	struct fh_compress *compress = filter->data;
+	z_stream *zs = &compress->zs;
+	struct fh_link *head = NULL, *tail = NULL;
+	bool starved = false;
+
+	if (in)
+		fh_compress_queue_input (compress, in);
+
+	for (size_t i = 0; i < FH_COMPRESS_BATCH_SIZE && !compress->finished
+					   && !starved;
+		 i++)
+	{
+		/* Partial writes advance the buffer's data pointer, so always start
+		   over from the original allocation.  */
+		uint8_t *data = compress->out_data[i];
+
+		zs->next_out = data;
+		zs->avail_out = FH_COMPRESS_CHUNK_SIZE;
+
+		while (zs->avail_out > 0)
+		{
+			while (zs->avail_in == 0 && compress->in)
+				fh_compress_next_input (compress);
+
+			if (zs->avail_in == 0 && !compress->in_eos)
+			{
+				starved = true;
+				break;
+			}
+
+			const int flush = zs->avail_in == 0 ? Z_FINISH : Z_NO_FLUSH;
+			const int rc = deflate (zs, flush);
+
+			if (rc == Z_STREAM_END)
+			{
+				compress->finished = true;
+				deflateEnd (zs);
+				break;
+			}
+
+			if (rc == Z_BUF_ERROR)
+				break;
+
+			if (rc != Z_OK)
+			{
+				fh_pr_err ("deflate() failed: %s",
+						   zs->msg ? zs->msg : "unknown error");
+				deflateEnd (zs);
+				return FH_FILTER_ERROR;
+			}
+		}
+
+		const size_t len = FH_COMPRESS_CHUNK_SIZE - zs->avail_out;
+
+		if (!len)
+			continue;
+
+		struct fh_link *link = &compress->out[i];
+
+		link->buf->attrs.mem.data = data;
+		link->buf->attrs.mem.len = len;
+		link->is_eos = false;
+		link->next = NULL;
+
+		if (tail)
+			tail->next = link;
+		else
+			head = link;
+
+		tail = link;
+	}
+
+	if (compress->finished)
+	{
+		if (!tail)
+		{
+			head = tail = fh_link_new_data (compress->pool, NULL, 0, true);
+
+			if (!tail)
+				return FH_FILTER_ERROR;
+		}
+
+		tail->is_eos = true;
+	}
+
+	*out_ptr = head;
+	return compress->finished || starved ? FH_FILTER_OK : FH_FILTER_AGAIN;
+}
+
+bool
+fh_compress_setup (const struct fh_config_compression *config,
+				   struct fh_response *response)
+{
+	if (response->content_encoding == FH_CONTENT_ENCODING_IDENTITY)
+		return true;
+
+	if (!fh_compress_applicable (config, response))
+	{
+		response->content_encoding = FH_CONTENT_ENCODING_IDENTITY;
+		return true;
+	}
+
+	pool_t *pool = response->pool;
+	struct fh_compress *compress = fh_pool_zalloc (pool, sizeof (*compress));
+
+	if (!compress)
+		return false;
+
+	compress->out = fh_pool_alloc (pool, FH_COMPRESS_BATCH_SIZE
+											 * (sizeof (struct fh_link)
+												+ sizeof (struct fh_buf)));
+
+	if (!compress->out)
+		return false;
+
+	struct fh_buf *bufs = (struct fh_buf *) (compress->out
+											 + FH_COMPRESS_BATCH_SIZE);
+
+	for (size_t i = 0; i < FH_COMPRESS_BATCH_SIZE; i++)
+	{
+		uint8_t *data = fh_pool_alloc (pool, FH_COMPRESS_CHUNK_SIZE);
+
+		if (!data)
+			return false;
+
+		bufs[i].type = FH_BUF_DATA;
+		bufs[i].freeable = false;
+		bufs[i].attrs.mem.rd_only = false;
+		bufs[i].attrs.mem.data = data;
+		bufs[i].attrs.mem.cap = FH_COMPRESS_CHUNK_SIZE;
+		compress->out_data[i] = data;
+		bufs[i].attrs.mem.len = 0;
+		compress->out[i].buf = &bufs[i];
+		compress->out[i].is_start = false;
+	}
+
+	compress->pool = pool;
+	compress->zs.zalloc = &fh_compress_zalloc;
+	compress->zs.zfree = &fh_compress_zfree;
+	compress->zs.opaque = pool;
+
+	if (deflateInit2 (&compress->zs, config->level, Z_DEFLATED,
+					  GZIP_WINDOW_BITS, GZIP_MEM_LEVEL, Z_DEFAULT_STRATEGY)
+		!= Z_OK)
+	{
+		fh_pr_err ("deflateInit2() failed: %s",
+				   compress->zs.msg ? compress->zs.msg : "unknown error");
+		return false;
+	}
+
+	if (!fh_compress_add_headers (response))
+		return false;
+
+	response->encoding = FH_ENCODING_CHUNKED;
+	response->content_length = 0;
+
+	return fh_filter_add (response, "compress", FH_FILTER_ORDER_COMPRESS,
+						  &fh_compress_filter, compress)
+		   != NULL;
+}
+
+static void
+fh_compress_cache_entry_free (struct fh_compress_cache_entry *entry)
+{
+	free (entry->key);
+	free (entry->data);
+	free (entry);
+}
+
+static void
+fh_compress_cache_unlink (struct fh_compress_cache_entry *entry)
+{
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		cache.head = entry->next;
+
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		cache.tail = entry->prev;
+
+	entry->prev = entry->next = NULL;
+}
+
+static void
+fh_compress_cache_push_front (struct fh_compress_cache_entry *entry)
+{
+	entry->prev = NULL;
+	entry->next = cache.head;
+
+	if (cache.head)
+		cache.head->prev = entry;
+	else
+		cache.tail = entry;
+
+	cache.head = entry;
+}
+
+/* Removes an entry from the index.  Entries that are still being sent are
+   only freed once the last response referencing them is done.  */
+static void
+fh_compress_cache_detach (struct fh_compress_cache_entry *entry)
+{
+	strtable_remove (cache.table, entry->key);
+	fh_compress_cache_unlink (entry);
+	cache.size -= entry->len;
+	entry->detached = true;
+
+	if (!entry->refs)
+		fh_compress_cache_entry_free (entry);
+}
+
+static void
+fh_compress_cache_release (void *ptr)
+{
+	struct fh_compress_cache_entry *entry
+		= *(struct fh_compress_cache_entry **) ptr;
+
+	if (!entry)
+		return;
+
+	entry->refs--;
+
+	if (entry->detached && !entry->refs)
+		fh_compress_cache_entry_free (entry);
+}
+
+static bool
+fh_compress_cache_make_room (size_t len, size_t max)
+{
+	struct fh_compress_cache_entry *entry = cache.tail;
+
+	while (entry && cache.size + len > max)
+	{
+		struct fh_compress_cache_entry *prev = entry->prev;
+
+		if (!entry->refs)
+			fh_compress_cache_detach (entry);
+
+		entry = prev;
+	}
+
+	return cache.size + len <= max;
+}
+
+static uint8_t *
+fh_compress_file_contents (const char *filename, size_t size, int level,
+						   size_t *out_len)
+{
+	fd_t fd = open (filename, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return NULL;
+
+	uint8_t *in = malloc (size ? size : 1);
+
+	if (!in)
+	{
+		close (fd);
+		return NULL;
+	}
+
+	size_t total = 0;
+
+	while (total < size)
+	{
+		ssize_t nread = read (fd, in + total, size - total);
+
+		if (nread < 0 && errno == EINTR)
+			continue;
+
+		if (nread <= 0)
+			break;
+
+		total += (size_t) nread;
+	}
+
+	close (fd);
+
+	if (total != size)
+	{
+		free (in);
+		return NULL;
+	}
+
+	z_stream zs = { 0 };
+
+	if (deflateInit2 (&zs, level, Z_DEFLATED, GZIP_WINDOW_BITS, GZIP_MEM_LEVEL,
+					  Z_DEFAULT_STRATEGY)
+		!= Z_OK)
+	{
+		free (in);
+		return NULL;
+	}
+
+	const size_t bound = deflateBound (&zs, (uLong) size);
+	uint8_t *out = malloc (bound);
+
+	if (!out)
+	{
+		deflateEnd (&zs);
+		free (in);
+		return NULL;
+	}
+
+	zs.next_in = in;
+	zs.avail_in = (uInt) size;
+	zs.next_out = out;
+	zs.avail_out = (uInt) bound;
+
+	const int rc = deflate (&zs, Z_FINISH);
+
+	*out_len = bound - zs.avail_out;
+	deflateEnd (&zs);
+	free (in);
+
+	if (rc != Z_STREAM_END)
+	{
+		free (out);
+		return NULL;
+	}
+
+	return out;
+}
+
+static struct fh_compress_cache_entry *
+fh_compress_cache_lookup (const struct fh_config_compression *config,
+						  const char *key, const char *filename,
+						  const struct stat64 *st)
+{
+	struct fh_compress_cache_entry *entry = strtable_get (cache.table, key);
+
+	if (entry)
+	{
+		if (entry->size == st->st_size
+			&& entry->mtime.tv_sec == st->st_mtim.tv_sec
+			&& entry->mtime.tv_nsec == st->st_mtim.tv_nsec)
+		{
+			fh_compress_cache_unlink (entry);
+			fh_compress_cache_push_front (entry);
+			return entry;
+		}
+
+		fh_pr_debug ("Cached copy of '%s' is stale", filename);
+		fh_compress_cache_detach (entry);
+	}
+
+	entry = calloc (1, sizeof (*entry));
+
+	if (!entry)
+		return NULL;
+
+	entry->data = fh_compress_file_contents (filename, (size_t) st->st_size,
+											 config->level, &entry->len);
+
+	if (!entry->data)
+	{
+		free (entry);
+		return NULL;
+	}
+
+	entry->key = strdup (key);
+	entry->size = st->st_size;
+	entry->mtime = st->st_mtim;
+
+	if (!entry->key)
+	{
+		fh_compress_cache_entry_free (entry);
+		return NULL;
+	}
+
+	if (!fh_compress_cache_make_room (entry->len, config->cache_size)
+		|| !strtable_set (cache.table, key, entry))
+	{
+		/* Serve it once, then let the release callback free it.  */
+		entry->detached = true;
+		return entry;
+	}
+
+	cache.size += entry->len;
+	fh_compress_cache_push_front (entry);
+	fh_pr_debug ("Cached %zu compressed bytes of '%s'", entry->len, filename);
+	return entry;
+}
+
+bool
+fh_compress_cache_file (const struct fh_config_compression *config,
+						struct fh_response *response, const char *filename,
+						const struct stat64 *st)
+{
+	if (response->content_encoding == FH_CONTENT_ENCODING_IDENTITY
+		|| !config->cache_size || response->no_send_body
+		|| (size_t) st->st_size > config->cache_max_file_size
+		|| (size_t) st->st_size < config->min_size
+		|| !fh_compress_type_allowed (config, response->content_type,
+									  response->content_type_len))
+	{
+		response->content_encoding = FH_CONTENT_ENCODING_IDENTITY;
+		return false;
+	}
+
+	if (!cache.table)
+	{
+		cache.table = strtable_create (0);
+
+		if (!cache.table)
+			return false;
+	}
+
+	char key[PATH_MAX + 16];
+	size_t encoding_len = 0;
+	const char *encoding = fh_content_encoding_to_string (
+		response->content_encoding, &encoding_len);
+
+	if (snprintf (key, sizeof key, "%s:%s", encoding, filename)
+		>= (int) sizeof key)
+		return false;
+
+	struct fh_compress_cache_entry *entry
+		= fh_compress_cache_lookup (config, key, filename, st);
+
+	if (!entry)
+	{
+		response->content_encoding = FH_CONTENT_ENCODING_IDENTITY;
+		return false;
+	}
+
+	if (entry->len >= (size_t) st->st_size)
+	{
+		if (entry->detached && !entry->refs)
+			fh_compress_cache_entry_free (entry);
+
+		response->content_encoding = FH_CONTENT_ENCODING_IDENTITY;
+		return false;
+	}
+
+	struct fh_compress_cache_entry **ref = fh_pool_large_alloc (
+		response->pool, sizeof (*ref), &fh_compress_cache_release);
+	struct fh_link *link = fh_pool_alloc (
+		response->pool, sizeof (struct fh_link) + sizeof (struct fh_buf));
+
+	if (!ref || !link)
+	{
+		if (ref)
+			*ref = NULL;
+
+		if (entry->detached && !entry->refs)
+			fh_compress_cache_entry_free (entry);
+
+		return false;
+	}
+
+	*ref = entry;
+	entry->refs++;
+
+	link->buf = (struct fh_buf *) (link + 1);
+	link->buf->type = FH_BUF_DATA;
+	link->buf->freeable = false;
+	link->buf->attrs.mem.rd_only = true;
+	link->buf->attrs.mem.data = entry->data;
+	link->buf->attrs.mem.len = link->buf->attrs.mem.cap = entry->len;
+	link->next = NULL;
+	link->is_eos = true;
+	link->is_start = true;
+
+	if (!fh_compress_add_headers (response))
+		return false;
+
+	response->body_start = link;
+	response->content_length = entry->len;
+	return true;
+}
+
+void
+fh_compress_cache_destroy (void)
+{
+	struct fh_compress_cache_entry *entry = cache.head;
+
+	while (entry)
+	{
+		struct fh_compress_cache_entry *next = entry->next;
+
+		if (entry->refs)
+			entry->detached = true;
+		else
+			fh_compress_cache_entry_free (entry);
+
+		entry = next;
+	}
+
+	if (cache.table)
+		strtable_destroy (cache.table);
+
+	memset (&cache, 0, sizeof cache);
+}
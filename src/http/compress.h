@@ -0,0 +1,90 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FH_HTTP_COMPRESS_H
+#define FH_HTTP_COMPRESS_H
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <stdbool.h>
+#include <sys/stat.h>
+
+#include "compat.h"
+#include "core/conf.h"
+#include "protocol.h"
+
+/* Size of a single output buffer, and the number of buffers filled per
+   filter call before the output is handed over to the socket.  */
+#define FH_COMPRESS_CHUNK_SIZE 8192
+#define FH_COMPRESS_BATCH_SIZE 4
+
+#ifdef FHTTPD_ENABLE_COMPRESSION
+
+enum fh_content_encoding
+fh_compress_negotiate (const struct fh_config_compression *config,
+					   const struct fh_request *request);
+bool fh_compress_setup (const struct fh_config_compression *config,
+						struct fh_response *response);
+bool fh_compress_cache_file (const struct fh_config_compression *config,
+							 struct fh_response *response,
+							 const char *filename, const struct stat64 *st);
+void fh_compress_cache_destroy (void);
+
+#else /* not FHTTPD_ENABLE_COMPRESSION */
+
+__attribute_maybe_unused__ static inline enum fh_content_encoding
+fh_compress_negotiate (const struct fh_config_compression *config,
+					   const struct fh_request *request)
+{
+	(void) config;
+	(void) request;
+	return FH_CONTENT_ENCODING_IDENTITY;
+}
+
+__attribute_maybe_unused__ static inline bool
+fh_compress_setup (const struct fh_config_compression *config,
+				   struct fh_response *response)
+{
+	(void) config;
+	(void) response;
+	return true;
+}
+
+__attribute_maybe_unused__ static inline bool
+fh_compress_cache_file (const struct fh_config_compression *config,
+						struct fh_response *response, const char *filename,
+						const struct stat64 *st)
+{
+	(void) config;
+	(void) response;
+	(void) filename;
+	(void) st;
+	return false;
+}
+
+__attribute_maybe_unused__ static inline void
+fh_compress_cache_destroy (void)
+{
+}
+
+#endif /* FHTTPD_ENABLE_COMPRESSION */
+
+#endif /* FH_HTTP_COMPRESS_H */
@@ -0,0 +1,188 @@
+/*
+ * This file is part of OSN freehttpd.
+ * 
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+
+#include "fastcgi.h"
+
+void
+fh_fcgi_encode_header (uint8_t *out, uint8_t type, uint16_t request_id,
+					   uint16_t content_len, uint8_t padding_len)
+{
+	out[0] = FH_FCGI_VERSION_1;
+	out[1] = type;
+	out[2] = (uint8_t) (request_id >> 8);
+	out[3] = (uint8_t) request_id;
+	out[4] = (uint8_t) (content_len >> 8);
+	out[5] = (uint8_t) content_len;
+	out[6] = padding_len;
+	out[7] = 0;
+}
+
+bool
+fh_fcgi_decode_header (const uint8_t *in, struct fh_fcgi_header *header)
+{
+	header->version = in[0];
+	header->type = in[1];
+	header->request_id = (uint16_t) ((in[2] << 8) | in[3]);
+	header->content_len = (uint16_t) ((in[4] << 8) | in[5]);
+	header->padding_len = in[6];
+
+	return header->version == FH_FCGI_VERSION_1;
+}
+
+void
+fh_fcgi_encode_begin_request (uint8_t *out, uint16_t request_id,
+							  uint16_t role, uint8_t flags)
+{
+	fh_fcgi_encode_header (out, FH_FCGI_BEGIN_REQUEST, request_id, 8, 0);
+	out += FH_FCGI_HEADER_LEN;
+	out[0] = (uint8_t) (role >> 8);
+	out[1] = (uint8_t) role;
+	out[2] = flags;
+	memset (out + 3, 0, 5);
+}
+
+void
+fh_fcgi_decode_end_request (const uint8_t *in, struct fh_fcgi_end_request *end)
+{
+	end->app_status = ((uint32_t) in[0] << 24) | ((uint32_t) in[1] << 16)
+					  | ((uint32_t) in[2] << 8) | in[3];
+	end->protocol_status = in[4];
+}
+
+static size_t
+fh_fcgi_encode_length (uint8_t *out, size_t len)
+{
+	if (len < 128)
+	{
+		out[0] = (uint8_t) len;
+		return 1;
+	}
+
+	out[0] = (uint8_t) ((len >> 24) | 0x80);
+	out[1] = (uint8_t) (len >> 16);
+	out[2] = (uint8_t) (len >> 8);
+	out[3] = (uint8_t) len;
+	return 4;
+}
+
+size_t
+fh_fcgi_encode_pair_header (uint8_t *out, size_t name_len, size_t value_len)
+{
+	size_t len = fh_fcgi_encode_length (out, name_len);
+
+	return len + fh_fcgi_encode_length (out + len, value_len);
+}
+
+void
+fh_fcgi_reader_init (struct fh_fcgi_reader *reader, uint16_t request_id)
+{
+	memset (reader, 0, sizeof (*reader));
+	reader->request_id = request_id;
+}
+
+int
+fh_fcgi_read (struct fh_fcgi_reader *reader, const uint8_t **data,
+			  size_t *len, size_t stdout_max, struct fh_fcgi_chunk *chunk)
+{
+	for (;;)
+	{
+		if (reader->header_len == FH_FCGI_HEADER_LEN && !reader->remaining
+			&& !reader->padding)
+		{
+			reader->header_len = 0;
+
+			if (reader->type == FH_FCGI_END_REQUEST)
+			{
+				chunk->type = FH_FCGI_END_REQUEST;
+				chunk->data = NULL;
+				chunk->len = 0;
+				fh_fcgi_decode_end_request (reader->header, &chunk->end);
+				return 1;
+			}
+		}
+
+		if (!*len)
+			return 0;
+
+		size_t take = *len;
+
+		if (reader->header_len < FH_FCGI_HEADER_LEN)
+		{
+			struct fh_fcgi_header header;
+			const size_t missing = FH_FCGI_HEADER_LEN - reader->header_len;
+
+			if (take > missing)
+				take = missing;
+
+			memcpy (reader->header + reader->header_len, *data, take);
+			reader->header_len += take;
+			*data += take;
+			*len -= take;
+
+			if (reader->header_len < FH_FCGI_HEADER_LEN)
+				return 0;
+
+			if (!fh_fcgi_decode_header (reader->header, &header)
+				|| header.request_id != reader->request_id
+				|| (header.type == FH_FCGI_END_REQUEST
+					&& header.content_len != 8))
+				return -1;
+
+			reader->type = header.type;
+			reader->remaining = header.content_len;
+			reader->padding = header.padding_len;
+			continue;
+		}
+
+		if (!reader->remaining)
+		{
+			if (take > reader->padding)
+				take = reader->padding;
+
+			reader->padding -= take;
+			*data += take;
+			*len -= take;
+			continue;
+		}
+
+		if (take > reader->remaining)
+			take = reader->remaining;
+
+		if (reader->type == FH_FCGI_STDOUT && take > stdout_max)
+			take = stdout_max;
+
+		/* The header is done with, so the body goes there.  */
+		if (reader->type == FH_FCGI_END_REQUEST)
+			memcpy (reader->header + FH_FCGI_HEADER_LEN - reader->remaining,
+					*data, take);
+
+		chunk->type = reader->type;
+		chunk->data = *data;
+		chunk->len = take;
+		reader->remaining -= take;
+		*data += take;
+		*len -= take;
+
+		if (reader->type == FH_FCGI_STDOUT || reader->type == FH_FCGI_STDERR)
+			return 1;
+	}
+}
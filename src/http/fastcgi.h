@@ -0,0 +1,124 @@
+/*
+ * This file is part of OSN freehttpd.
+ * 
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef FH_HTTP_FASTCGI_H
+#define FH_HTTP_FASTCGI_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define FH_FCGI_VERSION_1 1
+#define FH_FCGI_HEADER_LEN 8
+#define FH_FCGI_MAX_CONTENT_LEN 65535
+/* A name-value pair whose lengths take 4 bytes each */
+#define FH_FCGI_MAX_PAIR_HEADER_LEN 8
+
+#define FH_FCGI_RESPONDER 1
+#define FH_FCGI_KEEP_CONN 1
+
+enum fh_fcgi_type
+{
+	FH_FCGI_BEGIN_REQUEST = 1,
+	FH_FCGI_ABORT_REQUEST = 2,
+	FH_FCGI_END_REQUEST = 3,
+	FH_FCGI_PARAMS = 4,
+	FH_FCGI_STDIN = 5,
+	FH_FCGI_STDOUT = 6,
+	FH_FCGI_STDERR = 7,
+	FH_FCGI_DATA = 8,
+	FH_FCGI_GET_VALUES = 9,
+	FH_FCGI_GET_VALUES_RESULT = 10,
+	FH_FCGI_UNKNOWN_TYPE = 11
+};
+
+enum fh_fcgi_protocol_status
+{
+	FH_FCGI_REQUEST_COMPLETE = 0,
+	FH_FCGI_CANT_MPX_CONN = 1,
+	FH_FCGI_OVERLOADED = 2,
+	FH_FCGI_UNKNOWN_ROLE = 3
+};
+
+struct fh_fcgi_header
+{
+	uint8_t version;
+	uint8_t type;
+	uint16_t request_id;
+	uint16_t content_len;
+	uint8_t padding_len;
+};
+
+struct fh_fcgi_end_request
+{
+	uint32_t app_status;
+	uint8_t protocol_status;
+};
+
+void fh_fcgi_encode_header (uint8_t *out, uint8_t type, uint16_t request_id,
+							uint16_t content_len, uint8_t padding_len);
+/* Returns false if the record is not of version 1.  */
+bool fh_fcgi_decode_header (const uint8_t *in, struct fh_fcgi_header *header);
+
+/* Writes a whole FCGI_BEGIN_REQUEST record.  */
+void fh_fcgi_encode_begin_request (uint8_t *out, uint16_t request_id,
+								   uint16_t role, uint8_t flags);
+void fh_fcgi_decode_end_request (const uint8_t *in,
+								 struct fh_fcgi_end_request *end);
+
+/* Writes the lengths that precede a name-value pair, and returns how many
+   bytes they took.  The name and the value follow as they are.  */
+size_t fh_fcgi_encode_pair_header (uint8_t *out, size_t name_len,
+								   size_t value_len);
+
+/* Takes the records of one request apart as they arrive, in pieces of any
+   size */
+struct fh_fcgi_reader
+{
+	uint16_t request_id;
+	/* The header of the current record, and then the body of an
+	   FCGI_END_REQUEST record, as far as received */
+	uint8_t header[FH_FCGI_HEADER_LEN];
+	uint8_t header_len;
+	uint8_t type;
+	uint8_t padding;
+	uint16_t remaining;
+};
+
+/* What fh_fcgi_read() found next */
+struct fh_fcgi_chunk
+{
+	uint8_t type;
+	/* A piece of the content of an FCGI_STDOUT or FCGI_STDERR record */
+	const uint8_t *data;
+	size_t len;
+	/* For FCGI_END_REQUEST */
+	struct fh_fcgi_end_request end;
+};
+
+void fh_fcgi_reader_init (struct fh_fcgi_reader *reader, uint16_t request_id);
+/* Consumes `*data' until a piece of FCGI_STDOUT or FCGI_STDERR content, at
+   most `stdout_max' bytes of the former, or a whole FCGI_END_REQUEST record
+   is found, and returns 1 with `chunk' set.  Returns 0 once `*len' is used
+   up and -1 on malformed records or those of other requests.  */
+int fh_fcgi_read (struct fh_fcgi_reader *reader, const uint8_t **data,
+				  size_t *len, size_t stdout_max, struct fh_fcgi_chunk *chunk);
+
+#endif /* FH_HTTP_FASTCGI_H */
@@ -0,0 +1,168 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FH_LOG_MODULE_NAME "filter"
+
+#include "compress.h"
+#include "core/conf.h"
+#include "filter.h"
+#include "log/log.h"
+#include "mm/pool.h"
+#include "range.h"
+
+#define FH_FILTER_MAX_REGISTERED 16
+
+struct fh_filter_registration
+{
+	const char *name;
+	fh_filter_attach_fn_t attach;
+};
+
+static struct fh_filter_registration registered[FH_FILTER_MAX_REGISTERED];
+static size_t registered_count = 0;
+
+bool
+fh_filter_register (const char *name, fh_filter_attach_fn_t attach)
+{
+	if (registered_count >= FH_FILTER_MAX_REGISTERED)
+	{
+		fh_pr_err ("Too many filters registered, ignoring '%s'", name);
+		return false;
+	}
+
+	registered[registered_count].name = name;
+	registered[registered_count].attach = attach;
+	registered_count++;
+
+	fh_pr_debug ("Registered filter '%s'", name);
+	return true;
+}
+
+void
+fh_filter_unregister (fh_filter_attach_fn_t attach)
+{
+	for (size_t i = 0; i < registered_count; i++)
+	{
+		if (registered[i].attach != attach)
+			continue;
+
+		memmove (&registered[i], &registered[i + 1],
+				 (registered_count - i - 1) * sizeof (registered[0]));
+		registered_count--;
+		return;
+	}
+}
+
+struct fh_filter *
+fh_filter_add (struct fh_response *response, const char *name,
+			   unsigned int order, fh_filter_fn_t fn, void *data)
+{
+	struct fh_filter *filter = fh_pool_alloc (response->pool, sizeof (*filter));
+
+	if (!filter)
+		return NULL;
+
+	filter->name = name;
+	filter->order = order;
+	filter->fn = fn;
+	filter->data = data;
+	filter->response = response;
+	filter->pending = false;
+
+	struct fh_filter **pos = &response->filters;
+
+	while (*pos && (*pos)->order <= order)
+		pos = &(*pos)->next;
+
+	filter->next = *pos;
+	*pos = filter;
+
+	fh_pr_debug ("Added filter '%s'", name);
+	return filter;
+}
+
+int
+fh_filter_run (struct fh_response *response, struct fh_link *in,
+			   struct fh_link **out_ptr)
+{
+	struct fh_link *chain = in;
+	bool pending = false;
+
+	for (struct fh_filter *filter = response->filters; filter;
+		 filter = filter->next)
+	{
+		if (!chain && !filter->pending)
+			continue;
+
+		struct fh_link *out = NULL;
+		int rc = filter->fn (filter, chain, &out);
+
+		if (rc == FH_FILTER_ERROR)
+		{
+			fh_pr_err ("Filter '%s' failed", filter->name);
+			return FH_FILTER_ERROR;
+		}
+
+		filter->pending = rc == FH_FILTER_AGAIN;
+		pending |= filter->pending;
+		chain = out;
+	}
+
+	*out_ptr = chain;
+	return pending ? FH_FILTER_AGAIN : FH_FILTER_OK;
+}
+
+bool
+fh_filter_pending (const struct fh_response *response)
+{
+	for (const struct fh_filter *filter = response->filters; filter;
+		 filter = filter->next)
+	{
+		if (filter->pending)
+			return true;
+	}
+
+	return false;
+}
+
+bool
+fh_filter_setup (const struct fh_config *config,
+				 const struct fh_request *request,
+				 struct fh_response *response)
+{
+	for (size_t i = 0; i < registered_count; i++)
+	{
+		if (!registered[i].attach (request, response))
+		{
+			fh_pr_err ("Failed to attach filter '%s'", registered[i].name);
+			return false;
+		}
+	}
+
+	if (!fh_compress_setup (config->compression, response))
+		return false;
+
+	return fh_range_setup (request, response);
+}
@@ -0,0 +1,92 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FH_HTTP_FILTER_H
+#define FH_HTTP_FILTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "core/stream.h"
+#include "protocol.h"
+
+/* Filters are kept sorted by their order; lower values run first, i.e.
+   closer to the handler.  */
+enum fh_filter_order
+{
+	FH_FILTER_ORDER_MODULE = 100,
+	FH_FILTER_ORDER_COMPRESS = 200,
+	FH_FILTER_ORDER_RANGE = 300,
+	FH_FILTER_ORDER_CHUNKED = 400,
+};
+
+enum fh_filter_status
+{
+	/* All input was consumed.  */
+	FH_FILTER_OK,
+	/* Some input was retained; the filter must be called again (with no new
+	   input) once the output produced so far has been written.  */
+	FH_FILTER_AGAIN,
+	FH_FILTER_ERROR
+};
+
+struct fh_filter;
+
+/* A filter takes a chain of links (possibly NULL) and returns a new chain
+   in *out_ptr.  The chain ends either at a NULL next pointer or at a link
+   with is_eos set, and a filter marks the last link of its own output with
+   is_eos once it will never produce anything again.  Filters are only run
+   again after everything they returned has been sent, so output buffers
+   may be reused across calls.  File links should be passed through as they
+   are, so that they can still be sent with sendfile().  */
+typedef int (*fh_filter_fn_t) (struct fh_filter *filter, struct fh_link *in,
+							   struct fh_link **out_ptr);
+
+/* Called for every response after the handler has run; may add filters to
+   the response with fh_filter_add().  */
+typedef bool (*fh_filter_attach_fn_t) (const struct fh_request *request,
+									   struct fh_response *response);
+
+struct fh_filter
+{
+	const char *name;
+	unsigned int order;
+	fh_filter_fn_t fn;
+	void *data;
+	struct fh_response *response;
+	bool pending : 1;
+	struct fh_filter *next;
+};
+
+struct fh_config;
+
+struct fh_filter *fh_filter_add (struct fh_response *response,
+								 const char *name, unsigned int order,
+								 fh_filter_fn_t fn, void *data);
+int fh_filter_run (struct fh_response *response, struct fh_link *in,
+				   struct fh_link **out_ptr);
+bool fh_filter_pending (const struct fh_response *response);
+bool fh_filter_setup (const struct fh_config *config,
+					  const struct fh_request *request,
+					  struct fh_response *response);
+
+bool fh_filter_register (const char *name, fh_filter_attach_fn_t attach);
+void fh_filter_unregister (fh_filter_attach_fn_t attach);
+
+#endif /* FH_HTTP_FILTER_H */
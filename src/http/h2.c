@@ -1,20 +1,2003 @@
 /*
  * This file is part of OSN freehttpd.
- * 
+ *
  * Copyright (C) 2025  OSN Developers.
  *
  * OSN freehttpd is free software: you can redistribute it and/or modify
  * it under the terms of the GNU Affero General Public License as published by
  * the Free Software Foundation, either version 3 of the License, or
  * (at your option) any later version.
- * 
+ *
  * OSN freehttpd is distributed in the hope that it will be useful,
  * but WITHOUT ANY WARRANTY; without even the implied warranty of
  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
  * GNU Affero General Public License for more details.
- * 
+ *
  * You should have received a copy of the GNU Affero General Public License
  * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define FH_LOG_MODULE_NAME "http/h2"
+
+#include "compat.h"
+#include "core/accesslog.h"
+#include "core/conn.h"
+#include "core/stats.h"
+#include "probes.h"
+#include "filter.h"
 #include "h2.h"
+#include "log/log.h"
+#include "utils/strutils.h"
+
+#define H2_STREAM_ID_MASK 0x7FFFFFFFU
+
+struct h2_frame
+{
+	uint32_t length;
+	uint8_t type;
+	uint8_t flags;
+	uint32_t stream_id;
+	const uint8_t *payload;
+};
+
+/* State shared with the HPACK callback while a header block of a stream
+   is being decoded.  */
+struct h2_header_ctx
+{
+	struct fh_h2_ctx *ctx;
+	struct h2_stream *stream;
+	bool trailers;
+	bool have_scheme;
+	const char *method;
+	size_t method_len;
+};
+
+static const struct
+{
+	const char *name;
+	size_t len;
+	enum fh_method method;
+} h2_methods[] = {
+	{ "GET", 3, FH_METHOD_GET },		 { "HEAD", 4, FH_METHOD_HEAD },
+	{ "POST", 4, FH_METHOD_POST },		 { "PUT", 3, FH_METHOD_PUT },
+	{ "DELETE", 6, FH_METHOD_DELETE },	 { "OPTIONS", 7, FH_METHOD_OPTIONS },
+	{ "PATCH", 5, FH_METHOD_PATCH },	 { "CONNECT", 7, FH_METHOD_CONNECT },
+	{ "TRACE", 5, FH_METHOD_TRACE },
+};
+
+static inline uint32_t
+h2_read_u32 (const uint8_t *p)
+{
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16)
+		   | ((uint32_t) p[2] << 8) | (uint32_t) p[3];
+}
+
+static inline void
+h2_write_u32 (uint8_t *p, uint32_t value)
+{
+	p[0] = (uint8_t) (value >> 24);
+	p[1] = (uint8_t) (value >> 16);
+	p[2] = (uint8_t) (value >> 8);
+	p[3] = (uint8_t) value;
+}
+
+static inline void
+h2_write_frame_header (uint8_t *p, uint32_t length, uint8_t type,
+					   uint8_t flags, uint32_t stream_id)
+{
+	struct h2_frame_header *header = (struct h2_frame_header *) p;
+
+	header->length[0] = (uint8_t) (length >> 16);
+	header->length[1] = (uint8_t) (length >> 8);
+	header->length[2] = (uint8_t) length;
+	header->type = type;
+	header->flags = flags;
+	h2_write_u32 (header->r_stream_id, stream_id & H2_STREAM_ID_MASK);
+}
+
+static bool
+fh_h2_out_reserve (struct fh_h2_ctx *ctx, size_t len)
+{
+	if (ctx->out_off > 0 && ctx->out_cap - ctx->out_len < len)
+	{
+		memmove (ctx->out, ctx->out + ctx->out_off,
+				 ctx->out_len - ctx->out_off);
+		ctx->out_len -= ctx->out_off;
+		ctx->file_at -= ctx->file_len > 0 ? ctx->out_off : 0;
+		ctx->out_off = 0;
+	}
+
+	if (ctx->out_cap - ctx->out_len >= len)
+		return true;
+
+	size_t cap = ctx->out_cap ? ctx->out_cap : 4096;
+
+	while (cap - ctx->out_len < len)
+		cap *= 2;
+
+	uint8_t *out = realloc (ctx->out, cap);
+
+	if (!out)
+		return false;
+
+	ctx->out = out;
+	ctx->out_cap = cap;
+	return true;
+}
+
+/* Appends a frame header and returns where its payload goes.  */
+static uint8_t *
+fh_h2_frame_begin (struct fh_h2_ctx *ctx, uint8_t type, uint8_t flags,
+				   uint32_t stream_id, uint32_t length)
+{
+	if (!fh_h2_out_reserve (ctx, H2_FRAME_HEADER_SIZE + length))
+		return NULL;
+
+	uint8_t *frame = ctx->out + ctx->out_len;
+
+	h2_write_frame_header (frame, length, type, flags, stream_id);
+	ctx->out_len += H2_FRAME_HEADER_SIZE + length;
+	return frame + H2_FRAME_HEADER_SIZE;
+}
+
+static inline size_t
+fh_h2_out_pending (const struct fh_h2_ctx *ctx)
+{
+	return ctx->out_len - ctx->out_off + ctx->file_len;
+}
+
+/* File-backed DATA payloads skip the output buffer when the kernel can
+   send them on its own, i.e. unless TLS is done in userspace.  */
+static inline bool
+fh_h2_can_sendfile (const struct fh_h2_ctx *ctx)
+{
+	return !ctx->conn->ssl || ctx->conn->ktls_send;
+}
+
+/* Called once the payload of a file-backed DATA frame has been sent.  */
+static void
+fh_h2_file_done (struct fh_h2_ctx *ctx)
+{
+	if (ctx->file_owned)
+		close (ctx->file_fd);
+
+	ctx->file_fd = -1;
+	ctx->file_len = 0;
+	ctx->file_stream = NULL;
+	ctx->file_owned = false;
+}
+
+static bool
+fh_h2_flush (struct fh_h2_ctx *ctx)
+{
+	while (fh_h2_out_pending (ctx))
+	{
+		const bool file_next
+			= ctx->file_len > 0 && ctx->out_off == ctx->file_at;
+		ssize_t wrote;
+
+		if (file_next)
+		{
+			wrote = fh_conn_sendfile (ctx->conn, ctx->file_fd, &ctx->file_off,
+									  ctx->file_len);
+		}
+		else
+		{
+			struct iovec iov = {
+				.iov_base = ctx->out + ctx->out_off,
+				.iov_len = (ctx->file_len > 0 ? ctx->file_at : ctx->out_len)
+						   - ctx->out_off,
+			};
+
+			wrote = fh_conn_writev (ctx->conn, &iov, 1);
+		}
+
+		if (wrote < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			return would_block ();
+		}
+
+		if (!file_next)
+		{
+			ctx->out_off += (size_t) wrote;
+			continue;
+		}
+
+		/* The file was truncated under us, and the frame can no longer
+		   be completed.  */
+		if (wrote == 0)
+			return false;
+
+		ctx->file_len -= (size_t) wrote;
+
+		if (ctx->file_len == 0)
+			fh_h2_file_done (ctx);
+	}
+
+	ctx->out_off = ctx->out_len = 0;
+	return true;
+}
+
+static bool
+fh_h2_send_settings (struct fh_h2_ctx *ctx)
+{
+	const struct
+	{
+		uint16_t id;
+		uint32_t value;
+	} settings[] = {
+		{ SETTINGS_HEADER_TABLE_SIZE, ctx->local.header_table_size },
+		{ SETTINGS_ENABLE_PUSH, ctx->local.enable_push },
+		{ SETTINGS_MAX_CONCURRENT_STREAMS, ctx->local.max_concurrent_streams },
+		{ SETTINGS_INITIAL_WINDOW_SIZE, ctx->local.initial_window_size },
+		{ SETTINGS_MAX_FRAME_SIZE, ctx->local.max_frame_size },
+		{ SETTINGS_MAX_HEADER_LIST_SIZE, ctx->local.max_header_list_size },
+	};
+	const size_t count = sizeof (settings) / sizeof (settings[0]);
+	uint8_t *payload = fh_h2_frame_begin (ctx, H2_FRAME_SETTINGS, 0, 0,
+										  (uint32_t) (count * 6));
+
+	if (!payload)
+		return false;
+
+	for (size_t i = 0; i < count; i++, payload += 6)
+	{
+		payload[0] = (uint8_t) (settings[i].id >> 8);
+		payload[1] = (uint8_t) settings[i].id;
+		h2_write_u32 (payload + 2, settings[i].value);
+	}
+
+	return true;
+}
+
+static bool
+fh_h2_send_window_update (struct fh_h2_ctx *ctx, uint32_t stream_id,
+						  uint32_t increment)
+{
+	uint8_t *payload
+		= fh_h2_frame_begin (ctx, H2_FRAME_WINDOW_UPDATE, 0, stream_id, 4);
+
+	if (!payload)
+		return false;
+
+	h2_write_u32 (payload, increment & H2_STREAM_ID_MASK);
+	return true;
+}
+
+/* Gives back connection window for received DATA that is no longer
+   buffered.  */
+static bool
+fh_h2_recv_release (struct fh_h2_ctx *ctx, size_t len)
+{
+	if (len == 0)
+		return true;
+
+	ctx->recv_window += (int64_t) len;
+	return fh_h2_send_window_update (ctx, 0, (uint32_t) len);
+}
+
+static bool
+fh_h2_send_rst_stream (struct fh_h2_ctx *ctx, uint32_t stream_id,
+					   enum h2_error_code code)
+{
+	uint8_t *payload
+		= fh_h2_frame_begin (ctx, H2_FRAME_RST_STREAM, 0, stream_id, 4);
+
+	if (!payload)
+		return false;
+
+	h2_write_u32 (payload, code);
+	return true;
+}
+
+static bool
+fh_h2_send_goaway (struct fh_h2_ctx *ctx, enum h2_error_code code)
+{
+	uint8_t *payload = fh_h2_frame_begin (ctx, H2_FRAME_GOAWAY, 0, 0, 8);
+
+	if (!payload)
+		return false;
+
+	h2_write_u32 (payload, ctx->last_stream_id);
+	h2_write_u32 (payload + 4, code);
+	ctx->goaway_sent = true;
+	return true;
+}
+
+/* Reports a connection error: sends GOAWAY as a best effort and returns
+   false so that the caller closes the connection.  */
+static bool
+fh_h2_conn_error (struct fh_h2_ctx *ctx, enum h2_error_code code,
+				  const char *reason)
+{
+	fh_pr_debug ("Connection #%lu: connection error %d: %s", ctx->conn->id,
+				 code, reason);
+	fh_stats_add (parse_errors, 1);
+
+	if (!ctx->goaway_sent && fh_h2_send_goaway (ctx, code))
+		fh_h2_flush (ctx);
+
+	return false;
+}
+
+static struct h2_stream *
+fh_h2_stream_find (struct fh_h2_ctx *ctx, uint32_t id)
+{
+	for (struct h2_stream *stream = ctx->stream_head; stream;
+		 stream = stream->next)
+	{
+		if (stream->id == id)
+			return stream;
+	}
+
+	return NULL;
+}
+
+static struct h2_stream *
+fh_h2_stream_create (struct fh_h2_ctx *ctx, uint32_t id)
+{
+	pool_t *pool = fh_pool_create (0);
+
+	if (!pool)
+		return NULL;
+
+	struct h2_stream *stream = fh_pool_alloc (pool, sizeof (*stream));
+
+	if (!stream)
+	{
+		fh_pool_destroy (pool);
+		return NULL;
+	}
+
+	memset (stream, 0, sizeof (*stream));
+	stream->id = id;
+	stream->state = H2_STREAM_STATE_OPEN;
+	stream->pool = pool;
+	stream->send_window = ctx->remote.initial_window_size;
+	stream->recv_window = ctx->local.initial_window_size;
+
+	/* RFC 9218 makes responses non-incremental by default.  Streams that
+	   did not ask for that share the bandwidth instead, so that a large
+	   download does not hold back everything requested after it.  */
+	stream->urgency = H2_DEFAULT_URGENCY;
+	stream->incremental = true;
+	stream->weight = H2_DEFAULT_WEIGHT;
+	fh_stats_mark (&stream->timing, FH_STATS_MARK_FIRST_BYTE);
+
+	fh_headers_init (&stream->request.headers);
+	stream->request.pool = pool;
+	stream->request.conn = ctx->conn;
+	stream->request.protocol = FH_PROTOCOL_H2;
+	fh_response_init (&stream->response, pool);
+	stream->response.protocol = FH_PROTOCOL_H2;
+
+	stream->prev = ctx->stream_tail;
+
+	if (ctx->stream_tail)
+		ctx->stream_tail->next = stream;
+	else
+		ctx->stream_head = stream;
+
+	ctx->stream_tail = stream;
+	ctx->stream_count++;
+	fh_conn_request_begin (ctx->conn);
+	return stream;
+}
+
+static void
+fh_h2_stream_close (struct fh_h2_ctx *ctx, struct h2_stream *stream)
+{
+	if (stream->prev)
+		stream->prev->next = stream->next;
+	else
+		ctx->stream_head = stream->next;
+
+	if (stream->next)
+		stream->next->prev = stream->prev;
+	else
+		ctx->stream_tail = stream->prev;
+
+	ctx->stream_count--;
+	fh_conn_request_end (ctx->conn);
+
+	if (stream->end_stream_sent)
+		fh_stats_mark (&stream->timing, FH_STATS_MARK_BODY);
+
+	fh_stats_record (&stream->timing);
+
+	if (stream->headers_sent)
+		fh_access_log (ctx->conn, &stream->request, stream->response.status,
+					   stream->bytes_sent, &stream->timing);
+
+	if (ctx->sched_next == stream)
+		ctx->sched_next = stream->next;
+
+	/* A DATA frame that is partly written must still be completed, so the
+	   file it comes from outlives the stream.  */
+	if (ctx->file_stream == stream)
+	{
+		stream->link->buf->attrs.file.file_fd = -1;
+		ctx->file_stream = NULL;
+		ctx->file_owned = true;
+	}
+
+	fh_link_release (stream->link);
+	fh_link_release (stream->response.body_start);
+	fh_response_cleanup (&stream->response);
+	fh_pool_destroy (stream->pool);
+
+	/* The peer may use the window again once the body is gone.  */
+	if (!ctx->goaway_sent)
+		fh_h2_recv_release (ctx, stream->body_size);
+}
+
+static bool
+fh_h2_stream_error (struct fh_h2_ctx *ctx, uint32_t stream_id,
+					enum h2_error_code code)
+{
+	struct h2_stream *stream = fh_h2_stream_find (ctx, stream_id);
+
+	fh_pr_debug ("Connection #%lu: stream %u error %d", ctx->conn->id,
+				 stream_id, code);
+
+	if (stream)
+		fh_h2_stream_close (ctx, stream);
+
+	return fh_h2_send_rst_stream (ctx, stream_id, code);
+}
+
+struct fh_h2_ctx *
+fh_h2_ctx_create (struct fh_conn *conn, fh_h2_request_handler_t handler,
+				  void *handler_data)
+{
+	struct fh_h2_ctx *ctx = fh_pool_alloc (conn->pool, sizeof (*ctx));
+
+	if (!ctx)
+		return NULL;
+
+	memset (ctx, 0, sizeof (*ctx));
+	ctx->conn = conn;
+	ctx->file_fd = -1;
+	ctx->handler = handler;
+	ctx->handler_data = handler_data;
+
+	ctx->local = (struct h2_settings) {
+		.header_table_size = FH_HPACK_DEFAULT_TABLE_SIZE,
+		.initial_window_size = H2_DEFAULT_WINDOW_SIZE,
+		.max_frame_size = H2_DEFAULT_FRAME_SIZE,
+		.max_header_list_size = H2_MAX_HEADER_BLOCK_SIZE,
+		.max_concurrent_streams = H2_MAX_CONCURRENT_STREAMS,
+		.enable_push = false,
+	};
+
+	ctx->remote = (struct h2_settings) {
+		.header_table_size = FH_HPACK_DEFAULT_TABLE_SIZE,
+		.initial_window_size = H2_DEFAULT_WINDOW_SIZE,
+		.max_frame_size = H2_DEFAULT_FRAME_SIZE,
+		.max_header_list_size = UINT32_MAX,
+		.max_concurrent_streams = UINT32_MAX,
+		.enable_push = true,
+	};
+
+	ctx->send_window = H2_DEFAULT_WINDOW_SIZE;
+	ctx->recv_window = H2_CONN_RECV_WINDOW;
+	ctx->in_cap = H2_FRAME_HEADER_SIZE + ctx->local.max_frame_size;
+	ctx->in = malloc (ctx->in_cap);
+
+	if (!ctx->in)
+		return NULL;
+
+	if (!fh_hpack_decoder_init (&ctx->decoder, ctx->local.header_table_size)
+		|| !fh_h2_send_settings (ctx)
+		|| !fh_h2_send_window_update (
+			ctx, 0, H2_CONN_RECV_WINDOW - H2_DEFAULT_WINDOW_SIZE))
+	{
+		fh_h2_ctx_destroy (ctx);
+		return NULL;
+	}
+
+	ctx->decoder.max_list_size = ctx->local.max_header_list_size;
+	return ctx;
+}
+
+void
+fh_h2_ctx_destroy (struct fh_h2_ctx *ctx)
+{
+	while (ctx->stream_head)
+		fh_h2_stream_close (ctx, ctx->stream_head);
+
+	fh_h2_file_done (ctx);
+	fh_hpack_decoder_free (&ctx->decoder);
+	free (ctx->in);
+	free (ctx->header_block);
+	free (ctx->out);
+	ctx->in = ctx->header_block = ctx->out = NULL;
+}
+
+bool
+fh_h2_done (const struct fh_h2_ctx *ctx)
+{
+	return (ctx->goaway_received || ctx->goaway_sent) && !ctx->stream_head
+		   && !fh_h2_out_pending (ctx);
+}
+
+static bool
+fh_h2_on_pseudo_header (struct h2_header_ctx *hctx, const char *name,
+						size_t name_len, const char *value, size_t value_len)
+{
+	struct fh_request *request = &hctx->stream->request;
+
+	if (name_len == 7 && !memcmp (name, ":method", 7) && !hctx->method)
+	{
+		hctx->method = value;
+		hctx->method_len = value_len;
+	}
+	else if (name_len == 5 && !memcmp (name, ":path", 5) && !request->uri
+			 && value_len > 0)
+	{
+		request->uri = value;
+		request->uri_len = value_len;
+	}
+	else if (name_len == 7 && !memcmp (name, ":scheme", 7) && !hctx->have_scheme)
+	{
+		hctx->have_scheme = true;
+	}
+	else if (name_len == 10 && !memcmp (name, ":authority", 10)
+			 && !request->host)
+	{
+		const char *colon = memchr (value, ':', value_len);
+
+		request->host = value;
+		request->full_host_len = value_len;
+		request->host_len = colon ? (size_t) (colon - value) : value_len;
+	}
+	else
+	{
+		return false;
+	}
+
+	return true;
+}
+
+/* Connection-specific fields must not appear in HTTP/2 (RFC 9113,
+   section 8.2.2).  */
+static bool
+fh_h2_is_connection_header (const char *name, size_t name_len,
+							const char *value, size_t value_len)
+{
+	static const struct
+	{
+		const char *name;
+		size_t len;
+	} names[] = {
+		{ "connection", 10 },	{ "keep-alive", 10 }, { "proxy-connection", 16 },
+		{ "transfer-encoding", 17 }, { "upgrade", 7 },
+	};
+
+	for (size_t i = 0; i < sizeof (names) / sizeof (names[0]); i++)
+	{
+		if (name_len == names[i].len && !memcmp (name, names[i].name, name_len))
+			return true;
+	}
+
+	return name_len == 2 && !memcmp (name, "te", 2)
+		   && (value_len != 8 || strncasecmp (value, "trailers", 8));
+}
+
+/* Applies an RFC 9218 Priority field value, such as "u=1, i".  Unknown
+   members and invalid values are ignored, as are the parameters of
+   members.  */
+static void
+fh_h2_parse_priority (struct h2_stream *stream, const char *value,
+					  size_t value_len)
+{
+	const char *pos = value, *end = value + value_len;
+
+	stream->urgency = H2_DEFAULT_URGENCY;
+	stream->incremental = false;
+
+	while (pos < end)
+	{
+		while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == ','))
+			pos++;
+
+		const char *member = pos;
+
+		while (pos < end && *pos != ',')
+			pos++;
+
+		size_t len = (size_t) (pos - member);
+		const char *params = memchr (member, ';', len);
+
+		if (params)
+			len = (size_t) (params - member);
+
+		while (len > 0 && (member[len - 1] == ' ' || member[len - 1] == '\t'))
+			len--;
+
+		if (len == 3 && member[0] == 'u' && member[1] == '='
+			&& member[2] >= '0' && member[2] <= '0' + H2_MAX_URGENCY)
+			stream->urgency = (uint8_t) (member[2] - '0');
+		else if ((len == 1 && member[0] == 'i')
+				 || (len == 4 && !memcmp (member, "i=?1", 4)))
+			stream->incremental = true;
+		else if (len == 4 && !memcmp (member, "i=?0", 4))
+			stream->incremental = false;
+	}
+}
+
+static bool
+fh_h2_on_header (void *data, const char *name, size_t name_len,
+				 const char *value, size_t value_len)
+{
+	struct h2_header_ctx *hctx = data;
+	struct h2_stream *stream = hctx->stream;
+
+	/* The block still has to be decoded to keep the HPACK state in sync,
+	   even if the stream is going away.  */
+	if (!stream || stream->refused || stream->malformed)
+		return true;
+
+	for (size_t i = 0; i < name_len; i++)
+	{
+		if (name[i] >= 'A' && name[i] <= 'Z')
+		{
+			stream->malformed = true;
+			return true;
+		}
+	}
+
+	if (name_len > 0 && name[0] == ':')
+	{
+		if (hctx->trailers || stream->pseudo_done
+			|| !fh_h2_on_pseudo_header (hctx, name, name_len, value,
+										value_len))
+			stream->malformed = true;
+
+		return true;
+	}
+
+	stream->pseudo_done = true;
+
+	if (hctx->trailers)
+		return true;
+
+	if (!fh_validate_header_name (name, name_len)
+		|| fh_h2_is_connection_header (name, name_len, value, value_len))
+	{
+		stream->malformed = true;
+		return true;
+	}
+
+	struct fh_request *request = &stream->request;
+
+	if (name_len == 4 && !memcmp (name, "host", 4) && !request->host)
+	{
+		const char *colon = memchr (value, ':', value_len);
+
+		request->host = value;
+		request->full_host_len = value_len;
+		request->host_len = colon ? (size_t) (colon - value) : value_len;
+	}
+	else if (name_len == 14 && !memcmp (name, "content-length", 14))
+	{
+		errno = 0;
+		const uint64_t content_length = strntoull (value, value_len, 10);
+
+		if (errno == EINVAL
+			|| (stream->has_content_length
+				&& content_length != request->content_length))
+		{
+			stream->malformed = true;
+			return true;
+		}
+
+		request->content_length = content_length;
+		stream->has_content_length = true;
+	}
+	else if (name_len == 8 && !memcmp (name, "priority", 8))
+	{
+		fh_h2_parse_priority (stream, value, value_len);
+	}
+
+	return fh_header_add (stream->pool, &request->headers, name, name_len,
+						  value, value_len)
+		   != NULL;
+}
+
+static void
+fh_h2_finish_request_headers (struct h2_header_ctx *hctx)
+{
+	struct h2_stream *stream = hctx->stream;
+	struct fh_request *request = &stream->request;
+	bool found = false;
+
+	if (!hctx->method)
+	{
+		stream->malformed = true;
+		return;
+	}
+
+	for (size_t i = 0; i < sizeof (h2_methods) / sizeof (h2_methods[0]); i++)
+	{
+		if (hctx->method_len == h2_methods[i].len
+			&& !memcmp (hctx->method, h2_methods[i].name, hctx->method_len))
+		{
+			request->method = h2_methods[i].method;
+			found = true;
+			break;
+		}
+	}
+
+	if (!found)
+	{
+		request->method = FH_METHOD_GET;
+		stream->error_status = FH_STATUS_NOT_IMPLEMENTED;
+		return;
+	}
+
+	if (request->method == FH_METHOD_CONNECT)
+	{
+		if (hctx->have_scheme || request->uri || !request->host)
+			stream->malformed = true;
+		else
+			stream->error_status = FH_STATUS_METHOD_NOT_ALLOWED;
+
+		return;
+	}
+
+	if (!hctx->have_scheme || !request->uri)
+		stream->malformed = true;
+}
+
+static bool
+fh_h2_use_error_page (struct fh_h2_ctx *ctx, struct h2_stream *stream)
+{
+	struct fh_response *response = &stream->response;
+	struct fh_conn_extra *extra = ctx->conn->extra;
+	size_t len = 0;
+	char *page = fh_response_error_page (stream->pool, response->status,
+										 extra->host, extra->host_len,
+										 extra->port, &len);
+
+	if (!page)
+		return false;
+
+	fh_link_release (response->body_start);
+	response->body_start
+		= fh_link_new_data (stream->pool, (const uint8_t *) page, len, true);
+
+	if (!response->body_start)
+		return false;
+
+	response->encoding = FH_ENCODING_PLAIN;
+	response->content_length = len;
+	response->content_type = "text/html; charset=UTF-8";
+	response->content_type_len = 24;
+	response->filters = NULL;
+	return true;
+}
+
+/* The request is complete: hand it over to the handler.  */
+static bool
+fh_h2_dispatch (struct fh_h2_ctx *ctx, struct h2_stream *stream)
+{
+	struct fh_response *response = &stream->response;
+
+	/* RFC 9113, section 8.1.1 */
+	if (stream->has_content_length
+		&& stream->request.content_length != stream->body_size)
+		return fh_h2_stream_error (ctx, stream->id, H2_PROTOCOL_ERROR);
+
+	stream->state = H2_STREAM_STATE_HALF_CLOSED_REMOTE;
+	FH_PROBE5 (request__parsed, ctx->conn->id, ctx->conn->client_sockfd,
+			   stream->request.method, stream->request.uri,
+			   stream->request.uri_len);
+
+	if (stream->error_status)
+	{
+		response->status = stream->error_status;
+		response->use_default_error_response = true;
+	}
+	else if (!ctx->handler (ctx->handler_data, ctx->conn, &stream->request,
+							response))
+	{
+		return fh_h2_stream_error (ctx, stream->id, H2_INTERNAL_ERROR);
+	}
+
+	fh_stats_mark (&stream->timing, FH_STATS_MARK_HANDLER);
+	stream->has_response = true;
+	return true;
+}
+
+static bool
+fh_h2_process_header_block (struct fh_h2_ctx *ctx)
+{
+	const uint32_t stream_id = ctx->header_stream_id;
+	const bool end_stream = ctx->header_flags & H2_FLAG_END_STREAM;
+	struct h2_stream *stream = fh_h2_stream_find (ctx, stream_id);
+	struct h2_header_ctx hctx = {
+		.ctx = ctx,
+		.stream = stream,
+		.trailers = stream && stream->pseudo_done,
+	};
+	pool_t *pool = stream && !hctx.trailers ? stream->pool : fh_pool_create (0);
+
+	ctx->header_stream_id = 0;
+
+	if (!pool)
+		return fh_h2_conn_error (ctx, H2_INTERNAL_ERROR, "Out of memory");
+
+	bool decoded
+		= fh_hpack_decode (&ctx->decoder, pool, ctx->header_block,
+						   ctx->header_block_len, &fh_h2_on_header, &hctx);
+
+	ctx->header_block_len = 0;
+
+	if (!stream || hctx.trailers)
+		fh_pool_destroy (pool);
+
+	if (!decoded)
+		return fh_h2_conn_error (ctx, H2_COMPRESSION_ERROR,
+								 "Header block decoding failed");
+
+	if (!stream)
+		return true;
+
+	if (stream->refused)
+		return fh_h2_stream_error (ctx, stream_id, H2_REFUSED_STREAM);
+
+	/* Larger than our SETTINGS_MAX_HEADER_LIST_SIZE */
+	if (ctx->decoder.list_too_large)
+		return fh_h2_stream_error (ctx, stream_id, H2_ENHANCE_YOUR_CALM);
+
+	if (hctx.trailers)
+	{
+		if (!end_stream || stream->malformed)
+			return fh_h2_stream_error (ctx, stream_id, H2_PROTOCOL_ERROR);
+	}
+	else
+	{
+		stream->pseudo_done = true;
+		fh_stats_mark (&stream->timing, FH_STATS_MARK_HEAD);
+
+		if (!stream->malformed)
+			fh_h2_finish_request_headers (&hctx);
+
+		if (stream->malformed)
+			return fh_h2_stream_error (ctx, stream_id, H2_PROTOCOL_ERROR);
+	}
+
+	return end_stream ? fh_h2_dispatch (ctx, stream) : true;
+}
+
+static bool
+fh_h2_append_header_block (struct fh_h2_ctx *ctx, const uint8_t *data,
+						   size_t len)
+{
+	if (ctx->header_block_len + len > H2_MAX_HEADER_BLOCK_SIZE)
+		return fh_h2_conn_error (ctx, H2_ENHANCE_YOUR_CALM,
+								 "Header block too large");
+
+	if (!ctx->header_block)
+	{
+		ctx->header_block = malloc (H2_MAX_HEADER_BLOCK_SIZE);
+
+		if (!ctx->header_block)
+			return fh_h2_conn_error (ctx, H2_INTERNAL_ERROR, "Out of memory");
+	}
+
+	memcpy (ctx->header_block + ctx->header_block_len, data, len);
+	ctx->header_block_len += len;
+	return true;
+}
+
+/* Removes the padding of DATA and HEADERS frames.  */
+static bool
+fh_h2_strip_padding (const struct h2_frame *frame, const uint8_t **data_ptr,
+					 size_t *len_ptr)
+{
+	const uint8_t *data = frame->payload;
+	size_t len = frame->length;
+
+	if (frame->flags & H2_FLAG_PADDED)
+	{
+		if (len < 1 || data[0] >= len)
+			return false;
+
+		len -= 1 + data[0];
+		data++;
+	}
+
+	*data_ptr = data;
+	*len_ptr = len;
+	return true;
+}
+
+static bool
+fh_h2_handle_headers (struct fh_h2_ctx *ctx, const struct h2_frame *frame)
+{
+	const uint8_t *data;
+	size_t len;
+
+	if (frame->stream_id == 0 || !fh_h2_strip_padding (frame, &data, &len))
+		return fh_h2_conn_error (ctx, H2_PROTOCOL_ERROR, "Invalid HEADERS");
+
+	bool self_dependent = false;
+	uint16_t weight = 0;
+
+	if (frame->flags & H2_FLAG_PRIORITY)
+	{
+		if (len < 5)
+			return fh_h2_conn_error (ctx, H2_FRAME_SIZE_ERROR,
+									 "Invalid HEADERS priority");
+
+		self_dependent
+			= (h2_read_u32 (data) & H2_STREAM_ID_MASK) == frame->stream_id;
+		weight = (uint16_t) (data[4] + 1);
+		data += 5;
+		len -= 5;
+	}
+
+	struct h2_stream *stream = fh_h2_stream_find (ctx, frame->stream_id);
+
+	if (stream)
+	{
+		if (stream->state != H2_STREAM_STATE_OPEN)
+			return fh_h2_conn_error (ctx, H2_STREAM_CLOSED,
+									 "HEADERS on a half-closed stream");
+	}
+	else
+	{
+		if (!(frame->stream_id & 1))
+			return fh_h2_conn_error (ctx, H2_PROTOCOL_ERROR,
+									 "Invalid stream identifier");
+
+		/* A stream that was opened and has been closed since is answered
+		   with STREAM_CLOSED (RFC 9113, section 5.1).  Any other id that
+		   is not above the last one opened is a PROTOCOL_ERROR (section
+		   5.1.1).  */
+		if (frame->stream_id <= ctx->last_stream_id)
+		{
+			const uint32_t distance
+				= (ctx->last_stream_id - frame->stream_id) / 2;
+
+			if (distance < 64 && (ctx->opened_streams >> distance) & 1)
+				return fh_h2_conn_error (ctx, H2_STREAM_CLOSED,
+										 "HEADERS on a closed stream");
+
+			return fh_h2_conn_error (ctx, H2_PROTOCOL_ERROR,
+									 "HEADERS on a stream that was skipped");
+		}
+
+		const uint32_t shift = (frame->stream_id - ctx->last_stream_id) / 2;
+
+		ctx->opened_streams = shift < 64 ? ctx->opened_streams << shift : 0;
+		ctx->opened_streams |= 1;
+		ctx->last_stream_id = frame->stream_id;
+
+		/* Streams opened after GOAWAY are ignored, but their header blocks
+		   are still decoded.  */
+		if (!ctx->goaway_sent)
+		{
+			stream = fh_h2_stream_create (ctx, frame->stream_id);
+
+			if (!stream)
+				return fh_h2_conn_error (ctx, H2_INTERNAL_ERROR,
+										 "Out of memory");
+
+			stream->refused
+				= ctx->stream_count > ctx->local.max_concurrent_streams;
+		}
+	}
+
+	if (stream && self_dependent)
+		stream->malformed = true;
+
+	if (stream && weight)
+		stream->weight = weight;
+
+	ctx->header_stream_id = frame->stream_id;
+	ctx->header_flags = frame->flags;
+
+	if (!fh_h2_append_header_block (ctx, data, len))
+		return false;
+
+	return frame->flags & H2_FLAG_END_HEADERS ? fh_h2_process_header_block (ctx)
+											  : true;
+}
+
+static bool
+fh_h2_handle_continuation (struct fh_h2_ctx *ctx, const struct h2_frame *frame)
+{
+	if (!ctx->header_stream_id || frame->stream_id != ctx->header_stream_id)
+		return fh_h2_conn_error (ctx, H2_PROTOCOL_ERROR,
+								 "Unexpected CONTINUATION");
+
+	if (!fh_h2_append_header_block (ctx, frame->payload, frame->length))
+		return false;
+
+	return frame->flags & H2_FLAG_END_HEADERS ? fh_h2_process_header_block (ctx)
+											  : true;
+}
+
+static bool
+fh_h2_handle_data (struct fh_h2_ctx *ctx, const struct h2_frame *frame)
+{
+	const uint8_t *data;
+	size_t len;
+
+	if (frame->stream_id == 0 || !fh_h2_strip_padding (frame, &data, &len))
+		return fh_h2_conn_error (ctx, H2_PROTOCOL_ERROR, "Invalid DATA");
+
+	/* Flow control covers the whole payload, padding included.  Only
+	   what ends up in a request body keeps its share of the connection
+	   window until the stream is closed.  */
+	ctx->recv_window -= frame->length;
+
+	if (ctx->recv_window < 0)
+		return fh_h2_conn_error (ctx, H2_FLOW_CONTROL_ERROR,
+								 "Connection window exceeded");
+
+	struct h2_stream *stream = fh_h2_stream_find (ctx, frame->stream_id);
+
+	if (!fh_h2_recv_release (ctx, stream ? frame->length - len
+										  : frame->length))
+		return fh_h2_conn_error (ctx, H2_INTERNAL_ERROR, "Out of memory");
+
+	if (!stream)
+	{
+		if (frame->stream_id > ctx->last_stream_id)
+			return fh_h2_conn_error (ctx, H2_PROTOCOL_ERROR,
+									 "DATA on an idle stream");
+
+		return fh_h2_send_rst_stream (ctx, frame->stream_id,
+									  H2_STREAM_CLOSED);
+	}
+
+	struct fh_request *request = &stream->request;
+
+	if (stream->state != H2_STREAM_STATE_OPEN || !stream->pseudo_done)
+	{
+		if (!fh_h2_recv_release (ctx, len))
+			return fh_h2_conn_error (ctx, H2_INTERNAL_ERROR, "Out of memory");
+
+		return fh_h2_stream_error (ctx, stream->id, H2_STREAM_CLOSED);
+	}
+
+	/* Accounted as part of the body from here on, so that closing the
+	   stream gives it back.  */
+	stream->body_size += len;
+	stream->recv_window -= frame->length;
+
+	if (stream->recv_window < 0)
+		return fh_h2_stream_error (ctx, stream->id, H2_FLOW_CONTROL_ERROR);
+
+	if (stream->has_content_length && stream->body_size > request->content_length)
+		return fh_h2_stream_error (ctx, stream->id, H2_PROTOCOL_ERROR);
+
+	if (len > 0)
+	{
+		if (stream->body_size > H2_MAX_REQUEST_BODY_SIZE)
+			return fh_h2_stream_error (ctx, stream->id, H2_ENHANCE_YOUR_CALM);
+
+		uint8_t *copy = fh_pool_alloc (stream->pool, len);
+		struct fh_link *link
+			= copy ? fh_link_new_data (stream->pool, copy, len, false) : NULL;
+
+		if (!link)
+			return fh_h2_stream_error (ctx, stream->id, H2_INTERNAL_ERROR);
+
+		memcpy (copy, data, len);
+
+		if (stream->body_tail)
+			stream->body_tail->next = link;
+		else
+			request->body_start = link;
+
+		stream->body_tail = link;
+	}
+
+	if (frame->flags & H2_FLAG_END_STREAM)
+	{
+		if (stream->body_tail)
+			stream->body_tail->is_eos = true;
+
+		return fh_h2_dispatch (ctx, stream);
+	}
+
+	if (frame->length > 0)
+	{
+		if (!fh_h2_send_window_update (ctx, stream->id, frame->length))
+			return fh_h2_conn_error (ctx, H2_INTERNAL_ERROR, "Out of memory");
+
+		stream->recv_window += frame->length;
+	}
+
+	return true;
+}
+
+static bool
+fh_h2_apply_setting (struct fh_h2_ctx *ctx, uint16_t id, uint32_t value)
+{
+	switch (id)
+	{
+		case SETTINGS_HEADER_TABLE_SIZE:
+			ctx->remote.header_table_size = value;
+			break;
+
+		case SETTINGS_ENABLE_PUSH:
+			if (value > 1)
+				return fh_h2_conn_error (ctx, H2_PROTOCOL_ERROR,
+										 "Invalid SETTINGS_ENABLE_PUSH");
+
+			ctx->remote.enable_push = value;
+			break;
+
+		case SETTINGS_MAX_CONCURRENT_STREAMS:
+			ctx->remote.max_concurrent_streams = value;
+			break;
+
+		case SETTINGS_INITIAL_WINDOW_SIZE:
+		{
+			if (value > H2_MAX_WINDOW_SIZE)
+				return fh_h2_conn_error (ctx, H2_FLOW_CONTROL_ERROR,
+										 "Invalid SETTINGS_INITIAL_WINDOW_SIZE");
+
+			const int64_t delta
+				= (int64_t) value - ctx->remote.initial_window_size;
+
+			for (struct h2_stream *stream = ctx->stream_head; stream;
+				 stream = stream->next)
+			{
+				stream->send_window += delta;
+
+				if (stream->send_window > H2_MAX_WINDOW_SIZE)
+					return fh_h2_conn_error (ctx, H2_FLOW_CONTROL_ERROR,
+											 "Stream window overflow");
+			}
+
+			ctx->remote.initial_window_size = value;
+			break;
+		}
+
+		case SETTINGS_MAX_FRAME_SIZE:
+			if (value < H2_DEFAULT_FRAME_SIZE || value > H2_MAX_FRAME_SIZE)
+				return fh_h2_conn_error (ctx, H2_PROTOCOL_ERROR,
+										 "Invalid SETTINGS_MAX_FRAME_SIZE");
+
+			ctx->remote.max_frame_size = value;
+			break;
+
+		case SETTINGS_MAX_HEADER_LIST_SIZE:
+			ctx->remote.max_header_list_size = value;
+			break;
+
+		default:
+			/* Unknown settings must be ignored.  */
+			break;
+	}
+
+	return true;
+}
+
+static bool
+fh_h2_handle_settings (struct fh_h2_ctx *ctx, const struct h2_frame *frame)
+{
+	if (frame->stream_id != 0)
+		return fh_h2_conn_error (ctx, H2_PROTOCOL_ERROR,
+								 "SETTINGS on a stream");
+
+	if (frame->flags & H2_FLAG_ACK)
+	{
+		if (frame->length != 0)
+			return fh_h2_conn_error (ctx, H2_FRAME_SIZE_ERROR,
+									 "SETTINGS ACK with a payload");
+
+		return true;
+	}
+
+	if (frame->length % 6 != 0)
+		return fh_h2_conn_error (ctx, H2_FRAME_SIZE_ERROR,
+								 "Invalid SETTINGS length");
+
+	for (size_t off = 0; off < frame->length; off += 6)
+	{
+		const uint8_t *p = frame->payload + off;
+
+		if (!fh_h2_apply_setting (ctx, (uint16_t) ((p[0] << 8) | p[1]),
+								  h2_read_u32 (p + 2)))
+			return false;
+	}
+
+	if (!fh_h2_frame_begin (ctx, H2_FRAME_SETTINGS, H2_FLAG_ACK, 0, 0))
+		return fh_h2_conn_error (ctx, H2_INTERNAL_ERROR, "Out of memory");
+
+	return true;
+}
+
+static bool
+fh_h2_handle_ping (struct fh_h2_ctx *ctx, const struct h2_frame *frame)
+{
+	if (frame->stream_id != 0)
+		return fh_h2_conn_error (ctx, H2_PROTOCOL_ERROR, "PING on a stream");
+
+	if (frame->length != 8)
+		return fh_h2_conn_error (ctx, H2_FRAME_SIZE_ERROR,
+								 "Invalid PING length");
+
+	if (frame->flags & H2_FLAG_ACK)
+		return true;
+
+	uint8_t *payload
+		= fh_h2_frame_begin (ctx, H2_FRAME_PING, H2_FLAG_ACK, 0, 8);
+
+	if (!payload)
+		return fh_h2_conn_error (ctx, H2_INTERNAL_ERROR, "Out of memory");
+
+	memcpy (payload, frame->payload, 8);
+	return true;
+}
+
+static bool
+fh_h2_handle_window_update (struct fh_h2_ctx *ctx,
+							const struct h2_frame *frame)
+{
+	if (frame->length != 4)
+		return fh_h2_conn_error (ctx, H2_FRAME_SIZE_ERROR,
+								 "Invalid WINDOW_UPDATE length");
+
+	const uint32_t increment = h2_read_u32 (frame->payload) & H2_STREAM_ID_MASK;
+
+	if (frame->stream_id == 0)
+	{
+		if (increment == 0)
+			return fh_h2_conn_error (ctx, H2_PROTOCOL_ERROR,
+									 "Zero WINDOW_UPDATE increment");
+
+		ctx->send_window += increment;
+
+		if (ctx->send_window > H2_MAX_WINDOW_SIZE)
+			return fh_h2_conn_error (ctx, H2_FLOW_CONTROL_ERROR,
+									 "Connection window overflow");
+
+		return true;
+	}
+
+	struct h2_stream *stream = fh_h2_stream_find (ctx, frame->stream_id);
+
+	if (!stream)
+	{
+		if (frame->stream_id > ctx->last_stream_id)
+			return fh_h2_conn_error (ctx, H2_PROTOCOL_ERROR,
+									 "WINDOW_UPDATE on an idle stream");
+
+		return true;
+	}
+
+	if (increment == 0)
+		return fh_h2_stream_error (ctx, stream->id, H2_PROTOCOL_ERROR);
+
+	stream->send_window += increment;
+
+	if (stream->send_window > H2_MAX_WINDOW_SIZE)
+		return fh_h2_stream_error (ctx, stream->id, H2_FLOW_CONTROL_ERROR);
+
+	return true;
+}
+
+/* Only the weight is taken from RFC 7540 priorities; the dependency tree
+   is deprecated by RFC 9113 and ignored.  */
+static bool
+fh_h2_handle_priority (struct fh_h2_ctx *ctx, const struct h2_frame *frame)
+{
+	if (frame->stream_id == 0)
+		return fh_h2_conn_error (ctx, H2_PROTOCOL_ERROR,
+								 "PRIORITY on stream 0");
+
+	if (frame->length != 5)
+		return fh_h2_stream_error (ctx, frame->stream_id,
+								   H2_FRAME_SIZE_ERROR);
+
+	struct h2_stream *stream = fh_h2_stream_find (ctx, frame->stream_id);
+
+	if (stream)
+		stream->weight = (uint16_t) (frame->payload[4] + 1);
+
+	return true;
+}
+
+/* RFC 9218, section 7.1.  Updates for streams that are not open yet are
+   dropped rather than buffered.  */
+static bool
+fh_h2_handle_priority_update (struct fh_h2_ctx *ctx,
+							  const struct h2_frame *frame)
+{
+	if (frame->stream_id != 0)
+		return fh_h2_conn_error (ctx, H2_PROTOCOL_ERROR,
+								 "PRIORITY_UPDATE on a stream");
+
+	if (frame->length < 4)
+		return fh_h2_conn_error (ctx, H2_FRAME_SIZE_ERROR,
+								 "Invalid PRIORITY_UPDATE length");
+
+	const uint32_t id = h2_read_u32 (frame->payload) & H2_STREAM_ID_MASK;
+
+	if (id == 0)
+		return fh_h2_conn_error (ctx, H2_PROTOCOL_ERROR,
+								 "PRIORITY_UPDATE for stream 0");
+
+	struct h2_stream *stream = fh_h2_stream_find (ctx, id);
+
+	if (stream)
+		fh_h2_parse_priority (stream, (const char *) frame->payload + 4,
+							  frame->length - 4);
+
+	return true;
+}
+
+static bool
+fh_h2_handle_frame (struct fh_h2_ctx *ctx, const struct h2_frame *frame)
+{
+	if (!ctx->preface_received)
+	{
+		if (frame->type != H2_FRAME_SETTINGS || frame->flags & H2_FLAG_ACK)
+			return fh_h2_conn_error (ctx, H2_PROTOCOL_ERROR,
+									 "Client preface lacks SETTINGS");
+
+		ctx->preface_received = true;
+	}
+
+	if (ctx->header_stream_id && frame->type != H2_FRAME_CONTINUATION)
+		return fh_h2_conn_error (ctx, H2_PROTOCOL_ERROR,
+								 "Header block interrupted");
+
+	switch (frame->type)
+	{
+		case H2_FRAME_DATA:
+			return fh_h2_handle_data (ctx, frame);
+
+		case H2_FRAME_HEADERS:
+			return fh_h2_handle_headers (ctx, frame);
+
+		case H2_FRAME_CONTINUATION:
+			return fh_h2_handle_continuation (ctx, frame);
+
+		case H2_FRAME_PRIORITY:
+			return fh_h2_handle_priority (ctx, frame);
+
+		case H2_FRAME_PRIORITY_UPDATE:
+			return fh_h2_handle_priority_update (ctx, frame);
+
+		case H2_FRAME_RST_STREAM:
+		{
+			if (frame->stream_id == 0 || frame->stream_id > ctx->last_stream_id)
+				return fh_h2_conn_error (ctx, H2_PROTOCOL_ERROR,
+										 "Invalid RST_STREAM");
+
+			if (frame->length != 4)
+				return fh_h2_conn_error (ctx, H2_FRAME_SIZE_ERROR,
+										 "Invalid RST_STREAM length");
+
+			struct h2_stream *stream
+				= fh_h2_stream_find (ctx, frame->stream_id);
+
+			if (stream)
+				fh_h2_stream_close (ctx, stream);
+
+			return true;
+		}
+
+		case H2_FRAME_SETTINGS:
+			return fh_h2_handle_settings (ctx, frame);
+
+		case H2_FRAME_PUSH_PROMISE:
+			return fh_h2_conn_error (ctx, H2_PROTOCOL_ERROR,
+									 "PUSH_PROMISE from a client");
+
+		case H2_FRAME_PING:
+			return fh_h2_handle_ping (ctx, frame);
+
+		case H2_FRAME_GOAWAY:
+			if (frame->stream_id != 0)
+				return fh_h2_conn_error (ctx, H2_PROTOCOL_ERROR,
+										 "GOAWAY on a stream");
+
+			if (frame->length < 8)
+				return fh_h2_conn_error (ctx, H2_FRAME_SIZE_ERROR,
+										 "Invalid GOAWAY length");
+
+			ctx->goaway_received = true;
+			return true;
+
+		case H2_FRAME_WINDOW_UPDATE:
+			return fh_h2_handle_window_update (ctx, frame);
+
+		default:
+			/* Unknown frame types are ignored.  */
+			return true;
+	}
+}
+
+static bool
+fh_h2_process_input (struct fh_h2_ctx *ctx)
+{
+	size_t off = 0;
+
+	while (ctx->in_len - off >= H2_FRAME_HEADER_SIZE)
+	{
+		const struct h2_frame_header *header
+			= (const struct h2_frame_header *) (ctx->in + off);
+		const uint32_t length = ((uint32_t) header->length[0] << 16)
+								| ((uint32_t) header->length[1] << 8)
+								| header->length[2];
+
+		if (length > ctx->local.max_frame_size)
+			return fh_h2_conn_error (ctx, H2_FRAME_SIZE_ERROR,
+									 "Frame too large");
+
+		if (ctx->in_len - off < H2_FRAME_HEADER_SIZE + length)
+			break;
+
+		if (fh_h2_out_pending (ctx) > H2_OUTPUT_LIMIT)
+			return fh_h2_conn_error (ctx, H2_ENHANCE_YOUR_CALM,
+									 "Peer does not read its output");
+
+		const struct h2_frame frame = {
+			.length = length,
+			.type = header->type,
+			.flags = header->flags,
+			.stream_id = h2_read_u32 (header->r_stream_id) & H2_STREAM_ID_MASK,
+			.payload = ctx->in + off + H2_FRAME_HEADER_SIZE,
+		};
+
+		if (!fh_h2_handle_frame (ctx, &frame))
+			return false;
+
+		off += H2_FRAME_HEADER_SIZE + length;
+	}
+
+	memmove (ctx->in, ctx->in + off, ctx->in_len - off);
+	ctx->in_len -= off;
+	return true;
+}
+
+bool
+fh_h2_feed (struct fh_h2_ctx *ctx, const uint8_t *data, size_t len)
+{
+	if (len > ctx->in_cap - ctx->in_len)
+		return fh_h2_conn_error (ctx, H2_INTERNAL_ERROR, "Input too large");
+
+	memcpy (ctx->in + ctx->in_len, data, len);
+	ctx->in_len += len;
+	return fh_h2_process_input (ctx);
+}
+
+bool
+fh_h2_recv (struct fh_h2_ctx *ctx)
+{
+	size_t budget = H2_RECV_BUDGET;
+
+	ctx->recv_more = false;
+
+	for (;;)
+	{
+		if (!budget)
+		{
+			ctx->recv_more = true;
+			return true;
+		}
+
+		ssize_t bytes_read = fh_conn_recv (ctx->conn, ctx->in + ctx->in_len,
+										   ctx->in_cap - ctx->in_len);
+
+		if (bytes_read < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			if (would_block ())
+				return true;
+
+			fh_pr_debug ("Connection #%lu: recv failed: %s", ctx->conn->id,
+						 strerror (errno));
+			return false;
+		}
+
+		if (bytes_read == 0)
+		{
+			fh_pr_debug ("Connection #%lu: peer closed the connection",
+						 ctx->conn->id);
+			return false;
+		}
+
+		ctx->in_len += (size_t) bytes_read;
+		budget -= (size_t) bytes_read < budget ? (size_t) bytes_read : budget;
+
+		if (!fh_h2_process_input (ctx))
+			return false;
+	}
+}
+
+static size_t
+fh_h2_header_block_estimate (const struct fh_response *response)
+{
+	size_t size = 128 + response->content_type_len;
+
+	if (response->headers)
+	{
+		for (const struct fh_header *h = response->headers->head; h;
+			 h = h->next)
+			size += h->name_len + h->value_len + 10;
+	}
+
+	return size;
+}
+
+static bool
+fh_h2_response_has_body (const struct fh_response *response)
+{
+	return !response->no_send_body
+		   && (response->use_default_error_response
+			   || response->content_length
+			   || response->encoding == FH_ENCODING_CHUNKED);
+}
+
+/* Serializes the response header block and sends it in a HEADERS frame,
+   followed by CONTINUATION frames if it does not fit into one.  */
+static bool
+fh_h2_send_headers (struct fh_h2_ctx *ctx, struct h2_stream *stream,
+					bool end_stream)
+{
+	struct fh_response *response = &stream->response;
+	const size_t cap = fh_h2_header_block_estimate (response);
+	uint8_t *block = fh_pool_alloc (stream->pool, cap);
+	size_t len = 0, n;
+
+	if (!block)
+		return false;
+
+	fh_stats_response (response->status);
+
+#define H2_ENCODE(expr)                                                        \
+	do                                                                         \
+	{                                                                          \
+		if (!(n = (expr)))                                                     \
+			return false;                                                      \
+		len += n;                                                              \
+	}                                                                          \
+	while (0)
+
+	H2_ENCODE (fh_hpack_encode_status (block, cap, response->status));
+	H2_ENCODE (fh_hpack_encode_field (block + len, cap - len, "server", 6,
+									  "freehttpd", 9));
+	H2_ENCODE (fh_hpack_encode_field (block + len, cap - len, "date", 4,
+									  fh_http_date_now (), 29));
+
+	if (response->content_type)
+		H2_ENCODE (fh_hpack_encode_field (block + len, cap - len,
+										  "content-type", 12,
+										  response->content_type,
+										  response->content_type_len));
+
+	if (response->encoding == FH_ENCODING_PLAIN)
+	{
+		char content_length[24];
+		int content_length_len
+			= snprintf (content_length, sizeof content_length, "%lu",
+						response->content_length);
+
+		H2_ENCODE (fh_hpack_encode_field (block + len, cap - len,
+										  "content-length", 14, content_length,
+										  (size_t) content_length_len));
+	}
+
+	if (response->headers)
+	{
+		for (const struct fh_header *h = response->headers->head; h;
+			 h = h->next)
+		{
+			if (fh_h2_is_connection_header (h->name, h->name_len, h->value,
+											h->value_len))
+				continue;
+
+			H2_ENCODE (fh_hpack_encode_field (block + len, cap - len, h->name,
+											  h->name_len, h->value,
+											  h->value_len));
+		}
+	}
+
+#undef H2_ENCODE
+
+	size_t off = 0;
+	uint8_t type = H2_FRAME_HEADERS;
+
+	do
+	{
+		const size_t chunk = len - off < ctx->remote.max_frame_size
+								 ? len - off
+								 : ctx->remote.max_frame_size;
+		uint8_t flags = off + chunk == len ? H2_FLAG_END_HEADERS : 0;
+
+		if (type == H2_FRAME_HEADERS && end_stream)
+			flags |= H2_FLAG_END_STREAM;
+
+		uint8_t *payload
+			= fh_h2_frame_begin (ctx, type, flags, stream->id, (uint32_t) chunk);
+
+		if (!payload)
+			return false;
+
+		memcpy (payload, block + off, chunk);
+		off += chunk;
+		type = H2_FRAME_CONTINUATION;
+	}
+	while (off < len);
+
+	fh_stats_mark (&stream->timing, FH_STATS_MARK_HEADERS);
+	stream->headers_sent = true;
+	stream->end_stream_sent = end_stream;
+	return true;
+}
+
+/* Fills one DATA frame of at most `avail' bytes from the stream's links.
+   Returns 1 if a frame was queued, 0 if there was nothing to send and -1
+   on errors.  */
+static int
+fh_h2_send_data (struct fh_h2_ctx *ctx, struct h2_stream *stream,
+				 size_t avail)
+{
+	struct fh_response *response = &stream->response;
+
+	if (!stream->link)
+	{
+		if (!response->body_start && response->pull
+			&& !response->pull (response))
+			return -1;
+
+		struct fh_link *in = response->body_start;
+
+		/* More of the body is yet to come from the handler.  */
+		if (!in && response->pull)
+			return 0;
+
+		if (!in && !fh_filter_pending (response))
+		{
+			/* The body ended without an end-of-stream marker.  */
+			if (!fh_h2_frame_begin (ctx, H2_FRAME_DATA, H2_FLAG_END_STREAM,
+									stream->id, 0))
+				return -1;
+
+			stream->end_stream_sent = true;
+			return 1;
+		}
+
+		response->body_start = NULL;
+
+		if (fh_filter_run (response, in, &stream->link) == FH_FILTER_ERROR)
+			return -1;
+
+		if (!stream->link)
+			return 0;
+	}
+
+	if (!fh_h2_out_reserve (ctx, H2_FRAME_HEADER_SIZE + avail))
+		return -1;
+
+	uint8_t *frame = ctx->out + ctx->out_len;
+	uint8_t *payload = frame + H2_FRAME_HEADER_SIZE;
+	size_t len = 0;
+	bool eos = false, from_file = false;
+
+	while (stream->link && len < avail)
+	{
+		struct fh_link *link = stream->link;
+		struct fh_buf *buf = link->buf;
+
+		if (buf->type == FH_BUF_FILE && fh_h2_can_sendfile (ctx))
+		{
+			/* A frame with a file payload carries nothing else, so that
+			   its payload can go straight from the file to the socket.  */
+			if (len > 0)
+				break;
+
+			len = avail < buf->attrs.file.file_len ? avail
+												   : buf->attrs.file.file_len;
+
+			if (len == 0)
+			{
+				close (buf->attrs.file.file_fd);
+				buf->attrs.file.file_fd = -1;
+			}
+			else
+			{
+				from_file = true;
+				ctx->file_fd = buf->attrs.file.file_fd;
+				ctx->file_off = buf->attrs.file.file_off;
+				ctx->file_len = len;
+				buf->attrs.file.file_off += len;
+				buf->attrs.file.file_len -= len;
+
+				if (buf->attrs.file.file_len > 0)
+				{
+					ctx->file_stream = stream;
+					break;
+				}
+
+				ctx->file_owned = true;
+				buf->attrs.file.file_fd = -1;
+			}
+		}
+		else if (buf->type == FH_BUF_FILE)
+		{
+			size_t want = avail - len < buf->attrs.file.file_len
+							  ? avail - len
+							  : buf->attrs.file.file_len;
+			ssize_t got = want ? pread (buf->attrs.file.file_fd, payload + len,
+										want, (off_t) buf->attrs.file.file_off)
+							   : 0;
+
+			if (got < 0 && errno == EINTR)
+				continue;
+
+			if (got < 0 || (want && got == 0))
+				return -1;
+
+			len += (size_t) got;
+			buf->attrs.file.file_off += (size_t) got;
+			buf->attrs.file.file_len -= (size_t) got;
+
+			if (buf->attrs.file.file_len > 0)
+				break;
+
+			close (buf->attrs.file.file_fd);
+			buf->attrs.file.file_fd = -1;
+		}
+		else
+		{
+			size_t n = avail - len < buf->attrs.mem.len ? avail - len
+														: buf->attrs.mem.len;
+
+			memcpy (payload + len, buf->attrs.mem.data, n);
+			buf->attrs.mem.data += n;
+			buf->attrs.mem.len -= n;
+			len += n;
+
+			if (buf->attrs.mem.len > 0)
+				break;
+		}
+
+		if (link->is_eos)
+		{
+			eos = true;
+			stream->link = NULL;
+			break;
+		}
+
+		stream->link = link->next;
+
+		if (from_file)
+			break;
+	}
+
+	if (!len && !eos)
+		return 0;
+
+	h2_write_frame_header (frame, (uint32_t) len, H2_FRAME_DATA,
+						   eos ? H2_FLAG_END_STREAM : 0, stream->id);
+	ctx->out_len += H2_FRAME_HEADER_SIZE + (from_file ? 0 : len);
+
+	if (from_file)
+		ctx->file_at = ctx->out_len;
+
+	ctx->send_window -= (int64_t) len;
+	stream->send_window -= (int64_t) len;
+	stream->deficit -= (int64_t) len;
+	stream->bytes_sent += len;
+	stream->end_stream_sent = eos;
+	return 1;
+}
+
+static int
+fh_h2_stream_produce (struct fh_h2_ctx *ctx, struct h2_stream *stream)
+{
+	struct fh_response *response = &stream->response;
+
+	if (!stream->headers_sent)
+	{
+		/* The handler completes the response later, e.g. a proxied one
+		   once the upstream server has answered.  */
+		if (response->headers_pending)
+			return 0;
+
+		if (response->use_default_error_response
+			&& !fh_h2_use_error_page (ctx, stream))
+			return -1;
+
+		const bool has_body = fh_h2_response_has_body (response);
+
+		if (!fh_h2_send_headers (ctx, stream, !has_body))
+			return -1;
+
+		return 1;
+	}
+
+	int64_t avail = ctx->send_window < stream->send_window
+						? ctx->send_window
+						: stream->send_window;
+
+	if (avail > ctx->remote.max_frame_size)
+		avail = ctx->remote.max_frame_size;
+
+	/* An exhausted window still allows an empty DATA frame to end the
+	   stream, but there is no way to tell that in advance.  */
+	if (avail <= 0)
+		return 0;
+
+	return fh_h2_send_data (ctx, stream, (size_t) avail);
+}
+
+/* Picks the stream to send the next DATA frame for.  The most urgent
+   level wins.  Within it, non-incremental streams go one at a time, in
+   stream order, and incremental ones take turns, each sending up to
+   weight * H2_WEIGHT_QUANTUM bytes per turn (deficit round-robin).  */
+static struct h2_stream *
+fh_h2_sched_pick (struct fh_h2_ctx *ctx)
+{
+	struct h2_stream *best = NULL;
+
+	for (struct h2_stream *stream = ctx->stream_head; stream;
+		 stream = stream->next)
+	{
+		if (!stream->has_response || stream->blocked)
+			continue;
+
+		if (!best || stream->urgency < best->urgency
+			|| (stream->urgency == best->urgency && !stream->incremental
+				&& best->incremental))
+			best = stream;
+	}
+
+	if (!best || !best->incremental)
+		return best;
+
+	const uint8_t urgency = best->urgency;
+
+	for (;;)
+	{
+		struct h2_stream *start
+			= ctx->sched_next ? ctx->sched_next : ctx->stream_head;
+		struct h2_stream *stream = start;
+
+		do
+		{
+			if (stream->has_response && !stream->blocked
+				&& stream->urgency == urgency && stream->deficit > 0)
+			{
+				ctx->sched_next = stream;
+				return stream;
+			}
+
+			stream = stream->next ? stream->next : ctx->stream_head;
+		}
+		while (stream != start);
+
+		/* Everyone used up their share; start a new round.  */
+		for (stream = ctx->stream_head; stream; stream = stream->next)
+		{
+			if (stream->has_response && !stream->blocked
+				&& stream->urgency == urgency)
+				stream->deficit += (int64_t) stream->weight * H2_WEIGHT_QUANTUM;
+		}
+	}
+}
+
+/* Queues one frame for the stream, and takes care of its end.  Returns
+   false on connection errors.  */
+static bool
+fh_h2_stream_step (struct fh_h2_ctx *ctx, struct h2_stream *stream,
+				   bool *sent_ptr)
+{
+	int rc = fh_h2_stream_produce (ctx, stream);
+
+	*sent_ptr = rc != 0;
+
+	if (rc < 0)
+		return fh_h2_stream_error (ctx, stream->id, H2_INTERNAL_ERROR);
+
+	if (rc == 0)
+		stream->blocked = true;
+
+	/* The turn passes on once the stream's share is used up.  */
+	if (ctx->sched_next == stream && stream->deficit <= 0)
+		ctx->sched_next = stream->next;
+
+	if (stream->end_stream_sent)
+	{
+		fh_pr_debug ("Connection #%lu: stream %u done", ctx->conn->id,
+					 stream->id);
+		fh_h2_stream_close (ctx, stream);
+	}
+
+	return true;
+}
+
+/* Queues frames until the output buffer is full or nothing can be sent.
+   While the payload of a file-backed frame is pending, no DATA frames
+   are added after it.  */
+static bool
+fh_h2_produce (struct fh_h2_ctx *ctx, bool *progress_ptr)
+{
+	bool progress = false, sent;
+
+	/* Response headers are small and not flow controlled, so they go out
+	   right away, whatever the priority of their stream.  */
+	for (struct h2_stream *stream = ctx->stream_head, *next; stream;
+		 stream = next)
+	{
+		next = stream->next;
+		stream->blocked = false;
+
+		if (!stream->has_response || stream->headers_sent)
+			continue;
+
+		if (!fh_h2_stream_step (ctx, stream, &sent))
+			return false;
+
+		progress |= sent;
+	}
+
+	while (!ctx->file_len && fh_h2_out_pending (ctx) < H2_OUTPUT_HIGH_WATER)
+	{
+		struct h2_stream *stream = fh_h2_sched_pick (ctx);
+
+		if (!stream)
+			break;
+
+		if (!fh_h2_stream_step (ctx, stream, &sent))
+			return false;
+
+		progress |= sent;
+	}
+
+	*progress_ptr = progress;
+	return true;
+}
+
+bool
+fh_h2_send (struct fh_h2_ctx *ctx)
+{
+	for (;;)
+	{
+		bool progress = false;
+
+		if (!fh_h2_produce (ctx, &progress))
+			return false;
+
+		/* Output left over from an earlier call may have been all that
+		   kept the scheduler from producing more.  */
+		const size_t pending = fh_h2_out_pending (ctx);
+
+		if (!fh_h2_flush (ctx))
+		{
+			fh_pr_debug ("Connection #%lu: send failed: %s", ctx->conn->id,
+						 strerror (errno));
+			return false;
+		}
+
+		if (fh_h2_out_pending (ctx) || (!progress && !pending))
+			return true;
+	}
+}
@@ -20,9 +20,47 @@
 #ifndef FH_H2_H
 #define FH_H2_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 
+#include "core/stats.h"
+#include "core/stream.h"
+#include "hpack.h"
+#include "mm/pool.h"
+#include "protocol.h"
+
+#define H2_FRAME_HEADER_SIZE 9
+#define H2_DEFAULT_WINDOW_SIZE 65535
+#define H2_MAX_WINDOW_SIZE 0x7FFFFFFF
+#define H2_DEFAULT_FRAME_SIZE 16384
+#define H2_MAX_FRAME_SIZE 0xFFFFFF
+#define H2_MAX_CONCURRENT_STREAMS 128
+#define H2_MAX_HEADER_BLOCK_SIZE 65536
+#define H2_MAX_REQUEST_BODY_SIZE (1 << 20)
+/* Connection window for request bodies.  Buffered bodies hold on to their
+   share of it until their stream is closed, which bounds what all the
+   streams of a connection can buffer together.  */
+#define H2_CONN_RECV_WINDOW (4 << 20)
+/* Frames are only generated while less than this is waiting to be
+   written.  */
+#define H2_OUTPUT_HIGH_WATER 65536
+/* A peer that keeps sending frames which need an answer (PING, SETTINGS,
+   DATA) while this much is still waiting to be written is not reading,
+   and the connection is closed with ENHANCE_YOUR_CALM.  */
+#define H2_OUTPUT_LIMIT (1 << 20)
+/* Bytes that one call of fh_h2_recv() reads before it lets the other
+   connections of the worker have a turn */
+#define H2_RECV_BUDGET (256 << 10)
+
+/* RFC 9218 urgency levels, 0 being the most urgent */
+#define H2_DEFAULT_URGENCY 3
+#define H2_MAX_URGENCY 7
+/* RFC 7540 weights share the bandwidth of streams with the same urgency;
+   a stream may send weight * H2_WEIGHT_QUANTUM bytes per round.  */
+#define H2_DEFAULT_WEIGHT 16
+#define H2_WEIGHT_QUANTUM 1024
+
 enum h2_frame_type
 {
 	H2_FRAME_DATA = 0x0,
@@ -35,6 +73,34 @@ enum h2_frame_type
 	H2_FRAME_GOAWAY,
 	H2_FRAME_WINDOW_UPDATE,
 	H2_FRAME_CONTINUATION,
+	H2_FRAME_PRIORITY_UPDATE = 0x10,
+};
+
+enum h2_frame_flags
+{
+	H2_FLAG_ACK = 0x1,
+	H2_FLAG_END_STREAM = 0x1,
+	H2_FLAG_END_HEADERS = 0x4,
+	H2_FLAG_PADDED = 0x8,
+	H2_FLAG_PRIORITY = 0x20
+};
+
+enum h2_error_code
+{
+	H2_NO_ERROR = 0x0,
+	H2_PROTOCOL_ERROR,
+	H2_INTERNAL_ERROR,
+	H2_FLOW_CONTROL_ERROR,
+	H2_SETTINGS_TIMEOUT,
+	H2_STREAM_CLOSED,
+	H2_FRAME_SIZE_ERROR,
+	H2_REFUSED_STREAM,
+	H2_CANCEL,
+	H2_COMPRESSION_ERROR,
+	H2_CONNECT_ERROR,
+	H2_ENHANCE_YOUR_CALM,
+	H2_INADEQUATE_SECURITY,
+	H2_HTTP_1_1_REQUIRED
 };
 
 struct h2_frame_header
@@ -47,7 +113,7 @@ struct h2_frame_header
 
 enum h2_settings_type
 {
-	SETTINGS_HEADER_TABLE_SIZE = 0x0,
+	SETTINGS_HEADER_TABLE_SIZE = 0x1,
 	SETTINGS_ENABLE_PUSH,
 	SETTINGS_MAX_CONCURRENT_STREAMS,
 	SETTINGS_INITIAL_WINDOW_SIZE,
@@ -57,23 +123,136 @@ enum h2_settings_type
 
 struct h2_settings
 {
-	size_t header_table_size;
-	size_t initial_window_size;
-	size_t max_frame_size;
-	size_t max_header_list_size;
+	uint32_t header_table_size;
+	uint32_t initial_window_size;
+	uint32_t max_frame_size;
+	uint32_t max_header_list_size;
+	uint32_t max_concurrent_streams;
 	bool enable_push;
-	uint8_t max_concurrent_streams;
+};
+
+enum h2_stream_state
+{
+	H2_STREAM_STATE_OPEN,
+	H2_STREAM_STATE_HALF_CLOSED_REMOTE,
+	H2_STREAM_STATE_CLOSED
 };
 
 struct h2_stream
 {
-	size_t id;
+	uint32_t id;
+	uint8_t state;
+	bool refused : 1;
+	bool headers_sent : 1;
+	bool end_stream_sent : 1;
+	bool has_response : 1;
+	bool pseudo_done : 1;
+	bool malformed : 1;
+	bool has_content_length : 1;
+	bool incremental : 1;
+	/* Could not send anything during the current scheduling pass */
+	bool blocked : 1;
+	/* Respond with the default error page instead of calling the handler */
+	uint16_t error_status;
+
+	uint8_t urgency;
+	uint16_t weight;
+	/* Bytes the stream may still send in the current round */
+	int64_t deficit;
+
+	/* Flow control windows; the send window may go negative after a
+	   SETTINGS_INITIAL_WINDOW_SIZE change.  */
+	int64_t send_window;
+	int64_t recv_window;
+
+	pool_t *pool;
+	struct fh_request request;
+	struct fh_response response;
+	struct fh_link *body_tail;
+	/* Bytes of the body buffered so far, which have not been given back
+	   to the connection window yet */
+	size_t body_size;
+	/* Output of the response filters that is yet to be framed */
+	struct fh_link *link;
+	/* The first byte is the HEADERS frame that opened the stream */
+	struct fh_stats_timing timing;
+	/* Payload of the DATA frames sent */
+	uint64_t bytes_sent;
+
+	struct h2_stream *prev;
+	struct h2_stream *next;
 };
 
+struct fh_conn;
+
+/* Produces the response for a complete request.  Returning false resets
+   the stream.  */
+typedef bool (*fh_h2_request_handler_t) (void *data, struct fh_conn *conn,
+										 const struct fh_request *request,
+										 struct fh_response *response);
+
 struct fh_h2_ctx
 {
+	struct fh_conn *conn;
+	struct h2_settings local;
+	struct h2_settings remote;
+	struct fh_hpack_decoder decoder;
+
+	fh_h2_request_handler_t handler;
+	void *handler_data;
+
 	struct h2_stream *stream_head;
 	struct h2_stream *stream_tail;
+	size_t stream_count;
+	uint32_t last_stream_id;
+	/* Bit n is set if stream last_stream_id - 2n was opened rather than
+	   skipped; older streams count as skipped.  */
+	uint64_t opened_streams;
+
+	int64_t send_window;
+	int64_t recv_window;
+
+	/* Frames read from the peer, at most one frame plus a partial one */
+	uint8_t *in;
+	size_t in_len, in_cap;
+
+	/* HEADERS and CONTINUATION fragments being assembled */
+	uint8_t *header_block;
+	size_t header_block_len;
+	uint32_t header_stream_id;
+	uint8_t header_flags;
+
+	/* Serialized frames not written yet, starting at out_off */
+	uint8_t *out;
+	size_t out_len, out_off, out_cap;
+
+	/* The payload of a file-backed DATA frame, sent with sendfile() once
+	   the output up to file_at is written.  The descriptor is borrowed
+	   from the body of file_stream, unless file_owned is set.  */
+	fd_t file_fd;
+	size_t file_off, file_len, file_at;
+	struct h2_stream *file_stream;
+	bool file_owned;
+
+	/* Where the scheduler resumes its round-robin */
+	struct h2_stream *sched_next;
+
+	bool preface_received : 1;
+	bool goaway_sent : 1;
+	bool goaway_received : 1;
+	/* fh_h2_recv() stopped at H2_RECV_BUDGET with input possibly left */
+	bool recv_more : 1;
 };
 
+struct fh_h2_ctx *fh_h2_ctx_create (struct fh_conn *conn,
+									fh_h2_request_handler_t handler,
+									void *handler_data);
+void fh_h2_ctx_destroy (struct fh_h2_ctx *ctx);
+/* Processes bytes that were read past the client preface before the
+   context existed.  */
+bool fh_h2_feed (struct fh_h2_ctx *ctx, const uint8_t *data, size_t len);
+bool fh_h2_recv (struct fh_h2_ctx *ctx);
+bool fh_h2_send (struct fh_h2_ctx *ctx);
+bool fh_h2_done (const struct fh_h2_ctx *ctx);
+
 #endif /* FH_H2_H */
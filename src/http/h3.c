@@ -0,0 +1,2068 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <nghttp3/nghttp3.h>
+#include <ngtcp2/ngtcp2.h>
+#include <ngtcp2/ngtcp2_crypto.h>
+#include <ngtcp2/ngtcp2_crypto_quictls.h>
+#include <openssl/ssl.h>
+
+#define FH_LOG_MODULE_NAME "http/h3"
+
+#include "compat.h"
+#include "core/accesslog.h"
+#include "core/conn.h"
+#include "core/quic.h"
+#include "core/server.h"
+#include "core/stats.h"
+#include "core/tls.h"
+#include "filter.h"
+#include "h3.h"
+#include "hash/itable.h"
+#include "log/log.h"
+#include "utils/strutils.h"
+
+/* Largest UDP payload sent; what fits into an Ethernet frame with IPv4 */
+#define H3_MAX_PACKET_SIZE 1472
+#define H3_TX_SLOT_SIZE (H3_MAX_GSO_SEGMENTS * H3_MAX_PACKET_SIZE)
+#define H3_IDLE_TIMEOUT (30 * NGTCP2_SECONDS)
+
+static const struct
+{
+	const char *name;
+	size_t len;
+	enum fh_method method;
+} h3_methods[] = {
+	{ "GET", 3, FH_METHOD_GET },		 { "HEAD", 4, FH_METHOD_HEAD },
+	{ "POST", 4, FH_METHOD_POST },		 { "PUT", 3, FH_METHOD_PUT },
+	{ "DELETE", 6, FH_METHOD_DELETE },	 { "OPTIONS", 7, FH_METHOD_OPTIONS },
+	{ "PATCH", 5, FH_METHOD_PATCH },	 { "CONNECT", 7, FH_METHOD_CONNECT },
+	{ "TRACE", 5, FH_METHOD_TRACE },
+};
+
+/* Response data handed to nghttp3, which refers to it until the peer
+   acknowledged it.  */
+struct h3_chunk
+{
+	struct h3_chunk *next;
+	size_t len;
+	uint8_t data[];
+};
+
+struct h3_conn;
+
+struct h3_stream
+{
+	int64_t id;
+	struct h3_conn *hc;
+	pool_t *pool;
+
+	struct fh_request request;
+	struct fh_response response;
+	const char *method;
+	size_t method_len;
+	enum fh_status error_status;
+	bool have_scheme : 1;
+	bool eof : 1;
+	/* read_data() returned NGHTTP3_ERR_WOULDBLOCK */
+	bool blocked : 1;
+
+	struct fh_link *body_tail;
+	size_t body_size;
+
+	/* Output of the response filters that is yet to be copied */
+	struct fh_link *link;
+	struct h3_chunk *chunk_head;
+	struct h3_chunk *chunk_tail;
+	/* Bytes of chunk_head the peer acknowledged */
+	size_t chunk_acked;
+	size_t unacked;
+	/* The body is complete once the peer acknowledged all of it */
+	struct fh_stats_timing timing;
+	/* Body bytes handed to nghttp3 */
+	uint64_t bytes_sent;
+
+	struct h3_stream *prev;
+	struct h3_stream *next;
+};
+
+struct h3_conn
+{
+	/* What the TLS callbacks of ngtcp2 get from SSL_get_app_data() */
+	ngtcp2_crypto_conn_ref conn_ref;
+	struct fh_h3 *h3;
+	ngtcp2_conn *quic;
+	nghttp3_conn *http;
+	SSL *ssl;
+	struct fh_conn *conn;
+	struct sockaddr_in local;
+	struct sockaddr_in remote;
+
+	/* The connection ID the client picked for its first Initial packet */
+	uint8_t odcid[NGTCP2_MAX_CIDLEN];
+	size_t odcid_len;
+
+	ngtcp2_ccerr ccerr;
+	/* CONNECTION_CLOSE packet, repeated while in the closing period */
+	uint8_t *close_pkt;
+	size_t close_pkt_len;
+	size_t close_recv_count;
+	bool closing : 1;
+	bool draining : 1;
+	bool write_pending : 1;
+
+	ngtcp2_tstamp expiry;
+	size_t heap_index;
+	struct h3_conn *next_pending;
+
+	struct h3_stream *stream_head;
+};
+
+struct fh_h3
+{
+	struct fh_server *server;
+	fd_t sockfd;
+	fd_t timerfd;
+	uint16_t port;
+	size_t worker;
+	fh_h3_request_handler_t handler;
+	void *handler_data;
+
+	/* (uint64_t connection ID hash) => (struct h3_conn *) */
+	struct itable *cids;
+	/* Connections by their next timer, a binary min-heap */
+	struct h3_conn **heap;
+	size_t heap_len, heap_cap;
+	ngtcp2_tstamp armed;
+	/* Connections that have something to send once input is processed */
+	struct h3_conn *pending;
+
+	uint8_t reset_secret[32];
+
+	uint8_t *rx_buf;
+	struct fh_quic_batch rx;
+	uint8_t *tx_buf;
+	struct fh_quic_batch tx;
+};
+
+static void h3_conn_free (struct h3_conn *hc);
+static void h3_conn_start_closing (struct h3_conn *hc);
+
+static ngtcp2_tstamp
+h3_now (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (ngtcp2_tstamp) ts.tv_sec * NGTCP2_SECONDS
+		   + (ngtcp2_tstamp) ts.tv_nsec;
+}
+
+static ngtcp2_path
+h3_conn_path (struct h3_conn *hc)
+{
+	return (ngtcp2_path) {
+		.local = {
+			.addr = (ngtcp2_sockaddr *) &hc->local,
+			.addrlen = sizeof (hc->local),
+		},
+		.remote = {
+			.addr = (ngtcp2_sockaddr *) &hc->remote,
+			.addrlen = sizeof (hc->remote),
+		},
+	};
+}
+
+/* Timers */
+
+static inline void
+h3_heap_swap (struct fh_h3 *h3, size_t a, size_t b)
+{
+	struct h3_conn *tmp = h3->heap[a];
+
+	h3->heap[a] = h3->heap[b];
+	h3->heap[b] = tmp;
+	h3->heap[a]->heap_index = a;
+	h3->heap[b]->heap_index = b;
+}
+
+static void
+h3_heap_fix (struct fh_h3 *h3, size_t i)
+{
+	while (i > 0 && h3->heap[(i - 1) / 2]->expiry > h3->heap[i]->expiry)
+	{
+		h3_heap_swap (h3, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+
+	for (;;)
+	{
+		size_t min = i, l = 2 * i + 1, r = 2 * i + 2;
+
+		if (l < h3->heap_len && h3->heap[l]->expiry < h3->heap[min]->expiry)
+			min = l;
+
+		if (r < h3->heap_len && h3->heap[r]->expiry < h3->heap[min]->expiry)
+			min = r;
+
+		if (min == i)
+			return;
+
+		h3_heap_swap (h3, i, min);
+		i = min;
+	}
+}
+
+static bool
+h3_heap_push (struct fh_h3 *h3, struct h3_conn *hc)
+{
+	if (h3->heap_len == h3->heap_cap)
+	{
+		size_t cap = h3->heap_cap ? h3->heap_cap * 2 : 64;
+		struct h3_conn **heap = realloc (h3->heap, cap * sizeof (*heap));
+
+		if (!heap)
+			return false;
+
+		h3->heap = heap;
+		h3->heap_cap = cap;
+	}
+
+	hc->heap_index = h3->heap_len;
+	h3->heap[h3->heap_len++] = hc;
+	h3_heap_fix (h3, hc->heap_index);
+	return true;
+}
+
+static void
+h3_heap_remove (struct fh_h3 *h3, struct h3_conn *hc)
+{
+	size_t i = hc->heap_index;
+
+	if (i >= h3->heap_len)
+		return;
+
+	h3->heap_len--;
+
+	if (i != h3->heap_len)
+	{
+		h3->heap[i] = h3->heap[h3->heap_len];
+		h3->heap[i]->heap_index = i;
+		h3_heap_fix (h3, i);
+	}
+
+	hc->heap_index = SIZE_MAX;
+}
+
+static void
+h3_conn_update_timer (struct h3_conn *hc)
+{
+	hc->expiry = hc->closing || hc->draining
+					 ? hc->expiry
+					 : ngtcp2_conn_get_expiry (hc->quic);
+	h3_heap_fix (hc->h3, hc->heap_index);
+}
+
+static void
+h3_arm_timer (struct fh_h3 *h3)
+{
+	ngtcp2_tstamp expiry = h3->heap_len ? h3->heap[0]->expiry : UINT64_MAX;
+
+	if (expiry == h3->armed)
+		return;
+
+	/* A zero it_value would disarm the timer rather than fire it.  */
+	struct itimerspec spec = { 0 };
+
+	if (expiry != UINT64_MAX)
+	{
+		expiry = expiry ? expiry : 1;
+		spec.it_value.tv_sec = (time_t) (expiry / NGTCP2_SECONDS);
+		spec.it_value.tv_nsec = (long) (expiry % NGTCP2_SECONDS);
+	}
+
+	if (timerfd_settime (h3->timerfd, TFD_TIMER_ABSTIME, &spec, NULL) < 0)
+	{
+		fh_pr_err ("timerfd_settime() failed: %s", strerror (errno));
+		return;
+	}
+
+	h3->armed = expiry;
+}
+
+/* Connection IDs */
+
+static bool
+h3_cid_add (struct fh_h3 *h3, const uint8_t *cid, size_t len,
+			struct h3_conn *hc)
+{
+	uint64_t key = fh_quic_cid_hash (cid, len);
+
+	/* Never let a client-chosen ID take over the entry of another
+	   connection.  */
+	if (itable_contains (h3->cids, key))
+		return false;
+
+	return itable_set (h3->cids, key, hc);
+}
+
+static void
+h3_cid_remove (struct fh_h3 *h3, const uint8_t *cid, size_t len,
+			   const struct h3_conn *hc)
+{
+	uint64_t key = fh_quic_cid_hash (cid, len);
+
+	if (itable_get (h3->cids, key) == hc)
+		itable_remove (h3->cids, key);
+}
+
+/* Datagrams */
+
+static void
+h3_tx_flush (struct fh_h3 *h3)
+{
+	if (!h3->tx.count)
+		return;
+
+	if (fh_quic_send_batch (h3->sockfd, &h3->tx) < 0)
+		fh_pr_debug ("sendmmsg() failed: %s", strerror (errno));
+
+	h3->tx.count = 0;
+}
+
+static inline uint8_t *
+h3_tx_slot (struct fh_h3 *h3)
+{
+	return h3->tx_buf + h3->tx.count * H3_TX_SLOT_SIZE;
+}
+
+/* Queues the datagram that was built in the current slot.  */
+static void
+h3_tx_push (struct fh_h3 *h3, const ngtcp2_path *path, size_t len,
+			size_t segment_size)
+{
+	struct fh_quic_datagram *datagram = &h3->tx.datagrams[h3->tx.count];
+
+	datagram->data = h3_tx_slot (h3);
+	datagram->len = len;
+	datagram->segment_size = segment_size < len ? segment_size : 0;
+	fh_stats_add (bytes_out, len);
+	memcpy (&datagram->remote, path->remote.addr, sizeof (datagram->remote));
+	datagram->local
+		= ((const struct sockaddr_in *) path->local.addr)->sin_addr;
+
+	if (++h3->tx.count == FH_QUIC_BATCH_SIZE)
+		h3_tx_flush (h3);
+}
+
+static void
+h3_send_version_negotiation (struct fh_h3 *h3,
+							 const struct fh_quic_datagram *in,
+							 const struct fh_quic_header *header)
+{
+	const uint32_t versions[] = { NGTCP2_PROTO_VER_V1, NGTCP2_PROTO_VER_V2 };
+	uint8_t *out = h3_tx_slot (h3);
+	size_t len = fh_quic_write_version_negotiation (
+		out, H3_TX_SLOT_SIZE, header, versions,
+		sizeof (versions) / sizeof (versions[0]));
+
+	if (!len)
+		return;
+
+	struct sockaddr_in local = {
+		.sin_family = AF_INET,
+		.sin_port = htons (h3->port),
+		.sin_addr = in->local,
+	};
+	struct sockaddr_in remote = in->remote;
+	const ngtcp2_path path = {
+		.local = { (ngtcp2_sockaddr *) &local, sizeof (local) },
+		.remote = { (ngtcp2_sockaddr *) &remote, sizeof (remote) },
+	};
+
+	h3_tx_push (h3, &path, len, 0);
+}
+
+/* Streams */
+
+static struct h3_stream *
+h3_stream_create (struct h3_conn *hc, int64_t stream_id)
+{
+	pool_t *pool = fh_pool_create (0);
+
+	if (!pool)
+		return NULL;
+
+	struct h3_stream *stream = fh_pool_alloc (pool, sizeof (*stream));
+
+	if (!stream)
+	{
+		fh_pool_destroy (pool);
+		return NULL;
+	}
+
+	memset (stream, 0, sizeof (*stream));
+	stream->id = stream_id;
+	stream->hc = hc;
+	stream->pool = pool;
+	fh_stats_mark (&stream->timing, FH_STATS_MARK_FIRST_BYTE);
+
+	fh_headers_init (&stream->request.headers);
+	stream->request.pool = pool;
+	stream->request.conn = hc->conn;
+	stream->request.protocol = FH_PROTOCOL_H3;
+	fh_response_init (&stream->response, pool);
+	stream->response.protocol = FH_PROTOCOL_H3;
+
+	stream->next = hc->stream_head;
+
+	if (hc->stream_head)
+		hc->stream_head->prev = stream;
+
+	hc->stream_head = stream;
+	fh_conn_request_begin (hc->conn);
+	return stream;
+}
+
+static void
+h3_stream_free (struct h3_stream *stream)
+{
+	struct h3_conn *hc = stream->hc;
+
+	if (stream->prev)
+		stream->prev->next = stream->next;
+	else
+		hc->stream_head = stream->next;
+
+	if (stream->next)
+		stream->next->prev = stream->prev;
+
+	fh_conn_request_end (hc->conn);
+	fh_stats_record (&stream->timing);
+
+	if (stream->response.status)
+		fh_access_log (hc->conn, &stream->request, stream->response.status,
+					   stream->bytes_sent, &stream->timing);
+
+	while (stream->chunk_head)
+	{
+		struct h3_chunk *chunk = stream->chunk_head;
+
+		stream->chunk_head = chunk->next;
+		free (chunk);
+	}
+
+	fh_link_release (stream->link);
+	fh_link_release (stream->response.body_start);
+	fh_response_cleanup (&stream->response);
+	fh_pool_destroy (stream->pool);
+}
+
+static void
+h3_stream_ack (struct h3_stream *stream, uint64_t len)
+{
+	stream->chunk_acked += len;
+
+	while (stream->chunk_head
+		   && stream->chunk_acked >= stream->chunk_head->len)
+	{
+		struct h3_chunk *chunk = stream->chunk_head;
+
+		stream->chunk_acked -= chunk->len;
+		stream->unacked -= chunk->len;
+		stream->chunk_head = chunk->next;
+		free (chunk);
+	}
+
+	if (!stream->chunk_head)
+		stream->chunk_tail = NULL;
+}
+
+/* Copies the next piece of the response body into `chunk'.  Returns false
+   on errors.  */
+static bool
+h3_stream_fill (struct h3_stream *stream, struct h3_chunk *chunk)
+{
+	struct fh_response *response = &stream->response;
+
+	while (chunk->len < H3_CHUNK_SIZE && !stream->eof)
+	{
+		if (!stream->link)
+		{
+			struct fh_link *in = response->body_start;
+
+			/* The body ended without an end-of-stream marker.  */
+			if (!in && !fh_filter_pending (response))
+			{
+				stream->eof = true;
+				break;
+			}
+
+			response->body_start = NULL;
+
+			if (fh_filter_run (response, in, &stream->link) == FH_FILTER_ERROR)
+				return false;
+
+			continue;
+		}
+
+		struct fh_link *link = stream->link;
+		struct fh_buf *buf = link->buf;
+		size_t room = H3_CHUNK_SIZE - chunk->len;
+
+		if (buf->type == FH_BUF_FILE)
+		{
+			size_t want = room < buf->attrs.file.file_len
+							  ? room
+							  : buf->attrs.file.file_len;
+			ssize_t got
+				= want ? pread (buf->attrs.file.file_fd, chunk->data + chunk->len,
+								want, (off_t) buf->attrs.file.file_off)
+					   : 0;
+
+			if (got < 0 && errno == EINTR)
+				continue;
+
+			if (got < 0 || (want && got == 0))
+				return false;
+
+			chunk->len += (size_t) got;
+			buf->attrs.file.file_off += (size_t) got;
+			buf->attrs.file.file_len -= (size_t) got;
+
+			if (buf->attrs.file.file_len > 0)
+				continue;
+
+			close (buf->attrs.file.file_fd);
+			buf->attrs.file.file_fd = -1;
+		}
+		else
+		{
+			size_t n = room < buf->attrs.mem.len ? room : buf->attrs.mem.len;
+
+			memcpy (chunk->data + chunk->len, buf->attrs.mem.data, n);
+			buf->attrs.mem.data += n;
+			buf->attrs.mem.len -= n;
+			chunk->len += n;
+
+			if (buf->attrs.mem.len > 0)
+				continue;
+		}
+
+		if (link->is_eos)
+		{
+			stream->eof = true;
+			stream->link = NULL;
+			break;
+		}
+
+		stream->link = link->next;
+	}
+
+	return true;
+}
+
+static nghttp3_ssize
+h3_read_data (nghttp3_conn *http, int64_t stream_id, nghttp3_vec *vec,
+			  size_t veccnt, uint32_t *pflags, void *conn_user_data,
+			  void *stream_user_data)
+{
+	struct h3_stream *stream = stream_user_data;
+
+	(void) http;
+	(void) stream_id;
+	(void) veccnt;
+	(void) conn_user_data;
+
+	if (stream->unacked >= H3_STREAM_HIGH_WATER)
+	{
+		stream->blocked = true;
+		return NGHTTP3_ERR_WOULDBLOCK;
+	}
+
+	struct h3_chunk *chunk = malloc (sizeof (*chunk) + H3_CHUNK_SIZE);
+
+	if (!chunk)
+		return NGHTTP3_ERR_CALLBACK_FAILURE;
+
+	chunk->next = NULL;
+	chunk->len = 0;
+
+	if (!h3_stream_fill (stream, chunk))
+	{
+		free (chunk);
+		return NGHTTP3_ERR_CALLBACK_FAILURE;
+	}
+
+	if (stream->eof)
+		*pflags |= NGHTTP3_DATA_FLAG_EOF;
+
+	if (!chunk->len)
+	{
+		free (chunk);
+		return 0;
+	}
+
+	if (stream->chunk_tail)
+		stream->chunk_tail->next = chunk;
+	else
+		stream->chunk_head = chunk;
+
+	stream->chunk_tail = chunk;
+	stream->unacked += chunk->len;
+	stream->bytes_sent += chunk->len;
+
+	vec[0].base = chunk->data;
+	vec[0].len = chunk->len;
+	return 1;
+}
+
+static const nghttp3_data_reader h3_data_reader = { &h3_read_data };
+
+/* Connection-specific fields have no meaning in HTTP/3 (RFC 9114,
+   section 4.2).  */
+static bool
+h3_is_connection_header (const char *name, size_t name_len)
+{
+	static const struct
+	{
+		const char *name;
+		size_t len;
+	} names[] = {
+		{ "connection", 10 },	{ "keep-alive", 10 }, { "proxy-connection", 16 },
+		{ "transfer-encoding", 17 }, { "upgrade", 7 },
+	};
+
+	for (size_t i = 0; i < sizeof (names) / sizeof (names[0]); i++)
+	{
+		if (name_len == names[i].len
+			&& !strncasecmp (name, names[i].name, name_len))
+			return true;
+	}
+
+	return false;
+}
+
+static inline void
+h3_nv (nghttp3_nv *nv, const char *name, size_t name_len, const char *value,
+	   size_t value_len)
+{
+	nv->name = (uint8_t *) name;
+	nv->namelen = name_len;
+	nv->value = (uint8_t *) value;
+	nv->valuelen = value_len;
+	nv->flags = NGHTTP3_NV_FLAG_NONE;
+}
+
+static bool
+h3_submit_response (struct h3_conn *hc, struct h3_stream *stream)
+{
+	struct fh_response *response = &stream->response;
+	size_t cap = 5 + (response->headers ? response->headers->count : 0);
+	nghttp3_nv *nva = fh_pool_alloc (stream->pool, cap * sizeof (*nva));
+	char *status = fh_pool_alloc (stream->pool, 4);
+	char *content_length = fh_pool_alloc (stream->pool, 24);
+	size_t n = 0;
+
+	if (!nva || !status || !content_length)
+		return false;
+
+	fh_stats_response (response->status);
+
+	snprintf (status, 4, "%03u", (unsigned int) response->status);
+	h3_nv (&nva[n++], ":status", 7, status, 3);
+	h3_nv (&nva[n++], "server", 6, "freehttpd", 9);
+	h3_nv (&nva[n++], "date", 4, fh_http_date_now (), 29);
+
+	if (response->content_type)
+		h3_nv (&nva[n++], "content-type", 12, response->content_type,
+			   response->content_type_len);
+
+	if (response->encoding == FH_ENCODING_PLAIN)
+	{
+		int len = snprintf (content_length, 24, "%lu",
+							response->content_length);
+
+		h3_nv (&nva[n++], "content-length", 14, content_length, (size_t) len);
+	}
+
+	if (response->headers)
+	{
+		for (const struct fh_header *h = response->headers->head; h;
+			 h = h->next)
+		{
+			if (h3_is_connection_header (h->name, h->name_len))
+				continue;
+
+			/* Field names are lowercase on the wire.  */
+			char *name = fh_pool_alloc (stream->pool, h->name_len);
+
+			if (!name)
+				return false;
+
+			for (size_t i = 0; i < h->name_len; i++)
+				name[i] = (h->name[i] >= 'A' && h->name[i] <= 'Z')
+							  ? (char) (h->name[i] - 'A' + 'a')
+							  : h->name[i];
+
+			h3_nv (&nva[n++], name, h->name_len, h->value, h->value_len);
+		}
+	}
+
+	const bool has_body = !response->no_send_body
+						  && (response->use_default_error_response
+							  || response->content_length
+							  || response->encoding == FH_ENCODING_CHUNKED);
+
+	int rv = nghttp3_conn_submit_response (hc->http, stream->id, nva, n,
+										   has_body ? &h3_data_reader : NULL);
+
+	if (rv != 0)
+	{
+		fh_pr_err ("nghttp3_conn_submit_response: %s", nghttp3_strerror (rv));
+		return false;
+	}
+
+	fh_stats_mark (&stream->timing, FH_STATS_MARK_HEADERS);
+	return true;
+}
+
+static bool
+h3_use_error_page (struct h3_conn *hc, struct h3_stream *stream)
+{
+	struct fh_response *response = &stream->response;
+	struct fh_conn_extra *extra = hc->conn->extra;
+	size_t len = 0;
+	char *page = fh_response_error_page (stream->pool, response->status,
+										 extra->host, extra->host_len,
+										 extra->port, &len);
+
+	if (!page)
+		return false;
+
+	fh_link_release (response->body_start);
+	response->body_start
+		= fh_link_new_data (stream->pool, (const uint8_t *) page, len, true);
+
+	if (!response->body_start)
+		return false;
+
+	response->encoding = FH_ENCODING_PLAIN;
+	response->content_length = len;
+	response->content_type = "text/html; charset=UTF-8";
+	response->content_type_len = 24;
+	response->filters = NULL;
+	return true;
+}
+
+static void
+h3_stream_finish_headers (struct h3_stream *stream)
+{
+	struct fh_request *request = &stream->request;
+
+	if (!stream->method)
+	{
+		stream->error_status = FH_STATUS_BAD_REQUEST;
+		return;
+	}
+
+	for (size_t i = 0; i < sizeof (h3_methods) / sizeof (h3_methods[0]); i++)
+	{
+		if (stream->method_len == h3_methods[i].len
+			&& !memcmp (stream->method, h3_methods[i].name, stream->method_len))
+		{
+			request->method = h3_methods[i].method;
+
+			if (request->method == FH_METHOD_CONNECT)
+				stream->error_status = FH_STATUS_METHOD_NOT_ALLOWED;
+			else if (!stream->have_scheme || !request->uri)
+				stream->error_status = FH_STATUS_BAD_REQUEST;
+
+			return;
+		}
+	}
+
+	request->method = FH_METHOD_GET;
+	stream->error_status = FH_STATUS_NOT_IMPLEMENTED;
+}
+
+/* The request is complete: hand it over to the handler.  */
+static bool
+h3_stream_dispatch (struct h3_conn *hc, struct h3_stream *stream)
+{
+	struct fh_h3 *h3 = hc->h3;
+	struct fh_response *response = &stream->response;
+
+	h3_stream_finish_headers (stream);
+	fh_stats_mark (&stream->timing, FH_STATS_MARK_HEAD);
+
+	if (stream->body_tail)
+		stream->body_tail->is_eos = true;
+
+	if (stream->error_status)
+	{
+		response->status = stream->error_status;
+		response->use_default_error_response = true;
+	}
+	else if (!h3->handler (h3->handler_data, hc->conn, &stream->request,
+						   response))
+	{
+		return false;
+	}
+
+	fh_stats_mark (&stream->timing, FH_STATS_MARK_HANDLER);
+
+	if (response->use_default_error_response
+		&& !h3_use_error_page (hc, stream))
+		return false;
+
+	return h3_submit_response (hc, stream);
+}
+
+/* nghttp3 callbacks */
+
+static void
+h3_consume (struct h3_conn *hc, int64_t stream_id, size_t len)
+{
+	ngtcp2_conn_extend_max_stream_offset (hc->quic, stream_id, len);
+	ngtcp2_conn_extend_max_offset (hc->quic, len);
+}
+
+static int
+h3_on_acked_stream_data (nghttp3_conn *http, int64_t stream_id,
+						 uint64_t datalen, void *conn_user_data,
+						 void *stream_user_data)
+{
+	struct h3_stream *stream = stream_user_data;
+
+	(void) conn_user_data;
+
+	if (!stream)
+		return 0;
+
+	h3_stream_ack (stream, datalen);
+
+	if (stream->blocked && stream->unacked < H3_STREAM_HIGH_WATER)
+	{
+		stream->blocked = false;
+
+		if (nghttp3_conn_resume_stream (http, stream_id) != 0)
+			return NGHTTP3_ERR_CALLBACK_FAILURE;
+	}
+
+	return 0;
+}
+
+static int
+h3_on_stream_close (nghttp3_conn *http, int64_t stream_id,
+					uint64_t app_error_code, void *conn_user_data,
+					void *stream_user_data)
+{
+	struct h3_stream *stream = stream_user_data;
+
+	(void) http;
+	(void) stream_id;
+	(void) conn_user_data;
+
+	if (!stream)
+		return 0;
+
+	if (app_error_code == NGHTTP3_H3_NO_ERROR)
+		fh_stats_mark (&stream->timing, FH_STATS_MARK_BODY);
+
+	h3_stream_free (stream);
+
+	return 0;
+}
+
+static int
+h3_on_recv_data (nghttp3_conn *http, int64_t stream_id, const uint8_t *data,
+				 size_t datalen, void *conn_user_data, void *stream_user_data)
+{
+	struct h3_conn *hc = conn_user_data;
+	struct h3_stream *stream = stream_user_data;
+
+	(void) http;
+
+	h3_consume (hc, stream_id, datalen);
+
+	if (!stream || !datalen)
+		return 0;
+
+	if (stream->body_size + datalen > H3_MAX_REQUEST_BODY_SIZE)
+	{
+		ngtcp2_conn_shutdown_stream (hc->quic, 0, stream_id,
+									 NGHTTP3_H3_EXCESSIVE_LOAD);
+		return 0;
+	}
+
+	uint8_t *copy = fh_pool_alloc (stream->pool, datalen);
+	struct fh_link *link
+		= copy ? fh_link_new_data (stream->pool, copy, datalen, false) : NULL;
+
+	if (!link)
+		return NGHTTP3_ERR_CALLBACK_FAILURE;
+
+	memcpy (copy, data, datalen);
+
+	if (stream->body_tail)
+		stream->body_tail->next = link;
+	else
+		stream->request.body_start = link;
+
+	stream->body_tail = link;
+	stream->body_size += datalen;
+	return 0;
+}
+
+static int
+h3_on_deferred_consume (nghttp3_conn *http, int64_t stream_id,
+						size_t consumed, void *conn_user_data,
+						void *stream_user_data)
+{
+	(void) http;
+	(void) stream_user_data;
+
+	h3_consume (conn_user_data, stream_id, consumed);
+	return 0;
+}
+
+static int
+h3_on_begin_headers (nghttp3_conn *http, int64_t stream_id,
+					 void *conn_user_data, void *stream_user_data)
+{
+	(void) stream_user_data;
+
+	struct h3_stream *stream = h3_stream_create (conn_user_data, stream_id);
+
+	if (!stream)
+		return NGHTTP3_ERR_CALLBACK_FAILURE;
+
+	nghttp3_conn_set_stream_user_data (http, stream_id, stream);
+	return 0;
+}
+
+static int
+h3_on_recv_header (nghttp3_conn *http, int64_t stream_id, int32_t token,
+				   nghttp3_rcbuf *name_buf, nghttp3_rcbuf *value_buf,
+				   uint8_t flags, void *conn_user_data, void *stream_user_data)
+{
+	struct h3_stream *stream = stream_user_data;
+
+	(void) http;
+	(void) stream_id;
+	(void) token;
+	(void) flags;
+	(void) conn_user_data;
+
+	if (!stream)
+		return 0;
+
+	/* The buffers go away with the header block, and nghttp3 already
+	   rejected malformed fields.  */
+	nghttp3_vec name_vec = nghttp3_rcbuf_get_buf (name_buf);
+	nghttp3_vec value_vec = nghttp3_rcbuf_get_buf (value_buf);
+	char *name = fh_pool_alloc (stream->pool, name_vec.len + 1);
+	char *value = fh_pool_alloc (stream->pool, value_vec.len + 1);
+	const size_t name_len = name_vec.len, value_len = value_vec.len;
+
+	if (!name || !value)
+		return NGHTTP3_ERR_CALLBACK_FAILURE;
+
+	memcpy (name, name_vec.base, name_len);
+	memcpy (value, value_vec.base, value_len);
+	name[name_len] = value[value_len] = 0;
+
+	struct fh_request *request = &stream->request;
+
+	if (name_len == 7 && !memcmp (name, ":method", 7))
+	{
+		stream->method = value;
+		stream->method_len = value_len;
+		return 0;
+	}
+
+	if (name_len == 5 && !memcmp (name, ":path", 5))
+	{
+		request->uri = value;
+		request->uri_len = value_len;
+		return 0;
+	}
+
+	if (name_len == 7 && !memcmp (name, ":scheme", 7))
+	{
+		stream->have_scheme = true;
+		return 0;
+	}
+
+	if ((name_len == 10 && !memcmp (name, ":authority", 10))
+		|| (name_len == 4 && !memcmp (name, "host", 4)))
+	{
+		if (!request->host)
+		{
+			const char *colon = memchr (value, ':', value_len);
+
+			request->host = value;
+			request->full_host_len = value_len;
+			request->host_len = colon ? (size_t) (colon - value) : value_len;
+		}
+
+		if (name[0] == ':')
+			return 0;
+	}
+	else if (name[0] == ':')
+	{
+		return 0;
+	}
+	else if (name_len == 14 && !memcmp (name, "content-length", 14))
+	{
+		request->content_length = strntoull (value, value_len, 10);
+	}
+
+	return fh_header_add (stream->pool, &request->headers, name, name_len,
+						  value, value_len)
+			   ? 0
+			   : NGHTTP3_ERR_CALLBACK_FAILURE;
+}
+
+static int
+h3_on_end_stream (nghttp3_conn *http, int64_t stream_id, void *conn_user_data,
+				  void *stream_user_data)
+{
+	struct h3_conn *hc = conn_user_data;
+	struct h3_stream *stream = stream_user_data;
+
+	(void) http;
+
+	if (stream && !h3_stream_dispatch (hc, stream))
+		ngtcp2_conn_shutdown_stream (hc->quic, 0, stream_id,
+									 NGHTTP3_H3_INTERNAL_ERROR);
+
+	return 0;
+}
+
+static int
+h3_on_stop_sending (nghttp3_conn *http, int64_t stream_id,
+					uint64_t app_error_code, void *conn_user_data,
+					void *stream_user_data)
+{
+	struct h3_conn *hc = conn_user_data;
+
+	(void) http;
+	(void) stream_user_data;
+
+	ngtcp2_conn_shutdown_stream_read (hc->quic, 0, stream_id, app_error_code);
+	return 0;
+}
+
+static int
+h3_on_reset_stream (nghttp3_conn *http, int64_t stream_id,
+					uint64_t app_error_code, void *conn_user_data,
+					void *stream_user_data)
+{
+	struct h3_conn *hc = conn_user_data;
+
+	(void) http;
+	(void) stream_user_data;
+
+	ngtcp2_conn_shutdown_stream_write (hc->quic, 0, stream_id, app_error_code);
+	return 0;
+}
+
+static const nghttp3_callbacks h3_http_callbacks = {
+	.acked_stream_data = &h3_on_acked_stream_data,
+	.stream_close = &h3_on_stream_close,
+	.recv_data = &h3_on_recv_data,
+	.deferred_consume = &h3_on_deferred_consume,
+	.begin_headers = &h3_on_begin_headers,
+	.recv_header = &h3_on_recv_header,
+	.end_stream = &h3_on_end_stream,
+	.stop_sending = &h3_on_stop_sending,
+	.reset_stream = &h3_on_reset_stream,
+};
+
+/* The HTTP/3 layer needs the peer's transport parameters to open its
+   unidirectional streams, so it is only set up once they are known.  */
+static bool
+h3_conn_setup_http (struct h3_conn *hc)
+{
+	nghttp3_settings settings;
+	int64_t control_id, encoder_id, decoder_id;
+
+	nghttp3_settings_default (&settings);
+	settings.qpack_max_dtable_capacity = 4096;
+	settings.qpack_blocked_streams = 100;
+
+	if (nghttp3_conn_server_new (&hc->http, &h3_http_callbacks, &settings,
+								 nghttp3_mem_default (), hc)
+		!= 0)
+		return false;
+
+	const ngtcp2_transport_params *params
+		= ngtcp2_conn_get_local_transport_params (hc->quic);
+
+	nghttp3_conn_set_max_client_streams_bidi (hc->http,
+											  params->initial_max_streams_bidi);
+
+	return ngtcp2_conn_open_uni_stream (hc->quic, &control_id, NULL) == 0
+		   && nghttp3_conn_bind_control_stream (hc->http, control_id) == 0
+		   && ngtcp2_conn_open_uni_stream (hc->quic, &encoder_id, NULL) == 0
+		   && ngtcp2_conn_open_uni_stream (hc->quic, &decoder_id, NULL) == 0
+		   && nghttp3_conn_bind_qpack_streams (hc->http, encoder_id,
+											   decoder_id)
+				  == 0;
+}
+
+/* ngtcp2 callbacks */
+
+static ngtcp2_conn *
+h3_get_conn (ngtcp2_crypto_conn_ref *conn_ref)
+{
+	return ((struct h3_conn *) conn_ref->user_data)->quic;
+}
+
+static void
+h3_rand (uint8_t *dest, size_t destlen, const ngtcp2_rand_ctx *rand_ctx)
+{
+	(void) rand_ctx;
+
+	if (!fh_quic_random (dest, destlen))
+		fh_pr_err ("getrandom() failed: %s", strerror (errno));
+}
+
+static int
+h3_on_get_new_connection_id (ngtcp2_conn *quic, ngtcp2_cid *cid,
+							 uint8_t *token, size_t cidlen, void *user_data)
+{
+	struct h3_conn *hc = user_data;
+	struct fh_h3 *h3 = hc->h3;
+
+	(void) quic;
+
+	do
+	{
+		if (!fh_quic_generate_cid (cid->data, cidlen, h3->worker))
+			return NGTCP2_ERR_CALLBACK_FAILURE;
+
+		cid->datalen = cidlen;
+	}
+	while (itable_contains (h3->cids, fh_quic_cid_hash (cid->data, cidlen)));
+
+	if (ngtcp2_crypto_generate_stateless_reset_token (
+			token, h3->reset_secret, sizeof (h3->reset_secret), cid)
+			!= 0
+		|| !h3_cid_add (h3, cid->data, cid->datalen, hc))
+		return NGTCP2_ERR_CALLBACK_FAILURE;
+
+	return 0;
+}
+
+static int
+h3_on_remove_connection_id (ngtcp2_conn *quic, const ngtcp2_cid *cid,
+							void *user_data)
+{
+	struct h3_conn *hc = user_data;
+
+	(void) quic;
+
+	h3_cid_remove (hc->h3, cid->data, cid->datalen, hc);
+	return 0;
+}
+
+static int
+h3_on_handshake_completed (ngtcp2_conn *quic, void *user_data)
+{
+	struct h3_conn *hc = user_data;
+
+	(void) quic;
+
+	fh_pr_debug ("Connection #%lu: QUIC handshake done, cipher %s",
+				 hc->conn->id, SSL_get_cipher_name (hc->ssl));
+
+	if (!hc->http && !h3_conn_setup_http (hc))
+		return NGTCP2_ERR_CALLBACK_FAILURE;
+
+	return 0;
+}
+
+static int
+h3_on_recv_stream_data (ngtcp2_conn *quic, uint32_t flags, int64_t stream_id,
+						uint64_t offset, const uint8_t *data, size_t datalen,
+						void *user_data, void *stream_user_data)
+{
+	struct h3_conn *hc = user_data;
+
+	(void) offset;
+	(void) stream_user_data;
+
+	/* Stream data may overtake the packet that completes the handshake */
+	if (!hc->http && !h3_conn_setup_http (hc))
+		return NGTCP2_ERR_CALLBACK_FAILURE;
+
+	nghttp3_ssize consumed = nghttp3_conn_read_stream (
+		hc->http, stream_id, data, datalen,
+		(flags & NGTCP2_STREAM_DATA_FLAG_FIN) != 0);
+
+	if (consumed < 0)
+	{
+		fh_pr_debug ("Connection #%lu: nghttp3_conn_read_stream: %s",
+					 hc->conn->id, nghttp3_strerror ((int) consumed));
+		ngtcp2_ccerr_set_application_error (
+			&hc->ccerr, nghttp3_err_infer_quic_app_error_code ((int) consumed),
+			NULL, 0);
+		return NGTCP2_ERR_CALLBACK_FAILURE;
+	}
+
+	ngtcp2_conn_extend_max_stream_offset (quic, stream_id, (uint64_t) consumed);
+	ngtcp2_conn_extend_max_offset (quic, (uint64_t) consumed);
+	return 0;
+}
+
+static int
+h3_on_acked_stream_data_offset (ngtcp2_conn *quic, int64_t stream_id,
+								uint64_t offset, uint64_t datalen,
+								void *user_data, void *stream_user_data)
+{
+	struct h3_conn *hc = user_data;
+
+	(void) quic;
+	(void) offset;
+	(void) stream_user_data;
+
+	if (hc->http && nghttp3_conn_add_ack_offset (hc->http, stream_id, datalen))
+		return NGTCP2_ERR_CALLBACK_FAILURE;
+
+	return 0;
+}
+
+static int
+h3_on_quic_stream_close (ngtcp2_conn *quic, uint32_t flags, int64_t stream_id,
+						 uint64_t app_error_code, void *user_data,
+						 void *stream_user_data)
+{
+	struct h3_conn *hc = user_data;
+
+	(void) quic;
+	(void) stream_user_data;
+
+	/* Lets the client open another request stream in place of it */
+	if (ngtcp2_is_bidi_stream (stream_id))
+		ngtcp2_conn_extend_max_streams_bidi (hc->quic, 1);
+
+	if (!hc->http)
+		return 0;
+
+	if (!(flags & NGTCP2_STREAM_CLOSE_FLAG_APP_ERROR_CODE_SET))
+		app_error_code = NGHTTP3_H3_NO_ERROR;
+
+	int rv = nghttp3_conn_close_stream (hc->http, stream_id, app_error_code);
+
+	if (rv != 0 && rv != NGHTTP3_ERR_STREAM_NOT_FOUND)
+	{
+		ngtcp2_ccerr_set_application_error (
+			&hc->ccerr, nghttp3_err_infer_quic_app_error_code (rv), NULL, 0);
+		return NGTCP2_ERR_CALLBACK_FAILURE;
+	}
+
+	return 0;
+}
+
+static int
+h3_on_stream_reset (ngtcp2_conn *quic, int64_t stream_id, uint64_t final_size,
+					uint64_t app_error_code, void *user_data,
+					void *stream_user_data)
+{
+	struct h3_conn *hc = user_data;
+
+	(void) quic;
+	(void) final_size;
+	(void) app_error_code;
+	(void) stream_user_data;
+
+	if (hc->http && nghttp3_conn_shutdown_stream_read (hc->http, stream_id))
+		return NGTCP2_ERR_CALLBACK_FAILURE;
+
+	return 0;
+}
+
+static int
+h3_on_stream_stop_sending (ngtcp2_conn *quic, int64_t stream_id,
+						   uint64_t app_error_code, void *user_data,
+						   void *stream_user_data)
+{
+	(void) app_error_code;
+
+	return h3_on_stream_reset (quic, stream_id, 0, 0, user_data,
+							   stream_user_data);
+}
+
+static int
+h3_on_extend_max_remote_streams_bidi (ngtcp2_conn *quic, uint64_t max_streams,
+									  void *user_data)
+{
+	struct h3_conn *hc = user_data;
+
+	(void) quic;
+
+	if (hc->http)
+		nghttp3_conn_set_max_client_streams_bidi (hc->http, max_streams);
+
+	return 0;
+}
+
+static int
+h3_on_extend_max_stream_data (ngtcp2_conn *quic, int64_t stream_id,
+							  uint64_t max_data, void *user_data,
+							  void *stream_user_data)
+{
+	struct h3_conn *hc = user_data;
+
+	(void) quic;
+	(void) max_data;
+	(void) stream_user_data;
+
+	if (hc->http && nghttp3_conn_unblock_stream (hc->http, stream_id))
+		return NGTCP2_ERR_CALLBACK_FAILURE;
+
+	return 0;
+}
+
+static const ngtcp2_callbacks h3_quic_callbacks = {
+	.recv_client_initial = &ngtcp2_crypto_recv_client_initial_cb,
+	.recv_crypto_data = &ngtcp2_crypto_recv_crypto_data_cb,
+	.handshake_completed = &h3_on_handshake_completed,
+	.encrypt = &ngtcp2_crypto_encrypt_cb,
+	.decrypt = &ngtcp2_crypto_decrypt_cb,
+	.hp_mask = &ngtcp2_crypto_hp_mask_cb,
+	.recv_stream_data = &h3_on_recv_stream_data,
+	.acked_stream_data_offset = &h3_on_acked_stream_data_offset,
+	.stream_close = &h3_on_quic_stream_close,
+	.rand = &h3_rand,
+	.get_new_connection_id = &h3_on_get_new_connection_id,
+	.remove_connection_id = &h3_on_remove_connection_id,
+	.update_key = &ngtcp2_crypto_update_key_cb,
+	.stream_reset = &h3_on_stream_reset,
+	.extend_max_remote_streams_bidi = &h3_on_extend_max_remote_streams_bidi,
+	.extend_max_stream_data = &h3_on_extend_max_stream_data,
+	.delete_crypto_aead_ctx = &ngtcp2_crypto_delete_crypto_aead_ctx_cb,
+	.delete_crypto_cipher_ctx = &ngtcp2_crypto_delete_crypto_cipher_ctx_cb,
+	.get_path_challenge_data = &ngtcp2_crypto_get_path_challenge_data_cb,
+	.stream_stop_sending = &h3_on_stream_stop_sending,
+	.version_negotiation = &ngtcp2_crypto_version_negotiation_cb,
+};
+
+/* Connections */
+
+static void
+h3_conn_want_write (struct h3_conn *hc)
+{
+	if (hc->write_pending)
+		return;
+
+	hc->write_pending = true;
+	hc->next_pending = hc->h3->pending;
+	hc->h3->pending = hc;
+}
+
+static struct h3_conn *
+h3_conn_create (struct fh_h3 *h3, const struct fh_quic_datagram *datagram,
+				const ngtcp2_pkt_hd *pkt)
+{
+	SSL *ssl = fh_tls_quic_new (h3->server->tls, h3->port);
+
+	if (!ssl)
+		return NULL;
+
+	struct h3_conn *hc = calloc (1, sizeof (*hc));
+
+	if (!hc)
+	{
+		SSL_free (ssl);
+		return NULL;
+	}
+
+	hc->h3 = h3;
+	hc->ssl = ssl;
+	hc->heap_index = SIZE_MAX;
+	hc->local = (struct sockaddr_in) {
+		.sin_family = AF_INET,
+		.sin_port = htons (h3->port),
+		.sin_addr = datagram->local,
+	};
+	hc->remote = datagram->remote;
+	hc->conn_ref.get_conn = &h3_get_conn;
+	hc->conn_ref.user_data = hc;
+	ngtcp2_ccerr_default (&hc->ccerr);
+	SSL_set_app_data (ssl, &hc->conn_ref);
+
+	hc->conn = fh_conn_create (-1, &hc->remote, &hc->local);
+
+	if (!hc->conn)
+		goto fail;
+
+	struct fh_config_host *config = h3->server->config->default_host_config;
+	struct fh_bound_addr *addr = &config->addr;
+
+	hc->conn->protocol = FH_PROTOCOL_H3;
+	hc->conn->extra->host = addr->full_hostname;
+	hc->conn->extra->port = addr->port;
+	hc->conn->extra->host_len = addr->hostname_len;
+	hc->conn->extra->full_host_len = addr->full_hostname_len;
+	hc->conn->config = config;
+
+	ngtcp2_cid scid;
+	ngtcp2_settings settings;
+	ngtcp2_transport_params params;
+
+	do
+	{
+		if (!fh_quic_generate_cid (scid.data, FH_QUIC_CID_LEN, h3->worker))
+			goto fail;
+
+		scid.datalen = FH_QUIC_CID_LEN;
+	}
+	while (itable_contains (h3->cids,
+							fh_quic_cid_hash (scid.data, scid.datalen)));
+
+	ngtcp2_settings_default (&settings);
+	settings.initial_ts = h3_now ();
+	settings.max_tx_udp_payload_size = H3_MAX_PACKET_SIZE;
+
+	ngtcp2_transport_params_default (&params);
+	params.initial_max_stream_data_bidi_remote = H3_STREAM_WINDOW;
+	params.initial_max_stream_data_uni = H3_STREAM_WINDOW;
+	params.initial_max_data = H3_CONN_WINDOW;
+	params.initial_max_streams_bidi = H3_MAX_CONCURRENT_STREAMS;
+	params.initial_max_streams_uni = 3;
+	params.max_idle_timeout = H3_IDLE_TIMEOUT;
+	params.original_dcid = pkt->dcid;
+	params.original_dcid_present = 1;
+	params.stateless_reset_token_present = 1;
+
+	if (ngtcp2_crypto_generate_stateless_reset_token (
+			params.stateless_reset_token, h3->reset_secret,
+			sizeof (h3->reset_secret), &scid)
+		!= 0)
+		goto fail;
+
+	ngtcp2_path path = h3_conn_path (hc);
+	int rv = ngtcp2_conn_server_new (&hc->quic, &pkt->scid, &scid, &path,
+									 pkt->version, &h3_quic_callbacks,
+									 &settings, &params, NULL, hc);
+
+	if (rv != 0)
+	{
+		fh_pr_err ("ngtcp2_conn_server_new: %s", ngtcp2_strerror (rv));
+		goto fail;
+	}
+
+	ngtcp2_conn_set_tls_native_handle (hc->quic, ssl);
+
+	memcpy (hc->odcid, pkt->dcid.data, pkt->dcid.datalen);
+	hc->odcid_len = pkt->dcid.datalen;
+
+	if (!h3_cid_add (h3, scid.data, scid.datalen, hc)
+		|| !h3_cid_add (h3, hc->odcid, hc->odcid_len, hc)
+		|| !h3_heap_push (h3, hc))
+		goto fail;
+
+	char ip[INET_ADDRSTRLEN] = { 0 };
+
+	inet_ntop (AF_INET, &hc->remote.sin_addr, ip, sizeof ip);
+	fh_pr_debug ("Connection #%lu: QUIC connection from %s:%u", hc->conn->id,
+				 ip, ntohs (hc->remote.sin_port));
+	return hc;
+
+fail:
+	h3_conn_free (hc);
+	return NULL;
+}
+
+static void
+h3_conn_free (struct h3_conn *hc)
+{
+	struct fh_h3 *h3 = hc->h3;
+
+	if (hc->write_pending)
+	{
+		struct h3_conn **p = &h3->pending;
+
+		while (*p != hc)
+			p = &(*p)->next_pending;
+
+		*p = hc->next_pending;
+	}
+
+	h3_heap_remove (h3, hc);
+
+	if (hc->quic)
+	{
+		size_t count = ngtcp2_conn_get_num_scid (hc->quic);
+		ngtcp2_cid *cids = count ? calloc (count, sizeof (*cids)) : NULL;
+
+		if (cids)
+		{
+			count = ngtcp2_conn_get_scid (hc->quic, cids);
+
+			for (size_t i = 0; i < count; i++)
+				h3_cid_remove (h3, cids[i].data, cids[i].datalen, hc);
+
+			free (cids);
+		}
+	}
+
+	if (hc->odcid_len)
+		h3_cid_remove (h3, hc->odcid, hc->odcid_len, hc);
+
+	while (hc->stream_head)
+		h3_stream_free (hc->stream_head);
+
+	if (hc->http)
+		nghttp3_conn_del (hc->http);
+
+	if (hc->quic)
+		ngtcp2_conn_del (hc->quic);
+
+	SSL_free (hc->ssl);
+
+	if (hc->conn)
+		fh_conn_destroy (hc->conn);
+
+	free (hc->close_pkt);
+	free (hc);
+}
+
+static void
+h3_conn_send_close (struct h3_conn *hc)
+{
+	struct fh_h3 *h3 = hc->h3;
+	ngtcp2_path path = h3_conn_path (hc);
+
+	memcpy (h3_tx_slot (h3), hc->close_pkt, hc->close_pkt_len);
+	h3_tx_push (h3, &path, hc->close_pkt_len, 0);
+}
+
+/* Enters the closing period, in which the connection only answers with
+   the same CONNECTION_CLOSE for three PTOs (RFC 9000, section 10.2).  */
+static void
+h3_conn_start_closing (struct h3_conn *hc)
+{
+	if (hc->closing || hc->draining)
+		return;
+
+	hc->close_pkt = malloc (H3_MAX_PACKET_SIZE);
+
+	if (!hc->close_pkt)
+	{
+		h3_conn_free (hc);
+		return;
+	}
+
+	ngtcp2_path_storage ps;
+	ngtcp2_pkt_info pi;
+	ngtcp2_tstamp now = h3_now ();
+
+	ngtcp2_path_storage_zero (&ps);
+
+	ngtcp2_ssize len = ngtcp2_conn_write_connection_close (
+		hc->quic, &ps.path, &pi, hc->close_pkt, H3_MAX_PACKET_SIZE, &hc->ccerr,
+		now);
+
+	/* Nothing can be sent before the handshake keys are there */
+	if (len <= 0)
+	{
+		h3_conn_free (hc);
+		return;
+	}
+
+	fh_pr_debug ("Connection #%lu: closing, error %lu", hc->conn->id,
+				 (unsigned long) hc->ccerr.error_code);
+
+	hc->close_pkt_len = (size_t) len;
+	hc->closing = true;
+	hc->expiry = now + 3 * ngtcp2_conn_get_pto (hc->quic);
+	h3_heap_fix (hc->h3, hc->heap_index);
+	h3_conn_send_close (hc);
+}
+
+static void
+h3_conn_start_draining (struct h3_conn *hc)
+{
+	if (hc->closing || hc->draining)
+		return;
+
+	hc->draining = true;
+	hc->expiry = h3_now () + 3 * ngtcp2_conn_get_pto (hc->quic);
+	h3_heap_fix (hc->h3, hc->heap_index);
+}
+
+static void
+h3_conn_fail (struct h3_conn *hc, int liberr)
+{
+	if (!hc->ccerr.error_code)
+		ngtcp2_ccerr_set_liberr (&hc->ccerr, liberr, NULL, 0);
+
+	h3_conn_start_closing (hc);
+}
+
+/* Writes out packets until there is nothing left to send or congestion
+   control says to stop.  Consecutive packets of the same size are
+   coalesced into one datagram that the kernel splits up again (GSO).  */
+static bool
+h3_conn_write (struct h3_conn *hc)
+{
+	struct fh_h3 *h3 = hc->h3;
+	const ngtcp2_tstamp now = h3_now ();
+	size_t max_size = ngtcp2_conn_get_path_max_tx_udp_payload_size (hc->quic);
+	size_t max_packets = ngtcp2_conn_get_send_quantum (hc->quic) / max_size;
+	size_t packets = 0, segments = 0, len = 0, segment_size = 0;
+	ngtcp2_path_storage ps, prev_ps;
+
+	if (max_size > H3_MAX_PACKET_SIZE)
+		max_size = H3_MAX_PACKET_SIZE;
+
+	if (max_packets == 0)
+		max_packets = 1;
+
+	ngtcp2_path_storage_zero (&ps);
+	ngtcp2_path_storage_zero (&prev_ps);
+
+	for (;;)
+	{
+		int64_t stream_id = -1;
+		int fin = 0;
+		nghttp3_vec vec[16];
+		nghttp3_ssize veccnt = 0;
+
+		if (hc->http && ngtcp2_conn_get_max_data_left (hc->quic))
+		{
+			veccnt = nghttp3_conn_writev_stream (hc->http, &stream_id, &fin,
+												 vec, 16);
+
+			if (veccnt < 0)
+			{
+				ngtcp2_ccerr_set_application_error (
+					&hc->ccerr,
+					nghttp3_err_infer_quic_app_error_code ((int) veccnt),
+					NULL, 0);
+				h3_conn_start_closing (hc);
+				return false;
+			}
+		}
+
+		uint8_t *buf = h3_tx_slot (h3) + len;
+		ngtcp2_ssize datalen;
+		uint32_t flags = NGTCP2_WRITE_STREAM_FLAG_MORE;
+		ngtcp2_pkt_info pi;
+
+		if (fin)
+			flags |= NGTCP2_WRITE_STREAM_FLAG_FIN;
+
+		ngtcp2_ssize n = ngtcp2_conn_writev_stream (
+			hc->quic, &ps.path, &pi, buf, max_size, &datalen, flags, stream_id,
+			(const ngtcp2_vec *) vec, (size_t) veccnt, now);
+
+		if (n < 0)
+		{
+			switch (n)
+			{
+				case NGTCP2_ERR_STREAM_DATA_BLOCKED:
+					nghttp3_conn_block_stream (hc->http, stream_id);
+					continue;
+
+				case NGTCP2_ERR_STREAM_SHUT_WR:
+					nghttp3_conn_shutdown_stream_write (hc->http, stream_id);
+					continue;
+
+				case NGTCP2_ERR_WRITE_MORE:
+					if (nghttp3_conn_add_write_offset (hc->http, stream_id,
+													   (size_t) datalen))
+						break;
+
+					continue;
+			}
+
+			fh_pr_debug ("Connection #%lu: ngtcp2_conn_writev_stream: %s",
+						 hc->conn->id, ngtcp2_strerror ((int) n));
+
+			if (len)
+				h3_tx_push (h3, &prev_ps.path, len, segment_size);
+
+			h3_conn_fail (hc, (int) n);
+			return false;
+		}
+
+		if (datalen >= 0
+			&& nghttp3_conn_add_write_offset (hc->http, stream_id,
+											  (size_t) datalen))
+		{
+			if (len)
+				h3_tx_push (h3, &prev_ps.path, len, segment_size);
+
+			h3_conn_fail (hc, NGTCP2_ERR_CALLBACK_FAILURE);
+			return false;
+		}
+
+		if (n == 0)
+			break;
+
+		/* A packet that cannot extend the current datagram starts the
+		   next one.  */
+		if (len
+			&& ((size_t) n > segment_size
+				|| !ngtcp2_path_eq (&prev_ps.path, &ps.path)))
+		{
+			uint8_t copy[H3_MAX_PACKET_SIZE];
+
+			memcpy (copy, buf, (size_t) n);
+			h3_tx_push (h3, &prev_ps.path, len, segment_size);
+			memcpy (h3_tx_slot (h3), copy, (size_t) n);
+			len = segments = 0;
+		}
+
+		if (!len)
+		{
+			segment_size = (size_t) n;
+			ngtcp2_path_storage_init (&prev_ps, ps.path.local.addr,
+									  ps.path.local.addrlen,
+									  ps.path.remote.addr,
+									  ps.path.remote.addrlen, NULL);
+		}
+
+		len += (size_t) n;
+		segments++;
+		packets++;
+
+		/* Only the last segment may be shorter than the others.  */
+		if ((size_t) n < segment_size || segments == H3_MAX_GSO_SEGMENTS
+			|| packets >= max_packets)
+		{
+			h3_tx_push (h3, &prev_ps.path, len, segment_size);
+			len = segments = 0;
+
+			if (packets >= max_packets)
+				break;
+		}
+	}
+
+	if (len)
+	{
+		h3_tx_push (h3, &prev_ps.path, len, segment_size);
+	}
+
+	ngtcp2_conn_update_pkt_tx_time (hc->quic, now);
+	h3_conn_update_timer (hc);
+	return true;
+}
+
+static void
+h3_flush_pending (struct fh_h3 *h3)
+{
+	while (h3->pending)
+	{
+		struct h3_conn *hc = h3->pending;
+
+		h3->pending = hc->next_pending;
+		hc->write_pending = false;
+
+		if (!hc->closing && !hc->draining)
+			h3_conn_write (hc);
+	}
+
+	h3_tx_flush (h3);
+	h3_arm_timer (h3);
+}
+
+static void
+h3_handle_packet (struct fh_h3 *h3, const struct fh_quic_datagram *datagram,
+				  const uint8_t *data, size_t len)
+{
+	struct fh_quic_header header;
+
+	if (!fh_quic_parse_header (data, len, &header))
+		return;
+
+	struct h3_conn *hc = itable_get (
+		h3->cids, fh_quic_cid_hash (header.dcid, header.dcid_len));
+
+	if (!hc)
+	{
+		ngtcp2_pkt_hd pkt;
+
+		if (!header.is_long)
+			return;
+
+		/* Only answer datagrams as large as the answer, as a client's
+		   first flight must be (RFC 9000, section 14.1).  */
+		if (!ngtcp2_is_supported_version (header.version))
+		{
+			if (datagram->len >= FH_QUIC_MIN_INITIAL_SIZE)
+				h3_send_version_negotiation (h3, datagram, &header);
+
+			return;
+		}
+
+		if (ngtcp2_accept (&pkt, data, len) != 0)
+			return;
+
+		hc = h3_conn_create (h3, datagram, &pkt);
+
+		if (!hc)
+			return;
+	}
+
+	if (hc->closing)
+	{
+		/* Repeat the close, less often the more the peer keeps sending */
+		hc->close_recv_count++;
+
+		if (!(hc->close_recv_count & (hc->close_recv_count - 1)))
+			h3_conn_send_close (hc);
+
+		return;
+	}
+
+	if (hc->draining)
+		return;
+
+	ngtcp2_path path = h3_conn_path (hc);
+	struct sockaddr_in local = {
+		.sin_family = AF_INET,
+		.sin_port = htons (h3->port),
+		.sin_addr = datagram->local,
+	};
+	struct sockaddr_in remote = datagram->remote;
+	ngtcp2_pkt_info pi = { 0 };
+
+	/* The peer may have moved; ngtcp2 validates the new path itself.  */
+	path.local.addr = (ngtcp2_sockaddr *) &local;
+	path.remote.addr = (ngtcp2_sockaddr *) &remote;
+
+	int rv = ngtcp2_conn_read_pkt (hc->quic, &path, &pi, data, len, h3_now ());
+
+	switch (rv)
+	{
+		case 0:
+			/* Later packets are answered from the path last used */
+			hc->local = local;
+			hc->remote = remote;
+			h3_conn_want_write (hc);
+			return;
+
+		case NGTCP2_ERR_DRAINING:
+			h3_conn_start_draining (hc);
+			return;
+
+		case NGTCP2_ERR_DROP_CONN:
+			h3_conn_free (hc);
+			return;
+
+		case NGTCP2_ERR_CRYPTO:
+			if (!hc->ccerr.error_code)
+				ngtcp2_ccerr_set_tls_alert (
+					&hc->ccerr, ngtcp2_conn_get_tls_alert (hc->quic), NULL, 0);
+
+			break;
+	}
+
+	fh_pr_debug ("Connection #%lu: ngtcp2_conn_read_pkt: %s", hc->conn->id,
+				 ngtcp2_strerror (rv));
+	h3_conn_fail (hc, rv);
+}
+
+/* Endpoints */
+
+struct fh_h3 *
+fh_h3_create (struct fh_server *server, fd_t sockfd, uint16_t port,
+			  size_t worker, fh_h3_request_handler_t handler,
+			  void *handler_data)
+{
+	struct fh_h3 *h3 = calloc (1, sizeof (*h3));
+
+	if (!h3)
+		return NULL;
+
+	h3->server = server;
+	h3->sockfd = sockfd;
+	h3->port = port;
+	h3->worker = worker;
+	h3->handler = handler;
+	h3->handler_data = handler_data;
+	h3->armed = UINT64_MAX;
+	h3->timerfd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	h3->cids = itable_create (0);
+	h3->rx_buf = malloc (FH_QUIC_BATCH_SIZE * FH_QUIC_MAX_GRO_SIZE);
+	h3->tx_buf = malloc (FH_QUIC_BATCH_SIZE * H3_TX_SLOT_SIZE);
+
+	if (h3->timerfd < 0 || !h3->cids || !h3->rx_buf || !h3->tx_buf
+		|| !fh_quic_random (h3->reset_secret, sizeof (h3->reset_secret)))
+	{
+		/* The socket is the caller's until this succeeded */
+		h3->sockfd = -1;
+		fh_h3_destroy (h3);
+		return NULL;
+	}
+
+	return h3;
+}
+
+void
+fh_h3_destroy (struct fh_h3 *h3)
+{
+	while (h3->heap_len)
+		h3_conn_free (h3->heap[0]);
+
+	if (h3->cids)
+		itable_destroy (h3->cids);
+
+	if (h3->timerfd >= 0)
+		close (h3->timerfd);
+
+	if (h3->sockfd >= 0)
+		close (h3->sockfd);
+
+	free (h3->heap);
+	free (h3->rx_buf);
+	free (h3->tx_buf);
+	free (h3);
+}
+
+fd_t
+fh_h3_sockfd (const struct fh_h3 *h3)
+{
+	return h3->sockfd;
+}
+
+fd_t
+fh_h3_timerfd (const struct fh_h3 *h3)
+{
+	return h3->timerfd;
+}
+
+bool
+fh_h3_recv (struct fh_h3 *h3)
+{
+	for (;;)
+	{
+		int count = fh_quic_recv_batch (h3->sockfd, &h3->rx, h3->rx_buf,
+										FH_QUIC_MAX_GRO_SIZE);
+
+		if (count < 0)
+		{
+			fh_pr_err ("recvmmsg() failed: %s", strerror (errno));
+			h3_flush_pending (h3);
+			return false;
+		}
+
+		if (count == 0)
+			break;
+
+		for (int i = 0; i < count; i++)
+		{
+			const struct fh_quic_datagram *datagram = &h3->rx.datagrams[i];
+			const size_t step = datagram->segment_size ? datagram->segment_size
+													   : datagram->len;
+
+			fh_stats_add (bytes_in, datagram->len);
+
+			for (size_t off = 0; off < datagram->len; off += step)
+			{
+				const size_t len = datagram->len - off < step
+									   ? datagram->len - off
+									   : step;
+
+				h3_handle_packet (h3, datagram, datagram->data + off, len);
+			}
+		}
+
+		if ((size_t) count < FH_QUIC_BATCH_SIZE)
+			break;
+	}
+
+	h3_flush_pending (h3);
+	return true;
+}
+
+bool
+fh_h3_expire (struct fh_h3 *h3)
+{
+	uint64_t ticks;
+
+	if (read (h3->timerfd, &ticks, sizeof ticks) < 0 && !would_block ())
+		return false;
+
+	const ngtcp2_tstamp now = h3_now ();
+
+	h3->armed = UINT64_MAX;
+
+	/* Every connection is looked at once at most: one whose timer is due
+	   again right away is handled when the timer fires next.  */
+	for (size_t n = h3->heap_len; n > 0 && h3->heap_len; n--)
+	{
+		struct h3_conn *hc = h3->heap[0];
+
+		if (hc->expiry > now)
+			break;
+
+		if (hc->closing || hc->draining)
+		{
+			h3_conn_free (hc);
+			continue;
+		}
+
+		int rv = ngtcp2_conn_handle_expiry (hc->quic, now);
+
+		if (rv == NGTCP2_ERR_IDLE_CLOSE)
+		{
+			fh_pr_debug ("Connection #%lu: idle timeout", hc->conn->id);
+			h3_conn_free (hc);
+			continue;
+		}
+
+		if (rv != 0)
+		{
+			h3_conn_fail (hc, rv);
+			continue;
+		}
+
+		if (!h3_conn_write (hc))
+			continue;
+
+		/* Nothing was due after all, e.g. while pacing */
+		if (hc->expiry <= now)
+		{
+			hc->expiry = now + NGTCP2_MILLISECONDS;
+			h3_heap_fix (h3, hc->heap_index);
+		}
+	}
+
+	h3_flush_pending (h3);
+	return true;
+}
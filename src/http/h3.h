@@ -0,0 +1,69 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FH_H3_H
+#define FH_H3_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "protocol.h"
+#include "types.h"
+
+/* Bidirectional streams a client may have open at once */
+#define H3_MAX_CONCURRENT_STREAMS 128
+#define H3_STREAM_WINDOW (256 * 1024)
+#define H3_CONN_WINDOW (1024 * 1024)
+#define H3_MAX_REQUEST_BODY_SIZE (1 << 20)
+/* Response data is copied into chunks of this size, which are kept until
+   the peer acknowledged them; a stream stops producing once it holds
+   H3_STREAM_HIGH_WATER bytes of them.  */
+#define H3_CHUNK_SIZE 16384
+#define H3_STREAM_HIGH_WATER (256 * 1024)
+/* Packets of a connection coalesced into one datagram for GSO */
+#define H3_MAX_GSO_SEGMENTS 10
+
+struct fh_server;
+struct fh_conn;
+struct fh_h3;
+
+/* Produces the response for a complete request.  Returning false resets
+   the stream.  */
+typedef bool (*fh_h3_request_handler_t) (void *data, struct fh_conn *conn,
+										 const struct fh_request *request,
+										 struct fh_response *response);
+
+/* One QUIC endpoint of a worker, i.e. its socket of a UDP port.  */
+struct fh_h3 *fh_h3_create (struct fh_server *server, fd_t sockfd,
+							uint16_t port, size_t worker,
+							fh_h3_request_handler_t handler,
+							void *handler_data);
+void fh_h3_destroy (struct fh_h3 *h3);
+
+fd_t fh_h3_sockfd (const struct fh_h3 *h3);
+/* A timerfd that becomes readable when a connection has timers due */
+fd_t fh_h3_timerfd (const struct fh_h3 *h3);
+
+/* Reads and processes every datagram queued on the socket.  */
+bool fh_h3_recv (struct fh_h3 *h3);
+/* Handles the connections whose timers expired.  */
+bool fh_h3_expire (struct fh_h3 *h3);
+
+#endif /* FH_H3_H */
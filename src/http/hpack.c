@@ -0,0 +1,860 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "hpack.h"
+
+struct fh_hpack_static_entry
+{
+	const char *name;
+	const char *value;
+	uint8_t name_len;
+	uint8_t value_len;
+};
+
+/* A dynamic table slot; the strings live in the table's data ring.  */
+struct fh_hpack_entry
+{
+	uint32_t off;
+	uint32_t name_len;
+	uint32_t value_len;
+};
+
+struct fh_hpack_code
+{
+	uint32_t code;
+	uint8_t bits;
+};
+
+#define HPACK_STATIC(n, v) { n, v, sizeof (n) - 1, sizeof (v) - 1 }
+
+/* RFC 7541, Appendix A; index 0 is unused.  */
+static const struct fh_hpack_static_entry hpack_static_table[] = {
+	HPACK_STATIC ("", ""),
+	HPACK_STATIC (":authority", ""),
+	HPACK_STATIC (":method", "GET"),
+	HPACK_STATIC (":method", "POST"),
+	HPACK_STATIC (":path", "/"),
+	HPACK_STATIC (":path", "/index.html"),
+	HPACK_STATIC (":scheme", "http"),
+	HPACK_STATIC (":scheme", "https"),
+	HPACK_STATIC (":status", "200"),
+	HPACK_STATIC (":status", "204"),
+	HPACK_STATIC (":status", "206"),
+	HPACK_STATIC (":status", "304"),
+	HPACK_STATIC (":status", "400"),
+	HPACK_STATIC (":status", "404"),
+	HPACK_STATIC (":status", "500"),
+	HPACK_STATIC ("accept-charset", ""),
+	HPACK_STATIC ("accept-encoding", "gzip, deflate"),
+	HPACK_STATIC ("accept-language", ""),
+	HPACK_STATIC ("accept-ranges", ""),
+	HPACK_STATIC ("accept", ""),
+	HPACK_STATIC ("access-control-allow-origin", ""),
+	HPACK_STATIC ("age", ""),
+	HPACK_STATIC ("allow", ""),
+	HPACK_STATIC ("authorization", ""),
+	HPACK_STATIC ("cache-control", ""),
+	HPACK_STATIC ("content-disposition", ""),
+	HPACK_STATIC ("content-encoding", ""),
+	HPACK_STATIC ("content-language", ""),
+	HPACK_STATIC ("content-length", ""),
+	HPACK_STATIC ("content-location", ""),
+	HPACK_STATIC ("content-range", ""),
+	HPACK_STATIC ("content-type", ""),
+	HPACK_STATIC ("cookie", ""),
+	HPACK_STATIC ("date", ""),
+	HPACK_STATIC ("etag", ""),
+	HPACK_STATIC ("expect", ""),
+	HPACK_STATIC ("expires", ""),
+	HPACK_STATIC ("from", ""),
+	HPACK_STATIC ("host", ""),
+	HPACK_STATIC ("if-match", ""),
+	HPACK_STATIC ("if-modified-since", ""),
+	HPACK_STATIC ("if-none-match", ""),
+	HPACK_STATIC ("if-range", ""),
+	HPACK_STATIC ("if-unmodified-since", ""),
+	HPACK_STATIC ("last-modified", ""),
+	HPACK_STATIC ("link", ""),
+	HPACK_STATIC ("location", ""),
+	HPACK_STATIC ("max-forwards", ""),
+	HPACK_STATIC ("proxy-authenticate", ""),
+	HPACK_STATIC ("proxy-authorization", ""),
+	HPACK_STATIC ("range", ""),
+	HPACK_STATIC ("referer", ""),
+	HPACK_STATIC ("refresh", ""),
+	HPACK_STATIC ("retry-after", ""),
+	HPACK_STATIC ("server", ""),
+	HPACK_STATIC ("set-cookie", ""),
+	HPACK_STATIC ("strict-transport-security", ""),
+	HPACK_STATIC ("transfer-encoding", ""),
+	HPACK_STATIC ("user-agent", ""),
+	HPACK_STATIC ("vary", ""),
+	HPACK_STATIC ("via", ""),
+	HPACK_STATIC ("www-authenticate", ""),
+};
+
+#define HPACK_STATIC_COUNT                                                     \
+	(sizeof (hpack_static_table) / sizeof (hpack_static_table[0]) - 1)
+
+/* RFC 7541, Appendix B; the last entry is EOS.  */
+static const struct fh_hpack_code hpack_huffman_codes[257] = {
+	{ 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 },
+	{ 0xfffffe4, 28 }, { 0xfffffe5, 28 }, { 0xfffffe6, 28 }, { 0xfffffe7, 28 },
+	{ 0xfffffe8, 28 }, { 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 },
+	{ 0xfffffea, 28 }, { 0x3ffffffd, 30 }, { 0xfffffeb, 28 }, { 0xfffffec, 28 },
+	{ 0xfffffed, 28 }, { 0xfffffee, 28 }, { 0xfffffef, 28 }, { 0xffffff0, 28 },
+	{ 0xffffff1, 28 }, { 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+	{ 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 },
+	{ 0xffffff8, 28 }, { 0xffffff9, 28 }, { 0xffffffa, 28 }, { 0xffffffb, 28 },
+	{ 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 }, { 0x1ff9, 13 },
+	{ 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 }, { 0x3fa, 10 }, { 0x3fb, 10 },
+	{ 0xf9, 8 }, { 0x7fb, 11 }, { 0xfa, 8 }, { 0x16, 6 }, { 0x17, 6 },
+	{ 0x18, 6 }, { 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 }, { 0x1a, 6 },
+	{ 0x1b, 6 }, { 0x1c, 6 }, { 0x1d, 6 }, { 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 },
+	{ 0xfb, 8 }, { 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 },
+	{ 0x1ffa, 13 }, { 0x21, 6 }, { 0x5d, 7 }, { 0x5e, 7 }, { 0x5f, 7 },
+	{ 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 }, { 0x63, 7 }, { 0x64, 7 }, { 0x65, 7 },
+	{ 0x66, 7 }, { 0x67, 7 }, { 0x68, 7 }, { 0x69, 7 }, { 0x6a, 7 }, { 0x6b, 7 },
+	{ 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 }, { 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 },
+	{ 0x72, 7 }, { 0xfc, 8 }, { 0x73, 7 }, { 0xfd, 8 }, { 0x1ffb, 13 },
+	{ 0x7fff0, 19 }, { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 }, { 0x7ffd, 15 },
+	{ 0x3, 5 }, { 0x23, 6 }, { 0x4, 5 }, { 0x24, 6 }, { 0x5, 5 }, { 0x25, 6 },
+	{ 0x26, 6 }, { 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 }, { 0x28, 6 },
+	{ 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 }, { 0x2b, 6 }, { 0x76, 7 }, { 0x2c, 6 },
+	{ 0x8, 5 }, { 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 }, { 0x79, 7 },
+	{ 0x7a, 7 }, { 0x7b, 7 }, { 0x7ffe, 15 }, { 0x7fc, 11 }, { 0x3ffd, 14 },
+	{ 0x1ffd, 13 }, { 0xffffffc, 28 }, { 0xfffe6, 20 }, { 0x3fffd2, 22 },
+	{ 0xfffe7, 20 }, { 0xfffe8, 20 }, { 0x3fffd3, 22 }, { 0x3fffd4, 22 },
+	{ 0x3fffd5, 22 }, { 0x7fffd9, 23 }, { 0x3fffd6, 22 }, { 0x7fffda, 23 },
+	{ 0x7fffdb, 23 }, { 0x7fffdc, 23 }, { 0x7fffdd, 23 }, { 0x7fffde, 23 },
+	{ 0xffffeb, 24 }, { 0x7fffdf, 23 }, { 0xffffec, 24 }, { 0xffffed, 24 },
+	{ 0x3fffd7, 22 }, { 0x7fffe0, 23 }, { 0xffffee, 24 }, { 0x7fffe1, 23 },
+	{ 0x7fffe2, 23 }, { 0x7fffe3, 23 }, { 0x7fffe4, 23 }, { 0x1fffdc, 21 },
+	{ 0x3fffd8, 22 }, { 0x7fffe5, 23 }, { 0x3fffd9, 22 }, { 0x7fffe6, 23 },
+	{ 0x7fffe7, 23 }, { 0xffffef, 24 }, { 0x3fffda, 22 }, { 0x1fffdd, 21 },
+	{ 0xfffe9, 20 }, { 0x3fffdb, 22 }, { 0x3fffdc, 22 }, { 0x7fffe8, 23 },
+	{ 0x7fffe9, 23 }, { 0x1fffde, 21 }, { 0x7fffea, 23 }, { 0x3fffdd, 22 },
+	{ 0x3fffde, 22 }, { 0xfffff0, 24 }, { 0x1fffdf, 21 }, { 0x3fffdf, 22 },
+	{ 0x7fffeb, 23 }, { 0x7fffec, 23 }, { 0x1fffe0, 21 }, { 0x1fffe1, 21 },
+	{ 0x3fffe0, 22 }, { 0x1fffe2, 21 }, { 0x7fffed, 23 }, { 0x3fffe1, 22 },
+	{ 0x7fffee, 23 }, { 0x7fffef, 23 }, { 0xfffea, 20 }, { 0x3fffe2, 22 },
+	{ 0x3fffe3, 22 }, { 0x3fffe4, 22 }, { 0x7ffff0, 23 }, { 0x3fffe5, 22 },
+	{ 0x3fffe6, 22 }, { 0x7ffff1, 23 }, { 0x3ffffe0, 26 }, { 0x3ffffe1, 26 },
+	{ 0xfffeb, 20 }, { 0x7fff1, 19 }, { 0x3fffe7, 22 }, { 0x7ffff2, 23 },
+	{ 0x3fffe8, 22 }, { 0x1ffffec, 25 }, { 0x3ffffe2, 26 }, { 0x3ffffe3, 26 },
+	{ 0x3ffffe4, 26 }, { 0x7ffffde, 27 }, { 0x7ffffdf, 27 }, { 0x3ffffe5, 26 },
+	{ 0xfffff1, 24 }, { 0x1ffffed, 25 }, { 0x7fff2, 19 }, { 0x1fffe3, 21 },
+	{ 0x3ffffe6, 26 }, { 0x7ffffe0, 27 }, { 0x7ffffe1, 27 }, { 0x3ffffe7, 26 },
+	{ 0x7ffffe2, 27 }, { 0xfffff2, 24 }, { 0x1fffe4, 21 }, { 0x1fffe5, 21 },
+	{ 0x3ffffe8, 26 }, { 0x3ffffe9, 26 }, { 0xffffffd, 28 }, { 0x7ffffe3, 27 },
+	{ 0x7ffffe4, 27 }, { 0x7ffffe5, 27 }, { 0xfffec, 20 }, { 0xfffff3, 24 },
+	{ 0xfffed, 20 }, { 0x1fffe6, 21 }, { 0x3fffe9, 22 }, { 0x1fffe7, 21 },
+	{ 0x1fffe8, 21 }, { 0x7ffff3, 23 }, { 0x3fffea, 22 }, { 0x3fffeb, 22 },
+	{ 0x1ffffee, 25 }, { 0x1ffffef, 25 }, { 0xfffff4, 24 }, { 0xfffff5, 24 },
+	{ 0x3ffffea, 26 }, { 0x7ffff4, 23 }, { 0x3ffffeb, 26 }, { 0x7ffffe6, 27 },
+	{ 0x3ffffec, 26 }, { 0x3ffffed, 26 }, { 0x7ffffe7, 27 }, { 0x7ffffe8, 27 },
+	{ 0x7ffffe9, 27 }, { 0x7ffffea, 27 }, { 0x7ffffeb, 27 }, { 0xffffffe, 28 },
+	{ 0x7ffffec, 27 }, { 0x7ffffed, 27 }, { 0x7ffffee, 27 }, { 0x7ffffef, 27 },
+	{ 0x7fffff0, 27 }, { 0x3ffffee, 26 }, { 0x3fffffff, 30 },
+};
+
+
+#define HPACK_EOS 256
+
+/* Huffman decoding walks the code tree four bits at a time.  Every
+   internal node of the tree is a state; since the shortest code is 5 bits
+   long, a nibble emits at most one symbol.  A state accepts if the bits
+   consumed since the last symbol are a valid padding, i.e. at most 7 bits
+   of the EOS prefix.  */
+#define HPACK_HUFFMAN_STATES 256
+#define HPACK_FSM_EMIT 0x1
+#define HPACK_FSM_ACCEPT 0x2
+#define HPACK_FSM_FAIL 0x4
+
+struct fh_hpack_fsm_entry
+{
+	uint8_t next;
+	uint8_t flags;
+	uint8_t sym;
+};
+
+static struct fh_hpack_fsm_entry hpack_huffman_fsm[HPACK_HUFFMAN_STATES][16];
+
+/* Static table lookup by name goes through a perfect hash over the second
+   and the last character of the name and its length.  A slot holds the
+   first static index with that name; entries sharing a name are
+   adjacent.  */
+#define HPACK_NAME_SLOTS 64
+
+static const uint8_t hpack_name_asso[256] = {
+	['a'] = 35, ['c'] = 4,	['d'] = 37, ['e'] = 24, ['f'] = 25, ['g'] = 12,
+	['h'] = 3,	['i'] = 46, ['k'] = 10, ['l'] = 4,	['m'] = 48, ['n'] = 30,
+	['o'] = 53, ['p'] = 41, ['r'] = 45, ['s'] = 15, ['t'] = 61, ['u'] = 1,
+	['w'] = 5,	['x'] = 45, ['y'] = 20,
+};
+
+static uint8_t hpack_name_slots[HPACK_NAME_SLOTS];
+
+static inline size_t
+fh_hpack_name_hash (const char *name, size_t len)
+{
+	return (len + hpack_name_asso[(uint8_t) (name[1] | 0x20)]
+			+ hpack_name_asso[(uint8_t) (name[len - 1] | 0x20)])
+		   % HPACK_NAME_SLOTS;
+}
+
+static void __attribute__ ((constructor))
+fh_hpack_init (void)
+{
+	/* Children of the internal nodes: a positive value is another node,
+	   a negative one the leaf -(sym + 1).  Node 0 is the root.  */
+	int16_t tree[HPACK_HUFFMAN_STATES][2] = { 0 };
+	bool accept[HPACK_HUFFMAN_STATES] = { [0] = true };
+	int16_t nodes = 1;
+
+	for (int16_t sym = 0; sym <= HPACK_EOS; sym++)
+	{
+		const struct fh_hpack_code *code = &hpack_huffman_codes[sym];
+		int16_t node = 0;
+
+		for (uint8_t depth = 1; depth < code->bits; depth++)
+		{
+			const int bit = (code->code >> (code->bits - depth)) & 1;
+
+			if (!tree[node][bit])
+				tree[node][bit] = nodes++;
+
+			node = tree[node][bit];
+
+			if (sym == HPACK_EOS && depth <= 7)
+				accept[node] = true;
+		}
+
+		tree[node][code->code & 1] = (int16_t) -(sym + 1);
+	}
+
+	for (int state = 0; state < HPACK_HUFFMAN_STATES; state++)
+	{
+		for (int nibble = 0; nibble < 16; nibble++)
+		{
+			struct fh_hpack_fsm_entry *entry
+				= &hpack_huffman_fsm[state][nibble];
+			int16_t node = (int16_t) state;
+
+			for (int shift = 3; shift >= 0; shift--)
+			{
+				const int16_t child = tree[node][(nibble >> shift) & 1];
+
+				if (child >= 0)
+				{
+					node = child;
+					continue;
+				}
+
+				if (-child - 1 == HPACK_EOS)
+				{
+					entry->flags = HPACK_FSM_FAIL;
+					break;
+				}
+
+				entry->flags |= HPACK_FSM_EMIT;
+				entry->sym = (uint8_t) (-child - 1);
+				node = 0;
+			}
+
+			if (entry->flags & HPACK_FSM_FAIL)
+				continue;
+
+			entry->next = (uint8_t) node;
+
+			if (accept[node])
+				entry->flags |= HPACK_FSM_ACCEPT;
+		}
+	}
+
+	for (size_t i = HPACK_STATIC_COUNT; i >= 1; i--)
+	{
+		const struct fh_hpack_static_entry *entry = &hpack_static_table[i];
+
+		hpack_name_slots[fh_hpack_name_hash (entry->name, entry->name_len)]
+			= (uint8_t) i;
+	}
+}
+
+static bool
+fh_hpack_huffman_decode (const uint8_t *src, size_t len, char *dst,
+						 size_t *dst_len_ptr)
+{
+	char *pos = dst;
+	uint8_t state = 0;
+	uint8_t flags = HPACK_FSM_ACCEPT;
+
+	for (size_t i = 0; i < len; i++)
+	{
+		const struct fh_hpack_fsm_entry *entry
+			= &hpack_huffman_fsm[state][src[i] >> 4];
+
+		if (entry->flags & HPACK_FSM_FAIL)
+			return false;
+
+		if (entry->flags & HPACK_FSM_EMIT)
+			*pos++ = (char) entry->sym;
+
+		entry = &hpack_huffman_fsm[entry->next][src[i] & 0xF];
+
+		if (entry->flags & HPACK_FSM_FAIL)
+			return false;
+
+		if (entry->flags & HPACK_FSM_EMIT)
+			*pos++ = (char) entry->sym;
+
+		state = entry->next;
+		flags = entry->flags;
+	}
+
+	if (!(flags & HPACK_FSM_ACCEPT))
+		return false;
+
+	*dst_len_ptr = (size_t) (pos - dst);
+	return true;
+}
+
+static size_t
+fh_hpack_huffman_length (const char *str, size_t len, bool lowercase)
+{
+	size_t bits = 0;
+
+	for (size_t i = 0; i < len; i++)
+	{
+		const uint8_t c = lowercase ? (uint8_t) tolower ((unsigned char) str[i])
+									: (uint8_t) str[i];
+
+		bits += hpack_huffman_codes[c].bits;
+	}
+
+	return (bits + 7) / 8;
+}
+
+static void
+fh_hpack_huffman_encode (uint8_t *dst, const char *str, size_t len,
+						 bool lowercase)
+{
+	uint64_t acc = 0;
+	unsigned int bits = 0;
+
+	for (size_t i = 0; i < len; i++)
+	{
+		const uint8_t c = lowercase ? (uint8_t) tolower ((unsigned char) str[i])
+									: (uint8_t) str[i];
+		const struct fh_hpack_code *code = &hpack_huffman_codes[c];
+
+		acc = (acc << code->bits) | code->code;
+		bits += code->bits;
+
+		while (bits >= 8)
+		{
+			bits -= 8;
+			*dst++ = (uint8_t) (acc >> bits);
+		}
+	}
+
+	/* Pad with the most significant bits of EOS.  */
+	if (bits)
+		*dst = (uint8_t) ((acc << (8 - bits)) | (0xFFU >> bits));
+}
+
+static bool
+fh_hpack_decode_int (const uint8_t **pos_ptr, const uint8_t *end,
+					 uint8_t prefix_bits, size_t *value_ptr)
+{
+	const uint8_t *pos = *pos_ptr;
+	const uint8_t mask = (uint8_t) ((1U << prefix_bits) - 1);
+
+	if (pos >= end)
+		return false;
+
+	size_t value = *pos++ & mask;
+
+	if (value == mask)
+	{
+		unsigned int shift = 0;
+		uint8_t byte;
+
+		do
+		{
+			if (pos >= end || shift > 28)
+				return false;
+
+			byte = *pos++;
+			value += (size_t) (byte & 0x7F) << shift;
+			shift += 7;
+		}
+		while (byte & 0x80);
+	}
+
+	*pos_ptr = pos;
+	*value_ptr = value;
+	return true;
+}
+
+static bool
+fh_hpack_decode_string (const uint8_t **pos_ptr, const uint8_t *end,
+						pool_t *pool, const char **str_ptr, size_t *len_ptr)
+{
+	const uint8_t *pos = *pos_ptr;
+	size_t len;
+
+	if (pos >= end)
+		return false;
+
+	const bool huffman = *pos & 0x80;
+
+	if (!fh_hpack_decode_int (&pos, end, 7, &len)
+		|| len > (size_t) (end - pos))
+		return false;
+
+	/* The shortest code is 5 bits long.  */
+	char *str = fh_pool_alloc (pool, huffman ? (len * 8) / 5 + 1 : len + 1);
+
+	if (!str)
+		return false;
+
+	if (huffman)
+	{
+		if (!fh_hpack_huffman_decode (pos, len, str, len_ptr))
+			return false;
+	}
+	else
+	{
+		memcpy (str, pos, len);
+		*len_ptr = len;
+	}
+
+	str[*len_ptr] = 0;
+	*str_ptr = str;
+	*pos_ptr = pos + len;
+	return true;
+}
+
+static void
+fh_hpack_ring_write (struct fh_hpack_table *table, size_t off,
+					 const char *src, size_t len)
+{
+	const size_t first = table->capacity - off < len ? table->capacity - off
+													 : len;
+
+	memcpy (table->data + off, src, first);
+	memcpy (table->data, src + first, len - first);
+}
+
+static void
+fh_hpack_ring_read (const struct fh_hpack_table *table, size_t off, char *dst,
+					size_t len)
+{
+	const size_t first = table->capacity - off < len ? table->capacity - off
+													 : len;
+
+	memcpy (dst, table->data + off, first);
+	memcpy (dst + first, table->data, len - first);
+	dst[len] = 0;
+}
+
+static void
+fh_hpack_table_evict (struct fh_hpack_table *table, size_t max_size)
+{
+	while (table->size > max_size && table->count)
+	{
+		const struct fh_hpack_entry *entry = &table->entries[table->first];
+
+		table->size -= entry->name_len + entry->value_len
+					   + FH_HPACK_ENTRY_OVERHEAD;
+		table->first = (table->first + 1) % table->slots;
+		table->count--;
+	}
+
+	if (!table->count)
+		table->first = table->data_end = 0;
+}
+
+static void
+fh_hpack_table_add (struct fh_hpack_table *table, const char *name,
+					size_t name_len, const char *value, size_t value_len)
+{
+	const size_t size = name_len + value_len + FH_HPACK_ENTRY_OVERHEAD;
+
+	/* An entry larger than the table empties it and is not added.  */
+	if (size > table->max_size)
+	{
+		fh_hpack_table_evict (table, 0);
+		return;
+	}
+
+	fh_hpack_table_evict (table, table->max_size - size);
+
+	/* The live strings take less than size - 32 * count bytes, so the new
+	   ones never run into the oldest entry, and there is always a free
+	   slot.  */
+	struct fh_hpack_entry *entry
+		= &table->entries[(table->first + table->count) % table->slots];
+
+	entry->off = (uint32_t) table->data_end;
+	entry->name_len = (uint32_t) name_len;
+	entry->value_len = (uint32_t) value_len;
+
+	fh_hpack_ring_write (table, entry->off, name, name_len);
+	fh_hpack_ring_write (table, (entry->off + name_len) % table->capacity,
+						 value, value_len);
+
+	table->data_end = (entry->off + name_len + value_len) % table->capacity;
+	table->size += size;
+	table->count++;
+}
+
+/* Resolves an index into the combined static and dynamic index space.
+   Dynamic table strings are copied, since the entry may be evicted
+   before the caller is done with them: into `scratch' if it is given,
+   which has room for the largest entry, and into the pool otherwise.  */
+static bool
+fh_hpack_lookup (struct fh_hpack_table *table, pool_t *pool, char *scratch,
+				 size_t index, bool with_value, const char **name_ptr,
+				 size_t *name_len_ptr, const char **value_ptr,
+				 size_t *value_len_ptr)
+{
+	if (index == 0)
+		return false;
+
+	if (index <= HPACK_STATIC_COUNT)
+	{
+		const struct fh_hpack_static_entry *entry = &hpack_static_table[index];
+
+		*name_ptr = entry->name;
+		*name_len_ptr = entry->name_len;
+
+		if (with_value)
+		{
+			*value_ptr = entry->value;
+			*value_len_ptr = entry->value_len;
+		}
+
+		return true;
+	}
+
+	index -= HPACK_STATIC_COUNT + 1;
+
+	if (index >= table->count)
+		return false;
+
+	const struct fh_hpack_entry *entry
+		= &table->entries[(table->first + table->count - 1 - index)
+						  % table->slots];
+	const size_t copy_len
+		= entry->name_len + (with_value ? entry->value_len : 0);
+	char *copy = scratch ? scratch : fh_pool_alloc (pool, copy_len + 2);
+
+	if (!copy)
+		return false;
+
+	fh_hpack_ring_read (table, entry->off, copy, entry->name_len);
+	*name_ptr = copy;
+	*name_len_ptr = entry->name_len;
+
+	if (with_value)
+	{
+		fh_hpack_ring_read (table,
+							(entry->off + entry->name_len) % table->capacity,
+							copy + entry->name_len + 1, entry->value_len);
+		*value_ptr = copy + entry->name_len + 1;
+		*value_len_ptr = entry->value_len;
+	}
+
+	return true;
+}
+
+bool
+fh_hpack_decoder_init (struct fh_hpack_decoder *decoder, size_t capacity)
+{
+	struct fh_hpack_table *table = &decoder->table;
+
+	memset (decoder, 0, sizeof (*decoder));
+	table->max_size = capacity;
+	table->capacity = capacity;
+	table->slots = capacity / FH_HPACK_ENTRY_OVERHEAD;
+
+	if (!capacity)
+		return true;
+
+	table->data = malloc (capacity);
+	table->entries = malloc (table->slots * sizeof (*table->entries));
+
+	if (!table->data || !table->entries)
+	{
+		fh_hpack_decoder_free (decoder);
+		return false;
+	}
+
+	return true;
+}
+
+void
+fh_hpack_decoder_free (struct fh_hpack_decoder *decoder)
+{
+	free (decoder->table.data);
+	free (decoder->table.entries);
+	decoder->table.data = NULL;
+	decoder->table.entries = NULL;
+	decoder->table.count = decoder->table.size = 0;
+}
+
+bool
+fh_hpack_decode (struct fh_hpack_decoder *decoder, pool_t *pool,
+				 const uint8_t *src, size_t len, fh_hpack_header_cb_t cb,
+				 void *data)
+{
+	struct fh_hpack_table *table = &decoder->table;
+	const uint8_t *pos = src, *end = src + len;
+	bool fields_seen = false;
+	size_t list_size = 0;
+	/* Once the list is too large, dynamic table entries are copied here
+	   instead of into the pool, so that a short block of indexed fields
+	   cannot make it grow by a table entry each */
+	char *scratch = NULL;
+
+	decoder->list_too_large = false;
+
+	while (pos < end)
+	{
+		const uint8_t byte = *pos;
+		const char *name = NULL, *value = NULL;
+		size_t name_len = 0, value_len = 0, index;
+
+		if (byte & 0x80)
+		{
+			/* Indexed header field */
+			if (!fh_hpack_decode_int (&pos, end, 7, &index)
+				|| !fh_hpack_lookup (table, pool, scratch, index, true, &name,
+									 &name_len, &value, &value_len))
+				return false;
+		}
+		else if ((byte & 0xE0) == 0x20)
+		{
+			/* Dynamic table size update; only allowed before the first
+			   field of a block.  */
+			if (fields_seen || !fh_hpack_decode_int (&pos, end, 5, &index)
+				|| index > table->capacity)
+				return false;
+
+			table->max_size = index;
+			fh_hpack_table_evict (table, index);
+			continue;
+		}
+		else
+		{
+			/* Literal header field, with incremental indexing (6-bit
+			   prefix), without indexing or never indexed (4-bit).  */
+			const bool indexing = (byte & 0xC0) == 0x40;
+
+			if (!fh_hpack_decode_int (&pos, end, indexing ? 6 : 4, &index))
+				return false;
+
+			if (index
+					? !fh_hpack_lookup (table, pool, scratch, index, false,
+										&name, &name_len, NULL, NULL)
+					: !fh_hpack_decode_string (&pos, end, pool, &name,
+											   &name_len))
+				return false;
+
+			if (!fh_hpack_decode_string (&pos, end, pool, &value, &value_len))
+				return false;
+
+			if (indexing)
+				fh_hpack_table_add (table, name, name_len, value, value_len);
+		}
+
+		fields_seen = true;
+		list_size += name_len + value_len + FH_HPACK_ENTRY_OVERHEAD;
+
+		if (decoder->max_list_size && list_size > decoder->max_list_size
+			&& !decoder->list_too_large)
+		{
+			decoder->list_too_large = true;
+			scratch = fh_pool_alloc (pool, table->capacity + 2);
+
+			if (!scratch)
+				return false;
+		}
+
+		if (decoder->list_too_large)
+			continue;
+
+		if (!cb (data, name, name_len, value, value_len))
+			return false;
+	}
+
+	return true;
+}
+
+static size_t
+fh_hpack_encode_int (uint8_t *dst, size_t cap, uint8_t first,
+					 uint8_t prefix_bits, size_t value)
+{
+	const uint8_t mask = (uint8_t) ((1U << prefix_bits) - 1);
+	size_t off = 0;
+
+	if (cap == 0)
+		return 0;
+
+	if (value < mask)
+	{
+		dst[off++] = first | (uint8_t) value;
+		return off;
+	}
+
+	dst[off++] = first | mask;
+	value -= mask;
+
+	while (value >= 0x80)
+	{
+		if (off >= cap)
+			return 0;
+
+		dst[off++] = (uint8_t) ((value & 0x7F) | 0x80);
+		value >>= 7;
+	}
+
+	if (off >= cap)
+		return 0;
+
+	dst[off++] = (uint8_t) value;
+	return off;
+}
+
+/* Strings are Huffman coded whenever that makes them shorter.  */
+static size_t
+fh_hpack_encode_string (uint8_t *dst, size_t cap, const char *str, size_t len,
+						bool lowercase)
+{
+	const size_t huffman_len = fh_hpack_huffman_length (str, len, lowercase);
+	const bool huffman = huffman_len < len;
+	const size_t out_len = huffman ? huffman_len : len;
+	size_t off
+		= fh_hpack_encode_int (dst, cap, huffman ? 0x80 : 0x00, 7, out_len);
+
+	if (!off || cap - off < out_len)
+		return 0;
+
+	if (huffman)
+	{
+		fh_hpack_huffman_encode (dst + off, str, len, lowercase);
+	}
+	else if (lowercase)
+	{
+		for (size_t i = 0; i < len; i++)
+			dst[off + i] = (uint8_t) tolower ((unsigned char) str[i]);
+	}
+	else
+	{
+		memcpy (dst + off, str, len);
+	}
+
+	return off + out_len;
+}
+
+/* Returns the static index matching both name and value, or 0 and the
+   first index with a matching name (if any) in *name_index_ptr.  */
+static size_t
+fh_hpack_static_find (const char *name, size_t name_len, const char *value,
+					  size_t value_len, size_t *name_index_ptr)
+{
+	*name_index_ptr = 0;
+
+	if (name_len < 2)
+		return 0;
+
+	size_t index = hpack_name_slots[fh_hpack_name_hash (name, name_len)];
+
+	if (!index || hpack_static_table[index].name_len != name_len
+		|| strncasecmp (hpack_static_table[index].name, name, name_len))
+		return 0;
+
+	*name_index_ptr = index;
+
+	for (; index <= HPACK_STATIC_COUNT; index++)
+	{
+		const struct fh_hpack_static_entry *entry = &hpack_static_table[index];
+
+		if (entry->name_len != name_len
+			|| memcmp (entry->name, hpack_static_table[*name_index_ptr].name,
+					   name_len))
+			break;
+
+		if (entry->value_len && entry->value_len == value_len
+			&& !memcmp (entry->value, value, value_len))
+			return index;
+	}
+
+	return 0;
+}
+
+size_t
+fh_hpack_encode_status (uint8_t *dst, size_t cap, unsigned int status)
+{
+	char value[3];
+
+	value[0] = (char) ('0' + (status / 100) % 10);
+	value[1] = (char) ('0' + (status / 10) % 10);
+	value[2] = (char) ('0' + status % 10);
+
+	return fh_hpack_encode_field (dst, cap, ":status", 7, value, 3);
+}
+
+size_t
+fh_hpack_encode_field (uint8_t *dst, size_t cap, const char *name,
+					   size_t name_len, const char *value, size_t value_len)
+{
+	size_t name_index;
+	const size_t index
+		= fh_hpack_static_find (name, name_len, value, value_len, &name_index);
+
+	if (index)
+		return fh_hpack_encode_int (dst, cap, 0x80, 7, index);
+
+	size_t off = fh_hpack_encode_int (dst, cap, 0x00, 4, name_index), n;
+
+	if (!off)
+		return 0;
+
+	if (!name_index)
+	{
+		n = fh_hpack_encode_string (dst + off, cap - off, name, name_len,
+									true);
+
+		if (!n)
+			return 0;
+
+		off += n;
+	}
+
+	n = fh_hpack_encode_string (dst + off, cap - off, value, value_len, false);
+	return n ? off + n : 0;
+}
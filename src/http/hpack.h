@@ -0,0 +1,88 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FH_HTTP_HPACK_H
+#define FH_HTTP_HPACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mm/pool.h"
+
+#define FH_HPACK_DEFAULT_TABLE_SIZE 4096
+#define FH_HPACK_ENTRY_OVERHEAD 32
+
+struct fh_hpack_entry;
+
+/* The dynamic table of a decoder (RFC 7541, section 2.3.2).  Both the
+   strings and the entries are kept in rings allocated once, at init.  */
+struct fh_hpack_table
+{
+	/* String storage, capacity bytes */
+	char *data;
+	/* Every entry takes at least 32 bytes of the table size, so there can
+	   never be more than capacity / 32 of them.  */
+	struct fh_hpack_entry *entries;
+	size_t slots;
+	/* Slot of the oldest entry */
+	size_t first;
+	size_t count;
+	/* Where the strings of the next entry go */
+	size_t data_end;
+	/* Sum of the entry sizes, as defined in section 4.1 */
+	size_t size;
+	/* Current limit, as set by the last dynamic table size update */
+	size_t max_size;
+	/* Upper bound for max_size, i.e. our SETTINGS_HEADER_TABLE_SIZE */
+	size_t capacity;
+};
+
+struct fh_hpack_decoder
+{
+	struct fh_hpack_table table;
+	/* Limit on the size of a decoded header list, counted as in section
+	   4.1, or 0 for none.  Fields past it are still decoded, to keep the
+	   table in sync, but not passed on, and list_too_large is set.  */
+	size_t max_list_size;
+	bool list_too_large;
+};
+
+/* Called for every decoded header field.  The strings are allocated in the
+   pool given to fh_hpack_decode() or are static.  */
+typedef bool (*fh_hpack_header_cb_t) (void *data, const char *name,
+									  size_t name_len, const char *value,
+									  size_t value_len);
+
+bool fh_hpack_decoder_init (struct fh_hpack_decoder *decoder, size_t capacity);
+void fh_hpack_decoder_free (struct fh_hpack_decoder *decoder);
+bool fh_hpack_decode (struct fh_hpack_decoder *decoder, pool_t *pool,
+					  const uint8_t *src, size_t len, fh_hpack_header_cb_t cb,
+					  void *data);
+
+/* The encoder never adds anything to the peer's dynamic table; it uses
+   static table matches and Huffman coding only.  Both return the number
+   of bytes written, or 0 if dst is too small.  Header names are
+   lowercased on the way out.  */
+size_t fh_hpack_encode_status (uint8_t *dst, size_t cap, unsigned int status);
+size_t fh_hpack_encode_field (uint8_t *dst, size_t cap, const char *name,
+							  size_t name_len, const char *value,
+							  size_t value_len);
+
+#endif /* FH_HTTP_HPACK_H */
@@ -29,6 +29,8 @@
 #define FH_LOG_MODULE_NAME "http1/request"
 
 #include "compat.h"
+#include "core/conf.h"
+#include "core/server.h"
 #include "core/stream.h"
 #include "http1.h"
 #include "http1_request.h"
@@ -106,8 +108,7 @@ fh_http1_parse_method (struct fh_http1_req_ctx *ctx)
 
 				const char *method;
 				bool is_fragmented = ctx->cur.link != cur->link;
-				size_t eff_len
-					= is_fragmented ? ctx->current_consumed : memchr_consumed;
+				size_t eff_len = ctx->current_consumed;
 
 				if (eff_len == 0)
 				{
@@ -150,7 +151,7 @@ fh_http1_parse_method (struct fh_http1_req_ctx *ctx)
 				}
 				else
 				{
-					method = (const char *) (start_ptr);
+					method = (const char *) (buf->attrs.mem.data + ctx->cur.off);
 				}
 
 				bool method_found = false;
@@ -231,8 +232,7 @@ fh_http1_parse_uri (struct fh_http1_req_ctx *ctx)
 
 				const char *uri;
 				bool is_fragmented = ctx->cur.link != cur->link;
-				size_t eff_len
-					= is_fragmented ? ctx->current_consumed : memchr_consumed;
+				size_t eff_len = ctx->current_consumed;
 
 				if (eff_len == 0)
 				{
@@ -274,7 +274,7 @@ fh_http1_parse_uri (struct fh_http1_req_ctx *ctx)
 				}
 				else
 				{
-					uri = (const char *) (start_ptr);
+					uri = (const char *) (buf->attrs.mem.data + ctx->cur.off);
 				}
 
 				ctx->request.uri = uri;
@@ -340,8 +340,7 @@ fh_http1_parse_version (struct fh_http1_req_ctx *ctx)
 
 				const char *version;
 				bool is_fragmented = ctx->cur.link != cur->link;
-				size_t eff_len
-					= is_fragmented ? ctx->current_consumed : memchr_consumed;
+				size_t eff_len = ctx->current_consumed;
 
 				if (eff_len != HTTP1_VERSION_MAX_LEN + 1)
 				{
@@ -378,7 +377,7 @@ fh_http1_parse_version (struct fh_http1_req_ctx *ctx)
 				}
 				else
 				{
-					version = (const char *) (start_ptr);
+					version = (const char *) (buf->attrs.mem.data + ctx->cur.off);
 				}
 
 				if (version[eff_len - 1] != '\r')
@@ -514,8 +513,7 @@ fh_http1_parse_header_name (struct fh_http1_req_ctx *ctx)
 
 				const char *header_name;
 				bool is_fragmented = ctx->cur.link != cur->link;
-				size_t eff_len
-					= is_fragmented ? ctx->current_consumed : memchr_consumed;
+				size_t eff_len = ctx->current_consumed;
 
 				if (eff_len == 0)
 				{
@@ -557,7 +555,7 @@ fh_http1_parse_header_name (struct fh_http1_req_ctx *ctx)
 				}
 				else
 				{
-					header_name = (const char *) (start_ptr);
+					header_name = (const char *) (buf->attrs.mem.data + ctx->cur.off);
 				}
 
 				ctx->current_header_name = header_name;
@@ -729,8 +727,7 @@ fh_http1_parse_header_value (struct fh_http1_req_ctx *ctx)
 
 				const char *header_value;
 				bool is_fragmented = ctx->cur.link != cur->link;
-				size_t eff_len
-					= is_fragmented ? ctx->current_consumed :memchr_consumed;
+				size_t eff_len = ctx->current_consumed;
 
 				if (eff_len == 0)
 				{
@@ -780,7 +777,7 @@ fh_http1_parse_header_value (struct fh_http1_req_ctx *ctx)
 				}
 				else
 				{
-					header_value = (const char *) (start_ptr);
+					header_value = (const char *) (buf->attrs.mem.data + ctx->cur.off);
 				}
 
 				size_t trimmed_len = 0;
@@ -850,22 +847,23 @@ fh_http1_validate (struct fh_http1_req_ctx *ctx,
 		return H1_ERR (400);
 	}
 
+	/* The body is buffered before the request is handled */
+	if (ctx->server && ctx->server->config
+		&& ctx->request.content_length
+			   > ctx->server->config->security->max_request_body_size)
+	{
+		fh_pr_debug ("Request body of %lu bytes is too large",
+					 ctx->request.content_length);
+		return H1_ERR (413);
+	}
+
 	return H1_NEXT;
 }
 
 static unsigned int
 fh_http1_parse_body (struct fh_http1_req_ctx *ctx, struct fh_conn *conn)
 {
-	if (ctx->request.content_length == 0)
-	{
-		unsigned int rc = 0;
-
-		if ((rc = fh_http1_validate (ctx, conn)) != H1_NEXT)
-			return rc;
-
-		return H1_DONE;
-	}
-
+	struct fh_request *request = &ctx->request;
 	struct fh_http1_cursor *cur = &ctx->arg_cur;
 
 	if (!ctx->is_streaming_body)
@@ -875,63 +873,70 @@ fh_http1_parse_body (struct fh_http1_req_ctx *ctx, struct fh_conn *conn)
 		if ((rc = fh_http1_validate (ctx, conn)) != H1_NEXT)
 			return rc;
 
-		struct fh_link *current = cur->link;
+		if (request->content_length == 0)
+			return H1_DONE;
 
-		if (!current)
+		if (!cur->link)
 			return H1_ERR (500);
 
+		/* The body starts a link of its own, over whatever followed the
+		   head in the current buffer and the room left in it.  */
+		struct fh_link *current = cur->link;
 		struct fh_buf *buf = current->buf;
+		const size_t off
+			= cur->off < buf->attrs.mem.len ? cur->off : buf->attrs.mem.len;
+		struct fh_link *body
+			= fh_link_new_data (ctx->stream->pool, buf->attrs.mem.data + off,
+								buf->attrs.mem.len - off, false);
 
-		uint8_t *start = buf->attrs.mem.data + cur->off;
-		size_t len
-			= cur->off < buf->attrs.mem.len ? buf->attrs.mem.len - cur->off : 0;
-
-		struct fh_buf *new_buf;
-
-		if (len > 0)
-			new_buf = fh_stream_add_buf_data (ctx->stream, start, len, len);
-		else
-			new_buf = fh_stream_alloc_buf_data (ctx->stream, DEFAULT_BUF_SIZE);
-
-		if (!new_buf)
+		if (!body)
 			return H1_ERR (500);
 
-		if (len > 0)
+		if (ctx->stream->tail == current)
 		{
-			buf->attrs.mem.len -= len;
-			ctx->current_consumed += len;
+			body->buf->attrs.mem.cap = buf->attrs.mem.cap - off;
+			ctx->stream->tail = body;
 		}
+
+		buf->attrs.mem.len = buf->attrs.mem.cap = off;
+		body->next = current->next;
+		current->next = body;
+		request->body_start = body;
+		cur->link = body;
+		cur->off = 0;
+		ctx->current_consumed = 0;
+		ctx->is_streaming_body = true;
 	}
 
-	while (cur->link && ctx->current_consumed <= ctx->request.content_length)
+	while (cur->link)
 	{
-		struct fh_buf *buf = cur->link->buf;
+		struct fh_link *link = cur->link;
+		const size_t avail = link->buf->attrs.mem.len - cur->off;
+		const uint64_t left = request->content_length - ctx->current_consumed;
 
-		if (cur->off < buf->attrs.mem.len)
+		if (avail >= left)
 		{
-			size_t len = buf->attrs.mem.len - cur->off;
-
-			if (len > 0)
-			{
-				cur->off += len;
-				ctx->current_consumed += len;
-			}
+			/* Anything past the body is not part of this request.  */
+			link->buf->attrs.mem.len = cur->off + (size_t) left;
+			link->next = NULL;
+			link->is_eos = true;
+			ctx->stream->tail = link;
+			ctx->current_consumed += left;
+			cur->off += (size_t) left;
+			return H1_DONE;
 		}
 
-		if (!cur->link->next)
-		{
-			if (ctx->current_consumed <= ctx->request.content_length)
-				return H1_RECV;
+		ctx->current_consumed += avail;
+		cur->off += avail;
 
+		if (!link->next)
 			break;
-		}
 
-		cur->link = cur->link->next;
+		cur->link = link->next;
 		cur->off = 0;
 	}
 
-	ctx->stream->tail->is_eos = true;
-	return H1_DONE;
+	return H1_RECV;
 }
 
 static unsigned int
@@ -961,11 +966,13 @@ fh_http1_recv (struct fh_http1_req_ctx *ctx, struct fh_conn *conn)
 		is_allocated = true;
 	}
 
-	ssize_t bytes_read = recv (conn->client_sockfd, ptr, readable, 0);
+	ssize_t bytes_read = fh_conn_recv (conn, ptr, readable);
+
+	if (bytes_read <= 0 && is_allocated)
+		fh_pool_undo_last_alloc (ctx->stream->pool, DEFAULT_BUF_SIZE);
 
 	if (bytes_read < 0)
 	{
-		fh_pool_undo_last_alloc (ctx->stream->pool, DEFAULT_BUF_SIZE);
 
 		if (would_block ())
 		{
@@ -978,7 +985,6 @@ fh_http1_recv (struct fh_http1_req_ctx *ctx, struct fh_conn *conn)
 	}
 	else if (bytes_read == 0)
 	{
-		fh_pool_undo_last_alloc (ctx->stream->pool, DEFAULT_BUF_SIZE);
 		fh_pr_debug ("recv error: possible HUP: %s", strerror (errno));
 		return H1_ERR (0);
 	}
@@ -27,7 +27,6 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
-#include <sys/sendfile.h>
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <time.h>
@@ -36,12 +35,15 @@
 #define FH_LOG_MODULE_NAME "http1/response"
 
 #include "compat.h"
+#include "core/stats.h"
 #include "core/stream.h"
+#include "filter.h"
 #include "http1.h"
 #include "http1_response.h"
 #include "log/log.h"
 #include "macros.h"
 #include "mm/pool.h"
+#include "probes.h"
 #include "utils/strutils.h"
 #include "utils/utils.h"
 
@@ -60,8 +62,6 @@
 	(ctx)->iov_size = (size);                                                  \
 	(ctx)->iov_data_size = (data_size);
 
-static char default_date_header_value[64] = { 0 };
-
 static struct fh_header default_headers[] = {
 	{
 		.name = "Server",
@@ -72,7 +72,7 @@ static struct fh_header default_headers[] = {
 	{
 		.name = "Date",
 		.name_len = 4,
-		.value = default_date_header_value,
+		.value = NULL,
 		.value_len = 29,
 	},
 	{
@@ -94,7 +94,6 @@ static const size_t default_header_count
 static struct fh_header *default_headers_tail
 	= default_headers + (default_header_count - 1);
 static size_t default_headers_http_size = 0;
-static time_t last_date_header_update_time = 0;
 
 static struct fh_buf default_error_response_buf = {
 	.type = FH_BUF_DATA,
@@ -159,13 +158,9 @@ fh_http1_res_ctx_create (pool_t *pool)
 	ctx->iov = NULL;
 	ctx->iov_size = 0;
 	ctx->iov_data_size = 0;
+	ctx->link = NULL;
 	ctx->state = FH_RES_STATE_HEADERS;
-	ctx->response->protocol = FH_PROTOCOL_HTTP_1_1;
-	ctx->response->encoding = FH_ENCODING_PLAIN;
-	ctx->response->no_send_body = false;
-	ctx->response->headers = NULL;
-	ctx->response->content_length = 0;
-	ctx->response->pool = pool;
+	fh_response_init (ctx->response, pool);
 
 	return ctx;
 }
@@ -183,6 +178,7 @@ fh_http1_res_ctx_create_with_response (pool_t *pool,
 	ctx->iov = NULL;
 	ctx->iov_size = 0;
 	ctx->iov_data_size = 0;
+	ctx->link = NULL;
 	ctx->state = FH_RES_STATE_HEADERS;
 	ctx->response = response;
 	ctx->response->pool = pool;
@@ -190,39 +186,27 @@ fh_http1_res_ctx_create_with_response (pool_t *pool,
 	return ctx;
 }
 
-__always_inline static inline void
-fh_update_date_header_value (time_t now)
-{
-	struct tm gmt_tm;
-	const char *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
-							 "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
-	const char *days[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
-
-	gmtime_r (&now, &gmt_tm);
-	snprintf (default_date_header_value, sizeof (default_date_header_value),
-			  "%3s, %02d %3s %04d %02d:%02d:%02d GMT", days[gmt_tm.tm_wday],
-			  gmt_tm.tm_mday, months[gmt_tm.tm_mon], gmt_tm.tm_year + 1900,
-			  gmt_tm.tm_hour, gmt_tm.tm_min, gmt_tm.tm_sec);
-}
-
 __always_inline static inline void
 fh_update_static_headers (void)
 {
-	time_t now = time (NULL);
-
-	if (now != last_date_header_update_time)
-	{
-		fh_update_date_header_value (now);
-		last_date_header_update_time = now;
-	}
+	default_headers[1].value = fh_http_date_now ();
 }
 
 __always_inline static inline bool
 fh_add_misc_headers (struct fh_response *response, struct iovec *iov,
-					 size_t *iov_index_ptr, bool set_transfer_encoding)
+					 size_t *iov_index_ptr, size_t *data_size_ptr,
+					 bool set_transfer_encoding)
 {
 	size_t iov_index = *iov_index_ptr;
 
+	if (response->content_type)
+	{
+		fh_add_header_iov (iov, iov_index, "Content-Type", 12,
+						   response->content_type, response->content_type_len);
+		iov_index += 4;
+		*data_size_ptr += 12 + response->content_type_len + 4;
+	}
+
 	if (set_transfer_encoding)
 	{
 		size_t encoding_len = 0;
@@ -231,6 +215,7 @@ fh_add_misc_headers (struct fh_response *response, struct iovec *iov,
 		fh_add_header_iov (iov, iov_index, "Transfer-Encoding", 17,
 						   transfer_encoding, encoding_len);
 		iov_index += 4;
+		*data_size_ptr += 17 + encoding_len + 4;
 	}
 	else
 	{
@@ -250,6 +235,7 @@ fh_add_misc_headers (struct fh_response *response, struct iovec *iov,
 		fh_add_header_iov (iov, iov_index, "Content-Length", 14, content_length,
 						   (size_t) content_length_len);
 		iov_index += 4;
+		*data_size_ptr += 14 + (size_t) content_length_len + 4;
 	}
 
 	*iov_index_ptr = iov_index;
@@ -261,57 +247,108 @@ fh_use_default_error_response (struct fh_http1_res_ctx *ctx,
 							   struct fh_conn *conn,
 							   struct fh_response *response)
 {
-	size_t status_text_len = 0;
-	size_t description_len = 0;
-	const char *status_text
-		= fh_get_status_text (response->status, &status_text_len);
-	const char *description
-		= fh_get_status_description (response->status, &description_len);
-	uint16_t port = conn->extra->port;
-	const char *host = conn->extra->host;
-	size_t host_len = conn->extra->host_len;
-	size_t buf_len = resource_error_html_len - 16 + (status_text_len * 2)
-					 + (3 * 2) + description_len
-					 + (port < 10	   ? 1
-						: port < 100   ? 2
-						: port < 1000  ? 3
-						: port < 10000 ? 4
-									   : 5)
-					 + host_len;
-	char *data = fh_pool_alloc (ctx->pool, buf_len + 1);
+	size_t buf_len = 0;
+	char *data = fh_response_error_page (ctx->pool, response->status,
+										 conn->extra->host,
+										 conn->extra->host_len,
+										 conn->extra->port, &buf_len);
 
 	if (!data)
 		return false;
 
-	if (snprintf (data, buf_len + 1, resource_error_html, response->status,
-				  status_text, response->status, status_text, description,
-				  (int) host_len, host, port)
-		< 0)
-		return false;
-
 	default_error_response_buf.attrs.mem.data = (uint8_t *) data;
 	default_error_response_buf.attrs.mem.len = buf_len;
 	default_error_response_buf.attrs.mem.cap = buf_len;
 	response->encoding = FH_ENCODING_PLAIN;
 	response->content_length = buf_len;
+	response->content_type = "text/html; charset=UTF-8";
+	response->content_type_len = 24;
+	response->body_start = &default_error_response_link;
+	response->filters = NULL;
 
 	return true;
 }
 
+static int
+fh_http1_chunked_filter (struct fh_filter *filter, struct fh_link *in,
+						 struct fh_link **out_ptr)
+{
+	static const char chunk_trailer[] = "\r\n0\r\n\r\n";
+	struct fh_link *last = NULL;
+	size_t size = 0;
+	bool eos = false;
+
+	for (struct fh_link *link = in; link; link = link->next)
+	{
+		size += fh_link_size (link);
+		last = link;
+
+		if (link->is_eos)
+		{
+			eos = true;
+			break;
+		}
+	}
+
+	if (!size)
+	{
+		*out_ptr = eos ? fh_link_new_data (filter->response->pool,
+										   (const uint8_t *) chunk_trailer + 2,
+										   5, true)
+					   : NULL;
+		return eos && !*out_ptr ? FH_FILTER_ERROR : FH_FILTER_OK;
+	}
+
+	struct fh_link *header = fh_pool_alloc (
+		filter->response->pool, sizeof (*header) + sizeof (*header->buf) + 20);
+	struct fh_link *trailer
+		= fh_link_new_data (filter->response->pool,
+							(const uint8_t *) chunk_trailer, eos ? 7 : 2, eos);
+
+	if (!header || !trailer)
+		return FH_FILTER_ERROR;
+
+	header->buf = (struct fh_buf *) (header + 1);
+	header->buf->type = FH_BUF_DATA;
+	header->buf->freeable = false;
+	header->buf->attrs.mem.rd_only = false;
+	header->buf->attrs.mem.data = (uint8_t *) (header->buf + 1);
+	header->buf->attrs.mem.cap = 20;
+	header->buf->attrs.mem.len = (size_t) snprintf (
+		(char *) header->buf->attrs.mem.data, 20, "%zx\r\n", size);
+	header->is_eos = false;
+	header->is_start = false;
+	header->next = in;
+
+	last->is_eos = false;
+	last->next = trailer;
+
+	*out_ptr = header;
+	return FH_FILTER_OK;
+}
+
 static unsigned int
 fh_res_send_headers (struct fh_http1_res_ctx *ctx, struct fh_conn *conn)
 {
 	(void) conn;
 
 	struct fh_response *response = ctx->response;
+
+	if (response->headers_pending)
+	{
+		errno = EAGAIN;
+		return H1_RES_AGAIN;
+	}
+
 	struct fh_headers *headers = response->headers;
-	const bool set_transfer_encoding = response->encoding != FH_ENCODING_PLAIN;
-	const size_t generated_header_count = 1;
+	const size_t generated_header_count = 2;
 	const size_t header_count = (headers ? headers->count : 0)
 								+ default_header_count + generated_header_count;
-	size_t status_text_len = 0;
+	size_t status_text_len = response->reason_len;
 	const char *status_text
-		= fh_get_status_text (response->status, &status_text_len);
+		= response->reason
+			  ? response->reason
+			  : fh_get_status_text (response->status, &status_text_len);
 	const size_t status_line_len = 8 + 1 + 3 + 1 + status_text_len + 2;
 	const size_t iov_count = (4 * header_count) + 2;
 	size_t iov_index = 0;
@@ -321,14 +358,17 @@ fh_res_send_headers (struct fh_http1_res_ctx *ctx, struct fh_conn *conn)
 	if (!iov)
 		return H1_RES_ERR;
 
-	const size_t total_data_size = status_line_len + default_headers_http_size
+	fh_stats_response (response->status);
+
+	size_t total_data_size = status_line_len + default_headers_http_size
 								   + (headers ? headers->total_http1_size : 0)
 								   + 2;
 	char *status_line_buf = (char *) (iov + iov_count);
 
-	if (snprintf (status_line_buf, status_line_len + 1, "HTTP/1.%c %3u %s\r\n",
+	if (snprintf (status_line_buf, status_line_len + 1,
+				  "HTTP/1.%c %3u %.*s\r\n",
 				  response->protocol == FH_PROTOCOL_HTTP_1_0 ? '0' : '1',
-				  response->status, status_text)
+				  response->status, (int) status_text_len, status_text)
 		< 0)
 		return H1_RES_ERR;
 
@@ -343,10 +383,16 @@ fh_res_send_headers (struct fh_http1_res_ctx *ctx, struct fh_conn *conn)
 			return H1_RES_ERR;
 	}
 
+	const bool set_transfer_encoding = response->encoding != FH_ENCODING_PLAIN;
+
+	if (response->encoding == FH_ENCODING_CHUNKED
+		&& !fh_filter_add (response, "chunked", FH_FILTER_ORDER_CHUNKED,
+						   &fh_http1_chunked_filter, NULL))
+		return H1_RES_ERR;
+
 	fh_update_static_headers ();
 
-	if (headers)
-		default_headers_tail->next = headers->head;
+	default_headers_tail->next = headers ? headers->head : NULL;
 
 	for (struct fh_header *h = default_headers; h; h = h->next, iov_index += 4)
 	{
@@ -354,7 +400,8 @@ fh_res_send_headers (struct fh_http1_res_ctx *ctx, struct fh_conn *conn)
 						   h->value_len);
 	}
 
-	if (!fh_add_misc_headers (response, iov, &iov_index, set_transfer_encoding))
+	if (!fh_add_misc_headers (response, iov, &iov_index, &total_data_size,
+							  set_transfer_encoding))
 		return H1_RES_ERR;
 
 	iov[iov_index++] = (struct iovec) {
@@ -362,205 +409,213 @@ fh_res_send_headers (struct fh_http1_res_ctx *ctx, struct fh_conn *conn)
 		.iov_len = 2,
 	};
 
-	fh_prep_write (ctx, iov, iov_count, total_data_size);
+	ctx->headers_size = total_data_size;
+	fh_prep_write (ctx, iov, iov_index, total_data_size);
 	return H1_RES_WRITE (FH_RES_STATE_BODY);
 }
 
+/* Writes out a run of consecutive in-memory links with a single writev(),
+   advancing *link_ptr past everything that was fully sent.  */
 static unsigned int
-fh_res_send_body (struct fh_http1_res_ctx *ctx, struct fh_conn *conn)
+fh_res_send_body_data (struct fh_link **link_ptr, struct fh_conn *conn)
 {
-	fd_t sockfd = conn->client_sockfd;
-	struct fh_response *response = ctx->response;
-
-	if ((!response->use_default_error_response && !response->content_length
-		 && response->encoding != FH_ENCODING_CHUNKED)
-		|| response->no_send_body)
-		return H1_RES_DONE;
-
-	struct fh_link *link = response->use_default_error_response
-							   ? &default_error_response_link
-							   : response->body_start;
+	struct iovec iov[__IOV_MAX];
+	size_t iov_count = 0;
+	struct fh_link *link = *link_ptr;
 
-	if (!link)
+	for (; link && link->buf->type == FH_BUF_DATA && iov_count < __IOV_MAX;
+		 link = link->next)
 	{
-		errno = EAGAIN;
-		return H1_RES_AGAIN;
+		iov[iov_count++] = (struct iovec) {
+			.iov_base = link->buf->attrs.mem.data,
+			.iov_len = link->buf->attrs.mem.len,
+		};
+
+		if (link->is_eos)
+			break;
 	}
 
-	struct iovec iov[__IOV_MAX];
-	size_t iov_count = 0, iov_off = 0, iov_total_size = 0;
-	size_t file_count = 0;
-	uint8_t last_buf_type = FH_BUF_DATA;
+	ssize_t wrote;
 
-	while (link || iov_count > 0 || file_count > 0)
+	do
+		wrote = fh_conn_writev (conn, iov, (int) iov_count);
+	while (wrote < 0 && would_interrupt ());
+
+	if (wrote < 0)
+		return would_block () ? H1_RES_AGAIN : H1_RES_ERR;
+
+	size_t size = (size_t) wrote;
+
+	link = *link_ptr;
+
+	for (size_t i = 0; i < iov_count; i++, link = link->next)
 	{
-		const struct fh_buf *buf = link ? link->buf : NULL;
-		bool buf_type_mismatch
-			= link && link->next ? last_buf_type != buf->type : true;
+		struct fh_buf *buf = link->buf;
 
-		switch (buf->type)
+		if (buf->attrs.mem.len > size)
 		{
-			case FH_BUF_DATA:
-				iov[iov_count++] = (struct iovec) {
-					.iov_base = buf->attrs.mem.data,
-					.iov_len = buf->attrs.mem.len,
-				};
+			buf->attrs.mem.data += size;
+			buf->attrs.mem.len -= size;
+			*link_ptr = link;
+			return H1_RES_NEXT;
+		}
 
-				break;
+		size -= buf->attrs.mem.len;
+		buf->attrs.mem.len = 0;
 
-			case FH_BUF_FILE:
-				file_count++;
-				break;
+		if (link->is_eos)
+		{
+			*link_ptr = NULL;
+			return H1_RES_DONE;
 		}
+	}
 
-		if ((buf_type_mismatch && iov_count > 0) || iov_count >= __IOV_MAX - 1)
-		{
-			for (;;)
-			{
-				ssize_t wrote = writev (sockfd, iov + iov_off, iov_count);
+	*link_ptr = link;
+	return H1_RES_NEXT;
+}
 
-				if (wrote < 1)
-				{
-					if (would_block ())
-						return H1_RES_AGAIN;
+static unsigned int
+fh_res_send_body_file (struct fh_link **link_ptr, struct fh_conn *conn)
+{
+	struct fh_link *link = *link_ptr;
+	struct fh_buf *buf = link->buf;
+	fd_t in_fd = buf->attrs.file.file_fd;
 
-					return H1_RES_ERR;
-				}
+	while (buf->attrs.file.file_len > 0)
+	{
+		fh_pr_debug ("Sending fd #%d", in_fd);
 
-				if (((size_t) wrote) >= iov_total_size)
-				{
-					iov_count = 0;
-					iov_off = 0;
-					break;
-				}
-				else
-				{
-					iov_total_size -= (size_t) wrote;
-					size_t size = (size_t) wrote;
-
-					while (size > 0)
-					{
-						if (iov_count && iov->iov_len < size)
-						{
-							size -= iov->iov_len;
-							iov_off++;
-							iov_count--;
-
-							if (response->body_start)
-								response->body_start
-									= response->body_start->next;
-							else
-								goto writev_loop_end;
-
-							fh_pr_debug ("Removed 1 body iovec");
-							continue;
-						}
-
-						if (!iov_count)
-							break;
-
-						if (response->body_start)
-						{
-							struct fh_buf *buf = response->body_start->buf;
-
-							buf->attrs.mem.len -= size;
-							buf->attrs.mem.data
-								= (void *) (((char *) buf->attrs.mem.data)
-											+ size);
-							iov->iov_len = buf->attrs.mem.len;
-							iov->iov_base = buf->attrs.mem.data;
-						}
-						else
-						{
-							goto writev_loop_end;
-						}
-
-						size = 0;
-						fh_pr_debug ("Adjusted 1 body iovec");
-						break;
-					}
-				}
+		ssize_t sent
+			= fh_conn_sendfile (conn, in_fd, &buf->attrs.file.file_off,
+								buf->attrs.file.file_len);
 
+		if (sent < 0)
+		{
+			if (would_interrupt ())
 				continue;
-			writev_loop_end:
-				break;
-			}
+
+			return would_block () ? H1_RES_AGAIN : H1_RES_ERR;
 		}
-		else if ((buf_type_mismatch && file_count > 0) || file_count >= 63)
+
+		if (sent == 0)
+			return H1_RES_ERR;
+
+		buf->attrs.file.file_len -= (size_t) sent;
+	}
+
+	close (in_fd);
+	buf->attrs.file.file_fd = -1;
+	fh_pr_debug ("Closed fd #%d", in_fd);
+	*link_ptr = link->is_eos ? NULL : link->next;
+	return link->is_eos ? H1_RES_DONE : H1_RES_NEXT;
+}
+
+static unsigned int
+fh_res_send_body_pipe (struct fh_link **link_ptr, struct fh_conn *conn)
+{
+	struct fh_link *link = *link_ptr;
+	struct fh_buf *buf = link->buf;
+
+	while (buf->attrs.pipe.pipe_len > 0)
+	{
+		ssize_t sent = fh_conn_splice (conn, buf->attrs.pipe.pipe_fd,
+									   buf->attrs.pipe.pipe_len);
+
+		if (sent < 0)
 		{
-			for (size_t i = 0; i < file_count; i++)
-			{
-				struct fh_buf *buf
-					= response->body_start ? response->body_start->buf : NULL;
+			if (errno == EINTR)
+				continue;
 
-				if (buf)
-				{
-					fd_t in_fd = buf->attrs.file.file_fd;
+			return would_block () ? H1_RES_AGAIN : H1_RES_ERR;
+		}
 
-					fh_pr_debug ("Sending fd #%d", in_fd);
+		if (sent == 0)
+			return H1_RES_ERR;
+
+		buf->attrs.pipe.pipe_len -= (size_t) sent;
+	}
+
+	*link_ptr = link->is_eos ? NULL : link->next;
+	return link->is_eos ? H1_RES_DONE : H1_RES_NEXT;
+}
 
-					ssize_t sent = sendfile64 (
-						sockfd, in_fd, (off64_t *) &buf->attrs.file.file_off,
-						buf->attrs.file.file_len);
+/* Sends whatever the filters produced last time, and only then asks them
+   for more.  This keeps at most one batch of filter output in memory when
+   the socket is slower than the handler.  */
+static unsigned int
+fh_res_send_body (struct fh_http1_res_ctx *ctx, struct fh_conn *conn)
+{
+	struct fh_response *response = ctx->response;
 
-					if (sent < 1 || ((size_t) sent) < buf->attrs.file.file_len)
-					{
-						if (would_block ())
-						{
-							if (sent)
-								buf->attrs.file.file_len -= sent;
+	if ((!response->use_default_error_response && !response->content_length
+		 && response->encoding != FH_ENCODING_CHUNKED)
+		|| response->no_send_body)
+		return H1_RES_DONE;
 
-							return H1_RES_AGAIN;
-						}
+	for (;;)
+	{
+		if (!ctx->link)
+		{
+			if (!response->body_start && response->pull
+				&& !response->pull (response))
+				return H1_RES_ERR;
 
-						return H1_RES_ERR;
-					}
+			struct fh_link *in = response->body_start;
 
-					response->body_start = response->body_start->next;
-					fh_pr_debug ("Closed fd #%d", in_fd);
-					close (in_fd);
-				}
-				else
-				{
-					break;
-				}
+			if (!in && !fh_filter_pending (response))
+			{
+				errno = EAGAIN;
+				return H1_RES_AGAIN;
 			}
 
-			file_count = 0;
+			response->body_start = NULL;
+
+			if (fh_filter_run (response, in, &ctx->link) == FH_FILTER_ERROR)
+				return H1_RES_ERR;
+
+			continue;
 		}
 
-		last_buf_type = buf->type;
+		unsigned int rc;
 
-		if (link)
+		switch (ctx->link->buf->type)
 		{
-			if (link->is_eos)
+			case FH_BUF_FILE:
+				rc = fh_res_send_body_file (&ctx->link, conn);
 				break;
 
-			link = link->next;
-		}
-	}
+			case FH_BUF_PIPE:
+				rc = fh_res_send_body_pipe (&ctx->link, conn);
+				break;
 
-	response->body_start = link;
+			default:
+				rc = fh_res_send_body_data (&ctx->link, conn);
+				break;
+		}
 
-	if (link && link->is_eos)
-	{
-		response->body_start = NULL;
-		return H1_RES_DONE;
+		if (rc != H1_RES_NEXT)
+			return rc;
 	}
+}
 
-	return H1_RES_AGAIN;
+static inline void
+fh_res_set_state (struct fh_http1_res_ctx *ctx, const struct fh_conn *conn,
+				  unsigned int state)
+{
+	(void) conn;
+	FH_PROBE5 (response__state, conn->id, conn->client_sockfd, ctx->state,
+			   state, ctx->response->status);
+	ctx->state = state;
 }
 
 static unsigned int
 fh_res_write_data (struct fh_http1_res_ctx *ctx, struct fh_conn *conn)
 {
-	fd_t sockfd = conn->client_sockfd;
-
 	for (;;)
 	{
 		fh_pr_debug ("ctx->iov_size: %zu", ctx->iov_size);
 
-		ssize_t wrote = writev (sockfd, ctx->iov, ctx->iov_size);
+		ssize_t wrote = fh_conn_writev (conn, ctx->iov, ctx->iov_size);
 
 		if (wrote < 1)
 		{
@@ -577,9 +632,12 @@ fh_res_write_data (struct fh_http1_res_ctx *ctx, struct fh_conn *conn)
 
 		if (((size_t) wrote) >= ctx->iov_data_size)
 		{
+			if (ctx->next_state == FH_RES_STATE_BODY)
+				fh_stats_mark (&conn->timing, FH_STATS_MARK_HEADERS);
+
 			ctx->iov_data_size = 0;
 			ctx->iov = NULL;
-			ctx->state = ctx->next_state;
+			fh_res_set_state (ctx, conn, ctx->next_state);
 			return H1_RES_NEXT;
 		}
 		else
@@ -643,7 +701,7 @@ fh_http1_send_response (struct fh_http1_res_ctx *ctx, struct fh_conn *conn)
 
 		if (rc == H1_RES_ERR)
 		{
-			ctx->state = FH_RES_STATE_ERROR;
+			fh_res_set_state (ctx, conn, FH_RES_STATE_ERROR);
 			return false;
 		}
 
@@ -653,13 +711,13 @@ fh_http1_send_response (struct fh_http1_res_ctx *ctx, struct fh_conn *conn)
 		if (rc >> 31)
 		{
 			ctx->next_state = rc & 0xFFFF;
-			ctx->state = FH_RES_STATE_WRITE;
+			fh_res_set_state (ctx, conn, FH_RES_STATE_WRITE);
 			continue;
 		}
 
 		if (rc == H1_RES_DONE)
 		{
-			ctx->state = FH_RES_STATE_DONE;
+			fh_res_set_state (ctx, conn, FH_RES_STATE_DONE);
 			return true;
 		}
 	}
@@ -671,16 +729,7 @@ fh_http1_res_ctx_clean (struct fh_http1_res_ctx *ctx)
 	if (!ctx->response)
 		return;
 
-	struct fh_link *link = ctx->response->body_start;
-
-	while (link)
-	{
-		if (link->buf->type == FH_BUF_FILE)
-		{
-			close (link->buf->attrs.file.file_fd);
-			fh_pr_debug ("Closed fd %d", link->buf->attrs.file.file_fd);
-		}
-
-		link = link->next;
-	}
+	fh_link_release (ctx->link);
+	fh_link_release (ctx->response->body_start);
+	fh_response_cleanup (ctx->response);
 }
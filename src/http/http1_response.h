@@ -47,6 +47,8 @@ struct fh_http1_res_ctx
 	size_t iov_size, iov_data_size;
 	struct fh_link *link;
 	struct fh_response *response;
+	/* Bytes of the status line and headers, to tell the body apart */
+	size_t headers_size;
 };
 
 struct fh_http1_res_ctx *fh_http1_res_ctx_create (pool_t *pool);
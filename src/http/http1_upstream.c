@@ -0,0 +1,245 @@
+/*
+ * This file is part of OSN freehttpd.
+ * 
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+
+#include "http1_request.h"
+#include "http1_upstream.h"
+
+static const char *
+fh_http1_find_head_end (const char *buf, size_t len)
+{
+	for (const char *p = buf; (p = memchr (p, '\n', len - (size_t) (p - buf)));
+		 p++)
+	{
+		const char *next = p + 1;
+
+		if (next < buf + len && *next == '\r')
+			next++;
+
+		if (next >= buf + len)
+			return NULL;
+
+		if (*next == '\n')
+			return next + 1;
+	}
+
+	return NULL;
+}
+
+static size_t
+fh_http1_trim_cr (const char *line, size_t len)
+{
+	return len > 0 && line[len - 1] == '\r' ? len - 1 : len;
+}
+
+static bool
+fh_http1_parse_header_lines (pool_t *pool, const char *line, const char *end,
+							 struct fh_headers *headers)
+{
+	while (line < end)
+	{
+		const char *eol = memchr (line, '\n', (size_t) (end - line));
+		size_t line_len = fh_http1_trim_cr (line, (size_t) (eol - line));
+
+		if (!line_len)
+			break;
+
+		/* Obsolete line folding is not supported */
+		if (line[0] == ' ' || line[0] == '\t')
+			return false;
+
+		const char *colon = memchr (line, ':', line_len);
+
+		if (!colon || colon == line
+			|| !fh_validate_header_name (line, (size_t) (colon - line))
+			|| headers->count >= HTTP1_HEADER_COUNT_MAX)
+			return false;
+
+		const char *value = colon + 1;
+		const char *value_end = line + line_len;
+
+		while (value < value_end && (*value == ' ' || *value == '\t'))
+			value++;
+
+		while (value_end > value
+			   && (value_end[-1] == ' ' || value_end[-1] == '\t'))
+			value_end--;
+
+		if (!fh_header_add (pool, headers, line, (size_t) (colon - line),
+							value, (size_t) (value_end - value)))
+			return false;
+
+		line = eol + 1;
+	}
+
+	return true;
+}
+
+int
+fh_http1_parse_response_head (pool_t *pool, const char *buf, size_t len,
+							  struct fh_http1_response_head *head)
+{
+	const char *end = fh_http1_find_head_end (buf, len);
+
+	if (!end)
+		return len >= HTTP1_UPSTREAM_HEAD_MAX_LEN ? -1 : 0;
+
+	if (end - buf > HTTP1_UPSTREAM_HEAD_MAX_LEN)
+		return -1;
+
+	head->len = (size_t) (end - buf);
+	fh_headers_init (&head->headers);
+
+	/* HTTP/1.x SP 3DIGIT SP reason-phrase */
+	const char *eol = memchr (buf, '\n', head->len);
+	size_t line_len = fh_http1_trim_cr (buf, (size_t) (eol - buf));
+
+	if (line_len < 12 || memcmp (buf, "HTTP/1.", 7)
+		|| (buf[7] != '0' && buf[7] != '1') || buf[8] != ' ')
+		return -1;
+
+	head->minor_version = (uint8_t) (buf[7] - '0');
+	head->status = 0;
+
+	for (size_t i = 9; i < 12; i++)
+	{
+		if (buf[i] < '0' || buf[i] > '9')
+			return -1;
+
+		head->status = (uint16_t) (head->status * 10 + (buf[i] - '0'));
+	}
+
+	if (head->status < 100 || (line_len > 12 && buf[12] != ' '))
+		return -1;
+
+	head->reason = line_len > 13 ? buf + 13 : "";
+	head->reason_len = line_len > 13 ? line_len - 13 : 0;
+
+	return fh_http1_parse_header_lines (pool, eol + 1, end, &head->headers)
+			   ? 1
+			   : -1;
+}
+
+
+int
+fh_http1_parse_cgi_head (pool_t *pool, const char *buf, size_t len,
+						 struct fh_http1_response_head *head)
+{
+	const char *end = len && buf[0] == '\n'			  ? buf + 1
+					  : len > 1 && !memcmp (buf, "\r\n", 2) ? buf + 2
+						  : fh_http1_find_head_end (buf, len);
+
+	if (!end)
+		return len >= HTTP1_UPSTREAM_HEAD_MAX_LEN ? -1 : 0;
+
+	if (end - buf > HTTP1_UPSTREAM_HEAD_MAX_LEN)
+		return -1;
+
+	head->len = (size_t) (end - buf);
+	head->minor_version = 1;
+	head->status = 200;
+	head->reason = "";
+	head->reason_len = 0;
+	fh_headers_init (&head->headers);
+
+	if (!fh_http1_parse_header_lines (pool, buf, end, &head->headers))
+		return -1;
+
+	/* Status: 3DIGIT [SP reason-phrase] */
+	const struct fh_header *status = fh_header_get (&head->headers, "Status", 6);
+
+	if (status)
+	{
+		const char *value = status->value;
+
+		if (status->value_len < 3 || (status->value_len > 3 && value[3] != ' '))
+			return -1;
+
+		head->status = 0;
+
+		for (size_t i = 0; i < 3; i++)
+		{
+			if (value[i] < '0' || value[i] > '9')
+				return -1;
+
+			head->status = (uint16_t) (head->status * 10 + (value[i] - '0'));
+		}
+
+		if (head->status < 200)
+			return -1;
+
+		head->reason = status->value_len > 4 ? value + 4 : "";
+		head->reason_len = status->value_len > 4 ? status->value_len - 4 : 0;
+	}
+	else if (fh_header_get (&head->headers, "Location", 8))
+	{
+		head->status = 302;
+	}
+
+	return 1;
+}
+
+int
+fh_http1_parse_chunk_size (const char *buf, size_t len, uint64_t *size_ptr,
+						   size_t *line_len_ptr)
+{
+	const char *eol = memchr (buf, '\n', len);
+
+	if (!eol)
+		return len >= HTTP1_HEADER_VALUE_MAX_LEN ? -1 : 0;
+
+	uint64_t size = 0;
+	size_t i = 0;
+
+	for (; buf + i < eol; i++)
+	{
+		const char c = buf[i];
+		unsigned digit;
+
+		if (c >= '0' && c <= '9')
+			digit = (unsigned) (c - '0');
+		else if (c >= 'a' && c <= 'f')
+			digit = (unsigned) (c - 'a' + 10);
+		else if (c >= 'A' && c <= 'F')
+			digit = (unsigned) (c - 'A' + 10);
+		else
+			break;
+
+		/* 15 hex digits are more than any body we would ever relay */
+		if (i >= 15)
+			return -1;
+
+		size = (size << 4) | digit;
+	}
+
+	if (!i)
+		return -1;
+
+	/* Whatever follows is either a chunk extension, which is ignored, or
+	   the line terminator.  */
+	if (buf[i] != ';' && buf[i] != ' ' && buf[i] != '\t' && buf[i] != '\r'
+		&& buf[i] != '\n')
+		return -1;
+
+	*size_ptr = size;
+	*line_len_ptr = (size_t) (eol - buf) + 1;
+	return 1;
+}
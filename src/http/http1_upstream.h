@@ -0,0 +1,64 @@
+/*
+ * This file is part of OSN freehttpd.
+ * 
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef FH_HTTP1_UPSTREAM_H
+#define FH_HTTP1_UPSTREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mm/pool.h"
+#include "protocol.h"
+
+/* Largest response head accepted from an upstream server */
+#define HTTP1_UPSTREAM_HEAD_MAX_LEN (16 * 1024)
+
+struct fh_http1_response_head
+{
+	uint16_t status;
+	uint8_t minor_version;
+	const char *reason;
+	size_t reason_len;
+	/* Names and values point into the parsed buffer */
+	struct fh_headers headers;
+	/* Size of the head, including the empty line that ends it */
+	size_t len;
+};
+
+/* Parses the status line and the headers of an HTTP/1.x response.  Returns
+   1 once the head is complete, 0 if more data is needed and -1 if it is
+   malformed.  */
+int fh_http1_parse_response_head (pool_t *pool, const char *buf, size_t len,
+								  struct fh_http1_response_head *head);
+
+/* Parses the head of a CGI response, which is made of header fields only:
+   the status comes from a `Status' field, and is 302 along with a
+   `Location' field and 200 otherwise.  Returns like
+   fh_http1_parse_response_head().  */
+int fh_http1_parse_cgi_head (pool_t *pool, const char *buf, size_t len,
+							 struct fh_http1_response_head *head);
+
+/* Parses a chunk-size line, extensions included.  Returns like
+   fh_http1_parse_response_head(), with the length of the line stored in
+   `line_len_ptr'.  */
+int fh_http1_parse_chunk_size (const char *buf, size_t len, uint64_t *size_ptr,
+							   size_t *line_len_ptr);
+
+#endif /* FH_HTTP1_UPSTREAM_H */
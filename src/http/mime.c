@@ -0,0 +1,90 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <strings.h>
+
+#include "mime.h"
+#include "utils/utils.h"
+
+struct fh_mime_entry
+{
+	const char *ext;
+	const char *type;
+	size_t type_len;
+};
+
+#define MIME_ENTRY(ext, type) { ext, type, sizeof (type) - 1 }
+
+static const struct fh_mime_entry mime_table[] = {
+	MIME_ENTRY ("html", "text/html; charset=UTF-8"),
+	MIME_ENTRY ("htm", "text/html; charset=UTF-8"),
+	MIME_ENTRY ("txt", "text/plain; charset=UTF-8"),
+	MIME_ENTRY ("css", "text/css; charset=UTF-8"),
+	MIME_ENTRY ("csv", "text/csv; charset=UTF-8"),
+	MIME_ENTRY ("md", "text/markdown; charset=UTF-8"),
+	MIME_ENTRY ("xml", "application/xml"),
+	MIME_ENTRY ("js", "text/javascript; charset=UTF-8"),
+	MIME_ENTRY ("mjs", "text/javascript; charset=UTF-8"),
+	MIME_ENTRY ("json", "application/json"),
+	MIME_ENTRY ("wasm", "application/wasm"),
+	MIME_ENTRY ("svg", "image/svg+xml"),
+	MIME_ENTRY ("png", "image/png"),
+	MIME_ENTRY ("jpg", "image/jpeg"),
+	MIME_ENTRY ("jpeg", "image/jpeg"),
+	MIME_ENTRY ("gif", "image/gif"),
+	MIME_ENTRY ("webp", "image/webp"),
+	MIME_ENTRY ("ico", "image/vnd.microsoft.icon"),
+	MIME_ENTRY ("woff", "font/woff"),
+	MIME_ENTRY ("woff2", "font/woff2"),
+	MIME_ENTRY ("pdf", "application/pdf"),
+	MIME_ENTRY ("zip", "application/zip"),
+	MIME_ENTRY ("gz", "application/gzip"),
+	MIME_ENTRY ("mp4", "video/mp4"),
+	MIME_ENTRY ("mp3", "audio/mpeg"),
+};
+
+#undef MIME_ENTRY
+
+static const size_t mime_table_size = sizeof (mime_table) / sizeof (mime_table[0]);
+
+const char *
+fh_mime_type_from_filename (const char *filename, size_t *len_ptr)
+{
+	const char *ext = get_file_extension (filename);
+
+	if (ext && *ext)
+	{
+		for (size_t i = 0; i < mime_table_size; i++)
+		{
+			if (!strcasecmp (ext, mime_table[i].ext))
+			{
+				if (len_ptr)
+					*len_ptr = mime_table[i].type_len;
+
+				return mime_table[i].type;
+			}
+		}
+	}
+
+	if (len_ptr)
+		*len_ptr = sizeof (FH_MIME_DEFAULT_TYPE) - 1;
+
+	return FH_MIME_DEFAULT_TYPE;
+}
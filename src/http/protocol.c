@@ -27,7 +27,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/socket.h>
+#include <time.h>
 
 #include "compat.h"
 #include "core/conn.h"
@@ -35,6 +37,13 @@
 #include "mm/pool.h"
 #include "protocol.h"
 
+#ifdef HAVE_RESOURCES
+	#include "resources.h"
+#endif /* HAVE_RESOURCES */
+
+static char date_value[64] = { 0 };
+static time_t date_value_time = 0;
+
 const char *
 fh_protocol_to_string (enum fh_protocol protocol)
 {
@@ -46,6 +55,8 @@ fh_protocol_to_string (enum fh_protocol protocol)
 			return "HTTP/1.1";
 		case FH_PROTOCOL_H2:
 			return "h2";
+		case FH_PROTOCOL_H3:
+			return "h3";
 		default:
 			return "Unknown Protocol";
 	}
@@ -61,6 +72,8 @@ fh_string_to_protocol (const char *protocol_str)
 	else if (strcmp (protocol_str, "HTTP/2.0") == 0 || strcmp (protocol_str, "h2") == 0
 			 || strcmp (protocol_str, "h2c") == 0)
 		return FH_PROTOCOL_H2;
+	else if (strcmp (protocol_str, "HTTP/3") == 0 || strcmp (protocol_str, "h3") == 0)
+		return FH_PROTOCOL_H3;
 	else
 		return -1;
 }
@@ -137,6 +150,11 @@ fh_get_status_text (enum fh_status code, size_t *len_ptr)
 			len = 10;
 			break;
 
+		case FH_STATUS_PARTIAL_CONTENT:
+			text = "Partial Content";
+			len = 15;
+			break;
+
 		case FH_STATUS_BAD_REQUEST:
 			text = "Bad Request";
 			len = 11;
@@ -157,11 +175,21 @@ fh_get_status_text (enum fh_status code, size_t *len_ptr)
 			len = 9;
 			break;
 
+		case FH_STATUS_CONTENT_TOO_LARGE:
+			text = "Content Too Large";
+			len = 17;
+			break;
+
 		case FH_STATUS_REQUEST_URI_TOO_LONG:
 			text = "Request URI Too Long";
 			len = 20;
 			break;
 
+		case FH_STATUS_RANGE_NOT_SATISFIABLE:
+			text = "Range Not Satisfiable";
+			len = 21;
+			break;
+
 		case FH_STATUS_INTERNAL_SERVER_ERROR:
 			text = "Internal Server Error";
 			len = 21;
@@ -172,11 +200,21 @@ fh_get_status_text (enum fh_status code, size_t *len_ptr)
 			len = 15;
 			break;
 
+		case FH_STATUS_BAD_GATEWAY:
+			text = "Bad Gateway";
+			len = 11;
+			break;
+
 		case FH_STATUS_SERVICE_UNAVAILABLE:
 			text = "Service Unavailable";
 			len = 19;
 			break;
 
+		case FH_STATUS_GATEWAY_TIMEOUT:
+			text = "Gateway Timeout";
+			len = 15;
+			break;
+
 		case FH_STATUS_METHOD_NOT_ALLOWED:
 			text = "Method Not Allowed";
 			len = 18;
@@ -228,6 +266,11 @@ fh_get_status_description (enum fh_status code, size_t *len_ptr)
 			len = 80;
 			break;
 
+		case FH_STATUS_PARTIAL_CONTENT:
+			text = "The server is delivering only part of the resource due to a range request.";
+			len = 74;
+			break;
+
 		case FH_STATUS_BAD_REQUEST:
 			text = "The server cannot or will not process the request due to a client error (e.g., malformed request "
 				   "syntax).";
@@ -249,11 +292,21 @@ fh_get_status_description (enum fh_status code, size_t *len_ptr)
 			len = 46;
 			break;
 
+		case FH_STATUS_CONTENT_TOO_LARGE:
+			text = "The request body is larger than the server is willing to process.";
+			len = 65;
+			break;
+
 		case FH_STATUS_REQUEST_URI_TOO_LONG:
 			text = "The request URI is too long for the server to process.";
 			len = 54;
 			break;
 
+		case FH_STATUS_RANGE_NOT_SATISFIABLE:
+			text = "The requested range cannot be satisfied for the requested resource.";
+			len = 67;
+			break;
+
 		case FH_STATUS_INTERNAL_SERVER_ERROR:
 			text = "The server encountered an unexpected condition that prevented it from fulfilling the request.";
 			len = 93;
@@ -264,11 +317,21 @@ fh_get_status_description (enum fh_status code, size_t *len_ptr)
 			len = 78;
 			break;
 
+		case FH_STATUS_BAD_GATEWAY:
+			text = "The server, while acting as a gateway or proxy, received an invalid response from the upstream server.";
+			len = 102;
+			break;
+
 		case FH_STATUS_SERVICE_UNAVAILABLE:
 			text = "The server is currently unable to handle the request due to temporary overloading or maintenance.";
 			len = 97;
 			break;
 
+		case FH_STATUS_GATEWAY_TIMEOUT:
+			text = "The server, while acting as a gateway or proxy, did not receive a timely response from the upstream server.";
+			len = 107;
+			break;
+
 		case FH_STATUS_METHOD_NOT_ALLOWED:
 			text = "The request method is not allowed or supported for the requested resource.";
 			len = 74;
@@ -325,21 +388,48 @@ fh_header_add (pool_t *pool, struct fh_headers *headers, const char *name, size_
 	header->value = value;
 	header->value_len = value_len;
 
+	headers->total_http1_size += name_len + value_len + 4;
 	return header;
 }
 
+const struct fh_header *
+fh_header_get (const struct fh_headers *headers, const char *name, size_t name_len)
+{
+	for (const struct fh_header *h = headers->head; h; h = h->next)
+	{
+		if (h->name_len == name_len && !strncasecmp (h->name, name, name_len))
+			return h;
+	}
+
+	return NULL;
+}
+
 struct fh_header *
 fh_header_addf (pool_t *pool, struct fh_headers *headers, const char *name, size_t name_len, const char *value_format,
 				...)
 {
-	(void) pool;
-	(void) headers;
-	(void) name;
-	(void) name_len;
-	(void) value_format;
+	va_list args;
 
-	assert (false);
-	return NULL;
+	va_start (args, value_format);
+	int len = vsnprintf (NULL, 0, value_format, args);
+	va_end (args);
+
+	if (len < 0)
+		return NULL;
+
+	char *value = fh_pool_alloc (pool, (size_t) len + 1);
+
+	if (!value)
+		return NULL;
+
+	va_start (args, value_format);
+	len = vsnprintf (value, (size_t) len + 1, value_format, args);
+	va_end (args);
+
+	if (len < 0)
+		return NULL;
+
+	return fh_header_add (pool, headers, name, name_len, value, (size_t) len);
 }
 
 void
@@ -348,6 +438,22 @@ fh_headers_init (struct fh_headers *headers)
 	memset (headers, 0, sizeof (*headers));
 }
 
+struct fh_headers *
+fh_response_get_headers (struct fh_response *response)
+{
+	if (!response->headers)
+	{
+		response->headers = fh_pool_alloc (response->pool, sizeof (*response->headers));
+
+		if (!response->headers)
+			return NULL;
+
+		fh_headers_init (response->headers);
+	}
+
+	return response->headers;
+}
+
 const char *
 fh_encoding_to_string (enum fh_encoding encoding, size_t *out_len)
 {
@@ -377,3 +483,110 @@ fh_encoding_to_string (enum fh_encoding encoding, size_t *out_len)
 
 	return out;
 }
+
+const char *
+fh_content_encoding_to_string (enum fh_content_encoding encoding, size_t *out_len)
+{
+	const char *out;
+	size_t len = 0;
+
+	switch (encoding)
+	{
+		case FH_CONTENT_ENCODING_IDENTITY:
+			out = "identity";
+			len = 8;
+			break;
+
+		case FH_CONTENT_ENCODING_GZIP:
+			out = "gzip";
+			len = 4;
+			break;
+
+		default:
+			out = "unknown";
+			len = 7;
+			break;
+	}
+
+	if (out_len)
+		*out_len = len;
+
+	return out;
+}
+
+void
+fh_response_init (struct fh_response *response, pool_t *pool)
+{
+	memset (response, 0, sizeof (*response));
+	response->pool = pool;
+	response->protocol = FH_PROTOCOL_HTTP_1_1;
+	response->encoding = FH_ENCODING_PLAIN;
+	response->content_encoding = FH_CONTENT_ENCODING_IDENTITY;
+}
+
+void
+fh_response_cleanup (struct fh_response *response)
+{
+	void (*cleanup) (struct fh_response *) = response->cleanup;
+
+	if (!cleanup)
+		return;
+
+	response->cleanup = NULL;
+	response->pull = NULL;
+	cleanup (response);
+}
+
+char *
+fh_response_error_page (pool_t *pool, enum fh_status code, const char *host,
+						size_t host_len, uint16_t port, size_t *len_ptr)
+{
+	size_t status_text_len = 0, description_len = 0;
+	const char *status_text = fh_get_status_text (code, &status_text_len);
+	const char *description = fh_get_status_description (code, &description_len);
+	const size_t len = resource_error_html_len - 16 + (status_text_len * 2)
+					   + (3 * 2) + description_len
+					   + (port < 10		 ? 1
+						  : port < 100	 ? 2
+						  : port < 1000	 ? 3
+						  : port < 10000 ? 4
+										 : 5)
+					   + host_len;
+	char *data = fh_pool_alloc (pool, len + 1);
+
+	if (!data)
+		return NULL;
+
+	if (snprintf (data, len + 1, resource_error_html, code, status_text, code,
+				  status_text, description, (int) host_len, host, port)
+		< 0)
+		return NULL;
+
+	*len_ptr = len;
+	return data;
+}
+
+const char *
+fh_http_date_now (void)
+{
+	static const char *const months[] = { "Jan", "Feb", "Mar", "Apr",
+										  "May", "Jun", "Jul", "Aug",
+										  "Sep", "Oct", "Nov", "Dec" };
+	static const char *const days[]
+		= { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+	time_t now = time (NULL);
+
+	if (now != date_value_time)
+	{
+		struct tm gmt_tm;
+
+		gmtime_r (&now, &gmt_tm);
+		snprintf (date_value, sizeof (date_value),
+				  "%3s, %02d %3s %04d %02d:%02d:%02d GMT", days[gmt_tm.tm_wday],
+				  gmt_tm.tm_mday, months[gmt_tm.tm_mon], gmt_tm.tm_year + 1900,
+				  gmt_tm.tm_hour, gmt_tm.tm_min, gmt_tm.tm_sec);
+		date_value_time = now;
+	}
+
+	return date_value;
+}
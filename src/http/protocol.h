@@ -37,7 +37,8 @@ enum fh_protocol
 	FH_PROTOCOL_UNKNOWN,
 	FH_PROTOCOL_HTTP_1_0,
 	FH_PROTOCOL_HTTP_1_1,
-	FH_PROTOCOL_H2
+	FH_PROTOCOL_H2,
+	FH_PROTOCOL_H3
 };
 
 typedef enum fh_protocol protocol_t;
@@ -63,15 +64,20 @@ enum fh_status
 	FH_STATUS_CREATED = 201,
 	FH_STATUS_ACCEPTED = 202,
 	FH_STATUS_NO_CONTENT = 204,
+	FH_STATUS_PARTIAL_CONTENT = 206,
 	FH_STATUS_BAD_REQUEST = 400,
 	FH_STATUS_UNAUTHORIZED = 401,
 	FH_STATUS_FORBIDDEN = 403,
 	FH_STATUS_NOT_FOUND = 404,
 	FH_STATUS_METHOD_NOT_ALLOWED = 405,
+	FH_STATUS_CONTENT_TOO_LARGE = 413,
 	FH_STATUS_REQUEST_URI_TOO_LONG = 414,
+	FH_STATUS_RANGE_NOT_SATISFIABLE = 416,
 	FH_STATUS_INTERNAL_SERVER_ERROR = 500,
 	FH_STATUS_NOT_IMPLEMENTED = 501,
+	FH_STATUS_BAD_GATEWAY = 502,
 	FH_STATUS_SERVICE_UNAVAILABLE = 503,
+	FH_STATUS_GATEWAY_TIMEOUT = 504,
 };
 
 enum fh_encoding
@@ -80,6 +86,12 @@ enum fh_encoding
 	FH_ENCODING_CHUNKED
 };
 
+enum fh_content_encoding
+{
+	FH_CONTENT_ENCODING_IDENTITY,
+	FH_CONTENT_ENCODING_GZIP
+};
+
 struct fh_header
 {
 	const char *name;
@@ -117,6 +129,8 @@ struct fh_request
 	uint8_t method : 4;
 };
 
+struct fh_filter;
+
 struct fh_response
 {
 	pool_t *pool;
@@ -124,13 +138,30 @@ struct fh_response
 
 	uint8_t protocol : 4;
 	uint8_t encoding : 4;
+	uint8_t content_encoding : 4;
 	bool no_send_body : 1;
 	bool use_default_error_response : 1;
+	/* The handler has not decided on the status and headers yet */
+	bool headers_pending : 1;
 
 	struct fh_headers *headers;
 	uint64_t content_length;
+	const char *content_type;
+	size_t content_type_len;
+	/* Reason phrase to send instead of the standard one, if set */
+	const char *reason;
+	size_t reason_len;
 
 	struct fh_link *body_start;
+	struct fh_filter *filters;
+
+	/* For handlers that produce the response asynchronously.  `pull' is
+	   called when `body_start' has run dry, may append more links to it,
+	   and is reset to NULL once the body is complete.  Nothing new
+	   meanwhile means the handler will resume the connection later.  */
+	bool (*pull) (struct fh_response *response);
+	void (*cleanup) (struct fh_response *response);
+	void *handler_data;
 };
 
 const char *fh_protocol_to_string (enum fh_protocol protocol);
@@ -144,13 +175,27 @@ const char *fh_get_status_text (enum fh_status code, size_t *len_ptr);
 const char *fh_get_status_description (enum fh_status code, size_t *len_ptr);
 
 const char *fh_encoding_to_string (enum fh_encoding encoding, size_t *out_len);
+const char *fh_content_encoding_to_string (enum fh_content_encoding encoding, size_t *out_len);
 
 void fh_headers_init (struct fh_headers *headers);
+struct fh_headers *fh_response_get_headers (struct fh_response *response);
 struct fh_header *fh_header_add (pool_t *pool, struct fh_headers *headers,
 								 const char *name, size_t name_len,
 								 const char *value, size_t value_len);
+const struct fh_header *fh_header_get (const struct fh_headers *headers,
+									  const char *name, size_t name_len);
 struct fh_header *fh_header_addf (pool_t *pool, struct fh_headers *headers,
 								  const char *name, size_t name_len,
 								  const char *value_format, ...);
 
+void fh_response_init (struct fh_response *response, pool_t *pool);
+/* Calls the cleanup hook of the handler, once */
+void fh_response_cleanup (struct fh_response *response);
+char *fh_response_error_page (pool_t *pool, enum fh_status code,
+							  const char *host, size_t host_len, uint16_t port,
+							  size_t *len_ptr);
+
+/* The current time as an IMF-fixdate, always 29 characters long */
+const char *fh_http_date_now (void);
+
 #endif /* FH_PROTOCOL_H */
@@ -0,0 +1,264 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#define FH_LOG_MODULE_NAME "range"
+
+#include "filter.h"
+#include "log/log.h"
+#include "range.h"
+
+static bool
+fh_range_parse_number (const char **p_ptr, const char *end, uint64_t *out)
+{
+	const char *p = *p_ptr;
+	uint64_t value = 0;
+
+	if (p >= end || *p < '0' || *p > '9')
+		return false;
+
+	for (; p < end && *p >= '0' && *p <= '9'; p++)
+	{
+		if (value > (UINT64_MAX - 9) / 10)
+			return false;
+
+		value = value * 10 + (uint64_t) (*p - '0');
+	}
+
+	*p_ptr = p;
+	*out = value;
+	return true;
+}
+
+/* Parses a single "bytes=" range.  Returns false if the header should be
+   ignored (malformed, multiple ranges or another unit), otherwise sets
+   *satisfiable_ptr accordingly.  */
+bool
+fh_range_parse (const char *value, size_t value_len, uint64_t total,
+				struct fh_range *range, bool *satisfiable_ptr)
+{
+	const char *p = value, *end = value + value_len;
+
+	if (value_len < 6 || strncasecmp (p, "bytes=", 6))
+		return false;
+
+	p += 6;
+
+	if (memchr (p, ',', (size_t) (end - p)))
+		return false;
+
+	uint64_t first = 0, last = total ? total - 1 : 0;
+	bool suffix = p < end && *p == '-';
+
+	if (suffix)
+	{
+		uint64_t length;
+
+		p++;
+
+		if (!fh_range_parse_number (&p, end, &length) || p != end)
+			return false;
+
+		if (!length || !total)
+		{
+			*satisfiable_ptr = false;
+			return true;
+		}
+
+		first = length >= total ? 0 : total - length;
+	}
+	else
+	{
+		if (!fh_range_parse_number (&p, end, &first) || p >= end || *p != '-')
+			return false;
+
+		p++;
+
+		if (p < end)
+		{
+			if (!fh_range_parse_number (&p, end, &last) || p != end
+				|| last < first)
+				return false;
+		}
+
+		if (first >= total)
+		{
+			*satisfiable_ptr = false;
+			return true;
+		}
+
+		if (last >= total)
+			last = total - 1;
+	}
+
+	range->start = first;
+	range->end = last;
+	range->offset = 0;
+	range->done = false;
+	*satisfiable_ptr = true;
+	return true;
+}
+
+static void
+fh_range_drop (struct fh_link *link)
+{
+	if (link->buf->type == FH_BUF_FILE && link->buf->attrs.file.file_fd >= 0)
+	{
+		close (link->buf->attrs.file.file_fd);
+		link->buf->attrs.file.file_fd = -1;
+	}
+}
+
+static int
+fh_range_filter (struct fh_filter *filter, struct fh_link *in,
+				 struct fh_link **out_ptr)
+{
+	struct fh_range *range = filter->data;
+	struct fh_link *head = NULL, *tail = NULL, *next;
+	bool eos = false;
+
+	for (struct fh_link *link = in; link; link = next)
+	{
+		eos = link->is_eos;
+		next = eos ? NULL : link->next;
+
+		const uint64_t size = fh_link_size (link);
+		const uint64_t link_start = range->offset;
+		const uint64_t link_end = link_start + size;
+
+		range->offset = link_end;
+
+		if (range->done || link_end <= range->start || link_start > range->end)
+		{
+			fh_range_drop (link);
+			continue;
+		}
+
+		const uint64_t skip
+			= range->start > link_start ? range->start - link_start : 0;
+		const uint64_t keep_end
+			= link_end < range->end + 1 ? link_end : range->end + 1;
+		const uint64_t keep = keep_end - link_start - skip;
+
+		if (link->buf->type == FH_BUF_FILE)
+		{
+			link->buf->attrs.file.file_off += skip;
+			link->buf->attrs.file.file_len = keep;
+		}
+		else
+		{
+			link->buf->attrs.mem.data += skip;
+			link->buf->attrs.mem.len = keep;
+		}
+
+		link->is_eos = false;
+		link->next = NULL;
+
+		if (tail)
+			tail->next = link;
+		else
+			head = link;
+
+		tail = link;
+
+		if (link_end > range->end)
+			range->done = true;
+	}
+
+	if ((range->done || eos) && !tail)
+	{
+		tail = head = fh_link_new_data (filter->response->pool, NULL, 0, true);
+
+		if (!tail)
+			return FH_FILTER_ERROR;
+	}
+
+	if (range->done || eos)
+		tail->is_eos = true;
+
+	*out_ptr = head;
+	return FH_FILTER_OK;
+}
+
+bool
+fh_range_setup (const struct fh_request *request, struct fh_response *response)
+{
+	if (request->method != FH_METHOD_GET || response->status != FH_STATUS_OK
+		|| response->use_default_error_response || response->no_send_body
+		|| response->encoding != FH_ENCODING_PLAIN
+		|| response->content_encoding != FH_CONTENT_ENCODING_IDENTITY)
+		return true;
+
+	const struct fh_header *header
+		= fh_header_get (&request->headers, "Range", 5);
+
+	/* We don't send validators, so any If-Range condition fails and the
+	   whole representation has to be sent.  */
+	if (!header || fh_header_get (&request->headers, "If-Range", 8))
+		return true;
+
+	struct fh_range parsed;
+	bool satisfiable = false;
+	const uint64_t total = response->content_length;
+
+	if (!fh_range_parse (header->value, header->value_len, total, &parsed,
+						 &satisfiable))
+		return true;
+
+	if (!fh_response_get_headers (response))
+		return false;
+
+	if (!satisfiable)
+	{
+		fh_link_release (response->body_start);
+		response->body_start = NULL;
+		response->status = FH_STATUS_RANGE_NOT_SATISFIABLE;
+		response->use_default_error_response = true;
+
+		return fh_header_addf (response->pool, response->headers,
+							   "Content-Range", 13, "bytes */%lu",
+							   (unsigned long) total)
+			   != NULL;
+	}
+
+	struct fh_range *range = fh_pool_alloc (response->pool, sizeof (*range));
+
+	if (!range)
+		return false;
+
+	*range = parsed;
+
+	if (!fh_header_addf (response->pool, response->headers, "Content-Range",
+						 13, "bytes %lu-%lu/%lu", (unsigned long) range->start,
+						 (unsigned long) range->end, (unsigned long) total))
+		return false;
+
+	response->status = FH_STATUS_PARTIAL_CONTENT;
+	response->content_length = range->end - range->start + 1;
+
+	return fh_filter_add (response, "range", FH_FILTER_ORDER_RANGE,
+						  &fh_range_filter, range)
+		   != NULL;
+}
@@ -0,0 +1,40 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FH_HTTP_RANGE_H
+#define FH_HTTP_RANGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "protocol.h"
+
+struct fh_range
+{
+	uint64_t start, end;
+	uint64_t offset;
+	bool done;
+};
+
+bool fh_range_parse (const char *value, size_t value_len, uint64_t total,
+					 struct fh_range *range, bool *satisfiable_ptr);
+bool fh_range_setup (const struct fh_request *request,
+					 struct fh_response *response);
+
+#endif /* FH_HTTP_RANGE_H */
@@ -0,0 +1,53 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FH_PROBES_H
+#define FH_PROBES_H
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+/* Static tracepoints of the `freehttpd' provider, for bpftrace, SystemTap
+   and perf.  A probe is a single nop until a tracer attaches to it, and
+   without <sys/sdt.h> it is not compiled in at all; the arguments are not
+   evaluated then either.  Connection probes pass the connection id and
+   the socket first, so that a script can follow one connection.  See
+   tests/trace/ for examples.  */
+#ifdef FHTTPD_ENABLE_USDT
+	#include <sys/sdt.h>
+
+	#define FH_PROBE0(name) STAP_PROBE (freehttpd, name)
+	#define FH_PROBE1(name, a) STAP_PROBE1 (freehttpd, name, a)
+	#define FH_PROBE2(name, a, b) STAP_PROBE2 (freehttpd, name, a, b)
+	#define FH_PROBE3(name, a, b, c) STAP_PROBE3 (freehttpd, name, a, b, c)
+	#define FH_PROBE4(name, a, b, c, d)                                        \
+		STAP_PROBE4 (freehttpd, name, a, b, c, d)
+	#define FH_PROBE5(name, a, b, c, d, e)                                     \
+		STAP_PROBE5 (freehttpd, name, a, b, c, d, e)
+#else /* not FHTTPD_ENABLE_USDT */
+	#define FH_PROBE0(name) ((void) 0)
+	#define FH_PROBE1(name, a) ((void) 0)
+	#define FH_PROBE2(name, a, b) ((void) 0)
+	#define FH_PROBE3(name, a, b, c) ((void) 0)
+	#define FH_PROBE4(name, a, b, c, d) ((void) 0)
+	#define FH_PROBE5(name, a, b, c, d, e) ((void) 0)
+#endif /* FHTTPD_ENABLE_USDT */
+
+#endif /* FH_PROBES_H */
@@ -17,29 +17,92 @@
  * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
+#define FH_LOG_MODULE_NAME "log"
+
 #include "compat.h"
 #include "log.h"
 #include "utils/datetime.h"
 
-#ifdef NDEBUG
-static enum fh_log_level min_level = LOG_INFO;
-#else  /* not NDEBUG */
-static enum fh_log_level min_level = LOG_DEBUG;
-#endif /* NDEBUG */
+/* Longer messages are cut */
+#define FH_LOG_LINE_MAX 4096
+#define FH_LOG_RING_SIZE (256 * 1024)
+/* Most records the writer passes to one writev() */
+#define FH_LOG_BATCH 64
+/* How long the writer sleeps at most when there is nothing to write, in
+   milliseconds */
+#define FH_LOG_IDLE_WAIT 100
+
+/* Most modules that fh_log_set_levels() remembers a level of */
+#define FH_LOG_MAX_OVERRIDES 64
+#define FH_LOG_NAME_MAX 32
+#define FH_LOG_LEVELS_MAX 4096
+
+struct fh_log_override
+{
+	char name[FH_LOG_NAME_MAX];
+	enum fh_log_level level;
+};
+
+struct fh_log_module fh_log_default_module = {
+	.name = NULL,
+	.level = FH_LOG_FLOOR,
+};
+volatile sig_atomic_t fh_log_levels_requested = 0;
+volatile sig_atomic_t fh_log_reopen_requested = 0;
+
+static struct fh_log_module *modules = NULL;
+static struct fh_log_override overrides[FH_LOG_MAX_OVERRIDES];
+static size_t override_count = 0;
+static char *levels_file = NULL;
+static char *out_file = NULL;
+static char *err_file = NULL;
 
 static etime_t startup_time = 0;
 static bool is_tty = false;
 static pid_t main_pid = 0;
 static bool is_master = true;
+static int out_fd = STDOUT_FILENO;
+static int err_fd = STDERR_FILENO;
+
+/* Each record is this header followed by `len' bytes, padded to the size
+   of the header.  A record with fd -1 fills the space up to the end of the
+   buffer, where the next record did not fit.  */
+struct fh_log_record
+{
+	uint32_t len;
+	int32_t fd;
+};
+
+/* Written by the thread that logs, and read by the writer thread */
+struct fh_log_ring
+{
+	uint8_t *buf;
+	/* Both count bytes since the start, and are only ever increased, the
+	   head by the thread that logs and the tail by the writer */
+	uint64_t head;
+	uint64_t tail;
+	uint64_t dropped;
+	bool waiting;
+	bool stop;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+};
+
+static struct fh_log_ring *ring = NULL;
 
 static etime_t
 now (void)
@@ -64,47 +127,567 @@ fh_log_set_worker_pid (pid_t pid)
 	is_master = false;
 }
 
+static enum fh_log_level
+fh_log_module_level (const char *name)
+{
+	for (size_t i = 0; i < override_count; i++)
+	{
+		if (!strcmp (overrides[i].name, name))
+			return overrides[i].level;
+	}
+
+	return fh_log_default_module.level;
+}
+
+void
+fh_log_register (struct fh_log_module *module)
+{
+	module->level = fh_log_module_level (module->name);
+	module->next = modules;
+	modules = module;
+}
+
+void
+fh_log_unregister (struct fh_log_module *module)
+{
+	for (struct fh_log_module **link = &modules; *link; link = &(*link)->next)
+	{
+		if (*link == module)
+		{
+			*link = module->next;
+			return;
+		}
+	}
+}
+
+static void
+fh_log_update_modules (void)
+{
+	for (struct fh_log_module *module = modules; module; module = module->next)
+		module->level = fh_log_module_level (module->name);
+}
+
+void
+fh_log_set_min_level (enum fh_log_level level)
+{
+	fh_log_default_module.level = level;
+	override_count = 0;
+	fh_log_update_modules ();
+}
+
+static int
+fh_log_parse_level (const char *name, size_t len)
+{
+	static const struct
+	{
+		const char *name;
+		enum fh_log_level level;
+	} levels[] = {
+		{ "debug", LOG_DEBUG },	  { "info", LOG_INFO },
+		{ "warn", LOG_WARN },	  { "error", LOG_ERR },
+		{ "emergency", LOG_EMERG },
+	};
+
+	for (size_t i = 0; i < sizeof (levels) / sizeof (levels[0]); i++)
+	{
+		if (strlen (levels[i].name) == len && !memcmp (levels[i].name, name, len))
+			return levels[i].level;
+	}
+
+	return -1;
+}
+
+bool
+fh_log_set_levels (const char *spec)
+{
+	struct fh_log_override new_overrides[FH_LOG_MAX_OVERRIDES];
+	size_t new_count = 0;
+	int new_default = -1;
+	const char *p = spec;
+
+	/* Nothing changes unless the whole list is valid */
+	for (;;)
+	{
+		p += strspn (p, ", \t\r\n");
+
+		if (!*p)
+			break;
+
+		const size_t len = strcspn (p, ", \t\r\n");
+		const char *eq = memchr (p, '=', len);
+
+		if (!eq)
+		{
+			if ((new_default = fh_log_parse_level (p, len)) < 0)
+				return false;
+
+			/* Overrides before it no longer apply */
+			new_count = 0;
+		}
+		else
+		{
+			const size_t name_len = (size_t) (eq - p);
+			const int level = fh_log_parse_level (eq + 1, len - name_len - 1);
+
+			if (level < 0 || name_len == 0 || name_len >= FH_LOG_NAME_MAX
+				|| new_count == FH_LOG_MAX_OVERRIDES)
+				return false;
+
+			memcpy (new_overrides[new_count].name, p, name_len);
+			new_overrides[new_count].name[name_len] = 0;
+			new_overrides[new_count].level = level;
+			new_count++;
+		}
+
+		p += len;
+	}
+
+	/* A level for all modules drops the overrides that were set before */
+	struct fh_log_override merged[FH_LOG_MAX_OVERRIDES];
+	size_t merged_count = new_default >= 0 ? 0 : override_count;
+
+	memcpy (merged, overrides, merged_count * sizeof (*merged));
+
+	for (size_t i = 0; i < new_count; i++)
+	{
+		size_t j = 0;
+
+		while (j < merged_count && strcmp (merged[j].name, new_overrides[i].name))
+			j++;
+
+		if (j == FH_LOG_MAX_OVERRIDES)
+			return false;
+
+		merged[j] = new_overrides[i];
+
+		if (j == merged_count)
+			merged_count++;
+	}
+
+	if (new_default >= 0)
+		fh_log_default_module.level = new_default;
+
+	memcpy (overrides, merged, merged_count * sizeof (*merged));
+	override_count = merged_count;
+	fh_log_update_modules ();
+	return true;
+}
+
+bool
+fh_log_set_levels_file (const char *path)
+{
+	char *copy = path ? strdup (path) : NULL;
+
+	if (path && !copy)
+		return false;
+
+	free (levels_file);
+	levels_file = copy;
+	return true;
+}
+
+bool
+fh_log_load_levels (void)
+{
+	char spec[FH_LOG_LEVELS_MAX];
+	size_t len = 0;
+	ssize_t n;
+
+	if (!levels_file)
+		return true;
+
+	int fd = open (levels_file, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+	{
+		fh_pr_err ("Failed to open %s: %s", levels_file, strerror (errno));
+		return false;
+	}
+
+	while (len < sizeof (spec) - 1
+		   && ((n = read (fd, spec + len, sizeof (spec) - 1 - len)) > 0
+			   || (n < 0 && errno == EINTR)))
+		len += n > 0 ? (size_t) n : 0;
+
+	close (fd);
+	spec[len] = 0;
+
+	/* Lines starting with # are comments */
+	for (char *line = spec; line && *line; line = strchr (line, '\n'))
+	{
+		line += *line == '\n';
+
+		if (*line == '#')
+			memset (line, ' ', strcspn (line, "\n"));
+	}
+
+	if (!fh_log_set_levels (spec))
+	{
+		fh_pr_err ("Invalid log levels in %s", levels_file);
+		return false;
+	}
+
+	fh_pr_info ("Loaded log levels from %s", levels_file);
+	return true;
+}
+
+bool
+fh_log_open (const char *file, const char *error_file)
+{
+	int fd = -1, efd = -1;
+
+	if (file
+		&& (fd = open (file, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0640))
+			   < 0)
+		return false;
+
+	if (error_file
+		&& (efd = open (error_file,
+						O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0640))
+			   < 0)
+	{
+		if (fd >= 0)
+			close (fd);
+
+		return false;
+	}
+
+	if (fd >= 0)
+		out_fd = fd;
+
+	if (efd >= 0)
+		err_fd = efd;
+	else if (fd >= 0)
+		err_fd = fd;
+
+	free (out_file);
+	free (err_file);
+	out_file = file ? strdup (file) : NULL;
+	err_file = error_file ? strdup (error_file) : NULL;
+
+	if (fd >= 0 || efd >= 0)
+		is_tty = isatty (out_fd) && isatty (err_fd);
+
+	return true;
+}
+
+/* Replaces the file behind FD, so that the writer thread, which may be
+   using it, need not know.  */
+static bool
+fh_log_reopen_fd (const char *path, int fd)
+{
+	int new_fd = open (path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0640);
+
+	if (new_fd < 0)
+	{
+		fh_pr_err ("Failed to reopen %s: %s", path, strerror (errno));
+		return false;
+	}
+
+	dup2 (new_fd, fd);
+	close (new_fd);
+	return true;
+}
+
+bool
+fh_log_reopen (void)
+{
+	bool ret = true;
+
+	if (out_file)
+		ret = fh_log_reopen_fd (out_file, out_fd);
+
+	if (err_file)
+		ret = fh_log_reopen_fd (err_file, err_fd) && ret;
+
+	return ret;
+}
+
+static void
+fh_log_write_all (int fd, struct iovec *iov, int iovcnt)
+{
+	while (iovcnt > 0)
+	{
+		ssize_t n = writev (fd, iov, iovcnt);
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			return;
+		}
+
+		while (iovcnt > 0 && (size_t) n >= iov->iov_len)
+		{
+			n -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+
+		if (iovcnt > 0)
+		{
+			iov->iov_base = (uint8_t *) iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+}
+
+static inline size_t
+fh_log_record_size (size_t len)
+{
+	const size_t align = sizeof (struct fh_log_record);
+	return (sizeof (struct fh_log_record) + len + align - 1) & ~(align - 1);
+}
+
+static void
+fh_log_report_dropped (uint64_t dropped)
+{
+	char line[128];
+	int len = snprintf (line, sizeof (line),
+						"[%12.7lf] [%s %d] %-6s %lu log messages were dropped\n",
+						((double) (now () - startup_time)) / (double) 1000000,
+						is_master ? "Master" : "Worker", main_pid, "warn:",
+						(unsigned long) dropped);
+	struct iovec iov = { .iov_base = line, .iov_len = (size_t) len };
+
+	fh_log_write_all (err_fd, &iov, 1);
+}
+
+static void *
+fh_log_writer (void *arg __attribute_maybe_unused__)
+{
+	struct iovec iov[FH_LOG_BATCH];
+	uint64_t reported = 0;
+
+	for (;;)
+	{
+		const uint64_t head = __atomic_load_n (&ring->head, __ATOMIC_SEQ_CST);
+		uint64_t tail = ring->tail;
+
+		if (head == tail)
+		{
+			const uint64_t dropped
+				= __atomic_load_n (&ring->dropped, __ATOMIC_RELAXED);
+
+			if (dropped != reported)
+			{
+				fh_log_report_dropped (dropped - reported);
+				reported = dropped;
+			}
+
+			if (__atomic_load_n (&ring->stop, __ATOMIC_SEQ_CST))
+				break;
+
+			struct timespec ts;
+
+			clock_gettime (CLOCK_REALTIME, &ts);
+			ts.tv_nsec += FH_LOG_IDLE_WAIT * 1000000L;
+			ts.tv_sec += ts.tv_nsec / 1000000000L;
+			ts.tv_nsec %= 1000000000L;
+
+			pthread_mutex_lock (&ring->lock);
+			__atomic_store_n (&ring->waiting, true, __ATOMIC_SEQ_CST);
+
+			if (__atomic_load_n (&ring->head, __ATOMIC_SEQ_CST) == tail
+				&& !__atomic_load_n (&ring->stop, __ATOMIC_SEQ_CST))
+				pthread_cond_timedwait (&ring->cond, &ring->lock, &ts);
+
+			__atomic_store_n (&ring->waiting, false, __ATOMIC_SEQ_CST);
+			pthread_mutex_unlock (&ring->lock);
+			continue;
+		}
+
+		/* Collects the records up to the first that goes to another file */
+		int iovcnt = 0, fd = -1;
+
+		while (tail != head && iovcnt < FH_LOG_BATCH)
+		{
+			const size_t off = tail % FH_LOG_RING_SIZE;
+			struct fh_log_record record;
+
+			memcpy (&record, ring->buf + off, sizeof (record));
+
+			if (record.fd < 0)
+			{
+				tail += FH_LOG_RING_SIZE - off;
+				continue;
+			}
+
+			if (iovcnt && record.fd != fd)
+				break;
+
+			fd = record.fd;
+			iov[iovcnt].iov_base = ring->buf + off + sizeof (record);
+			iov[iovcnt].iov_len = record.len;
+			iovcnt++;
+			tail += fh_log_record_size (record.len);
+		}
+
+		if (iovcnt)
+			fh_log_write_all (fd, iov, iovcnt);
+
+		__atomic_store_n (&ring->tail, tail, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+bool
+fh_log_start_async (void)
+{
+	if (ring)
+		return true;
+
+	struct fh_log_ring *new_ring = calloc (1, sizeof (*new_ring));
+
+	if (!new_ring)
+		return false;
+
+	new_ring->buf = malloc (FH_LOG_RING_SIZE);
+
+	if (!new_ring->buf)
+	{
+		free (new_ring);
+		return false;
+	}
+
+	pthread_mutex_init (&new_ring->lock, NULL);
+	pthread_cond_init (&new_ring->cond, NULL);
+	ring = new_ring;
+
+	int err = pthread_create (&ring->thread, NULL, &fh_log_writer, NULL);
+
+	if (err)
+	{
+		ring = NULL;
+		pthread_cond_destroy (&new_ring->cond);
+		pthread_mutex_destroy (&new_ring->lock);
+		free (new_ring->buf);
+		free (new_ring);
+		errno = err;
+		return false;
+	}
+
+	return true;
+}
+
+void
+fh_log_stop_async (void)
+{
+	if (!ring)
+		return;
+
+	pthread_mutex_lock (&ring->lock);
+	__atomic_store_n (&ring->stop, true, __ATOMIC_SEQ_CST);
+	pthread_cond_signal (&ring->cond);
+	pthread_mutex_unlock (&ring->lock);
+	pthread_join (ring->thread, NULL);
+
+	struct fh_log_ring *old_ring = ring;
+
+	ring = NULL;
+	pthread_cond_destroy (&old_ring->cond);
+	pthread_mutex_destroy (&old_ring->lock);
+	free (old_ring->buf);
+	free (old_ring);
+}
+
+uint64_t
+fh_log_dropped (void)
+{
+	return ring ? __atomic_load_n (&ring->dropped, __ATOMIC_RELAXED) : 0;
+}
+
+static void
+fh_log_push (int fd, const char *line, size_t len)
+{
+	const size_t size = fh_log_record_size (len);
+	uint64_t head = ring->head;
+	const uint64_t tail = __atomic_load_n (&ring->tail, __ATOMIC_ACQUIRE);
+	const size_t off = head % FH_LOG_RING_SIZE;
+	const size_t pad = size > FH_LOG_RING_SIZE - off ? FH_LOG_RING_SIZE - off : 0;
+
+	if (head + pad + size - tail > FH_LOG_RING_SIZE)
+	{
+		__atomic_add_fetch (&ring->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	if (pad)
+	{
+		const struct fh_log_record record = { .len = 0, .fd = -1 };
+
+		memcpy (ring->buf + off, &record, sizeof (record));
+		head += pad;
+	}
+
+	const struct fh_log_record record = { .len = (uint32_t) len, .fd = fd };
+	uint8_t *dest = ring->buf + head % FH_LOG_RING_SIZE;
+
+	memcpy (dest, &record, sizeof (record));
+	memcpy (dest + sizeof (record), line, len);
+	__atomic_store_n (&ring->head, head + size, __ATOMIC_SEQ_CST);
+
+	if (unlikely (__atomic_load_n (&ring->waiting, __ATOMIC_SEQ_CST)))
+	{
+		pthread_mutex_lock (&ring->lock);
+		pthread_cond_signal (&ring->cond);
+		pthread_mutex_unlock (&ring->lock);
+	}
+}
+
 __attribute__ ((format (printf, 1, 2))) int
 fh_printl (const char *format, ...)
 {
 	bool sig_fmt = ((uint8_t) format[0]) == LOG_FORMAT_SIG;
 	enum fh_log_level level = sig_fmt ? format[1] : LOG_INFO;
 
-	if (level < min_level)
-		return 0;
-
-	FILE *stream = level >= LOG_WARN ? stderr : stdout;
+	const int fd = level >= LOG_WARN ? err_fd : out_fd;
+	const char *label = level == LOG_DEBUG ? "debug:"
+						: level == LOG_INFO ? "info:"
+						: level == LOG_WARN ? "warn:"
+						: level == LOG_ERR	? "error:"
+											: "emerg:";
+	char line[FH_LOG_LINE_MAX];
+	int len;
 
 	if (likely (is_tty))
 	{
 		const int color = level == LOG_DEBUG ? 2 : level == LOG_INFO ? 0 : level == LOG_WARN ? 33 : 31;
 		const int ts_color = level >= LOG_WARN ? 31 : 32;
 
-		fprintf (stream, "\033[%dm[%12.7lf]\033[0m \033[2;37m[%s %d]\033[0m \033[%dm%-6s\033[0m ", ts_color,
-				 ((double) (now () - startup_time)) / (double) 1000000, is_master ? "Master" : "Worker", main_pid,
-				 color,
-				 level == LOG_DEBUG	 ? "debug:"
-				 : level == LOG_INFO ? "info:"
-				 : level == LOG_WARN ? "warn:"
-				 : level == LOG_ERR	 ? "error:"
-									 : "emerg:");
+		len = snprintf (line, sizeof (line), "\033[%dm[%12.7lf]\033[0m \033[2;37m[%s %d]\033[0m \033[%dm%-6s\033[0m ",
+						ts_color, ((double) (now () - startup_time)) / (double) 1000000,
+						is_master ? "Master" : "Worker", main_pid, color, label);
 	}
 	else
 	{
-		fprintf (stream, "[%12.7lf] [%s %d] %-6s ", ((double) (now () - startup_time)) / (double) 1000000,
-				 is_master ? "Master" : "Worker", main_pid,
-				 level == LOG_DEBUG	 ? "debug:"
-				 : level == LOG_INFO ? "info:"
-				 : level == LOG_WARN ? "warn:"
-				 : level == LOG_ERR	 ? "error:"
-									 : "emerg:");
+		len = snprintf (line, sizeof (line), "[%12.7lf] [%s %d] %-6s ",
+						((double) (now () - startup_time)) / (double) 1000000,
+						is_master ? "Master" : "Worker", main_pid, label);
 	}
 
+	/* Leaves room for the newline */
+	const size_t room = sizeof (line) - (size_t) len - 1;
 	va_list args;
 	va_start (args, format);
-	int ret = vfprintf (stream, sig_fmt ? format + 2 : format, args);
+	int ret = vsnprintf (line + len, room, sig_fmt ? format + 2 : format, args);
 	va_end (args);
 
-	fputc ('\n', stream);
+	if (ret < 0)
+		return ret;
+
+	len += (size_t) ret < room ? ret : (int) room - 1;
+	line[len++] = '\n';
+
+	if (ring)
+		fh_log_push (fd, line, (size_t) len);
+	else
+	{
+		struct iovec iov = { .iov_base = line, .iov_len = (size_t) len };
+		fh_log_write_all (fd, &iov, 1);
+	}
+
 	return ret;
 }
@@ -20,6 +20,9 @@
 #ifndef FH_LOG_LOG_H
 #define FH_LOG_LOG_H
 
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 #define LOG_FORMAT_SIG 0xf2
@@ -36,6 +39,82 @@ enum fh_log_level
 
 __attribute__ ((format (printf, 1, 2))) int fh_printl (const char *format, ...);
 void fh_log_set_worker_pid (pid_t pid);
+/* Writes messages to these files instead of the standard output and error.
+   Errors go to FILE too when ERROR_FILE is NULL.  */
+bool fh_log_open (const char *file, const char *error_file);
+/* Opens the files of fh_log_open() again, after they were rotated.  */
+bool fh_log_reopen (void);
+/* Hands messages to a thread that writes them, so that logging does not
+   block.  Messages that do not fit in its buffer are dropped and counted.
+   Only the thread that called this may log until fh_log_stop_async().  */
+bool fh_log_start_async (void);
+/* Writes out what is left, and stops the thread.  */
+void fh_log_stop_async (void);
+uint64_t fh_log_dropped (void);
+
+/* Messages below this level are not compiled in.  */
+#ifndef FH_LOG_FLOOR
+	#ifdef NDEBUG
+		#define FH_LOG_FLOOR LOG_INFO
+	#else /* not NDEBUG */
+		#define FH_LOG_FLOOR LOG_DEBUG
+	#endif /* NDEBUG */
+#endif /* FH_LOG_FLOOR */
+
+/* Every file that defines FH_LOG_MODULE_NAME has one of these, and files
+   with the same name share their level.  */
+struct fh_log_module
+{
+	const char *name;
+	enum fh_log_level level;
+	struct fh_log_module *next;
+};
+
+/* For files without a module name */
+extern struct fh_log_module fh_log_default_module;
+extern volatile sig_atomic_t fh_log_levels_requested;
+extern volatile sig_atomic_t fh_log_reopen_requested;
+
+void fh_log_register (struct fh_log_module *module);
+void fh_log_unregister (struct fh_log_module *module);
+/* Sets the level of all modules.  */
+void fh_log_set_min_level (enum fh_log_level level);
+/* Applies a list such as "info,conn=debug,http1=warn", separated by commas
+   or spaces.  A level without a name applies to all modules.  */
+bool fh_log_set_levels (const char *spec);
+/* Sets the file that fh_log_load_levels() reads a list of levels from.  */
+bool fh_log_set_levels_file (const char *path);
+bool fh_log_load_levels (void);
+
+/* Called from signal handlers; the levels are loaded, or the files
+   reopened, at the next fh_log_check_requests().  */
+static inline void
+fh_log_request_levels (void)
+{
+	fh_log_levels_requested = 1;
+}
+
+static inline void
+fh_log_request_reopen (void)
+{
+	fh_log_reopen_requested = 1;
+}
+
+static inline void
+fh_log_check_requests (void)
+{
+	if (__builtin_expect (fh_log_levels_requested, 0))
+	{
+		fh_log_levels_requested = 0;
+		fh_log_load_levels ();
+	}
+
+	if (__builtin_expect (fh_log_reopen_requested, 0))
+	{
+		fh_log_reopen_requested = 0;
+		fh_log_reopen ();
+	}
+}
 
 #define FH_LOG_USE_COLORS
 
@@ -45,10 +124,34 @@ void fh_log_set_worker_pid (pid_t pid);
 	#else
 		#define _FH_LOG_MODULE FH_LOG_MODULE_NAME ": "
 	#endif
+
+static struct fh_log_module fh_log_module = {
+	.name = FH_LOG_MODULE_NAME,
+	.level = FH_LOG_FLOOR,
+};
+
+__attribute__ ((constructor)) static void
+fh_log_module_register (void)
+{
+	fh_log_register (&fh_log_module);
+}
+
+/* Loadable modules are unloaded before exiting */
+__attribute__ ((destructor)) static void
+fh_log_module_unregister (void)
+{
+	fh_log_unregister (&fh_log_module);
+}
+
+	#define _FH_LOG_LEVEL fh_log_module.level
 #else /* not FH_LOG_MODULE */
 	#define _FH_LOG_MODULE
+	#define _FH_LOG_LEVEL fh_log_default_module.level
 #endif /* FH_LOG_MODULE */
 
+#define fh_log_enabled(level) \
+	((level) >= FH_LOG_FLOOR && (level) >= _FH_LOG_LEVEL)
+
 #define PR_DEBUG LOG_FORMAT_SIG_STR "\x5"
 #define PR_INFO LOG_FORMAT_SIG_STR "\x6"
 #define PR_WARN LOG_FORMAT_SIG_STR "\x7"
@@ -57,10 +160,18 @@ void fh_log_set_worker_pid (pid_t pid);
 
 /* Macro helpers for logging in different levels. */
 
-#define fh_pr_debug(...) fh_printl (PR_DEBUG _FH_LOG_MODULE __VA_ARGS__)
-#define fh_pr_info(...) fh_printl (PR_INFO _FH_LOG_MODULE __VA_ARGS__)
-#define fh_pr_warn(...) fh_printl (PR_WARN _FH_LOG_MODULE __VA_ARGS__)
-#define fh_pr_err(...) fh_printl (PR_ERR _FH_LOG_MODULE __VA_ARGS__)
-#define fh_pr_emerg(...) fh_printl (PR_EMERG _FH_LOG_MODULE __VA_ARGS__)
+#define _fh_pr(level, prefix, ...) \
+	do \
+	{ \
+		if (fh_log_enabled (level)) \
+			fh_printl (prefix _FH_LOG_MODULE __VA_ARGS__); \
+	} \
+	while (0)
+
+#define fh_pr_debug(...) _fh_pr (LOG_DEBUG, PR_DEBUG, __VA_ARGS__)
+#define fh_pr_info(...) _fh_pr (LOG_INFO, PR_INFO, __VA_ARGS__)
+#define fh_pr_warn(...) _fh_pr (LOG_WARN, PR_WARN, __VA_ARGS__)
+#define fh_pr_err(...) _fh_pr (LOG_ERR, PR_ERR, __VA_ARGS__)
+#define fh_pr_emerg(...) _fh_pr (LOG_EMERG, PR_EMERG, __VA_ARGS__)
 
 #endif /* FH_LOG_LOG_H */
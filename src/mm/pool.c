@@ -24,32 +24,42 @@
 
 #include "macros.h"
 #include "pool.h"
+#include "probes.h"
 
 #undef fh_pool_alloc
 #undef fh_pool_zalloc
 #undef fh_pool_undo_last_alloc
 
+size_t fh_pool_bytes = 0;
+
 struct fh_pool *
 fh_pool_create (size_t init_cap)
 {
 	init_cap = init_cap ? init_cap : FH_DEFAULT_CHUNK_CAP;
-	struct fh_pool *pool = zalloc (sizeof (*pool) + sizeof (*pool->current) + init_cap);
+	const size_t size = sizeof (struct fh_pool) + sizeof (struct fh_pool_chunk) + init_cap;
+	struct fh_pool *pool = zalloc (size);
 
 	if (!pool)
 		return NULL;
 
+	pool->size = size;
+	fh_pool_bytes += size;
+
 	pool->current = (struct fh_pool_chunk *) (pool + 1);
 	pool->current->mptr = (void *) (pool->current + 1);
 	pool->current->cap = init_cap;
 	pool->current->non_freeable = true;
 	pool->chunk_count = 1;
 
+	FH_PROBE2 (pool__create, pool, size);
 	return pool;
 }
 
 void
 fh_pool_destroy (struct fh_pool *pool)
 {
+	FH_PROBE2 (pool__destroy, pool, pool->size);
+
 	struct fh_pool_chunk *c = pool->current;
 
 	while (c)
@@ -84,6 +94,7 @@ fh_pool_destroy (struct fh_pool *pool)
 		p = next;
 	}
 
+	fh_pool_bytes -= pool->size;
 	free (pool);
 }
 
@@ -104,6 +115,8 @@ fh_pool_large_alloc (struct fh_pool *pool, size_t size, fh_pool_cleanup_cb_t cle
 
 	pool->mallocs = m;
 	pool->malloc_count++;
+	pool->size += sizeof (struct fh_pool_malloc) + size;
+	fh_pool_bytes += sizeof (struct fh_pool_malloc) + size;
 
 	return m->mptr;
 }
@@ -130,6 +143,8 @@ fh_pool_alloc (struct fh_pool *pool, size_t size)
 
 		pool->current = c;
 		pool->chunk_count++;
+		pool->size += sizeof (*c) + cap;
+		fh_pool_bytes += sizeof (*c) + cap;
 
 		return c->mptr;
 	}
@@ -54,10 +54,15 @@ struct fh_pool
 	struct fh_pool *last_child;
 	size_t child_count;
 	struct fh_pool *next;
+	/* Bytes taken from malloc(), children not included */
+	size_t size;
 };
 
 typedef struct fh_pool pool_t;
 
+/* Bytes held by all pools of the process */
+extern size_t fh_pool_bytes;
+
 // #define fh_pool_alloc(a, b) malloc (b)
 // #define fh_pool_zalloc(a, b) calloc (1, b)
 // #define fh_pool_undo_last_alloc(...) NULL
@@ -0,0 +1,502 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "shmcache.h"
+
+#define FH_SHM_CACHE_NIL UINT32_MAX
+#define FH_SHM_CACHE_ALIGN(n, a) (((n) + (a) - 1) & ~((size_t) (a) - 1))
+
+struct fh_shm_cache_slot
+{
+	uint32_t hash_next;
+	uint32_t lru_prev;
+	uint32_t lru_next;
+	uint32_t value_len;
+	time_t expires;
+	/* Set once the key and the value are complete, and cleared before the
+	   slot is freed, so that it can be told apart after a crash.  */
+	uint8_t live;
+	uint8_t key_len;
+	uint8_t key[FH_SHM_CACHE_KEY_MAX];
+	uint8_t value[];
+};
+
+/* Followed by `bucket_count' bucket heads and then `slot_count' slots of
+   `slot_size' bytes each.  Links are slot indices, which stay valid no
+   matter where the mapping ends up.  */
+struct fh_shm_cache_shard
+{
+	pthread_mutex_t lock;
+	uint32_t lru_head;
+	uint32_t lru_tail;
+	uint32_t free_head;
+	uint32_t count;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+};
+
+struct fh_shm_cache
+{
+	size_t map_size;
+	size_t value_max;
+	size_t slot_size;
+	size_t shard_size;
+	size_t slots_off;
+	uint32_t slot_count;
+	uint32_t bucket_count;
+	fh_shm_cache_evict_cb_t evict;
+};
+
+static inline struct fh_shm_cache_shard *
+fh_shm_cache_shard (struct fh_shm_cache *cache, size_t index)
+{
+	return (struct fh_shm_cache_shard *) ((uint8_t *) cache
+										  + FH_SHM_CACHE_ALIGN (sizeof (*cache), 64)
+										  + index * cache->shard_size);
+}
+
+static inline uint32_t *
+fh_shm_cache_buckets (struct fh_shm_cache_shard *shard)
+{
+	return (uint32_t *) (shard + 1);
+}
+
+static inline struct fh_shm_cache_slot *
+fh_shm_cache_slot (struct fh_shm_cache *cache, struct fh_shm_cache_shard *shard,
+				   uint32_t index)
+{
+	return (struct fh_shm_cache_slot *) ((uint8_t *) shard + cache->slots_off
+										 + (size_t) index * cache->slot_size);
+}
+
+static inline uint64_t
+fh_shm_cache_hash (const uint8_t *key, size_t key_len)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (size_t i = 0; i < key_len; i++)
+	{
+		hash ^= key[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+static void
+fh_shm_cache_shard_reset (struct fh_shm_cache *cache,
+						  struct fh_shm_cache_shard *shard)
+{
+	uint32_t *buckets = fh_shm_cache_buckets (shard);
+
+	for (uint32_t i = 0; i < cache->bucket_count; i++)
+		buckets[i] = FH_SHM_CACHE_NIL;
+
+	for (uint32_t i = 0; i < cache->slot_count; i++)
+	{
+		struct fh_shm_cache_slot *slot = fh_shm_cache_slot (cache, shard, i);
+
+		slot->live = 0;
+		slot->lru_next = i + 1 < cache->slot_count ? i + 1 : FH_SHM_CACHE_NIL;
+	}
+
+	shard->free_head = 0;
+	shard->lru_head = shard->lru_tail = FH_SHM_CACHE_NIL;
+	shard->count = 0;
+}
+
+static bool
+fh_shm_cache_lock (struct fh_shm_cache *cache, struct fh_shm_cache_shard *shard)
+{
+	int rc = pthread_mutex_lock (&shard->lock);
+
+	if (rc == EOWNERDEAD)
+	{
+		/* The previous owner died halfway through an update, so the links
+		   in this shard cannot be trusted any more.  Entries still own
+		   whatever the evict callback frees, so it runs for every one of
+		   them, possibly again for one that was being evicted.  */
+		for (uint32_t i = 0; cache->evict && i < cache->slot_count; i++)
+		{
+			struct fh_shm_cache_slot *slot = fh_shm_cache_slot (cache, shard, i);
+
+			if (slot->live && slot->key_len <= FH_SHM_CACHE_KEY_MAX
+				&& slot->value_len <= cache->value_max)
+				cache->evict (slot->key, slot->key_len, slot->value,
+							  slot->value_len);
+		}
+
+		fh_shm_cache_shard_reset (cache, shard);
+		pthread_mutex_consistent (&shard->lock);
+		return true;
+	}
+
+	return rc == 0;
+}
+
+struct fh_shm_cache *
+fh_shm_cache_create (size_t size, size_t value_max)
+{
+	const size_t header_size = FH_SHM_CACHE_ALIGN (sizeof (struct fh_shm_cache), 64);
+	const size_t shard_header = FH_SHM_CACHE_ALIGN (sizeof (struct fh_shm_cache_shard), 8);
+	const size_t slot_size = FH_SHM_CACHE_ALIGN (sizeof (struct fh_shm_cache_slot) + value_max, 8);
+	const size_t per_slot = slot_size + sizeof (uint32_t);
+
+	if (size < header_size + FH_SHM_CACHE_SHARDS * (shard_header + per_slot + 64))
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	size_t slot_count = (size - header_size) / FH_SHM_CACHE_SHARDS;
+	slot_count = (slot_count - shard_header - 64) / per_slot;
+
+	if (slot_count >= FH_SHM_CACHE_NIL)
+		slot_count = FH_SHM_CACHE_NIL - 1;
+
+	const size_t slots_off = FH_SHM_CACHE_ALIGN (shard_header + slot_count * sizeof (uint32_t), 8);
+	const size_t shard_size = FH_SHM_CACHE_ALIGN (slots_off + slot_count * slot_size, 64);
+	const size_t map_size = header_size + FH_SHM_CACHE_SHARDS * shard_size;
+
+	struct fh_shm_cache *cache = mmap (NULL, map_size, PROT_READ | PROT_WRITE,
+									   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if (cache == MAP_FAILED)
+		return NULL;
+
+	cache->map_size = map_size;
+	cache->value_max = value_max;
+	cache->slot_size = slot_size;
+	cache->shard_size = shard_size;
+	cache->slots_off = slots_off;
+	cache->slot_count = (uint32_t) slot_count;
+	cache->bucket_count = (uint32_t) slot_count;
+
+	pthread_mutexattr_t attr;
+
+	if (pthread_mutexattr_init (&attr) != 0)
+	{
+		munmap (cache, map_size);
+		return NULL;
+	}
+
+	pthread_mutexattr_setpshared (&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust (&attr, PTHREAD_MUTEX_ROBUST);
+
+	for (size_t i = 0; i < FH_SHM_CACHE_SHARDS; i++)
+	{
+		struct fh_shm_cache_shard *shard = fh_shm_cache_shard (cache, i);
+
+		if (pthread_mutex_init (&shard->lock, &attr) != 0)
+		{
+			pthread_mutexattr_destroy (&attr);
+			munmap (cache, map_size);
+			return NULL;
+		}
+
+		fh_shm_cache_shard_reset (cache, shard);
+	}
+
+	pthread_mutexattr_destroy (&attr);
+	return cache;
+}
+
+void
+fh_shm_cache_destroy (struct fh_shm_cache *cache)
+{
+	if (cache)
+		munmap (cache, cache->map_size);
+}
+
+void
+fh_shm_cache_set_evict_cb (struct fh_shm_cache *cache,
+						   fh_shm_cache_evict_cb_t evict)
+{
+	cache->evict = evict;
+}
+
+static uint32_t
+fh_shm_cache_find (struct fh_shm_cache *cache, struct fh_shm_cache_shard *shard,
+				   uint32_t bucket, const void *key, size_t key_len)
+{
+	uint32_t index = fh_shm_cache_buckets (shard)[bucket];
+
+	while (index != FH_SHM_CACHE_NIL)
+	{
+		struct fh_shm_cache_slot *slot = fh_shm_cache_slot (cache, shard, index);
+
+		if (slot->key_len == key_len && !memcmp (slot->key, key, key_len))
+			return index;
+
+		index = slot->hash_next;
+	}
+
+	return FH_SHM_CACHE_NIL;
+}
+
+static void
+fh_shm_cache_lru_unlink (struct fh_shm_cache *cache,
+						 struct fh_shm_cache_shard *shard,
+						 struct fh_shm_cache_slot *slot)
+{
+	if (slot->lru_prev != FH_SHM_CACHE_NIL)
+		fh_shm_cache_slot (cache, shard, slot->lru_prev)->lru_next = slot->lru_next;
+	else
+		shard->lru_head = slot->lru_next;
+
+	if (slot->lru_next != FH_SHM_CACHE_NIL)
+		fh_shm_cache_slot (cache, shard, slot->lru_next)->lru_prev = slot->lru_prev;
+	else
+		shard->lru_tail = slot->lru_prev;
+}
+
+static void
+fh_shm_cache_lru_push (struct fh_shm_cache *cache,
+					   struct fh_shm_cache_shard *shard, uint32_t index)
+{
+	struct fh_shm_cache_slot *slot = fh_shm_cache_slot (cache, shard, index);
+
+	slot->lru_prev = FH_SHM_CACHE_NIL;
+	slot->lru_next = shard->lru_head;
+
+	if (shard->lru_head != FH_SHM_CACHE_NIL)
+		fh_shm_cache_slot (cache, shard, shard->lru_head)->lru_prev = index;
+	else
+		shard->lru_tail = index;
+
+	shard->lru_head = index;
+}
+
+static void
+fh_shm_cache_unlink (struct fh_shm_cache *cache, struct fh_shm_cache_shard *shard,
+					 uint32_t index)
+{
+	struct fh_shm_cache_slot *slot = fh_shm_cache_slot (cache, shard, index);
+	uint32_t bucket = (uint32_t) ((fh_shm_cache_hash (slot->key, slot->key_len)
+								   / FH_SHM_CACHE_SHARDS)
+								  % cache->bucket_count);
+	uint32_t *link = &fh_shm_cache_buckets (shard)[bucket];
+
+	slot->live = 0;
+	/* A crash is the only other observer, so only the compiler needs to
+	   keep the order.  */
+	__atomic_signal_fence (__ATOMIC_SEQ_CST);
+
+	while (*link != index)
+		link = &fh_shm_cache_slot (cache, shard, *link)->hash_next;
+
+	*link = slot->hash_next;
+	fh_shm_cache_lru_unlink (cache, shard, slot);
+
+	slot->lru_next = shard->free_head;
+	shard->free_head = index;
+	shard->count--;
+}
+
+static void
+fh_shm_cache_evict (struct fh_shm_cache *cache, struct fh_shm_cache_shard *shard,
+					uint32_t index)
+{
+	struct fh_shm_cache_slot *slot = fh_shm_cache_slot (cache, shard, index);
+
+	if (cache->evict)
+		cache->evict (slot->key, slot->key_len, slot->value, slot->value_len);
+
+	fh_shm_cache_unlink (cache, shard, index);
+}
+
+static bool
+fh_shm_cache_store (struct fh_shm_cache *cache, const void *key,
+					size_t key_len, const void *value, size_t value_len,
+					time_t expires, bool replace, time_t now)
+{
+	if (key_len > FH_SHM_CACHE_KEY_MAX || value_len > cache->value_max)
+		return false;
+
+	uint64_t hash = fh_shm_cache_hash (key, key_len);
+	struct fh_shm_cache_shard *shard
+		= fh_shm_cache_shard (cache, hash % FH_SHM_CACHE_SHARDS);
+	uint32_t bucket
+		= (uint32_t) ((hash / FH_SHM_CACHE_SHARDS) % cache->bucket_count);
+
+	if (!fh_shm_cache_lock (cache, shard))
+		return false;
+
+	uint32_t index = fh_shm_cache_find (cache, shard, bucket, key, key_len);
+
+	if (index != FH_SHM_CACHE_NIL)
+	{
+		if (replace)
+			fh_shm_cache_unlink (cache, shard, index);
+		else if (fh_shm_cache_slot (cache, shard, index)->expires > now)
+		{
+			pthread_mutex_unlock (&shard->lock);
+			return false;
+		}
+		else
+			fh_shm_cache_evict (cache, shard, index);
+	}
+
+	if (shard->free_head == FH_SHM_CACHE_NIL)
+	{
+		fh_shm_cache_evict (cache, shard, shard->lru_tail);
+		shard->evictions++;
+	}
+
+	index = shard->free_head;
+
+	struct fh_shm_cache_slot *slot = fh_shm_cache_slot (cache, shard, index);
+	uint32_t *buckets = fh_shm_cache_buckets (shard);
+
+	shard->free_head = slot->lru_next;
+	shard->count++;
+
+	slot->key_len = (uint8_t) key_len;
+	slot->value_len = (uint32_t) value_len;
+	slot->expires = expires;
+	memcpy (slot->key, key, key_len);
+	memcpy (slot->value, value, value_len);
+	__atomic_signal_fence (__ATOMIC_SEQ_CST);
+	slot->live = 1;
+
+	slot->hash_next = buckets[bucket];
+	buckets[bucket] = index;
+	fh_shm_cache_lru_push (cache, shard, index);
+
+	pthread_mutex_unlock (&shard->lock);
+	return true;
+}
+
+bool
+fh_shm_cache_set (struct fh_shm_cache *cache, const void *key, size_t key_len,
+				  const void *value, size_t value_len, time_t expires)
+{
+	return fh_shm_cache_store (cache, key, key_len, value, value_len, expires,
+							   true, 0);
+}
+
+bool
+fh_shm_cache_add (struct fh_shm_cache *cache, const void *key, size_t key_len,
+				  const void *value, size_t value_len, time_t expires,
+				  time_t now)
+{
+	return fh_shm_cache_store (cache, key, key_len, value, value_len, expires,
+							   false, now);
+}
+
+bool
+fh_shm_cache_get (struct fh_shm_cache *cache, const void *key, size_t key_len,
+				  void *value, size_t *value_len, time_t now)
+{
+	if (key_len > FH_SHM_CACHE_KEY_MAX)
+		return false;
+
+	uint64_t hash = fh_shm_cache_hash (key, key_len);
+	struct fh_shm_cache_shard *shard
+		= fh_shm_cache_shard (cache, hash % FH_SHM_CACHE_SHARDS);
+	uint32_t bucket
+		= (uint32_t) ((hash / FH_SHM_CACHE_SHARDS) % cache->bucket_count);
+	bool found = false;
+
+	if (!fh_shm_cache_lock (cache, shard))
+		return false;
+
+	uint32_t index = fh_shm_cache_find (cache, shard, bucket, key, key_len);
+
+	if (index != FH_SHM_CACHE_NIL)
+	{
+		struct fh_shm_cache_slot *slot = fh_shm_cache_slot (cache, shard, index);
+
+		if (slot->expires <= now)
+			fh_shm_cache_evict (cache, shard, index);
+		else if (slot->value_len <= *value_len)
+		{
+			memcpy (value, slot->value, slot->value_len);
+			*value_len = slot->value_len;
+
+			fh_shm_cache_lru_unlink (cache, shard, slot);
+			fh_shm_cache_lru_push (cache, shard, index);
+			found = true;
+		}
+	}
+
+	if (found)
+		shard->hits++;
+	else
+		shard->misses++;
+
+	pthread_mutex_unlock (&shard->lock);
+	return found;
+}
+
+bool
+fh_shm_cache_remove (struct fh_shm_cache *cache, const void *key,
+					 size_t key_len)
+{
+	if (key_len > FH_SHM_CACHE_KEY_MAX)
+		return false;
+
+	uint64_t hash = fh_shm_cache_hash (key, key_len);
+	struct fh_shm_cache_shard *shard
+		= fh_shm_cache_shard (cache, hash % FH_SHM_CACHE_SHARDS);
+	uint32_t bucket
+		= (uint32_t) ((hash / FH_SHM_CACHE_SHARDS) % cache->bucket_count);
+
+	if (!fh_shm_cache_lock (cache, shard))
+		return false;
+
+	uint32_t index = fh_shm_cache_find (cache, shard, bucket, key, key_len);
+
+	if (index != FH_SHM_CACHE_NIL)
+		fh_shm_cache_unlink (cache, shard, index);
+
+	pthread_mutex_unlock (&shard->lock);
+	return index != FH_SHM_CACHE_NIL;
+}
+
+void
+fh_shm_cache_get_stats (struct fh_shm_cache *cache,
+						struct fh_shm_cache_stats *stats)
+{
+	memset (stats, 0, sizeof (*stats));
+
+	for (size_t i = 0; i < FH_SHM_CACHE_SHARDS; i++)
+	{
+		struct fh_shm_cache_shard *shard = fh_shm_cache_shard (cache, i);
+
+		if (!fh_shm_cache_lock (cache, shard))
+			continue;
+
+		stats->entries += shard->count;
+		stats->capacity += cache->slot_count;
+		stats->hits += shard->hits;
+		stats->misses += shard->misses;
+		stats->evictions += shard->evictions;
+
+		pthread_mutex_unlock (&shard->lock);
+	}
+}
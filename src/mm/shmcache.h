@@ -0,0 +1,74 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FH_MM_SHMCACHE_H
+#define FH_MM_SHMCACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define FH_SHM_CACHE_KEY_MAX 32
+#define FH_SHM_CACHE_SHARDS 16
+
+/* A fixed-size key/value store living in anonymous shared memory, so that
+   it survives fork() and is shared by every worker.  Entries are spread
+   over FH_SHM_CACHE_SHARDS independently locked shards, each of which
+   evicts its least recently used entry when full.  */
+struct fh_shm_cache;
+
+/* Called with the shard locked for entries that are dropped to make room,
+   because they expired or because a process died while holding the lock,
+   but not for those that are replaced or removed.  */
+typedef void (*fh_shm_cache_evict_cb_t) (const void *key, size_t key_len,
+										 const void *value, size_t value_len);
+
+struct fh_shm_cache_stats
+{
+	uint64_t entries;
+	uint64_t capacity;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+};
+
+struct fh_shm_cache *fh_shm_cache_create (size_t size, size_t value_max);
+void fh_shm_cache_destroy (struct fh_shm_cache *cache);
+/* Set before the workers are forked.  */
+void fh_shm_cache_set_evict_cb (struct fh_shm_cache *cache,
+								fh_shm_cache_evict_cb_t evict);
+
+bool fh_shm_cache_set (struct fh_shm_cache *cache, const void *key,
+					   size_t key_len, const void *value, size_t value_len,
+					   time_t expires);
+/* Like fh_shm_cache_set(), but fails if the key has an entry that has not
+   expired at `now'.  */
+bool fh_shm_cache_add (struct fh_shm_cache *cache, const void *key,
+					   size_t key_len, const void *value, size_t value_len,
+					   time_t expires, time_t now);
+bool fh_shm_cache_get (struct fh_shm_cache *cache, const void *key,
+					   size_t key_len, void *value, size_t *value_len,
+					   time_t now);
+bool fh_shm_cache_remove (struct fh_shm_cache *cache, const void *key,
+						  size_t key_len);
+void fh_shm_cache_get_stats (struct fh_shm_cache *cache,
+							 struct fh_shm_cache_stats *stats);
+
+#endif /* FH_MM_SHMCACHE_H */
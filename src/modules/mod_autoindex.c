@@ -38,20 +38,6 @@
 #include "mod_autoindex.h"
 #include "log/log.h"
 
-static struct fh_link end_chunk_link = {
-	.is_eos = true,
-	.is_start = false,
-	.next = NULL,
-	.buf = & (struct fh_buf) {
-		.type = FH_BUF_DATA,
-		.freeable = false,
-		.attrs.mem.cap = 5,
-		.attrs.mem.len = 5,
-		.attrs.mem.rd_only = true,
-		.attrs.mem.data = (uint8_t *) "0\r\n\r\n", 
-	},
-};
-
 #define FILEINFO_SUCCESS 0
 #define FILEINFO_NEXT 1
 #define FILEINFO_EXIT 2
@@ -143,18 +129,15 @@ fh_autoindex_handle_chunked (struct fh_autoindex *autoindex)
 
 	pool_t *pool = autoindex->response->pool;
 	uint16_t port = autoindex->conn->extra->port;
-	size_t index_start_chunk_len
+	size_t index_start_len
 		= resource_index_start_html_len - 12 + (3 * request->uri_len);
-	size_t index_end_chunk_len = resource_index_end_html_len - 6
-								 + autoindex->conn->extra->host_len
-								 + (port < 10	   ? 1
-									: port < 100   ? 2
-									: port < 1000  ? 3
-									: port < 10000 ? 4
-												   : 5);
-
-	size_t index_start_len = index_start_chunk_len + 32 + 4;
-	size_t index_end_len = index_end_chunk_len + 32 + 4;
+	size_t index_end_len = resource_index_end_html_len - 6
+						   + autoindex->conn->extra->host_len
+						   + (port < 10		 ? 1
+							  : port < 100	 ? 2
+							  : port < 1000	 ? 3
+							  : port < 10000 ? 4
+											 : 5);
 
 	struct fh_link *end_link;
 	struct fh_link *start_link
@@ -180,59 +163,36 @@ fh_autoindex_handle_chunked (struct fh_autoindex *autoindex)
 	end_link->buf->attrs.mem.data = (uint8_t *) (end_link->buf + 1);
 	end_link->buf->type = FH_BUF_DATA;
 	end_link->next = NULL;
-	end_link->is_eos = false;
-
-	end_chunk_link.buf->attrs.mem.data = (uint8_t *) "0\r\n\r\n";
-	end_chunk_link.buf->attrs.mem.cap = end_chunk_link.buf->attrs.mem.len = 5;
-
-	int rc1, rc2;
+	end_link->is_eos = true;
+	end_link->is_start = false;
 
-	if ((rc1 = snprintf ((char *) start_link->buf->attrs.mem.data, 34,
-						 "%zx\r\n", index_start_chunk_len))
-		< 0)
-	{
-		response->status = FH_STATUS_INTERNAL_SERVER_ERROR;
-		return true;
-	}
+	int rc;
 
-	if ((rc2 = snprintf ((char *) start_link->buf->attrs.mem.data + rc1,
-						 index_start_len + 1 - rc1, resource_index_start_html,
-						 (int) request->uri_len, request->uri,
-						 (int) request->uri_len, request->uri,
-						 (int) request->uri_len, request->uri))
+	if ((rc = snprintf ((char *) start_link->buf->attrs.mem.data,
+						index_start_len + 1, resource_index_start_html,
+						(int) request->uri_len, request->uri,
+						(int) request->uri_len, request->uri,
+						(int) request->uri_len, request->uri))
 		< 0)
 	{
 		response->status = FH_STATUS_INTERNAL_SERVER_ERROR;
 		return true;
 	}
 
-	start_link->buf->attrs.mem.data[rc1 + rc2] = '\r';
-	start_link->buf->attrs.mem.data[rc1 + rc2 + 1] = '\n';
 	start_link->buf->attrs.mem.cap = start_link->buf->attrs.mem.len
-		= (size_t) (rc1 + rc2 + 2);
+		= (size_t) rc;
 
-	if ((rc1 = snprintf ((char *) end_link->buf->attrs.mem.data, 34, "%zx\r\n",
-						 index_end_chunk_len))
-		< 0)
-	{
-		response->status = FH_STATUS_INTERNAL_SERVER_ERROR;
-		return true;
-	}
-
-	if ((rc2 = snprintf ((char *) end_link->buf->attrs.mem.data + rc1,
-						 index_end_len + 1 - rc1, resource_index_end_html,
-						 (int) autoindex->conn->extra->host_len,
-						 autoindex->conn->extra->host, port))
+	if ((rc = snprintf ((char *) end_link->buf->attrs.mem.data,
+						index_end_len + 1, resource_index_end_html,
+						(int) autoindex->conn->extra->host_len,
+						autoindex->conn->extra->host, port))
 		< 0)
 	{
 		response->status = FH_STATUS_INTERNAL_SERVER_ERROR;
 		return true;
 	}
 
-	end_link->buf->attrs.mem.data[rc1 + rc2] = '\r';
-	end_link->buf->attrs.mem.data[rc1 + rc2 + 1] = '\n';
-	end_link->buf->attrs.mem.cap = end_link->buf->attrs.mem.len
-		= (size_t) (rc1 + rc2 + 2);
+	end_link->buf->attrs.mem.cap = end_link->buf->attrs.mem.len = (size_t) rc;
 
 	struct dirent64 **namelist;
 	int namelist_count = 0;
@@ -278,7 +238,7 @@ fh_autoindex_handle_chunked (struct fh_autoindex *autoindex)
 			}
 
 			static const char data[]
-				= "7d\r\n<tr>"
+				= "<tr>"
 				  "<td>"
 				  "<img src=\"/icons/folder.png\" alt=\"[DIR]\" />"
 				  "</td>"
@@ -287,7 +247,7 @@ fh_autoindex_handle_chunked (struct fh_autoindex *autoindex)
 				  "</td>"
 				  "<td>-</td>"
 				  "<td>-</td>"
-				  "</tr>\r\n";
+				  "</tr>";
 
 			link->buf = (struct fh_buf *) (link + 1);
 			link->buf->type = FH_BUF_DATA;
@@ -308,7 +268,7 @@ fh_autoindex_handle_chunked (struct fh_autoindex *autoindex)
 			else if (rc == FILEINFO_NEXT)
 				goto ret_clean;
 
-			const char format[] = "%zx\r\n<tr>"
+			const char format[] = "<tr>"
 								  "<td>"
 								  "<img src=\"/icons/%s.png\" alt=\"[%s]\" />"
 								  "</td>"
@@ -317,14 +277,12 @@ fh_autoindex_handle_chunked (struct fh_autoindex *autoindex)
 								  "</td>"
 								  "<td>%s</td>"
 								  "<td>%s</td>"
-								  "</tr>\r\n";
+								  "</tr>";
 
-			const size_t format_len = sizeof (format) - 1;
-			size_t chunk_len
-				= format_len - 19 - 4 + (2 * name_len)
+			const size_t len
+				= sizeof (format) - 1 - 16 + (2 * name_len)
 				  + (is_dir ? 6 + 3 + 2 + 1 : (4 + 4 + afo.size_buf_len))
 				  + afo.time_len;
-			size_t len = chunk_len + 32 + 4;
 
 			link = fh_pool_alloc (pool, sizeof (*link) + sizeof (*link->buf)
 											+ len + 1);
@@ -341,7 +299,7 @@ fh_autoindex_handle_chunked (struct fh_autoindex *autoindex)
 			link->is_eos = false;
 
 			if ((rc = snprintf ((char *) link->buf->attrs.mem.data, len + 1,
-								format, chunk_len, is_dir ? "folder" : "file",
+								format, is_dir ? "folder" : "file",
 								is_dir ? "DIR" : "FILE", entry->d_name,
 								is_dir ? "/" : "", entry->d_name,
 								is_dir ? "/" : "", is_dir ? "-" : afo.size_buf,
@@ -376,9 +334,6 @@ fh_autoindex_handle_chunked (struct fh_autoindex *autoindex)
 	tail->next = end_link;
 	tail = end_link;
 
-	tail->next = &end_chunk_link;
-	tail = &end_chunk_link;
-
 	response->encoding = FH_ENCODING_CHUNKED;
 	response->body_start = start_link;
 	response->status = FH_STATUS_OK;
@@ -616,6 +571,9 @@ fh_autoindex_handle_plain (struct fh_autoindex *autoindex)
 bool
 fh_autoindex_handle (struct fh_autoindex *autoindex)
 {
+	autoindex->response->content_type = "text/html; charset=UTF-8";
+	autoindex->response->content_type_len = 24;
+
 	switch (autoindex->request->protocol)
 	{
 		case FH_PROTOCOL_HTTP_1_0:
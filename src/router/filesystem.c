@@ -32,10 +32,13 @@
 #define FH_LOG_MODULE_NAME "router/fs"
 
 #include "core/conn.h"
+#include "core/server.h"
 #include "core/stream.h"
 #include "filesystem.h"
+#include "http/compress.h"
 #include "http/http1_request.h"
 #include "http/http1_response.h"
+#include "http/mime.h"
 #include "modules/mod_autoindex.h"
 #include "router.h"
 #include "utils/utils.h"
@@ -68,13 +71,29 @@ fh_router_handle_static_file (struct fh_router *router, struct fh_conn *conn,
 							  const char *filename, size_t filename_len,
 							  const struct stat64 *st)
 {
-	(void) router;
 	(void) request;
 	(void) conn;
 	(void) filename_len;
 
 	response->content_length = st->st_size;
 	response->status = FH_STATUS_OK;
+	response->content_type
+		= fh_mime_type_from_filename (filename, &response->content_type_len);
+
+	if (!fh_response_get_headers (response)
+		|| !fh_header_add (response->pool, response->headers, "Accept-Ranges",
+						   13, "bytes", 5))
+	{
+		response->status = FH_STATUS_INTERNAL_SERVER_ERROR;
+		return true;
+	}
+
+	if (fh_compress_cache_file (router->server->config->compression, response,
+								filename, st))
+	{
+		response->use_default_error_response = false;
+		return true;
+	}
 
 	if (request->method == FH_METHOD_HEAD)
 	{
@@ -0,0 +1,1772 @@
+/*
+ * This file is part of OSN freehttpd.
+ * 
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FH_LOG_MODULE_NAME "router/proxy"
+
+#include "compat.h"
+#include "core/cache.h"
+#include "core/conn.h"
+#include "core/server.h"
+#include "core/stream.h"
+#include "core/upstream.h"
+#include "http/fastcgi.h"
+#include "http/http1_upstream.h"
+#include "log/log.h"
+#include "proxy.h"
+#include "router.h"
+
+/* Buffer that a body is copied through when it cannot be spliced */
+#define FH_PROXY_BUF_SIZE (64 * 1024)
+#define FH_PROXY_LINE_MAX HTTP1_HEADER_VALUE_MAX_LEN
+#define FH_PROXY_IOV_MAX 64
+/* The only request on a FastCGI connection at a time */
+#define FH_PROXY_FCGI_REQUEST_ID 1
+/* Parameters other than HTTP_ ones that a request may carry */
+#define FH_PROXY_FCGI_PARAMS 20
+
+enum fh_proxy_state
+{
+	FH_PROXY_STATE_SEND,
+	FH_PROXY_STATE_HEAD,
+	FH_PROXY_STATE_BODY,
+	FH_PROXY_STATE_DONE,
+	FH_PROXY_STATE_ERROR,
+	/* For another request to fetch the response into the cache */
+	FH_PROXY_STATE_WAIT
+};
+
+enum fh_proxy_body
+{
+	FH_PROXY_BODY_LENGTH,
+	FH_PROXY_BODY_CHUNKED,
+	FH_PROXY_BODY_EOF,
+	/* FastCGI: until the FCGI_END_REQUEST record */
+	FH_PROXY_BODY_RECORDS
+};
+
+enum fh_proxy_chunk_state
+{
+	FH_PROXY_CHUNK_SIZE,
+	FH_PROXY_CHUNK_DATA,
+	FH_PROXY_CHUNK_CRLF,
+	FH_PROXY_CHUNK_TRAILER
+};
+
+struct fh_proxy_session
+{
+	struct fh_router *router;
+	struct fh_conn *conn;
+	const struct fh_request *request;
+	struct fh_response *response;
+	const struct fh_config_proxy *config;
+	struct fh_upstreams *upstreams;
+	struct fh_upstream_group *group;
+	struct fh_upstream_peer *peer;
+	struct fh_upstream_conn *upstream;
+	/* What the `hash' policy keys on */
+	const char *key;
+	size_t key_len;
+	/* Servers that could not be reached */
+	size_t tries;
+	/* When the request was handed to the upstream server, in
+	   microseconds */
+	uint64_t started;
+
+	/* The request head followed by the body links */
+	struct iovec *iov;
+	size_t iov_count;
+	size_t total;
+	size_t sent;
+	/* First vector that is not sent in full, and how much of it is */
+	size_t iov_first;
+	size_t iov_first_off;
+
+	char *head_buf;
+	/* FastCGI: the response head as gathered from FCGI_STDOUT records */
+	size_t head_len;
+	/* FastCGI: records as received, which body links point into */
+	uint8_t *rec_buf;
+	size_t rec_len;
+	size_t rec_off;
+	struct fh_fcgi_reader fcgi;
+	/* FastCGI: body that came along with the response head */
+	struct fh_link *pending;
+
+	/* Only when the body is copied */
+	uint8_t *body_buf;
+	/* Only when the body is spliced: the last link handed out */
+	struct fh_link *pipe_link;
+	/* Left of the body, or of the current chunk */
+	uint64_t remaining;
+
+	/* NULL unless the response may come from the cache */
+	struct fh_cache_req *cache;
+	struct fh_cache_waiter waiter;
+	/* When to stop waiting and fetch the response anyway */
+	time_t wait_until;
+
+	uint8_t state : 4;
+	uint8_t body : 2;
+	uint8_t chunk_state : 2;
+	bool use_pipe : 1;
+	bool in_handler : 1;
+	bool waiting : 1;
+	bool keepalive : 1;
+	bool head_started : 1;
+	bool fastcgi : 1;
+	/* Whether the request counts towards the load of `peer' */
+	bool outstanding : 1;
+	/* Whether the outcome was recorded for the health of `peer' */
+	bool reported : 1;
+	/* Whether the response is being written to the cache */
+	bool storing : 1;
+};
+
+const struct fh_config_proxy *
+fh_proxy_match (const struct fh_config_host *config,
+				const struct fh_request *request)
+{
+	if (!config || !request->uri)
+		return NULL;
+
+	for (const struct fh_config_proxy *proxy = config->proxies; proxy;
+		 proxy = proxy->next)
+	{
+		if (request->uri_len >= proxy->path_len
+			&& !memcmp (request->uri, proxy->path, proxy->path_len))
+			return proxy;
+	}
+
+	return NULL;
+}
+
+#define fh_proxy_header_is(h, str)                                             \
+	((h)->name_len == sizeof (str) - 1                                         \
+	 && !strncasecmp ((h)->name, (str), sizeof (str) - 1))
+
+/* Headers that only concern a single connection, and those that are
+   generated for the other side anyway */
+static bool
+fh_proxy_is_hop_header (const struct fh_header *h)
+{
+	return fh_proxy_header_is (h, "Connection")
+		   || fh_proxy_header_is (h, "Keep-Alive")
+		   || fh_proxy_header_is (h, "Proxy-Connection")
+		   || fh_proxy_header_is (h, "TE") || fh_proxy_header_is (h, "Trailer")
+		   || fh_proxy_header_is (h, "Transfer-Encoding")
+		   || fh_proxy_header_is (h, "Upgrade")
+		   || fh_proxy_header_is (h, "Content-Length");
+}
+
+/* Whether a comma-separated header value lists `token' */
+static bool
+fh_proxy_has_token (const char *value, size_t len, const char *token)
+{
+	const size_t token_len = strlen (token);
+	const char *end = value + len;
+
+	while (value < end)
+	{
+		while (value < end && (*value == ' ' || *value == '\t' || *value == ','))
+			value++;
+
+		const char *start = value;
+
+		while (value < end && *value != ',')
+			value++;
+
+		const char *stop = value;
+
+		while (stop > start && (stop[-1] == ' ' || stop[-1] == '\t'))
+			stop--;
+
+		if ((size_t) (stop - start) == token_len
+			&& !strncasecmp (start, token, token_len))
+			return true;
+	}
+
+	return false;
+}
+
+static inline char *
+fh_proxy_append (char *p, const char *str, size_t len)
+{
+	memcpy (p, str, len);
+	return p + len;
+}
+
+/* The body has been read in full by the time the request is handled, so
+   it goes out with the head from the buffers it was read into.  Its size
+   is bounded by the `max_request_body_size' security setting.  */
+static bool
+fh_proxy_build_request (struct fh_proxy_session *session)
+{
+	const struct fh_request *request = session->request;
+	pool_t *pool = session->response->pool;
+	const char *method = fh_method_to_string (request->method);
+	const size_t method_len = strlen (method);
+	const struct fh_header *forwarded_for
+		= fh_header_get (&request->headers, "X-Forwarded-For", 15);
+	const bool has_host = fh_header_get (&request->headers, "Host", 4);
+	char client_ip[INET_ADDRSTRLEN] = "";
+	uint64_t body_len = 0;
+	size_t body_links = 0;
+
+	inet_ntop (AF_INET, &session->conn->client_addr->sin_addr, client_ip,
+			   sizeof client_ip);
+
+	for (struct fh_link *link = request->body_start; link; link = link->next)
+	{
+		body_len += fh_link_size (link);
+		body_links++;
+
+		if (link->is_eos)
+			break;
+	}
+
+	const bool send_length = body_len || request->method == FH_METHOD_POST
+							 || request->method == FH_METHOD_PUT
+							 || request->method == FH_METHOD_PATCH;
+	size_t size = method_len + 1 + request->uri_len + 11
+				  + (has_host ? 0 : 8 + request->full_host_len) + 17
+				  + (forwarded_for ? forwarded_for->value_len + 2 : 0)
+				  + strlen (client_ip) + 2 + 26 + 40 + 2;
+
+	for (const struct fh_header *h = request->headers.head; h; h = h->next)
+		size += h->name_len + h->value_len + 4;
+
+	char *head = fh_pool_alloc (pool, size);
+	session->iov = fh_pool_alloc (pool, sizeof (struct iovec) * (1 + body_links));
+
+	if (!head || !session->iov)
+		return false;
+
+	char *p = head;
+
+	p = fh_proxy_append (p, method, method_len);
+	p = fh_proxy_append (p, " ", 1);
+	p = fh_proxy_append (p, request->uri, request->uri_len);
+	p = fh_proxy_append (p, " HTTP/1.1\r\n", 11);
+
+	if (!has_host)
+	{
+		p = fh_proxy_append (p, "Host: ", 6);
+		p = fh_proxy_append (p, request->host, request->full_host_len);
+		p = fh_proxy_append (p, "\r\n", 2);
+	}
+
+	for (const struct fh_header *h = request->headers.head; h; h = h->next)
+	{
+		if (fh_proxy_is_hop_header (h) || fh_proxy_header_is (h, "Expect")
+			|| fh_proxy_header_is (h, "X-Forwarded-For")
+			|| fh_proxy_header_is (h, "X-Forwarded-Proto"))
+			continue;
+
+		p = fh_proxy_append (p, h->name, h->name_len);
+		p = fh_proxy_append (p, ": ", 2);
+		p = fh_proxy_append (p, h->value, h->value_len);
+		p = fh_proxy_append (p, "\r\n", 2);
+	}
+
+	p = fh_proxy_append (p, "X-Forwarded-For: ", 17);
+
+	if (forwarded_for)
+	{
+		p = fh_proxy_append (p, forwarded_for->value, forwarded_for->value_len);
+		p = fh_proxy_append (p, ", ", 2);
+	}
+
+	p = fh_proxy_append (p, client_ip, strlen (client_ip));
+	p = fh_proxy_append (p, "\r\n", 2);
+	p = session->conn->ssl
+			? fh_proxy_append (p, "X-Forwarded-Proto: https\r\n", 26)
+			: fh_proxy_append (p, "X-Forwarded-Proto: http\r\n", 25);
+
+	if (send_length)
+		p += snprintf (p, 40, "Content-Length: %lu\r\n", body_len);
+
+	p = fh_proxy_append (p, "\r\n", 2);
+
+	session->iov[0].iov_base = head;
+	session->iov[0].iov_len = (size_t) (p - head);
+	session->iov_count = 1;
+	session->total = session->iov[0].iov_len;
+
+	for (struct fh_link *link = request->body_start;
+		 session->iov_count <= body_links; link = link->next)
+	{
+		session->iov[session->iov_count].iov_base = link->buf->attrs.mem.data;
+		session->iov[session->iov_count].iov_len = link->buf->attrs.mem.len;
+		session->total += link->buf->attrs.mem.len;
+		session->iov_count++;
+	}
+
+	return true;
+}
+
+/* Name-value pairs for FCGI_PARAMS, as pieces that point into the
+   request wherever possible */
+struct fh_proxy_fcgi_params
+{
+	struct iovec *pieces;
+	size_t count;
+	size_t len;
+	/* Room for the lengths of the pairs and the HTTP_ names */
+	uint8_t *scratch;
+};
+
+static void
+fh_proxy_fcgi_param_v (struct fh_proxy_fcgi_params *params, const char *name,
+					   size_t name_len, const struct iovec *value,
+					   size_t value_count)
+{
+	size_t value_len = 0;
+
+	for (size_t i = 0; i < value_count; i++)
+		value_len += value[i].iov_len;
+
+	const size_t header_len
+		= fh_fcgi_encode_pair_header (params->scratch, name_len, value_len);
+
+	params->pieces[params->count++] = (struct iovec) {
+		.iov_base = params->scratch,
+		.iov_len = header_len,
+	};
+	params->pieces[params->count++] = (struct iovec) {
+		.iov_base = (char *) name,
+		.iov_len = name_len,
+	};
+
+	for (size_t i = 0; i < value_count; i++)
+		params->pieces[params->count++] = value[i];
+
+	params->scratch += header_len;
+	params->len += header_len + name_len + value_len;
+}
+
+static void
+fh_proxy_fcgi_param (struct fh_proxy_fcgi_params *params, const char *name,
+					 const char *value, size_t value_len)
+{
+	const struct iovec iov = {
+		.iov_base = (char *) value,
+		.iov_len = value_len,
+	};
+
+	fh_proxy_fcgi_param_v (params, name, strlen (name), &iov, 1);
+}
+
+/* Turns a request header into an HTTP_ parameter */
+static void
+fh_proxy_fcgi_param_header (struct fh_proxy_fcgi_params *params,
+							const struct fh_header *h)
+{
+	char *name = (char *) params->scratch;
+	const struct iovec iov = {
+		.iov_base = (char *) h->value,
+		.iov_len = h->value_len,
+	};
+
+	memcpy (name, "HTTP_", 5);
+
+	for (size_t i = 0; i < h->name_len; i++)
+	{
+		const char c = h->name[i];
+		name[5 + i] = c == '-' ? '_' : (c >= 'a' && c <= 'z') ? c - 32 : c;
+	}
+
+	params->scratch += 5 + h->name_len;
+	fh_proxy_fcgi_param_v (params, name, 5 + h->name_len, &iov, 1);
+}
+
+/* Appends `len' bytes worth of `pieces' to the request as records of
+   `type', followed by the empty record that ends the stream.  */
+static bool
+fh_proxy_fcgi_frame (struct fh_proxy_session *session, uint8_t type,
+					 const struct iovec *pieces, size_t len)
+{
+	pool_t *pool = session->response->pool;
+	size_t piece = 0, off = 0;
+	bool last;
+
+	do
+	{
+		last = !len;
+
+		const size_t record_len
+			= len < FH_FCGI_MAX_CONTENT_LEN ? len : FH_FCGI_MAX_CONTENT_LEN;
+		uint8_t *header = fh_pool_alloc (pool, FH_FCGI_HEADER_LEN);
+
+		if (!header)
+			return false;
+
+		fh_fcgi_encode_header (header, type, FH_PROXY_FCGI_REQUEST_ID,
+							   (uint16_t) record_len, 0);
+		session->iov[session->iov_count++] = (struct iovec) {
+			.iov_base = header,
+			.iov_len = FH_FCGI_HEADER_LEN,
+		};
+
+		for (size_t left = record_len; left;)
+		{
+			size_t take = pieces[piece].iov_len - off;
+
+			if (take > left)
+				take = left;
+
+			if (take)
+				session->iov[session->iov_count++] = (struct iovec) {
+					.iov_base = (char *) pieces[piece].iov_base + off,
+					.iov_len = take,
+				};
+
+			left -= take;
+			off += take;
+
+			if (off == pieces[piece].iov_len)
+			{
+				piece++;
+				off = 0;
+			}
+		}
+
+		len -= record_len;
+		session->total += FH_FCGI_HEADER_LEN + record_len;
+	}
+	while (!last);
+
+	return true;
+}
+
+/* Whether the path of a URI steps out of the directory it starts in */
+static bool
+fh_proxy_fcgi_path_escapes (const char *path, size_t len)
+{
+	const char *query = memchr (path, '?', len);
+
+	if (query)
+		len = (size_t) (query - path);
+
+	for (size_t i = 0; i + 1 < len; i++)
+	{
+		if (path[i] == '.' && path[i + 1] == '.' && (!i || path[i - 1] == '/')
+			&& (i + 2 == len || path[i + 2] == '/'))
+			return true;
+	}
+
+	return false;
+}
+
+static size_t
+fh_proxy_fcgi_iov_count (size_t pieces, size_t len)
+{
+	const size_t records
+		= (len + FH_FCGI_MAX_CONTENT_LEN - 1) / FH_FCGI_MAX_CONTENT_LEN;
+
+	/* A record header each, the pieces that records split in two, and the
+	   empty record at the end */
+	return pieces + 2 * records + 1;
+}
+
+static bool
+fh_proxy_fcgi_build_request (struct fh_proxy_session *session)
+{
+	const struct fh_request *request = session->request;
+	const struct fh_config_proxy *config = session->group->config;
+	const struct fh_conn *conn = session->conn;
+	pool_t *pool = session->response->pool;
+	const char *docroot = conn->config->docroot ? conn->config->docroot : "";
+	const char *query = memchr (request->uri, '?', request->uri_len);
+	const size_t path_len
+		= query ? (size_t) (query - request->uri) : request->uri_len;
+	const char *index = config->index ? config->index : "index.php";
+	const bool add_index = !config->script && path_len
+						   && request->uri[path_len - 1] == '/';
+	const char *method = fh_method_to_string (request->method);
+	size_t scratch_len = FH_FCGI_MAX_PAIR_HEADER_LEN * FH_PROXY_FCGI_PARAMS;
+	size_t header_count = 0;
+	uint64_t body_len = 0;
+	size_t body_links = 0;
+
+	for (const struct fh_header *h = request->headers.head; h; h = h->next)
+	{
+		scratch_len += FH_FCGI_MAX_PAIR_HEADER_LEN + 5 + h->name_len;
+		header_count++;
+	}
+
+	for (struct fh_link *link = request->body_start; link; link = link->next)
+	{
+		body_len += fh_link_size (link);
+		body_links++;
+
+		if (link->is_eos)
+			break;
+	}
+
+	/* Up to three pieces for each value, and one for each name and for
+	   the lengths before it */
+	struct fh_proxy_fcgi_params params = {
+		.pieces = fh_pool_alloc (pool,
+								 sizeof (struct iovec)
+									 * (5 * FH_PROXY_FCGI_PARAMS
+										+ 3 * header_count)),
+		.scratch = fh_pool_alloc (pool, scratch_len),
+	};
+	struct iovec *body = fh_pool_alloc (pool, sizeof (struct iovec)
+												  * (body_links + 1));
+	char *numbers = fh_pool_alloc (pool, INET_ADDRSTRLEN + 3 * 24);
+
+	if (!params.pieces || !params.scratch || !body || !numbers)
+		return false;
+
+	const struct iovec filename[] = {
+		{ .iov_base = (char *) docroot, .iov_len = strlen (docroot) },
+		{ .iov_base = (char *) request->uri, .iov_len = path_len },
+		{ .iov_base = (char *) index,
+		  .iov_len = add_index ? strlen (index) : 0 },
+	};
+	const struct iovec script_name[] = {
+		{ .iov_base = (char *) request->uri, .iov_len = path_len },
+		{ .iov_base = (char *) index,
+		  .iov_len = add_index ? strlen (index) : 0 },
+	};
+	char *remote_addr = numbers;
+	char *remote_port = remote_addr + INET_ADDRSTRLEN;
+	char *server_port = remote_port + 24;
+	char *content_length = server_port + 24;
+
+	inet_ntop (AF_INET, &conn->client_addr->sin_addr, remote_addr,
+			   INET_ADDRSTRLEN);
+	snprintf (remote_port, 24, "%u", ntohs (conn->client_addr->sin_port));
+	snprintf (server_port, 24, "%u", ntohs (conn->server_addr->sin_port));
+	snprintf (content_length, 24, "%lu", body_len);
+
+	if (config->script)
+		fh_proxy_fcgi_param (&params, "SCRIPT_FILENAME", config->script,
+							 strlen (config->script));
+	else
+		fh_proxy_fcgi_param_v (&params, "SCRIPT_FILENAME", 15, filename, 3);
+
+	fh_proxy_fcgi_param_v (&params, "SCRIPT_NAME", 11, script_name, 2);
+	fh_proxy_fcgi_param (&params, "DOCUMENT_URI", request->uri, path_len);
+	fh_proxy_fcgi_param (&params, "REQUEST_URI", request->uri,
+						 request->uri_len);
+	fh_proxy_fcgi_param (&params, "QUERY_STRING", query ? query + 1 : "",
+						 query ? request->uri_len - path_len - 1 : 0);
+	fh_proxy_fcgi_param (&params, "DOCUMENT_ROOT", docroot, strlen (docroot));
+	fh_proxy_fcgi_param (&params, "REQUEST_METHOD", method, strlen (method));
+	fh_proxy_fcgi_param (&params, "SERVER_PROTOCOL",
+						 fh_protocol_to_string (request->protocol),
+						 strlen (fh_protocol_to_string (request->protocol)));
+	fh_proxy_fcgi_param (&params, "GATEWAY_INTERFACE", "CGI/1.1", 7);
+	fh_proxy_fcgi_param (&params, "SERVER_SOFTWARE", "freehttpd", 9);
+	fh_proxy_fcgi_param (&params, "REMOTE_ADDR", remote_addr,
+						 strlen (remote_addr));
+	fh_proxy_fcgi_param (&params, "REMOTE_PORT", remote_port,
+						 strlen (remote_port));
+	fh_proxy_fcgi_param (&params, "SERVER_NAME", request->host,
+						 request->host ? request->host_len : 0);
+	fh_proxy_fcgi_param (&params, "SERVER_PORT", server_port,
+						 strlen (server_port));
+	/* Needed by PHP built with --enable-force-cgi-redirect */
+	fh_proxy_fcgi_param (&params, "REDIRECT_STATUS", "200", 3);
+
+	if (conn->ssl)
+		fh_proxy_fcgi_param (&params, "HTTPS", "on", 2);
+
+	if (body_len || request->method == FH_METHOD_POST
+		|| request->method == FH_METHOD_PUT
+		|| request->method == FH_METHOD_PATCH)
+		fh_proxy_fcgi_param (&params, "CONTENT_LENGTH", content_length,
+							 strlen (content_length));
+
+	for (const struct fh_header *h = request->headers.head; h; h = h->next)
+	{
+		if (fh_proxy_header_is (h, "Content-Type"))
+			fh_proxy_fcgi_param (&params, "CONTENT_TYPE", h->value,
+								 h->value_len);
+		/* HTTP_PROXY would let clients set the proxy of the application
+		   (httpoxy), and names with underscores would pass for others */
+		else if (!fh_proxy_header_is (h, "Content-Length")
+				 && !fh_proxy_header_is (h, "Proxy")
+				 && !memchr (h->name, '_', h->name_len))
+			fh_proxy_fcgi_param_header (&params, h);
+	}
+
+	size_t count = 0;
+
+	for (struct fh_link *link = request->body_start; count < body_links;
+		 link = link->next)
+	{
+		body[count].iov_base = link->buf->attrs.mem.data;
+		body[count].iov_len = link->buf->attrs.mem.len;
+		count++;
+	}
+
+	uint8_t *begin = fh_pool_alloc (pool, FH_FCGI_HEADER_LEN + 8);
+	session->iov = fh_pool_alloc (
+		pool, sizeof (struct iovec)
+				  * (1 + fh_proxy_fcgi_iov_count (params.count, params.len)
+					 + fh_proxy_fcgi_iov_count (body_links, body_len)));
+
+	if (!begin || !session->iov)
+		return false;
+
+	fh_fcgi_encode_begin_request (begin, FH_PROXY_FCGI_REQUEST_ID,
+								  FH_FCGI_RESPONDER, FH_FCGI_KEEP_CONN);
+	fh_fcgi_reader_init (&session->fcgi, FH_PROXY_FCGI_REQUEST_ID);
+	session->iov[0].iov_base = begin;
+	session->iov[0].iov_len = FH_FCGI_HEADER_LEN + 8;
+	session->iov_count = 1;
+	session->total = FH_FCGI_HEADER_LEN + 8;
+
+	return fh_proxy_fcgi_frame (session, FH_FCGI_PARAMS, params.pieces,
+								params.len)
+		   && fh_proxy_fcgi_frame (session, FH_FCGI_STDIN, body, body_len);
+}
+
+/* Returns 1 once the whole request is sent, 0 if the socket is full and
+   -1 on errors.  */
+static int
+fh_proxy_send_request (struct fh_proxy_session *session)
+{
+	while (session->sent < session->total)
+	{
+		struct iovec iov[FH_PROXY_IOV_MAX];
+		size_t count = 0, skip = session->iov_first_off;
+
+		for (size_t i = session->iov_first;
+			 i < session->iov_count && count < FH_PROXY_IOV_MAX; i++)
+		{
+			iov[count].iov_base = (char *) session->iov[i].iov_base + skip;
+			iov[count].iov_len = session->iov[i].iov_len - skip;
+			skip = 0;
+			count++;
+		}
+
+		struct msghdr msg = {
+			.msg_iov = iov,
+			.msg_iovlen = count,
+		};
+		ssize_t wrote
+			= sendmsg (session->upstream->sockfd, &msg, MSG_NOSIGNAL);
+
+		if (wrote < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			return would_block () ? 0 : -1;
+		}
+
+		session->sent += (size_t) wrote;
+
+		for (size_t left = (size_t) wrote; left;)
+		{
+			const size_t rest = session->iov[session->iov_first].iov_len
+								- session->iov_first_off;
+
+			if (left < rest)
+			{
+				session->iov_first_off += left;
+				break;
+			}
+
+			left -= rest;
+			session->iov_first++;
+			session->iov_first_off = 0;
+		}
+	}
+
+	return 1;
+}
+
+static bool
+fh_proxy_apply_head (struct fh_proxy_session *session,
+					 const struct fh_http1_response_head *head)
+{
+	struct fh_response *response = session->response;
+	struct fh_headers *headers = fh_response_get_headers (response);
+	bool chunked = false, has_length = false, has_coding = false;
+	uint64_t length = 0;
+
+	if (!headers)
+		return false;
+
+	/* FastCGI connections are kept unless the upstream server ends the
+	   request badly.  */
+	session->keepalive = session->fastcgi || head->minor_version == 1;
+
+	for (const struct fh_header *h = head->headers.head; h; h = h->next)
+	{
+		if (fh_proxy_header_is (h, "Content-Length"))
+		{
+			uint64_t value = 0;
+
+			if (!h->value_len || h->value_len > 19)
+				return false;
+
+			for (size_t i = 0; i < h->value_len; i++)
+			{
+				if (h->value[i] < '0' || h->value[i] > '9')
+					return false;
+
+				value = value * 10 + (uint64_t) (h->value[i] - '0');
+			}
+
+			if (has_length && value != length)
+				return false;
+
+			has_length = true;
+			length = value;
+		}
+		else if (session->fastcgi && fh_proxy_header_is (h, "Status"))
+		{
+			/* Already taken as the status */
+		}
+		else if (!session->fastcgi
+				 && fh_proxy_header_is (h, "Transfer-Encoding"))
+		{
+			/* Any other coding can only be delimited by closing */
+			chunked = fh_proxy_has_token (h->value, h->value_len, "chunked");
+			has_coding = true;
+		}
+		else if (!session->fastcgi && fh_proxy_header_is (h, "Connection"))
+		{
+			if (fh_proxy_has_token (h->value, h->value_len, "close"))
+				session->keepalive = false;
+			else if (fh_proxy_has_token (h->value, h->value_len, "keep-alive"))
+				session->keepalive = true;
+		}
+		else if (fh_proxy_header_is (h, "Content-Type"))
+		{
+			response->content_type = h->value;
+			response->content_type_len = h->value_len;
+		}
+		else if (!fh_proxy_is_hop_header (h) && !fh_proxy_header_is (h, "Server")
+				 && !fh_proxy_header_is (h, "Date")
+				 && !fh_header_add (response->pool, headers, h->name,
+									h->name_len, h->value, h->value_len))
+		{
+			return false;
+		}
+	}
+
+	/* A length is meaningless next to a transfer coding */
+	if (has_coding)
+		has_length = false;
+
+	response->status = head->status;
+	/* The standard phrase stands in for a missing one.  */
+	response->reason = head->reason_len ? head->reason : NULL;
+	response->reason_len = head->reason_len;
+	response->content_encoding = FH_CONTENT_ENCODING_IDENTITY;
+	response->encoding = chunked ? FH_ENCODING_CHUNKED : FH_ENCODING_PLAIN;
+	response->content_length = has_length ? length : 0;
+	response->headers_pending = false;
+
+	if (session->cache)
+	{
+		if (session->cache->locked)
+			session->storing = fh_cache_store_begin (
+				session->cache, session->config, response, time (NULL));
+
+		if (!fh_header_add (response->pool, headers, "X-Cache", 7, "MISS", 4))
+			return false;
+	}
+
+	if (session->request->method == FH_METHOD_HEAD
+		|| head->status == FH_STATUS_NO_CONTENT || head->status == 304)
+	{
+		/* The records of a FastCGI response would still be on their
+		   way.  */
+		session->keepalive &= !session->fastcgi;
+		response->no_send_body = true;
+		response->pull = NULL;
+		session->state = FH_PROXY_STATE_DONE;
+		return true;
+	}
+
+	if (session->fastcgi)
+	{
+		session->body = FH_PROXY_BODY_RECORDS;
+		session->state = FH_PROXY_STATE_BODY;
+
+		if (!has_length)
+			response->encoding = FH_ENCODING_CHUNKED;
+
+		return true;
+	}
+
+	if (has_length)
+	{
+		session->body = FH_PROXY_BODY_LENGTH;
+		session->remaining = length;
+
+		if (!length)
+		{
+			response->pull = NULL;
+			session->state = FH_PROXY_STATE_DONE;
+			return true;
+		}
+	}
+	else
+	{
+		session->body = chunked ? FH_PROXY_BODY_CHUNKED : FH_PROXY_BODY_EOF;
+		session->chunk_state = FH_PROXY_CHUNK_SIZE;
+		session->keepalive &= chunked;
+		response->encoding = FH_ENCODING_CHUNKED;
+	}
+
+	/* Userspace TLS and HTTP/2 framing need the body in memory.  */
+	session->use_pipe = (response->protocol == FH_PROTOCOL_HTTP_1_0
+						 || response->protocol == FH_PROTOCOL_HTTP_1_1)
+						&& fh_conn_can_splice (session->conn)
+						&& fh_upstream_pipe (session->upstream)
+						&& !session->storing;
+
+	if (!session->use_pipe
+		&& !(session->body_buf = fh_pool_alloc (response->pool,
+												 FH_PROXY_BUF_SIZE)))
+		return false;
+
+	session->state = FH_PROXY_STATE_BODY;
+	return true;
+}
+
+/* Returns 1 once the response head is in, 0 if more is to come and -1 on
+   errors.  */
+static int
+fh_proxy_read_head (struct fh_proxy_session *session)
+{
+	const fd_t fd = session->upstream->sockfd;
+
+	for (;;)
+	{
+		ssize_t got
+			= recv (fd, session->head_buf, HTTP1_UPSTREAM_HEAD_MAX_LEN, MSG_PEEK);
+
+		if (got < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			return would_block () ? 0 : -1;
+		}
+
+		if (got == 0)
+			return -1;
+
+		session->head_started = true;
+
+		struct fh_http1_response_head head;
+		int rc = fh_http1_parse_response_head (session->response->pool,
+											   session->head_buf,
+											   (size_t) got, &head);
+
+		if (rc <= 0)
+		{
+			if (rc < 0)
+				fh_pr_err ("Malformed response head from upstream %s",
+						   session->peer->config->name);
+
+			return rc;
+		}
+
+		/* Only the head is taken off the socket; the body stays there.  */
+		if (recv (fd, session->head_buf, head.len, 0) != (ssize_t) head.len)
+			return -1;
+
+		/* Interim responses are not relayed.  */
+		if (head.status < 200)
+			continue;
+
+		fh_upstream_report (session->group, session->peer, true,
+							fh_upstream_clock () - session->started);
+		session->reported = true;
+
+		return fh_proxy_apply_head (session, &head) ? 1 : -1;
+	}
+}
+
+static struct fh_link *
+fh_proxy_pipe_link (pool_t *pool, fd_t pipe_fd, size_t len)
+{
+	struct fh_link *link
+		= fh_pool_alloc (pool, sizeof (*link) + sizeof (*link->buf));
+
+	if (!link)
+		return NULL;
+
+	link->buf = (struct fh_buf *) (link + 1);
+	link->buf->type = FH_BUF_PIPE;
+	link->buf->freeable = false;
+	link->buf->attrs.pipe.pipe_fd = pipe_fd;
+	link->buf->attrs.pipe.pipe_len = len;
+	link->next = NULL;
+	link->is_eos = false;
+	link->is_start = false;
+	return link;
+}
+
+/* Moves the next piece of the body off the socket.  Returns like
+   fh_proxy_read_head().  */
+static int
+fh_proxy_read_data (struct fh_proxy_session *session,
+					struct fh_link **link_ptr)
+{
+	struct fh_upstream_conn *upstream = session->upstream;
+	size_t want = session->use_pipe ? FH_UPSTREAM_PIPE_SIZE : FH_PROXY_BUF_SIZE;
+	ssize_t got;
+
+	if (session->body != FH_PROXY_BODY_EOF && session->remaining < want)
+		want = (size_t) session->remaining;
+
+	do
+		got = session->use_pipe
+				  ? splice (upstream->sockfd, NULL, upstream->pipe[1], NULL,
+							want, SPLICE_F_NONBLOCK | SPLICE_F_MOVE)
+				  : recv (upstream->sockfd, session->body_buf, want, 0);
+	while (got < 0 && errno == EINTR);
+
+	if (got < 0)
+		return would_block () ? 0 : -1;
+
+	if (got == 0)
+	{
+		if (session->body != FH_PROXY_BODY_EOF)
+		{
+			fh_pr_err ("Upstream %s closed the connection in the middle of "
+					   "a response",
+					   session->peer->config->name);
+			return -1;
+		}
+
+		session->state = FH_PROXY_STATE_DONE;
+		return 1;
+	}
+
+	struct fh_link *link
+		= session->use_pipe
+			  ? fh_proxy_pipe_link (session->response->pool, upstream->pipe[0],
+									(size_t) got)
+			  : fh_link_new_data (session->response->pool, session->body_buf,
+								  (size_t) got, false);
+
+	if (!link)
+		return -1;
+
+	if (session->use_pipe)
+		session->pipe_link = link;
+
+	if (session->body != FH_PROXY_BODY_EOF)
+	{
+		session->remaining -= (uint64_t) got;
+
+		if (!session->remaining)
+		{
+			if (session->body == FH_PROXY_BODY_LENGTH)
+				session->state = FH_PROXY_STATE_DONE;
+			else
+				session->chunk_state = FH_PROXY_CHUNK_CRLF;
+		}
+	}
+
+	*link_ptr = link;
+	return 1;
+}
+
+/* Consumes a chunk-size line, the CRLF after a chunk or a trailer line.
+   Returns like fh_proxy_read_head().  */
+static int
+fh_proxy_read_chunk_framing (struct fh_proxy_session *session)
+{
+	const fd_t fd = session->upstream->sockfd;
+	char line[FH_PROXY_LINE_MAX];
+	size_t consume = 0;
+	ssize_t got;
+
+	do
+		got = recv (fd, line, sizeof line, MSG_PEEK);
+	while (got < 0 && errno == EINTR);
+
+	if (got < 0)
+		return would_block () ? 0 : -1;
+
+	if (got == 0)
+		return -1;
+
+	switch (session->chunk_state)
+	{
+		case FH_PROXY_CHUNK_SIZE:
+		{
+			uint64_t size = 0;
+			int rc = fh_http1_parse_chunk_size (line, (size_t) got, &size,
+												&consume);
+
+			if (rc <= 0)
+				return rc;
+
+			session->remaining = size;
+			session->chunk_state
+				= size ? FH_PROXY_CHUNK_DATA : FH_PROXY_CHUNK_TRAILER;
+			break;
+		}
+
+		case FH_PROXY_CHUNK_CRLF:
+			if (line[0] == '\n')
+				consume = 1;
+			else if (line[0] != '\r')
+				return -1;
+			else if (got < 2)
+				return 0;
+			else if (line[1] == '\n')
+				consume = 2;
+			else
+				return -1;
+
+			session->chunk_state = FH_PROXY_CHUNK_SIZE;
+			break;
+
+		case FH_PROXY_CHUNK_TRAILER:
+		{
+			/* Trailer fields are dropped; the empty line ends the body.  */
+			const char *eol = memchr (line, '\n', (size_t) got);
+
+			if (!eol)
+				return got == (ssize_t) sizeof line ? -1 : 0;
+
+			consume = (size_t) (eol - line) + 1;
+
+			if (consume == 1 || (consume == 2 && line[0] == '\r'))
+				session->state = FH_PROXY_STATE_DONE;
+
+			break;
+		}
+
+		default:
+			return -1;
+	}
+
+	return recv (fd, line, consume, 0) == (ssize_t) consume ? 1 : -1;
+}
+
+static bool
+fh_proxy_pull (struct fh_response *response)
+{
+	struct fh_proxy_session *session = response->handler_data;
+	struct fh_link *link = NULL;
+
+	while (!link && session->state == FH_PROXY_STATE_BODY)
+	{
+		int rc = session->body == FH_PROXY_BODY_CHUNKED
+						 && session->chunk_state != FH_PROXY_CHUNK_DATA
+					 ? fh_proxy_read_chunk_framing (session)
+					 : fh_proxy_read_data (session, &link);
+
+		if (rc < 0)
+		{
+			session->state = FH_PROXY_STATE_ERROR;
+			return false;
+		}
+
+		/* The next event on the upstream connection resumes the
+		   response.  */
+		if (rc == 0)
+		{
+			session->waiting = true;
+			return true;
+		}
+	}
+
+	if (session->state == FH_PROXY_STATE_DONE)
+	{
+		if (!link && !(link = fh_link_new_data (response->pool, NULL, 0, true)))
+			return false;
+
+		link->is_eos = true;
+		response->pull = NULL;
+	}
+
+	if (session->storing)
+		session->storing = fh_cache_store_write (session->cache, link);
+
+	response->body_start = link;
+	return true;
+}
+
+/* Takes the records in `rec_buf' apart: FCGI_STDOUT data makes up the
+   response head and then the body links, which point into the buffer.
+   Returns 1 when the head is complete, the response is over or `*link_ptr'
+   is set, 0 once the buffer is used up and -1 on errors.  */
+static int
+fh_proxy_fcgi_parse (struct fh_proxy_session *session,
+					 struct fh_link **link_ptr)
+{
+	const char *name = session->peer->config->name;
+
+	for (;;)
+	{
+		const uint8_t *data = session->rec_buf + session->rec_off;
+		size_t len = session->rec_len - session->rec_off;
+		struct fh_fcgi_chunk chunk;
+		/* What does not fit next to the head is left for the body.  */
+		int rc = fh_fcgi_read (&session->fcgi, &data, &len,
+							   session->state == FH_PROXY_STATE_BODY
+								   ? SIZE_MAX
+								   : HTTP1_UPSTREAM_HEAD_MAX_LEN
+										 - session->head_len,
+							   &chunk);
+
+		session->rec_off = session->rec_len - len;
+
+		if (rc <= 0)
+		{
+			if (rc < 0)
+				fh_pr_err ("Malformed record from upstream %s", name);
+
+			return rc;
+		}
+
+		switch (chunk.type)
+		{
+			case FH_FCGI_END_REQUEST:
+				if (chunk.end.protocol_status != FH_FCGI_REQUEST_COMPLETE
+					|| session->state != FH_PROXY_STATE_BODY)
+				{
+					fh_pr_err ("Upstream %s ended a request without a "
+							   "response (status %u)",
+							   name, chunk.end.protocol_status);
+					return -1;
+				}
+
+				/* Anything after the end of the request is a protocol
+				   error.  */
+				session->keepalive = !len;
+				session->state = FH_PROXY_STATE_DONE;
+				return 1;
+
+			case FH_FCGI_STDOUT:
+			{
+				if (session->state == FH_PROXY_STATE_BODY)
+				{
+					*link_ptr = fh_link_new_data (session->response->pool,
+												  chunk.data, chunk.len,
+												  false);
+					return *link_ptr ? 1 : -1;
+				}
+
+				if (!chunk.len)
+				{
+					fh_pr_err ("Response head from upstream %s is too large",
+							   name);
+					return -1;
+				}
+
+				memcpy (session->head_buf + session->head_len, chunk.data,
+						chunk.len);
+				session->head_len += chunk.len;
+
+				struct fh_http1_response_head head;
+				int rc = fh_http1_parse_cgi_head (session->response->pool,
+												  session->head_buf,
+												  session->head_len, &head);
+
+				if (rc < 0)
+				{
+					fh_pr_err ("Malformed response head from upstream %s",
+							   name);
+					return -1;
+				}
+
+				if (rc == 0)
+					break;
+
+				fh_upstream_report (session->group, session->peer, true,
+									fh_upstream_clock () - session->started);
+				session->reported = true;
+
+				if (!fh_proxy_apply_head (session, &head))
+					return -1;
+
+				if (head.len < session->head_len
+					&& session->state == FH_PROXY_STATE_BODY
+					&& !(session->pending = fh_link_new_data (
+							 session->response->pool,
+							 (uint8_t *) session->head_buf + head.len,
+							 session->head_len - head.len, false)))
+					return -1;
+
+				return 1;
+			}
+
+			case FH_FCGI_STDERR:
+				fh_pr_warn ("Upstream %s: %.*s", name, (int) chunk.len,
+							chunk.data);
+				break;
+
+			default:
+				break;
+		}
+	}
+}
+
+/* Refills `rec_buf' once it is used up.  Returns like
+   fh_proxy_read_head().  */
+static int
+fh_proxy_fcgi_read (struct fh_proxy_session *session)
+{
+	ssize_t got;
+
+	do
+		got = recv (session->upstream->sockfd, session->rec_buf,
+					FH_PROXY_BUF_SIZE, 0);
+	while (got < 0 && errno == EINTR);
+
+	if (got < 0)
+		return would_block () ? 0 : -1;
+
+	if (got == 0)
+	{
+		if (session->head_started)
+			fh_pr_err ("Upstream %s closed the connection in the middle of "
+					   "a response",
+					   session->peer->config->name);
+
+		return -1;
+	}
+
+	session->head_started = true;
+	session->rec_off = 0;
+	session->rec_len = (size_t) got;
+	return 1;
+}
+
+static int
+fh_proxy_fcgi_read_head (struct fh_proxy_session *session)
+{
+	for (;;)
+	{
+		struct fh_link *link = NULL;
+		int rc = fh_proxy_fcgi_parse (session, &link);
+
+		if (rc != 0)
+			return rc;
+
+		if ((rc = fh_proxy_fcgi_read (session)) <= 0)
+			return rc;
+	}
+}
+
+static bool
+fh_proxy_fcgi_pull (struct fh_response *response)
+{
+	struct fh_proxy_session *session = response->handler_data;
+	struct fh_link *link = session->pending;
+
+	session->pending = NULL;
+
+	while (!link && session->state == FH_PROXY_STATE_BODY)
+	{
+		int rc = fh_proxy_fcgi_parse (session, &link);
+
+		if (rc == 0)
+			rc = fh_proxy_fcgi_read (session);
+
+		if (rc < 0)
+		{
+			session->state = FH_PROXY_STATE_ERROR;
+			return false;
+		}
+
+		if (rc == 0)
+		{
+			session->waiting = true;
+			return true;
+		}
+	}
+
+	if (session->state == FH_PROXY_STATE_DONE)
+	{
+		if (!link && !(link = fh_link_new_data (response->pool, NULL, 0, true)))
+			return false;
+
+		link->is_eos = true;
+		response->pull = NULL;
+	}
+
+	if (session->storing)
+		session->storing = fh_cache_store_write (session->cache, link);
+
+	response->body_start = link;
+	return true;
+}
+
+static void
+fh_proxy_cleanup (struct fh_response *response)
+{
+	struct fh_proxy_session *session = response->handler_data;
+
+	if (session->cache)
+	{
+		fh_cache_cancel_wait (session->router->server->cache, &session->waiter);
+		fh_cache_finish (session->cache,
+						 session->state == FH_PROXY_STATE_DONE);
+	}
+
+	if (session->outstanding)
+	{
+		fh_upstream_end (session->peer);
+		session->outstanding = false;
+	}
+
+	if (!session->upstream)
+		return;
+
+	/* Only a response that was read to its end leaves the connection
+	   ready for another one.  */
+	const bool reusable
+		= session->state == FH_PROXY_STATE_DONE && session->keepalive
+		  && (!session->pipe_link
+			  || !session->pipe_link->buf->attrs.pipe.pipe_len);
+
+	fh_upstream_release (session->upstreams, session->upstream, reusable);
+	session->upstream = NULL;
+}
+
+static void
+fh_proxy_fail (struct fh_proxy_session *session)
+{
+	struct fh_response *response = session->response;
+
+	if (session->upstream)
+	{
+		fh_upstream_release (session->upstreams, session->upstream, false);
+		session->upstream = NULL;
+	}
+
+	if (!session->reported)
+	{
+		fh_upstream_report (session->group, session->peer, false, 0);
+		session->reported = true;
+	}
+
+	if (session->outstanding)
+	{
+		fh_upstream_end (session->peer);
+		session->outstanding = false;
+	}
+
+	session->state = FH_PROXY_STATE_ERROR;
+	response->status = FH_STATUS_BAD_GATEWAY;
+	response->reason = NULL;
+	response->use_default_error_response = true;
+	response->no_send_body = false;
+	response->headers_pending = false;
+	response->pull = NULL;
+}
+
+static void fh_proxy_on_event (void *data, uint32_t events);
+
+/* Moves the request to another server of the group after `peer' could
+   not be reached.  */
+static bool
+fh_proxy_next_peer (struct fh_proxy_session *session)
+{
+	struct fh_upstream_group *group = session->group;
+	struct fh_upstream_peer *failed = session->peer;
+
+	if (++session->tries >= group->peer_count)
+		return false;
+
+	fh_upstream_report (group, failed, false, 0);
+	fh_upstream_end (failed);
+
+	session->peer = fh_upstream_pick (group, session->key, session->key_len);
+
+	if (session->peer == failed)
+		session->peer = &group->peers[(size_t) (failed - group->peers + 1)
+									  % group->peer_count];
+
+	fh_upstream_begin (session->peer);
+	session->started = fh_upstream_clock ();
+
+	fh_pr_debug ("Trying upstream %s instead of %s",
+				 session->peer->config->name, failed->config->name);
+	return true;
+}
+
+static bool
+fh_proxy_connect (struct fh_proxy_session *session)
+{
+	do
+		session->upstream
+			= fh_upstream_acquire (session->upstreams, session->peer,
+								   &fh_proxy_on_event, session);
+	while (!session->upstream && fh_proxy_next_peer (session));
+
+	session->sent = 0;
+	session->iov_first = 0;
+	session->iov_first_off = 0;
+	session->state = FH_PROXY_STATE_SEND;
+	return session->upstream;
+}
+
+/* RFC 9110, section 9.2.2 */
+static inline bool
+fh_proxy_idempotent (enum fh_method method)
+{
+	switch (method)
+	{
+		case FH_METHOD_GET:
+		case FH_METHOD_HEAD:
+		case FH_METHOD_OPTIONS:
+		case FH_METHOD_TRACE:
+		case FH_METHOD_PUT:
+		case FH_METHOD_DELETE:
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+/* Nothing is sent over a connection that could not be made, so any
+   request can go to another server then.  A kept-alive connection may
+   have been closed by the server just as it was picked for reuse, so the
+   request is worth another try as long as nothing came back.  The server
+   may have acted on the request all the same, so only idempotent ones
+   are sent again.  */
+static bool
+fh_proxy_retry (struct fh_proxy_session *session)
+{
+	if (session->head_started)
+		return false;
+
+	if (!session->upstream->connected)
+	{
+		if (!fh_proxy_next_peer (session))
+			return false;
+	}
+	else if (!session->upstream->requests
+			 || !fh_proxy_idempotent (session->request->method))
+	{
+		return false;
+	}
+	else
+	{
+		fh_pr_debug ("Retrying on a fresh connection to upstream %s",
+					 session->peer->config->name);
+	}
+
+	fh_upstream_release (session->upstreams, session->upstream, false);
+	session->upstream = NULL;
+	return fh_proxy_connect (session);
+}
+
+/* Sends the request and reads the response head, as far as the sockets
+   allow, and resumes the client once the response can start.  */
+static void
+fh_proxy_advance (struct fh_proxy_session *session, uint32_t events)
+{
+	for (;;)
+	{
+		int rc = 1;
+
+		if (session->state == FH_PROXY_STATE_SEND)
+		{
+			if (!session->upstream->connected)
+			{
+				if (!(events & (XPOLLERR | XPOLLHUP)))
+					return;
+
+				rc = -1;
+			}
+			else if ((rc = fh_proxy_send_request (session)) > 0)
+			{
+				session->state = FH_PROXY_STATE_HEAD;
+			}
+		}
+
+		if (rc > 0 && session->state == FH_PROXY_STATE_HEAD)
+			rc = session->fastcgi ? fh_proxy_fcgi_read_head (session)
+								  : fh_proxy_read_head (session);
+
+		if (rc == 0)
+			return;
+
+		if (rc < 0)
+		{
+			if (fh_proxy_retry (session))
+			{
+				events = 0;
+				continue;
+			}
+
+			fh_pr_err ("Request to upstream %s failed: %s",
+					   session->peer->config->name, strerror (errno));
+			fh_proxy_fail (session);
+		}
+
+		break;
+	}
+
+	if (!session->in_handler)
+		fh_router_resume (session->router, session->conn);
+}
+
+static void
+fh_proxy_on_event (void *data, uint32_t events)
+{
+	struct fh_proxy_session *session = data;
+
+	switch (session->state)
+	{
+		case FH_PROXY_STATE_SEND:
+		case FH_PROXY_STATE_HEAD:
+			fh_proxy_advance (session, events);
+			break;
+
+		case FH_PROXY_STATE_BODY:
+			/* The client side reads the body at its own pace.  */
+			if (session->waiting)
+			{
+				session->waiting = false;
+				fh_router_resume (session->router, session->conn);
+			}
+
+			break;
+
+		default:
+			break;
+	}
+}
+
+/* Hands the request to a server of the group.  Returns false on
+   allocation failures only.  */
+static bool
+fh_proxy_start (struct fh_proxy_session *session)
+{
+	struct fh_response *response = session->response;
+
+	session->peer
+		= fh_upstream_pick (session->group, session->key, session->key_len);
+	session->head_buf = fh_pool_alloc (response->pool,
+									   HTTP1_UPSTREAM_HEAD_MAX_LEN);
+
+	if (!session->head_buf
+		|| (session->fastcgi
+				? !(session->rec_buf = fh_pool_alloc (response->pool,
+													  FH_PROXY_BUF_SIZE))
+					  || !fh_proxy_fcgi_build_request (session)
+				: !fh_proxy_build_request (session)))
+		return false;
+
+	response->pull
+		= session->fastcgi ? &fh_proxy_fcgi_pull : &fh_proxy_pull;
+	response->headers_pending = true;
+	session->started = fh_upstream_clock ();
+	session->outstanding = true;
+	fh_upstream_begin (session->peer);
+
+	if (!fh_proxy_connect (session))
+	{
+		fh_proxy_fail (session);
+		return true;
+	}
+
+	fh_proxy_advance (session, 0);
+	return true;
+}
+
+/* Answers from the cache, or has the request wait while another one
+   fetches the response.  Returns false if the request is to be
+   forwarded, and the response stored if the cache lock was taken.  A
+   stale response is revalidated by the request that takes the lock, and
+   served to the others meanwhile.  */
+static bool
+fh_proxy_cache_lookup (struct fh_proxy_session *session, time_t now)
+{
+	struct fh_cache_req *cache = session->cache;
+	struct fh_response *response = session->response;
+	const char *tag = NULL;
+
+	switch (fh_cache_lookup (cache, now))
+	{
+		case FH_CACHE_HIT:
+			tag = "HIT";
+			break;
+
+		case FH_CACHE_STALE:
+			if (!fh_cache_lock (cache, now))
+				tag = "STALE";
+
+			break;
+
+		case FH_CACHE_PASS:
+			return false;
+
+		default:
+			break;
+	}
+
+	if (tag && fh_cache_serve (cache, response, tag, now))
+	{
+		session->state = FH_PROXY_STATE_DONE;
+		return true;
+	}
+
+	/* HTTP/3 responses cannot be put off.  */
+	if (fh_cache_lock (cache, now) || now >= session->wait_until
+		|| session->request->method != FH_METHOD_GET
+		|| session->request->protocol == FH_PROTOCOL_H3)
+		return false;
+
+	session->state = FH_PROXY_STATE_WAIT;
+	response->headers_pending = true;
+
+	if (fh_cache_wait (session->router->server->cache, &session->waiter))
+		return true;
+
+	response->headers_pending = false;
+	return false;
+}
+
+static void
+fh_proxy_cache_tick (void *data)
+{
+	struct fh_proxy_session *session = data;
+
+	if (fh_proxy_cache_lookup (session, time (NULL))
+		&& session->state == FH_PROXY_STATE_WAIT)
+		return;
+
+	session->in_handler = true;
+
+	if (session->state == FH_PROXY_STATE_WAIT && !fh_proxy_start (session))
+		fh_proxy_fail (session);
+
+	session->in_handler = false;
+
+	if (!session->response->headers_pending)
+		fh_router_resume (session->router, session->conn);
+}
+
+bool
+fh_router_handle_proxy (struct fh_router *router, struct fh_conn *conn,
+						const struct fh_request *request,
+						struct fh_response *response)
+{
+	const struct fh_config_proxy *config = fh_proxy_match (conn->config, request);
+	struct fh_upstreams *upstreams = router->server->upstreams;
+
+	if (!config)
+		return false;
+
+	/* The script is looked up under the document root.  */
+	if (config->fastcgi && !config->script
+		&& fh_proxy_fcgi_path_escapes (request->uri, request->uri_len))
+	{
+		response->status = FH_STATUS_BAD_REQUEST;
+		response->use_default_error_response = true;
+		return true;
+	}
+
+	struct fh_upstream_group *group = fh_upstream_group_get (upstreams, config);
+	const char *key = NULL;
+	size_t key_len = 0;
+
+	if (config->balance == FH_UPSTREAM_BALANCE_HASH && config->hash_header)
+	{
+		const struct fh_header *header = fh_header_get (
+			&request->headers, config->hash_header, config->hash_header_len);
+
+		if (header)
+		{
+			key = header->value;
+			key_len = header->value_len;
+		}
+	}
+	else if (config->balance == FH_UPSTREAM_BALANCE_HASH)
+	{
+		key = request->uri;
+		key_len = request->uri_len;
+	}
+
+	struct fh_proxy_session *session
+		= group ? fh_pool_zalloc (response->pool, sizeof (*session)) : NULL;
+	const time_t now = time (NULL);
+
+	if (!session)
+		return false;
+
+	session->router = router;
+	session->conn = conn;
+	session->request = request;
+	session->response = response;
+	session->config = config;
+	session->upstreams = upstreams;
+	session->group = group;
+	session->key = key;
+	session->key_len = key_len;
+	session->fastcgi = config->fastcgi;
+	session->waiter.on_tick = &fh_proxy_cache_tick;
+	session->waiter.data = session;
+	session->wait_until = now + FH_CACHE_LOCK_TIMEOUT;
+	response->handler_data = session;
+	response->cleanup = &fh_proxy_cleanup;
+
+	if (config->cache
+		&& (session->cache = fh_cache_req_create (response->pool, request))
+		&& fh_proxy_cache_lookup (session, now))
+		return true;
+
+	/* HTTP/3 responses are submitted in one go, so there is no waiting for
+	   the upstream server there, and chunked request bodies are not
+	   parsed.  */
+	if (request->protocol == FH_PROTOCOL_H3
+		|| request->transfer_encoding == FH_ENCODING_CHUNKED)
+	{
+		response->status = request->protocol == FH_PROTOCOL_H3
+							   ? FH_STATUS_BAD_GATEWAY
+							   : FH_STATUS_NOT_IMPLEMENTED;
+		response->use_default_error_response = true;
+		return true;
+	}
+
+	session->in_handler = true;
+	const bool ok = fh_proxy_start (session);
+	session->in_handler = false;
+	return ok;
+}
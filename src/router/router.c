@@ -29,11 +29,18 @@
 
 #define FH_LOG_MODULE_NAME "router"
 
+#include "compat.h"
+#include "core/accesslog.h"
 #include "core/conf.h"
 #include "core/conn.h"
+#include "core/server.h"
+#include "http/compress.h"
+#include "http/filter.h"
+#include "http/h2.h"
 #include "http/http1_request.h"
 #include "http/http1_response.h"
 #include "log/log.h"
+#include "probes.h"
 #include "router.h"
 #include "utils/utils.h"
 
@@ -53,6 +60,24 @@ fh_router_init (struct fh_router *router, struct fh_server *server)
 	router->default_route->handler = FH_HANDLER_FILESYSTEM;
 	router->default_route->flags = FH_HANDLER_FILESYSTEM_FLAGS;
 	router->default_route->path = NULL;
+
+	router->proxy_route = malloc (sizeof (struct fh_route));
+
+	if (!router->proxy_route)
+		return false;
+
+	router->proxy_route->handler = FH_HANDLER_PROXY;
+	router->proxy_route->flags = 0;
+	router->proxy_route->path = NULL;
+
+	router->status_route = malloc (sizeof (struct fh_route));
+
+	if (!router->status_route)
+		return false;
+
+	router->status_route->handler = FH_HANDLER_STATUS;
+	router->status_route->flags = FH_HANDLER_STATUS_FLAGS;
+	router->status_route->path = NULL;
 	router->server = server;
 	return true;
 }
@@ -61,20 +86,79 @@ void
 fh_router_free (struct fh_router *router)
 {
 	free (router->default_route);
+	free (router->proxy_route);
+	free (router->status_route);
 	strtable_destroy (router->static_routes);
 }
 
+static struct fh_route *
+fh_router_find_route (struct fh_router *router, const struct fh_conn *conn,
+					  const struct fh_request *request)
+{
+	if (fh_status_match (conn->config, request))
+		return router->status_route;
+
+	if (fh_proxy_match (conn->config, request))
+		return router->proxy_route;
+
+	return router->default_route;
+}
+
 bool
-fh_router_handle (struct fh_router *router, struct fh_conn *conn,
-				  const struct fh_request *request)
+fh_router_respond (struct fh_router *router, struct fh_conn *conn,
+				   const struct fh_request *request,
+				   struct fh_response *response)
+{
+	struct fh_route *route = fh_router_find_route (router, conn, request);
+
+	response->protocol = request->protocol;
+	response->content_encoding = fh_compress_negotiate (
+		router->server->config->compression, request);
+
+	if (!route->handler (router, conn, request, response))
+		return false;
+
+	/* Let clients of a host that is also served over QUIC switch to it */
+	if (conn->ssl && conn->config && conn->config->tls
+		&& conn->config->tls->http3
+		&& !fh_header_addf (response->pool, fh_response_get_headers (response),
+							"Alt-Svc", 7, "h3=\":%u\"; ma=86400",
+							conn->config->addr.port))
+		return false;
+
+	/* Filters need to see the final status and headers, which are not
+	   known yet when the handler answers later.  */
+	if (!response->headers_pending
+		&& !fh_filter_setup (router->server->config, request, response))
+	{
+		fh_pr_err ("Failed to set up response filters");
+		return false;
+	}
+
+	return true;
+}
+
+static void
+fh_router_log_http1 (const struct fh_conn *conn,
+					 const struct fh_request *request,
+					 const struct fh_http1_res_ctx *ctx)
+{
+	const uint64_t body = conn->bytes_sent > ctx->headers_size
+							  ? conn->bytes_sent - ctx->headers_size
+							  : 0;
+
+	fh_access_log (conn, request, ctx->response->status, body, &conn->timing);
+}
+
+static bool
+fh_router_handle_http1 (struct fh_router *router, struct fh_conn *conn,
+						const struct fh_request *request)
 {
-	struct fh_route *route = NULL;
 	struct fh_http1_res_ctx *ctx = conn->io_ctx.h1.res_ctx;
-	pool_t *child_pool = NULL;
 
 	if (!ctx)
 	{
-		child_pool = fh_pool_create (0);
+		pool_t *child_pool = fh_pool_create (0);
 
 		if (!child_pool)
 		{
@@ -90,20 +174,33 @@ fh_router_handle (struct fh_router *router, struct fh_conn *conn,
 			return true;
 		}
 
-		ctx->response->protocol = request->protocol;
-	}
-
-	bool initial_call = !conn->io_ctx.h1.res_ctx;
-
-	if (!conn->io_ctx.h1.res_ctx)
 		conn->io_ctx.h1.res_ctx = ctx;
 
-	if (!route)
-		route = router->default_route;
+		if (!fh_router_respond (router, conn, request, ctx->response))
+		{
+			fh_server_close_conn (router->server, conn);
+			return true;
+		}
+
+		fh_stats_mark (&conn->timing, FH_STATS_MARK_HANDLER);
 
-	if ((initial_call || route->flags & ~FH_ROUTE_CALL_ONCE))
+		/* The handler resumes the response when it has more to send, so
+		   the socket only needs to report changes from now on.  */
+		if ((ctx->response->headers_pending || ctx->response->pull)
+			&& !xpoll_mod (router->server->xpoll_fd, conn->client_sockfd,
+						   XPOLLOUT | XPOLLET | XPOLLHUP))
+		{
+			fh_pr_err ("Unable to switch poll mode for a deferred response");
+			fh_server_close_conn (router->server, conn);
+			return true;
+		}
+	}
+	else
 	{
-		if (!route->handler (router, conn, request, ctx->response))
+		struct fh_route *route = fh_router_find_route (router, conn, request);
+
+		if (route->flags & ~FH_ROUTE_CALL_ONCE
+			&& !route->handler (router, conn, request, ctx->response))
 		{
 			fh_server_close_conn (router->server, conn);
 			return true;
@@ -113,6 +210,7 @@ fh_router_handle (struct fh_router *router, struct fh_conn *conn,
 	if (!fh_http1_send_response (ctx, conn))
 	{
 		fh_pr_err ("Failed to send response");
+		fh_router_log_http1 (conn, request, ctx);
 		fh_server_close_conn (router->server, conn);
 		return true;
 	}
@@ -120,6 +218,8 @@ fh_router_handle (struct fh_router *router, struct fh_conn *conn,
 	if (ctx->state == FH_RES_STATE_DONE)
 	{
 		fh_pr_debug ("Response sent successfully");
+		fh_stats_mark (&conn->timing, FH_STATS_MARK_BODY);
+		fh_router_log_http1 (conn, request, ctx);
 		fh_server_close_conn (router->server, conn);
 		return true;
 	}
@@ -132,3 +232,31 @@ fh_router_handle (struct fh_router *router, struct fh_conn *conn,
 
 	return true;
 }
+
+bool
+fh_router_handle (struct fh_router *router, struct fh_conn *conn,
+				  const struct fh_request *request)
+{
+	/* The connection may be gone on return.  */
+	const object_id_t id __attribute_maybe_unused__ = conn->id;
+	const fd_t fd __attribute_maybe_unused__ = conn->client_sockfd;
+
+	FH_PROBE2 (router__handle__entry, id, fd);
+	const bool ret = fh_router_handle_http1 (router, conn, request);
+	FH_PROBE3 (router__handle__return, id, fd, ret);
+	return ret;
+}
+
+void
+fh_router_resume (struct fh_router *router, struct fh_conn *conn)
+{
+	if (conn->protocol == FH_PROTOCOL_H2)
+	{
+		if (!fh_h2_send (conn->io_ctx.h2) || fh_h2_done (conn->io_ctx.h2))
+			fh_server_close_conn (router->server, conn);
+
+		return;
+	}
+
+	fh_router_handle (router, conn, conn->requests->tail);
+}
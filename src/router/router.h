@@ -26,6 +26,8 @@
 #include "core/conn.h"
 #include "core/server.h"
 #include "filesystem.h"
+#include "proxy.h"
+#include "status.h"
 
 struct fh_router;
 
@@ -44,18 +46,28 @@ struct fh_router
 	/* (const char *) => (struct fh_route *) */
 	struct strtable *static_routes;
 	struct fh_route *default_route;
+	struct fh_route *proxy_route;
+	struct fh_route *status_route;
 };
 
 bool fh_router_init (struct fh_router *router, struct fh_server *server);
 void fh_router_free (struct fh_router *router);
 bool fh_router_handle (struct fh_router *router, struct fh_conn *conn, const struct fh_request *request);
+bool fh_router_respond (struct fh_router *router, struct fh_conn *conn, const struct fh_request *request, struct fh_response *response);
+/* Carries on with a response whose handler was waiting for something */
+void fh_router_resume (struct fh_router *router, struct fh_conn *conn);
 
 bool fh_router_handle_filesystem (struct fh_router *router, struct fh_conn *conn, const struct fh_request *request, struct fh_response *response);
+bool fh_router_handle_proxy (struct fh_router *router, struct fh_conn *conn, const struct fh_request *request, struct fh_response *response);
+bool fh_router_handle_status (struct fh_router *router, struct fh_conn *conn, const struct fh_request *request, struct fh_response *response);
 
 #define FH_ROUTE_CALL_ONCE 0x1
 
 #define FH_HANDLER_FILESYSTEM (&fh_router_handle_filesystem)
+#define FH_HANDLER_PROXY (&fh_router_handle_proxy)
+#define FH_HANDLER_STATUS (&fh_router_handle_status)
 
 #define FH_HANDLER_FILESYSTEM_FLAGS FH_ROUTE_CALL_ONCE
+#define FH_HANDLER_STATUS_FLAGS FH_ROUTE_CALL_ONCE
 
 #endif /* FH_ROUTER_H */
@@ -0,0 +1,337 @@
+/*
+ * This file is part of OSN freehttpd.
+ * 
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#define FH_LOG_MODULE_NAME "router/status"
+
+#include "core/conf.h"
+#include "core/conn.h"
+#include "core/stats.h"
+#include "core/stream.h"
+#include "log/log.h"
+#include "router.h"
+#include "status.h"
+
+/* Room for the lines of one worker, in either format */
+#define FH_STATUS_WORKER_SIZE 2048
+/* Room for the latency of all phases, in either format */
+#define FH_STATUS_PHASES_SIZE 4096
+
+static const char *const fh_status_phase_names[FH_STATS_PHASE_COUNT] = {
+	[FH_STATS_PHASE_ACCEPT] = "accept",	  [FH_STATS_PHASE_PARSE] = "parse",
+	[FH_STATS_PHASE_HANDLER] = "handler", [FH_STATS_PHASE_HEADERS] = "headers",
+	[FH_STATS_PHASE_BODY] = "body",		  [FH_STATS_PHASE_TOTAL] = "total",
+};
+
+static const double fh_status_quantiles[] = { 0.5, 0.9, 0.99 };
+
+struct fh_status_buf
+{
+	char *data;
+	size_t len;
+	size_t cap;
+};
+
+static void __attribute__ ((format (printf, 2, 3)))
+fh_status_printf (struct fh_status_buf *buf, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start (args, fmt);
+	const int len = vsnprintf (buf->data + buf->len, buf->cap - buf->len, fmt,
+							   args);
+	va_end (args);
+
+	if (len > 0)
+		buf->len += (size_t) len < buf->cap - buf->len
+						? (size_t) len
+						: buf->cap - buf->len - 1;
+}
+
+bool
+fh_status_match (const struct fh_config_host *config,
+				 const struct fh_request *request)
+{
+	if (!config || !config->status_path || !request->uri)
+		return false;
+
+	const char *query = memchr (request->uri, '?', request->uri_len);
+	const size_t len
+		= query ? (size_t) (query - request->uri) : request->uri_len;
+
+	return len == config->status_path_len
+		   && !memcmp (request->uri, config->status_path, len);
+}
+
+/* Prometheus asks for its text format in the Accept header, and a query
+   string does for anyone else.  */
+static bool
+fh_status_wants_prometheus (const struct fh_request *request)
+{
+	const char *query = memchr (request->uri, '?', request->uri_len);
+	const struct fh_header *accept
+		= fh_header_get (&request->headers, "Accept", 6);
+
+	if (query
+		&& memmem (query, request->uri_len - (size_t) (query - request->uri),
+				   "format=prometheus", 17))
+		return true;
+
+	return accept
+		   && (memmem (accept->value, accept->value_len, "version=0.0.4", 13)
+			   || memmem (accept->value, accept->value_len,
+						  "application/openmetrics-text", 28));
+}
+
+static void
+fh_status_print_text (struct fh_status_buf *buf,
+					  const struct fh_worker_stats *stats, size_t count,
+					  const struct fh_worker_stats *total)
+{
+	fh_status_printf (buf,
+					  "Workers: %zu\n"
+					  "Connections accepted: %lu\n"
+					  "Connections active: %lu\n"
+					  "Connections idle: %lu\n"
+					  "Responses: 1xx %lu, 2xx %lu, 3xx %lu, 4xx %lu, 5xx %lu, "
+					  "other %lu\n"
+					  "Bytes in: %lu\n"
+					  "Bytes out: %lu\n"
+					  "Parse errors: %lu\n"
+					  "Pool memory: %lu\n\n",
+					  count, total->accepted, total->active, total->idle,
+					  total->responses[1], total->responses[2],
+					  total->responses[3], total->responses[4],
+					  total->responses[5], total->responses[0],
+					  total->bytes_in, total->bytes_out, total->parse_errors,
+					  total->pool_bytes);
+
+	fh_status_printf (buf, "%-6s %-8s %10s %8s %8s %10s %14s %14s %8s %12s\n",
+					  "Worker", "PID", "Accepted", "Active", "Idle",
+					  "Responses", "Bytes in", "Bytes out", "Errors", "Pool");
+
+	for (size_t i = 0; i < count; i++)
+	{
+		uint64_t responses = 0;
+
+		for (size_t j = 0; j < FH_STATS_STATUS_CLASSES; j++)
+			responses += stats[i].responses[j];
+
+		fh_status_printf (
+			buf, "%-6zu %-8d %10lu %8lu %8lu %10lu %14lu %14lu %8lu %12lu\n", i,
+			(int) stats[i].pid, stats[i].accepted, stats[i].active,
+			stats[i].idle, responses, stats[i].bytes_in, stats[i].bytes_out,
+			stats[i].parse_errors, stats[i].pool_bytes);
+	}
+}
+
+static void
+fh_status_print_phases_text (struct fh_status_buf *buf,
+							 const struct fh_histogram *phases)
+{
+	fh_status_printf (buf, "\n%-8s %10s %10s %10s %10s %10s %10s\n", "Phase",
+					  "Count", "Mean us", "p50 us", "p90 us", "p99 us",
+					  "Max us");
+
+	for (size_t i = 0; i < FH_STATS_PHASE_COUNT; i++)
+	{
+		const struct fh_histogram *h = &phases[i];
+
+		fh_status_printf (buf, "%-8s %10lu %10lu %10lu %10lu %10lu %10lu\n",
+						  fh_status_phase_names[i], h->count,
+						  h->count ? h->sum / h->count : 0,
+						  fh_histogram_percentile (h, 0.5),
+						  fh_histogram_percentile (h, 0.9),
+						  fh_histogram_percentile (h, 0.99), h->max);
+	}
+}
+
+#define FH_STATUS_METRIC(buf, name, type, help)                                \
+	fh_status_printf ((buf), "# HELP freehttpd_" name " " help "\n"           \
+							 "# TYPE freehttpd_" name " " type "\n")
+
+static void
+fh_status_print_prometheus (struct fh_status_buf *buf,
+							const struct fh_worker_stats *stats, size_t count)
+{
+	static const char *const classes[FH_STATS_STATUS_CLASSES]
+		= { "other", "1xx", "2xx", "3xx", "4xx", "5xx" };
+
+#define FH_STATUS_SAMPLES(name, field)                                         \
+	for (size_t i = 0; i < count; i++)                                         \
+		fh_status_printf (buf, "freehttpd_" name "{worker=\"%zu\"} %lu\n", i,  \
+						  stats[i].field)
+
+	FH_STATUS_METRIC (buf, "connections_accepted_total", "counter",
+					  "Connections accepted.");
+	FH_STATUS_SAMPLES ("connections_accepted_total", accepted);
+	FH_STATUS_METRIC (buf, "connections_active", "gauge",
+					  "Open connections with a request in progress.");
+	FH_STATUS_SAMPLES ("connections_active", active);
+	FH_STATUS_METRIC (buf, "connections_idle", "gauge",
+					  "Open connections waiting for a request.");
+	FH_STATUS_SAMPLES ("connections_idle", idle);
+
+	FH_STATUS_METRIC (buf, "responses_total", "counter",
+					  "Responses by status class.");
+
+	for (size_t i = 0; i < count; i++)
+	{
+		for (size_t j = 0; j < FH_STATS_STATUS_CLASSES; j++)
+			fh_status_printf (buf,
+							  "freehttpd_responses_total{worker=\"%zu\","
+							  "class=\"%s\"} %lu\n",
+							  i, classes[j], stats[i].responses[j]);
+	}
+
+	FH_STATUS_METRIC (buf, "received_bytes_total", "counter",
+					  "Bytes received from clients.");
+	FH_STATUS_SAMPLES ("received_bytes_total", bytes_in);
+	FH_STATUS_METRIC (buf, "sent_bytes_total", "counter",
+					  "Bytes sent to clients.");
+	FH_STATUS_SAMPLES ("sent_bytes_total", bytes_out);
+	FH_STATUS_METRIC (buf, "parse_errors_total", "counter",
+					  "Requests or connections rejected as malformed.");
+	FH_STATUS_SAMPLES ("parse_errors_total", parse_errors);
+	FH_STATUS_METRIC (buf, "pool_bytes", "gauge",
+					  "Memory held by the pools of the worker.");
+	FH_STATUS_SAMPLES ("pool_bytes", pool_bytes);
+
+#undef FH_STATUS_SAMPLES
+}
+
+/* Quantiles of different workers cannot be added up, so the phases are
+   only reported for all of them.  */
+static void
+fh_status_print_phases_prometheus (struct fh_status_buf *buf,
+								   const struct fh_histogram *phases)
+{
+	FH_STATUS_METRIC (buf, "phase_duration_seconds", "summary",
+					  "Time spent in each phase of a request.");
+
+	for (size_t i = 0; i < FH_STATS_PHASE_COUNT; i++)
+	{
+		const struct fh_histogram *h = &phases[i];
+		const char *name = fh_status_phase_names[i];
+
+		for (size_t j = 0; j < sizeof (fh_status_quantiles)
+								   / sizeof (fh_status_quantiles[0]);
+			 j++)
+		{
+			fh_status_printf (
+				buf,
+				"freehttpd_phase_duration_seconds{phase=\"%s\","
+				"quantile=\"%g\"} %.6f\n",
+				name, fh_status_quantiles[j],
+				(double) fh_histogram_percentile (h, fh_status_quantiles[j])
+					/ 1e6);
+		}
+
+		fh_status_printf (buf,
+						  "freehttpd_phase_duration_seconds_sum{phase=\"%s\"} "
+						  "%.6f\n"
+						  "freehttpd_phase_duration_seconds_count{phase=\"%s\"} "
+						  "%lu\n",
+						  name, (double) h->sum / 1e6, name, h->count);
+	}
+}
+
+bool
+fh_router_handle_status (struct fh_router *router, struct fh_conn *conn,
+						 const struct fh_request *request,
+						 struct fh_response *response)
+{
+	(void) router;
+	(void) conn;
+
+	if (request->method != FH_METHOD_GET && request->method != FH_METHOD_HEAD)
+	{
+		response->status = FH_STATUS_METHOD_NOT_ALLOWED;
+		response->use_default_error_response = true;
+		return true;
+	}
+
+	const size_t count = fh_stats_worker_count ();
+	const bool prometheus = fh_status_wants_prometheus (request);
+	struct fh_worker_stats total;
+	struct fh_worker_stats *stats
+		= fh_pool_alloc (response->pool, (count ? count : 1) * sizeof (*stats));
+	struct fh_histogram *phases = fh_pool_alloc (
+		response->pool, FH_STATS_PHASE_COUNT * sizeof (*phases));
+	struct fh_status_buf buf = {
+		.cap = FH_STATUS_WORKER_SIZE * (count + 1) + FH_STATUS_PHASES_SIZE,
+	};
+
+	if (!stats || !phases
+		|| !(buf.data = fh_pool_alloc (response->pool, buf.cap))
+		|| !fh_response_get_headers (response)
+		|| !fh_header_add (response->pool, response->headers, "Cache-Control",
+						   13, "no-store", 8))
+	{
+		response->status = FH_STATUS_INTERNAL_SERVER_ERROR;
+		response->use_default_error_response = true;
+		return true;
+	}
+
+	buf.data[0] = 0;
+	fh_stats_collect (stats, &total);
+	fh_stats_collect_phases (phases);
+
+	if (prometheus)
+	{
+		fh_status_print_prometheus (&buf, stats, count);
+		fh_status_print_phases_prometheus (&buf, phases);
+	}
+	else
+	{
+		fh_status_print_text (&buf, stats, count, &total);
+		fh_status_print_phases_text (&buf, phases);
+	}
+
+	response->status = FH_STATUS_OK;
+	response->use_default_error_response = false;
+	response->content_type = prometheus
+								 ? "text/plain; version=0.0.4; charset=utf-8"
+								 : "text/plain; charset=utf-8";
+	response->content_type_len = strlen (response->content_type);
+	response->content_length = buf.len;
+
+	if (request->method == FH_METHOD_HEAD)
+	{
+		response->no_send_body = true;
+		return true;
+	}
+
+	response->body_start
+		= fh_link_new_data (response->pool, (uint8_t *) buf.data, buf.len, true);
+
+	if (!response->body_start)
+	{
+		response->status = FH_STATUS_INTERNAL_SERVER_ERROR;
+		response->use_default_error_response = true;
+	}
+
+	return true;
+}
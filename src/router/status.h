@@ -0,0 +1,33 @@
+/*
+ * This file is part of OSN freehttpd.
+ * 
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FH_ROUTER_STATUS_H
+#define FH_ROUTER_STATUS_H
+
+#include <stdbool.h>
+
+#include "core/conf.h"
+#include "http/protocol.h"
+
+/* Whether the request is for the statistics of the host, at the path of
+   its `status' property.  */
+bool fh_status_match (const struct fh_config_host *config,
+					  const struct fh_request *request);
+
+#endif /* FH_ROUTER_STATUS_H */
@@ -0,0 +1,111 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "histogram.h"
+
+#define fh_histogram_load(field) __atomic_load_n (&(field), __ATOMIC_RELAXED)
+#define fh_histogram_store(field, value)                                       \
+	__atomic_store_n (&(field), (value), __ATOMIC_RELAXED)
+
+uint64_t
+fh_histogram_bucket_min (size_t bucket)
+{
+	if (bucket < FH_HISTOGRAM_SUB_COUNT)
+		return bucket;
+
+	const size_t exp
+		= bucket / FH_HISTOGRAM_SUB_COUNT + FH_HISTOGRAM_SUB_BITS - 1;
+	const uint64_t sub = bucket % FH_HISTOGRAM_SUB_COUNT;
+
+	return (FH_HISTOGRAM_SUB_COUNT + sub) << (exp - FH_HISTOGRAM_SUB_BITS);
+}
+
+/* With a single writer, relaxed loads and stores do instead of locked
+   read-modify-write instructions.  */
+void
+fh_histogram_record (struct fh_histogram *histogram, uint64_t value)
+{
+	const size_t bucket = fh_histogram_bucket (value);
+
+	fh_histogram_store (histogram->buckets[bucket],
+						fh_histogram_load (histogram->buckets[bucket]) + 1);
+	fh_histogram_store (histogram->sum,
+						fh_histogram_load (histogram->sum) + value);
+
+	if (value > fh_histogram_load (histogram->max))
+		fh_histogram_store (histogram->max, value);
+
+	fh_histogram_store (histogram->count,
+						fh_histogram_load (histogram->count) + 1);
+}
+
+void
+fh_histogram_merge (struct fh_histogram *dst, const struct fh_histogram *src)
+{
+	uint64_t count = 0;
+
+	/* The count is made up from the buckets, so that percentiles never
+	   look for values that a concurrent record has not counted yet.  */
+	for (size_t i = 0; i < FH_HISTOGRAM_BUCKETS; i++)
+	{
+		const uint64_t n = fh_histogram_load (src->buckets[i]);
+
+		dst->buckets[i] += n;
+		count += n;
+	}
+
+	const uint64_t max = fh_histogram_load (src->max);
+
+	dst->count += count;
+	dst->sum += fh_histogram_load (src->sum);
+
+	if (max > dst->max)
+		dst->max = max;
+}
+
+uint64_t
+fh_histogram_percentile (const struct fh_histogram *histogram,
+						 double fraction)
+{
+	if (!histogram->count)
+		return 0;
+
+	uint64_t rank = (uint64_t) (fraction * (double) histogram->count + 0.5);
+	uint64_t seen = 0;
+
+	if (rank < 1)
+		rank = 1;
+
+	for (size_t i = 0; i < FH_HISTOGRAM_BUCKETS; i++)
+	{
+		seen += histogram->buckets[i];
+
+		if (seen >= rank)
+		{
+			const uint64_t value
+				= i + 1 < FH_HISTOGRAM_BUCKETS
+					  ? fh_histogram_bucket_min (i + 1) - 1
+					  : histogram->max;
+
+			return value < histogram->max ? value : histogram->max;
+		}
+	}
+
+	return histogram->max;
+}
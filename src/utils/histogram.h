@@ -0,0 +1,76 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FH_UTILS_HISTOGRAM_H
+#define FH_UTILS_HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Log-linear buckets, as in HDR histograms: every power of two is split
+   into FH_HISTOGRAM_SUB_COUNT buckets, so a value is off by at most
+   1/FH_HISTOGRAM_SUB_COUNT of itself.  Values below 2 * SUB_COUNT get a
+   bucket each.  */
+#define FH_HISTOGRAM_SUB_BITS 3
+#define FH_HISTOGRAM_SUB_COUNT (1 << FH_HISTOGRAM_SUB_BITS)
+/* Values from 2^FH_HISTOGRAM_MAX_EXP on are counted in the last bucket */
+#define FH_HISTOGRAM_MAX_EXP 32
+#define FH_HISTOGRAM_BUCKETS                                                   \
+	((FH_HISTOGRAM_MAX_EXP - FH_HISTOGRAM_SUB_BITS + 1)                        \
+	 * FH_HISTOGRAM_SUB_COUNT)
+
+/* Only one process may record into a histogram, but any may read it while
+   it does.  */
+struct fh_histogram
+{
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t buckets[FH_HISTOGRAM_BUCKETS];
+};
+
+static inline size_t
+fh_histogram_bucket (uint64_t value)
+{
+	if (value < FH_HISTOGRAM_SUB_COUNT)
+		return (size_t) value;
+
+	if (value >> FH_HISTOGRAM_MAX_EXP)
+		return FH_HISTOGRAM_BUCKETS - 1;
+
+	const unsigned int exp = 63 - (unsigned int) __builtin_clzll (value);
+
+	return (size_t) (exp - FH_HISTOGRAM_SUB_BITS + 1) * FH_HISTOGRAM_SUB_COUNT
+		   + (size_t) (value >> (exp - FH_HISTOGRAM_SUB_BITS))
+		   - FH_HISTOGRAM_SUB_COUNT;
+}
+
+/* Returns the lowest value that falls into `bucket'.  */
+uint64_t fh_histogram_bucket_min (size_t bucket);
+
+void fh_histogram_record (struct fh_histogram *histogram, uint64_t value);
+/* Adds `src' to `dst', which nobody else uses.  */
+void fh_histogram_merge (struct fh_histogram *dst,
+						 const struct fh_histogram *src);
+/* Returns the highest value of the bucket that holds the given fraction
+   of the recorded values, or 0 if there are none.  */
+uint64_t fh_histogram_percentile (const struct fh_histogram *histogram,
+								  double fraction);
+
+#endif /* FH_UTILS_HISTOGRAM_H */
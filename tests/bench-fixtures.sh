@@ -0,0 +1,31 @@
+#!/bin/sh
+#
+# This file is part of OSN freehttpd.
+#
+# Copyright (C) 2025  OSN Developers.
+#
+# OSN freehttpd is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# OSN freehttpd is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+
+# Files under /fhbench/ of the default host that the benchmarks request,
+# created in its docroot when BENCH_DOCROOT is set.
+
+if [ -n "$BENCH_DOCROOT" ]; then
+    mkdir -p "$BENCH_DOCROOT/fhbench/dir" || exit 1
+    head -c 1024 /dev/zero | tr '\0' 'x' > "$BENCH_DOCROOT/fhbench/small.html"
+    head -c 8388608 /dev/urandom > "$BENCH_DOCROOT/fhbench/large.bin"
+
+    for i in 1 2 3 4 5 6 7 8; do
+        echo "$i" > "$BENCH_DOCROOT/fhbench/dir/file-$i.txt"
+    done
+fi
@@ -21,6 +21,14 @@ if [ -z "$BINDIR" ]; then
     BINDIR=../build/bin
 fi
 
+FHBENCH=${FHBENCH:-./fhbench}
+BENCH_URL=${BENCH_URL:-http://localhost:8080}
+BENCH_DURATION=${BENCH_DURATION:-10}
+BENCH_CONNECTIONS=${BENCH_CONNECTIONS:-50}
+
+# The scenarios request files under /fhbench/ of the default host
+. "$(dirname "$0")/bench-fixtures.sh"
+
 "$BINDIR/freehttpd" > freehttpd.log 2>&1 &
 
 pid=$!
@@ -38,17 +46,42 @@ if ! kill -0 "$pid" > /dev/null; then
 	exit 1
 fi
 
-siege -b -c 50 -t 10s --no-parser http://127.0.0.1:8080/
+failed=0
+
+run ()
+{
+    name=$1
+    shift
+
+    echo "Running scenario: $name"
+
+    # 4xx responses are expected from the not-found scenario, so only
+    # transport errors fail the run.
+    if ! "$FHBENCH" -d "$BENCH_DURATION" "$@" > "bench-$name.json"; then
+        echo "Scenario $name failed" >&2
+        failed=1
+    fi
 
-if [ $? -ne 0 ]; then
+    cat "bench-$name.json"
+}
+
+run small -c "$BENCH_CONNECTIONS" "$BENCH_URL/fhbench/small.html"
+run large -c 8 "$BENCH_URL/fhbench/large.bin"
+run autoindex -c "$BENCH_CONNECTIONS" "$BENCH_URL/fhbench/dir/"
+run not-found -c "$BENCH_CONNECTIONS" "$BENCH_URL/fhbench/missing"
+run mixed -c "$BENCH_CONNECTIONS" \
+    "$BENCH_URL/fhbench/small.html#8" \
+    "$BENCH_URL/fhbench/large.bin#1" \
+    "$BENCH_URL/fhbench/dir/#1" \
+    "$BENCH_URL/fhbench/missing#2"
+
+if [ $failed -ne 0 ]; then
     echo "Benchmark failed"
     exit 1
 fi
 
-echo "Benchmark completed successfully"
-
 kill -9 $pid
 ps aux | grep freehttpd | awk '{ print $2 }' | xargs kill -9
 
 echo "Benchmark completed successfully"
-echo "Check freehttpd.log for details"
+echo "Results are in bench-*.json, check freehttpd.log for details"
@@ -0,0 +1,323 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* The response cache, driven through its API with requests and responses
+   built by hand, at made-up times.  */
+
+#undef NDEBUG
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "core/cache.h"
+#include "core/conf.h"
+#include "core/stream.h"
+#include "hash/strtable.h"
+#include "http/protocol.h"
+
+#define NOW 1000000
+
+static pool_t *pool;
+static struct fh_config_proxy proxy = { .cache = true };
+
+static struct fh_request *
+make_request (enum fh_method method, const char *uri, const char *header,
+			  const char *value)
+{
+	struct fh_request *request = fh_pool_zalloc (pool, sizeof (*request));
+	assert (request != NULL);
+
+	request->pool = pool;
+	request->method = method;
+	request->uri = uri;
+	request->uri_len = strlen (uri);
+	request->host = "localhost";
+	request->full_host_len = request->host_len = strlen (request->host);
+	fh_headers_init (&request->headers);
+
+	if (header)
+		assert (fh_header_add (pool, &request->headers, header,
+							   strlen (header), value, strlen (value)));
+
+	return request;
+}
+
+/* Looks up `request', and expects `status' from it.  */
+static struct fh_cache_req *
+lookup (const struct fh_request *request, time_t now,
+		enum fh_cache_status status)
+{
+	struct fh_cache_req *req = fh_cache_req_create (pool, request);
+	assert (req != NULL);
+	assert (fh_cache_lookup (req, now) == status);
+	return req;
+}
+
+/* Fetches a response for `request' as the request that holds the lock
+   would, with the given header if any.  Returns whether it was stored.  */
+static bool
+store (const struct fh_request *request, time_t now, const char *header,
+	   const char *value)
+{
+	static const char body[] = "hello";
+	struct fh_cache_req *req = fh_cache_req_create (pool, request);
+	struct fh_response response = { .pool = pool, .status = 200 };
+	struct fh_buf buf = { .type = FH_BUF_DATA };
+	struct fh_link link = { .buf = &buf, .is_eos = true };
+
+	assert (req != NULL);
+	fh_cache_lookup (req, now);
+	assert (fh_cache_lock (req, now));
+
+	if (header)
+		assert (fh_header_add (pool, fh_response_get_headers (&response),
+							   header, strlen (header), value,
+							   strlen (value)));
+
+	if (!fh_cache_store_begin (req, &proxy, &response, now))
+	{
+		/* The lock must be gone either way.  */
+		assert (fh_cache_lock (req, now));
+		fh_cache_finish (req, false);
+		return false;
+	}
+
+	buf.attrs.mem.data = (uint8_t *) body;
+	buf.attrs.mem.len = sizeof body - 1;
+	assert (fh_cache_store_write (req, &link));
+	fh_cache_finish (req, true);
+	return true;
+}
+
+static void
+test_freshness (void)
+{
+	const struct fh_request *request
+		= make_request (FH_METHOD_GET, "/fresh", NULL, NULL);
+
+	/* Without an explicit lifetime, cache_valid applies */
+	proxy.cache_valid = 0;
+	assert (!store (request, NOW, NULL, NULL));
+	lookup (request, NOW, FH_CACHE_PASS);
+	lookup (request, NOW + FH_CACHE_PASS_TTL, FH_CACHE_MISS);
+
+	proxy.cache_valid = 30;
+	assert (store (request, NOW, NULL, NULL));
+	lookup (request, NOW + 29, FH_CACHE_HIT);
+	lookup (request, NOW + 30, FH_CACHE_MISS);
+
+	/* s-maxage wins over max-age */
+	request = make_request (FH_METHOD_GET, "/max-age", NULL, NULL);
+	assert (store (request, NOW, "Cache-Control", "max-age=10, s-maxage=20"));
+	lookup (request, NOW + 19, FH_CACHE_HIT);
+	lookup (request, NOW + 20, FH_CACHE_MISS);
+
+	request = make_request (FH_METHOD_GET, "/short", NULL, NULL);
+	assert (store (request, NOW, "Cache-Control", "max-age=5"));
+	lookup (request, NOW + 4, FH_CACHE_HIT);
+	lookup (request, NOW + 5, FH_CACHE_MISS);
+
+	/* Mon, 12 Jan 1970 13:46:50 GMT is NOW + 10 */
+	request = make_request (FH_METHOD_GET, "/expires", NULL, NULL);
+	assert (store (request, NOW, "Expires", "Mon, 12 Jan 1970 13:46:50 GMT"));
+	lookup (request, NOW + 9, FH_CACHE_HIT);
+	lookup (request, NOW + 10, FH_CACHE_MISS);
+
+	/* Invalid dates are in the past */
+	assert (!store (request, NOW + 10, "Expires", "tomorrow"));
+	lookup (request, NOW + 10, FH_CACHE_PASS);
+
+	/* Responses that may not be shared */
+	request = make_request (FH_METHOD_GET, "/private", NULL, NULL);
+	assert (!store (request, NOW, "Cache-Control", "private, max-age=60"));
+	lookup (request, NOW, FH_CACHE_PASS);
+
+	request = make_request (FH_METHOD_GET, "/cookie", NULL, NULL);
+	assert (!store (request, NOW, "Set-Cookie", "id=1"));
+	lookup (request, NOW, FH_CACHE_PASS);
+
+	/* Requests that bypass the cache */
+	assert (!fh_cache_req_create (
+		pool, make_request (FH_METHOD_GET, "/fresh", "Authorization", "x")));
+	assert (!fh_cache_req_create (
+		pool, make_request (FH_METHOD_GET, "/fresh", "Cache-Control",
+							"no-cache")));
+	assert (!fh_cache_req_create (
+		pool, make_request (FH_METHOD_POST, "/fresh", NULL, NULL)));
+
+	/* HEAD is answered from GET, but does not fetch */
+	request = make_request (FH_METHOD_GET, "/head", NULL, NULL);
+	struct fh_cache_req *req = lookup (
+		make_request (FH_METHOD_HEAD, "/head", NULL, NULL), NOW, FH_CACHE_MISS);
+	assert (!fh_cache_lock (req, NOW));
+	assert (store (request, NOW, "Cache-Control", "max-age=10"));
+	lookup (make_request (FH_METHOD_HEAD, "/head", NULL, NULL), NOW,
+			FH_CACHE_HIT);
+}
+
+static void
+test_stale_while_revalidate (void)
+{
+	const struct fh_request *request
+		= make_request (FH_METHOD_GET, "/swr", NULL, NULL);
+
+	assert (store (request, NOW, "Cache-Control",
+				   "max-age=10, stale-while-revalidate=20"));
+	lookup (request, NOW + 9, FH_CACHE_HIT);
+	lookup (request, NOW + 10, FH_CACHE_STALE);
+	lookup (request, NOW + 29, FH_CACHE_STALE);
+
+	/* One stale hit revalidates, the others keep getting the old one */
+	struct fh_cache_req *first = lookup (request, NOW + 15, FH_CACHE_STALE);
+	struct fh_cache_req *second = lookup (request, NOW + 15, FH_CACHE_STALE);
+
+	assert (fh_cache_lock (first, NOW + 15));
+	assert (!fh_cache_lock (second, NOW + 15));
+	fh_cache_finish (first, false);
+
+	assert (store (request, NOW + 15, "Cache-Control", "max-age=10"));
+	lookup (request, NOW + 24, FH_CACHE_HIT);
+	lookup (request, NOW + 25, FH_CACHE_MISS);
+
+	/* Without the directive, nothing is served stale */
+	request = make_request (FH_METHOD_GET, "/no-swr", NULL, NULL);
+	assert (store (request, NOW, "Cache-Control", "max-age=10"));
+	lookup (request, NOW + 10, FH_CACHE_MISS);
+}
+
+static void
+test_vary (void)
+{
+	const struct fh_request *gzip
+		= make_request (FH_METHOD_GET, "/vary", "Accept-Encoding", "gzip");
+	const struct fh_request *br
+		= make_request (FH_METHOD_GET, "/vary", "Accept-Encoding", "br");
+	const struct fh_request *none
+		= make_request (FH_METHOD_GET, "/vary", NULL, NULL);
+
+	assert (store (gzip, NOW, "Vary", "Accept-Encoding, X-Unused"));
+
+	/* The key has the lowercased names, and the values of this request */
+	struct fh_cache_req *req = lookup (gzip, NOW + 1, FH_CACHE_HIT);
+	const char key[] = "GET http://localhost/vary\n"
+					   "accept-encoding: gzip\n"
+					   "x-unused: ";
+
+	assert (req->key_len == sizeof key - 1);
+	assert (!memcmp (req->key, key, sizeof key - 1));
+
+	/* Other values are other entries */
+	lookup (br, NOW + 1, FH_CACHE_MISS);
+	lookup (none, NOW + 1, FH_CACHE_MISS);
+	assert (store (br, NOW + 1, "Vary", "accept-encoding, x-unused"));
+	lookup (br, NOW + 2, FH_CACHE_HIT);
+	lookup (gzip, NOW + 2, FH_CACHE_HIT);
+
+	/* Locks are per variant */
+	struct fh_cache_req *first = lookup (none, NOW + 2, FH_CACHE_MISS);
+	struct fh_cache_req *second = lookup (gzip, NOW + 2, FH_CACHE_HIT);
+
+	assert (fh_cache_lock (first, NOW + 2));
+	assert (fh_cache_lock (second, NOW + 2));
+	fh_cache_finish (first, false);
+	fh_cache_finish (second, false);
+
+	/* Vary: * cannot be cached */
+	const struct fh_request *star
+		= make_request (FH_METHOD_GET, "/star", NULL, NULL);
+
+	assert (!store (star, NOW, "Vary", "*"));
+	lookup (star, NOW, FH_CACHE_PASS);
+}
+
+static void
+test_collapsed_forwarding (void)
+{
+	const struct fh_request *request
+		= make_request (FH_METHOD_GET, "/collapse", NULL, NULL);
+	struct fh_cache_req *first = lookup (request, NOW, FH_CACHE_MISS);
+	struct fh_cache_req *second = lookup (request, NOW, FH_CACHE_MISS);
+
+	/* One miss fetches, the others wait until it is done */
+	assert (fh_cache_lock (first, NOW));
+	assert (fh_cache_lock (first, NOW));
+	assert (!fh_cache_lock (second, NOW));
+	assert (!fh_cache_lock (second, NOW + FH_CACHE_LOCK_TIMEOUT - 1));
+
+	/* Giving up releases the lock */
+	fh_cache_finish (first, false);
+	lookup (request, NOW, FH_CACHE_MISS);
+	assert (fh_cache_lock (second, NOW));
+
+	/* A fetch that takes too long loses the lock to a waiting request */
+	first = lookup (request, NOW, FH_CACHE_MISS);
+	assert (!fh_cache_lock (first, NOW + FH_CACHE_LOCK_TIMEOUT - 1));
+	assert (fh_cache_lock (first, NOW + FH_CACHE_LOCK_TIMEOUT));
+	fh_cache_finish (first, false);
+	fh_cache_finish (second, false);
+
+	/* Waiting requests find the response once it is stored */
+	second = lookup (request, NOW, FH_CACHE_MISS);
+	assert (store (request, NOW, "Cache-Control", "max-age=10"));
+	assert (fh_cache_lookup (second, NOW + 1) == FH_CACHE_HIT);
+
+	/* After a response that cannot be cached, nobody waits for the next
+	   one, and nobody fetches it alone */
+	request = make_request (FH_METHOD_GET, "/uncacheable", NULL, NULL);
+	second = lookup (request, NOW, FH_CACHE_MISS);
+	assert (!store (request, NOW, "Cache-Control", "no-store"));
+	assert (fh_cache_lookup (second, NOW) == FH_CACHE_PASS);
+}
+
+int
+main (void)
+{
+	char dir[] = "/tmp/fhcache.XXXXXX";
+	struct fh_config_cache cache_config = {
+		.index_size = 1 << 20,
+		.max_entry_size = 1 << 20,
+	};
+	struct fh_config_host host = { .proxies = &proxy };
+	struct fh_config config = { .cache = &cache_config };
+
+	assert (mkdtemp (dir) != NULL);
+	cache_config.path = dir;
+	config.hosts = strtable_create (4);
+	assert (config.hosts && strtable_set (config.hosts, "localhost", &host));
+	assert (fh_cache_shared_init (&config));
+	assert ((pool = fh_pool_create (4096)) != NULL);
+
+	test_freshness ();
+	test_stale_while_revalidate ();
+	test_vary ();
+	test_collapsed_forwarding ();
+
+	fh_pool_destroy (pool);
+	fh_cache_shared_destroy ();
+	strtable_destroy (config.hosts);
+
+	char cmd[64];
+	snprintf (cmd, sizeof cmd, "rm -rf %s", dir);
+	assert (system (cmd) == 0);
+	return 0;
+}
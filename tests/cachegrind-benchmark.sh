@@ -0,0 +1,205 @@
+#!/bin/sh
+#
+# This file is part of OSN freehttpd.
+#
+# Copyright (C) 2025  OSN Developers.
+#
+# OSN freehttpd is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# OSN freehttpd is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+
+# Replays a fixed corpus of requests under cachegrind, and reports the
+# instructions and last-level cache misses per request of each phase of
+# request processing, which are the same from run to run unlike times.
+# The server runs a single worker, from a configuration that includes
+# FHTTPD_CONFIG and sets worker_count, and only the profile of that
+# worker is counted. A phase that costs more than CG_TOLERANCE percent
+# over the baseline fails the run, and so does a baseline that has not
+# been recorded yet with CG_UPDATE_BASELINE=1.
+
+if [ -z "$BINDIR" ]; then
+    BINDIR=../build/bin
+fi
+
+srcdir=$(dirname "$0")
+VALGRIND=${VALGRIND:-$srcdir/../build-aux/valgrind}
+FHBENCH=${FHBENCH:-./fhbench}
+BENCH_URL=${BENCH_URL:-http://localhost:8080}
+CG_CORPUS=${CG_CORPUS:-$srcdir/cachegrind/corpus.txt}
+CG_BASELINE=${CG_BASELINE:-$srcdir/cachegrind/baseline.txt}
+CG_CONFIG=${CG_CONFIG:-cachegrind.conf}
+CG_ROUNDS=${CG_ROUNDS:-20}
+CG_TOLERANCE=${CG_TOLERANCE:-2}
+
+if [ -z "$FHTTPD_CONFIG" ]; then
+    echo "FHTTPD_CONFIG must name the configuration file to run" >&2
+    exit 1
+fi
+
+. "$srcdir/bench-fixtures.sh"
+
+urls=$(grep -v '^#' "$CG_CORPUS" | sed "s|^|$BENCH_URL|")
+requests=$(($(echo "$urls" | wc -l) * CG_ROUNDS))
+pid=
+
+trap 'test -n "$pid" && kill -9 $pid > /dev/null 2>&1' EXIT
+trap "exit 1" INT TERM
+
+printf 'include "%s";\nworker_count = 1;\n' "$FHTTPD_CONFIG" > "$CG_CONFIG"
+rm -f cachegrind.corpus.*
+
+echo "Profiling $requests requests..."
+CACHEGRIND_OUT=cachegrind.corpus "$VALGRIND" --cachegrind \
+    "$BINDIR/freehttpd" --config="$CG_CONFIG" \
+    > freehttpd-cachegrind.log 2>&1 &
+pid=$!
+tries=0
+
+until "$FHBENCH" -c 1 -t 1 -n 1 -d 1 "$BENCH_URL/" > /dev/null 2>&1; do
+    tries=$((tries + 1))
+
+    if [ $tries -ge 120 ] || ! kill -0 $pid > /dev/null 2>&1; then
+        echo "freehttpd failed to start" >&2
+        tail -n100 freehttpd-cachegrind.log >&2
+        exit 1
+    fi
+
+    sleep 1
+done
+
+if ! "$FHBENCH" -c 1 -t 1 -n "$requests" -d 3600 $urls \
+    > bench-cachegrind.json; then
+    echo "Replaying the corpus failed" >&2
+    exit 1
+fi
+
+# The worker first, as the master only notices when it has exited
+pkill -TERM -P $pid
+kill -TERM $pid 2> /dev/null
+wait $pid
+
+# The profile of the master is named after the pid that was started
+worker=$(ls cachegrind.corpus.* | grep -v "\.$pid\$")
+pid=
+
+if [ -z "$worker" ] || [ "$(echo "$worker" | wc -l)" -ne 1 ]; then
+    echo "Expected the profile of one worker, found: $worker" >&2
+    exit 1
+fi
+
+# Counts the profile by phase, per request: "phase Ir LL" per line. The
+# worker also answered the request that waited for it to start, and its
+# own startup and shutdown are spread over the requests, which costs the
+# same in every run of a build.
+awk -v requests="$((requests + 1))" '
+    function phase (file)
+    {
+        if (file ~ /\/http\/http1_request\.c$/)
+            return "parse"
+        if (file ~ /\/(router|modules)\//)
+            return "handler"
+        if (file ~ /\/http\//)
+            return "response"
+        if (file ~ /\/(event|core)\//)
+            return "event"
+        if (file ~ /\/(mm|hash)\//)
+            return "memory"
+        if (file ~ /\/(utils|digest|log)\//)
+            return "other"
+        return "external"
+    }
+
+    /^events:/ {
+        for (i = 2; i <= NF; i++)
+            col[$i] = i
+        next
+    }
+
+    /^fl=/ {
+        current = phase(substr($0, 4))
+        next
+    }
+
+    /^[0-9]/ {
+        ll = $(col["ILmr"]) + $(col["DLmr"]) + $(col["DLmw"])
+        ir[current] += $(col["Ir"])
+        misses[current] += ll
+        ir["total"] += $(col["Ir"])
+        misses["total"] += ll
+    }
+
+    END {
+        for (p in ir)
+            printf "%s %.1f %.2f\n", p, ir[p] / requests,
+                   misses[p] / requests
+    }' $worker | sort > cachegrind.txt
+
+if [ -n "$CG_UPDATE_BASELINE" ]; then
+    grep '^#' "$CG_BASELINE" > cachegrind-baseline.tmp
+    cat cachegrind.txt >> cachegrind-baseline.tmp
+    mv cachegrind-baseline.tmp "$CG_BASELINE"
+    echo "Updated $CG_BASELINE"
+fi
+
+# Prints every phase against its baseline, and fails on regressions and
+# on phases that the baseline does not have
+awk -v tolerance="$CG_TOLERANCE" '
+    FNR == NR {
+        if ($0 !~ /^#/ && NF == 3)
+        {
+            base_ir[$1] = $2
+            base_ll[$1] = $3
+        }
+        next
+    }
+
+    function delta (now, base)
+    {
+        return base > 0 ? (now - base) * 100 / base : 0
+    }
+
+    {
+        printf "%-10s %12.1f Ir/req", $1, $2
+
+        if (!($1 in base_ir))
+        {
+            printf " %8.2f LL/req (no baseline)\n", $3
+            missing = 1
+            next
+        }
+
+        printf " (%+.2f%%) %8.2f LL/req (%+.2f%%)\n", delta($2, base_ir[$1]),
+               $3, delta($3, base_ll[$1])
+
+        # Less than a miss per request is too few for a percentage
+        if (delta($2, base_ir[$1]) > tolerance \
+            || (base_ll[$1] >= 1 && delta($3, base_ll[$1]) > tolerance))
+            failed = 1
+    }
+
+    END { exit missing ? 2 : failed }' "$CG_BASELINE" cachegrind.txt
+
+case $? in
+    0)
+        ;;
+    2)
+        echo "$CG_BASELINE has no counts to compare with; record them" \
+             "for this toolchain with CG_UPDATE_BASELINE=1" >&2
+        exit 1
+        ;;
+    *)
+        echo "Instruction counts regressed by more than $CG_TOLERANCE%" >&2
+        exit 1
+        ;;
+esac
+
+echo "Results are in cachegrind.txt, the profile in $worker"
@@ -0,0 +1,1119 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* An HTTP/1.1 load generator.  Each thread drives its share of the
+   connections from its own epoll instance, keeps up to `pipeline'
+   requests in flight on each, and reports throughput and latency
+   percentiles as JSON.  With a rate, requests are scheduled ahead of
+   time and their latency counts from when they were due, so that a slow
+   server cannot hide its queueing delay.  Run `make check-benchmark'
+   for the standard scenarios.  */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "utils/histogram.h"
+
+#define BENCH_IN_SIZE 65536
+#define BENCH_MAX_EVENTS 256
+/* Open-loop requests that may wait for a free connection per thread */
+#define BENCH_BACKLOG_SIZE 65536
+/* After a failed connect() */
+#define BENCH_RETRY_DELAY 100000
+#define BENCH_STATUS_CLASSES 6
+
+enum bench_state
+{
+	BENCH_STATE_HEAD,
+	BENCH_STATE_LENGTH,
+	BENCH_STATE_CHUNK_SIZE,
+	BENCH_STATE_CHUNK_DATA,
+	BENCH_STATE_CHUNK_END,
+	BENCH_STATE_TRAILERS,
+	BENCH_STATE_UNTIL_CLOSE
+};
+
+struct bench_url
+{
+	const char *url;
+	char *request;
+	size_t request_len;
+};
+
+struct bench_config
+{
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	struct bench_url *urls;
+	size_t url_count;
+	/* Indices into urls, each as often as its weight */
+	size_t *schedule;
+	size_t schedule_len;
+
+	size_t connections;
+	size_t threads;
+	size_t pipeline;
+	double rate;
+	double duration;
+	uint64_t requests;
+	bool close;
+};
+
+struct bench_inflight
+{
+	size_t url;
+	uint64_t start;
+};
+
+struct bench_thread;
+
+struct bench_conn
+{
+	struct bench_thread *thread;
+	int fd;
+	bool connected;
+	uint64_t retry_at;
+	size_t cursor;
+
+	/* Requests written or about to be, oldest first */
+	struct bench_inflight *inflight;
+	size_t inflight_head, inflight_count;
+
+	char *out;
+	size_t out_len, out_off, out_cap;
+
+	char *in;
+	size_t in_len;
+	enum bench_state state;
+	uint64_t remaining;
+	unsigned int status;
+	bool close_after;
+	/* Part of the current response came in */
+	bool receiving;
+};
+
+struct bench_thread
+{
+	pthread_t tid;
+	const struct bench_config *config;
+	int epfd;
+	struct bench_conn *conns;
+	size_t conn_count;
+
+	uint64_t quota;
+	uint64_t issued;
+
+	/* Open loop only */
+	uint64_t interval;
+	uint64_t next_due;
+	uint64_t *backlog;
+	size_t backlog_head, backlog_count;
+
+	struct fh_histogram latency;
+	uint64_t completed;
+	uint64_t status[BENCH_STATUS_CLASSES];
+	uint64_t bytes;
+	uint64_t connects;
+	uint64_t connect_errors;
+	uint64_t read_errors;
+	uint64_t parse_errors;
+	uint64_t overload;
+};
+
+static volatile int bench_stop = 0;
+
+static uint64_t
+bench_now (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+static bool
+bench_stopped (void)
+{
+	return __atomic_load_n (&bench_stop, __ATOMIC_RELAXED);
+}
+
+static bool
+bench_done (const struct bench_thread *thread)
+{
+	return thread->quota && thread->completed >= thread->quota;
+}
+
+/* Whether another request may be issued now, and when it is due */
+static bool
+bench_next_request (struct bench_thread *thread, uint64_t *start)
+{
+	if (thread->quota && thread->issued >= thread->quota)
+		return false;
+
+	if (!thread->interval)
+	{
+		*start = bench_now ();
+		return true;
+	}
+
+	if (!thread->backlog_count)
+		return false;
+
+	*start = thread->backlog[thread->backlog_head];
+	thread->backlog_head = (thread->backlog_head + 1) % BENCH_BACKLOG_SIZE;
+	thread->backlog_count--;
+	return true;
+}
+
+static bool
+bench_out_append (struct bench_conn *conn, const char *data, size_t len)
+{
+	if (conn->out_len + len > conn->out_cap)
+	{
+		size_t cap = conn->out_cap ? conn->out_cap : 4096;
+
+		while (cap < conn->out_len + len)
+			cap *= 2;
+
+		char *out = realloc (conn->out, cap);
+
+		if (!out)
+			return false;
+
+		conn->out = out;
+		conn->out_cap = cap;
+	}
+
+	memcpy (conn->out + conn->out_len, data, len);
+	conn->out_len += len;
+	return true;
+}
+
+/* Fills the pipeline of the connection.  */
+static bool
+bench_conn_fill (struct bench_conn *conn)
+{
+	struct bench_thread *thread = conn->thread;
+	const struct bench_config *config = thread->config;
+	uint64_t start;
+
+	while (conn->inflight_count < config->pipeline
+		   && bench_next_request (thread, &start))
+	{
+		const size_t url = config->schedule[conn->cursor];
+		const size_t tail = (conn->inflight_head + conn->inflight_count)
+							% config->pipeline;
+
+		conn->cursor = (conn->cursor + 1) % config->schedule_len;
+		conn->inflight[tail].url = url;
+		conn->inflight[tail].start = start;
+		conn->inflight_count++;
+		thread->issued++;
+
+		if (!bench_out_append (conn, config->urls[url].request,
+							   config->urls[url].request_len))
+			return false;
+	}
+
+	return true;
+}
+
+static bool
+bench_conn_flush (struct bench_conn *conn)
+{
+	while (conn->out_off < conn->out_len)
+	{
+		ssize_t n = send (conn->fd, conn->out + conn->out_off,
+						  conn->out_len - conn->out_off, MSG_NOSIGNAL);
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+
+		conn->out_off += (size_t) n;
+	}
+
+	conn->out_off = conn->out_len = 0;
+	return true;
+}
+
+static void
+bench_conn_connect (struct bench_conn *conn)
+{
+	struct bench_thread *thread = conn->thread;
+	const struct bench_config *config = thread->config;
+	const int one = 1;
+
+	conn->fd = socket (config->addr.ss_family,
+					   SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+	if (conn->fd < 0)
+		goto fail;
+
+	setsockopt (conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+
+	if (connect (conn->fd, (const struct sockaddr *) &config->addr,
+				 config->addr_len)
+			< 0
+		&& errno != EINPROGRESS)
+		goto fail;
+
+	struct epoll_event ev = {
+		.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP,
+		.data.ptr = conn,
+	};
+
+	if (epoll_ctl (thread->epfd, EPOLL_CTL_ADD, conn->fd, &ev) < 0)
+		goto fail;
+
+	thread->connects++;
+	conn->connected = false;
+	return;
+
+fail:
+	thread->connect_errors++;
+
+	if (conn->fd >= 0)
+		close (conn->fd);
+
+	conn->fd = -1;
+	conn->retry_at = bench_now () + BENCH_RETRY_DELAY;
+}
+
+/* Closes the connection and opens another one.  Requests without a
+   response are sent again, keeping their start time, unless the
+   response to the first of them was cut short.  */
+static void
+bench_conn_reset (struct bench_conn *conn, bool failed)
+{
+	struct bench_thread *thread = conn->thread;
+	const struct bench_config *config = thread->config;
+
+	if (conn->fd >= 0)
+		close (conn->fd);
+
+	conn->fd = -1;
+
+	if (failed && conn->inflight_count)
+	{
+		thread->read_errors++;
+		conn->inflight_head = (conn->inflight_head + 1) % config->pipeline;
+		conn->inflight_count--;
+	}
+
+	conn->out_len = conn->out_off = 0;
+	conn->in_len = 0;
+	conn->state = BENCH_STATE_HEAD;
+	conn->receiving = false;
+	conn->close_after = false;
+
+	for (size_t i = 0; i < conn->inflight_count; i++)
+	{
+		const struct bench_inflight *req
+			= &conn->inflight[(conn->inflight_head + i) % config->pipeline];
+
+		bench_out_append (conn, config->urls[req->url].request,
+						  config->urls[req->url].request_len);
+	}
+
+	if (!bench_stopped ())
+		bench_conn_connect (conn);
+}
+
+static bool
+bench_header_is (const char *line, size_t len, const char *name)
+{
+	const size_t name_len = strlen (name);
+
+	return len > name_len && line[name_len] == ':'
+		   && !strncasecmp (line, name, name_len);
+}
+
+static bool
+bench_header_has (const char *line, size_t len, const char *token)
+{
+	return memmem (line, len, token, strlen (token)) != NULL;
+}
+
+/* Parses the status line and headers in the first `len' bytes.  */
+static bool
+bench_parse_head (struct bench_conn *conn, size_t len)
+{
+	const char *p = conn->in;
+	const char *end = conn->in + len;
+
+	if (len < 12 || memcmp (p, "HTTP/1.", 7) || p[8] != ' ')
+		return false;
+
+	conn->status = (unsigned int) (p[9] - '0') * 100
+				   + (unsigned int) (p[10] - '0') * 10
+				   + (unsigned int) (p[11] - '0');
+	conn->close_after = p[7] == '0';
+
+	bool chunked = false, have_length = false;
+	uint64_t length = 0;
+
+	for (p = (const char *) memchr (p, '\n', (size_t) (end - p)) + 1; p < end;)
+	{
+		const char *eol = memchr (p, '\n', (size_t) (end - p));
+		const size_t line_len
+			= (size_t) (eol - p) - (eol > p && eol[-1] == '\r');
+
+		if (bench_header_is (p, line_len, "Content-Length"))
+		{
+			have_length = true;
+			length = strtoull (p + 15, NULL, 10);
+		}
+		else if (bench_header_is (p, line_len, "Transfer-Encoding"))
+			chunked = bench_header_has (p, line_len, "chunked");
+		else if (bench_header_is (p, line_len, "Connection"))
+		{
+			if (bench_header_has (p, line_len, "close"))
+				conn->close_after = true;
+			else if (bench_header_has (p, line_len, "keep-alive"))
+				conn->close_after = false;
+		}
+
+		p = eol + 1;
+	}
+
+	if (conn->status == 204 || conn->status == 304 || conn->status < 200)
+		conn->state = BENCH_STATE_LENGTH, conn->remaining = 0;
+	else if (chunked)
+		conn->state = BENCH_STATE_CHUNK_SIZE;
+	else if (have_length)
+		conn->state = BENCH_STATE_LENGTH, conn->remaining = length;
+	else
+		conn->state = BENCH_STATE_UNTIL_CLOSE;
+
+	return true;
+}
+
+static void
+bench_complete (struct bench_conn *conn)
+{
+	struct bench_thread *thread = conn->thread;
+	const struct bench_config *config = thread->config;
+	const struct bench_inflight *req = &conn->inflight[conn->inflight_head];
+	const unsigned int class = conn->status / 100;
+
+	fh_histogram_record (&thread->latency, bench_now () - req->start);
+	thread->status[class < BENCH_STATUS_CLASSES ? class : 0]++;
+	thread->completed++;
+
+	conn->inflight_head = (conn->inflight_head + 1) % config->pipeline;
+	conn->inflight_count--;
+	conn->state = BENCH_STATE_HEAD;
+	conn->receiving = false;
+}
+
+/* Consumes what is in the input buffer.  Returns 1 when a response that
+   ends the connection is complete, -1 on malformed responses.  */
+static int
+bench_conn_parse (struct bench_conn *conn)
+{
+	size_t off = 0;
+
+	while (off < conn->in_len)
+	{
+		char *data = conn->in + off;
+		const size_t avail = conn->in_len - off;
+		char *eol;
+
+		if (!conn->inflight_count)
+			return -1;
+
+		conn->receiving = true;
+
+		switch (conn->state)
+		{
+			case BENCH_STATE_HEAD:
+			{
+				char *head_end = memmem (data, avail, "\r\n\r\n", 4);
+
+				if (!head_end)
+				{
+					if (avail == BENCH_IN_SIZE)
+						return -1;
+
+					goto partial;
+				}
+
+				if (off)
+				{
+					memmove (conn->in, data, avail);
+					conn->in_len = avail;
+					off = 0;
+					head_end = conn->in + (head_end - data);
+				}
+
+				if (!bench_parse_head (conn,
+									   (size_t) (head_end - conn->in) + 2))
+					return -1;
+
+				off = (size_t) (head_end - conn->in) + 4;
+				break;
+			}
+
+			case BENCH_STATE_LENGTH:
+			{
+				const size_t n
+					= conn->remaining < avail ? conn->remaining : avail;
+
+				conn->remaining -= n;
+				off += n;
+				break;
+			}
+
+			case BENCH_STATE_CHUNK_SIZE:
+				if (!(eol = memmem (data, avail, "\r\n", 2)))
+					goto partial;
+
+				conn->remaining = strtoull (data, NULL, 16);
+				conn->state = conn->remaining ? BENCH_STATE_CHUNK_DATA
+											  : BENCH_STATE_TRAILERS;
+				off += (size_t) (eol - data) + 2;
+				continue;
+
+			case BENCH_STATE_CHUNK_DATA:
+			{
+				const size_t n
+					= conn->remaining < avail ? conn->remaining : avail;
+
+				conn->remaining -= n;
+				off += n;
+
+				if (!conn->remaining)
+					conn->state = BENCH_STATE_CHUNK_END;
+
+				continue;
+			}
+
+			case BENCH_STATE_CHUNK_END:
+				if (avail < 2)
+					goto partial;
+
+				if (memcmp (data, "\r\n", 2))
+					return -1;
+
+				conn->state = BENCH_STATE_CHUNK_SIZE;
+				off += 2;
+				continue;
+
+			case BENCH_STATE_TRAILERS:
+				if (!(eol = memmem (data, avail, "\r\n", 2)))
+					goto partial;
+
+				off += (size_t) (eol - data) + 2;
+
+				if (eol != data)
+					continue;
+
+				conn->state = BENCH_STATE_LENGTH;
+				conn->remaining = 0;
+				break;
+
+			case BENCH_STATE_UNTIL_CLOSE:
+				off = conn->in_len;
+				continue;
+		}
+
+		if (conn->state == BENCH_STATE_LENGTH && !conn->remaining)
+		{
+			const bool close_after = conn->close_after;
+
+			bench_complete (conn);
+
+			if (close_after)
+				return 1;
+		}
+	}
+
+	conn->in_len = 0;
+
+	/* A response with an empty body may not be followed by any data.  */
+	if (conn->state == BENCH_STATE_LENGTH && !conn->remaining
+		&& conn->receiving)
+	{
+		const bool close_after = conn->close_after;
+
+		bench_complete (conn);
+		return close_after;
+	}
+
+	return 0;
+
+partial:
+	memmove (conn->in, conn->in + off, conn->in_len - off);
+	conn->in_len -= off;
+	return 0;
+}
+
+static void
+bench_conn_read (struct bench_conn *conn)
+{
+	struct bench_thread *thread = conn->thread;
+
+	for (;;)
+	{
+		ssize_t n = recv (conn->fd, conn->in + conn->in_len,
+						  BENCH_IN_SIZE - conn->in_len, 0);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+
+		if (n <= 0)
+		{
+			/* The body ends with the connection */
+			if (n == 0 && conn->state == BENCH_STATE_UNTIL_CLOSE)
+			{
+				bench_complete (conn);
+				bench_conn_reset (conn, false);
+			}
+			else
+				bench_conn_reset (conn, n < 0 || conn->receiving);
+
+			return;
+		}
+
+		thread->bytes += (uint64_t) n;
+		conn->in_len += (size_t) n;
+
+		int rc = bench_conn_parse (conn);
+
+		if (rc < 0)
+		{
+			thread->parse_errors++;
+			bench_conn_reset (conn, false);
+			return;
+		}
+
+		if (rc > 0)
+		{
+			bench_conn_reset (conn, false);
+			return;
+		}
+
+		if (!bench_conn_fill (conn) || !bench_conn_flush (conn))
+		{
+			bench_conn_reset (conn, true);
+			return;
+		}
+	}
+}
+
+static void
+bench_conn_writable (struct bench_conn *conn)
+{
+	if (!conn->connected)
+	{
+		int err = 0;
+		socklen_t len = sizeof (err);
+
+		getsockopt (conn->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+
+		if (err)
+		{
+			conn->thread->connect_errors++;
+			close (conn->fd);
+			conn->fd = -1;
+			conn->retry_at = bench_now () + BENCH_RETRY_DELAY;
+			return;
+		}
+
+		conn->connected = true;
+	}
+
+	if (!bench_conn_fill (conn) || !bench_conn_flush (conn))
+		bench_conn_reset (conn, true);
+}
+
+/* Queues the open-loop requests that are due by now.  */
+static void
+bench_schedule (struct bench_thread *thread, uint64_t now)
+{
+	while (thread->next_due <= now)
+	{
+		if (thread->backlog_count == BENCH_BACKLOG_SIZE)
+			thread->overload++;
+		else
+		{
+			const size_t tail = (thread->backlog_head + thread->backlog_count)
+								% BENCH_BACKLOG_SIZE;
+
+			thread->backlog[tail] = thread->next_due;
+			thread->backlog_count++;
+		}
+
+		thread->next_due += thread->interval;
+	}
+}
+
+static void *
+bench_thread_run (void *data)
+{
+	struct bench_thread *thread = data;
+	struct epoll_event events[BENCH_MAX_EVENTS];
+
+	thread->next_due = bench_now ();
+
+	for (size_t i = 0; i < thread->conn_count; i++)
+		bench_conn_connect (&thread->conns[i]);
+
+	while (!bench_stopped () && !bench_done (thread))
+	{
+		uint64_t now = bench_now ();
+		int timeout = 10;
+
+		if (thread->interval)
+		{
+			bench_schedule (thread, now);
+
+			for (size_t i = 0; i < thread->conn_count; i++)
+			{
+				struct bench_conn *conn = &thread->conns[i];
+
+				if (conn->fd >= 0 && conn->connected
+					&& (!bench_conn_fill (conn) || !bench_conn_flush (conn)))
+					bench_conn_reset (conn, true);
+			}
+
+			now = bench_now ();
+
+			if (thread->next_due > now)
+			{
+				const uint64_t wait = (thread->next_due - now) / 1000;
+
+				timeout = wait < (uint64_t) timeout ? (int) wait : timeout;
+			}
+			else
+				timeout = 0;
+		}
+
+		for (size_t i = 0; i < thread->conn_count; i++)
+		{
+			struct bench_conn *conn = &thread->conns[i];
+
+			if (conn->fd < 0 && conn->retry_at <= now)
+				bench_conn_connect (conn);
+		}
+
+		int n = epoll_wait (thread->epfd, events, BENCH_MAX_EVENTS, timeout);
+
+		for (int i = 0; i < n; i++)
+		{
+			struct bench_conn *conn = events[i].data.ptr;
+			const int fd = conn->fd;
+
+			if (events[i].events & EPOLLOUT)
+				bench_conn_writable (conn);
+
+			if (conn->fd == fd && conn->fd >= 0 && conn->connected
+				&& events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))
+				bench_conn_read (conn);
+		}
+	}
+
+	for (size_t i = 0; i < thread->conn_count; i++)
+	{
+		if (thread->conns[i].fd >= 0)
+			close (thread->conns[i].fd);
+	}
+
+	return NULL;
+}
+
+static bool
+bench_add_url (struct bench_config *config, char *arg, size_t index)
+{
+	struct bench_url *url = &config->urls[index];
+	char *weight_str = strrchr (arg, '#');
+	unsigned long weight = 1;
+
+	if (weight_str)
+	{
+		*weight_str++ = 0;
+		weight = strtoul (weight_str, NULL, 10);
+
+		if (!weight)
+		{
+			fprintf (stderr, "fhbench: invalid weight: %s\n", weight_str);
+			return false;
+		}
+	}
+
+	if (strncmp (arg, "http://", 7))
+	{
+		fprintf (stderr, "fhbench: only http:// URLs are supported: %s\n",
+				 arg);
+		return false;
+	}
+
+	char *authority = arg + 7;
+	char *path = strchr (authority, '/');
+	const size_t authority_len
+		= path ? (size_t) (path - authority) : strlen (authority);
+	char host[256], port[16] = "80";
+
+	if (authority_len >= sizeof (host))
+		return false;
+
+	memcpy (host, authority, authority_len);
+	host[authority_len] = 0;
+
+	char *colon = strrchr (host, ':');
+
+	if (colon)
+	{
+		*colon = 0;
+		snprintf (port, sizeof (port), "%s", colon + 1);
+	}
+
+	if (!index)
+	{
+		struct addrinfo hints = {
+			.ai_family = AF_UNSPEC,
+			.ai_socktype = SOCK_STREAM,
+		};
+		struct addrinfo *res;
+		int rc = getaddrinfo (host, port, &hints, &res);
+
+		if (rc)
+		{
+			fprintf (stderr, "fhbench: %s: %s\n", host, gai_strerror (rc));
+			return false;
+		}
+
+		memcpy (&config->addr, res->ai_addr, res->ai_addrlen);
+		config->addr_len = res->ai_addrlen;
+		freeaddrinfo (res);
+	}
+
+	const int len = asprintf (
+		&url->request,
+		"GET %s HTTP/1.1\r\nHost: %.*s\r\nUser-Agent: fhbench\r\n"
+		"Accept: */*\r\n%s\r\n",
+		path ? path : "/", (int) authority_len, authority,
+		config->close ? "Connection: close\r\n" : "");
+
+	if (len < 0)
+		return false;
+
+	url->url = arg;
+	url->request_len = (size_t) len;
+
+	size_t *schedule = realloc (config->schedule,
+								(config->schedule_len + weight)
+									* sizeof (*schedule));
+
+	if (!schedule)
+		return false;
+
+	for (size_t i = 0; i < weight; i++)
+		schedule[config->schedule_len++] = index;
+
+	config->schedule = schedule;
+	return true;
+}
+
+static void
+bench_report (const struct bench_config *config,
+			  const struct bench_thread *threads, double elapsed)
+{
+	static struct fh_histogram latency;
+	uint64_t status[BENCH_STATUS_CLASSES] = { 0 };
+	uint64_t completed = 0, bytes = 0, connects = 0, connect_errors = 0,
+			 read_errors = 0, parse_errors = 0, overload = 0;
+
+	for (size_t i = 0; i < config->threads; i++)
+	{
+		const struct bench_thread *t = &threads[i];
+
+		fh_histogram_merge (&latency, &t->latency);
+		completed += t->completed;
+		bytes += t->bytes;
+		connects += t->connects;
+		connect_errors += t->connect_errors;
+		read_errors += t->read_errors;
+		parse_errors += t->parse_errors;
+		overload += t->overload;
+
+		for (size_t j = 0; j < BENCH_STATUS_CLASSES; j++)
+			status[j] += t->status[j];
+	}
+
+	printf ("{\n  \"urls\": [");
+
+	for (size_t i = 0; i < config->url_count; i++)
+		printf ("%s\"%s\"", i ? ", " : "", config->urls[i].url);
+
+	printf ("],\n"
+			"  \"connections\": %zu,\n"
+			"  \"threads\": %zu,\n"
+			"  \"pipeline\": %zu,\n"
+			"  \"rate\": %.1f,\n"
+			"  \"duration\": %.3f,\n"
+			"  \"requests\": %lu,\n"
+			"  \"throughput\": %.1f,\n"
+			"  \"bytes\": %lu,\n"
+			"  \"transfer_rate\": %.1f,\n"
+			"  \"connects\": %lu,\n",
+			config->connections, config->threads, config->pipeline,
+			config->rate, elapsed, completed, (double) completed / elapsed,
+			bytes, (double) bytes / elapsed, connects);
+	printf ("  \"status\": {\"1xx\": %lu, \"2xx\": %lu, \"3xx\": %lu, "
+			"\"4xx\": %lu, \"5xx\": %lu, \"other\": %lu},\n",
+			status[1], status[2], status[3], status[4], status[5], status[0]);
+	printf ("  \"errors\": {\"connect\": %lu, \"read\": %lu, \"parse\": %lu, "
+			"\"overload\": %lu},\n",
+			connect_errors, read_errors, parse_errors, overload);
+	printf ("  \"latency_us\": {\"mean\": %.1f, \"p50\": %lu, \"p90\": %lu, "
+			"\"p99\": %lu, \"p99.9\": %lu, \"max\": %lu}\n}\n",
+			latency.count ? (double) latency.sum / (double) latency.count
+						  : 0.0,
+			fh_histogram_percentile (&latency, 0.5),
+			fh_histogram_percentile (&latency, 0.9),
+			fh_histogram_percentile (&latency, 0.99),
+			fh_histogram_percentile (&latency, 0.999), latency.max);
+}
+
+static void
+usage (const char *name)
+{
+	printf ("Usage: %s [options] URL[#weight]...\n\n"
+			"Options:\n"
+			"  -c, --connections N  Open connections (default: 50)\n"
+			"  -t, --threads N      Threads (default: one per CPU)\n"
+			"  -d, --duration SEC   How long to run (default: 10)\n"
+			"  -n, --requests N     Stop after N responses\n"
+			"  -p, --pipeline N     Requests in flight per connection "
+			"(default: 1)\n"
+			"  -r, --rate N         Requests per second, scheduled whether "
+			"or not\n"
+			"                       responses came in (default: as fast as "
+			"they do)\n"
+			"      --close          Ask for a new connection per request\n"
+			"  -h, --help           Print this help and exit\n\n"
+			"URLs are requested in turn, each as often as its weight.\n",
+			name);
+}
+
+int
+main (int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "connections", required_argument, 0, 'c' },
+		{ "threads", required_argument, 0, 't' },
+		{ "duration", required_argument, 0, 'd' },
+		{ "requests", required_argument, 0, 'n' },
+		{ "pipeline", required_argument, 0, 'p' },
+		{ "rate", required_argument, 0, 'r' },
+		{ "close", no_argument, 0, 'C' },
+		{ "help", no_argument, 0, 'h' },
+		{ 0, 0, 0, 0 },
+	};
+	struct bench_config config = {
+		.connections = 50,
+		.pipeline = 1,
+		.duration = 10,
+	};
+	long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+	int opt;
+
+	config.threads = cpus > 0 ? (size_t) cpus : 1;
+
+	while ((opt = getopt_long (argc, argv, "c:t:d:n:p:r:h", long_options,
+							   NULL))
+		   != -1)
+	{
+		switch (opt)
+		{
+			case 'c':
+				config.connections = strtoul (optarg, NULL, 10);
+				break;
+
+			case 't':
+				config.threads = strtoul (optarg, NULL, 10);
+				break;
+
+			case 'd':
+				config.duration = strtod (optarg, NULL);
+				break;
+
+			case 'n':
+				config.requests = strtoull (optarg, NULL, 10);
+				break;
+
+			case 'p':
+				config.pipeline = strtoul (optarg, NULL, 10);
+				break;
+
+			case 'r':
+				config.rate = strtod (optarg, NULL);
+				break;
+
+			case 'C':
+				config.close = true;
+				break;
+
+			case 'h':
+				usage (argv[0]);
+				return 0;
+
+			default:
+				usage (argv[0]);
+				return 1;
+		}
+	}
+
+	if (optind >= argc || !config.connections || !config.threads
+		|| !config.pipeline || config.duration <= 0 || config.rate < 0)
+	{
+		usage (argv[0]);
+		return 1;
+	}
+
+	if (config.threads > config.connections)
+		config.threads = config.connections;
+
+	config.url_count = (size_t) (argc - optind);
+	config.urls = calloc (config.url_count, sizeof (*config.urls));
+
+	if (!config.urls)
+		return 1;
+
+	for (size_t i = 0; i < config.url_count; i++)
+	{
+		if (!bench_add_url (&config, argv[optind + (int) i], i))
+			return 1;
+	}
+
+	struct bench_thread *threads = calloc (config.threads, sizeof (*threads));
+
+	if (!threads)
+		return 1;
+
+	for (size_t i = 0; i < config.threads; i++)
+	{
+		struct bench_thread *thread = &threads[i];
+
+		thread->config = &config;
+		thread->conn_count = config.connections / config.threads
+							 + (i < config.connections % config.threads);
+		thread->quota = config.requests / config.threads
+						+ (i < config.requests % config.threads);
+		thread->epfd = epoll_create1 (EPOLL_CLOEXEC);
+		thread->conns = calloc (thread->conn_count, sizeof (*thread->conns));
+
+		if (config.rate > 0)
+		{
+			thread->interval
+				= (uint64_t) (1e6 * (double) config.threads / config.rate);
+			thread->interval = thread->interval ? thread->interval : 1;
+			thread->backlog
+				= malloc (BENCH_BACKLOG_SIZE * sizeof (*thread->backlog));
+		}
+
+		if (thread->epfd < 0 || !thread->conns
+			|| (config.rate > 0 && !thread->backlog))
+			return 1;
+
+		for (size_t j = 0; j < thread->conn_count; j++)
+		{
+			struct bench_conn *conn = &thread->conns[j];
+
+			conn->thread = thread;
+			conn->fd = -1;
+			/* Connections start at different points of the mix */
+			conn->cursor = (i * thread->conn_count + j) % config.schedule_len;
+			conn->inflight = calloc (config.pipeline, sizeof (*conn->inflight));
+			conn->in = malloc (BENCH_IN_SIZE);
+
+			if (!conn->inflight || !conn->in)
+				return 1;
+		}
+	}
+
+	const uint64_t start = bench_now ();
+	const uint64_t end = start + (uint64_t) (config.duration * 1e6);
+
+	for (size_t i = 0; i < config.threads; i++)
+	{
+		if (pthread_create (&threads[i].tid, NULL, &bench_thread_run,
+							&threads[i]))
+		{
+			perror ("fhbench: pthread_create");
+			return 1;
+		}
+	}
+
+	for (;;)
+	{
+		bool done = config.requests > 0;
+
+		for (size_t i = 0; i < config.threads && done; i++)
+			done = bench_done (&threads[i]);
+
+		if (done || bench_now () >= end)
+			break;
+
+		usleep (10000);
+	}
+
+	__atomic_store_n (&bench_stop, 1, __ATOMIC_RELAXED);
+
+	for (size_t i = 0; i < config.threads; i++)
+		pthread_join (threads[i].tid, NULL);
+
+	bench_report (&config, threads, (double) (bench_now () - start) / 1e6);
+
+	uint64_t failed = 0, completed = 0;
+
+	for (size_t i = 0; i < config.threads; i++)
+	{
+		failed += threads[i].connect_errors + threads[i].read_errors
+				  + threads[i].parse_errors;
+		completed += threads[i].completed;
+	}
+
+	return completed && !failed ? 0 : 2;
+}
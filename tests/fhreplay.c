@@ -0,0 +1,621 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Replays a file written by the `capture' block against a server.  Each
+   captured connection is opened again, and what the client sent is sent
+   in the same pieces, at the original pace or a multiple of it, so that
+   the server reads it in the same pieces too.  Request bodies, which are
+   not captured, are sent as filler bytes of the same length.  Responses
+   are read and discarded, and a summary is printed as JSON.  */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "core/capture.h"
+#include "hash/itable.h"
+
+#define REPLAY_MAX_EVENTS 256
+#define REPLAY_READ_SIZE 65536
+
+struct replay_record
+{
+	struct fh_capture_record header;
+	const uint8_t *data;
+};
+
+struct replay_piece
+{
+	const uint8_t *data;
+	size_t len;
+	struct replay_piece *next;
+};
+
+struct replay_conn
+{
+	int fd;
+	bool connected;
+	/* The client had closed in the capture */
+	bool closing;
+	struct replay_piece *head, *tail;
+	size_t off;
+};
+
+struct replay
+{
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	int epfd;
+	struct itable *conns;
+	size_t open;
+
+	uint64_t connections;
+	uint64_t pieces;
+	uint64_t bytes_sent;
+	uint64_t bytes_received;
+	uint64_t connect_errors;
+	uint64_t send_errors;
+	uint64_t resets;
+};
+
+static uint64_t
+replay_now (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+static int
+replay_compare (const void *a, const void *b)
+{
+	const struct replay_record *ra = a, *rb = b;
+
+	if (ra->header.time != rb->header.time)
+		return ra->header.time < rb->header.time ? -1 : 1;
+
+	/* Keeps the order of the file otherwise */
+	return ra->data < rb->data ? -1 : ra->data > rb->data;
+}
+
+static struct replay_record *
+replay_load (const char *path, uint8_t **file_ptr, size_t *count_ptr)
+{
+	FILE *file = fopen (path, "rb");
+	struct stat st;
+
+	if (!file || fstat (fileno (file), &st) < 0)
+	{
+		perror (path);
+		return NULL;
+	}
+
+	uint8_t *data = malloc ((size_t) st.st_size + 1);
+
+	if (!data || fread (data, 1, (size_t) st.st_size, file)
+					 != (size_t) st.st_size)
+	{
+		perror (path);
+		return NULL;
+	}
+
+	fclose (file);
+
+	if ((size_t) st.st_size < FH_CAPTURE_MAGIC_LEN
+		|| memcmp (data, FH_CAPTURE_MAGIC, FH_CAPTURE_MAGIC_LEN))
+	{
+		fprintf (stderr, "fhreplay: %s: not a capture file\n", path);
+		return NULL;
+	}
+
+	size_t count = 0, cap = 1024;
+	struct replay_record *records = malloc (cap * sizeof (*records));
+	size_t off = FH_CAPTURE_MAGIC_LEN;
+
+	while (records && off + sizeof (struct fh_capture_record)
+						  <= (size_t) st.st_size)
+	{
+		/* Records are packed, so the header may be unaligned */
+		struct fh_capture_record header;
+
+		memcpy (&header, data + off, sizeof (header));
+
+		if (off + sizeof (header) + header.len > (size_t) st.st_size)
+		{
+			fprintf (stderr, "fhreplay: %s: truncated record\n", path);
+			break;
+		}
+
+		if (count == cap)
+		{
+			cap *= 2;
+			records = realloc (records, cap * sizeof (*records));
+
+			if (!records)
+				break;
+		}
+
+		records[count].header = header;
+		records[count].data = data + off + sizeof (header);
+		count++;
+		off += sizeof (header) + header.len;
+	}
+
+	if (!records)
+		return NULL;
+
+	qsort (records, count, sizeof (*records), &replay_compare);
+	*file_ptr = data;
+	*count_ptr = count;
+	return records;
+}
+
+static void
+replay_close (struct replay *replay, uint64_t id, struct replay_conn *conn)
+{
+	close (conn->fd);
+	itable_remove (replay->conns, id);
+	replay->open--;
+
+	while (conn->head)
+	{
+		struct replay_piece *next = conn->head->next;
+		free (conn->head);
+		conn->head = next;
+	}
+
+	free (conn);
+}
+
+static bool
+replay_flush (struct replay *replay, struct replay_conn *conn)
+{
+	if (!conn->connected)
+		return true;
+
+	/* One send() per piece, as the client did */
+	while (conn->head)
+	{
+		struct replay_piece *piece = conn->head;
+		ssize_t n = send (conn->fd, piece->data + conn->off,
+						  piece->len - conn->off, MSG_NOSIGNAL);
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return true;
+
+			replay->send_errors++;
+			return false;
+		}
+
+		replay->bytes_sent += (uint64_t) n;
+		conn->off += (size_t) n;
+
+		if (conn->off < piece->len)
+			continue;
+
+		conn->head = piece->next;
+		conn->off = 0;
+		free (piece);
+	}
+
+	conn->tail = NULL;
+
+	if (conn->closing)
+		shutdown (conn->fd, SHUT_WR);
+
+	return true;
+}
+
+static void
+replay_record (struct replay *replay, const struct replay_record *record)
+{
+	const uint64_t id = record->header.conn;
+	const uint32_t len = record->header.len;
+	const uint8_t type = record->header.type;
+
+	struct replay_conn *conn = itable_get (replay->conns, id);
+
+	if (type == FH_CAPTURE_OPEN)
+	{
+		if (conn)
+			return;
+
+		if (!(conn = calloc (1, sizeof (*conn))))
+			return;
+
+		conn->fd = socket (replay->addr.ss_family,
+						   SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+		const int one = 1;
+		struct epoll_event ev = {
+			.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP,
+			.data.u64 = id,
+		};
+
+		if (conn->fd < 0
+			|| setsockopt (conn->fd, IPPROTO_TCP, TCP_NODELAY, &one,
+						   sizeof (one))
+				   < 0
+			|| (connect (conn->fd, (const struct sockaddr *) &replay->addr,
+						 replay->addr_len)
+					< 0
+				&& errno != EINPROGRESS)
+			|| epoll_ctl (replay->epfd, EPOLL_CTL_ADD, conn->fd, &ev) < 0
+			|| !itable_set (replay->conns, id, conn))
+		{
+			replay->connect_errors++;
+
+			if (conn->fd >= 0)
+				close (conn->fd);
+
+			free (conn);
+			return;
+		}
+
+		replay->connections++;
+		replay->open++;
+		return;
+	}
+
+	/* Opened before the capture started, or failed to connect */
+	if (!conn)
+		return;
+
+	uint64_t body_len = 0;
+
+	if (type == FH_CAPTURE_BODY && len == sizeof (body_len))
+		memcpy (&body_len, record->data, sizeof (body_len));
+
+	if ((type == FH_CAPTURE_DATA && len > 0) || body_len > 0)
+	{
+		struct replay_piece *piece = malloc (sizeof (*piece) + body_len);
+
+		if (!piece)
+			return;
+
+		if (body_len)
+		{
+			memset (piece + 1, 'x', body_len);
+			piece->data = (const uint8_t *) (piece + 1);
+			piece->len = body_len;
+		}
+		else
+		{
+			piece->data = record->data;
+			piece->len = len;
+		}
+
+		piece->next = NULL;
+
+		if (conn->tail)
+			conn->tail->next = piece;
+		else
+			conn->head = piece;
+
+		conn->tail = piece;
+		replay->pieces++;
+	}
+	else if (type == FH_CAPTURE_CLOSE)
+		conn->closing = true;
+
+	if (!replay_flush (replay, conn))
+		replay_close (replay, id, conn);
+}
+
+static void
+replay_event (struct replay *replay, const struct epoll_event *event)
+{
+	const uint64_t id = event->data.u64;
+	struct replay_conn *conn = itable_get (replay->conns, id);
+	static char buf[REPLAY_READ_SIZE];
+
+	if (!conn)
+		return;
+
+	if (!conn->connected && event->events & (EPOLLOUT | EPOLLERR))
+	{
+		int err = 0;
+		socklen_t len = sizeof (err);
+
+		getsockopt (conn->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+
+		if (err)
+		{
+			replay->connect_errors++;
+			replay_close (replay, id, conn);
+			return;
+		}
+
+		conn->connected = true;
+	}
+
+	if (event->events & EPOLLOUT && !replay_flush (replay, conn))
+	{
+		replay_close (replay, id, conn);
+		return;
+	}
+
+	for (;;)
+	{
+		ssize_t n = recv (conn->fd, buf, sizeof (buf), 0);
+
+		if (n > 0)
+		{
+			replay->bytes_received += (uint64_t) n;
+			continue;
+		}
+
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+
+		if (n < 0)
+			replay->resets++;
+
+		replay_close (replay, id, conn);
+		return;
+	}
+}
+
+static void
+replay_poll (struct replay *replay, int timeout)
+{
+	struct epoll_event events[REPLAY_MAX_EVENTS];
+	int n = epoll_wait (replay->epfd, events, REPLAY_MAX_EVENTS, timeout);
+
+	for (int i = 0; i < n; i++)
+		replay_event (replay, &events[i]);
+}
+
+static bool
+replay_resolve (struct replay *replay, char *target)
+{
+	char *colon = strrchr (target, ':');
+	const char *port = "80";
+
+	if (colon)
+	{
+		*colon = 0;
+		port = colon + 1;
+	}
+
+	struct addrinfo hints = {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM,
+	};
+	struct addrinfo *res;
+	int rc = getaddrinfo (target, port, &hints, &res);
+
+	if (rc)
+	{
+		fprintf (stderr, "fhreplay: %s: %s\n", target, gai_strerror (rc));
+		return false;
+	}
+
+	memcpy (&replay->addr, res->ai_addr, res->ai_addrlen);
+	replay->addr_len = res->ai_addrlen;
+	freeaddrinfo (res);
+	return true;
+}
+
+static void
+replay_print (const struct replay_record *records, size_t count)
+{
+	const uint64_t start = count ? records[0].header.time : 0;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		static const char *types[] = { "?", "open", "data", "close", "body" };
+		const struct fh_capture_record *header = &records[i].header;
+		const uint8_t type = header->type <= FH_CAPTURE_BODY ? header->type : 0;
+
+		printf ("%10.6f %016lx %-5s %u", (double) (header->time - start) / 1e6,
+				(unsigned long) header->conn, types[type], header->len);
+
+		if (type == FH_CAPTURE_BODY && header->len == sizeof (uint64_t))
+		{
+			uint64_t body_len;
+
+			memcpy (&body_len, records[i].data, sizeof (body_len));
+			printf (" %lu", (unsigned long) body_len);
+		}
+		else if (header->len)
+		{
+			putchar (' ');
+
+			for (uint32_t j = 0; j < header->len; j++)
+			{
+				const uint8_t c = records[i].data[j];
+
+				if (c == '\r')
+					fputs ("\\r", stdout);
+				else if (c == '\n')
+					fputs ("\\n", stdout);
+				else if (c < 0x20 || c >= 0x7f || c == '\\')
+					printf ("\\x%02x", c);
+				else
+					putchar (c);
+			}
+		}
+
+		putchar ('\n');
+	}
+}
+
+static void
+usage (const char *name)
+{
+	printf ("Usage: %s [options] HOST:PORT FILE\n"
+			"       %s --print FILE\n\n"
+			"Options:\n"
+			"  -s, --speed N    Replay N times as fast as captured, or as "
+			"fast as\n"
+			"                   possible with 0 (default: 1)\n"
+			"  -w, --wait SEC   How long to wait for responses after the "
+			"last\n"
+			"                   record (default: 5)\n"
+			"  -p, --print      Print the records of FILE and exit\n"
+			"  -h, --help       Print this help and exit\n",
+			name, name);
+}
+
+int
+main (int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "speed", required_argument, 0, 's' },
+		{ "wait", required_argument, 0, 'w' },
+		{ "print", no_argument, 0, 'p' },
+		{ "help", no_argument, 0, 'h' },
+		{ 0, 0, 0, 0 },
+	};
+	struct replay replay = { 0 };
+	double speed = 1, wait = 5;
+	bool print = false;
+	int opt;
+
+	while ((opt = getopt_long (argc, argv, "s:w:ph", long_options, NULL))
+		   != -1)
+	{
+		switch (opt)
+		{
+			case 's':
+				speed = strtod (optarg, NULL);
+				break;
+
+			case 'w':
+				wait = strtod (optarg, NULL);
+				break;
+
+			case 'p':
+				print = true;
+				break;
+
+			case 'h':
+				usage (argv[0]);
+				return 0;
+
+			default:
+				usage (argv[0]);
+				return 1;
+		}
+	}
+
+	if (argc - optind != (print ? 1 : 2) || speed < 0 || wait < 0)
+	{
+		usage (argv[0]);
+		return 1;
+	}
+
+	uint8_t *file;
+	size_t count;
+	struct replay_record *records
+		= replay_load (argv[argc - 1], &file, &count);
+
+	if (!records)
+		return 1;
+
+	if (print)
+	{
+		replay_print (records, count);
+		return 0;
+	}
+
+	if (!replay_resolve (&replay, argv[optind]))
+		return 1;
+
+	replay.epfd = epoll_create1 (EPOLL_CLOEXEC);
+	replay.conns = itable_create (0);
+
+	if (replay.epfd < 0 || !replay.conns)
+		return 1;
+
+	const uint64_t start = replay_now ();
+	const uint64_t captured_start = count ? records[0].header.time : 0;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const uint64_t offset = records[i].header.time - captured_start;
+		const uint64_t due
+			= speed > 0 ? start + (uint64_t) ((double) offset / speed) : 0;
+		uint64_t now;
+
+		while ((now = replay_now ()) < due)
+		{
+			const uint64_t left = (due - now + 999) / 1000;
+			replay_poll (&replay, left > 100 ? 100 : (int) left);
+		}
+
+		replay_record (&replay, &records[i]);
+		replay_poll (&replay, 0);
+	}
+
+	const uint64_t deadline = replay_now () + (uint64_t) (wait * 1e6);
+
+	while (replay.open && replay_now () < deadline)
+		replay_poll (&replay, 100);
+
+	const double elapsed = (double) (replay_now () - start) / 1e6;
+	const double captured
+		= count ? (double) (records[count - 1].header.time - captured_start)
+					  / 1e6
+				: 0;
+
+	printf ("{\n"
+			"  \"records\": %zu,\n"
+			"  \"connections\": %lu,\n"
+			"  \"pieces\": %lu,\n"
+			"  \"bytes_sent\": %lu,\n"
+			"  \"bytes_received\": %lu,\n"
+			"  \"captured_duration\": %.3f,\n"
+			"  \"duration\": %.3f,\n"
+			"  \"unfinished\": %zu,\n"
+			"  \"errors\": {\"connect\": %lu, \"send\": %lu, \"reset\": %lu}\n"
+			"}\n",
+			count, replay.connections, replay.pieces, replay.bytes_sent,
+			replay.bytes_received, captured, elapsed, replay.open,
+			replay.connect_errors, replay.send_errors, replay.resets);
+
+	itable_destroy (replay.conns);
+	free (records);
+	free (file);
+	return replay.connect_errors || replay.send_errors ? 2 : 0;
+}
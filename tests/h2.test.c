@@ -0,0 +1,811 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* The HTTP/2 frame layer, driven over a socket pair: the test writes the
+   client's frames to one end and reads what the server answers from it. */
+
+#undef NDEBUG
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "core/conn.h"
+#include "core/stream.h"
+#include "http/h2.h"
+#include "http/hpack.h"
+#include "http/protocol.h"
+
+#define MAX_FRAMES 64
+/* Size of the file served as /big */
+#define BIG_SIZE (4 << 20)
+
+struct frame
+{
+	uint8_t type;
+	uint8_t flags;
+	uint32_t stream_id;
+	size_t len;
+	const uint8_t *payload;
+};
+
+struct peer
+{
+	int fd;
+	struct fh_conn *conn;
+	struct fh_h2_ctx *ctx;
+
+	/* What the server wrote since the last read_frames() */
+	uint8_t buf[1 << 16];
+	size_t buf_len;
+	struct frame frames[MAX_FRAMES];
+	size_t frame_count;
+};
+
+static const char body[] = "hello";
+static int big_fd = -1;
+
+static bool
+handle_request (void *data __attribute__ ((unused)),
+				struct fh_conn *conn __attribute__ ((unused)),
+				const struct fh_request *request, struct fh_response *response)
+{
+	if (request->uri_len == 4 && memcmp (request->uri, "/big", 4) == 0)
+	{
+		struct fh_link *link = fh_pool_alloc (
+			response->pool, sizeof (struct fh_link) + sizeof (struct fh_buf));
+
+		assert (link);
+		memset (link, 0, sizeof (*link));
+		link->buf = (struct fh_buf *) (link + 1);
+		link->buf->type = FH_BUF_FILE;
+		link->buf->attrs.file.file_fd = dup (big_fd);
+		link->buf->attrs.file.file_off = 0;
+		link->buf->attrs.file.file_len = BIG_SIZE;
+		link->is_eos = true;
+		assert (link->buf->attrs.file.file_fd >= 0);
+
+		response->body_start = link;
+		response->content_length = BIG_SIZE;
+		response->status = FH_STATUS_OK;
+		response->use_default_error_response = false;
+		return true;
+	}
+
+	response->body_start = fh_link_new_data (
+		response->pool, (const uint8_t *) body, sizeof (body) - 1, true);
+	assert (response->body_start);
+	response->content_length = sizeof (body) - 1;
+	response->status = FH_STATUS_OK;
+	response->use_default_error_response = false;
+	return true;
+}
+
+static uint32_t
+read_u32 (const uint8_t *p)
+{
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16)
+		   | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static void
+peer_open (struct peer *peer)
+{
+	int fds[2];
+	struct sockaddr_in addr = { .sin_family = AF_INET };
+
+	assert (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+	assert (fcntl (fds[0], F_SETFL, O_NONBLOCK) == 0);
+	assert (fcntl (fds[1], F_SETFL, O_NONBLOCK) == 0);
+
+	memset (peer, 0, sizeof (*peer));
+	peer->fd = fds[1];
+	peer->conn = fh_conn_create (fds[0], &addr, NULL);
+	assert (peer->conn);
+	peer->ctx = fh_h2_ctx_create (peer->conn, &handle_request, NULL);
+	assert (peer->ctx);
+	peer->conn->protocol = FH_PROTOCOL_H2;
+	peer->conn->io_ctx.h2 = peer->ctx;
+}
+
+/* Like peer_open(), over a TCP connection on the loopback interface */
+static void
+peer_open_tcp (struct peer *peer)
+{
+	struct sockaddr_in addr = { .sin_family = AF_INET };
+	socklen_t addr_len = sizeof (addr);
+	int one = 1;
+	int listen_fd = socket (AF_INET, SOCK_STREAM, 0);
+
+	addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	assert (listen_fd >= 0);
+	assert (bind (listen_fd, (struct sockaddr *) &addr, sizeof (addr)) == 0);
+	assert (listen (listen_fd, 1) == 0);
+	assert (getsockname (listen_fd, (struct sockaddr *) &addr, &addr_len)
+			== 0);
+
+	memset (peer, 0, sizeof (*peer));
+	peer->fd = socket (AF_INET, SOCK_STREAM, 0);
+	assert (peer->fd >= 0);
+	assert (connect (peer->fd, (struct sockaddr *) &addr, sizeof (addr)) == 0);
+	assert (setsockopt (peer->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one))
+			== 0);
+
+	int fd = accept (listen_fd, NULL, NULL);
+
+	assert (fd >= 0);
+	assert (fcntl (fd, F_SETFL, O_NONBLOCK) == 0);
+	assert (fcntl (peer->fd, F_SETFL, O_NONBLOCK) == 0);
+	close (listen_fd);
+
+	peer->conn = fh_conn_create (fd, &addr, NULL);
+	assert (peer->conn);
+	peer->ctx = fh_h2_ctx_create (peer->conn, &handle_request, NULL);
+	assert (peer->ctx);
+	peer->conn->protocol = FH_PROTOCOL_H2;
+	peer->conn->io_ctx.h2 = peer->ctx;
+}
+
+static void
+peer_close (struct peer *peer)
+{
+	fh_conn_destroy (peer->conn);
+	close (peer->fd);
+}
+
+static void
+send_frame (struct peer *peer, uint8_t type, uint8_t flags,
+			uint32_t stream_id, const void *payload, size_t len)
+{
+	uint8_t header[H2_FRAME_HEADER_SIZE] = {
+		(uint8_t) (len >> 16),		 (uint8_t) (len >> 8),
+		(uint8_t) len,				 type,
+		flags,						 (uint8_t) (stream_id >> 24),
+		(uint8_t) (stream_id >> 16), (uint8_t) (stream_id >> 8),
+		(uint8_t) stream_id,
+	};
+
+	assert (write (peer->fd, header, sizeof (header)) == sizeof (header));
+
+	if (len)
+		assert (write (peer->fd, payload, len) == (ssize_t) len);
+}
+
+/* Lets the server read everything sent so far and answer it.  */
+static bool
+pump (struct peer *peer)
+{
+	return fh_h2_recv (peer->ctx) && fh_h2_send (peer->ctx);
+}
+
+static void
+read_frames (struct peer *peer)
+{
+	ssize_t bytes_read;
+
+	peer->buf_len = 0;
+	peer->frame_count = 0;
+
+	while ((bytes_read = read (peer->fd, peer->buf + peer->buf_len,
+							   sizeof (peer->buf) - peer->buf_len))
+		   > 0)
+		peer->buf_len += (size_t) bytes_read;
+
+	assert (bytes_read < 0 && errno == EAGAIN);
+
+	for (size_t off = 0; off < peer->buf_len;)
+	{
+		const uint8_t *p = peer->buf + off;
+		struct frame *frame = &peer->frames[peer->frame_count++];
+
+		assert (peer->frame_count <= MAX_FRAMES);
+		assert (off + H2_FRAME_HEADER_SIZE <= peer->buf_len);
+		frame->len = ((size_t) p[0] << 16) | ((size_t) p[1] << 8) | p[2];
+		frame->type = p[3];
+		frame->flags = p[4];
+		frame->stream_id = read_u32 (p + 5) & 0x7FFFFFFF;
+		frame->payload = p + H2_FRAME_HEADER_SIZE;
+		off += H2_FRAME_HEADER_SIZE + frame->len;
+		assert (off <= peer->buf_len);
+	}
+}
+
+static const struct frame *
+find_frame (const struct peer *peer, uint8_t type, uint32_t stream_id)
+{
+	for (size_t i = 0; i < peer->frame_count; i++)
+	{
+		if (peer->frames[i].type == type
+			&& peer->frames[i].stream_id == stream_id)
+			return &peer->frames[i];
+	}
+
+	return NULL;
+}
+
+/* Opens a connection and exchanges the initial SETTINGS.  */
+static void
+peer_start (struct peer *peer)
+{
+	peer_open (peer);
+	send_frame (peer, H2_FRAME_SETTINGS, 0, 0, NULL, 0);
+	assert (pump (peer));
+	read_frames (peer);
+}
+
+static void
+send_request_path (struct peer *peer, uint32_t stream_id, const char *method,
+				   const char *path, const char *content_length,
+				   bool end_stream)
+{
+	uint8_t block[256];
+	size_t len = 0;
+
+	len += fh_hpack_encode_field (block + len, sizeof (block) - len,
+								  ":method", 7, method, strlen (method));
+	len += fh_hpack_encode_field (block + len, sizeof (block) - len,
+								  ":scheme", 7, "http", 4);
+	len += fh_hpack_encode_field (block + len, sizeof (block) - len, ":path",
+								  5, path, strlen (path));
+	len += fh_hpack_encode_field (block + len, sizeof (block) - len,
+								  ":authority", 10, "localhost", 9);
+
+	if (content_length)
+		len += fh_hpack_encode_field (block + len, sizeof (block) - len,
+									  "content-length", 14, content_length,
+									  strlen (content_length));
+
+	send_frame (peer, H2_FRAME_HEADERS,
+				H2_FLAG_END_HEADERS | (end_stream ? H2_FLAG_END_STREAM : 0),
+				stream_id, block, len);
+}
+
+static void
+send_request (struct peer *peer, uint32_t stream_id, const char *method,
+			  const char *content_length, bool end_stream)
+{
+	send_request_path (peer, stream_id, method, "/", content_length,
+					   end_stream);
+}
+
+static void
+test_settings_ping (void)
+{
+	struct peer peer;
+	const uint8_t ping[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+
+	peer_open (&peer);
+	send_frame (&peer, H2_FRAME_SETTINGS, 0, 0, NULL, 0);
+	assert (pump (&peer));
+	read_frames (&peer);
+
+	/* The server's SETTINGS come first, then its connection window and the
+	   acknowledgement of ours.  */
+	assert (peer.frame_count == 3);
+	assert (peer.frames[0].type == H2_FRAME_SETTINGS);
+	assert (peer.frames[0].flags == 0);
+	assert (peer.frames[0].len % 6 == 0);
+	assert (peer.frames[1].type == H2_FRAME_WINDOW_UPDATE);
+	assert (peer.frames[1].stream_id == 0);
+	assert (read_u32 (peer.frames[1].payload)
+			== H2_CONN_RECV_WINDOW - H2_DEFAULT_WINDOW_SIZE);
+	assert (peer.frames[2].type == H2_FRAME_SETTINGS);
+	assert (peer.frames[2].flags == H2_FLAG_ACK);
+	assert (peer.frames[2].len == 0);
+
+	send_frame (&peer, H2_FRAME_PING, 0, 0, ping, sizeof (ping));
+	assert (pump (&peer));
+	read_frames (&peer);
+	assert (peer.frame_count == 1);
+	assert (peer.frames[0].type == H2_FRAME_PING);
+	assert (peer.frames[0].flags == H2_FLAG_ACK);
+	assert (peer.frames[0].len == sizeof (ping));
+	assert (memcmp (peer.frames[0].payload, ping, sizeof (ping)) == 0);
+
+	/* Neither is answered when it is an acknowledgement itself */
+	send_frame (&peer, H2_FRAME_PING, H2_FLAG_ACK, 0, ping, sizeof (ping));
+	send_frame (&peer, H2_FRAME_SETTINGS, H2_FLAG_ACK, 0, NULL, 0);
+	assert (pump (&peer));
+	read_frames (&peer);
+	assert (peer.frame_count == 0);
+
+	/* A PING must be 8 bytes long */
+	send_frame (&peer, H2_FRAME_PING, 0, 0, ping, 4);
+	assert (!pump (&peer));
+	read_frames (&peer);
+	assert (peer.frame_count == 1);
+	assert (peer.frames[0].type == H2_FRAME_GOAWAY);
+	assert (read_u32 (peer.frames[0].payload + 4) == H2_FRAME_SIZE_ERROR);
+
+	peer_close (&peer);
+}
+
+static void
+test_request (void)
+{
+	struct peer peer;
+	const struct frame *frame;
+
+	peer_start (&peer);
+	send_request (&peer, 1, "GET", NULL, true);
+	assert (pump (&peer));
+	read_frames (&peer);
+
+	assert (find_frame (&peer, H2_FRAME_HEADERS, 1));
+	assert ((frame = find_frame (&peer, H2_FRAME_DATA, 1)));
+	assert (frame->flags & H2_FLAG_END_STREAM);
+	assert (frame->len == sizeof (body) - 1);
+	assert (memcmp (frame->payload, body, frame->len) == 0);
+	assert (fh_h2_done (peer.ctx) == false);
+	assert (peer.ctx->stream_count == 0);
+
+	peer_close (&peer);
+}
+
+static void
+test_window (void)
+{
+	struct peer peer;
+	static uint8_t data[1000];
+	const uint8_t padded[] = { 200 };
+	const struct frame *frame;
+
+	peer_start (&peer);
+	assert (peer.ctx->recv_window == H2_CONN_RECV_WINDOW);
+
+	/* The stream window is given back as the body arrives, the connection
+	   window only once the stream is done with it.  */
+	send_request (&peer, 1, "POST", "2000", false);
+	send_frame (&peer, H2_FRAME_DATA, 0, 1, data, sizeof (data));
+	assert (pump (&peer));
+	read_frames (&peer);
+	assert (peer.ctx->recv_window == H2_CONN_RECV_WINDOW - 1000);
+	assert (!find_frame (&peer, H2_FRAME_WINDOW_UPDATE, 0));
+	assert ((frame = find_frame (&peer, H2_FRAME_WINDOW_UPDATE, 1)));
+	assert (read_u32 (frame->payload) == 1000);
+
+	/* Padding does not count towards the body, and is credited back right
+	   away.  */
+	uint8_t frame_payload[1 + 200];
+
+	memcpy (frame_payload, padded, sizeof (padded));
+	memset (frame_payload + 1, 0, 200);
+	send_frame (&peer, H2_FRAME_DATA, H2_FLAG_PADDED, 1, frame_payload,
+				sizeof (frame_payload));
+	assert (pump (&peer));
+	read_frames (&peer);
+	assert (peer.ctx->recv_window == H2_CONN_RECV_WINDOW - 1000);
+	assert ((frame = find_frame (&peer, H2_FRAME_WINDOW_UPDATE, 0)));
+	assert (read_u32 (frame->payload) == sizeof (frame_payload));
+
+	send_frame (&peer, H2_FRAME_DATA, H2_FLAG_END_STREAM, 1, data,
+				sizeof (data));
+	assert (pump (&peer));
+	read_frames (&peer);
+	assert (find_frame (&peer, H2_FRAME_HEADERS, 1));
+	assert ((frame = find_frame (&peer, H2_FRAME_WINDOW_UPDATE, 0)));
+	assert (read_u32 (frame->payload) == 2000);
+	assert (peer.ctx->recv_window == H2_CONN_RECV_WINDOW);
+	assert (peer.ctx->stream_count == 0);
+
+	peer_close (&peer);
+}
+
+static void
+test_content_length (void)
+{
+	struct peer peer;
+	const struct frame *frame;
+	static uint8_t data[10];
+
+	peer_start (&peer);
+
+	/* Shorter than announced */
+	send_request (&peer, 1, "POST", "10", false);
+	send_frame (&peer, H2_FRAME_DATA, H2_FLAG_END_STREAM, 1, data, 5);
+	assert (pump (&peer));
+	read_frames (&peer);
+	assert (!find_frame (&peer, H2_FRAME_HEADERS, 1));
+	assert ((frame = find_frame (&peer, H2_FRAME_RST_STREAM, 1)));
+	assert (read_u32 (frame->payload) == H2_PROTOCOL_ERROR);
+
+	/* Longer than announced */
+	send_request (&peer, 3, "POST", "5", false);
+	send_frame (&peer, H2_FRAME_DATA, H2_FLAG_END_STREAM, 3, data, 10);
+	assert (pump (&peer));
+	read_frames (&peer);
+	assert (!find_frame (&peer, H2_FRAME_HEADERS, 3));
+	assert ((frame = find_frame (&peer, H2_FRAME_RST_STREAM, 3)));
+	assert (read_u32 (frame->payload) == H2_PROTOCOL_ERROR);
+
+	/* Both bodies were given back to the connection window */
+	assert (peer.ctx->recv_window == H2_CONN_RECV_WINDOW);
+	assert (peer.ctx->stream_count == 0);
+
+	peer_close (&peer);
+}
+
+static void
+test_header_list_size (void)
+{
+	struct peer peer;
+	const struct frame *frame;
+	uint8_t block[8192];
+	size_t len = 0;
+	char value[4000];
+
+	peer_start (&peer);
+
+	/* One large field added to the dynamic table, then referenced over
+	   and over from a small block.  */
+	memset (value, 'a', sizeof (value));
+	len += fh_hpack_encode_field (block + len, sizeof (block) - len,
+								  ":method", 7, "GET", 3);
+	len += fh_hpack_encode_field (block + len, sizeof (block) - len,
+								  ":scheme", 7, "http", 4);
+	len += fh_hpack_encode_field (block + len, sizeof (block) - len, ":path",
+								  5, "/", 1);
+	block[len++] = 0x40;
+	block[len++] = 1;
+	block[len++] = 'x';
+	block[len++] = 0x7F;
+	block[len++] = (uint8_t) ((sizeof (value) - 127) % 128 | 0x80);
+	block[len++] = (uint8_t) ((sizeof (value) - 127) / 128);
+	memcpy (block + len, value, sizeof (value));
+	len += sizeof (value);
+
+	for (int i = 0; i < 64; i++)
+		block[len++] = 0x80 | 62;
+
+	send_frame (&peer, H2_FRAME_HEADERS,
+				H2_FLAG_END_HEADERS | H2_FLAG_END_STREAM, 1, block, len);
+	assert (pump (&peer));
+	read_frames (&peer);
+	assert (!find_frame (&peer, H2_FRAME_HEADERS, 1));
+	assert ((frame = find_frame (&peer, H2_FRAME_RST_STREAM, 1)));
+	assert (read_u32 (frame->payload) == H2_ENHANCE_YOUR_CALM);
+
+	/* The decoder is still in sync with the peer's table */
+	send_request (&peer, 3, "GET", NULL, true);
+	assert (pump (&peer));
+	read_frames (&peer);
+	assert (find_frame (&peer, H2_FRAME_HEADERS, 3));
+
+	peer_close (&peer);
+}
+
+static void
+test_closed_stream (void)
+{
+	struct peer peer;
+	const struct frame *frame;
+
+	/* Stream 1 is skipped, so it was never opened */
+	peer_start (&peer);
+	send_request (&peer, 3, "GET", NULL, true);
+	assert (pump (&peer));
+	read_frames (&peer);
+	assert (find_frame (&peer, H2_FRAME_HEADERS, 3));
+
+	send_request (&peer, 1, "GET", NULL, true);
+	assert (!pump (&peer));
+	read_frames (&peer);
+	assert ((frame = find_frame (&peer, H2_FRAME_GOAWAY, 0)));
+	assert ((read_u32 (frame->payload) & 0x7FFFFFFF) == 3);
+	assert (read_u32 (frame->payload + 4) == H2_PROTOCOL_ERROR);
+	peer_close (&peer);
+
+	/* Stream 1 was opened and closed before it comes back */
+	peer_start (&peer);
+	send_request (&peer, 1, "GET", NULL, true);
+	send_request (&peer, 3, "GET", NULL, true);
+	assert (pump (&peer));
+	read_frames (&peer);
+	assert (find_frame (&peer, H2_FRAME_HEADERS, 1));
+	assert (find_frame (&peer, H2_FRAME_HEADERS, 3));
+
+	send_request (&peer, 1, "GET", NULL, true);
+	assert (!pump (&peer));
+	read_frames (&peer);
+	assert ((frame = find_frame (&peer, H2_FRAME_GOAWAY, 0)));
+	assert ((read_u32 (frame->payload) & 0x7FFFFFFF) == 3);
+	assert (read_u32 (frame->payload + 4) == H2_STREAM_CLOSED);
+	peer_close (&peer);
+}
+
+static void
+test_output_limit (void)
+{
+	struct peer peer;
+	uint8_t pings[64 * (H2_FRAME_HEADER_SIZE + 8)] = { 0 };
+	bool ok = true;
+
+	peer_start (&peer);
+
+	for (size_t i = 0; i < 64; i++)
+	{
+		pings[i * (H2_FRAME_HEADER_SIZE + 8) + 2] = 8;
+		pings[i * (H2_FRAME_HEADER_SIZE + 8) + 3] = H2_FRAME_PING;
+	}
+
+	/* The answers pile up while the peer never reads them */
+	for (size_t i = 0; ok && i < 2 * H2_OUTPUT_LIMIT / sizeof (pings); i++)
+	{
+		assert (write (peer.fd, pings, sizeof (pings)) == sizeof (pings));
+		ok = fh_h2_recv (peer.ctx);
+	}
+
+	assert (!ok);
+	assert (peer.ctx->goaway_sent);
+	assert (peer.ctx->out_len - peer.ctx->out_off
+			<= H2_OUTPUT_LIMIT + sizeof (pings) + 64);
+
+	peer_close (&peer);
+}
+
+static double
+elapsed (const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (double) (now.tv_sec - start->tv_sec)
+		   + (double) (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* A client that keeps sending does not keep fh_h2_recv() to itself */
+static void
+test_recv_budget (void)
+{
+	struct peer peer;
+	uint8_t ping[H2_FRAME_HEADER_SIZE + 8] = { 0, 0, 8, H2_FRAME_PING };
+	size_t sent = 0, answered = 0, base;
+	struct pollfd pfd;
+
+	peer_open_tcp (&peer);
+	send_frame (&peer, H2_FRAME_SETTINGS, 0, 0, NULL, 0);
+	pfd = (struct pollfd) { .fd = peer.conn->client_sockfd, .events = POLLIN };
+	assert (poll (&pfd, 1, 1000) == 1);
+	assert (fh_h2_recv (peer.ctx));
+	assert (!peer.ctx->recv_more);
+	base = peer.ctx->out_len;
+
+	/* Queue up more than one budget of PINGs before the server reads */
+	while (sent < 2 * H2_RECV_BUDGET)
+	{
+		if (write (peer.fd, ping, sizeof (ping)) == sizeof (ping))
+		{
+			sent += sizeof (ping);
+			continue;
+		}
+
+		assert (errno == EAGAIN);
+		pfd = (struct pollfd) { .fd = peer.fd, .events = POLLOUT };
+		assert (poll (&pfd, 1, 1000) == 1);
+	}
+
+	/* Wait for all of it to arrive */
+	for (int i = 0; i < 100; i++)
+	{
+		int queued;
+
+		assert (ioctl (peer.conn->client_sockfd, FIONREAD, &queued) == 0);
+
+		if ((size_t) queued >= sent)
+			break;
+
+		usleep (10000);
+	}
+
+	for (int calls = 1;; calls++)
+	{
+		assert (fh_h2_recv (peer.ctx));
+
+		answered = (peer.ctx->out_len - base) / sizeof (ping);
+
+		if (!peer.ctx->recv_more)
+		{
+			assert (calls >= 2);
+			break;
+		}
+
+		assert (answered * sizeof (ping)
+				<= calls * (H2_RECV_BUDGET + peer.ctx->in_cap));
+		assert (calls < 10);
+	}
+
+	assert (answered == sent / sizeof (ping));
+
+	peer_close (&peer);
+}
+
+/* Requests a large file and two small responses, keeping the default
+   windows and replenishing them once half is used, and reading in
+   chunks of one frame, as common clients do.  */
+static void
+run_client (struct peer *peer)
+{
+	send_frame (peer, H2_FRAME_SETTINGS, 0, 0, NULL, 0);
+	send_request_path (peer, 1, "GET", "/big", NULL, true);
+	send_request (peer, 3, "GET", NULL, true);
+	send_request (peer, 5, "GET", NULL, true);
+
+	/* Frames are parsed as they come in; only the headers are kept.  */
+	uint8_t header[H2_FRAME_HEADER_SIZE];
+	size_t header_len = 0, payload_left = 0, big_bytes = 0;
+	/* DATA received since the last WINDOW_UPDATE of the connection and of
+	   stream 1 */
+	size_t consumed[2] = { 0, 0 };
+	uint32_t payload_stream = 0;
+	unsigned int streams_done = 0;
+
+	while (streams_done < 3 || payload_left)
+	{
+		struct pollfd pfd = { .fd = peer->fd, .events = POLLIN };
+		ssize_t bytes_read;
+
+		assert (poll (&pfd, 1, -1) == 1);
+		bytes_read = read (peer->fd, peer->buf, H2_DEFAULT_FRAME_SIZE);
+
+		assert (bytes_read > 0);
+
+		for (const uint8_t *p = peer->buf, *end = p + bytes_read; p < end;)
+		{
+			if (payload_left)
+			{
+				size_t n = (size_t) (end - p) < payload_left
+							   ? (size_t) (end - p)
+							   : payload_left;
+
+				if (payload_stream)
+					consumed[0] += n;
+
+				if (payload_stream == 1)
+					big_bytes += n, consumed[1] += n;
+
+				payload_left -= n;
+				p += n;
+				continue;
+			}
+
+			header[header_len++] = *p++;
+
+			if (header_len < H2_FRAME_HEADER_SIZE)
+				continue;
+
+			header_len = 0;
+			payload_left = ((size_t) header[0] << 16)
+						   | ((size_t) header[1] << 8) | header[2];
+			payload_stream = header[3] == H2_FRAME_DATA
+								 ? read_u32 (header + 5) & 0x7FFFFFFF
+								 : 0;
+			assert (header[3] != H2_FRAME_RST_STREAM);
+			assert (header[3] != H2_FRAME_GOAWAY);
+
+			if (header[3] == H2_FRAME_DATA && (header[4] & H2_FLAG_END_STREAM))
+				streams_done++;
+		}
+
+		for (uint32_t id = 0; id < 2; id++)
+		{
+			if (consumed[id] < H2_DEFAULT_WINDOW_SIZE / 2)
+				continue;
+
+			const uint8_t increment[]
+				= { (uint8_t) (consumed[id] >> 24), (uint8_t) (consumed[id] >> 16),
+					(uint8_t) (consumed[id] >> 8), (uint8_t) consumed[id] };
+
+			send_frame (peer, H2_FRAME_WINDOW_UPDATE, 0, id, increment,
+						sizeof (increment));
+			consumed[id] = 0;
+		}
+	}
+
+	assert (big_bytes == BIG_SIZE);
+}
+
+/* A file-backed response next to small ones over TCP, the client running
+   in a child process.  Frame headers and file payloads are separate
+   writes, and the last frame of each window is cut short, which Nagle's
+   algorithm would hold back until the client's delayed ACK.  */
+static void
+test_concurrent_streams (void)
+{
+	struct peer peer;
+	char path[] = "/tmp/h2.test.XXXXXX";
+
+	big_fd = mkstemp (path);
+	assert (big_fd >= 0);
+	assert (unlink (path) == 0);
+	assert (ftruncate (big_fd, BIG_SIZE) == 0);
+
+	peer_open_tcp (&peer);
+
+	int fd = peer.conn->client_sockfd;
+	struct timespec start;
+	pid_t pid = fork ();
+
+	assert (pid >= 0);
+	clock_gettime (CLOCK_MONOTONIC, &start);
+
+	if (pid == 0)
+	{
+		close (fd);
+		run_client (&peer);
+		_exit (0);
+	}
+
+	/* The server side, run the way the event loop runs it */
+	close (peer.fd);
+
+	for (;;)
+	{
+		struct pollfd pfd = {
+			.fd = fd,
+			.events = POLLIN
+					  | (peer.ctx->out_len > peer.ctx->out_off
+							 || peer.ctx->file_len
+						 ? POLLOUT
+						 : 0),
+		};
+
+		assert (poll (&pfd, 1, 1000) > 0);
+
+		if (!pump (&peer))
+			break;
+	}
+
+	int status;
+
+	assert (waitpid (pid, &status, 0) == pid);
+	assert (WIFEXITED (status) && WEXITSTATUS (status) == 0);
+	assert (elapsed (&start) < 2.0);
+	assert (peer.ctx->stream_count == 0);
+
+	fh_conn_destroy (peer.conn);
+	close (big_fd);
+	big_fd = -1;
+}
+
+int
+main (void)
+{
+	test_settings_ping ();
+	test_request ();
+	test_window ();
+	test_content_length ();
+	test_header_list_size ();
+	test_closed_stream ();
+	test_output_limit ();
+	test_recv_budget ();
+	test_concurrent_streams ();
+	return 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * This file is part of OSN freehttpd.
+ * 
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#undef NDEBUG
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "utils/histogram.h"
+
+int
+main (void)
+{
+	/* Buckets are contiguous and cover every value exactly once.  */
+	assert (fh_histogram_bucket_min (0) == 0);
+
+	for (size_t i = 1; i < FH_HISTOGRAM_BUCKETS; i++)
+	{
+		const uint64_t min = fh_histogram_bucket_min (i);
+
+		assert (min > fh_histogram_bucket_min (i - 1));
+		assert (fh_histogram_bucket (min) == i);
+		assert (fh_histogram_bucket (min - 1) == i - 1);
+	}
+
+	/* Small values are exact, larger ones off by at most 1/8th.  */
+	for (uint64_t v = 0; v < 2 * FH_HISTOGRAM_SUB_COUNT; v++)
+		assert (fh_histogram_bucket_min (fh_histogram_bucket (v)) == v);
+
+	for (uint64_t v = 1; v < (1ULL << FH_HISTOGRAM_MAX_EXP); v = v * 3 + 1)
+	{
+		const size_t bucket = fh_histogram_bucket (v);
+		const uint64_t min = fh_histogram_bucket_min (bucket);
+
+		assert (min <= v);
+		assert (v - min <= v / FH_HISTOGRAM_SUB_COUNT);
+	}
+
+	assert (fh_histogram_bucket (UINT64_MAX) == FH_HISTOGRAM_BUCKETS - 1);
+
+	static struct fh_histogram h, merged;
+	memset (&h, 0, sizeof (h));
+	assert (fh_histogram_percentile (&h, 0.5) == 0);
+
+	for (uint64_t v = 1; v <= 1000; v++)
+		fh_histogram_record (&h, v);
+
+	assert (h.count == 1000);
+	assert (h.sum == 500500);
+	assert (h.max == 1000);
+
+	const uint64_t p50 = fh_histogram_percentile (&h, 0.5);
+	const uint64_t p99 = fh_histogram_percentile (&h, 0.99);
+
+	printf ("p50 %lu p99 %lu\n", p50, p99);
+	assert (p50 >= 500 && p50 <= 500 + 500 / FH_HISTOGRAM_SUB_COUNT);
+	assert (p99 >= 990 && p99 <= 1000);
+	assert (fh_histogram_percentile (&h, 1.0) == 1000);
+
+	fh_histogram_merge (&merged, &h);
+	fh_histogram_record (&h, 5000);
+	fh_histogram_merge (&merged, &h);
+
+	assert (merged.count == 2001);
+	assert (merged.sum == 2 * 500500 + 5000);
+	assert (merged.max == 5000);
+	assert (fh_histogram_percentile (&merged, 0.5)
+			== fh_histogram_percentile (&h, 0.5));
+
+	return 0;
+}
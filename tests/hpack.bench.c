@@ -0,0 +1,131 @@
+/*
+ * This file is part of OSN freehttpd.
+ * 
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Throughput of the HPACK codec on typical request and response header
+   blocks.  Run with `make check-hpack-benchmark'.  */
+
+#undef NDEBUG
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "http/hpack.h"
+#include "mm/pool.h"
+
+#define ITERATIONS 1000000
+
+static const char *response_fields[][2] = {
+	{ ":status", "200" },
+	{ "server", "freehttpd" },
+	{ "date", "Mon, 21 Oct 2013 20:13:21 GMT" },
+	{ "content-type", "text/html; charset=UTF-8" },
+	{ "content-length", "24001" },
+	{ "last-modified", "Sat, 18 Oct 2025 10:00:00 GMT" },
+	{ "accept-ranges", "bytes" },
+	{ "vary", "Accept-Encoding" },
+};
+
+/* RFC 7541, C.4.1: a request with Huffman coded strings, added to the
+   dynamic table */
+static const uint8_t request_block[] = {
+	0x82, 0x86, 0x84, 0x41, 0x8c, 0xf1, 0xe3, 0xc2, 0xe5,
+	0xf2, 0x3a, 0x6b, 0xa0, 0xab, 0x90, 0xf4, 0xff,
+};
+
+static size_t decoded;
+
+static bool
+count_field (void *data, const char *name, size_t name_len, const char *value,
+			 size_t value_len)
+{
+	(void) data;
+	(void) name;
+	(void) value;
+	decoded += name_len + value_len;
+	return true;
+}
+
+static double
+now (void)
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static void
+report (const char *what, double elapsed, size_t bytes)
+{
+	printf ("%-8s %10.1f ns/block %10.1f MB/s\n", what,
+			elapsed * 1e9 / ITERATIONS, (double) bytes / elapsed / 1e6);
+}
+
+int
+main (void)
+{
+	const size_t field_count
+		= sizeof (response_fields) / sizeof (response_fields[0]);
+	uint8_t block[1024];
+	size_t encoded = 0;
+	double start;
+
+	start = now ();
+
+	for (size_t i = 0; i < ITERATIONS; i++)
+	{
+		size_t len = 0;
+
+		for (size_t j = 0; j < field_count; j++)
+		{
+			size_t n = fh_hpack_encode_field (
+				block + len, sizeof (block) - len, response_fields[j][0],
+				strlen (response_fields[j][0]), response_fields[j][1],
+				strlen (response_fields[j][1]));
+			assert (n > 0);
+			len += n;
+		}
+
+		encoded += len;
+	}
+
+	report ("encode", now () - start, encoded);
+
+	struct fh_hpack_decoder decoder;
+	assert (fh_hpack_decoder_init (&decoder, FH_HPACK_DEFAULT_TABLE_SIZE));
+
+	start = now ();
+
+	for (size_t i = 0; i < ITERATIONS; i++)
+	{
+		pool_t *pool = fh_pool_create (0);
+		assert (pool != NULL);
+		assert (fh_hpack_decode (&decoder, pool, request_block,
+								 sizeof (request_block), &count_field, NULL));
+		fh_pool_destroy (pool);
+	}
+
+	report ("decode", now () - start, sizeof (request_block) * ITERATIONS);
+
+	fh_hpack_decoder_free (&decoder);
+	return decoded ? 0 : 1;
+}
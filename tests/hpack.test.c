@@ -0,0 +1,432 @@
+/*
+ * This file is part of OSN freehttpd.
+ * 
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#undef NDEBUG
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "http/hpack.h"
+#include "mm/pool.h"
+
+struct header_list
+{
+	size_t count;
+	const char *names[16];
+	const char *values[16];
+};
+
+static bool
+collect (void *data, const char *name, size_t name_len, const char *value,
+		 size_t value_len)
+{
+	struct header_list *list = data;
+
+	assert (list->count < 16);
+	assert (strlen (name) == name_len);
+	assert (strlen (value) == value_len);
+	list->names[list->count] = name;
+	list->values[list->count] = value;
+	list->count++;
+	return true;
+}
+
+static bool
+count_fields (void *data, const char *name __attribute__ ((unused)),
+			  size_t name_len __attribute__ ((unused)),
+			  const char *value __attribute__ ((unused)),
+			  size_t value_len __attribute__ ((unused)))
+{
+	(*(size_t *) data)++;
+	return true;
+}
+
+static size_t
+unhex (const char *hex, uint8_t *out)
+{
+	size_t len = 0;
+
+	for (; hex[0] && hex[1]; hex += 2)
+	{
+		unsigned int byte;
+		assert (sscanf (hex, "%2x", &byte) == 1);
+		out[len++] = (uint8_t) byte;
+	}
+
+	return len;
+}
+
+/* Decodes one block and checks it against a NULL-terminated list of
+   name/value pairs and the expected table size.  */
+static void
+check_block (struct fh_hpack_decoder *decoder, pool_t *pool, const char *hex,
+			 size_t table_size, const char **expected)
+{
+	uint8_t block[512];
+	struct header_list list = { 0 };
+	size_t len = unhex (hex, block);
+	size_t i = 0;
+
+	assert (fh_hpack_decode (decoder, pool, block, len, &collect, &list));
+
+	for (; expected[2 * i]; i++)
+	{
+		assert (i < list.count);
+		assert (!strcmp (list.names[i], expected[2 * i]));
+		assert (!strcmp (list.values[i], expected[2 * i + 1]));
+	}
+
+	assert (i == list.count);
+	assert (decoder->table.size == table_size);
+}
+
+static const char *c3_1[] = { ":method", "GET", ":scheme", "http", ":path", "/",
+							  ":authority", "www.example.com", NULL };
+static const char *c3_2[]
+	= { ":method",	  "GET",			 ":scheme",		  "http",
+		":path",	  "/",				 ":authority",	  "www.example.com",
+		"cache-control", "no-cache",	 NULL };
+static const char *c3_3[]
+	= { ":method",	  "GET",			 ":scheme",		  "https",
+		":path",	  "/index.html",	 ":authority",	  "www.example.com",
+		"custom-key", "custom-value",	 NULL };
+
+static const char *c5_1[]
+	= { ":status",		 "302",
+		"cache-control", "private",
+		"date",			 "Mon, 21 Oct 2013 20:13:21 GMT",
+		"location",		 "https://www.example.com",
+		NULL };
+static const char *c5_2[]
+	= { ":status",		 "307",
+		"cache-control", "private",
+		"date",			 "Mon, 21 Oct 2013 20:13:21 GMT",
+		"location",		 "https://www.example.com",
+		NULL };
+static const char *c5_3[]
+	= { ":status",
+		"200",
+		"cache-control",
+		"private",
+		"date",
+		"Mon, 21 Oct 2013 20:13:22 GMT",
+		"location",
+		"https://www.example.com",
+		"content-encoding",
+		"gzip",
+		"set-cookie",
+		"foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1",
+		NULL };
+
+/* RFC 7541, C.3 and C.4: requests, without and with Huffman coding */
+static void
+test_requests (pool_t *pool, bool huffman)
+{
+	struct fh_hpack_decoder decoder;
+
+	assert (fh_hpack_decoder_init (&decoder, 4096));
+
+	if (huffman)
+	{
+		check_block (&decoder, pool, "828684418cf1e3c2e5f23a6ba0ab90f4ff", 57,
+					 c3_1);
+		check_block (&decoder, pool, "828684be5886a8eb10649cbf", 110, c3_2);
+		check_block (&decoder, pool,
+					 "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf", 164,
+					 c3_3);
+	}
+	else
+	{
+		check_block (&decoder, pool,
+					 "828684410f7777772e6578616d706c652e636f6d", 57, c3_1);
+		check_block (&decoder, pool, "828684be58086e6f2d6361636865", 110,
+					 c3_2);
+		check_block (&decoder, pool,
+					 "828785bf400a637573746f6d2d6b65790c637573746f6d2d76616c75"
+					 "65",
+					 164, c3_3);
+	}
+
+	assert (decoder.table.count == 3);
+	fh_hpack_decoder_free (&decoder);
+}
+
+/* RFC 7541, C.5 and C.6: responses with a 256 byte table, so entries
+   get evicted */
+static void
+test_responses (pool_t *pool, bool huffman)
+{
+	struct fh_hpack_decoder decoder;
+
+	assert (fh_hpack_decoder_init (&decoder, 256));
+
+	if (huffman)
+	{
+		check_block (&decoder, pool,
+					 "488264025885aec3771a4b6196d07abe941054d444a8200595040b81"
+					 "66e082a62d1bff6e919d29ad171863c78f0b97c8e9ae82ae43d3",
+					 222, c5_1);
+		check_block (&decoder, pool, "4883640effc1c0bf", 222, c5_2);
+		check_block (&decoder, pool,
+					 "88c16196d07abe941054d444a8200595040b8166e084a62d1bffc05a"
+					 "839bd9ab77ad94e7821dd7f2e6c7b335dfdfcd5b3960d5af27087f36"
+					 "72c1ab270fb5291f9587316065c003ed4ee5b1063d5007",
+					 215, c5_3);
+	}
+	else
+	{
+		check_block (&decoder, pool,
+					 "4803333032580770726976617465611d4d6f6e2c203231204f637420"
+					 "323031332032303a31333a323120474d546e1768747470733a2f2f77"
+					 "77772e6578616d706c652e636f6d",
+					 222, c5_1);
+		check_block (&decoder, pool, "4803333037c1c0bf", 222, c5_2);
+		check_block (&decoder, pool,
+					 "88c1611d4d6f6e2c203231204f637420323031332032303a31333a32"
+					 "3220474d54c05a04677a69707738666f6f3d4153444a4b48514b425a"
+					 "584f5157454f50495541585157454f49553b206d61782d6167653d33"
+					 "3630303b2076657273696f6e3d31",
+					 215, c5_3);
+	}
+
+	assert (decoder.table.count == 3);
+	fh_hpack_decoder_free (&decoder);
+}
+
+static void
+test_malformed (pool_t *pool)
+{
+	struct fh_hpack_decoder decoder;
+	struct header_list list = { 0 };
+	uint8_t block[64];
+	size_t len;
+
+	assert (fh_hpack_decoder_init (&decoder, 4096));
+
+	/* Index 0, an index past the tables, a truncated integer and a
+	   string running past the block */
+	len = unhex ("80", block);
+	assert (!fh_hpack_decode (&decoder, pool, block, len, &collect, &list));
+	len = unhex ("bf", block);
+	assert (!fh_hpack_decode (&decoder, pool, block, len, &collect, &list));
+	len = unhex ("ff", block);
+	assert (!fh_hpack_decode (&decoder, pool, block, len, &collect, &list));
+	len = unhex ("0f2805616263", block);
+	assert (!fh_hpack_decode (&decoder, pool, block, len, &collect, &list));
+
+	/* Huffman padding that is not an EOS prefix, padding longer than 7
+	   bits, and an explicit EOS */
+	len = unhex ("0f2881fe", block);
+	assert (!fh_hpack_decode (&decoder, pool, block, len, &collect, &list));
+	len = unhex ("0f28821fff", block);
+	assert (!fh_hpack_decode (&decoder, pool, block, len, &collect, &list));
+	len = unhex ("0f2884ffffffff", block);
+	assert (!fh_hpack_decode (&decoder, pool, block, len, &collect, &list));
+
+	/* Table size updates above the limit or after a field */
+	len = unhex ("3fe21f", block);
+	assert (!fh_hpack_decode (&decoder, pool, block, len, &collect, &list));
+	len = unhex ("8220", block);
+	assert (!fh_hpack_decode (&decoder, pool, block, len, &collect, &list));
+
+	fh_hpack_decoder_free (&decoder);
+}
+
+static void
+test_eviction (pool_t *pool)
+{
+	struct fh_hpack_decoder decoder;
+	char hex[128];
+
+	/* Room for two entries of 45 bytes; the strings wrap around the ring
+	   over and over again.  */
+	assert (fh_hpack_decoder_init (&decoder, 100));
+
+	for (int i = 0; i < 50; i++)
+	{
+		char value[8];
+		const char *expected[] = { "x-key", value, NULL };
+
+		snprintf (value, sizeof value, "val%04d", i);
+		snprintf (hex, sizeof hex, "4005782d6b657907%02x%02x%02x%02x%02x%02x%02x",
+				  value[0], value[1], value[2], value[3], value[4], value[5],
+				  value[6]);
+		check_block (&decoder, pool, hex, i ? 88 : 44, expected);
+
+		if (i)
+		{
+			char previous[8];
+			const char *expected_previous[] = { "x-key", previous, NULL };
+
+			snprintf (previous, sizeof previous, "val%04d", i - 1);
+			check_block (&decoder, pool, "bf", 88, expected_previous);
+		}
+	}
+
+	/* Shrinking the table evicts the oldest entry first.  */
+	const char *newest[] = { "x-key", "val0049", NULL };
+	check_block (&decoder, pool, "3f1abe", 44, newest);
+
+	fh_hpack_decoder_free (&decoder);
+}
+
+static void
+test_encode (pool_t *pool)
+{
+	static const char *fields[][2] = {
+		{ ":status", "200" },
+		{ ":status", "418" },
+		{ "server", "freehttpd" },
+		{ "Content-Type", "text/html; charset=UTF-8" },
+		{ "accept-encoding", "gzip, deflate" },
+		{ "X-Custom-Header", "some value with \x01 control \xff bytes" },
+		{ "vary", "" },
+		{ "content-length", "12345" },
+	};
+
+	struct fh_hpack_decoder decoder;
+	struct header_list list = { 0 };
+	uint8_t block[512];
+	size_t len = 0;
+
+	assert (fh_hpack_decoder_init (&decoder, 4096));
+
+	for (size_t i = 0; i < sizeof (fields) / sizeof (fields[0]); i++)
+	{
+		size_t n = fh_hpack_encode_field (block + len, sizeof (block) - len,
+										  fields[i][0], strlen (fields[i][0]),
+										  fields[i][1], strlen (fields[i][1]));
+		assert (n > 0);
+		len += n;
+	}
+
+	assert (fh_hpack_decode (&decoder, pool, block, len, &collect, &list));
+	assert (list.count == sizeof (fields) / sizeof (fields[0]));
+
+	for (size_t i = 0; i < list.count; i++)
+	{
+		assert (!strcasecmp (list.names[i], fields[i][0]));
+		assert (!strcmp (list.values[i], fields[i][1]));
+
+		for (const char *c = list.names[i]; *c; c++)
+			assert (*c < 'A' || *c > 'Z');
+	}
+
+	/* Static matches are single bytes, and nothing ends up in the
+	   decoder's table.  */
+	assert (fh_hpack_encode_status (block, sizeof (block), 404) == 1
+			&& block[0] == 0x8d);
+	assert (fh_hpack_encode_field (block, sizeof (block), ":path", 5,
+								   "/index.html", 11)
+				== 1
+			&& block[0] == 0x85);
+	assert (fh_hpack_encode_field (block, sizeof (block), "Accept-Encoding",
+								   15, "gzip, deflate", 13)
+				== 1
+			&& block[0] == 0x90);
+	assert (decoder.table.count == 0);
+
+	/* C.4.1 encodes www.example.com as 8c f1e3 c2e5 f23a 6ba0 ab90 f4ff */
+	len = fh_hpack_encode_field (block, sizeof (block), ":authority", 10,
+								 "www.example.com", 15);
+	assert (len == 14 && block[0] == 0x01 && block[1] == 0x8c
+			&& block[2] == 0xf1 && block[13] == 0xff);
+
+	/* No room */
+	assert (fh_hpack_encode_field (block, 5, "server", 6, "freehttpd", 9)
+			== 0);
+
+	fh_hpack_decoder_free (&decoder);
+}
+
+/* A large table entry referenced over and over must not be copied once
+   the list is past its limit.  */
+static void
+test_list_size (void)
+{
+	enum { VALUE_LEN = 4000, REFS = 60000 };
+	struct fh_hpack_decoder decoder;
+	uint8_t *block = malloc (16 + VALUE_LEN + REFS);
+	size_t len = 0, count = 0;
+
+	assert (block != NULL);
+	assert (fh_hpack_decoder_init (&decoder, 4096));
+	decoder.max_list_size = 65536;
+
+	/* x-bomb: aaa..., with incremental indexing */
+	block[len++] = 0x40;
+	block[len++] = 6;
+	memcpy (block + len, "x-bomb", 6);
+	len += 6;
+	block[len++] = 0x7f;
+	block[len++] = (uint8_t) (((VALUE_LEN - 127) & 0x7f) | 0x80);
+	block[len++] = (uint8_t) ((VALUE_LEN - 127) >> 7);
+	memset (block + len, 'a', VALUE_LEN);
+	len += VALUE_LEN;
+	memset (block + len, 0xbe, REFS);
+	len += REFS;
+
+	pool_t *pool = fh_pool_create (0);
+	assert (pool != NULL);
+
+	const size_t before = fh_pool_bytes;
+
+	assert (fh_hpack_decode (&decoder, pool, block, len, &count_fields,
+							 &count));
+	assert (decoder.list_too_large);
+	/* 16 fields of 4038 bytes fit into 64 KiB */
+	assert (count == 16);
+	assert (fh_pool_bytes - before < 1024 * 1024);
+	fh_pool_destroy (pool);
+
+	/* The entry was still added, and the next block starts afresh.  */
+	pool = fh_pool_create (0);
+	assert (pool != NULL);
+	count = 0;
+	block[0] = 0xbe;
+	assert (fh_hpack_decode (&decoder, pool, block, 1, &count_fields, &count));
+	assert (!decoder.list_too_large && count == 1);
+	fh_pool_destroy (pool);
+
+	fh_hpack_decoder_free (&decoder);
+	free (block);
+}
+
+int
+main (void)
+{
+	pool_t *pool = fh_pool_create (0);
+	assert (pool != NULL);
+
+	test_requests (pool, false);
+	test_requests (pool, true);
+	test_responses (pool, false);
+	test_responses (pool, true);
+	test_malformed (pool);
+	test_eviction (pool);
+	test_encode (pool);
+	test_list_size ();
+
+	fh_pool_destroy (pool);
+	return 0;
+}
@@ -0,0 +1,94 @@
+/*
+ * This file is part of OSN freehttpd.
+ * 
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#undef NDEBUG
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "log/log.h"
+
+static struct fh_log_module module_a = { .name = "a" };
+static struct fh_log_module module_b = { .name = "b" };
+
+/* The level that a module registered now gets */
+static enum fh_log_level
+level_of (const char *name)
+{
+	struct fh_log_module module = { .name = name };
+
+	fh_log_register (&module);
+	fh_log_unregister (&module);
+	return module.level;
+}
+
+static void
+assert_levels (enum fh_log_level a, enum fh_log_level b,
+			   enum fh_log_level other)
+{
+	assert (module_a.level == a && level_of ("a") == a);
+	assert (module_b.level == b && level_of ("b") == b);
+	assert (fh_log_default_module.level == other && level_of ("c") == other);
+}
+
+int
+main (void)
+{
+	fh_log_register (&module_a);
+	fh_log_register (&module_b);
+
+	assert (fh_log_set_levels ("warn, a=debug"));
+	assert_levels (LOG_DEBUG, LOG_WARN, LOG_WARN);
+
+	/* A bad token anywhere leaves every level as it was.  */
+	assert (!fh_log_set_levels ("error b=error a=verbose"));
+	assert (!fh_log_set_levels ("b=error =info"));
+	assert (!fh_log_set_levels ("b=error info=info=info"));
+	assert (!fh_log_set_levels ("b=error loud"));
+	assert_levels (LOG_DEBUG, LOG_WARN, LOG_WARN);
+
+	/* Overrides are merged with the ones already set.  */
+	assert (fh_log_set_levels ("b=error"));
+	assert_levels (LOG_DEBUG, LOG_ERR, LOG_WARN);
+	assert (fh_log_set_levels ("b=info b=debug"));
+	assert_levels (LOG_DEBUG, LOG_DEBUG, LOG_WARN);
+
+	/* So is the table being full only found out while merging.  */
+	for (size_t i = 2; i < 64; i++)
+	{
+		char spec[32];
+
+		snprintf (spec, sizeof (spec), "m%zu=info", i);
+		assert (fh_log_set_levels (spec));
+	}
+
+	assert (fh_log_set_levels ("a=info m2=error"));
+	assert_levels (LOG_INFO, LOG_DEBUG, LOG_WARN);
+	assert (!fh_log_set_levels ("a=error b=error full=debug"));
+	assert_levels (LOG_INFO, LOG_DEBUG, LOG_WARN);
+
+	/* A level for all modules drops the overrides before it.  */
+	assert (fh_log_set_levels ("b=error info full=debug"));
+	assert_levels (LOG_INFO, LOG_INFO, LOG_INFO);
+
+	fh_log_unregister (&module_a);
+	fh_log_unregister (&module_b);
+	return 0;
+}
@@ -0,0 +1,405 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Time and heap allocations per operation of the core data structures
+   and the HTTP/1.x codec.  Every benchmark runs for at least
+   MICROBENCH_MIN_TIME, and prints one JSON object per line, so that the
+   output of two runs can be compared line by line.  Names given on the
+   command line select the benchmarks to run.  Run with
+   `make check-microbench'.  */
+
+#undef NDEBUG
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "core/conf.h"
+#include "core/conn.h"
+#include "core/server.h"
+#include "core/stream.h"
+#include "digest/base64.h"
+#include "hash/itable.h"
+#include "hash/strtable.h"
+#include "http/http1_request.h"
+#include "http/http1_response.h"
+#include "http/protocol.h"
+#include "mm/pool.h"
+#include "utils/path.h"
+
+#define MICROBENCH_MIN_TIME 0.2
+#define TABLE_KEYS 4096
+#define POOL_ALLOCS 1024
+/* Size of the pieces that a fragmented request comes in */
+#define FRAGMENT_SIZE 7
+
+struct microbench
+{
+	const char *name;
+	void (*run) (size_t ops);
+};
+
+static const char request[]
+	= "GET /static/css/site.css?v=3 HTTP/1.1\r\n"
+	  "Host: localhost\r\n"
+	  "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101\r\n"
+	  "Accept: text/css,*/*;q=0.1\r\n"
+	  "Accept-Language: en-US,en;q=0.5\r\n"
+	  "Accept-Encoding: gzip, deflate, br\r\n"
+	  "Referer: http://localhost/index.html\r\n"
+	  "Connection: keep-alive\r\n"
+	  "\r\n";
+
+static const char *hosts[]
+	= { "localhost",	   "localhost:8080", "example.com", "www.example.com",
+		"api.example.com", "127.0.0.1",		 "[::1]:8443",	"static.example.org" };
+
+/* Sink for results, so that the calls are not optimized away */
+static volatile uintptr_t sink;
+/* What the tables map keys to */
+static int value;
+static uint64_t allocations;
+
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t n, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+void *
+malloc (size_t size)
+{
+	allocations++;
+	return __libc_malloc (size);
+}
+
+void *
+calloc (size_t n, size_t size)
+{
+	allocations++;
+	return __libc_calloc (n, size);
+}
+
+void *
+realloc (void *ptr, size_t size)
+{
+	allocations++;
+	return __libc_realloc (ptr, size);
+}
+
+static struct itable *itable;
+static struct strtable *strtable;
+static struct fh_server server;
+static char docroot[] = "/var/www/html";
+static struct fh_config_host host_config = { .docroot = docroot };
+static struct fh_conn conn;
+static struct fh_requests conn_requests;
+static struct fh_conn_extra conn_extra;
+static struct fh_stream conn_stream;
+
+static double
+now (void)
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static void
+bench_pool_alloc (size_t ops)
+{
+	for (size_t i = 0; i < ops; i += POOL_ALLOCS)
+	{
+		pool_t *pool = fh_pool_create (0);
+		assert (pool != NULL);
+
+		for (size_t j = 0; j < POOL_ALLOCS; j++)
+			sink = (uintptr_t) fh_pool_alloc (pool, 8 + (j & 63));
+
+		fh_pool_destroy (pool);
+	}
+}
+
+static void
+bench_itable_set (size_t ops)
+{
+	for (size_t i = 0; i < ops; i += TABLE_KEYS)
+	{
+		struct itable *table = itable_create (0);
+		assert (table != NULL);
+
+		for (uint64_t key = 0; key < TABLE_KEYS; key++)
+			assert (itable_set (table, key * 7 + 3, &value));
+
+		itable_destroy (table);
+	}
+}
+
+static void
+bench_itable_get_hit (size_t ops)
+{
+	for (size_t i = 0; i < ops; i++)
+		sink = (uintptr_t) itable_get (itable, (i % TABLE_KEYS) * 7 + 3);
+}
+
+static void
+bench_itable_get_miss (size_t ops)
+{
+	for (size_t i = 0; i < ops; i++)
+		sink = (uintptr_t) itable_get (itable, (i % TABLE_KEYS) * 7 + 4);
+}
+
+static void
+bench_strtable_get_hit (size_t ops)
+{
+	const size_t count = sizeof (hosts) / sizeof (hosts[0]);
+
+	for (size_t i = 0; i < ops; i++)
+		sink = (uintptr_t) strtable_get (strtable, hosts[i % count]);
+}
+
+static void
+bench_strtable_get_miss (size_t ops)
+{
+	for (size_t i = 0; i < ops; i++)
+		sink = (uintptr_t) strtable_get (strtable, "unknown.example.net");
+}
+
+static void
+bench_path_normalize (size_t ops)
+{
+	static const char path[] = "/static/./css/../css//vendor/../site.css";
+	char normalized[sizeof (path)];
+
+	for (size_t i = 0; i < ops; i++)
+	{
+		size_t len = sizeof (path) - 1;
+		assert (path_normalize (normalized, path, &len));
+		sink = len;
+	}
+}
+
+static void
+parse_request (size_t fragment_size)
+{
+	pool_t *pool = fh_pool_create (0);
+	assert (pool != NULL);
+
+	fh_stream_init (conn.stream, pool);
+	conn.pool = pool;
+
+	for (size_t off = 0; off < sizeof (request) - 1; off += fragment_size)
+	{
+		const size_t len = sizeof (request) - 1 - off < fragment_size
+							   ? sizeof (request) - 1 - off
+							   : fragment_size;
+
+		assert (fh_stream_add_buf_memcpy (conn.stream,
+										  (const uint8_t *) request + off, len,
+										  len));
+	}
+
+	struct fh_http1_req_ctx *ctx
+		= fh_http1_ctx_create (&server, &conn, conn.stream);
+	assert (ctx != NULL);
+
+	ctx->cur.link = ctx->arg_cur.link = conn.stream->head;
+	conn.stream->head->is_start = true;
+
+	assert (fh_http1_parse (ctx, &conn));
+	assert (ctx->state == H1_REQ_STATE_DONE);
+	sink = ctx->request.uri_len;
+	fh_pool_destroy (pool);
+}
+
+static void
+bench_http1_parse (size_t ops)
+{
+	for (size_t i = 0; i < ops; i++)
+		parse_request (sizeof (request));
+}
+
+static void
+bench_http1_parse_fragmented (size_t ops)
+{
+	for (size_t i = 0; i < ops; i++)
+		parse_request (FRAGMENT_SIZE);
+}
+
+static void
+bench_http1_send_headers (size_t ops)
+{
+	for (size_t i = 0; i < ops; i++)
+	{
+		pool_t *pool = fh_pool_create (0);
+		assert (pool != NULL);
+
+		struct fh_http1_res_ctx *ctx = fh_http1_res_ctx_create (pool);
+		assert (ctx != NULL);
+
+		struct fh_response *response = ctx->response;
+		struct fh_headers *headers = fh_response_get_headers (response);
+		assert (headers != NULL);
+
+		response->status = FH_STATUS_OK;
+		response->content_type = "text/css; charset=UTF-8";
+		response->content_type_len = strlen (response->content_type);
+		response->content_length = 24001;
+		response->no_send_body = true;
+		assert (fh_header_add (pool, headers, "Last-Modified", 13,
+							   "Sat, 18 Oct 2025 10:00:00 GMT", 29));
+		assert (fh_header_add (pool, headers, "ETag", 4,
+							   "\"68f365a0-5dc1\"", 15));
+		assert (fh_header_add (pool, headers, "Cache-Control", 13,
+							   "max-age=3600", 12));
+		assert (fh_header_add (pool, headers, "Vary", 4, "Accept-Encoding",
+							   15));
+
+		assert (fh_http1_send_response (ctx, &conn));
+		assert (ctx->state == FH_RES_STATE_DONE);
+		fh_pool_destroy (pool);
+	}
+}
+
+static void
+bench_base64_encode (size_t ops)
+{
+	static const char data[48] = "Aladdin:open sesame, and a little more data..";
+	char out[80];
+	struct fh_base64_buf b64 = { .buf = out };
+
+	for (size_t i = 0; i < ops; i++)
+	{
+		b64.size = 0;
+		assert (fh_base64_encode (&b64, data, sizeof (data)));
+		sink = b64.size;
+	}
+}
+
+static void
+bench_base64_decode (size_t ops)
+{
+	static const char data[]
+		= "QWxhZGRpbjpvcGVuIHNlc2FtZSwgYW5kIGEgbGl0dGxlIG1vcmUgZGF0YS4uAAA=";
+	char out[64];
+	struct fh_base64_buf b64 = { .buf = out };
+
+	for (size_t i = 0; i < ops; i++)
+	{
+		b64.size = 0;
+		assert (fh_base64_decode (&b64, data, sizeof (data) - 1));
+		sink = b64.size;
+	}
+}
+
+static const struct microbench benchmarks[] = {
+	{ "pool_alloc", &bench_pool_alloc },
+	{ "itable_set", &bench_itable_set },
+	{ "itable_get_hit", &bench_itable_get_hit },
+	{ "itable_get_miss", &bench_itable_get_miss },
+	{ "strtable_get_hit", &bench_strtable_get_hit },
+	{ "strtable_get_miss", &bench_strtable_get_miss },
+	{ "path_normalize", &bench_path_normalize },
+	{ "http1_parse", &bench_http1_parse },
+	{ "http1_parse_fragmented", &bench_http1_parse_fragmented },
+	{ "http1_send_headers", &bench_http1_send_headers },
+	{ "base64_encode", &bench_base64_encode },
+	{ "base64_decode", &bench_base64_decode },
+};
+
+static void
+setup (void)
+{
+	itable = itable_create (0);
+	strtable = strtable_create (0);
+	assert (itable != NULL && strtable != NULL);
+
+	for (uint64_t key = 0; key < TABLE_KEYS; key++)
+		assert (itable_set (itable, key * 7 + 3, &value));
+
+	for (size_t i = 0; i < sizeof (hosts) / sizeof (hosts[0]); i++)
+		assert (strtable_set (strtable, hosts[i], &value));
+
+	server.host_configs = strtable_create (0);
+	assert (server.host_configs != NULL);
+	assert (strtable_set (server.host_configs, "localhost", &host_config));
+
+	/* Responses are written to /dev/null, requests never need to be read */
+	conn.client_sockfd = open ("/dev/null", O_WRONLY | O_CLOEXEC);
+	assert (conn.client_sockfd >= 0);
+	conn.stream = &conn_stream;
+	conn.requests = &conn_requests;
+	conn.extra = &conn_extra;
+}
+
+static void
+run (const struct microbench *bench)
+{
+	size_t ops = 4096;
+	double elapsed;
+	uint64_t allocated;
+
+	bench->run (ops);
+
+	for (;;)
+	{
+		allocated = allocations;
+		elapsed = now ();
+		bench->run (ops);
+		elapsed = now () - elapsed;
+		allocated = allocations - allocated;
+
+		if (elapsed >= MICROBENCH_MIN_TIME)
+			break;
+
+		ops *= elapsed > 0 && MICROBENCH_MIN_TIME / elapsed < 8 ? 2 : 8;
+	}
+
+	printf ("{\"name\": \"%s\", \"ops\": %zu, \"ns_per_op\": %.2f, "
+			"\"allocs_per_op\": %.4f}\n",
+			bench->name, ops, elapsed * 1e9 / (double) ops,
+			(double) allocated / (double) ops);
+	fflush (stdout);
+}
+
+int
+main (int argc, char **argv)
+{
+	setup ();
+
+	for (size_t i = 0; i < sizeof (benchmarks) / sizeof (benchmarks[0]); i++)
+	{
+		bool selected = argc < 2;
+
+		for (int j = 1; j < argc && !selected; j++)
+			selected = !strcmp (argv[j], benchmarks[i].name);
+
+		if (selected)
+			run (&benchmarks[i]);
+	}
+
+	itable_destroy (itable);
+	strtable_destroy (strtable);
+	strtable_destroy (server.host_configs);
+	close (conn.client_sockfd);
+	return 0;
+}
@@ -49,6 +49,16 @@ main (void)
 		assert (*ints[i] == i * 2);
 	}
 
+	/* 5000 small allocations take a few chunks */
+	assert (root_pool->chunk_count > 1);
+	assert (fh_pool_bytes == root_pool->size);
+
+	void *large = fh_pool_alloc (root_pool, FH_SMALL_MAX_SIZE * 2);
+	assert (large != NULL);
+	assert (fh_pool_bytes == root_pool->size);
+	assert (fh_pool_bytes > FH_SMALL_MAX_SIZE * 2);
+
 	fh_pool_destroy (root_pool);
+	assert (fh_pool_bytes == 0);
 	return 0;
 }
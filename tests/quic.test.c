@@ -0,0 +1,286 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#undef NDEBUG
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "core/quic.h"
+
+#define SLOT_SIZE FH_QUIC_MAX_GRO_SIZE
+
+static uint8_t recv_buf[FH_QUIC_BATCH_SIZE * SLOT_SIZE];
+
+static void
+test_parse_header (void)
+{
+	struct fh_quic_header header;
+	const uint8_t initial[] = {
+		0xc3, 0x00, 0x00, 0x00, 0x01,		/* Initial, version 1 */
+		0x08, 1, 2, 3, 4, 5, 6, 7, 8,		/* DCID */
+		0x04, 9, 10, 11, 12,				/* SCID */
+		0x00,								/* token length */
+	};
+
+	assert (fh_quic_parse_header (initial, sizeof initial, &header));
+	assert (header.is_long);
+	assert (header.version == 1);
+	assert (header.dcid_len == 8 && header.dcid == initial + 6);
+	assert (header.scid_len == 4 && header.scid == initial + 15);
+
+	/* Truncated in the middle of either connection ID */
+	assert (!fh_quic_parse_header (initial, 10, &header));
+	assert (!fh_quic_parse_header (initial, 16, &header));
+	assert (!fh_quic_parse_header (initial, 0, &header));
+
+	uint8_t short_header[1 + FH_QUIC_CID_LEN + 4] = { 0x40 };
+
+	for (size_t i = 0; i < FH_QUIC_CID_LEN; i++)
+		short_header[1 + i] = (uint8_t) i;
+
+	assert (fh_quic_parse_header (short_header, sizeof short_header, &header));
+	assert (!header.is_long);
+	assert (header.dcid_len == FH_QUIC_CID_LEN && header.dcid == short_header + 1);
+	assert (!fh_quic_parse_header (short_header, FH_QUIC_CID_LEN, &header));
+}
+
+static void
+test_version_negotiation (void)
+{
+	const uint8_t initial[] = {
+		0xc0, 0x1a, 0x2a, 0x3a, 0x4a, 0x02, 0xaa, 0xbb, 0x03, 0x11, 0x22, 0x33,
+	};
+	struct fh_quic_header header;
+	const uint32_t versions[] = { 0x00000001, 0x6b3343cf };
+	uint8_t out[64];
+
+	assert (fh_quic_parse_header (initial, sizeof initial, &header));
+
+	size_t len = fh_quic_write_version_negotiation (out, sizeof out, &header,
+													versions, 2);
+
+	assert (len == 7 + 3 + 2 + 8);
+	assert (out[0] & 0x80);
+	assert (!memcmp (out + 1, "\0\0\0\0", 4));
+	assert (out[5] == 3 && !memcmp (out + 6, initial + 9, 3));
+	assert (out[9] == 2 && !memcmp (out + 10, initial + 6, 2));
+	assert (!memcmp (out + 12, "\x00\x00\x00\x01\x6b\x33\x43\xcf", 8));
+
+	assert (!fh_quic_write_version_negotiation (out, len - 1, &header,
+												versions, 2));
+}
+
+static void
+test_cid (void)
+{
+	uint8_t a[FH_QUIC_CID_LEN], b[FH_QUIC_CID_LEN];
+
+	assert (fh_quic_generate_cid (a, sizeof a, 5));
+	assert (fh_quic_generate_cid (b, sizeof b, 5));
+	assert (a[0] == 5 && b[0] == 5);
+	assert (memcmp (a, b, sizeof a));
+	assert (fh_quic_cid_hash (a, sizeof a) == fh_quic_cid_hash (a, sizeof a));
+	assert (fh_quic_cid_hash (a, sizeof a) != fh_quic_cid_hash (b, sizeof b));
+}
+
+static uint16_t
+free_udp_port (void)
+{
+	struct sockaddr_in addr = { .sin_family = AF_INET };
+	socklen_t addr_len = sizeof addr;
+	int fd = socket (AF_INET, SOCK_DGRAM, 0);
+
+	assert (fd >= 0);
+	assert (bind (fd, (struct sockaddr *) &addr, sizeof addr) == 0);
+	assert (getsockname (fd, (struct sockaddr *) &addr, &addr_len) == 0);
+	close (fd);
+	return ntohs (addr.sin_port);
+}
+
+/* Receives everything that arrives on `fd' within a short while and
+   returns the number of payload bytes.  */
+static size_t
+drain (fd_t fd, struct fh_quic_batch *batch, uint8_t *first_byte)
+{
+	size_t total = 0;
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+	while (poll (&pfd, 1, 100) > 0)
+	{
+		int count = fh_quic_recv_batch (fd, batch, recv_buf, SLOT_SIZE);
+
+		assert (count >= 0);
+
+		for (int i = 0; i < count; i++)
+		{
+			if (first_byte)
+				*first_byte = batch->datagrams[i].data[1];
+
+			assert (batch->datagrams[i].local.s_addr == htonl (INADDR_LOOPBACK));
+			total += batch->datagrams[i].len;
+		}
+	}
+
+	return total;
+}
+
+static void
+test_steering (void)
+{
+	const uint16_t port = free_udp_port ();
+	fd_t fds[2];
+	struct fh_quic_batch batch;
+
+	for (size_t i = 0; i < 2; i++)
+		assert ((fds[i] = fh_quic_socket (port)) >= 0);
+
+	assert (fh_quic_attach_steering (fds[0], 2));
+
+	int client = socket (AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in to = {
+		.sin_family = AF_INET,
+		.sin_port = htons (port),
+		.sin_addr.s_addr = htonl (INADDR_LOOPBACK),
+	};
+
+	assert (client >= 0);
+
+	/* Short headers, steered by the first byte of the connection ID */
+	for (uint8_t worker = 0; worker < 2; worker++)
+	{
+		for (int n = 0; n < 4; n++)
+		{
+			uint8_t packet[1 + FH_QUIC_CID_LEN] = { 0x40 };
+
+			assert (fh_quic_generate_cid (packet + 1, FH_QUIC_CID_LEN, worker));
+			assert (sendto (client, packet, sizeof packet, 0,
+							(struct sockaddr *) &to, sizeof to)
+					== sizeof packet);
+		}
+
+		for (size_t i = 0; i < 2; i++)
+		{
+			uint8_t cid_byte = 0xff;
+			size_t total = drain (fds[i], &batch, &cid_byte);
+
+			assert (total == (i == worker ? 4 * (1 + FH_QUIC_CID_LEN) : 0));
+			assert (i != worker || cid_byte == worker);
+		}
+	}
+
+	/* A long header, steered by its destination connection ID as well */
+	const uint8_t initial[] = { 0xc0, 0, 0, 0, 1, 4, 1, 0xee, 0xee, 0xee, 0 };
+
+	assert (sendto (client, initial, sizeof initial, 0, (struct sockaddr *) &to,
+					sizeof to)
+			== sizeof initial);
+	assert (drain (fds[0], &batch, NULL) == 0);
+	assert (drain (fds[1], &batch, NULL) == sizeof initial);
+
+	close (client);
+	close (fds[0]);
+	close (fds[1]);
+}
+
+static void
+test_segmentation (void)
+{
+	const uint16_t port = free_udp_port ();
+	fd_t server = fh_quic_socket (port);
+	fd_t client = fh_quic_socket (free_udp_port ());
+	uint8_t payload[350];
+	struct fh_quic_batch batch = { .count = 2 };
+
+	assert (server >= 0 && client >= 0);
+
+	for (size_t i = 0; i < sizeof payload; i++)
+		payload[i] = (uint8_t) i;
+
+	/* Three full segments and a short one, then a plain datagram */
+	batch.datagrams[0] = (struct fh_quic_datagram) {
+		.data = payload,
+		.len = 350,
+		.segment_size = 100,
+		.remote = {
+			.sin_family = AF_INET,
+			.sin_port = htons (port),
+			.sin_addr.s_addr = htonl (INADDR_LOOPBACK),
+		},
+		.local.s_addr = htonl (INADDR_LOOPBACK),
+	};
+	batch.datagrams[1] = batch.datagrams[0];
+	batch.datagrams[1].len = 20;
+	batch.datagrams[1].segment_size = 0;
+
+	assert (fh_quic_send_batch (client, &batch) == 2);
+
+	struct pollfd pfd = { .fd = server, .events = POLLIN };
+	size_t sizes[8], size_count = 0;
+
+	while (poll (&pfd, 1, 100) > 0)
+	{
+		int count = fh_quic_recv_batch (server, &batch, recv_buf, SLOT_SIZE);
+
+		assert (count >= 0);
+
+		for (int i = 0; i < count; i++)
+		{
+			const struct fh_quic_datagram *datagram = &batch.datagrams[i];
+			size_t step = datagram->segment_size ? datagram->segment_size
+												 : datagram->len;
+
+			/* GRO may or may not have coalesced the segments again */
+			for (size_t off = 0; off < datagram->len; off += step)
+			{
+				size_t len = datagram->len - off < step ? datagram->len - off
+														: step;
+
+				assert (size_count < 8);
+				assert (datagram->data[off] == (uint8_t) ((size_count % 4) * 100));
+				sizes[size_count++] = len;
+			}
+		}
+	}
+
+	assert (size_count == 5);
+	assert (sizes[0] == 100 && sizes[1] == 100 && sizes[2] == 100);
+	assert (sizes[3] == 50 && sizes[4] == 20);
+
+	close (server);
+	close (client);
+}
+
+int
+main (void)
+{
+	test_parse_header ();
+	test_version_negotiation ();
+	test_cid ();
+	test_steering ();
+	test_segmentation ();
+	return 0;
+}
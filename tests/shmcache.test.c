@@ -0,0 +1,193 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#undef NDEBUG
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "mm/shmcache.h"
+
+#define VALUE_MAX 64
+
+static size_t evicted = 0;
+static bool die_in_evict = false;
+
+static void
+count_evicted (const void *key, size_t key_len, const void *value,
+			   size_t value_len)
+{
+	(void) key;
+	(void) key_len;
+	(void) value;
+	(void) value_len;
+
+	if (die_in_evict)
+		_exit (0);
+
+	evicted++;
+}
+
+static bool
+get_str (struct fh_shm_cache *cache, const char *key, char *out, time_t now)
+{
+	size_t len = VALUE_MAX;
+	bool found = fh_shm_cache_get (cache, key, strlen (key), out, &len, now);
+
+	if (found)
+		out[len] = 0;
+
+	return found;
+}
+
+static void
+set_str (struct fh_shm_cache *cache, const char *key, const char *value,
+		 time_t expires)
+{
+	assert (fh_shm_cache_set (cache, key, strlen (key), value,
+							  strlen (value) + 1, expires));
+}
+
+int
+main (void)
+{
+	char buf[VALUE_MAX + 1];
+	struct fh_shm_cache_stats stats;
+
+	assert (fh_shm_cache_create (128, VALUE_MAX) == NULL);
+
+	struct fh_shm_cache *cache = fh_shm_cache_create (64 * 1024, VALUE_MAX);
+	assert (cache != NULL);
+	fh_shm_cache_set_evict_cb (cache, &count_evicted);
+
+	/* Basic operations */
+
+	set_str (cache, "alpha", "one", 100);
+	set_str (cache, "beta", "two", 100);
+	assert (get_str (cache, "alpha", buf, 10) && !strcmp (buf, "one"));
+	assert (get_str (cache, "beta", buf, 10) && !strcmp (buf, "two"));
+	assert (!get_str (cache, "gamma", buf, 10));
+
+	set_str (cache, "alpha", "uno", 100);
+	assert (get_str (cache, "alpha", buf, 10) && !strcmp (buf, "uno"));
+
+	assert (fh_shm_cache_remove (cache, "beta", 4));
+	assert (!fh_shm_cache_remove (cache, "beta", 4));
+	assert (!get_str (cache, "beta", buf, 10));
+
+	/* Oversized keys and values are refused */
+
+	char big[VALUE_MAX + 1] = { 0 };
+	assert (!fh_shm_cache_set (cache, "k", 1, big, sizeof big, 100));
+	assert (!fh_shm_cache_set (cache, big, FH_SHM_CACHE_KEY_MAX + 1, "v", 1, 100));
+
+	/* Expired entries are dropped on lookup */
+
+	set_str (cache, "old", "stale", 50);
+	assert (get_str (cache, "old", buf, 49));
+	assert (!get_str (cache, "old", buf, 50));
+	assert (!get_str (cache, "old", buf, 10));
+	assert (evicted == 1);
+
+	/* Adding only succeeds over a missing or expired entry */
+
+	assert (fh_shm_cache_add (cache, "lock", 4, "a", 2, 20, 10));
+	assert (!fh_shm_cache_add (cache, "lock", 4, "b", 2, 30, 19));
+	assert (get_str (cache, "lock", buf, 19) && !strcmp (buf, "a"));
+	assert (fh_shm_cache_add (cache, "lock", 4, "c", 2, 30, 20));
+	assert (get_str (cache, "lock", buf, 20) && !strcmp (buf, "c"));
+	assert (evicted == 2);
+	assert (fh_shm_cache_remove (cache, "lock", 4));
+	assert (evicted == 2);
+
+	/* Filling the cache evicts least recently used entries */
+
+	fh_shm_cache_get_stats (cache, &stats);
+	const uint64_t capacity = stats.capacity;
+	assert (capacity > 0);
+
+	for (uint64_t i = 0; i < capacity * 4; i++)
+	{
+		char key[32];
+		snprintf (key, sizeof key, "key-%lu", (unsigned long) i);
+
+		set_str (cache, key, key, 1000);
+		assert (get_str (cache, "alpha", buf, 10));
+	}
+
+	fh_shm_cache_get_stats (cache, &stats);
+	assert (stats.entries <= capacity);
+	assert (stats.evictions > 0);
+	assert (evicted == 2 + stats.evictions);
+	assert (get_str (cache, "alpha", buf, 10) && !strcmp (buf, "uno"));
+
+	char last[32];
+	snprintf (last, sizeof last, "key-%lu", (unsigned long) (capacity * 4 - 1));
+	assert (get_str (cache, last, buf, 10) && !strcmp (buf, last));
+	assert (!get_str (cache, "key-0", buf, 10));
+
+	/* Entries are visible across fork() */
+
+	pid_t pid = fork ();
+	assert (pid >= 0);
+
+	if (pid == 0)
+	{
+		set_str (cache, "from-child", "hello", 100);
+		_exit (get_str (cache, "alpha", buf, 10) ? 0 : 1);
+	}
+
+	int status;
+	assert (waitpid (pid, &status, 0) == pid);
+	assert (WIFEXITED (status) && WEXITSTATUS (status) == 0);
+	assert (get_str (cache, "from-child", buf, 10) && !strcmp (buf, "hello"));
+
+	/* A process that dies holding a shard lock gets its entries evicted */
+
+	set_str (cache, "doomed", "x", 50);
+
+	fh_shm_cache_get_stats (cache, &stats);
+	const uint64_t entries = stats.entries;
+	const size_t evicted_before = evicted;
+	pid = fork ();
+	assert (pid >= 0);
+
+	if (pid == 0)
+	{
+		die_in_evict = true;
+		get_str (cache, "doomed", buf, 60);
+		_exit (1);
+	}
+
+	assert (waitpid (pid, &status, 0) == pid);
+	assert (WIFEXITED (status) && WEXITSTATUS (status) == 0);
+	assert (!get_str (cache, "doomed", buf, 10));
+
+	fh_shm_cache_get_stats (cache, &stats);
+	assert (stats.entries > 0 && stats.entries < entries);
+	assert (evicted - evicted_before == entries - stats.entries);
+
+	fh_shm_cache_destroy (cache);
+	return 0;
+}
@@ -0,0 +1,765 @@
+/*
+ * This file is part of OSN freehttpd.
+ *
+ * Copyright (C) 2025  OSN Developers.
+ *
+ * OSN freehttpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OSN freehttpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with OSN freehttpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#undef NDEBUG
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "core/conf.h"
+#include "core/upstream.h"
+#include "http/fastcgi.h"
+#include "http/http1_upstream.h"
+#include "mm/pool.h"
+
+#define S(str) str, sizeof (str) - 1
+
+static void
+test_parse_response_head (void)
+{
+	pool_t *pool = fh_pool_create (0);
+	struct fh_http1_response_head head;
+	const char ok[] = "HTTP/1.1 200 OK\r\n"
+					  "Content-Type: text/plain\r\n"
+					  "Content-Length: 5\r\n"
+					  "\r\n"
+					  "hello";
+
+	assert (pool);
+	assert (fh_http1_parse_response_head (pool, S (ok), &head) == 1);
+	assert (head.status == 200);
+	assert (head.minor_version == 1);
+	assert (head.reason_len == 2 && !memcmp (head.reason, "OK", 2));
+	assert (head.len == sizeof (ok) - 1 - 5);
+	assert (head.headers.count == 2);
+
+	const struct fh_header *length = fh_header_get (&head.headers, S ("content-length"));
+
+	assert (length && length->value_len == 1 && length->value[0] == '5');
+
+	/* Incomplete heads need more data, whatever the cut.  */
+	for (size_t i = 0; i < head.len; i++)
+		assert (fh_http1_parse_response_head (pool, ok, i, &head) == 0);
+
+	assert (fh_http1_parse_response_head (pool, S ("HTTP/1.0 404 \n\n"), &head) == 1);
+	assert (head.status == 404 && head.minor_version == 0 && head.reason_len == 0);
+	assert (fh_http1_parse_response_head (pool, S ("HTTP/1.1 100 Continue\r\n\r\n"), &head) == 1);
+	assert (head.status == 100 && head.headers.count == 0);
+
+	assert (fh_http1_parse_response_head (pool, S ("HTTP/2 200 OK\r\n\r\n"), &head) == -1);
+	assert (fh_http1_parse_response_head (pool, S ("HTTP/1.1 20 OK\r\n\r\n"), &head) == -1);
+	assert (fh_http1_parse_response_head (pool, S ("HTTP/1.1 2000 OK\r\n\r\n"), &head) == -1);
+	assert (fh_http1_parse_response_head (pool, S ("HTTP/1.1 200 OK\r\nNo-Colon\r\n\r\n"), &head) == -1);
+	assert (fh_http1_parse_response_head (pool, S ("HTTP/1.1 200 OK\r\nBad Name: x\r\n\r\n"), &head) == -1);
+	assert (fh_http1_parse_response_head (pool, S ("HTTP/1.1 200 OK\r\nA: b\r\n c\r\n\r\n"), &head) == -1);
+
+	char *big = malloc (HTTP1_UPSTREAM_HEAD_MAX_LEN + 1);
+
+	assert (big);
+	memset (big, 'a', HTTP1_UPSTREAM_HEAD_MAX_LEN + 1);
+	assert (fh_http1_parse_response_head (pool, big, HTTP1_UPSTREAM_HEAD_MAX_LEN + 1, &head) == -1);
+	free (big);
+
+	fh_pool_destroy (pool);
+}
+
+static void
+test_parse_chunk_size (void)
+{
+	uint64_t size;
+	size_t line_len;
+
+	assert (fh_http1_parse_chunk_size (S ("1a\r\n"), &size, &line_len) == 1);
+	assert (size == 0x1a && line_len == 4);
+	assert (fh_http1_parse_chunk_size (S ("FF;name=value\r\nxx"), &size, &line_len) == 1);
+	assert (size == 0xff && line_len == 15);
+	assert (fh_http1_parse_chunk_size (S ("0\n"), &size, &line_len) == 1);
+	assert (size == 0 && line_len == 2);
+
+	assert (fh_http1_parse_chunk_size (S ("1a"), &size, &line_len) == 0);
+	assert (fh_http1_parse_chunk_size (S ("1a\r"), &size, &line_len) == 0);
+	assert (fh_http1_parse_chunk_size (S (""), &size, &line_len) == 0);
+
+	assert (fh_http1_parse_chunk_size (S ("\r\n"), &size, &line_len) == -1);
+	assert (fh_http1_parse_chunk_size (S ("zz\r\n"), &size, &line_len) == -1);
+	assert (fh_http1_parse_chunk_size (S ("1x\r\n"), &size, &line_len) == -1);
+	assert (fh_http1_parse_chunk_size (S ("1000000000000000\r\n"), &size, &line_len) == -1);
+}
+
+static void
+test_parse_cgi_head (void)
+{
+	pool_t *pool = fh_pool_create (0);
+	struct fh_http1_response_head head;
+	const char ok[] = "Content-Type: text/html\r\nX-A: b\r\n\r\nbody";
+
+	assert (pool);
+	assert (fh_http1_parse_cgi_head (pool, S (ok), &head) == 1);
+	assert (head.status == 200 && head.reason_len == 0);
+	assert (head.len == sizeof (ok) - 1 - 4);
+	assert (head.headers.count == 2);
+
+	for (size_t i = 0; i < head.len; i++)
+		assert (fh_http1_parse_cgi_head (pool, ok, i, &head) == 0);
+
+	assert (fh_http1_parse_cgi_head (pool, S ("Status: 404 Not Here\n\n"), &head) == 1);
+	assert (head.status == 404);
+	assert (head.reason_len == 8 && !memcmp (head.reason, "Not Here", 8));
+	assert (fh_http1_parse_cgi_head (pool, S ("Location: /x\r\n\r\n"), &head) == 1);
+	assert (head.status == 302);
+	assert (fh_http1_parse_cgi_head (pool, S ("Status: 301\r\nLocation: /x\r\n\r\n"), &head) == 1);
+	assert (head.status == 301 && head.reason_len == 0);
+	assert (fh_http1_parse_cgi_head (pool, S ("\r\n"), &head) == 1);
+	assert (head.status == 200 && head.headers.count == 0 && head.len == 2);
+
+	assert (fh_http1_parse_cgi_head (pool, S ("Status: 20\r\n\r\n"), &head) == -1);
+	assert (fh_http1_parse_cgi_head (pool, S ("Status: 100\r\n\r\n"), &head) == -1);
+	assert (fh_http1_parse_cgi_head (pool, S ("No-Colon\r\n\r\n"), &head) == -1);
+
+	fh_pool_destroy (pool);
+}
+
+static void
+test_fastcgi (void)
+{
+	uint8_t buf[FH_FCGI_HEADER_LEN + 8];
+	struct fh_fcgi_header header;
+	struct fh_fcgi_end_request end;
+
+	fh_fcgi_encode_header (buf, FH_FCGI_STDOUT, 0x1234, 65535, 7);
+	assert (fh_fcgi_decode_header (buf, &header));
+	assert (header.type == FH_FCGI_STDOUT && header.request_id == 0x1234);
+	assert (header.content_len == 65535 && header.padding_len == 7);
+	buf[0] = 2;
+	assert (!fh_fcgi_decode_header (buf, &header));
+
+	fh_fcgi_encode_begin_request (buf, 1, FH_FCGI_RESPONDER, FH_FCGI_KEEP_CONN);
+	assert (!memcmp (buf, "\1\1\0\1\0\10\0\0\0\1\1\0\0\0\0\0", 16));
+
+	memcpy (buf, "\0\0\1\2\2\0\0\0", 8);
+	fh_fcgi_decode_end_request (buf, &end);
+	assert (end.app_status == 0x102 && end.protocol_status == FH_FCGI_OVERLOADED);
+
+	assert (fh_fcgi_encode_pair_header (buf, 11, 127) == 2);
+	assert (buf[0] == 11 && buf[1] == 127);
+	assert (fh_fcgi_encode_pair_header (buf, 128, 5) == 5);
+	assert (!memcmp (buf, "\x80\0\0\x80\5", 5));
+	assert (fh_fcgi_encode_pair_header (buf, 300, 70000) == FH_FCGI_MAX_PAIR_HEADER_LEN);
+	assert (!memcmp (buf, "\x80\0\1\x2c\x80\1\x11\x70", 8));
+}
+
+/* Appends a record of request 1 to `buf'.  */
+static size_t
+put_record (uint8_t *buf, uint8_t type, const void *content, size_t len,
+			uint8_t padding)
+{
+	fh_fcgi_encode_header (buf, type, 1, (uint16_t) len, padding);
+	memcpy (buf + FH_FCGI_HEADER_LEN, content, len);
+	memset (buf + FH_FCGI_HEADER_LEN + len, 0xee, padding);
+	return FH_FCGI_HEADER_LEN + len + padding;
+}
+
+/* Feeds `buf' to a reader `step' bytes at a time, and gathers what it
+   finds.  Returns the app status of FCGI_END_REQUEST.  */
+static uint32_t
+read_records (const uint8_t *buf, size_t len, size_t step, size_t stdout_max,
+			  char *out, size_t *out_len, char *err, size_t *err_len)
+{
+	struct fh_fcgi_reader reader;
+	struct fh_fcgi_chunk chunk;
+	uint32_t app_status = UINT32_MAX;
+
+	fh_fcgi_reader_init (&reader, 1);
+	*out_len = *err_len = 0;
+
+	for (size_t off = 0; off < len; off += step)
+	{
+		const uint8_t *data = buf + off;
+		size_t left = len - off < step ? len - off : step;
+		int rc;
+
+		while ((rc = fh_fcgi_read (&reader, &data, &left, stdout_max, &chunk))
+			   == 1)
+		{
+			assert (app_status == UINT32_MAX);
+
+			switch (chunk.type)
+			{
+				case FH_FCGI_STDOUT:
+					assert (chunk.len > 0 && chunk.len <= stdout_max);
+					memcpy (out + *out_len, chunk.data, chunk.len);
+					*out_len += chunk.len;
+					break;
+
+				case FH_FCGI_STDERR:
+					assert (chunk.len > 0);
+					memcpy (err + *err_len, chunk.data, chunk.len);
+					*err_len += chunk.len;
+					break;
+
+				case FH_FCGI_END_REQUEST:
+					assert (chunk.end.protocol_status == FH_FCGI_REQUEST_COMPLETE);
+					app_status = chunk.end.app_status;
+					break;
+
+				default:
+					assert (false);
+			}
+		}
+
+		assert (rc == 0 && left == 0);
+	}
+
+	return app_status;
+}
+
+static void
+test_fastcgi_reader (void)
+{
+	static const char head[] = "Status: 404 Not Found\r\n"
+							   "Content-Type: text/plain\r\n"
+							   "\r\n";
+	static const char response[] = "Status: 404 Not Found\r\n"
+								   "Content-Type: text/plain\r\n"
+								   "\r\n"
+								   "not found";
+	uint8_t buf[512];
+	char out[256], err[64];
+	size_t len = 0, out_len, err_len;
+
+	/* The head and the start of the body share a record, and the rest of
+	   the body comes after some stderr output */
+	len += put_record (buf + len, FH_FCGI_STDOUT, S ("Status: 404 Not Found\r\nContent-"), 5);
+	len += put_record (buf + len, FH_FCGI_STDOUT, S ("Type: text/plain\r\n\r\nnot "), 0);
+	len += put_record (buf + len, FH_FCGI_STDERR, S ("PHP Notice: oops"), 7);
+	len += put_record (buf + len, FH_FCGI_PARAMS, S ("ignored"), 1);
+	len += put_record (buf + len, FH_FCGI_STDOUT, S ("found"), 3);
+	len += put_record (buf + len, FH_FCGI_STDOUT, NULL, 0, 0);
+	len += put_record (buf + len, FH_FCGI_STDERR, NULL, 0, 0);
+	len += put_record (buf + len, FH_FCGI_END_REQUEST, S ("\0\0\1\2\0\0\0\0"), 0);
+
+	/* However the records are split up */
+	for (size_t step = 1; step <= len; step++)
+	{
+		assert (read_records (buf, len, step, SIZE_MAX, out, &out_len, err,
+							  &err_len)
+				== 0x102);
+		assert (out_len == sizeof (response) - 1);
+		assert (!memcmp (out, response, out_len));
+		assert (err_len == 16 && !memcmp (err, "PHP Notice: oops", 16));
+	}
+
+	/* Content is handed out as far as there is room for it */
+	assert (read_records (buf, len, len, 4, out, &out_len, err, &err_len)
+			== 0x102);
+	assert (out_len == sizeof (response) - 1);
+
+	pool_t *pool = fh_pool_create (0);
+	struct fh_http1_response_head parsed;
+
+	assert (pool);
+	assert (fh_http1_parse_cgi_head (pool, out, out_len, &parsed) == 1);
+	assert (parsed.status == 404 && parsed.len == sizeof (head) - 1);
+	assert (out_len - parsed.len == 9 && !memcmp (out + parsed.len, "not found", 9));
+	fh_pool_destroy (pool);
+
+	/* A full head gets no more */
+	struct fh_fcgi_reader reader;
+	struct fh_fcgi_chunk chunk;
+	const uint8_t *data = buf;
+	size_t left = len;
+
+	fh_fcgi_reader_init (&reader, 1);
+	assert (fh_fcgi_read (&reader, &data, &left, 0, &chunk) == 1);
+	assert (chunk.type == FH_FCGI_STDOUT && chunk.len == 0);
+
+	/* Records of other requests, and FCGI_END_REQUEST of the wrong size */
+	uint8_t bad[32];
+
+	fh_fcgi_encode_header (bad, FH_FCGI_STDOUT, 2, 0, 0);
+	data = bad;
+	left = FH_FCGI_HEADER_LEN;
+	fh_fcgi_reader_init (&reader, 1);
+	assert (fh_fcgi_read (&reader, &data, &left, SIZE_MAX, &chunk) == -1);
+
+	fh_fcgi_encode_header (bad, FH_FCGI_END_REQUEST, 1, 4, 0);
+	data = bad;
+	left = FH_FCGI_HEADER_LEN;
+	fh_fcgi_reader_init (&reader, 1);
+	assert (fh_fcgi_read (&reader, &data, &left, SIZE_MAX, &chunk) == -1);
+
+	/* The request may end without a response */
+	len = put_record (bad, FH_FCGI_END_REQUEST, S ("\0\0\0\0\2\0\0\0"), 0);
+	data = bad;
+	left = len;
+	fh_fcgi_reader_init (&reader, 1);
+	assert (fh_fcgi_read (&reader, &data, &left, SIZE_MAX, &chunk) == 1);
+	assert (chunk.type == FH_FCGI_END_REQUEST && !left);
+	assert (chunk.end.app_status == 0);
+	assert (chunk.end.protocol_status == FH_FCGI_OVERLOADED);
+}
+
+static void
+test_resolve (void)
+{
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+
+	assert (fh_upstream_resolve ("127.0.0.1:9000", &addr, &addr_len));
+	assert (addr.ss_family == AF_INET && addr_len == sizeof (struct sockaddr_in));
+
+	const struct sockaddr_in *in = (const struct sockaddr_in *) &addr;
+
+	assert (ntohs (in->sin_port) == 9000);
+	assert (ntohl (in->sin_addr.s_addr) == INADDR_LOOPBACK);
+
+	assert (fh_upstream_resolve ("[::1]:8080", &addr, &addr_len));
+	assert (addr.ss_family == AF_INET6);
+	assert (ntohs (((const struct sockaddr_in6 *) &addr)->sin6_port) == 8080);
+
+	assert (fh_upstream_resolve ("unix:/run/app.sock", &addr, &addr_len));
+	assert (addr.ss_family == AF_UNIX);
+	assert (!strcmp (((const struct sockaddr_un *) &addr)->sun_path, "/run/app.sock"));
+
+	assert (!fh_upstream_resolve ("127.0.0.1", &addr, &addr_len));
+	assert (!fh_upstream_resolve ("127.0.0.1:", &addr, &addr_len));
+	assert (!fh_upstream_resolve (":80", &addr, &addr_len));
+	assert (!fh_upstream_resolve ("127.0.0.1:http", &addr, &addr_len));
+	assert (!fh_upstream_resolve ("unix:", &addr, &addr_len));
+}
+
+static uint32_t last_events;
+static size_t event_count;
+
+static void
+on_event (void *data, uint32_t events)
+{
+	assert (data == &last_events);
+	last_events = events;
+	event_count++;
+}
+
+/* Waits for the next event on an upstream connection.  */
+static void
+poll_once (struct fh_upstreams *upstreams)
+{
+	xevent_t events[4];
+	int n = xpoll_wait (upstreams->xpoll_fd, events, 4, 1000);
+
+	assert (n > 0);
+
+	for (int i = 0; i < n; i++)
+		assert (fh_upstream_handle_event (upstreams, events[i].data.fd, events[i].events));
+}
+
+static void
+test_pool (void)
+{
+	fd_t listen_fd = socket (AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl (INADDR_LOOPBACK),
+	};
+	socklen_t addr_len = sizeof addr;
+
+	assert (listen_fd >= 0);
+	assert (!bind (listen_fd, (struct sockaddr *) &addr, sizeof addr));
+	assert (!listen (listen_fd, 4));
+	assert (!getsockname (listen_fd, (struct sockaddr *) &addr, &addr_len));
+
+	struct fh_config_upstream upstream_configs[2] = {
+		{ .name = "first" },
+		{ .name = "second" },
+	};
+
+	for (size_t i = 0; i < 2; i++)
+	{
+		memcpy (&upstream_configs[i].addr, &addr, sizeof addr);
+		upstream_configs[i].addr_len = addr_len;
+	}
+
+	struct fh_config_proxy proxy_config = {
+		.path = "/",
+		.path_len = 1,
+		.upstreams = upstream_configs,
+		.upstream_count = 2,
+		.keepalive = 1,
+	};
+
+	struct fh_upstreams *upstreams = fh_upstreams_create (xpoll_create ());
+
+	assert (upstreams);
+
+	struct fh_upstream_group *group = fh_upstream_group_get (upstreams, &proxy_config);
+
+	assert (group && group->peer_count == 2);
+	assert (fh_upstream_group_get (upstreams, &proxy_config) == group);
+	assert (fh_upstream_pick (group, NULL, 0) == &group->peers[0]);
+	assert (fh_upstream_pick (group, NULL, 0) == &group->peers[1]);
+
+	struct fh_upstream_peer *peer = fh_upstream_pick (group, NULL, 0);
+
+	assert (peer == &group->peers[0]);
+	assert (!fh_upstream_handle_event (upstreams, listen_fd, XPOLLIN));
+
+	/* A new connection reports when it is writable.  */
+	struct fh_upstream_conn *conn = fh_upstream_acquire (upstreams, peer, on_event, &last_events);
+
+	assert (conn && conn->peer == peer && !conn->idle);
+
+	fd_t server_fd = accept (listen_fd, NULL, NULL);
+
+	assert (server_fd >= 0);
+
+	while (!conn->connected)
+		poll_once (upstreams);
+
+	assert (event_count > 0 && (last_events & XPOLLOUT));
+	assert (!(last_events & XPOLLERR));
+
+	/* Released connections are handed out again, up to the keep-alive
+	   limit.  */
+	fd_t sockfd = conn->sockfd;
+
+	fh_upstream_release (upstreams, conn, true);
+	assert (peer->idle_count == 1 && peer->idle_head == conn && conn->idle);
+	assert (conn->requests == 1);
+
+	conn = fh_upstream_acquire (upstreams, peer, on_event, &last_events);
+	assert (conn && conn->sockfd == sockfd && !conn->idle);
+	assert (peer->idle_count == 0 && !peer->idle_head);
+
+	struct fh_upstream_conn *other = fh_upstream_acquire (upstreams, peer, on_event, &last_events);
+	fd_t other_server_fd = accept (listen_fd, NULL, NULL);
+
+	assert (other && other != conn && other_server_fd >= 0);
+
+	while (!other->connected)
+		poll_once (upstreams);
+
+	fh_upstream_release (upstreams, conn, true);
+	fh_upstream_release (upstreams, other, true);
+	assert (peer->idle_count == 1 && peer->idle_head == conn);
+
+	/* An idle connection that the server closes leaves the pool.  */
+	event_count = 0;
+	close (server_fd);
+
+	while (peer->idle_count)
+		poll_once (upstreams);
+
+	assert (!event_count);
+	assert (!peer->idle_head);
+
+	/* Connection failures come as XPOLLERR events.  */
+	close (listen_fd);
+	close (other_server_fd);
+
+	conn = fh_upstream_acquire (upstreams, peer, on_event, &last_events);
+
+	if (conn)
+	{
+		last_events = 0;
+
+		while (!(last_events & XPOLLERR))
+			poll_once (upstreams);
+
+		assert (!conn->connected);
+		fh_upstream_release (upstreams, conn, true);
+		assert (!peer->idle_count);
+	}
+
+	xpoll_t xpoll_fd = upstreams->xpoll_fd;
+
+	fh_upstreams_destroy (upstreams);
+	xpoll_destroy (xpoll_fd);
+}
+
+static void
+test_balance (void)
+{
+	struct fh_config_upstream upstream_configs[4] = {
+		{ .name = "a" }, { .name = "b" }, { .name = "c" }, { .name = "d" },
+	};
+	struct fh_config_proxy proxy_config = {
+		.path = "/",
+		.path_len = 1,
+		.upstreams = upstream_configs,
+		.upstream_count = 4,
+		.balance = FH_UPSTREAM_BALANCE_LEAST_CONN,
+		.max_fails = 2,
+		.fail_timeout = 1,
+	};
+	struct fh_upstreams *upstreams = fh_upstreams_create (xpoll_create ());
+
+	assert (upstreams);
+
+	struct fh_upstream_group *group = fh_upstream_group_get (upstreams, &proxy_config);
+	struct fh_upstream_peer *peers = group->peers;
+
+	assert (group);
+
+	/* Least outstanding requests */
+	for (size_t i = 0; i < 4; i++)
+		assert (peers[i].state == &peers[i].local_state);
+
+	fh_upstream_begin (&peers[0]);
+	fh_upstream_begin (&peers[1]);
+	fh_upstream_begin (&peers[3]);
+
+	for (size_t i = 0; i < 8; i++)
+		assert (fh_upstream_pick (group, NULL, 0) == &peers[2]);
+
+	fh_upstream_begin (&peers[2]);
+	fh_upstream_begin (&peers[2]);
+	fh_upstream_end (&peers[1]);
+	assert (fh_upstream_pick (group, NULL, 0) == &peers[1]);
+
+	for (size_t i = 0; i < 4; i++)
+	{
+		while (fh_upstream_outstanding (&peers[i]))
+			fh_upstream_end (&peers[i]);
+	}
+
+	/* Peak-EWMA latency, weighted by the requests in flight */
+	proxy_config.balance = FH_UPSTREAM_BALANCE_EWMA;
+	fh_upstream_report (group, &peers[0], true, 4000);
+	fh_upstream_report (group, &peers[1], true, 1000);
+	fh_upstream_report (group, &peers[2], true, 3000);
+	fh_upstream_report (group, &peers[3], true, 2000);
+
+	for (size_t i = 0; i < 8; i++)
+		assert (fh_upstream_pick (group, NULL, 0) == &peers[1]);
+
+	fh_upstream_begin (&peers[1]);
+	fh_upstream_begin (&peers[1]);
+	assert (fh_upstream_pick (group, NULL, 0) == &peers[3]);
+	fh_upstream_end (&peers[1]);
+	fh_upstream_end (&peers[1]);
+
+	/* A slow answer counts in full, a fast one only moves the average.  */
+	fh_upstream_report (group, &peers[1], true, 9000);
+	assert (peers[1].state->latency == 9000);
+	assert (fh_upstream_pick (group, NULL, 0) == &peers[3]);
+	fh_upstream_report (group, &peers[1], true, 10);
+	assert (peers[1].state->latency > 10 && peers[1].state->latency <= 9000);
+
+	/* Consistent hashing sticks to a server per key and spreads keys.  */
+	proxy_config.balance = FH_UPSTREAM_BALANCE_HASH;
+
+	size_t hits[4] = { 0 };
+	struct fh_upstream_peer *chosen[256];
+
+	for (size_t i = 0; i < 256; i++)
+	{
+		char key[16];
+		int len = snprintf (key, sizeof key, "/item/%zu", i);
+
+		chosen[i] = fh_upstream_pick (group, key, (size_t) len);
+		assert (chosen[i] == fh_upstream_pick (group, key, (size_t) len));
+		hits[chosen[i] - peers]++;
+	}
+
+	for (size_t i = 0; i < 4; i++)
+		assert (hits[i] > 32);
+
+	/* Failures in a row eject a server, and its keys move elsewhere while
+	   the others stay put.  */
+	fh_upstream_report (group, &peers[2], false, 0);
+	assert (fh_upstream_pick (group, S ("/item/x")) != NULL);
+	assert (!peers[2].state->ejected_until);
+	fh_upstream_report (group, &peers[2], false, 0);
+	assert (peers[2].state->ejected_until);
+	assert (peers[2].state->ejections == 1);
+
+	uint64_t now_ms = fh_upstream_clock () / 1000;
+
+	assert (peers[2].state->ejected_until - now_ms <= 1000);
+
+	for (size_t i = 0; i < 256; i++)
+	{
+		char key[16];
+		int len = snprintf (key, sizeof key, "/item/%zu", i);
+		struct fh_upstream_peer *peer = fh_upstream_pick (group, key, (size_t) len);
+
+		assert (peer != &peers[2]);
+		assert (chosen[i] == &peers[2] || peer == chosen[i]);
+	}
+
+	/* Another failure while ejected does not extend the ejection.  */
+	uint64_t until = peers[2].state->ejected_until;
+
+	fh_upstream_report (group, &peers[2], false, 0);
+	assert (peers[2].state->ejected_until == until);
+
+	/* Once the period is over, a failure ejects it for twice as long.  */
+	peers[2].state->ejected_until = 1;
+	fh_upstream_report (group, &peers[2], false, 0);
+	now_ms = fh_upstream_clock () / 1000;
+	assert (peers[2].state->ejections == 2);
+	assert (peers[2].state->ejected_until - now_ms > 1000);
+	assert (peers[2].state->ejected_until - now_ms <= 2000);
+
+	/* A success brings it back for good.  */
+	peers[2].state->ejected_until = 1;
+	fh_upstream_report (group, &peers[2], true, 100);
+	assert (!peers[2].state->fails && !peers[2].state->ejections);
+
+	/* With every server ejected, one is used anyway.  */
+	proxy_config.balance = FH_UPSTREAM_BALANCE_ROUND_ROBIN;
+
+	for (size_t i = 0; i < 4; i++)
+		peers[i].state->ejected_until = UINT64_MAX;
+
+	assert (fh_upstream_pick (group, NULL, 0));
+
+	peers[1].state->ejected_until = 0;
+
+	for (size_t i = 0; i < 4; i++)
+		assert (fh_upstream_pick (group, NULL, 0) == &peers[1]);
+
+	xpoll_t xpoll_fd = upstreams->xpoll_fd;
+
+	fh_upstreams_destroy (upstreams);
+	xpoll_destroy (xpoll_fd);
+}
+
+/* Runs `fn' in a worker of the given slot, which exits without ending
+   the requests it began.  */
+static void
+run_worker (size_t worker_index, struct fh_upstream_peer *peer,
+			int (*fn) (struct fh_upstream_peer *peer))
+{
+	int status;
+	pid_t pid = fork ();
+
+	assert (pid >= 0);
+
+	if (!pid)
+	{
+		fh_upstream_attach (worker_index);
+		_exit (fn (peer));
+	}
+
+	assert (waitpid (pid, &status, 0) == pid);
+	assert (WIFEXITED (status) && !WEXITSTATUS (status));
+}
+
+static int
+crash_with_requests (struct fh_upstream_peer *peer)
+{
+	fh_upstream_begin (peer);
+	fh_upstream_begin (peer);
+	fh_upstream_begin (peer);
+	return fh_upstream_outstanding (peer) == 5 ? 0 : 1;
+}
+
+static int
+respawn_and_count (struct fh_upstream_peer *peer)
+{
+	return fh_upstream_outstanding (peer) == 2 ? 0 : 1;
+}
+
+static void
+test_shared_outstanding (void)
+{
+	struct fh_config_upstream upstream_configs[2] = {
+		{ .name = "a" }, { .name = "b" },
+	};
+	struct fh_config_proxy proxy_config = {
+		.path = "/",
+		.path_len = 1,
+		.upstreams = upstream_configs,
+		.upstream_count = 2,
+		.balance = FH_UPSTREAM_BALANCE_LEAST_CONN,
+	};
+	struct fh_config_host host = { .proxies = &proxy_config };
+	struct strtable_entry entry = { .key = "localhost", .data = &host };
+	struct strtable hosts = { .count = 1, .head = &entry, .tail = &entry };
+	struct fh_config config = { .hosts = &hosts };
+
+	assert (fh_upstream_shared_init (&config, 3));
+	fh_upstream_attach (0);
+
+	struct fh_upstreams *upstreams = fh_upstreams_create (xpoll_create ());
+
+	assert (upstreams);
+
+	struct fh_upstream_group *group = fh_upstream_group_get (upstreams, &proxy_config);
+	struct fh_upstream_peer *peers = group->peers;
+
+	assert (peers[0].state == upstream_configs[0].state);
+	assert (peers[0].state != &peers[0].local_state);
+
+	fh_upstream_begin (&peers[0]);
+	fh_upstream_begin (&peers[0]);
+	assert (fh_upstream_outstanding (&peers[0]) == 2);
+
+	/* The requests of a worker that died are still counted... */
+	run_worker (1, &peers[0], crash_with_requests);
+	assert (fh_upstream_outstanding (&peers[0]) == 5);
+	assert (fh_upstream_pick (group, NULL, 0) == &peers[1]);
+
+	/* ...until a worker is started in its slot, or the master forgets
+	   them */
+	run_worker (1, &peers[0], respawn_and_count);
+	assert (fh_upstream_outstanding (&peers[0]) == 2);
+
+	run_worker (2, &peers[0], crash_with_requests);
+	assert (fh_upstream_outstanding (&peers[0]) == 5);
+	fh_upstream_forget (2);
+	assert (fh_upstream_outstanding (&peers[0]) == 2);
+	assert (!fh_upstream_outstanding (&peers[1]));
+
+	fh_upstream_end (&peers[0]);
+	fh_upstream_end (&peers[0]);
+	assert (!fh_upstream_outstanding (&peers[0]));
+	assert (peers[0].state->requests == 8);
+
+	xpoll_t xpoll_fd = upstreams->xpoll_fd;
+
+	fh_upstreams_destroy (upstreams);
+	xpoll_destroy (xpoll_fd);
+	fh_upstream_shared_destroy ();
+}
+
+int
+main (void)
+{
+	test_parse_response_head ();
+	test_parse_chunk_size ();
+	test_parse_cgi_head ();
+	test_fastcgi ();
+	test_fastcgi_reader ();
+	test_resolve ();
+	test_pool ();
+	test_balance ();
+	test_shared_outstanding ();
+
+	return 0;
+}
@@ -21,6 +21,9 @@ if [ -z "$BINDIR" ]; then
     BINDIR=../build/bin
 fi
 
+FHBENCH=${FHBENCH:-./fhbench}
+BENCH_URL=${BENCH_URL:-http://localhost:8080}
+
 valgrind \
     -s \
     --leak-check=full \
@@ -48,7 +51,7 @@ if ! kill -0 "$pid" > /dev/null; then
 	exit 1
 fi
 
-siege -b -c 50 -t 10s --no-parser http://127.0.0.1:8080/
+"$FHBENCH" -c 50 -d 10 "$BENCH_URL/" > bench-valgrind.json
 
 if [ $? -ne 0 ]; then
     echo "Benchmark failed"